@@ -0,0 +1,225 @@
+/*
+ * Copyright (c) 2012 Scott Tincman <sctincman@gmail.com>. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Decode throughput of whole streams through the driver, and the slice data
+ * it copies on the way in. Every stream is decoded twice, once with the
+ * default copy into driver storage and once with the zero-copy slice data
+ * attribute (VAConfigAttribEpiphanyZeroCopySliceData).
+ *
+ * Streams ending in .264 are H.264, in .vc1 or .rcv VC-1 (an RCV file or an
+ * Advanced profile elementary stream), anything else is MPEG-2 video. Each
+ * row names the VA profile the stream decoded with, and a summary of the
+ * copying runs gives the frames per second of every profile over all its
+ * streams. test/streams/fetch-vc1.sh downloads a VC-1 stream per profile.
+ *
+ * usage: decode_bench stream.m2v|stream.264|stream.vc1 ...
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "epiphany_drv_video.h"
+#include "va_client.h"
+#include "h264_stream.h"
+#include "mpeg2_stream.h"
+#include "vc1_stream.h"
+
+#define BENCH_MAX_PROFILES      32
+
+struct bench_result {
+    VAProfile profile;
+    int pictures;
+    double seconds;
+    unsigned long long bytes_copied;
+    unsigned long long bytes_wrapped;
+};
+
+typedef int (*bench_stream_decode)(struct va_decoder *decoder, const uint8_t *data, size_t size);
+
+/* Pictures and time of the copying runs of all streams of one profile */
+struct bench_profile_total {
+    VAProfile profile;
+    int pictures;
+    double seconds;
+};
+
+static const char *
+bench_profile_name(VAProfile profile)
+{
+    switch (profile) {
+    case VAProfileMPEG2Simple:
+        return "MPEG2Simple";
+    case VAProfileMPEG2Main:
+        return "MPEG2Main";
+    case VAProfileH264Baseline:
+        return "H264Baseline";
+    case VAProfileH264Main:
+        return "H264Main";
+    case VAProfileH264High:
+        return "H264High";
+    case VAProfileVC1Simple:
+        return "VC1Simple";
+    case VAProfileVC1Main:
+        return "VC1Main";
+    case VAProfileVC1Advanced:
+        return "VC1Advanced";
+    default:
+        return "unknown";
+    }
+}
+
+static bench_stream_decode
+bench_stream_decoder(const char *path)
+{
+    const char *ext = strrchr(path, '.');
+
+    if (NULL == ext) {
+        return mpeg2_stream_decode;
+    }
+    if (!strcmp(ext, ".264")) {
+        return h264_stream_decode;
+    }
+    if (!strcmp(ext, ".vc1") || !strcmp(ext, ".rcv")) {
+        return vc1_stream_decode;
+    }
+    return mpeg2_stream_decode;
+}
+
+static const char *
+bench_basename(const char *path)
+{
+    const char *slash = strrchr(path, '/');
+
+    return slash ? slash + 1 : path;
+}
+
+/*
+ * Decodes a stream on a fresh driver instance, so that the driver counters
+ * only cover this stream
+ * Return 0 on success, -1 on error
+ */
+static int
+bench_decode(bench_stream_decode decode, const uint8_t *data, size_t size, int zero_copy,
+             struct bench_result *result)
+{
+    struct epiphany_driver_data *driver_data;
+    struct va_client client;
+    struct va_decoder decoder;
+    double start;
+    int ret;
+
+    if (va_client_open(&client)) {
+        fprintf(stderr, "cannot initialize the driver\n");
+        return -1;
+    }
+    va_decoder_init(&decoder, &client);
+    va_decoder_set_attrib(&decoder, VAConfigAttribEpiphanyZeroCopySliceData, zero_copy);
+
+    start = va_client_now();
+    ret = decode(&decoder, data, size);
+    result->seconds = va_client_now() - start;
+
+    driver_data = (struct epiphany_driver_data *) client.ctx->pDriverData;
+    result->profile = decoder.profile;
+    result->pictures = decoder.num_pictures;
+    result->bytes_copied = driver_data->bytes_copied;
+    result->bytes_wrapped = driver_data->bytes_wrapped;
+
+    va_decoder_stop(&decoder);
+    va_client_close(&client);
+    return ret;
+}
+
+/* Adds a copying run to the total of its profile */
+static void
+bench_add_total(struct bench_profile_total *totals, int *num_totals, const struct bench_result *result)
+{
+    int i;
+
+    for (i = 0; (i < *num_totals) && (totals[i].profile != result->profile); i++) {
+    }
+    if (i == *num_totals) {
+        if (BENCH_MAX_PROFILES == *num_totals) {
+            return;
+        }
+        totals[i].profile = result->profile;
+        totals[i].pictures = 0;
+        totals[i].seconds = 0;
+        (*num_totals)++;
+    }
+    totals[i].pictures += result->pictures;
+    totals[i].seconds += result->seconds;
+}
+
+int
+main(int argc, char **argv)
+{
+    struct bench_profile_total totals[BENCH_MAX_PROFILES];
+    struct bench_result result;
+    bench_stream_decode decode;
+    uint8_t *data;
+    size_t size;
+    int i, zero_copy, num_totals = 0, ret = 0;
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s stream.m2v|stream.264|stream.vc1 ...\n", argv[0]);
+        return 1;
+    }
+
+    printf("%-24s %-12s %-9s %8s %8s %14s %14s\n", "stream", "profile", "slices", "pictures", "fps",
+           "copied/picture", "wrapped/picture");
+    for (i = 1; i < argc; i++) {
+        data = va_client_load(argv[i], &size);
+        if (NULL == data) {
+            fprintf(stderr, "cannot read %s\n", argv[i]);
+            ret = 1;
+            continue;
+        }
+        decode = bench_stream_decoder(argv[i]);
+        for (zero_copy = 0; zero_copy < 2; zero_copy++) {
+            if (bench_decode(decode, data, size, zero_copy, &result) || (0 == result.pictures)) {
+                fprintf(stderr, "%s: decoding failed\n", argv[i]);
+                ret = 1;
+                break;
+            }
+            printf("%-24s %-12s %-9s %8d %8.1f %14llu %14llu\n", bench_basename(argv[i]),
+                   bench_profile_name(result.profile), zero_copy ? "zero-copy" : "copied", result.pictures,
+                   result.pictures / result.seconds, result.bytes_copied / result.pictures,
+                   result.bytes_wrapped / result.pictures);
+            if (!zero_copy) {
+                bench_add_total(totals, &num_totals, &result);
+            }
+        }
+        free(data);
+    }
+
+    printf("\n%-12s %8s %8s\n", "profile", "pictures", "fps");
+    for (i = 0; i < num_totals; i++) {
+        printf("%-12s %8d %8.1f\n", bench_profile_name(totals[i].profile), totals[i].pictures,
+               totals[i].pictures / totals[i].seconds);
+    }
+    return ret;
+}
@@ -0,0 +1,250 @@
+/*
+ * Copyright (c) 2012 Scott Tincman <sctincman@gmail.com>. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Throughput of the image_convert kernels.
+ *
+ * Copies whole 1080p and 4K frames between NV12 and every other format
+ * vaGetImage()/vaPutImage() handle, with each kernel table this build and
+ * CPU support. Rates are in GB/s of frame data read plus written.
+ *
+ * usage: image_convert_bench [kernels ...]   (default: c sse2 avx2 neon)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <va/va.h>
+#include "image_convert.h"
+
+#define BENCH_MIN_SECONDS       0.25    /* Per kernel, format pair and size */
+#define BENCH_MAX_KERNELS       4
+
+struct bench_size {
+    int width;
+    int height;
+};
+
+struct bench_image {
+    struct image_planes planes;
+    uint8_t *buffer;
+    size_t size;                /* Bytes of frame data, without padding */
+};
+
+static const struct bench_size bench_sizes[] = {
+    { 1920, 1080 },
+    { 3840, 2160 },
+};
+
+static const unsigned int bench_formats[] = {
+    VA_FOURCC_NV12,
+    VA_FOURCC_I420,
+    VA_FOURCC_YV12,
+    VA_FOURCC_YUY2,
+    VA_FOURCC_BGRA,
+};
+
+static double
+bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static const char *
+bench_fourcc_name(unsigned int fourcc, char *name)
+{
+    memcpy(name, &fourcc, 4);
+    name[4] = '\0';
+    return name;
+}
+
+/*
+ * Allocates a width x height image of the given fourcc, with 64-byte
+ * aligned planes and pitches, filled with a gradient
+ * Return 0 on success, -1 on error
+ */
+static int
+bench_image_init(struct bench_image *image, unsigned int fourcc, int width, int height)
+{
+    unsigned int pitch[3] = { 0, 0, 0 };
+    unsigned int lines[3] = { 0, 0, 0 };
+    size_t offset = 0, i;
+    int p, num_planes;
+
+    switch (fourcc) {
+    case VA_FOURCC_NV12:
+        num_planes = 2;
+        pitch[0] = pitch[1] = width;
+        lines[0] = height;
+        lines[1] = height / 2;
+        break;
+    case VA_FOURCC_I420:
+    case VA_FOURCC_YV12:
+        num_planes = 3;
+        pitch[0] = width;
+        pitch[1] = pitch[2] = width / 2;
+        lines[0] = height;
+        lines[1] = lines[2] = height / 2;
+        break;
+    case VA_FOURCC_YUY2:
+        num_planes = 1;
+        pitch[0] = width * 2;
+        lines[0] = height;
+        break;
+    case VA_FOURCC_BGRA:
+        num_planes = 1;
+        pitch[0] = width * 4;
+        lines[0] = height;
+        break;
+    default:
+        return -1;
+    }
+
+    memset(&image->planes, 0, sizeof(image->planes));
+    image->planes.fourcc = fourcc;
+    image->size = 0;
+    for (p = 0; p < num_planes; p++) {
+        image->size += (size_t)pitch[p] * lines[p];
+        pitch[p] = (pitch[p] + 63) & ~63;
+    }
+    image->buffer = NULL;
+    for (p = 0; p < num_planes; p++) {
+        offset += (size_t)pitch[p] * lines[p];
+    }
+    if (posix_memalign((void **)&image->buffer, 64, offset)) {
+        return -1;
+    }
+    for (i = 0; i < offset; i++) {
+        image->buffer[i] = (i * 7 + (i >> 12)) & 0xff;
+    }
+    offset = 0;
+    for (p = 0; p < num_planes; p++) {
+        image->planes.data[p] = image->buffer + offset;
+        image->planes.pitch[p] = pitch[p];
+        offset += (size_t)pitch[p] * lines[p];
+    }
+    return 0;
+}
+
+/*
+ * Returns the GB/s of whole-frame copies from src to dst
+ */
+static double
+bench_convert(const struct image_convert_ops *ops, const struct bench_image *src,
+              const struct bench_image *dst, const struct bench_size *size)
+{
+    double start, elapsed;
+    int frames = 0;
+
+    /* One untimed frame to fault the pages in */
+    image_convert_copy(ops, &src->planes, 0, 0, &dst->planes, 0, 0, size->width, size->height);
+    start = bench_now();
+    do {
+        image_convert_copy(ops, &src->planes, 0, 0, &dst->planes, 0, 0, size->width, size->height);
+        frames++;
+        elapsed = bench_now() - start;
+    } while (elapsed < BENCH_MIN_SECONDS);
+    return (double)(src->size + dst->size) * frames / elapsed * 1e-9;
+}
+
+int
+main(int argc, char **argv)
+{
+    static const char *default_kernels[] = { "c", "sse2", "avx2", "neon" };
+    const struct image_convert_ops *kernels[BENCH_MAX_KERNELS];
+    struct bench_image images[sizeof(bench_formats) / sizeof(bench_formats[0]) + 1];
+    const int num_formats = sizeof(bench_formats) / sizeof(bench_formats[0]);
+    const char **names = default_kernels;
+    int num_names = BENCH_MAX_KERNELS;
+    int num_kernels = 0;
+    unsigned int s;
+    int i, f, k, dir;
+    char name0[5], name1[5];
+
+    if (argc > 1) {
+        names = (const char **)argv + 1;
+        num_names = argc - 1;
+    }
+    for (i = 0; i < num_names && num_kernels < BENCH_MAX_KERNELS; i++) {
+        const struct image_convert_ops *ops = image_convert_get_ops(names[i]);
+
+        /* image_convert_get_ops() falls back to the best kernels */
+        if (strcmp(ops->name, names[i])) {
+            printf("%s kernels not built or not supported by this CPU, skipped\n", names[i]);
+            continue;
+        }
+        kernels[num_kernels++] = ops;
+    }
+    if (!num_kernels) {
+        fprintf(stderr, "usage: %s [c|sse2|avx2|neon ...]\n", argv[0]);
+        return 1;
+    }
+
+    for (s = 0; s < sizeof(bench_sizes) / sizeof(bench_sizes[0]); s++) {
+        const struct bench_size *size = &bench_sizes[s];
+
+        /* The last image is a second NV12 one, the target of NV12 -> NV12 */
+        for (f = 0; f <= num_formats; f++) {
+            if (bench_image_init(&images[f], bench_formats[f % num_formats], size->width, size->height)) {
+                fprintf(stderr, "out of memory\n");
+                return 1;
+            }
+        }
+
+        printf("%dx%d, GB/s read + written\n", size->width, size->height);
+        printf("  conversion  ");
+        for (k = 0; k < num_kernels; k++) {
+            printf("  %6s", kernels[k]->name);
+        }
+        printf("\n");
+
+        /* images[0] is NV12, copy it to and from every format */
+        for (f = 0; f < num_formats; f++) {
+            for (dir = 0; dir < 2; dir++) {
+                const struct bench_image *src = dir ? &images[f] : &images[0];
+                const struct bench_image *dst = dir ? &images[0] : &images[f ? f : num_formats];
+
+                if ((f == 0) && dir) {
+                    continue;
+                }
+                printf("  %s -> %s", bench_fourcc_name(src->planes.fourcc, name0),
+                       bench_fourcc_name(dst->planes.fourcc, name1));
+                for (k = 0; k < num_kernels; k++) {
+                    printf("  %6.2f", bench_convert(kernels[k], src, dst, size));
+                    fflush(stdout);
+                }
+                printf("\n");
+            }
+        }
+
+        for (f = 0; f <= num_formats; f++) {
+            free(images[f].buffer);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,370 @@
+/*
+ * Copyright (c) 2012 Scott Tincman <sctincman@gmail.com>. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Lookup and iteration cost of object_heap's bucket layout.
+ *
+ * The legacy rows rebuild the layout object_heap had before its buckets
+ * became cache-line aligned powers of two: 16 packed objects per malloc()ed
+ * bucket, indexed with a divide and a modulo. The other rows use
+ * object_heap itself at several bucket sizes. The last table has threads
+ * update neighbouring objects, which share cache lines in the packed
+ * layout only.
+ *
+ * usage: object_heap_bench [objects]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include "object_heap.h"
+
+#define BENCH_ID_OFFSET         0x30000000
+#define BENCH_DEFAULT_OBJECTS   4096
+#define BENCH_LOOKUPS           (1 << 24)
+#define BENCH_ITERATIONS        (1 << 22)   /* Objects visited per iteration run */
+#define BENCH_UPDATES           (1 << 22)   /* Per thread */
+#define BENCH_MAX_THREADS       4
+
+#define LEGACY_ALLOCATED        -2
+
+/* About the size of the driver's smaller objects */
+struct bench_object {
+    struct object_base base;
+    int counter;
+    int payload[3];
+};
+
+/* The packed layout, allocation only, see object_heap_expand() */
+struct legacy_heap {
+    int object_size;
+    int heap_size;
+    int heap_increment;
+    void **bucket;
+};
+
+struct bench_thread {
+    pthread_t thread;
+    struct bench_object *obj;
+};
+
+static double
+bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * Builds a packed heap of num_objects allocated objects
+ * Return 0 on success, -1 on error
+ */
+static int
+legacy_heap_init(struct legacy_heap *heap, int num_objects)
+{
+    int i;
+
+    heap->object_size = sizeof(struct bench_object);
+    heap->heap_increment = 16;
+    heap->heap_size = (num_objects + heap->heap_increment - 1) / heap->heap_increment * heap->heap_increment;
+    heap->bucket = calloc(heap->heap_size / heap->heap_increment, sizeof(void *));
+    if (NULL == heap->bucket) {
+        return -1;
+    }
+    for (i = 0; i < heap->heap_size / heap->heap_increment; i++) {
+        heap->bucket[i] = malloc(heap->heap_increment * heap->object_size);
+        if (NULL == heap->bucket[i]) {
+            return -1;
+        }
+    }
+    for (i = 0; i < heap->heap_size; i++) {
+        object_base_p obj = (object_base_p)(heap->bucket[i / heap->heap_increment] +
+                                            (i % heap->heap_increment) * heap->object_size);
+        obj->id = i + BENCH_ID_OFFSET;
+        obj->next_free = LEGACY_ALLOCATED;
+    }
+    return 0;
+}
+
+static void
+legacy_heap_destroy(struct legacy_heap *heap)
+{
+    int i;
+
+    for (i = 0; i < heap->heap_size / heap->heap_increment; i++) {
+        free(heap->bucket[i]);
+    }
+    free(heap->bucket);
+}
+
+/*
+ * The lookup of the packed layout, without its mutex
+ */
+static object_base_p
+legacy_heap_lookup(struct legacy_heap *heap, int id)
+{
+    object_base_p obj;
+    int index;
+
+    if ((id & ~OBJECT_HEAP_ID_MASK) != BENCH_ID_OFFSET) {
+        return NULL;
+    }
+    index = id & OBJECT_HEAP_ID_MASK;
+    if (index >= __atomic_load_n(&heap->heap_size, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    obj = (object_base_p)(heap->bucket[index / heap->heap_increment] +
+                          (index % heap->heap_increment) * heap->object_size);
+    if (__atomic_load_n(&obj->next_free, __ATOMIC_ACQUIRE) != LEGACY_ALLOCATED) {
+        return NULL;
+    }
+    return obj;
+}
+
+/*
+ * Fills ids with a random permutation of num_objects consecutive IDs
+ */
+static void
+bench_shuffle(int *ids, int num_objects, int first_id)
+{
+    unsigned int state = 2463534242u;
+    int i, j, t;
+
+    for (i = 0; i < num_objects; i++) {
+        ids[i] = first_id + i;
+    }
+    for (i = num_objects; i-- > 1; ) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        j = state % (i + 1);
+        t = ids[i];
+        ids[i] = ids[j];
+        ids[j] = t;
+    }
+}
+
+/*
+ * Returns the nanoseconds per lookup of the IDs in random order
+ */
+static double
+bench_legacy_lookup(struct legacy_heap *heap, const int *ids, int num_objects)
+{
+    volatile int sink = 0;
+    double start = bench_now();
+    int i;
+
+    for (i = 0; i < BENCH_LOOKUPS; i++) {
+        sink += legacy_heap_lookup(heap, ids[i & (num_objects - 1)])->next_free;
+    }
+    return (bench_now() - start) * 1e9 / BENCH_LOOKUPS;
+}
+
+static double
+bench_heap_lookup(object_heap_p heap, const int *ids, int num_objects)
+{
+    volatile int sink = 0;
+    double start = bench_now();
+    int i;
+
+    for (i = 0; i < BENCH_LOOKUPS; i++) {
+        sink += object_heap_lookup(heap, ids[i & (num_objects - 1)])->next_free;
+    }
+    return (bench_now() - start) * 1e9 / BENCH_LOOKUPS;
+}
+
+/*
+ * Returns the nanoseconds per object of walking every slot, the way the
+ * packed layout iterated
+ */
+static double
+bench_legacy_iterate(struct legacy_heap *heap)
+{
+    volatile int sink = 0;
+    double start = bench_now();
+    long visited = 0;
+    object_base_p obj;
+    int i;
+
+    while (visited < BENCH_ITERATIONS) {
+        for (i = 0; i < heap->heap_size; i++) {
+            obj = (object_base_p)(heap->bucket[i / heap->heap_increment] +
+                                  (i % heap->heap_increment) * heap->object_size);
+            if (obj->next_free == LEGACY_ALLOCATED) {
+                sink += obj->id;
+                visited++;
+            }
+        }
+    }
+    return (bench_now() - start) * 1e9 / visited;
+}
+
+static double
+bench_heap_first_next(object_heap_p heap)
+{
+    volatile int sink = 0;
+    double start = bench_now();
+    long visited = 0;
+    object_heap_iterator iter;
+    object_base_p obj;
+
+    while (visited < BENCH_ITERATIONS) {
+        for (obj = object_heap_first(heap, &iter); obj; obj = object_heap_next(heap, &iter)) {
+            sink += obj->id;
+            visited++;
+        }
+    }
+    return (bench_now() - start) * 1e9 / visited;
+}
+
+static int
+bench_visit(object_base_p obj, void *data)
+{
+    *(volatile int *) data += obj->id;
+    return OBJECT_HEAP_VISIT_CONTINUE;
+}
+
+static double
+bench_heap_foreach(object_heap_p heap)
+{
+    int sink = 0;
+    double start = bench_now();
+    long visited = 0;
+
+    while (visited < BENCH_ITERATIONS) {
+        visited += object_heap_foreach(heap, bench_visit, &sink);
+    }
+    return (bench_now() - start) * 1e9 / visited;
+}
+
+static void *
+bench_update_thread(void *arg)
+{
+    struct bench_thread *self = arg;
+    int i;
+
+    for (i = 0; i < BENCH_UPDATES; i++) {
+        __atomic_fetch_add(&self->obj->counter, 1, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+/*
+ * Has each of num_threads threads update its own object, the objects being
+ * consecutive slots
+ * Returns the nanoseconds per update and thread
+ */
+static double
+bench_updates(struct bench_object **objs, int num_threads)
+{
+    struct bench_thread threads[BENCH_MAX_THREADS];
+    double start = bench_now();
+    int i;
+
+    for (i = 0; i < num_threads; i++) {
+        threads[i].obj = objs[i];
+        pthread_create(&threads[i].thread, NULL, bench_update_thread, &threads[i]);
+    }
+    for (i = 0; i < num_threads; i++) {
+        pthread_join(threads[i].thread, NULL);
+    }
+    return (bench_now() - start) * 1e9 / BENCH_UPDATES;
+}
+
+int
+main(int argc, char **argv)
+{
+    static const int bucket_sizes[] = { 16, 64, 256 };
+    struct bench_object *legacy_objs[BENCH_MAX_THREADS], *heap_objs[BENCH_MAX_THREADS];
+    struct legacy_heap legacy;
+    struct object_heap heap;
+    int num_objects = BENCH_DEFAULT_OBJECTS;
+    int *ids, *order;
+    int i, b, num_threads;
+
+    if (argc > 1) {
+        num_objects = atoi(argv[1]);
+    }
+    if (num_objects < BENCH_MAX_THREADS || (num_objects & (num_objects - 1)) ||
+        num_objects > OBJECT_HEAP_INDEX_MASK + 1) {
+        fprintf(stderr, "usage: %s [objects, a power of two from %d to %d]\n", argv[0],
+                BENCH_MAX_THREADS, OBJECT_HEAP_INDEX_MASK + 1);
+        return 1;
+    }
+    ids = malloc(num_objects * sizeof(int));
+    order = malloc(num_objects * sizeof(int));
+    if (NULL == ids || NULL == order || legacy_heap_init(&legacy, num_objects)) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    printf("%d objects of %d bytes, ns per lookup (random order) and per object iterated\n",
+           num_objects, (int) sizeof(struct bench_object));
+    printf("  layout              lookup  first/next  foreach\n");
+    bench_shuffle(order, num_objects, BENCH_ID_OFFSET);
+    printf("  legacy, 16 packed   %6.2f  %10.2f        -\n",
+           bench_legacy_lookup(&legacy, order, num_objects), bench_legacy_iterate(&legacy));
+
+    for (b = 0; b < (int) (sizeof(bucket_sizes) / sizeof(bucket_sizes[0])); b++) {
+        if (object_heap_init_bucket_size(&heap, sizeof(struct bench_object), BENCH_ID_OFFSET, bucket_sizes[b]) ||
+            object_heap_allocate_n(&heap, num_objects, ids)) {
+            fprintf(stderr, "out of memory\n");
+            return 1;
+        }
+        /* The IDs are contiguous on a fresh heap, shuffle them the same way */
+        bench_shuffle(order, num_objects, ids[0]);
+        printf("  heap, %3d aligned   %6.2f  %10.2f  %7.2f\n", bucket_sizes[b],
+               bench_heap_lookup(&heap, order, num_objects), bench_heap_first_next(&heap),
+               bench_heap_foreach(&heap));
+
+        object_heap_free_n(&heap, ids, num_objects);
+        object_heap_destroy(&heap);
+    }
+
+    if (object_heap_init(&heap, sizeof(struct bench_object), BENCH_ID_OFFSET) ||
+        object_heap_allocate_n(&heap, BENCH_MAX_THREADS, ids)) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    for (i = 0; i < BENCH_MAX_THREADS; i++) {
+        heap_objs[i] = (struct bench_object *) object_heap_lookup(&heap, ids[i]);
+        legacy_objs[i] = (struct bench_object *) legacy_heap_lookup(&legacy, BENCH_ID_OFFSET + i);
+    }
+    printf("threads updating neighbouring objects, ns per update\n");
+    printf("  threads  legacy    heap\n");
+    for (num_threads = 1; num_threads <= BENCH_MAX_THREADS; num_threads *= 2) {
+        printf("  %7d  %6.2f  %6.2f\n", num_threads, bench_updates(legacy_objs, num_threads),
+               bench_updates(heap_objs, num_threads));
+    }
+    object_heap_free_n(&heap, ids, BENCH_MAX_THREADS);
+    object_heap_destroy(&heap);
+
+    legacy_heap_destroy(&legacy);
+    free(ids);
+    free(order);
+    return 0;
+}
@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) 2012 Scott Tincman <sctincman@gmail.com>. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Speedup of decoding a picture on more threads. Every stream is decoded
+ * with the rows strategy (VAConfigAttribEpiphanyDecodeStrategy), H.264
+ * reconstructing and deblocking macroblock rows in wavefront order and
+ * MPEG-2 decoding its slice rows, once for every decode thread count
+ * (VAConfigAttribEpiphanyDecodeThreads) from 1 to 16, and the frames per
+ * second are compared with the single thread run.
+ *
+ * The pool gets 15 workers so that every count can be reached, unless
+ * EPIPHANY_POOL_THREADS says otherwise; counts beyond the cores online
+ * only add switching.
+ *
+ * Streams ending in .264 are H.264, anything else is MPEG-2 video.
+ *
+ * usage: thread_bench stream.m2v|stream.264 ...
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "va_epiphany.h"
+#include "va_client.h"
+#include "h264_stream.h"
+#include "mpeg2_stream.h"
+
+#define BENCH_MAX_THREADS       16
+
+typedef int (*bench_stream_decode)(struct va_decoder *decoder, const uint8_t *data, size_t size);
+
+static const char *
+bench_basename(const char *path)
+{
+    const char *slash = strrchr(path, '/');
+
+    return slash ? slash + 1 : path;
+}
+
+/*
+ * Decodes a stream on a fresh driver instance with threads decode threads
+ * Return 0 on success, -1 on error
+ */
+static int
+bench_decode(bench_stream_decode decode, const uint8_t *data, size_t size, int threads,
+             int *pictures, double *seconds)
+{
+    struct va_client client;
+    struct va_decoder decoder;
+    double start;
+    int ret;
+
+    if (va_client_open(&client)) {
+        fprintf(stderr, "cannot initialize the driver\n");
+        return -1;
+    }
+    va_decoder_init(&decoder, &client);
+    va_decoder_set_attrib(&decoder, VAConfigAttribEpiphanyDecodeThreads, threads);
+    va_decoder_set_attrib(&decoder, VAConfigAttribEpiphanyDecodeStrategy, VA_EPIPHANY_DECODE_ROWS);
+
+    start = va_client_now();
+    ret = decode(&decoder, data, size);
+    *seconds = va_client_now() - start;
+    *pictures = decoder.num_pictures;
+
+    va_decoder_stop(&decoder);
+    va_client_close(&client);
+    return ret;
+}
+
+int
+main(int argc, char **argv)
+{
+    bench_stream_decode decode;
+    double seconds, fps, single_fps;
+    const char *ext;
+    uint8_t *data;
+    size_t size;
+    int i, threads, pictures, ret = 0;
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s stream.m2v|stream.264 ...\n", argv[0]);
+        return 1;
+    }
+    setenv("EPIPHANY_POOL_THREADS", "15", 0);
+
+    printf("%ld cores online, %s pool workers\n\n", sysconf(_SC_NPROCESSORS_ONLN), getenv("EPIPHANY_POOL_THREADS"));
+    printf("%-24s %7s %8s %8s %8s\n", "stream", "threads", "pictures", "fps", "speedup");
+    for (i = 1; i < argc; i++) {
+        data = va_client_load(argv[i], &size);
+        if (NULL == data) {
+            fprintf(stderr, "cannot read %s\n", argv[i]);
+            ret = 1;
+            continue;
+        }
+        ext = strrchr(argv[i], '.');
+        decode = (ext && !strcmp(ext, ".264")) ? h264_stream_decode : mpeg2_stream_decode;
+        single_fps = 0;
+        for (threads = 1; threads <= BENCH_MAX_THREADS; threads *= 2) {
+            if (bench_decode(decode, data, size, threads, &pictures, &seconds) || (0 == pictures)) {
+                fprintf(stderr, "%s: decoding failed\n", argv[i]);
+                ret = 1;
+                break;
+            }
+            fps = pictures / seconds;
+            if (1 == threads) {
+                single_fps = fps;
+            }
+            printf("%-24s %7d %8d %8.1f %7.2fx\n", bench_basename(argv[i]), threads, pictures, fps,
+                   fps / single_fps);
+        }
+        free(data);
+    }
+    return ret;
+}
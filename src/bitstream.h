@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) 2012 Scott Tincman <sctincman@gmail.com>. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef BITSTREAM_H
+#define BITSTREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * MSB-first bit reader over client slice data. Reads never go past the end
+ * of the data: missing bytes read as zero, so a truncated slice looks like
+ * a slice followed by a start code and the decoders stop there.
+ */
+
+struct bitstream {
+    const uint8_t *data;
+    size_t size;            /* Bytes at data */
+    size_t pos;             /* Next bit to read */
+};
+
+static inline void
+bitstream_init(struct bitstream *bs, const uint8_t *data, size_t size, size_t bit_offset)
+{
+    bs->data = data;
+    bs->size = size;
+    bs->pos = bit_offset;
+}
+
+/* The next 57 or more bits, left aligned */
+static inline uint64_t
+bitstream_peek64(const struct bitstream *bs)
+{
+    size_t byte = bs->pos >> 3;
+    uint64_t value;
+
+    if (byte + 8 <= bs->size) {
+        memcpy(&value, bs->data + byte, sizeof(value));
+#ifndef WORDS_BIGENDIAN
+        value = __builtin_bswap64(value);
+#endif
+    } else {
+        int i;
+
+        value = 0;
+        for (i = 0; i < 8; i++)
+            value = (value << 8) | (byte + i < bs->size ? bs->data[byte + i] : 0);
+    }
+    return value << (bs->pos & 7);
+}
+
+/* 1 <= n <= 32 */
+static inline unsigned int
+bitstream_show_bits(const struct bitstream *bs, int n)
+{
+    return (unsigned int)(bitstream_peek64(bs) >> (64 - n));
+}
+
+static inline void
+bitstream_skip_bits(struct bitstream *bs, int n)
+{
+    bs->pos += n;
+}
+
+static inline unsigned int
+bitstream_get_bits(struct bitstream *bs, int n)
+{
+    unsigned int value = bitstream_show_bits(bs, n);
+
+    bs->pos += n;
+    return value;
+}
+
+static inline unsigned int
+bitstream_get_bit(struct bitstream *bs)
+{
+    return bitstream_get_bits(bs, 1);
+}
+
+/* n bit two's complement value */
+static inline int
+bitstream_get_sbits(struct bitstream *bs, int n)
+{
+    int value = (int)(bitstream_peek64(bs) >> 32) >> (32 - n);
+
+    bs->pos += n;
+    return value;
+}
+
+/* ue(v) Exp-Golomb code, UINT32_MAX for codes of more than 57 bits */
+static inline uint32_t
+bitstream_get_ue(struct bitstream *bs)
+{
+    uint64_t value = bitstream_peek64(bs);
+    int zeros;
+
+    if (value >> 36 == 0) {
+        bs->pos += 57;
+        return UINT32_MAX;
+    }
+    zeros = __builtin_clzll(value);
+    bs->pos += 2 * zeros + 1;
+    return (uint32_t)(value >> (63 - 2 * zeros)) - 1;
+}
+
+/* se(v) Exp-Golomb code */
+static inline int32_t
+bitstream_get_se(struct bitstream *bs)
+{
+    uint32_t value = bitstream_get_ue(bs);
+
+    return value & 1 ? (int32_t)(value >> 1) + 1 : -(int32_t)(value >> 1);
+}
+
+static inline long
+bitstream_bits_left(const struct bitstream *bs)
+{
+    return (long)(bs->size * 8) - (long)bs->pos;
+}
+
+static inline void
+bitstream_byte_align(struct bitstream *bs)
+{
+    bs->pos = (bs->pos + 7) & ~(size_t)7;
+}
+
+#endif /* BITSTREAM_H */
@@ -0,0 +1,232 @@
+/*
+ * Copyright (c) 2012 Scott Tincman <sctincman@gmail.com>. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <assert.h>
+#include "buffer_pool.h"
+
+#define ASSERT  assert
+
+/*
+ * Maps a size to its size class and rounds it up to the class size
+ * Above the minimum block there are four classes per power of two, which
+ * bounds the rounding waste at 25%.
+ */
+static int
+buffer_pool_class(size_t size, size_t *class_size)
+{
+    int log2, step_shift;
+    size_t rounded;
+
+    if (size <= BUFFER_POOL_MIN_SIZE) {
+        *class_size = BUFFER_POOL_MIN_SIZE;
+        return 0;
+    }
+
+    /* size is in (2^log2, 2^(log2 + 1)] */
+    log2 = 63 - __builtin_clzll(size - 1);
+    step_shift = log2 - 2;
+    rounded = (size + ((size_t)1 << step_shift) - 1) >> step_shift;  /* 5..8 */
+    *class_size = rounded << step_shift;
+    return 1 + (log2 - BUFFER_POOL_MIN_SHIFT) * 4 + (int)(rounded - 5);
+}
+
+/*
+ * Returns the block size of a size class, the inverse of buffer_pool_class()
+ */
+static size_t
+buffer_pool_class_size(int cls)
+{
+    if (0 == cls) {
+        return BUFFER_POOL_MIN_SIZE;
+    }
+    return (size_t)(5 + (cls - 1) % 4) << (BUFFER_POOL_MIN_SHIFT + (cls - 1) / 4 - 2);
+}
+
+static int
+buffer_pool_type_slot(int type)
+{
+    if ((type < 0) || (type >= BUFFER_POOL_NUM_TYPES)) {
+        return BUFFER_POOL_NUM_TYPES - 1;
+    }
+    return type;
+}
+
+/*
+ * Return 0 on success, -1 on error
+ */
+int
+buffer_pool_init(buffer_pool_p pool, size_t max_cached)
+{
+    int type, cls;
+
+    pthread_mutex_init(&pool->mutex, NULL);
+    for (type = 0; type < BUFFER_POOL_NUM_TYPES; type++) {
+        for (cls = 0; cls < BUFFER_POOL_NUM_CLASSES; cls++) {
+            pool->free_list[type][cls] = NULL;
+        }
+    }
+    pool->max_cached = max_cached;
+    pool->bytes_cached = 0;
+    pool->bytes_in_use = 0;
+    pool->hits = 0;
+    pool->misses = 0;
+    return 0;
+}
+
+/*
+ * Allocates at least size bytes of storage for a buffer of the given type
+ * Returns a 64-byte aligned pointer on success, returns NULL on error
+ */
+void *
+buffer_pool_alloc(buffer_pool_p pool, int type, size_t size, size_t *capacity)
+{
+    struct buffer_pool_block *block;
+    void *ptr;
+    int slot = buffer_pool_type_slot(type);
+    int cls;
+
+    cls = buffer_pool_class(size, capacity);
+    if (cls >= BUFFER_POOL_NUM_CLASSES) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    block = pool->free_list[slot][cls];
+    if (block) {
+        pool->free_list[slot][cls] = block->next;
+        pool->bytes_cached -= *capacity;
+        pool->hits++;
+    } else {
+        pool->misses++;
+    }
+    pool->bytes_in_use += *capacity;
+    pthread_mutex_unlock(&pool->mutex);
+
+    if (block) {
+        return block;
+    }
+
+    if (posix_memalign(&ptr, BUFFER_POOL_ALIGNMENT, *capacity)) {
+        pthread_mutex_lock(&pool->mutex);
+        pool->bytes_in_use -= *capacity;
+        pthread_mutex_unlock(&pool->mutex);
+        return NULL; /* Out of memory */
+    }
+    return ptr;
+}
+
+/*
+ * Returns storage obtained from buffer_pool_alloc() to the pool
+ */
+void
+buffer_pool_release(buffer_pool_p pool, int type, void *ptr, size_t capacity)
+{
+    struct buffer_pool_block *block = ptr;
+    size_t class_size;
+    int slot = buffer_pool_type_slot(type);
+    int cls;
+
+    if (!ptr)
+        return;
+
+    cls = buffer_pool_class(capacity, &class_size);
+    ASSERT(class_size == capacity);
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->bytes_in_use -= capacity;
+    if (pool->bytes_cached + capacity <= pool->max_cached) {
+        block->next = pool->free_list[slot][cls];
+        pool->free_list[slot][cls] = block;
+        pool->bytes_cached += capacity;
+        block = NULL;
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    /* Over budget, give it back to the system */
+    free(block);
+}
+
+/*
+ * Frees cached blocks, largest first, until at most target bytes are cached
+ */
+void
+buffer_pool_shrink(buffer_pool_p pool, size_t target)
+{
+    struct buffer_pool_block *block;
+    size_t class_size;
+    int type, cls;
+
+    pthread_mutex_lock(&pool->mutex);
+    for (cls = BUFFER_POOL_NUM_CLASSES; cls-- > 0; ) {
+        if (pool->bytes_cached <= target) {
+            break;
+        }
+        class_size = buffer_pool_class_size(cls);
+        for (type = 0; type < BUFFER_POOL_NUM_TYPES; type++) {
+            while ((pool->bytes_cached > target) && pool->free_list[type][cls]) {
+                block = pool->free_list[type][cls];
+                pool->free_list[type][cls] = block->next;
+                pool->bytes_cached -= class_size;
+                free(block);
+            }
+        }
+    }
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+/*
+ * Frees all cached blocks
+ */
+void
+buffer_pool_trim(buffer_pool_p pool)
+{
+    buffer_pool_shrink(pool, 0);
+}
+
+/*
+ * Returns the hit/miss counters and the memory held by the pool
+ */
+void
+buffer_pool_get_stats(buffer_pool_p pool, struct buffer_pool_stats *stats)
+{
+    pthread_mutex_lock(&pool->mutex);
+    stats->hits = pool->hits;
+    stats->misses = pool->misses;
+    stats->bytes_cached = pool->bytes_cached;
+    stats->bytes_in_use = pool->bytes_in_use;
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+/*
+ * Destroys a pool, all blocks must have been released.
+ */
+void
+buffer_pool_destroy(buffer_pool_p pool)
+{
+    ASSERT(pool->bytes_in_use == 0);
+
+    buffer_pool_trim(pool);
+    pthread_mutex_destroy(&pool->mutex);
+}
@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2012 Scott Tincman <sctincman@gmail.com>. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+/*
+ * Recycles buffer backing storage across frames. Freed blocks are kept on
+ * free lists keyed by buffer type and size class, so steady-state decoding
+ * stops going through malloc/free (and mmap/munmap for large slice data).
+ */
+
+#define BUFFER_POOL_MIN_SHIFT   6       /* Smallest block is 64 bytes */
+#define BUFFER_POOL_MIN_SIZE    (1 << BUFFER_POOL_MIN_SHIFT)
+#define BUFFER_POOL_ALIGNMENT   64
+#define BUFFER_POOL_NUM_CLASSES (1 + (32 - BUFFER_POOL_MIN_SHIFT) * 4)
+#define BUFFER_POOL_NUM_TYPES   16      /* Higher buffer types share the last list */
+
+typedef struct buffer_pool *buffer_pool_p;
+
+struct buffer_pool_block {
+    struct buffer_pool_block *next;
+};
+
+struct buffer_pool {
+    pthread_mutex_t mutex;
+    struct buffer_pool_block *free_list[BUFFER_POOL_NUM_TYPES][BUFFER_POOL_NUM_CLASSES];
+    size_t max_cached;      /* Blocks beyond this many cached bytes are freed */
+    size_t bytes_cached;
+    size_t bytes_in_use;
+    unsigned long hits;
+    unsigned long misses;
+};
+
+struct buffer_pool_stats {
+    unsigned long hits;
+    unsigned long misses;
+    size_t bytes_cached;    /* Held on free lists */
+    size_t bytes_in_use;    /* Handed out and not yet released */
+};
+
+/*
+ * Return 0 on success, -1 on error
+ */
+int
+buffer_pool_init(buffer_pool_p pool, size_t max_cached);
+
+/*
+ * Allocates at least size bytes of storage for a buffer of the given type
+ * The actual block size is returned in capacity and must be passed back to
+ * buffer_pool_release().
+ * Returns a 64-byte aligned pointer on success, returns NULL on error
+ */
+void *
+buffer_pool_alloc(buffer_pool_p pool, int type, size_t size, size_t *capacity);
+
+/*
+ * Returns storage obtained from buffer_pool_alloc() to the pool
+ */
+void
+buffer_pool_release(buffer_pool_p pool, int type, void *ptr, size_t capacity);
+
+/*
+ * Frees cached blocks, largest first, until at most target bytes are cached
+ */
+void
+buffer_pool_shrink(buffer_pool_p pool, size_t target);
+
+/*
+ * Frees all cached blocks
+ */
+void
+buffer_pool_trim(buffer_pool_p pool);
+
+/*
+ * Returns the hit/miss counters and the memory held by the pool
+ */
+void
+buffer_pool_get_stats(buffer_pool_p pool, struct buffer_pool_stats *stats);
+
+/*
+ * Destroys a pool, all blocks must have been released.
+ */
+void
+buffer_pool_destroy(buffer_pool_p pool);
+
+#endif /* BUFFER_POOL_H */
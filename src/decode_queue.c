@@ -0,0 +1,566 @@
+/*
+ * Copyright (c) 2012 Scott Tincman <sctincman@gmail.com>. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <time.h>
+#include <assert.h>
+#include "decode_queue.h"
+
+#define ASSERT  assert
+
+/* A flow's service_ns moves by 1 / 2^DECODE_QUEUE_SERVICE_SHIFT of the difference each job */
+#define DECODE_QUEUE_SERVICE_SHIFT  3
+
+static unsigned long long
+decode_queue_time_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* The flow that ended up with the jobs of flow */
+static decode_flow_p
+decode_queue_root(decode_flow_p flow)
+{
+    while (flow->merged) {
+        flow = flow->merged;
+    }
+    return flow;
+}
+
+/*
+ * Drops a reference to flow, freeing it with the last one
+ * Called with the queue lock held
+ */
+static void
+decode_queue_put_flow(decode_queue_p queue, decode_flow_p flow)
+{
+    decode_flow_p *link;
+
+    ASSERT(flow->references > 0);
+    if (--flow->references) {
+        return;
+    }
+    ASSERT((NULL == flow->head) && (0 == flow->outstanding));
+    for (link = &queue->flows; *link != flow; link = &(*link)->next) {
+    }
+    *link = flow->next;
+    if (flow->merged) {
+        decode_queue_put_flow(queue, flow->merged);
+    }
+    free(flow);
+}
+
+/*
+ * Hands the jobs and the contexts of root flow from over to root flow into
+ * Called with the queue lock held
+ */
+static void
+decode_queue_merge(decode_flow_p into, decode_flow_p from)
+{
+    if (from->head) {
+        if (into->tail) {
+            into->tail->next = from->head;
+        } else {
+            into->head = from->head;
+        }
+        into->tail = from->tail;
+    }
+    into->weight += from->weight;
+    into->running += from->running;
+    into->outstanding += from->outstanding;
+    if (from->priority > into->priority) {
+        into->priority = from->priority;
+    }
+    if (from->vtime > into->vtime) {
+        into->vtime = from->vtime;
+    }
+    if (from->service_ns > into->service_ns) {
+        into->service_ns = from->service_ns;
+    }
+    from->head = NULL;
+    from->tail = NULL;
+    from->weight = 0;
+    from->running = 0;
+    from->outstanding = 0;
+    from->merged = into;
+    into->references++;
+}
+
+/*
+ * Points fence at the root of flow, merging the flow it had into that one
+ * Called with the queue lock held
+ */
+static void
+decode_queue_set_flow(decode_queue_p queue, struct decode_fence *fence, decode_flow_p flow)
+{
+    decode_flow_p root = decode_queue_root(flow);
+    decode_flow_p old;
+
+    if (fence->flow == root) {
+        return;
+    }
+    root->references++;
+    if (fence->flow) {
+        old = decode_queue_root(fence->flow);
+        if (old != root) {
+            decode_queue_merge(root, old);
+        }
+        decode_queue_put_flow(queue, fence->flow);
+    }
+    fence->flow = root;
+}
+
+/*
+ * The flow to take a job from next, NULL if no job can be taken
+ * Called with the queue lock held
+ */
+static decode_flow_p
+decode_queue_pick(decode_queue_p queue, unsigned long long now)
+{
+    decode_flow_p flow;
+    decode_flow_p fair = NULL;
+    decode_flow_p urgent = NULL;
+
+    for (flow = queue->flows; flow; flow = flow->next) {
+        /* A flow runs its jobs one at a time */
+        if (flow->merged || (NULL == flow->head) || flow->running) {
+            continue;
+        }
+        if (fair && (flow->priority != fair->priority)) {
+            if (flow->priority < fair->priority) {
+                continue;
+            }
+            fair = NULL;
+            urgent = NULL;
+        }
+        if (flow->head->deadline_ns && (flow->head->deadline_ns <= now + flow->service_ns) &&
+            ((NULL == urgent) || (flow->head->deadline_ns < urgent->head->deadline_ns))) {
+            urgent = flow;
+        }
+        if ((NULL == fair) || (flow->vtime < fair->vtime) ||
+            ((flow->vtime == fair->vtime) && (flow->head->queued_ns < fair->head->queued_ns))) {
+            fair = flow;
+        }
+    }
+    return urgent ? urgent : fair;
+}
+
+/*
+ * Signals the job's fence, charges its flow for the time it ran and puts
+ * the job on the idle list
+ * Called with the queue lock held
+ */
+static void
+decode_queue_finish(decode_queue_p queue, struct decode_job *job, int status)
+{
+    struct decode_fence *fence = job->fence;
+    decode_flow_p flow = decode_queue_root(job->flow);
+    unsigned long long ns = decode_queue_time_ns() - job->started_ns;
+
+    ASSERT(fence->pending > 0);
+    ASSERT(flow->running > 0);
+    ASSERT(flow->outstanding > 0);
+    ASSERT(queue->outstanding > 0);
+    fence->status = status;
+    fence->pending--;
+    flow->running--;
+    flow->outstanding--;
+    queue->outstanding--;
+    flow->vtime += ns / (flow->weight ? flow->weight : 1);
+    flow->service_ns += (ns >> DECODE_QUEUE_SERVICE_SHIFT) - (flow->service_ns >> DECODE_QUEUE_SERVICE_SHIFT);
+    job->fence = NULL;
+    job->flow = NULL;
+    job->next = queue->idle;
+    queue->idle = job;
+    pthread_cond_broadcast(&queue->done);
+    if (queue->stop) {
+        pthread_cond_broadcast(&queue->queued);
+    } else if (flow->head) {
+        pthread_cond_signal(&queue->queued);
+    }
+}
+
+static void *
+decode_queue_worker(void *arg)
+{
+    decode_queue_p queue = arg;
+    struct decode_job *job;
+    decode_flow_p flow;
+    int status;
+
+    pthread_mutex_lock(&queue->mutex);
+    for (;;) {
+        flow = decode_queue_pick(queue, decode_queue_time_ns());
+        if (NULL == flow) {
+            if (queue->stop && (0 == queue->queued_jobs)) {
+                break;
+            }
+            pthread_cond_wait(&queue->queued, &queue->mutex);
+            continue;
+        }
+        job = flow->head;
+        flow->head = job->next;
+        if (NULL == flow->head) {
+            flow->tail = NULL;
+        }
+        queue->queued_jobs--;
+        flow->running++;
+        if (flow->vtime > queue->vtime) {
+            queue->vtime = flow->vtime;
+        }
+        job->started_ns = decode_queue_time_ns();
+        pthread_mutex_unlock(&queue->mutex);
+
+        status = queue->run(queue->data, job);
+
+        pthread_mutex_lock(&queue->mutex);
+        decode_queue_finish(queue, job, status);
+    }
+    pthread_mutex_unlock(&queue->mutex);
+    return NULL;
+}
+
+/*
+ * Return 0 on success, -1 on error
+ */
+int
+decode_queue_init(decode_queue_p queue, decode_job_func run, void *data, int num_threads)
+{
+    pthread_mutex_init(&queue->mutex, NULL);
+    pthread_cond_init(&queue->queued, NULL);
+    pthread_cond_init(&queue->done, NULL);
+    queue->threads = NULL;
+    queue->num_threads = 0;
+    queue->stop = 0;
+    queue->flows = NULL;
+    queue->queued_jobs = 0;
+    queue->vtime = 0;
+    queue->idle = NULL;
+    queue->outstanding = 0;
+    queue->run = run;
+    queue->data = data;
+    queue->submitted = 0;
+    queue->waits = 0;
+    queue->max_outstanding = 0;
+
+    if (num_threads > 0) {
+        queue->threads = calloc(num_threads, sizeof(*queue->threads));
+    }
+    if (NULL == queue->threads) {
+        return 0;
+    }
+    for (queue->num_threads = 0; queue->num_threads < num_threads; queue->num_threads++) {
+        if (pthread_create(&queue->threads[queue->num_threads], NULL, decode_queue_worker, queue)) {
+            break;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Returns the flow, NULL on error
+ */
+decode_flow_p
+decode_queue_open_flow(decode_queue_p queue, struct decode_fence **fences, int num_fences,
+                       unsigned int weight, int priority)
+{
+    decode_flow_p flow = calloc(1, sizeof(*flow));
+    int i;
+
+    if (NULL == flow) {
+        return NULL;
+    }
+    flow->references = 1;
+    flow->weight = weight;
+    flow->priority = priority;
+    pthread_mutex_lock(&queue->mutex);
+    flow->vtime = queue->vtime;
+    flow->next = queue->flows;
+    queue->flows = flow;
+    for (i = 0; i < num_fences; i++) {
+        decode_queue_set_flow(queue, fences[i], flow);
+    }
+    pthread_mutex_unlock(&queue->mutex);
+    return flow;
+}
+
+/*
+ * Blocks until every job submitted on flow has finished
+ */
+void
+decode_queue_drain_flow(decode_queue_p queue, decode_flow_p flow)
+{
+    pthread_mutex_lock(&queue->mutex);
+    while (decode_queue_root(flow)->outstanding) {
+        pthread_cond_wait(&queue->done, &queue->mutex);
+    }
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+/*
+ * Takes the weight of a context off its flow once it is drained and drops
+ * the context's reference
+ */
+void
+decode_queue_close_flow(decode_queue_p queue, decode_flow_p flow, unsigned int weight)
+{
+    decode_flow_p root;
+
+    pthread_mutex_lock(&queue->mutex);
+    root = decode_queue_root(flow);
+    ASSERT(root->weight >= weight);
+    root->weight -= weight;
+    decode_queue_put_flow(queue, flow);
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+/*
+ * Blocks until the jobs of the flow of fence have finished and drops the
+ * fence's reference
+ */
+void
+decode_queue_detach(decode_queue_p queue, struct decode_fence *fence)
+{
+    pthread_mutex_lock(&queue->mutex);
+    if (NULL == fence->flow) {
+        while (fence->pending) {
+            pthread_cond_wait(&queue->done, &queue->mutex);
+        }
+    } else {
+        while (decode_queue_root(fence->flow)->outstanding) {
+            pthread_cond_wait(&queue->done, &queue->mutex);
+        }
+        decode_queue_put_flow(queue, fence->flow);
+        fence->flow = NULL;
+    }
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+/*
+ * Returns a finished job for reuse, or NULL if there is none
+ */
+struct decode_job *
+decode_queue_get_job(decode_queue_p queue)
+{
+    struct decode_job *job;
+
+    pthread_mutex_lock(&queue->mutex);
+    job = queue->idle;
+    if (job) {
+        queue->idle = job->next;
+        job->next = NULL;
+    }
+    pthread_mutex_unlock(&queue->mutex);
+    return job;
+}
+
+/*
+ * Queues a job on flow that signals fence when it finishes
+ * Returns the job's status when it ran in the calling thread, 0 otherwise.
+ */
+int
+decode_queue_submit(decode_queue_p queue, struct decode_job *job, decode_flow_p flow,
+                    struct decode_fence *fence)
+{
+    decode_flow_p root;
+    int status = 0;
+
+    pthread_mutex_lock(&queue->mutex);
+    /* Jobs of another flow rendering into the surface have to stay ahead */
+    decode_queue_set_flow(queue, fence, flow);
+    root = decode_queue_root(flow);
+    job->next = NULL;
+    job->fence = fence;
+    job->flow = flow;
+    job->queued_ns = decode_queue_time_ns();
+    fence->pending++;
+    root->outstanding++;
+    queue->outstanding++;
+    queue->submitted++;
+    if (queue->outstanding > queue->max_outstanding) {
+        queue->max_outstanding = queue->outstanding;
+    }
+
+    if (queue->num_threads) {
+        if ((NULL == root->head) && (0 == root->running) && (root->vtime < queue->vtime)) {
+            /* Time spent idle is not owed */
+            root->vtime = queue->vtime;
+        }
+        if (root->tail) {
+            root->tail->next = job;
+        } else {
+            root->head = job;
+        }
+        root->tail = job;
+        queue->queued_jobs++;
+        pthread_cond_signal(&queue->queued);
+    } else {
+        root->running++;
+        job->started_ns = job->queued_ns;
+        pthread_mutex_unlock(&queue->mutex);
+        status = queue->run(queue->data, job);
+        pthread_mutex_lock(&queue->mutex);
+        decode_queue_finish(queue, job, status);
+    }
+    pthread_mutex_unlock(&queue->mutex);
+    return status;
+}
+
+/*
+ * Keeps fence pending after its job returns, for work the job left
+ * running elsewhere, until decode_queue_release()
+ */
+void
+decode_queue_hold(decode_queue_p queue, struct decode_fence *fence)
+{
+    pthread_mutex_lock(&queue->mutex);
+    fence->pending++;
+    decode_queue_root(fence->flow)->outstanding++;
+    queue->outstanding++;
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+/*
+ * Ends a decode_queue_hold(), the status of the job stays
+ */
+void
+decode_queue_release(decode_queue_p queue, struct decode_fence *fence)
+{
+    decode_flow_p flow;
+
+    pthread_mutex_lock(&queue->mutex);
+    flow = decode_queue_root(fence->flow);
+    ASSERT(fence->pending > 0);
+    ASSERT(flow->outstanding > 0);
+    ASSERT(queue->outstanding > 0);
+    fence->pending--;
+    flow->outstanding--;
+    queue->outstanding--;
+    pthread_cond_broadcast(&queue->done);
+    pthread_mutex_unlock(&queue->mutex);
+}
+/*
+ * Blocks until every job submitted with fence has finished
+ * Returns the fence's status
+ */
+int
+decode_queue_wait(decode_queue_p queue, struct decode_fence *fence)
+{
+    int status;
+
+    pthread_mutex_lock(&queue->mutex);
+    if (fence->pending) {
+        queue->waits++;
+        do {
+            pthread_cond_wait(&queue->done, &queue->mutex);
+        } while (fence->pending);
+    }
+    status = fence->status;
+    pthread_mutex_unlock(&queue->mutex);
+    return status;
+}
+
+/*
+ * Returns non-zero while jobs submitted with fence have not finished
+ */
+int
+decode_queue_busy(decode_queue_p queue, struct decode_fence *fence)
+{
+    int busy;
+
+    pthread_mutex_lock(&queue->mutex);
+    busy = (fence->pending != 0);
+    pthread_mutex_unlock(&queue->mutex);
+    return busy;
+}
+
+/*
+ * Blocks until every submitted job has finished
+ */
+void
+decode_queue_drain(decode_queue_p queue)
+{
+    pthread_mutex_lock(&queue->mutex);
+    while (queue->outstanding) {
+        pthread_cond_wait(&queue->done, &queue->mutex);
+    }
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+/*
+ * Returns the submission and wait counters
+ */
+void
+decode_queue_get_stats(decode_queue_p queue, struct decode_queue_stats *stats)
+{
+    pthread_mutex_lock(&queue->mutex);
+    stats->num_threads = queue->num_threads;
+    stats->submitted = queue->submitted;
+    stats->waits = queue->waits;
+    stats->max_outstanding = queue->max_outstanding;
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+/*
+ * Finishes the queued jobs, stops the workers, frees the flows and passes
+ * the idle jobs to free_job
+ */
+void
+decode_queue_destroy(decode_queue_p queue, decode_job_free_func free_job)
+{
+    struct decode_job *job;
+    decode_flow_p flow;
+    int i;
+
+    pthread_mutex_lock(&queue->mutex);
+    queue->stop = 1;
+    pthread_cond_broadcast(&queue->queued);
+    pthread_mutex_unlock(&queue->mutex);
+    for (i = 0; i < queue->num_threads; i++) {
+        pthread_join(queue->threads[i], NULL);
+    }
+    free(queue->threads);
+    queue->threads = NULL;
+    queue->num_threads = 0;
+    ASSERT(0 == queue->outstanding);
+
+    /* The contexts and surfaces holding them are gone */
+    while (queue->flows) {
+        flow = queue->flows;
+        queue->flows = flow->next;
+        free(flow);
+    }
+
+    while (queue->idle) {
+        job = queue->idle;
+        queue->idle = job->next;
+        free_job(queue->data, job);
+    }
+    pthread_cond_destroy(&queue->done);
+    pthread_cond_destroy(&queue->queued);
+    pthread_mutex_destroy(&queue->mutex);
+}
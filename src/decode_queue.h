@@ -0,0 +1,213 @@
+/*
+ * Copyright (c) 2012 Scott Tincman <sctincman@gmail.com>. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef DECODE_QUEUE_H
+#define DECODE_QUEUE_H
+
+#include <pthread.h>
+
+/*
+ * Runs decode jobs on worker threads, so vaEndPicture returns as soon as a
+ * picture is queued. Every job signals a fence, which counts the jobs of
+ * one surface still queued or running; vaSyncSurface waits for it to drop
+ * to zero and vaQuerySurfaceStatus polls it.
+ *
+ * Jobs are queued on flows, one per context or group of contexts sharing
+ * surfaces, which run their jobs one at a time in submission order. The
+ * workers pick between flows: the highest priority first, then a job
+ * whose deadline is closer than the time its flow's jobs take, earliest
+ * deadline first, then the flow that got the least decode time for its
+ * weight (start-time fair queuing, charged with the time jobs actually
+ * ran). A flow that sat idle starts again level with the others rather
+ * than with the time it did not use.
+ */
+
+typedef struct decode_queue *decode_queue_p;
+typedef struct decode_flow *decode_flow_p;
+
+struct decode_fence {
+    unsigned int pending;   /* Jobs submitted and not finished yet, and holds */
+    int status;             /* Returned by the last job that finished */
+    decode_flow_p flow;     /* Flow of the surface's jobs, holding a reference, NULL before the first */
+};
+
+/* Embedded at the start of the caller's job structure */
+struct decode_job {
+    struct decode_job *next;
+    struct decode_fence *fence;
+    decode_flow_p flow;
+    unsigned long long deadline_ns;     /* CLOCK_MONOTONIC time to finish by, 0 for none, set by the caller */
+    unsigned long long queued_ns;       /* When the job was submitted */
+    unsigned long long started_ns;      /* When a worker took it */
+};
+
+struct decode_flow {
+    struct decode_flow *next;           /* In the queue's list of flows */
+    struct decode_flow *merged;         /* Flow that took over this one's jobs, NULL if none did */
+    struct decode_job *head;            /* Jobs waiting for a worker, oldest first */
+    struct decode_job *tail;
+    unsigned int references;            /* Contexts, fences and flows merged into this one */
+    unsigned int weight;                /* Sum of the weights of the contexts */
+    int priority;
+    unsigned int running;               /* Jobs taken by a worker and not finished yet */
+    unsigned int outstanding;           /* Jobs submitted and not finished yet, and holds */
+    unsigned long long vtime;           /* Decode time received over weight, in ns */
+    unsigned long long service_ns;      /* Moving average of the time its jobs run */
+};
+
+/*
+ * Runs a job and returns its status, which is stored in the job's fence.
+ * The job is put on the idle list afterwards for decode_queue_get_job().
+ */
+typedef int (*decode_job_func)(void *data, struct decode_job *job);
+
+/* Frees an idle job when the queue is destroyed */
+typedef void (*decode_job_free_func)(void *data, struct decode_job *job);
+
+struct decode_queue {
+    pthread_mutex_t mutex;
+    pthread_cond_t queued;      /* A job may be taken or the workers must stop */
+    pthread_cond_t done;        /* A job finished */
+    pthread_t *threads;
+    int num_threads;            /* 0 when decode_queue_submit() runs the job */
+    int stop;
+    struct decode_flow *flows;  /* Every flow, merged ones included */
+    unsigned int queued_jobs;   /* Jobs waiting for a worker */
+    unsigned long long vtime;   /* Virtual time of the last flow a job was taken from */
+    struct decode_job *idle;
+    unsigned int outstanding;   /* Jobs submitted and not finished yet, and holds */
+    decode_job_func run;
+    void *data;
+    unsigned long submitted;
+    unsigned long waits;        /* decode_queue_wait() calls that had to block */
+    unsigned int max_outstanding;
+};
+
+struct decode_queue_stats {
+    int num_threads;
+    unsigned long submitted;
+    unsigned long waits;
+    unsigned int max_outstanding;
+};
+
+/*
+ * Starts num_threads workers, none meaning jobs run in the submitting
+ * thread. Falls back to that if no thread can be created.
+ * Return 0 on success, -1 on error
+ */
+int
+decode_queue_init(decode_queue_p queue, decode_job_func run, void *data, int num_threads);
+
+/*
+ * Opens the flow of a new context, of weight 1 or more, merged with the
+ * flows of the num_fences fences so that the jobs of contexts sharing a
+ * surface stay in order. The fences get the flow.
+ * Returns the flow, NULL on error
+ */
+decode_flow_p
+decode_queue_open_flow(decode_queue_p queue, struct decode_fence **fences, int num_fences,
+                       unsigned int weight, int priority);
+
+/*
+ * Blocks until every job submitted on flow has finished
+ */
+void
+decode_queue_drain_flow(decode_queue_p queue, decode_flow_p flow);
+
+/*
+ * Takes the weight of a context off its flow once it is drained and drops
+ * the context's reference
+ */
+void
+decode_queue_close_flow(decode_queue_p queue, decode_flow_p flow, unsigned int weight);
+
+/*
+ * Blocks until the jobs of the flow of fence have finished and drops the
+ * fence's reference, for a surface about to go
+ */
+void
+decode_queue_detach(decode_queue_p queue, struct decode_fence *fence);
+
+/*
+ * Returns a finished job for reuse, or NULL if there is none
+ */
+struct decode_job *
+decode_queue_get_job(decode_queue_p queue);
+
+/*
+ * Queues a job on flow that signals fence when it finishes, merging the
+ * flow of fence into flow if it has another one
+ * Returns the job's status when it ran in the calling thread, 0 otherwise.
+ */
+int
+decode_queue_submit(decode_queue_p queue, struct decode_job *job, decode_flow_p flow,
+                    struct decode_fence *fence);
+
+/*
+ * Keeps fence pending after its job returns, for work the job left
+ * running elsewhere, until decode_queue_release(). Waits and drains,
+ * of the job's flow too, wait for that as well.
+ */
+void
+decode_queue_hold(decode_queue_p queue, struct decode_fence *fence);
+
+/*
+ * Ends a decode_queue_hold(), the status of the job stays
+ */
+void
+decode_queue_release(decode_queue_p queue, struct decode_fence *fence);
+
+/*
+ * Blocks until every job submitted with fence has finished
+ * Returns the fence's status
+ */
+int
+decode_queue_wait(decode_queue_p queue, struct decode_fence *fence);
+
+/*
+ * Returns non-zero while jobs submitted with fence have not finished
+ */
+int
+decode_queue_busy(decode_queue_p queue, struct decode_fence *fence);
+
+/*
+ * Blocks until every submitted job has finished
+ */
+void
+decode_queue_drain(decode_queue_p queue);
+
+/*
+ * Returns the submission and wait counters
+ */
+void
+decode_queue_get_stats(decode_queue_p queue, struct decode_queue_stats *stats);
+
+/*
+ * Finishes the queued jobs, stops the workers, frees the flows and passes
+ * the idle jobs to free_job
+ */
+void
+decode_queue_destroy(decode_queue_p queue, decode_job_free_func free_job);
+
+#endif /* DECODE_QUEUE_H */
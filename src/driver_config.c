@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) 2012 Scott Tincman <sctincman@gmail.com>. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <assert.h>
+#include "driver_config.h"
+
+#define ASSERT  assert
+
+#define DRIVER_CONFIG_ENV_PREFIX    "EPIPHANY_"
+
+/* Strips leading and trailing white space in place */
+static char *
+driver_config_strip(char *str)
+{
+    char *end;
+
+    while (isspace((unsigned char) *str)) {
+        str++;
+    }
+    end = str + strlen(str);
+    while (end > str && isspace((unsigned char) end[-1])) {
+        end--;
+    }
+    *end = '\0';
+    return str;
+}
+
+/*
+ * Reads the configuration file, a missing file is an empty one
+ * Return 0 on success, -1 if a line does not parse
+ */
+int
+driver_config_init(driver_config_p config)
+{
+    const char *path = getenv(DRIVER_CONFIG_ENV_PREFIX "DRIVER_CONFIG");
+    char line[DRIVER_CONFIG_MAX_KEY + DRIVER_CONFIG_MAX_VALUE + 64];
+    FILE *file;
+    int result = 0;
+
+    config->num_entries = 0;
+    file = fopen(path ? path : DRIVER_CONFIG_FILE, "r");
+    if (NULL == file) {
+        return 0;
+    }
+
+    while (fgets(line, sizeof(line), file)) {
+        struct driver_config_entry *entry;
+        char *key, *value, *p;
+
+        p = strchr(line, '#');
+        if (p) {
+            *p = '\0';
+        }
+        key = driver_config_strip(line);
+        if ('\0' == *key) {
+            continue;
+        }
+        p = strchr(key, '=');
+        if (NULL == p) {
+            result = -1;
+            continue;
+        }
+        *p = '\0';
+        key = driver_config_strip(key);
+        value = driver_config_strip(p + 1);
+        if ('\0' == *key || strlen(key) >= DRIVER_CONFIG_MAX_KEY ||
+            strlen(value) >= DRIVER_CONFIG_MAX_VALUE ||
+            config->num_entries == DRIVER_CONFIG_MAX_ENTRIES) {
+            result = -1;
+            continue;
+        }
+
+        /* A key set twice keeps the last value */
+        for (entry = config->entries; entry < config->entries + config->num_entries; entry++) {
+            if (0 == strcmp(entry->key, key)) {
+                break;
+            }
+        }
+        if (entry == config->entries + config->num_entries) {
+            config->num_entries++;
+        }
+        strcpy(entry->key, key);
+        strcpy(entry->value, value);
+    }
+    fclose(file);
+    return result;
+}
+
+/*
+ * Returns the value of key, NULL if it is not set
+ */
+const char *
+driver_config_get(driver_config_p config, const char *key)
+{
+    char name[sizeof(DRIVER_CONFIG_ENV_PREFIX) + DRIVER_CONFIG_MAX_KEY];
+    const char *value;
+    int i;
+
+    ASSERT(strlen(key) < DRIVER_CONFIG_MAX_KEY);
+    strcpy(name, DRIVER_CONFIG_ENV_PREFIX);
+    for (i = 0; key[i]; i++) {
+        name[sizeof(DRIVER_CONFIG_ENV_PREFIX) - 1 + i] = toupper((unsigned char) key[i]);
+    }
+    name[sizeof(DRIVER_CONFIG_ENV_PREFIX) - 1 + i] = '\0';
+    value = getenv(name);
+    if (value) {
+        return value;
+    }
+
+    for (i = 0; i < config->num_entries; i++) {
+        if (0 == strcmp(config->entries[i].key, key)) {
+            return config->entries[i].value;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Returns the value of key as a number, default_value if it is not set
+ */
+int
+driver_config_get_int(driver_config_p config, const char *key, int default_value)
+{
+    const char *value = driver_config_get(config, key);
+
+    return value ? atoi(value) : default_value;
+}
+
+/*
+ * Returns 1 if key is set to anything but "0", "no" or "false"
+ */
+int
+driver_config_enabled(driver_config_p config, const char *key)
+{
+    const char *value = driver_config_get(config, key);
+
+    if (NULL == value) {
+        return 0;
+    }
+    return strcmp(value, "0") && strcasecmp(value, "no") && strcasecmp(value, "false");
+}
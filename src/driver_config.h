@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2012 Scott Tincman <sctincman@gmail.com>. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef DRIVER_CONFIG_H
+#define DRIVER_CONFIG_H
+
+/*
+ * Driver settings. Each key can be set in the environment as EPIPHANY_<KEY>
+ * or in the configuration file named by EPIPHANY_DRIVER_CONFIG, by default
+ * /etc/epiphany_drv_video.conf, as "key = value" lines with '#' comments.
+ * The environment wins, so a setting can be tried without editing the file.
+ */
+
+#define DRIVER_CONFIG_FILE          "/etc/epiphany_drv_video.conf"
+#define DRIVER_CONFIG_MAX_ENTRIES   32
+#define DRIVER_CONFIG_MAX_KEY       32
+#define DRIVER_CONFIG_MAX_VALUE     128
+
+typedef struct driver_config *driver_config_p;
+
+struct driver_config_entry {
+    char key[DRIVER_CONFIG_MAX_KEY];
+    char value[DRIVER_CONFIG_MAX_VALUE];
+};
+
+struct driver_config {
+    int num_entries;
+    struct driver_config_entry entries[DRIVER_CONFIG_MAX_ENTRIES];
+};
+
+/*
+ * Reads the configuration file, a missing file is an empty one
+ * Return 0 on success, -1 if a line does not parse
+ */
+int
+driver_config_init(driver_config_p config);
+
+/*
+ * Returns the value of key, NULL if it is not set
+ */
+const char *
+driver_config_get(driver_config_p config, const char *key);
+
+/*
+ * Returns the value of key as a number, default_value if it is not set
+ */
+int
+driver_config_get_int(driver_config_p config, const char *key, int default_value);
+
+/*
+ * Returns 1 if key is set to anything but "0", "no" or "false"
+ */
+int
+driver_config_enabled(driver_config_p config, const char *key);
+
+#endif /* DRIVER_CONFIG_H */
@@ -0,0 +1,251 @@
+/*
+ * Copyright (c) 2012 Scott Tincman <sctincman@gmail.com>. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "config.h"
+#include <string.h>
+#include "dsp.h"
+
+static inline uint8_t
+clamp_u8(int value)
+{
+    return value < 0 ? 0 : (value > 255 ? 255 : value);
+}
+
+/* The SIMD passes store with signed saturation, so must we */
+static inline int16_t
+clamp_s16(int value)
+{
+    return value < -32768 ? -32768 : (value > 32767 ? 32767 : value);
+}
+
+/*
+ * One pass of the separable integer inverse DCT over 8 values step apart.
+ * Even and odd halves are computed separately and combined as butterflies.
+ */
+static inline void
+idct_1d(int16_t *x, int step, int shift)
+{
+    int x0 = x[0], x1 = x[step], x2 = x[2 * step], x3 = x[3 * step];
+    int x4 = x[4 * step], x5 = x[5 * step], x6 = x[6 * step], x7 = x[7 * step];
+    int bias = 1 << (shift - 1);
+    int a0, a1, a2, a3, b0, b1, b2, b3;
+
+    a0 = DSP_IDCT_W4 * x0 + DSP_IDCT_W2 * x2 + DSP_IDCT_W4 * x4 + DSP_IDCT_W6 * x6 + bias;
+    a1 = DSP_IDCT_W4 * x0 + DSP_IDCT_W6 * x2 - DSP_IDCT_W4 * x4 - DSP_IDCT_W2 * x6 + bias;
+    a2 = DSP_IDCT_W4 * x0 - DSP_IDCT_W6 * x2 - DSP_IDCT_W4 * x4 + DSP_IDCT_W2 * x6 + bias;
+    a3 = DSP_IDCT_W4 * x0 - DSP_IDCT_W2 * x2 + DSP_IDCT_W4 * x4 - DSP_IDCT_W6 * x6 + bias;
+
+    b0 = DSP_IDCT_W1 * x1 + DSP_IDCT_W3 * x3 + DSP_IDCT_W5 * x5 + DSP_IDCT_W7 * x7;
+    b1 = DSP_IDCT_W3 * x1 - DSP_IDCT_W7 * x3 - DSP_IDCT_W1 * x5 - DSP_IDCT_W5 * x7;
+    b2 = DSP_IDCT_W5 * x1 - DSP_IDCT_W1 * x3 + DSP_IDCT_W7 * x5 + DSP_IDCT_W3 * x7;
+    b3 = DSP_IDCT_W7 * x1 - DSP_IDCT_W5 * x3 + DSP_IDCT_W3 * x5 - DSP_IDCT_W1 * x7;
+
+    x[0] = clamp_s16((a0 + b0) >> shift);
+    x[step] = clamp_s16((a1 + b1) >> shift);
+    x[2 * step] = clamp_s16((a2 + b2) >> shift);
+    x[3 * step] = clamp_s16((a3 + b3) >> shift);
+    x[4 * step] = clamp_s16((a3 - b3) >> shift);
+    x[5 * step] = clamp_s16((a2 - b2) >> shift);
+    x[6 * step] = clamp_s16((a1 - b1) >> shift);
+    x[7 * step] = clamp_s16((a0 - b0) >> shift);
+}
+
+static void
+idct_c(int16_t *block)
+{
+    int i;
+
+    for (i = 0; i < 8; i++) {
+        int16_t *row = block + 8 * i;
+
+        /* Most rows of a coded block are empty, their transform is too */
+        if (row[0] == 0 && row[1] == 0 && row[2] == 0 && row[3] == 0 &&
+            row[4] == 0 && row[5] == 0 && row[6] == 0 && row[7] == 0)
+            continue;
+        idct_1d(row, 1, DSP_IDCT_ROW_SHIFT);
+    }
+    for (i = 0; i < 8; i++)
+        idct_1d(block + i, 8, DSP_IDCT_COL_SHIFT);
+}
+
+static void
+put_block_c(uint8_t *dst, ptrdiff_t stride, const int16_t *block)
+{
+    int x, y;
+
+    for (y = 0; y < 8; y++, dst += stride, block += 8)
+        for (x = 0; x < 8; x++)
+            dst[x] = clamp_u8(block[x]);
+}
+
+static void
+add_block_c(uint8_t *dst, ptrdiff_t stride, const int16_t *block)
+{
+    int x, y;
+
+    for (y = 0; y < 8; y++, dst += stride, block += 8)
+        for (x = 0; x < 8; x++)
+            dst[x] = clamp_u8(dst[x] + block[x]);
+}
+
+static void
+put_block_uv_c(uint8_t *dst, ptrdiff_t stride, const int16_t *u, const int16_t *v)
+{
+    int x, y;
+
+    for (y = 0; y < 8; y++, dst += stride, u += 8, v += 8) {
+        for (x = 0; x < 8; x++) {
+            dst[2 * x] = clamp_u8(u[x]);
+            dst[2 * x + 1] = clamp_u8(v[x]);
+        }
+    }
+}
+
+static void
+add_block_uv_c(uint8_t *dst, ptrdiff_t stride, const int16_t *u, const int16_t *v)
+{
+    int x, y;
+
+    for (y = 0; y < 8; y++, dst += stride, u += 8, v += 8) {
+        for (x = 0; x < 8; x++) {
+            dst[2 * x] = clamp_u8(dst[2 * x] + u[x]);
+            dst[2 * x + 1] = clamp_u8(dst[2 * x + 1] + v[x]);
+        }
+    }
+}
+
+/*
+ * Motion compensation. The prediction averages the sample pairs or quads a
+ * half-sample position sits between, rounding up. Horizontal neighbours are
+ * step bytes apart, 2 in interleaved chroma.
+ */
+static inline void
+mc_c(uint8_t *dst, ptrdiff_t dst_stride, const uint8_t *src, ptrdiff_t src_stride,
+     int width, int step, int height, int half_x, int half_y, int avg)
+{
+    int x, y;
+
+    for (y = 0; y < height; y++, dst += dst_stride, src += src_stride) {
+        const uint8_t *below = src + src_stride;
+
+        for (x = 0; x < width; x++) {
+            int p;
+
+            if (half_x && half_y)
+                p = (src[x] + src[x + step] + below[x] + below[x + step] + 2) >> 2;
+            else if (half_x)
+                p = (src[x] + src[x + step] + 1) >> 1;
+            else if (half_y)
+                p = (src[x] + below[x] + 1) >> 1;
+            else
+                p = src[x];
+            dst[x] = avg ? (dst[x] + p + 1) >> 1 : p;
+        }
+    }
+}
+
+#define MC_C(op, avg, name, width, step, half_x, half_y)                        \
+static void                                                                     \
+op##_pixels##name##_##half_x##half_y##_c(uint8_t *dst, ptrdiff_t dst_stride,    \
+                                         const uint8_t *src, ptrdiff_t src_stride, \
+                                         int height)                            \
+{                                                                               \
+    mc_c(dst, dst_stride, src, src_stride, width, step, height, half_x, half_y, avg); \
+}
+
+#define MC_C_ALL(name, width, step)             \
+    MC_C(put, 0, name, width, step, 0, 0)       \
+    MC_C(put, 0, name, width, step, 1, 0)       \
+    MC_C(put, 0, name, width, step, 0, 1)       \
+    MC_C(put, 0, name, width, step, 1, 1)       \
+    MC_C(avg, 1, name, width, step, 0, 0)       \
+    MC_C(avg, 1, name, width, step, 1, 0)       \
+    MC_C(avg, 1, name, width, step, 0, 1)       \
+    MC_C(avg, 1, name, width, step, 1, 1)
+
+MC_C_ALL(16, 16, 1)
+MC_C_ALL(8, 8, 1)
+MC_C_ALL(_uv, 16, 2)
+
+const struct dsp_ops dsp_c = {
+    "c",
+    idct_c,
+    put_block_c,
+    add_block_c,
+    put_block_uv_c,
+    add_block_uv_c,
+    {
+        { put_pixels16_00_c, put_pixels16_10_c, put_pixels16_01_c, put_pixels16_11_c },
+        { put_pixels8_00_c, put_pixels8_10_c, put_pixels8_01_c, put_pixels8_11_c },
+        { put_pixels_uv_00_c, put_pixels_uv_10_c, put_pixels_uv_01_c, put_pixels_uv_11_c },
+    },
+    {
+        { avg_pixels16_00_c, avg_pixels16_10_c, avg_pixels16_01_c, avg_pixels16_11_c },
+        { avg_pixels8_00_c, avg_pixels8_10_c, avg_pixels8_01_c, avg_pixels8_11_c },
+        { avg_pixels_uv_00_c, avg_pixels_uv_10_c, avg_pixels_uv_01_c, avg_pixels_uv_11_c },
+    },
+};
+
+/* Best first */
+static const struct dsp_ops *const dsp_all[] = {
+#if defined(__x86_64__) || defined(__i386__)
+    &dsp_sse2,
+#endif
+    &dsp_c,
+};
+
+static int
+dsp_cpu_supports(const struct dsp_ops *ops)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (ops == &dsp_sse2)
+        return __builtin_cpu_supports("sse2");
+#endif
+    return 1;
+}
+
+/*
+ * Returns the kernels called name, or the best ones this CPU supports if
+ * name is NULL or not supported
+ */
+const struct dsp_ops *
+dsp_get_ops(const char *name)
+{
+    unsigned int i;
+    const struct dsp_ops *best = NULL;
+
+    for (i = 0; i < sizeof(dsp_all) / sizeof(dsp_all[0]); i++) {
+        const struct dsp_ops *ops = dsp_all[i];
+
+        if (!dsp_cpu_supports(ops))
+            continue;
+        if (!best)
+            best = ops;
+        if (name && !strcmp(name, ops->name))
+            return ops;
+    }
+    return best;
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2012 Scott Tincman <sctincman@gmail.com>. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef DSP_H
+#define DSP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Pixel kernels shared by the software decoders: the 8x8 inverse DCT,
+ * writing reconstructed blocks and half-sample motion compensation. Like
+ * the image_convert kernels they come in a portable C version and SIMD
+ * versions picked at runtime, and the SIMD ones match the C ones exactly.
+ */
+
+/* Inverse DCT, 2^14 * sqrt(2) * cos(k * pi / 16) */
+#define DSP_IDCT_W1     22725
+#define DSP_IDCT_W2     21407
+#define DSP_IDCT_W3     19266
+#define DSP_IDCT_W4     16383
+#define DSP_IDCT_W5     12873
+#define DSP_IDCT_W6     8867
+#define DSP_IDCT_W7     4520
+#define DSP_IDCT_ROW_SHIFT      11
+#define DSP_IDCT_COL_SHIFT      20
+
+/* Block widths for the motion compensation tables */
+#define DSP_MC_16       0
+#define DSP_MC_8        1
+#define DSP_MC_UV       2       /* 8 samples of NV12 chroma, 16 bytes of UV pairs */
+
+typedef void (*dsp_mc_func)(uint8_t *dst, ptrdiff_t dst_stride,
+                            const uint8_t *src, ptrdiff_t src_stride, int height);
+
+struct dsp_ops {
+    const char *name;
+    /* In place inverse DCT of 64 row-major coefficients */
+    void (*idct)(int16_t *block);
+    /* Writes an 8x8 block clamped to 0..255 */
+    void (*put_block)(uint8_t *dst, ptrdiff_t stride, const int16_t *block);
+    /* Adds an 8x8 block of residuals to dst, clamped to 0..255 */
+    void (*add_block)(uint8_t *dst, ptrdiff_t stride, const int16_t *block);
+    /* The same for interleaved NV12 chroma, from separate U and V blocks */
+    void (*put_block_uv)(uint8_t *dst, ptrdiff_t stride, const int16_t *u, const int16_t *v);
+    void (*add_block_uv)(uint8_t *dst, ptrdiff_t stride, const int16_t *u, const int16_t *v);
+    /*
+     * Half-sample prediction of a block, indexed by [DSP_MC_*][(half_y << 1) |
+     * half_x]. put stores the prediction, avg averages it into dst rounding up.
+     */
+    dsp_mc_func put_pixels[3][4];
+    dsp_mc_func avg_pixels[3][4];
+};
+
+extern const struct dsp_ops dsp_c;
+#if defined(__x86_64__) || defined(__i386__)
+extern const struct dsp_ops dsp_sse2;
+#endif
+
+/*
+ * Returns the kernels called name ("c" or "sse2"), or the best ones this
+ * CPU supports if name is NULL or not supported
+ */
+const struct dsp_ops *
+dsp_get_ops(const char *name);
+
+#endif /* DSP_H */
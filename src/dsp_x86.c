@@ -0,0 +1,324 @@
+/*
+ * Copyright (c) 2012 Scott Tincman <sctincman@gmail.com>. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+/*
+ * SSE2 versions of the dsp kernels, built with a per-function target
+ * attribute like the image_convert ones.
+ */
+
+#include "config.h"
+#include "dsp.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+#define SSE2    __attribute__((target("sse2")))
+
+/* Coefficient pair (c0, c1) repeated for _mm_madd_epi16 on interleaved inputs */
+#define PAIR(c0, c1)    _mm_set_epi16(c1, c0, c1, c0, c1, c0, c1, c0)
+
+static inline SSE2 void
+transpose8x8(__m128i *r)
+{
+    __m128i a0 = _mm_unpacklo_epi16(r[0], r[1]), a1 = _mm_unpackhi_epi16(r[0], r[1]);
+    __m128i a2 = _mm_unpacklo_epi16(r[2], r[3]), a3 = _mm_unpackhi_epi16(r[2], r[3]);
+    __m128i a4 = _mm_unpacklo_epi16(r[4], r[5]), a5 = _mm_unpackhi_epi16(r[4], r[5]);
+    __m128i a6 = _mm_unpacklo_epi16(r[6], r[7]), a7 = _mm_unpackhi_epi16(r[6], r[7]);
+    __m128i b0 = _mm_unpacklo_epi32(a0, a2), b1 = _mm_unpackhi_epi32(a0, a2);
+    __m128i b2 = _mm_unpacklo_epi32(a1, a3), b3 = _mm_unpackhi_epi32(a1, a3);
+    __m128i b4 = _mm_unpacklo_epi32(a4, a6), b5 = _mm_unpackhi_epi32(a4, a6);
+    __m128i b6 = _mm_unpacklo_epi32(a5, a7), b7 = _mm_unpackhi_epi32(a5, a7);
+
+    r[0] = _mm_unpacklo_epi64(b0, b4);
+    r[1] = _mm_unpackhi_epi64(b0, b4);
+    r[2] = _mm_unpacklo_epi64(b1, b5);
+    r[3] = _mm_unpackhi_epi64(b1, b5);
+    r[4] = _mm_unpacklo_epi64(b2, b6);
+    r[5] = _mm_unpackhi_epi64(b2, b6);
+    r[6] = _mm_unpacklo_epi64(b3, b7);
+    r[7] = _mm_unpackhi_epi64(b3, b7);
+}
+
+/*
+ * The 1-D transform of idct_1d() on four lanes, from inputs interleaved as
+ * (x0, x2), (x4, x6), (x1, x3) and (x5, x7) pairs. _mm_madd_epi16 gives the
+ * same 32-bit sums as the C code.
+ */
+static inline SSE2 void
+idct_half(__m128i p02, __m128i p46, __m128i p13, __m128i p57, __m128i bias, __m128i shift,
+          __m128i *y)
+{
+    __m128i a0, a1, a2, a3, b0, b1, b2, b3;
+
+    a0 = _mm_add_epi32(_mm_madd_epi16(p02, PAIR(DSP_IDCT_W4, DSP_IDCT_W2)),
+                       _mm_madd_epi16(p46, PAIR(DSP_IDCT_W4, DSP_IDCT_W6)));
+    a1 = _mm_add_epi32(_mm_madd_epi16(p02, PAIR(DSP_IDCT_W4, DSP_IDCT_W6)),
+                       _mm_madd_epi16(p46, PAIR(-DSP_IDCT_W4, -DSP_IDCT_W2)));
+    a2 = _mm_add_epi32(_mm_madd_epi16(p02, PAIR(DSP_IDCT_W4, -DSP_IDCT_W6)),
+                       _mm_madd_epi16(p46, PAIR(-DSP_IDCT_W4, DSP_IDCT_W2)));
+    a3 = _mm_add_epi32(_mm_madd_epi16(p02, PAIR(DSP_IDCT_W4, -DSP_IDCT_W2)),
+                       _mm_madd_epi16(p46, PAIR(DSP_IDCT_W4, -DSP_IDCT_W6)));
+    a0 = _mm_add_epi32(a0, bias);
+    a1 = _mm_add_epi32(a1, bias);
+    a2 = _mm_add_epi32(a2, bias);
+    a3 = _mm_add_epi32(a3, bias);
+
+    b0 = _mm_add_epi32(_mm_madd_epi16(p13, PAIR(DSP_IDCT_W1, DSP_IDCT_W3)),
+                       _mm_madd_epi16(p57, PAIR(DSP_IDCT_W5, DSP_IDCT_W7)));
+    b1 = _mm_add_epi32(_mm_madd_epi16(p13, PAIR(DSP_IDCT_W3, -DSP_IDCT_W7)),
+                       _mm_madd_epi16(p57, PAIR(-DSP_IDCT_W1, -DSP_IDCT_W5)));
+    b2 = _mm_add_epi32(_mm_madd_epi16(p13, PAIR(DSP_IDCT_W5, -DSP_IDCT_W1)),
+                       _mm_madd_epi16(p57, PAIR(DSP_IDCT_W7, DSP_IDCT_W3)));
+    b3 = _mm_add_epi32(_mm_madd_epi16(p13, PAIR(DSP_IDCT_W7, -DSP_IDCT_W5)),
+                       _mm_madd_epi16(p57, PAIR(DSP_IDCT_W3, -DSP_IDCT_W1)));
+
+    y[0] = _mm_sra_epi32(_mm_add_epi32(a0, b0), shift);
+    y[1] = _mm_sra_epi32(_mm_add_epi32(a1, b1), shift);
+    y[2] = _mm_sra_epi32(_mm_add_epi32(a2, b2), shift);
+    y[3] = _mm_sra_epi32(_mm_add_epi32(a3, b3), shift);
+    y[4] = _mm_sra_epi32(_mm_sub_epi32(a3, b3), shift);
+    y[5] = _mm_sra_epi32(_mm_sub_epi32(a2, b2), shift);
+    y[6] = _mm_sra_epi32(_mm_sub_epi32(a1, b1), shift);
+    y[7] = _mm_sra_epi32(_mm_sub_epi32(a0, b0), shift);
+}
+
+/* Transforms the 8 columns of r at once */
+static inline SSE2 void
+idct_columns(__m128i *r, int shift)
+{
+    __m128i bias = _mm_set1_epi32(1 << (shift - 1));
+    __m128i count = _mm_cvtsi32_si128(shift);
+    __m128i lo[8], hi[8];
+    int i;
+
+    idct_half(_mm_unpacklo_epi16(r[0], r[2]), _mm_unpacklo_epi16(r[4], r[6]),
+              _mm_unpacklo_epi16(r[1], r[3]), _mm_unpacklo_epi16(r[5], r[7]), bias, count, lo);
+    idct_half(_mm_unpackhi_epi16(r[0], r[2]), _mm_unpackhi_epi16(r[4], r[6]),
+              _mm_unpackhi_epi16(r[1], r[3]), _mm_unpackhi_epi16(r[5], r[7]), bias, count, hi);
+    for (i = 0; i < 8; i++)
+        r[i] = _mm_packs_epi32(lo[i], hi[i]);
+}
+
+static SSE2 void
+idct_sse2(int16_t *block)
+{
+    __m128i r[8];
+    int i;
+
+    for (i = 0; i < 8; i++)
+        r[i] = _mm_loadu_si128((const __m128i *)(block + 8 * i));
+
+    /* Rows as columns of the transposed block, then back */
+    transpose8x8(r);
+    idct_columns(r, DSP_IDCT_ROW_SHIFT);
+    transpose8x8(r);
+    idct_columns(r, DSP_IDCT_COL_SHIFT);
+
+    for (i = 0; i < 8; i++)
+        _mm_storeu_si128((__m128i *)(block + 8 * i), r[i]);
+}
+
+static SSE2 void
+put_block_sse2(uint8_t *dst, ptrdiff_t stride, const int16_t *block)
+{
+    int y;
+
+    for (y = 0; y < 8; y += 2, dst += 2 * stride, block += 16) {
+        __m128i p = _mm_packus_epi16(_mm_loadu_si128((const __m128i *) block),
+                                     _mm_loadu_si128((const __m128i *)(block + 8)));
+
+        _mm_storel_epi64((__m128i *) dst, p);
+        _mm_storel_epi64((__m128i *)(dst + stride), _mm_srli_si128(p, 8));
+    }
+}
+
+static SSE2 void
+add_block_sse2(uint8_t *dst, ptrdiff_t stride, const int16_t *block)
+{
+    const __m128i zero = _mm_setzero_si128();
+    int y;
+
+    for (y = 0; y < 8; y += 2, dst += 2 * stride, block += 16) {
+        __m128i d0 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) dst), zero);
+        __m128i d1 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(dst + stride)), zero);
+        __m128i p;
+
+        d0 = _mm_adds_epi16(d0, _mm_loadu_si128((const __m128i *) block));
+        d1 = _mm_adds_epi16(d1, _mm_loadu_si128((const __m128i *)(block + 8)));
+        p = _mm_packus_epi16(d0, d1);
+        _mm_storel_epi64((__m128i *) dst, p);
+        _mm_storel_epi64((__m128i *)(dst + stride), _mm_srli_si128(p, 8));
+    }
+}
+
+static SSE2 void
+put_block_uv_sse2(uint8_t *dst, ptrdiff_t stride, const int16_t *u, const int16_t *v)
+{
+    int y;
+
+    for (y = 0; y < 8; y++, dst += stride, u += 8, v += 8) {
+        __m128i a = _mm_loadu_si128((const __m128i *) u);
+        __m128i b = _mm_loadu_si128((const __m128i *) v);
+
+        _mm_storeu_si128((__m128i *) dst,
+                         _mm_packus_epi16(_mm_unpacklo_epi16(a, b), _mm_unpackhi_epi16(a, b)));
+    }
+}
+
+static SSE2 void
+add_block_uv_sse2(uint8_t *dst, ptrdiff_t stride, const int16_t *u, const int16_t *v)
+{
+    const __m128i zero = _mm_setzero_si128();
+    int y;
+
+    for (y = 0; y < 8; y++, dst += stride, u += 8, v += 8) {
+        __m128i a = _mm_loadu_si128((const __m128i *) u);
+        __m128i b = _mm_loadu_si128((const __m128i *) v);
+        __m128i d = _mm_loadu_si128((const __m128i *) dst);
+        __m128i lo = _mm_adds_epi16(_mm_unpacklo_epi8(d, zero), _mm_unpacklo_epi16(a, b));
+        __m128i hi = _mm_adds_epi16(_mm_unpackhi_epi8(d, zero), _mm_unpackhi_epi16(a, b));
+
+        _mm_storeu_si128((__m128i *) dst, _mm_packus_epi16(lo, hi));
+    }
+}
+
+/*
+ * Motion compensation. Rounding-up averages of two samples are pavgb, the
+ * four sample average needs 16-bit lanes to round like the C code.
+ */
+static inline SSE2 __m128i
+load16(const uint8_t *p)
+{
+    return _mm_loadu_si128((const __m128i *) p);
+}
+
+static inline SSE2 __m128i
+load8(const uint8_t *p)
+{
+    return _mm_loadl_epi64((const __m128i *) p);
+}
+
+static inline SSE2 void
+store16(uint8_t *p, __m128i v)
+{
+    _mm_storeu_si128((__m128i *) p, v);
+}
+
+static inline SSE2 void
+store8(uint8_t *p, __m128i v)
+{
+    _mm_storel_epi64((__m128i *) p, v);
+}
+
+/* Sums of horizontally adjacent samples, low and high 8 in 16-bit lanes */
+static inline SSE2 void
+pair_sums(const uint8_t *src, int step, __m128i (*load)(const uint8_t *), __m128i *lo, __m128i *hi)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i a = load(src), b = load(src + step);
+
+    *lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+    *hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+}
+
+static inline SSE2 void
+mc_sse2(uint8_t *dst, ptrdiff_t dst_stride, const uint8_t *src, ptrdiff_t src_stride,
+        int step, int height, int half_x, int half_y, int avg,
+        __m128i (*load)(const uint8_t *), void (*store)(uint8_t *, __m128i))
+{
+    const __m128i two = _mm_set1_epi16(2);
+    __m128i lo0, hi0, lo1, hi1;
+    int y;
+
+    if (half_x && half_y)
+        pair_sums(src, step, load, &lo0, &hi0);
+
+    for (y = 0; y < height; y++, dst += dst_stride, src += src_stride) {
+        __m128i p;
+
+        if (half_x && half_y) {
+            pair_sums(src + src_stride, step, load, &lo1, &hi1);
+            p = _mm_packus_epi16(_mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(lo0, lo1), two), 2),
+                                 _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(hi0, hi1), two), 2));
+            lo0 = lo1;
+            hi0 = hi1;
+        } else if (half_x) {
+            p = _mm_avg_epu8(load(src), load(src + step));
+        } else if (half_y) {
+            p = _mm_avg_epu8(load(src), load(src + src_stride));
+        } else {
+            p = load(src);
+        }
+        if (avg)
+            p = _mm_avg_epu8(p, load(dst));
+        store(dst, p);
+    }
+}
+
+#define MC_SSE2(op, avg, name, width, step, half_x, half_y)                     \
+static SSE2 void                                                                \
+op##_pixels##name##_##half_x##half_y##_sse2(uint8_t *dst, ptrdiff_t dst_stride, \
+                                            const uint8_t *src, ptrdiff_t src_stride, \
+                                            int height)                         \
+{                                                                               \
+    mc_sse2(dst, dst_stride, src, src_stride, step, height, half_x, half_y, avg, \
+            load##width, store##width);                                         \
+}
+
+#define MC_SSE2_ALL(name, width, step)              \
+    MC_SSE2(put, 0, name, width, step, 0, 0)        \
+    MC_SSE2(put, 0, name, width, step, 1, 0)        \
+    MC_SSE2(put, 0, name, width, step, 0, 1)        \
+    MC_SSE2(put, 0, name, width, step, 1, 1)        \
+    MC_SSE2(avg, 1, name, width, step, 0, 0)        \
+    MC_SSE2(avg, 1, name, width, step, 1, 0)        \
+    MC_SSE2(avg, 1, name, width, step, 0, 1)        \
+    MC_SSE2(avg, 1, name, width, step, 1, 1)
+
+MC_SSE2_ALL(16, 16, 1)
+MC_SSE2_ALL(8, 8, 1)
+MC_SSE2_ALL(_uv, 16, 2)
+
+const struct dsp_ops dsp_sse2 = {
+    "sse2",
+    idct_sse2,
+    put_block_sse2,
+    add_block_sse2,
+    put_block_uv_sse2,
+    add_block_uv_sse2,
+    {
+        { put_pixels16_00_sse2, put_pixels16_10_sse2, put_pixels16_01_sse2, put_pixels16_11_sse2 },
+        { put_pixels8_00_sse2, put_pixels8_10_sse2, put_pixels8_01_sse2, put_pixels8_11_sse2 },
+        { put_pixels_uv_00_sse2, put_pixels_uv_10_sse2, put_pixels_uv_01_sse2, put_pixels_uv_11_sse2 },
+    },
+    {
+        { avg_pixels16_00_sse2, avg_pixels16_10_sse2, avg_pixels16_01_sse2, avg_pixels16_11_sse2 },
+        { avg_pixels8_00_sse2, avg_pixels8_10_sse2, avg_pixels8_01_sse2, avg_pixels8_11_sse2 },
+        { avg_pixels_uv_00_sse2, avg_pixels_uv_10_sse2, avg_pixels_uv_01_sse2, avg_pixels_uv_11_sse2 },
+    },
+};
+
+#endif /* __x86_64__ || __i386__ */
@@ -0,0 +1,468 @@
+/*
+ * Copyright (c) 2012 Scott Tincman <sctincman@gmail.com>. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "emesh.h"
+
+#define ASSERT  assert
+
+/*
+ * Fills in the timing of an E16 (Epiphany-III) at 600 MHz
+ */
+void
+emesh_default_params(struct emesh_params *params)
+{
+    params->clock_mhz = 600;
+    params->dma_bytes_per_cycle = 8;
+    params->dma_setup = 20;
+    params->dma_row_overhead = 2;
+    params->hop_latency = 2;            /* 1.5 on the datasheet */
+    params->external_latency = 150;
+    params->elink_mb_per_s = 1200;
+}
+
+/*
+ * Parses "RxC", e.g. "4x4"
+ * Return 0 on success, -1 on error
+ */
+int
+emesh_parse_geometry(const char *str, int *rows, int *cols)
+{
+    char *end;
+    long r, c;
+
+    r = strtol(str, &end, 10);
+    if (end == str || (*end != 'x' && *end != 'X')) {
+        return -1;
+    }
+    str = end + 1;
+    c = strtol(str, &end, 10);
+    if (end == str || *end != '\0') {
+        return -1;
+    }
+    if (r < 1 || r > EMESH_MAX_ROWS || c < 1 || c > EMESH_MAX_COLS) {
+        return -1;
+    }
+    *rows = (int) r;
+    *cols = (int) c;
+    return 0;
+}
+
+/* The core whose local memory holds ptr, or NULL for off-chip memory */
+static emesh_core_p
+emesh_local_owner(emesh_p mesh, const void *ptr)
+{
+    const uint8_t *p = ptr;
+    const uint8_t *base = (const uint8_t *) mesh->cores;
+    size_t offset, index;
+
+    if (p < base || p >= (const uint8_t *) (mesh->cores + mesh->num_cores)) {
+        return NULL;
+    }
+    offset = p - base;
+    index = offset / sizeof(struct emesh_core);
+    if (p < mesh->cores[index].local || p >= mesh->cores[index].local + EMESH_LOCAL_SIZE) {
+        return NULL;
+    }
+    return &mesh->cores[index];
+}
+
+static unsigned int
+emesh_hops(emesh_core_p a, int row, int col)
+{
+    return abs(a->row - row) + abs(a->col - col);
+}
+
+/* Cycles the off-chip link needs to move bytes */
+static uint64_t
+emesh_elink_cycles(const struct emesh_params *params, uint64_t bytes)
+{
+    return (bytes * params->clock_mhz + params->elink_mb_per_s - 1) / params->elink_mb_per_s;
+}
+
+static void *
+emesh_core_thread(void *data)
+{
+    emesh_core_p core = data;
+    emesh_p mesh = core->mesh;
+
+    pthread_mutex_lock(&mesh->mutex);
+    for (;;) {
+        while (NULL == core->kernel && !mesh->stop) {
+            pthread_cond_wait(&core->wake, &mesh->mutex);
+        }
+        if (NULL == core->kernel) {
+            break;
+        }
+        pthread_mutex_unlock(&mesh->mutex);
+
+        core->kernel(core, core->arg);
+
+        pthread_mutex_lock(&mesh->mutex);
+        core->kernel = NULL;
+        if (--mesh->running == 0) {
+            pthread_cond_signal(&mesh->done);
+        }
+    }
+    pthread_mutex_unlock(&mesh->mutex);
+    return NULL;
+}
+
+/*
+ * Starts one thread per core
+ * Return 0 on success, -1 on error
+ */
+int
+emesh_init(emesh_p mesh, int rows, int cols, const struct emesh_params *params)
+{
+    void *cores;
+    int i;
+
+    if (rows < 1 || rows > EMESH_MAX_ROWS || cols < 1 || cols > EMESH_MAX_COLS) {
+        return -1;
+    }
+    if (posix_memalign(&cores, 64, rows * cols * sizeof(struct emesh_core))) {
+        return -1;
+    }
+    memset(cores, 0, rows * cols * sizeof(struct emesh_core));
+
+    pthread_mutex_init(&mesh->mutex, NULL);
+    pthread_mutex_init(&mesh->run_mutex, NULL);
+    pthread_cond_init(&mesh->done, NULL);
+    mesh->params = *params;
+    mesh->rows = rows;
+    mesh->cols = cols;
+    mesh->num_cores = rows * cols;
+    mesh->running = 0;
+    mesh->stop = 0;
+    mesh->cores = cores;
+    mesh->launches = 0;
+    mesh->cycles = 0;
+    mesh->compute_cycles = 0;
+    mesh->stall_cycles = 0;
+    mesh->dma_bytes = 0;
+    mesh->external_bytes = 0;
+    mesh->elink_bound_cycles = 0;
+    mesh->max_local_used = 0;
+
+    for (i = 0; i < mesh->num_cores; i++) {
+        emesh_core_p core = &mesh->cores[i];
+
+        core->mesh = mesh;
+        core->row = i / cols;
+        core->col = i % cols;
+        pthread_cond_init(&core->wake, NULL);
+        if (pthread_create(&core->thread, NULL, emesh_core_thread, core)) {
+            pthread_cond_destroy(&core->wake);
+            mesh->num_cores = i;
+            emesh_destroy(mesh);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Runs kernel on the first num_cores cores in row-major order, core i
+ * getting args[i], and waits for all of them
+ * Returns the simulated cycles the launch took.
+ */
+uint64_t
+emesh_run(emesh_p mesh, emesh_kernel_func kernel, void **args, int num_cores)
+{
+    uint64_t cycles = 0, external_bytes = 0, elink;
+    int i, c;
+
+    if (num_cores > mesh->num_cores) {
+        num_cores = mesh->num_cores;
+    }
+    if (num_cores <= 0) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&mesh->run_mutex);
+    pthread_mutex_lock(&mesh->mutex);
+    for (i = 0; i < num_cores; i++) {
+        emesh_core_p core = &mesh->cores[i];
+
+        /* The start signal travels from the link corner like a message */
+        core->clock = emesh_hops(core, 0, 0) * mesh->params.hop_latency;
+        for (c = 0; c < EMESH_DMA_CHANNELS; c++) {
+            core->dma_done[c] = 0;
+        }
+        core->local_used = 0;
+        core->mailbox.head = 0;
+        core->mailbox.count = 0;
+        core->compute_cycles = 0;
+        core->stall_cycles = 0;
+        core->dma_bytes = 0;
+        core->external_bytes = 0;
+        core->arg = args[i];
+        core->kernel = kernel;
+    }
+    mesh->running = num_cores;
+    for (i = 0; i < num_cores; i++) {
+        pthread_cond_signal(&mesh->cores[i].wake);
+    }
+    while (mesh->running) {
+        pthread_cond_wait(&mesh->done, &mesh->mutex);
+    }
+
+    for (i = 0; i < num_cores; i++) {
+        emesh_core_p core = &mesh->cores[i];
+        /* Outstanding transfers and the completion signal back to the host */
+        uint64_t end = core->clock;
+
+        for (c = 0; c < EMESH_DMA_CHANNELS; c++) {
+            if (core->dma_done[c] > end) {
+                end = core->dma_done[c];
+            }
+        }
+        end += emesh_hops(core, 0, 0) * mesh->params.hop_latency;
+        if (end > cycles) {
+            cycles = end;
+        }
+        external_bytes += core->external_bytes;
+        mesh->compute_cycles += core->compute_cycles;
+        mesh->stall_cycles += core->stall_cycles;
+        mesh->dma_bytes += core->dma_bytes;
+        if (core->local_used > mesh->max_local_used) {
+            mesh->max_local_used = core->local_used;
+        }
+    }
+    /* Cores model their transfers alone, the link they share bounds the launch */
+    elink = emesh_elink_cycles(&mesh->params, external_bytes);
+    if (elink > cycles) {
+        mesh->elink_bound_cycles += elink - cycles;
+        cycles = elink;
+    }
+    mesh->external_bytes += external_bytes;
+    mesh->cycles += cycles;
+    mesh->launches++;
+    pthread_mutex_unlock(&mesh->mutex);
+    pthread_mutex_unlock(&mesh->run_mutex);
+    return cycles;
+}
+
+/*
+ * Kernel side: carves size bytes out of the core's local memory, which is
+ * reset at every launch
+ * Returns NULL when the 32 KB are exhausted
+ */
+void *
+emesh_local_alloc(emesh_core_p core, size_t size)
+{
+    size_t offset = (core->local_used + EMESH_LOCAL_ALIGNMENT - 1) & ~(size_t) (EMESH_LOCAL_ALIGNMENT - 1);
+
+    if (size > EMESH_LOCAL_SIZE - offset) {
+        return NULL;
+    }
+    core->local_used = offset + size;
+    return core->local + offset;
+}
+
+/*
+ * Kernel side: starts a 2D transfer of rows lines of width bytes on
+ * channel, waiting for the channel's previous transfer to finish first.
+ * One end must be in the core's local memory, the other one is off-chip
+ * unless it is in another core's local memory.
+ */
+void
+emesh_dma_start(emesh_core_p core, int channel, void *dst, ptrdiff_t dst_stride,
+                const void *src, ptrdiff_t src_stride, size_t width, int rows)
+{
+    const struct emesh_params *params = &core->mesh->params;
+    emesh_core_p dst_core = emesh_local_owner(core->mesh, dst);
+    emesh_core_p src_core = emesh_local_owner(core->mesh, src);
+    emesh_core_p remote;
+    uint64_t bytes = (uint64_t) width * rows, start, cycles;
+    int i;
+
+    ASSERT(channel >= 0 && channel < EMESH_DMA_CHANNELS);
+    ASSERT(dst_core == core || src_core == core);
+
+    for (i = 0; i < rows; i++) {
+        memcpy((uint8_t *) dst + i * dst_stride, (const uint8_t *) src + i * src_stride, width);
+    }
+
+    /* A channel works through its descriptors in order */
+    start = core->clock + params->dma_setup;
+    if (core->dma_done[channel] > start) {
+        start = core->dma_done[channel];
+    }
+    core->clock += params->dma_setup;
+    core->compute_cycles += params->dma_setup;
+
+    cycles = (bytes + params->dma_bytes_per_cycle - 1) / params->dma_bytes_per_cycle +
+             (uint64_t) rows * params->dma_row_overhead;
+    remote = dst_core == core ? src_core : dst_core;
+    if (NULL == remote) {
+        uint64_t elink = emesh_elink_cycles(params, bytes);
+
+        /* Off-chip memory hangs off the link at the mesh corner */
+        cycles = (elink > cycles ? elink : cycles) + params->external_latency +
+                 emesh_hops(core, 0, 0) * params->hop_latency;
+        core->external_bytes += bytes;
+    } else {
+        cycles += emesh_hops(core, remote->row, remote->col) * params->hop_latency;
+    }
+    core->dma_done[channel] = start + cycles;
+    core->dma_bytes += bytes;
+}
+
+/*
+ * Kernel side: waits for the transfer on channel to finish
+ */
+void
+emesh_dma_wait(emesh_core_p core, int channel)
+{
+    ASSERT(channel >= 0 && channel < EMESH_DMA_CHANNELS);
+
+    if (core->dma_done[channel] > core->clock) {
+        core->stall_cycles += core->dma_done[channel] - core->clock;
+        core->clock = core->dma_done[channel];
+    }
+}
+
+/*
+ * Kernel side: emesh_dma_start() followed by emesh_dma_wait()
+ */
+void
+emesh_dma_copy(emesh_core_p core, int channel, void *dst, ptrdiff_t dst_stride,
+               const void *src, ptrdiff_t src_stride, size_t width, int rows)
+{
+    emesh_dma_start(core, channel, dst, dst_stride, src, src_stride, width, rows);
+    emesh_dma_wait(core, channel);
+}
+
+/*
+ * Kernel side: posts message to the mailbox of the core at (row, col)
+ * Return 0 on success, -1 if the mailbox is full
+ */
+int
+emesh_mailbox_send(emesh_core_p core, int row, int col, uint32_t message)
+{
+    emesh_p mesh = core->mesh;
+    emesh_core_p target;
+    struct emesh_mailbox *mailbox;
+    unsigned int slot;
+
+    if (row < 0 || row >= mesh->rows || col < 0 || col >= mesh->cols) {
+        return -1;
+    }
+    target = &mesh->cores[row * mesh->cols + col];
+    mailbox = &target->mailbox;
+
+    pthread_mutex_lock(&mesh->mutex);
+    if (mailbox->count == EMESH_MAILBOX_DEPTH) {
+        pthread_mutex_unlock(&mesh->mutex);
+        return -1;
+    }
+    /* A single write into the target's memory */
+    core->clock++;
+    core->compute_cycles++;
+    slot = (mailbox->head + mailbox->count++) % EMESH_MAILBOX_DEPTH;
+    mailbox->message[slot] = message;
+    mailbox->arrival[slot] = core->clock + emesh_hops(core, row, col) * mesh->params.hop_latency;
+    pthread_cond_signal(&target->wake);
+    pthread_mutex_unlock(&mesh->mutex);
+    return 0;
+}
+
+/*
+ * Kernel side: waits for a message from another core
+ */
+uint32_t
+emesh_mailbox_receive(emesh_core_p core)
+{
+    emesh_p mesh = core->mesh;
+    struct emesh_mailbox *mailbox = &core->mailbox;
+    uint32_t message;
+    uint64_t arrival;
+
+    pthread_mutex_lock(&mesh->mutex);
+    while (0 == mailbox->count) {
+        pthread_cond_wait(&core->wake, &mesh->mutex);
+    }
+    message = mailbox->message[mailbox->head];
+    arrival = mailbox->arrival[mailbox->head];
+    mailbox->head = (mailbox->head + 1) % EMESH_MAILBOX_DEPTH;
+    mailbox->count--;
+    pthread_mutex_unlock(&mesh->mutex);
+
+    if (arrival > core->clock) {
+        core->stall_cycles += arrival - core->clock;
+        core->clock = arrival;
+    }
+    return message;
+}
+
+/*
+ * Returns the totals over all launches
+ */
+void
+emesh_get_stats(emesh_p mesh, struct emesh_stats *stats)
+{
+    pthread_mutex_lock(&mesh->mutex);
+    stats->rows = mesh->rows;
+    stats->cols = mesh->cols;
+    stats->clock_mhz = mesh->params.clock_mhz;
+    stats->launches = mesh->launches;
+    stats->cycles = mesh->cycles;
+    stats->compute_cycles = mesh->compute_cycles;
+    stats->stall_cycles = mesh->stall_cycles;
+    stats->dma_bytes = mesh->dma_bytes;
+    stats->external_bytes = mesh->external_bytes;
+    stats->elink_bound_cycles = mesh->elink_bound_cycles;
+    stats->max_local_used = mesh->max_local_used;
+    pthread_mutex_unlock(&mesh->mutex);
+}
+
+/*
+ * Stops the core threads
+ */
+void
+emesh_destroy(emesh_p mesh)
+{
+    int i;
+
+    pthread_mutex_lock(&mesh->mutex);
+    mesh->stop = 1;
+    for (i = 0; i < mesh->num_cores; i++) {
+        pthread_cond_signal(&mesh->cores[i].wake);
+    }
+    pthread_mutex_unlock(&mesh->mutex);
+
+    for (i = 0; i < mesh->num_cores; i++) {
+        pthread_join(mesh->cores[i].thread, NULL);
+        pthread_cond_destroy(&mesh->cores[i].wake);
+    }
+    free(mesh->cores);
+    mesh->cores = NULL;
+    pthread_cond_destroy(&mesh->done);
+    pthread_mutex_destroy(&mesh->run_mutex);
+    pthread_mutex_destroy(&mesh->mutex);
+}
@@ -0,0 +1,227 @@
+/*
+ * Copyright (c) 2012 Scott Tincman <sctincman@gmail.com>. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef EMESH_H
+#define EMESH_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Host emulation of an Epiphany eMesh, so work can be partitioned for the
+ * coprocessor and timed without a board. Every core is a host thread with
+ * its own 32 KB local memory, two DMA channels and a mailbox. Kernels run
+ * natively on the host; what is modelled is time: each core keeps a clock
+ * in simulated cycles, advanced by the compute cycles a kernel charges and
+ * by the latency and bandwidth of its DMA transfers and messages. A launch
+ * takes as long as its slowest core, or the off-chip link if that is
+ * saturated.
+ *
+ * The copy behind a DMA transfer happens when it is started, kernels must
+ * still wait on the channel before using the data for the timing to hold.
+ */
+
+#define EMESH_LOCAL_SIZE        (32 * 1024)
+#define EMESH_LOCAL_ALIGNMENT   16
+#define EMESH_DMA_CHANNELS      2
+#define EMESH_MAILBOX_DEPTH     16
+#define EMESH_MAX_ROWS          8
+#define EMESH_MAX_COLS          8
+
+typedef struct emesh *emesh_p;
+typedef struct emesh_core *emesh_core_p;
+
+/* Runs on one core, arg is what was passed to emesh_run() for it */
+typedef void (*emesh_kernel_func)(emesh_core_p core, void *arg);
+
+/* Timing model, in core clock cycles unless noted */
+struct emesh_params {
+    unsigned int clock_mhz;
+    unsigned int dma_bytes_per_cycle;   /* One DMA channel */
+    unsigned int dma_setup;             /* Programming a descriptor */
+    unsigned int dma_row_overhead;      /* Per line of a 2D transfer */
+    unsigned int hop_latency;           /* Per router a transfer or message passes */
+    unsigned int external_latency;      /* Round trip to off-chip memory */
+    unsigned int elink_mb_per_s;        /* Off-chip link, shared by all cores */
+};
+
+struct emesh_mailbox {
+    uint32_t message[EMESH_MAILBOX_DEPTH];
+    uint64_t arrival[EMESH_MAILBOX_DEPTH];  /* Receiver clock the message lands at */
+    unsigned int head;
+    unsigned int count;
+};
+
+struct emesh_core {
+    struct emesh *mesh;
+    int row;
+    int col;
+    pthread_t thread;
+    pthread_cond_t wake;        /* Mailbox written */
+    struct emesh_mailbox mailbox;
+    emesh_kernel_func kernel;
+    void *arg;
+    /* Owned by the core's thread while a kernel runs */
+    uint64_t clock;
+    uint64_t dma_done[EMESH_DMA_CHANNELS];  /* Clock each channel finishes at */
+    size_t local_used;
+    uint64_t compute_cycles;
+    uint64_t stall_cycles;      /* Waiting on DMA or mailboxes */
+    uint64_t dma_bytes;
+    uint64_t external_bytes;
+    uint8_t local[EMESH_LOCAL_SIZE] __attribute__((aligned(64)));
+};
+
+struct emesh {
+    pthread_mutex_t mutex;      /* Mailboxes, launch state */
+    pthread_mutex_t run_mutex;  /* One launch at a time */
+    pthread_cond_t done;        /* A core finished its kernel */
+    struct emesh_params params;
+    int rows;
+    int cols;
+    int num_cores;
+    int running;                /* Cores still running the current launch */
+    int stop;
+    struct emesh_core *cores;   /* Row-major */
+    /* Totals over all launches */
+    unsigned long launches;
+    uint64_t cycles;
+    uint64_t compute_cycles;
+    uint64_t stall_cycles;
+    uint64_t dma_bytes;
+    uint64_t external_bytes;
+    uint64_t elink_bound_cycles;    /* Added because the link was the bottleneck */
+    size_t max_local_used;
+};
+
+struct emesh_stats {
+    int rows;
+    int cols;
+    unsigned int clock_mhz;
+    unsigned long launches;
+    uint64_t cycles;            /* Sum of the launch times */
+    uint64_t compute_cycles;    /* Summed over cores */
+    uint64_t stall_cycles;
+    uint64_t dma_bytes;
+    uint64_t external_bytes;
+    uint64_t elink_bound_cycles;
+    size_t max_local_used;
+};
+
+/*
+ * Fills in the timing of an E16 (Epiphany-III) at 600 MHz
+ */
+void
+emesh_default_params(struct emesh_params *params);
+
+/*
+ * Parses "RxC", e.g. "4x4"
+ * Return 0 on success, -1 on error
+ */
+int
+emesh_parse_geometry(const char *str, int *rows, int *cols);
+
+/*
+ * Starts one thread per core
+ * Return 0 on success, -1 on error
+ */
+int
+emesh_init(emesh_p mesh, int rows, int cols, const struct emesh_params *params);
+
+/*
+ * Runs kernel on the first num_cores cores in row-major order, core i
+ * getting args[i], and waits for all of them
+ * Returns the simulated cycles the launch took.
+ */
+uint64_t
+emesh_run(emesh_p mesh, emesh_kernel_func kernel, void **args, int num_cores);
+
+/*
+ * Kernel side: carves size bytes out of the core's local memory, which is
+ * reset at every launch
+ * Returns NULL when the 32 KB are exhausted
+ */
+void *
+emesh_local_alloc(emesh_core_p core, size_t size);
+
+/*
+ * Kernel side: charges cycles of computation to the core
+ */
+static inline void
+emesh_compute(emesh_core_p core, unsigned int cycles)
+{
+    core->clock += cycles;
+    core->compute_cycles += cycles;
+}
+
+/*
+ * Kernel side: starts a 2D transfer of rows lines of width bytes on
+ * channel, waiting for the channel's previous transfer to finish first.
+ * One end must be in the core's local memory, the other one is off-chip
+ * unless it is in another core's local memory.
+ */
+void
+emesh_dma_start(emesh_core_p core, int channel, void *dst, ptrdiff_t dst_stride,
+                const void *src, ptrdiff_t src_stride, size_t width, int rows);
+
+/*
+ * Kernel side: waits for the transfer on channel to finish
+ */
+void
+emesh_dma_wait(emesh_core_p core, int channel);
+
+/*
+ * Kernel side: emesh_dma_start() followed by emesh_dma_wait()
+ */
+void
+emesh_dma_copy(emesh_core_p core, int channel, void *dst, ptrdiff_t dst_stride,
+               const void *src, ptrdiff_t src_stride, size_t width, int rows);
+
+/*
+ * Kernel side: posts message to the mailbox of the core at (row, col)
+ * Return 0 on success, -1 if the mailbox is full
+ */
+int
+emesh_mailbox_send(emesh_core_p core, int row, int col, uint32_t message);
+
+/*
+ * Kernel side: waits for a message from another core
+ */
+uint32_t
+emesh_mailbox_receive(emesh_core_p core);
+
+/*
+ * Returns the totals over all launches
+ */
+void
+emesh_get_stats(emesh_p mesh, struct emesh_stats *stats);
+
+/*
+ * Stops the core threads
+ */
+void
+emesh_destroy(emesh_p mesh);
+
+#endif /* EMESH_H */
@@ -0,0 +1,501 @@
+/*
+ * Copyright (c) 2012 Scott Tincman <sctincman@gmail.com>. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "epiphany_backend.h"
+#include "epiphany_h264.h"
+#include "epiphany_jpeg.h"
+#include "epiphany_vc1.h"
+#include "epiphany_mpeg2.h"
+#include "epiphany_mpeg4.h"
+
+/* A picture handed over by vaEndPicture, decoded by the decode queue */
+struct backend_decode_job {
+    struct decode_job base;
+    object_context_p obj_context;
+    object_surface_p obj_surface;
+    struct epiphany_picture picture;
+};
+
+static unsigned long long
+backend_time_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Reconstructs picture into obj_surface from the buffers rendered for it */
+static VAStatus
+backend_decode_codec_picture(struct epiphany_driver_data *driver_data, object_context_p obj_context,
+                       const struct epiphany_picture *picture, object_surface_p obj_surface)
+{
+    switch ((int) obj_context->profile) {
+    case VAProfileMPEG2Simple:
+    case VAProfileMPEG2Main:
+        if (VAEntrypointMoComp == obj_context->entrypoint)
+            return epiphany_mpeg2_render_macroblocks(driver_data, obj_context, picture, obj_surface);
+        return epiphany_mpeg2_decode_picture(driver_data, obj_context, picture, obj_surface);
+
+    case VAProfileMPEG4Simple:
+    case VAProfileMPEG4AdvancedSimple:
+    case VAProfileMPEG4Main:
+        return epiphany_mpeg4_decode_picture(driver_data, obj_context, picture, obj_surface);
+
+    case VAProfileH264Baseline:
+    case VAProfileH264Main:
+    case VAProfileH264High:
+        return epiphany_h264_decode_picture(driver_data, obj_context, picture, obj_surface);
+
+    case VAProfileVC1Simple:
+    case VAProfileVC1Main:
+    case VAProfileVC1Advanced:
+        return epiphany_vc1_decode_picture(driver_data, obj_context, picture, obj_surface);
+
+#ifdef HAVE_VA_JPEG_DECODE
+    case VAProfileJPEGBaseline:
+        return epiphany_jpeg_decode_picture(driver_data, obj_context, picture, obj_surface);
+#endif
+
+    default:
+        return VA_STATUS_SUCCESS;
+    }
+}
+
+/*
+ * Decodes picture on this thread and at most decode_threads - 1 threads of
+ * the pool at once
+ */
+static VAStatus
+backend_decode_picture(struct epiphany_driver_data *driver_data, object_context_p obj_context,
+                       const struct epiphany_picture *picture, object_surface_p obj_surface)
+{
+    VAStatus vaStatus;
+
+    if (NULL == obj_context->thread_pool)
+        return backend_decode_codec_picture(driver_data, obj_context, picture, obj_surface);
+    thread_pool_enter(obj_context->thread_pool, &obj_context->thread_group);
+    vaStatus = backend_decode_codec_picture(driver_data, obj_context, picture, obj_surface);
+    thread_pool_leave(obj_context->thread_pool, &obj_context->thread_group);
+    return vaStatus;
+}
+
+/*
+ * Frees the codec state kept in obj_context->decoder
+ */
+void
+epiphany_backend_destroy_decoder(object_context_p obj_context)
+{
+    if (NULL == obj_context->decoder)
+        return;
+
+    switch ((int) obj_context->profile) {
+    case VAProfileMPEG2Simple:
+    case VAProfileMPEG2Main:
+        epiphany_mpeg2_destroy_decoder(obj_context->decoder);
+        break;
+
+    case VAProfileMPEG4Simple:
+    case VAProfileMPEG4AdvancedSimple:
+    case VAProfileMPEG4Main:
+        epiphany_mpeg4_destroy_decoder(obj_context->decoder);
+        break;
+
+    case VAProfileH264Baseline:
+    case VAProfileH264Main:
+    case VAProfileH264High:
+        epiphany_h264_destroy_decoder(obj_context->decoder);
+        break;
+
+    case VAProfileVC1Simple:
+    case VAProfileVC1Main:
+    case VAProfileVC1Advanced:
+        epiphany_vc1_destroy_decoder(obj_context->decoder);
+        break;
+
+#ifdef HAVE_VA_JPEG_DECODE
+    case VAProfileJPEGBaseline:
+        epiphany_jpeg_destroy_decoder(obj_context->decoder);
+        break;
+#endif
+
+    default:
+        break;
+    }
+    obj_context->decoder = NULL;
+}
+
+/*
+ * Every backend decodes through the decode queue, each context on a flow
+ * shared with the contexts rendering into its surfaces
+ */
+VAStatus
+epiphany_backend_open_context(struct epiphany_driver_data *driver_data, object_context_p obj_context)
+{
+    struct decode_fence **fences = NULL;
+    object_surface_p obj_surface;
+    int i, num_fences = 0;
+
+    if (obj_context->num_render_targets > 0) {
+        fences = malloc(obj_context->num_render_targets * sizeof(*fences));
+        if (NULL == fences)
+            return VA_STATUS_ERROR_ALLOCATION_FAILED;
+    }
+    for (i = 0; i < obj_context->num_render_targets; i++) {
+        obj_surface = SURFACE(obj_context->render_targets[i]);
+        if (obj_surface)
+            fences[num_fences++] = &obj_surface->fence;
+    }
+    obj_context->decode_flow = decode_queue_open_flow(&driver_data->decode_queue, fences, num_fences,
+                                                      obj_context->decode_weight, obj_context->decode_priority);
+    free(fences);
+    if (NULL == obj_context->decode_flow)
+        return VA_STATUS_ERROR_ALLOCATION_FAILED;
+    return VA_STATUS_SUCCESS;
+}
+
+void
+epiphany_backend_close_context(struct epiphany_driver_data *driver_data, object_context_p obj_context)
+{
+    if (NULL == obj_context->decode_flow)
+        return;
+    decode_queue_drain_flow(&driver_data->decode_queue, obj_context->decode_flow);
+    decode_queue_close_flow(&driver_data->decode_queue, obj_context->decode_flow, obj_context->decode_weight);
+    obj_context->decode_flow = NULL;
+}
+
+/* Pictures predicting from the surface are on its flow */
+void
+epiphany_backend_detach_surface(struct epiphany_driver_data *driver_data, object_surface_p obj_surface)
+{
+    decode_queue_detach(&driver_data->decode_queue, &obj_surface->fence);
+}
+
+/* The fences also count the holds */
+void
+epiphany_backend_hold_surface(struct epiphany_driver_data *driver_data, object_surface_p obj_surface)
+{
+    decode_queue_hold(&driver_data->decode_queue, &obj_surface->fence);
+}
+
+void
+epiphany_backend_release_surface(struct epiphany_driver_data *driver_data, object_surface_p obj_surface)
+{
+    decode_queue_release(&driver_data->decode_queue, &obj_surface->fence);
+}
+
+static int
+backend_run_decode_job(void *data, struct decode_job *job)
+{
+    struct epiphany_driver_data *driver_data = data;
+    struct backend_decode_job *decode_job = (struct backend_decode_job *) job;
+    object_context_p obj_context = decode_job->obj_context;
+    VAStatus vaStatus;
+
+    if (driver_data->report_stats) {
+        unsigned long long delay = job->started_ns - job->queued_ns;
+
+        STATS_ADD(obj_context->queue_pictures, 1);
+        STATS_ADD(obj_context->queue_delay_ns, delay);
+        STATS_MAX(obj_context->queue_max_delay_ns, delay);
+    }
+    if (driver_data->report_stats && (unsigned int) obj_context->profile < EPIPHANY_MAX_PROFILE_STATS) {
+        unsigned long long start = backend_time_ns(), ns;
+
+        vaStatus = backend_decode_picture(driver_data, obj_context, &decode_job->picture, decode_job->obj_surface);
+        ns = backend_time_ns() - start;
+        STATS_ADD(driver_data->decode_ns[obj_context->profile], ns);
+        STATS_ADD(driver_data->decode_pictures[obj_context->profile], 1);
+        if (VAEntrypointVLD == obj_context->entrypoint) {
+            STATS_ADD(driver_data->strategy_ns[obj_context->decode_strategy], ns);
+            STATS_ADD(driver_data->strategy_pictures[obj_context->decode_strategy], 1);
+            STATS_MAX(driver_data->strategy_max_ns[obj_context->decode_strategy], ns);
+        }
+    } else {
+        vaStatus = backend_decode_picture(driver_data, obj_context, &decode_job->picture, decode_job->obj_surface);
+    }
+
+    if (driver_data->report_stats && job->deadline_ns && backend_time_ns() > job->deadline_ns)
+        STATS_ADD(obj_context->queue_deadlines_missed, 1);
+
+    /* The buffers are done with, the lists stay for the next picture */
+    epiphany_release_picture_buffers(driver_data, &decode_job->picture);
+    decode_job->obj_context = NULL;
+    decode_job->obj_surface = NULL;
+    return vaStatus;
+}
+
+static void
+backend_free_decode_job(void *data, struct decode_job *job)
+{
+    struct backend_decode_job *decode_job = (struct backend_decode_job *) job;
+
+    epiphany_destroy_picture(&decode_job->picture);
+    free(decode_job);
+}
+
+/* Points every kernel table at the kernels called name, the best ones if it is NULL */
+static void
+backend_select_kernels(struct epiphany_driver_data *driver_data, const char *name)
+{
+    driver_data->convert_ops = image_convert_get_ops(name);
+    driver_data->dsp_ops = dsp_get_ops(name);
+    driver_data->h264_dsp_ops = h264_dsp_get_ops(name);
+    driver_data->jpeg_dsp_ops = jpeg_dsp_get_ops(name);
+    driver_data->mpeg4_dsp_ops = mpeg4_dsp_get_ops(name);
+    driver_data->vc1_dsp_ops = vc1_dsp_get_ops(name);
+}
+
+/*
+ * The CPU backends only differ in the kernels and whether decoding is
+ * threaded, on "queue_threads" threads, 1 by default, if it is
+ */
+static VAStatus
+cpu_init(struct epiphany_driver_data *driver_data, const char *kernels, int threaded)
+{
+    int threads = 0;
+
+    if (threaded) {
+        threads = driver_config_get_int(&driver_data->config, "queue_threads", 1);
+        if (threads < 1 || threads > VA_EPIPHANY_MAX_DECODE_THREADS)
+            threads = 1;
+    }
+    backend_select_kernels(driver_data, kernels);
+    driver_data->emesh = NULL;
+    if (decode_queue_init(&driver_data->decode_queue, backend_run_decode_job, driver_data, threads) < 0)
+        return VA_STATUS_ERROR_ALLOCATION_FAILED;
+    return VA_STATUS_SUCCESS;
+}
+
+static VAStatus
+cpu_scalar_init(struct epiphany_driver_data *driver_data)
+{
+    return cpu_init(driver_data, "c", 0);
+}
+
+/* EPIPHANY_SIMD=c|sse2|avx2|neon still forces a kernel set, mostly for comparing them */
+static VAStatus
+cpu_simd_init(struct epiphany_driver_data *driver_data)
+{
+    return cpu_init(driver_data, driver_config_get(&driver_data->config, "simd"), 0);
+}
+
+static VAStatus
+cpu_threaded_init(struct epiphany_driver_data *driver_data)
+{
+    return cpu_init(driver_data, driver_config_get(&driver_data->config, "simd"), 1);
+}
+
+static void
+cpu_terminate(struct epiphany_driver_data *driver_data)
+{
+    decode_queue_destroy(&driver_data->decode_queue, backend_free_decode_job);
+}
+
+static VAStatus
+cpu_submit_picture(struct epiphany_driver_data *driver_data, object_context_p obj_context,
+                   object_surface_p obj_surface)
+{
+    struct backend_decode_job *job;
+    struct epiphany_picture picture;
+
+    job = (struct backend_decode_job *) decode_queue_get_job(&driver_data->decode_queue);
+    if (NULL == job) {
+        job = calloc(1, sizeof(*job));
+        if (NULL == job)
+            return VA_STATUS_ERROR_ALLOCATION_FAILED;
+        epiphany_init_picture(&job->picture);
+    }
+
+    /* The job takes the buffers, the context gets the job's empty lists back */
+    picture = job->picture;
+    job->picture = obj_context->picture;
+    obj_context->picture = picture;
+    job->obj_context = obj_context;
+    job->obj_surface = obj_surface;
+    job->base.deadline_ns = 0;
+    if (obj_context->decode_deadline)
+        job->base.deadline_ns = backend_time_ns() + obj_context->decode_deadline * 1000ULL;
+    return decode_queue_submit(&driver_data->decode_queue, &job->base, obj_context->decode_flow,
+                               &obj_surface->fence);
+}
+
+static VAStatus
+cpu_wait_surface(struct epiphany_driver_data *driver_data, object_surface_p obj_surface)
+{
+    if (NULL == obj_surface) {
+        decode_queue_drain(&driver_data->decode_queue);
+        return VA_STATUS_SUCCESS;
+    }
+    return decode_queue_wait(&driver_data->decode_queue, &obj_surface->fence);
+}
+
+static int
+cpu_surface_busy(struct epiphany_driver_data *driver_data, object_surface_p obj_surface)
+{
+    return decode_queue_busy(&driver_data->decode_queue, &obj_surface->fence);
+}
+
+static struct surface_storage *
+cpu_alloc_surface_storage(struct epiphany_driver_data *driver_data, int width, int height)
+{
+    return surface_pool_alloc(&driver_data->surface_pool, width, height);
+}
+
+static void
+cpu_free_surface_storage(struct epiphany_driver_data *driver_data, struct surface_storage *storage)
+{
+    surface_pool_release(&driver_data->surface_pool, storage);
+}
+
+/* The decoders write straight into host memory, mapping is just waiting for them */
+static void *
+cpu_map_surface(struct epiphany_driver_data *driver_data, object_surface_p obj_surface)
+{
+    decode_queue_wait(&driver_data->decode_queue, &obj_surface->fence);
+    return obj_surface->storage->data;
+}
+
+static void
+cpu_unmap_surface(struct epiphany_driver_data *driver_data, object_surface_p obj_surface)
+{
+}
+
+/*
+ * The mesh shares the surfaces with the host like the board's shared DRAM
+ * window would, so only starting and stopping it differs from cpu-threaded
+ */
+static VAStatus
+emesh_backend_init(struct epiphany_driver_data *driver_data)
+{
+    const char *geometry = driver_config_get(&driver_data->config, "emesh");
+    struct emesh_params params;
+    int rows, cols;
+    VAStatus vaStatus;
+
+    if (emesh_parse_geometry(geometry ? geometry : EPIPHANY_DEFAULT_EMESH, &rows, &cols) < 0)
+        return VA_STATUS_ERROR_INVALID_VALUE;
+
+    vaStatus = cpu_init(driver_data, driver_config_get(&driver_data->config, "simd"), 1);
+    if (VA_STATUS_SUCCESS != vaStatus)
+        return vaStatus;
+
+    emesh_default_params(&params);
+    driver_data->emesh = malloc(sizeof(struct emesh));
+    if (NULL == driver_data->emesh || emesh_init(driver_data->emesh, rows, cols, &params) < 0) {
+        free(driver_data->emesh);
+        driver_data->emesh = NULL;
+        cpu_terminate(driver_data);
+        return VA_STATUS_ERROR_ALLOCATION_FAILED;
+    }
+    return VA_STATUS_SUCCESS;
+}
+
+static void
+emesh_backend_terminate(struct epiphany_driver_data *driver_data)
+{
+    cpu_terminate(driver_data);
+    emesh_destroy(driver_data->emesh);
+    free(driver_data->emesh);
+    driver_data->emesh = NULL;
+}
+
+static const struct epiphany_backend_ops backend_cpu_scalar = {
+    "cpu-scalar",
+    cpu_scalar_init,
+    cpu_terminate,
+    cpu_submit_picture,
+    cpu_wait_surface,
+    cpu_surface_busy,
+    cpu_alloc_surface_storage,
+    cpu_free_surface_storage,
+    cpu_map_surface,
+    cpu_unmap_surface,
+};
+
+static const struct epiphany_backend_ops backend_cpu_simd = {
+    "cpu-simd",
+    cpu_simd_init,
+    cpu_terminate,
+    cpu_submit_picture,
+    cpu_wait_surface,
+    cpu_surface_busy,
+    cpu_alloc_surface_storage,
+    cpu_free_surface_storage,
+    cpu_map_surface,
+    cpu_unmap_surface,
+};
+
+static const struct epiphany_backend_ops backend_cpu_threaded = {
+    "cpu-threaded",
+    cpu_threaded_init,
+    cpu_terminate,
+    cpu_submit_picture,
+    cpu_wait_surface,
+    cpu_surface_busy,
+    cpu_alloc_surface_storage,
+    cpu_free_surface_storage,
+    cpu_map_surface,
+    cpu_unmap_surface,
+};
+
+static const struct epiphany_backend_ops backend_emesh = {
+    "emesh",
+    emesh_backend_init,
+    emesh_backend_terminate,
+    cpu_submit_picture,
+    cpu_wait_surface,
+    cpu_surface_busy,
+    cpu_alloc_surface_storage,
+    cpu_free_surface_storage,
+    cpu_map_surface,
+    cpu_unmap_surface,
+};
+
+static const struct epiphany_backend_ops *const backend_all[] = {
+    &backend_cpu_scalar,
+    &backend_cpu_simd,
+    &backend_cpu_threaded,
+    &backend_emesh,
+};
+
+/*
+ * Returns the backend called name, NULL if there is none
+ */
+const struct epiphany_backend_ops *
+epiphany_backend_get_ops(const char *name)
+{
+    unsigned int i;
+
+    for (i = 0; i < sizeof(backend_all) / sizeof(backend_all[0]); i++) {
+        if (0 == strcmp(name, backend_all[i]->name))
+            return backend_all[i];
+    }
+    return NULL;
+}
@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) 2012 Scott Tincman <sctincman@gmail.com>. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef _EPIPHANY_BACKEND_H_
+#define _EPIPHANY_BACKEND_H_
+
+#include "epiphany_drv_video.h"
+
+/*
+ * Where pictures get decoded. The VA entry points only keep track of the
+ * objects and go through the backend picked at __vaDriverInit for anything
+ * that computes or touches pixels, so the implementations below run the
+ * same VA call stream and can be timed against each other:
+ *
+ *   cpu-scalar     decodes in vaEndPicture with the C kernels
+ *   cpu-simd       decodes in vaEndPicture with the best SIMD kernels
+ *   cpu-threaded   decodes on worker threads, "queue_threads" of them and
+ *                  1 by default, with the SIMD kernels
+ *   emesh          cpu-threaded, running the paths ported to the
+ *                  coprocessor on an emulated mesh (emesh = RxC, 4x4 by
+ *                  default). Only MPEG-2 is, VLD and MoComp, the other
+ *                  codecs decode as with cpu-threaded.
+ *
+ * The backend is set with EPIPHANY_BACKEND or "backend" in the driver
+ * configuration file, see driver_config.h.
+ */
+
+#define EPIPHANY_DEFAULT_BACKEND    "cpu-threaded"
+#define EPIPHANY_DEFAULT_EMESH      "4x4"
+
+struct epiphany_backend_ops {
+    const char *name;
+
+    /*
+     * Picks the pixel kernels and starts whatever decodes the pictures
+     * Return VA_STATUS_SUCCESS or an error if it could not start
+     */
+    VAStatus (*init)(struct epiphany_driver_data *driver_data);
+
+    /* Stops the backend, nothing may be in flight any more */
+    void (*terminate)(struct epiphany_driver_data *driver_data);
+
+    /*
+     * Decodes the buffers rendered into obj_context->picture into
+     * obj_surface, taking them over and leaving the picture empty.
+     * Returns the decode status if decoding is synchronous, errors of
+     * asynchronous decoding are returned by wait_surface().
+     */
+    VAStatus (*submit_picture)(struct epiphany_driver_data *driver_data, object_context_p obj_context,
+                               object_surface_p obj_surface);
+
+    /*
+     * Waits until the pictures submitted for obj_surface are decoded, or all
+     * of them if obj_surface is NULL
+     * Returns the status of the last picture decoded into obj_surface.
+     */
+    VAStatus (*wait_surface)(struct epiphany_driver_data *driver_data, object_surface_p obj_surface);
+
+    /* Returns nonzero while a picture is still being decoded into obj_surface */
+    int (*surface_busy)(struct epiphany_driver_data *driver_data, object_surface_p obj_surface);
+
+    /* Storage for the NV12 planes of a width x height surface, NULL on error */
+    struct surface_storage *(*alloc_surface_storage)(struct epiphany_driver_data *driver_data,
+                                                     int width, int height);
+    void (*free_surface_storage)(struct epiphany_driver_data *driver_data, struct surface_storage *storage);
+
+    /*
+     * Makes the planes of obj_surface accessible to the host once decoding
+     * into them is done, until unmap_surface()
+     * Returns the address of the Y plane, laid out like obj_surface->storage.
+     */
+    void *(*map_surface)(struct epiphany_driver_data *driver_data, object_surface_p obj_surface);
+    void (*unmap_surface)(struct epiphany_driver_data *driver_data, object_surface_p obj_surface);
+};
+
+/*
+ * Returns the backend called name, NULL if there is none
+ */
+const struct epiphany_backend_ops *
+epiphany_backend_get_ops(const char *name);
+
+/*
+ * Frees the codec state kept in obj_context->decoder
+ */
+void
+epiphany_backend_destroy_decoder(object_context_p obj_context);
+
+/*
+ * Puts obj_context on the decode queue's schedule, next to the contexts
+ * sharing render targets with it
+ * Return VA_STATUS_SUCCESS or an error
+ */
+VAStatus
+epiphany_backend_open_context(struct epiphany_driver_data *driver_data, object_context_p obj_context);
+
+/*
+ * Waits for the pictures of obj_context, and of the contexts sharing
+ * surfaces with it, and takes it off the schedule
+ */
+void
+epiphany_backend_close_context(struct epiphany_driver_data *driver_data, object_context_p obj_context);
+
+/*
+ * Waits for the pictures decoded into or predicted from obj_surface before
+ * it is destroyed
+ */
+void
+epiphany_backend_detach_surface(struct epiphany_driver_data *driver_data, object_surface_p obj_surface);
+
+/*
+ * Keeps obj_surface busy after the decode call for it returns, for codecs
+ * finishing pictures on their own threads, until
+ * epiphany_backend_release_surface(). Waiting for the surface, or for all
+ * of them, waits for that too.
+ */
+void
+epiphany_backend_hold_surface(struct epiphany_driver_data *driver_data, object_surface_p obj_surface);
+
+/*
+ * Marks the picture held in obj_surface decoded
+ */
+void
+epiphany_backend_release_surface(struct epiphany_driver_data *driver_data, object_surface_p obj_surface);
+
+#endif /* _EPIPHANY_BACKEND_H_ */
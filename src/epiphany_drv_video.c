@@ -28,26 +28,42 @@
 #include "sysdeps.h"
 
 #include "epiphany_drv_video.h"
+#include "epiphany_backend.h"
 
 #include "assert.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
+#include <limits.h>
+#include <unistd.h>
 
 #define ASSERT	assert
 
 #define INIT_DRIVER_DATA	struct epiphany_driver_data * const driver_data = (struct epiphany_driver_data *) ctx->pDriverData;
 
-#define CONFIG(id)  ((object_config_p) object_heap_lookup( &driver_data->config_heap, id ))
-#define CONTEXT(id) ((object_context_p) object_heap_lookup( &driver_data->context_heap, id ))
-#define SURFACE(id)	((object_surface_p) object_heap_lookup( &driver_data->surface_heap, id ))
-#define BUFFER(id)  ((object_buffer_p) object_heap_lookup( &driver_data->buffer_heap, id ))
+#define CONFIG_ID_OFFSET		0x10000000
+#define CONTEXT_ID_OFFSET		0x20000000
+#define SURFACE_ID_OFFSET		0x30000000
+#define BUFFER_ID_OFFSET		0x40000000
+#define IMAGE_ID_OFFSET			0x50000000
 
-#define CONFIG_ID_OFFSET		0x01000000
-#define CONTEXT_ID_OFFSET		0x02000000
-#define SURFACE_ID_OFFSET		0x04000000
-#define BUFFER_ID_OFFSET		0x08000000
+/* Objects per buffer heap bucket, must be a power of two */
+#define EPIPHANY_BUFFER_HEAP_BUCKET_SIZE	64
+
+/* Default upper bound on buffer storage kept for reuse, EPIPHANY_BUFFER_POOL_MB overrides it */
+#define EPIPHANY_BUFFER_POOL_MAX_CACHED		(64 << 20)
+
+/* Default upper bound on surface storage kept for reuse, EPIPHANY_SURFACE_POOL_MB overrides it */
+#define EPIPHANY_SURFACE_POOL_MAX_CACHED	(256 << 20)
+
+/* A heap is trimmed when a context goes away and it has this many slots reserved per object in use */
+#define EPIPHANY_HEAP_TRIM_RATIO		4
+
+/* When a context goes away the buffer pool keeps at most 1/N of its cache while other contexts run */
+#define EPIPHANY_BUFFER_POOL_TRIM_RATIO		4
+
+#define ALIGN(value, alignment)	(((value) + (alignment) - 1) & ~((alignment) - 1))
 
 static void epiphany__error_message(const char *msg, ...)
 {
@@ -88,6 +104,9 @@ VAStatus epiphany_QueryConfigProfiles(
     profile_list[i++] = VAProfileVC1Simple;
     profile_list[i++] = VAProfileVC1Main;
     profile_list[i++] = VAProfileVC1Advanced;
+#ifdef HAVE_VA_JPEG_DECODE
+    profile_list[i++] = VAProfileJPEGBaseline;
+#endif
 
     /* If the assert fails then EPIPHANY_MAX_PROFILES needs to be bigger */
     ASSERT(i <= EPIPHANY_MAX_PROFILES);
@@ -132,6 +151,13 @@ VAStatus epiphany_QueryConfigEntrypoints(
                 entrypoint_list[0] = VAEntrypointVLD;
                 break;
 
+#ifdef HAVE_VA_JPEG_DECODE
+        case VAProfileJPEGBaseline:
+                *num_entrypoints = 1;
+                entrypoint_list[0] = VAEntrypointVLD;
+                break;
+#endif
+
         default:
                 *num_entrypoints = 0;
                 break;
@@ -142,6 +168,29 @@ VAStatus epiphany_QueryConfigEntrypoints(
     return VA_STATUS_SUCCESS;
 }
 
+/*
+ * Returns how many workers the contexts share, "pool_threads", by default
+ * one per core left by the decode queue
+ */
+static int epiphany__pool_workers(struct epiphany_driver_data *driver_data)
+{
+    int queue_threads = driver_data->decode_queue.num_threads ? driver_data->decode_queue.num_threads : 1;
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int workers;
+
+    workers = driver_config_get_int(&driver_data->config, "pool_threads",
+                                    (cores > queue_threads) ? (int) cores - queue_threads : 0);
+    if (workers < 0)
+    {
+        workers = 0;
+    }
+    else if (workers > VA_EPIPHANY_MAX_DECODE_THREADS - 1)
+    {
+        workers = VA_EPIPHANY_MAX_DECODE_THREADS - 1;
+    }
+    return workers;
+}
+
 VAStatus epiphany_GetConfigAttributes(
 		VADriverContextP ctx,
 		VAProfile profile,
@@ -150,18 +199,51 @@ VAStatus epiphany_GetConfigAttributes(
 		int num_attribs
 	)
 {
+    INIT_DRIVER_DATA
     int i;
 
     /* Other attributes don't seem to be defined */
     /* What to do if we don't know the attribute? */
     for (i = 0; i < num_attribs; i++)
     {
-        switch (attrib_list[i].type)
+        switch ((int) attrib_list[i].type)
         {
           case VAConfigAttribRTFormat:
               attrib_list[i].value = VA_RT_FORMAT_YUV420;
               break;
 
+          case VAConfigAttribEpiphanyZeroCopySliceData:
+              /* Only the bitstream entrypoints take slice data */
+              attrib_list[i].value = (VAEntrypointVLD == entrypoint) ? 1 : VA_ATTRIB_NOT_SUPPORTED;
+              break;
+
+          case VAConfigAttribEpiphanyDecodeThreads:
+              /* The decode job's thread and every worker of the pool */
+              attrib_list[i].value = (VAEntrypointVLD == entrypoint) ? epiphany__pool_workers(driver_data) + 1 : VA_ATTRIB_NOT_SUPPORTED;
+              break;
+
+          case VAConfigAttribEpiphanyDecodeStrategy:
+              /* The strategies go from 0 up, so this is the last one */
+              attrib_list[i].value = (VAEntrypointVLD == entrypoint) ? VA_EPIPHANY_DECODE_SLICES : VA_ATTRIB_NOT_SUPPORTED;
+              break;
+
+          case VAConfigAttribEpiphanyDecodeDepth:
+              attrib_list[i].value = (VAEntrypointVLD == entrypoint) ? VA_EPIPHANY_MAX_DECODE_DEPTH : VA_ATTRIB_NOT_SUPPORTED;
+              break;
+
+          /* Every entrypoint goes through the decode queue */
+          case VAConfigAttribEpiphanyDecodeWeight:
+              attrib_list[i].value = VA_EPIPHANY_MAX_DECODE_WEIGHT;
+              break;
+
+          case VAConfigAttribEpiphanyDecodePriority:
+              attrib_list[i].value = VA_EPIPHANY_MAX_DECODE_PRIORITY;
+              break;
+
+          case VAConfigAttribEpiphanyDecodeDeadline:
+              attrib_list[i].value = VA_EPIPHANY_MAX_DECODE_DEADLINE;
+              break;
+
           default:
               /* Do nothing */
               attrib_list[i].value = VA_ATTRIB_NOT_SUPPORTED;
@@ -176,7 +258,7 @@ static VAStatus epiphany__update_attribute(object_config_p obj_config, VAConfigA
 {
     int i;
     /* Check existing attrbiutes */
-    for(i = 0; obj_config->attrib_count < i; i++)
+    for(i = 0; i < obj_config->attrib_count; i++)
     {
         if (obj_config->attrib_list[i].type == attrib->type)
         {
@@ -196,6 +278,245 @@ static VAStatus epiphany__update_attribute(object_config_p obj_config, VAConfigA
     return VA_STATUS_ERROR_MAX_NUM_EXCEEDED;
 }
 
+static VAStatus epiphany__validate_attribute(VAEntrypoint entrypoint, VAConfigAttrib *attrib)
+{
+    switch ((int) attrib->type)
+    {
+        case VAConfigAttribEpiphanyZeroCopySliceData:
+            if ((VAEntrypointVLD != entrypoint) || (attrib->value > 1))
+            {
+                return VA_STATUS_ERROR_ATTR_NOT_SUPPORTED;
+            }
+            break;
+
+        case VAConfigAttribEpiphanyDecodeThreads:
+            if ((VAEntrypointVLD != entrypoint) || (attrib->value < 1) ||
+                (attrib->value > VA_EPIPHANY_MAX_DECODE_THREADS))
+            {
+                return VA_STATUS_ERROR_ATTR_NOT_SUPPORTED;
+            }
+            break;
+
+        case VAConfigAttribEpiphanyDecodeStrategy:
+            if ((VAEntrypointVLD != entrypoint) || (attrib->value > VA_EPIPHANY_DECODE_SLICES))
+            {
+                return VA_STATUS_ERROR_ATTR_NOT_SUPPORTED;
+            }
+            break;
+
+        case VAConfigAttribEpiphanyDecodeDepth:
+            if ((VAEntrypointVLD != entrypoint) || (attrib->value < 1) ||
+                (attrib->value > VA_EPIPHANY_MAX_DECODE_DEPTH))
+            {
+                return VA_STATUS_ERROR_ATTR_NOT_SUPPORTED;
+            }
+            break;
+
+        case VAConfigAttribEpiphanyDecodeWeight:
+            if ((attrib->value < 1) || (attrib->value > VA_EPIPHANY_MAX_DECODE_WEIGHT))
+            {
+                return VA_STATUS_ERROR_ATTR_NOT_SUPPORTED;
+            }
+            break;
+
+        case VAConfigAttribEpiphanyDecodePriority:
+            if (attrib->value > VA_EPIPHANY_MAX_DECODE_PRIORITY)
+            {
+                return VA_STATUS_ERROR_ATTR_NOT_SUPPORTED;
+            }
+            break;
+
+        case VAConfigAttribEpiphanyDecodeDeadline:
+            if (attrib->value > VA_EPIPHANY_MAX_DECODE_DEADLINE)
+            {
+                return VA_STATUS_ERROR_ATTR_NOT_SUPPORTED;
+            }
+            break;
+
+        default:
+            break;
+    }
+    return VA_STATUS_SUCCESS;
+}
+
+static int epiphany__get_attribute(object_config_p obj_config, VAConfigAttribType type, int default_value)
+{
+    int i;
+
+    for(i = 0; i < obj_config->attrib_count; i++)
+    {
+        if (obj_config->attrib_list[i].type == type)
+        {
+            return obj_config->attrib_list[i].value;
+        }
+    }
+    return default_value;
+}
+
+static const char *epiphany__strategy_name(int strategy)
+{
+    switch (strategy)
+    {
+        case VA_EPIPHANY_DECODE_SERIAL: return "serial";
+        case VA_EPIPHANY_DECODE_ROWS:   return "rows";
+        case VA_EPIPHANY_DECODE_SLICES: return "slices";
+        default:                        return "unknown";
+    }
+}
+
+/* The "decode_strategy" driver setting */
+static int epiphany__default_strategy(struct epiphany_driver_data *driver_data)
+{
+    const char *name = driver_config_get(&driver_data->config, "decode_strategy");
+    int strategy;
+
+    if (NULL == name)
+    {
+        return VA_EPIPHANY_DECODE_ROWS;
+    }
+    for (strategy = 0; strategy < EPIPHANY_MAX_STRATEGY_STATS; strategy++)
+    {
+        if (0 == strcmp(name, epiphany__strategy_name(strategy)))
+        {
+            return strategy;
+        }
+    }
+    epiphany__error_message("unknown decode strategy %s, using %s\n", name,
+                            epiphany__strategy_name(VA_EPIPHANY_DECODE_ROWS));
+    return VA_EPIPHANY_DECODE_ROWS;
+}
+
+/*
+ * Returns the workers shared by the contexts, starting them the first time
+ * Returns NULL if they can't be started.
+ */
+static thread_pool_p epiphany__get_thread_pool(struct epiphany_driver_data *driver_data)
+{
+    thread_pool_p pool;
+    int workers;
+
+    pthread_mutex_lock(&driver_data->thread_pool_mutex);
+    if (NULL == driver_data->thread_pool)
+    {
+        workers = epiphany__pool_workers(driver_data);
+        driver_data->thread_pool = malloc(sizeof(*driver_data->thread_pool));
+        if (driver_data->thread_pool && (0 != thread_pool_init(driver_data->thread_pool, workers)))
+        {
+            free(driver_data->thread_pool);
+            driver_data->thread_pool = NULL;
+        }
+    }
+    pool = driver_data->thread_pool;
+    pthread_mutex_unlock(&driver_data->thread_pool_mutex);
+    return pool;
+}
+
+/*
+ * Sets how the decode jobs of a context use threads, which decodes on one
+ * thread if the shared workers do not start
+ */
+static void epiphany__init_decode_threads(struct epiphany_driver_data *driver_data, object_context_p obj_context)
+{
+    int threads = driver_config_get_int(&driver_data->config, "decode_threads", 1);
+    int depth = driver_config_get_int(&driver_data->config, "decode_depth", 1);
+
+    if ((threads < 1) || (threads > VA_EPIPHANY_MAX_DECODE_THREADS))
+    {
+        threads = 1;
+    }
+    if ((depth < 1) || (depth > VA_EPIPHANY_MAX_DECODE_DEPTH))
+    {
+        depth = 1;
+    }
+    obj_context->decode_threads = epiphany__get_attribute(CONFIG(obj_context->config_id),
+                                                          VAConfigAttribEpiphanyDecodeThreads, threads);
+    obj_context->decode_strategy = epiphany__get_attribute(CONFIG(obj_context->config_id),
+                                                           VAConfigAttribEpiphanyDecodeStrategy,
+                                                           epiphany__default_strategy(driver_data));
+    obj_context->decode_depth = epiphany__get_attribute(CONFIG(obj_context->config_id),
+                                                        VAConfigAttribEpiphanyDecodeDepth, depth);
+    obj_context->thread_pool = NULL;
+    if ((VAEntrypointVLD != obj_context->entrypoint) || (obj_context->decode_threads < 2) ||
+        (VA_EPIPHANY_DECODE_SERIAL == obj_context->decode_strategy))
+    {
+        /* Without workers there is nothing else to do */
+        obj_context->decode_strategy = VA_EPIPHANY_DECODE_SERIAL;
+        obj_context->decode_depth = 1;
+        return;
+    }
+    obj_context->thread_pool = epiphany__get_thread_pool(driver_data);
+    if (NULL == obj_context->thread_pool)
+    {
+        epiphany__information_message("context %08x decodes on one thread, the decode workers did not start\n",
+                                      obj_context->context_id);
+        obj_context->decode_strategy = VA_EPIPHANY_DECODE_SERIAL;
+        obj_context->decode_depth = 1;
+    }
+    else
+    {
+        /* The decode job's thread is one of them */
+        thread_pool_group_init(&obj_context->thread_group, obj_context->decode_threads);
+        if (0 == obj_context->thread_pool->num_threads)
+        {
+            /* Pictures left in flight need a worker to finish them */
+            obj_context->decode_depth = 1;
+        }
+    }
+}
+
+/* Forgets the pool once the decode jobs and their tasks are done with it */
+static void epiphany__destroy_decode_threads(object_context_p obj_context)
+{
+    if (obj_context->thread_pool)
+    {
+        thread_pool_group_destroy(&obj_context->thread_group);
+    }
+    obj_context->thread_pool = NULL;
+}
+
+/* How long the pictures of a context waited for a decode queue thread */
+static void epiphany__report_context_stats(struct epiphany_driver_data *driver_data, object_context_p obj_context)
+{
+    unsigned long long pictures = obj_context->queue_pictures;
+
+    if (0 == pictures)
+    {
+        return;
+    }
+    if (obj_context->decode_deadline)
+    {
+        epiphany__information_message("context %08x: %llu pictures, weight %d, priority %d, queue delay %.2f ms average, "
+                                      "%.2f ms longest, %llu missed the %d us deadline\n",
+                                      obj_context->base.id, pictures, obj_context->decode_weight,
+                                      obj_context->decode_priority, obj_context->queue_delay_ns / 1e6 / pictures,
+                                      obj_context->queue_max_delay_ns / 1e6, obj_context->queue_deadlines_missed,
+                                      obj_context->decode_deadline);
+    }
+    else
+    {
+        epiphany__information_message("context %08x: %llu pictures, weight %d, priority %d, queue delay %.2f ms average, "
+                                      "%.2f ms longest\n",
+                                      obj_context->base.id, pictures, obj_context->decode_weight,
+                                      obj_context->decode_priority, obj_context->queue_delay_ns / 1e6 / pictures,
+                                      obj_context->queue_max_delay_ns / 1e6);
+    }
+}
+
+/*
+ * Trims a heap once most of the slots it reserved are unused, or when the last
+ * context is gone. Streams that come and go at a steady rate keep their slots.
+ */
+static void epiphany__trim_heap(object_heap_p heap, int last_context)
+{
+    struct object_heap_stats stats;
+
+    object_heap_get_stats(heap, &stats);
+    if (last_context || (stats.allocated * EPIPHANY_HEAP_TRIM_RATIO < stats.reserved))
+    {
+        object_heap_trim(heap);
+    }
+}
+
 VAStatus epiphany_CreateConfig(
 		VADriverContextP ctx,
 		VAProfile profile,
@@ -265,6 +586,19 @@ VAStatus epiphany_CreateConfig(
                 }
                 break;
 
+#ifdef HAVE_VA_JPEG_DECODE
+        case VAProfileJPEGBaseline:
+                if (VAEntrypointVLD == entrypoint)
+                {
+                    vaStatus = VA_STATUS_SUCCESS;
+                }
+                else
+                {
+                    vaStatus = VA_STATUS_ERROR_UNSUPPORTED_ENTRYPOINT;
+                }
+                break;
+#endif
+
         default:
                 vaStatus = VA_STATUS_ERROR_UNSUPPORTED_PROFILE;
                 break;
@@ -291,6 +625,11 @@ VAStatus epiphany_CreateConfig(
 
     for(i = 0; i < num_attribs; i++)
     {
+        vaStatus = epiphany__validate_attribute(entrypoint, &(attrib_list[i]));
+        if (VA_STATUS_SUCCESS != vaStatus)
+        {
+            break;
+        }
         vaStatus = epiphany__update_attribute(obj_config, &(attrib_list[i]));
         if (VA_STATUS_SUCCESS != vaStatus)
         {
@@ -346,7 +685,11 @@ VAStatus epiphany_QueryConfigAttributes(
     int i;
 
     obj_config = CONFIG(config_id);
-    ASSERT(obj_config);
+    if (NULL == obj_config)
+    {
+        vaStatus = VA_STATUS_ERROR_INVALID_CONFIG;
+        return vaStatus;
+    }
 
     *profile = obj_config->profile;
     *entrypoint = obj_config->entrypoint;
@@ -359,6 +702,63 @@ VAStatus epiphany_QueryConfigAttributes(
     return vaStatus;
 }
 
+static void epiphany__release_buffer_data(struct epiphany_driver_data *driver_data, object_buffer_p obj_buffer)
+{
+    if (obj_buffer->external)
+    {
+        /* Client memory, just forget about it */
+        obj_buffer->buffer_data = NULL;
+        obj_buffer->external = 0;
+    }
+    else if (NULL != obj_buffer->buffer_data)
+    {
+        buffer_pool_release(&driver_data->buffer_pool, obj_buffer->type,
+                            obj_buffer->buffer_data, obj_buffer->capacity);
+        obj_buffer->buffer_data = NULL;
+        obj_buffer->capacity = 0;
+    }
+}
+
+static VAStatus epiphany__allocate_buffer(struct epiphany_driver_data *driver_data, object_buffer_p obj_buffer, unsigned int size)
+{
+    VAStatus vaStatus = VA_STATUS_SUCCESS;
+
+    /* Storage is recycled across frames by the buffer pool */
+    epiphany__release_buffer_data(driver_data, obj_buffer);
+    obj_buffer->buffer_data = buffer_pool_alloc(&driver_data->buffer_pool, obj_buffer->type,
+                                                size, &obj_buffer->capacity);
+    if (NULL == obj_buffer->buffer_data)
+    {
+        obj_buffer->capacity = 0;
+        vaStatus = VA_STATUS_ERROR_ALLOCATION_FAILED;
+    }
+    return vaStatus;
+}
+
+static void epiphany__destroy_buffer(struct epiphany_driver_data *driver_data, object_buffer_p obj_buffer)
+{
+    epiphany__release_buffer_data(driver_data, obj_buffer);
+
+    object_heap_free( &driver_data->buffer_heap, (object_base_p) obj_buffer);
+}
+
+static void epiphany__destroy_image(struct epiphany_driver_data *driver_data, object_image_p obj_image)
+{
+    object_buffer_p obj_buffer = BUFFER(obj_image->image.buf);
+    object_surface_p obj_surface = SURFACE(obj_image->derived_surface);
+
+    if (obj_buffer)
+    {
+        epiphany__destroy_buffer(driver_data, obj_buffer);
+    }
+    if (obj_surface)
+    {
+        driver_data->backend->unmap_surface(driver_data, obj_surface);
+        obj_surface->derived_image = VA_INVALID_ID;
+    }
+    object_heap_free( &driver_data->image_heap, (object_base_p) obj_image);
+}
+
 VAStatus epiphany_CreateSurfaces(
 		VADriverContextP ctx,
 		int width,
@@ -378,30 +778,48 @@ VAStatus epiphany_CreateSurfaces(
         return VA_STATUS_ERROR_UNSUPPORTED_RT_FORMAT;
     }
 
+    if ((width <= 0) || (height <= 0) ||
+        (width > EPIPHANY_MAX_SURFACE_SIZE) || (height > EPIPHANY_MAX_SURFACE_SIZE))
+    {
+        return VA_STATUS_ERROR_RESOLUTION_NOT_SUPPORTED;
+    }
+
+    /* Allocate all surface IDs in one go, this either fully succeeds or fails */
+    if (-1 == object_heap_allocate_n( &driver_data->surface_heap, num_surfaces, (int *) surfaces ))
+    {
+        vaStatus = VA_STATUS_ERROR_ALLOCATION_FAILED;
+        return vaStatus;
+    }
+
     for (i = 0; i < num_surfaces; i++)
     {
-        int surfaceID = object_heap_allocate( &driver_data->surface_heap );
-        object_surface_p obj_surface = SURFACE(surfaceID);
-        if (NULL == obj_surface)
+        object_surface_p obj_surface = SURFACE(surfaces[i]);
+        ASSERT(obj_surface);
+        obj_surface->surface_id = surfaces[i];
+        obj_surface->width = width;
+        obj_surface->height = height;
+        obj_surface->derived_image = VA_INVALID_ID;
+        obj_surface->fence.pending = 0;
+        obj_surface->fence.status = VA_STATUS_SUCCESS;
+        obj_surface->fence.flow = NULL;
+        obj_surface->storage = driver_data->backend->alloc_surface_storage(driver_data, width, height);
+        if (NULL == obj_surface->storage)
         {
             vaStatus = VA_STATUS_ERROR_ALLOCATION_FAILED;
             break;
         }
-        obj_surface->surface_id = surfaceID;
-        surfaces[i] = surfaceID;
     }
 
     /* Error recovery */
     if (VA_STATUS_SUCCESS != vaStatus)
     {
-        /* surfaces[i-1] was the last successful allocation */
-        for(; i--; )
+        while (i--)
         {
             object_surface_p obj_surface = SURFACE(surfaces[i]);
-            surfaces[i] = VA_INVALID_SURFACE;
-            ASSERT(obj_surface);
-            object_heap_free( &driver_data->surface_heap, (object_base_p) obj_surface);
+            driver_data->backend->free_surface_storage(driver_data, obj_surface->storage);
+            obj_surface->storage = NULL;
         }
+        object_heap_free_n( &driver_data->surface_heap, (int *) surfaces, num_surfaces );
     }
 
     return vaStatus;
@@ -415,22 +833,133 @@ VAStatus epiphany_DestroySurfaces(
 {
     INIT_DRIVER_DATA
     int i;
+
+    /* Reject the whole list if any ID is stale, before freeing anything */
     for(i = num_surfaces; i--; )
+    {
+        if (NULL == SURFACE(surface_list[i]))
+        {
+            return VA_STATUS_ERROR_INVALID_SURFACE;
+        }
+    }
+
+    /* Queued pictures may be decoding into or predicting from them */
+    for(i = 0; i < num_surfaces; i++)
+    {
+        epiphany_backend_detach_surface(driver_data, SURFACE(surface_list[i]));
+    }
+
+    for(i = 0; i < num_surfaces; i++)
     {
         object_surface_p obj_surface = SURFACE(surface_list[i]);
-        ASSERT(obj_surface);
-        object_heap_free( &driver_data->surface_heap, (object_base_p) obj_surface);
+        object_image_p obj_image = IMAGE(obj_surface->derived_image);
+
+        /* A derived image can't outlive the planes it points into */
+        if (obj_image)
+        {
+            epiphany__destroy_image(driver_data, obj_image);
+        }
+        driver_data->backend->free_surface_storage(driver_data, obj_surface->storage);
+        obj_surface->storage = NULL;
     }
+
+    object_heap_free_n( &driver_data->surface_heap, (int *) surface_list, num_surfaces );
     return VA_STATUS_SUCCESS;
 }
 
+/* Image formats GetImage/PutImage convert from/to, NV12 first as it copies straight */
+static const VAImageFormat epiphany__image_formats[] = {
+    { VA_FOURCC_NV12, VA_LSB_FIRST, 12, },
+    { VA_FOURCC_I420, VA_LSB_FIRST, 12, },
+    { VA_FOURCC_YV12, VA_LSB_FIRST, 12, },
+    { VA_FOURCC_YUY2, VA_LSB_FIRST, 16, },
+    { VA_FOURCC_BGRA, VA_LSB_FIRST, 32, 32, 0x00ff0000, 0x0000ff00, 0x000000ff, 0xff000000 },
+};
+
+#define EPIPHANY_NUM_IMAGE_FORMATS	(sizeof(epiphany__image_formats) / sizeof(epiphany__image_formats[0]))
+
+/* Fills in the plane layout of an image from its format and size */
+static void epiphany__image_layout(VAImage *image)
+{
+    unsigned int width = image->width;
+    unsigned int height = ALIGN(image->height, 2);
+
+    switch (image->format.fourcc)
+    {
+        case VA_FOURCC_NV12:
+            image->num_planes = 2;
+            image->pitches[0] = ALIGN(width, 64);
+            image->pitches[1] = image->pitches[0];
+            image->offsets[1] = image->pitches[0] * height;
+            image->data_size = image->offsets[1] + image->pitches[1] * height / 2;
+            break;
+
+        case VA_FOURCC_I420:
+        case VA_FOURCC_YV12:
+            image->num_planes = 3;
+            image->pitches[0] = ALIGN(width, 64);
+            image->pitches[1] = image->pitches[0] / 2;
+            image->pitches[2] = image->pitches[1];
+            image->offsets[1] = image->pitches[0] * height;
+            image->offsets[2] = image->offsets[1] + image->pitches[1] * height / 2;
+            image->data_size = image->offsets[2] + image->pitches[2] * height / 2;
+            break;
+
+        case VA_FOURCC_YUY2:
+            image->num_planes = 1;
+            image->pitches[0] = ALIGN(2 * ALIGN(width, 2), 64);
+            image->data_size = image->pitches[0] * image->height;
+            break;
+
+        case VA_FOURCC_BGRA:
+            image->num_planes = 1;
+            image->pitches[0] = ALIGN(4 * width, 64);
+            image->data_size = image->pitches[0] * image->height;
+            break;
+    }
+}
+
+static void epiphany__image_planes(const VAImage *image, void *data, struct image_planes *planes)
+{
+    unsigned int i;
+
+    planes->fourcc = image->format.fourcc;
+    for (i = 0; i < 3; i++)
+    {
+        planes->data[i] = (uint8_t *) data + image->offsets[i];
+        planes->pitch[i] = image->pitches[i];
+    }
+}
+
+/* The planes of obj_surface, mapped at data */
+static void epiphany__surface_planes(object_surface_p obj_surface, void *data, struct image_planes *planes)
+{
+    struct surface_storage *storage = obj_surface->storage;
+
+    planes->fourcc = VA_FOURCC_NV12;
+    planes->data[0] = data;
+    planes->data[1] = (uint8_t *) data + storage->chroma_offset;
+    planes->data[2] = NULL;
+    planes->pitch[0] = storage->pitch;
+    planes->pitch[1] = storage->pitch;
+    planes->pitch[2] = 0;
+}
+
 VAStatus epiphany_QueryImageFormats(
 	VADriverContextP ctx,
 	VAImageFormat *format_list,        /* out */
 	int *num_formats           /* out */
 )
 {
-    /* TODO */
+    unsigned int i;
+
+    for (i = 0; i < EPIPHANY_NUM_IMAGE_FORMATS; i++)
+    {
+        format_list[i] = epiphany__image_formats[i];
+    }
+    /* If the assert fails then EPIPHANY_MAX_IMAGE_FORMATS needs to be bigger */
+    ASSERT(i <= EPIPHANY_MAX_IMAGE_FORMATS);
+    *num_formats = i;
     return VA_STATUS_SUCCESS;
 }
 
@@ -442,26 +971,161 @@ VAStatus epiphany_CreateImage(
 	VAImage *image     /* out */
 )
 {
-    /* TODO */
-    return VA_STATUS_SUCCESS;
-}
-
-VAStatus epiphany_DeriveImage(
-	VADriverContextP ctx,
-	VASurfaceID surface,
-	VAImage *image     /* out */
-)
-{
-    /* TODO */
-    return VA_STATUS_SUCCESS;
-}
+    INIT_DRIVER_DATA
+    VAStatus vaStatus;
+    object_image_p obj_image;
+    object_buffer_p obj_buffer;
+    int imageID, bufferID;
+    unsigned int i;
 
-VAStatus epiphany_DestroyImage(
+    for (i = 0; i < EPIPHANY_NUM_IMAGE_FORMATS; i++)
+    {
+        if (epiphany__image_formats[i].fourcc == format->fourcc)
+        {
+            break;
+        }
+    }
+    if (i == EPIPHANY_NUM_IMAGE_FORMATS)
+    {
+        return VA_STATUS_ERROR_INVALID_IMAGE_FORMAT;
+    }
+
+    if ((width <= 0) || (height <= 0) ||
+        (width > EPIPHANY_MAX_SURFACE_SIZE) || (height > EPIPHANY_MAX_SURFACE_SIZE))
+    {
+        return VA_STATUS_ERROR_INVALID_PARAMETER;
+    }
+
+    imageID = object_heap_allocate( &driver_data->image_heap );
+    obj_image = IMAGE(imageID);
+    if (NULL == obj_image)
+    {
+        return VA_STATUS_ERROR_ALLOCATION_FAILED;
+    }
+
+    memset(&obj_image->image, 0, sizeof(obj_image->image));
+    obj_image->image.image_id = imageID;
+    obj_image->image.format = epiphany__image_formats[i];
+    obj_image->image.width = width;
+    obj_image->image.height = height;
+    epiphany__image_layout(&obj_image->image);
+    obj_image->derived_surface = VA_INVALID_ID;
+
+    bufferID = object_heap_allocate( &driver_data->buffer_heap );
+    obj_buffer = BUFFER(bufferID);
+    if (NULL == obj_buffer)
+    {
+        object_heap_free( &driver_data->image_heap, (object_base_p) obj_image);
+        return VA_STATUS_ERROR_ALLOCATION_FAILED;
+    }
+    obj_buffer->buffer_data = NULL;
+    obj_buffer->capacity = 0;
+    obj_buffer->external = 0;
+    obj_buffer->rendered = 0;
+    obj_buffer->type = VAImageBufferType;
+    obj_buffer->element_size = obj_image->image.data_size;
+    obj_buffer->max_num_elements = 1;
+    obj_buffer->num_elements = 1;
+
+    vaStatus = epiphany__allocate_buffer(driver_data, obj_buffer, obj_image->image.data_size);
+    if (VA_STATUS_SUCCESS != vaStatus)
+    {
+        object_heap_free( &driver_data->buffer_heap, (object_base_p) obj_buffer);
+        object_heap_free( &driver_data->image_heap, (object_base_p) obj_image);
+        return vaStatus;
+    }
+
+    obj_image->image.buf = bufferID;
+    *image = obj_image->image;
+    return VA_STATUS_SUCCESS;
+}
+
+VAStatus epiphany_DeriveImage(
+	VADriverContextP ctx,
+	VASurfaceID surface,
+	VAImage *image     /* out */
+)
+{
+    INIT_DRIVER_DATA
+    object_surface_p obj_surface;
+    object_image_p obj_image;
+    object_buffer_p obj_buffer;
+    struct surface_storage *storage;
+    void *data;
+    int imageID, bufferID;
+
+    obj_surface = SURFACE(surface);
+    if (NULL == obj_surface)
+    {
+        return VA_STATUS_ERROR_INVALID_SURFACE;
+    }
+    if (VA_INVALID_ID != obj_surface->derived_image)
+    {
+        return VA_STATUS_ERROR_OPERATION_FAILED;
+    }
+    storage = obj_surface->storage;
+
+    imageID = object_heap_allocate( &driver_data->image_heap );
+    obj_image = IMAGE(imageID);
+    if (NULL == obj_image)
+    {
+        return VA_STATUS_ERROR_ALLOCATION_FAILED;
+    }
+
+    /* The image buffer wraps the surface planes, mapping it copies nothing */
+    bufferID = object_heap_allocate( &driver_data->buffer_heap );
+    obj_buffer = BUFFER(bufferID);
+    if (NULL == obj_buffer)
+    {
+        object_heap_free( &driver_data->image_heap, (object_base_p) obj_image);
+        return VA_STATUS_ERROR_ALLOCATION_FAILED;
+    }
+
+    /* Mapped until the image is destroyed */
+    data = driver_data->backend->map_surface(driver_data, obj_surface);
+    obj_buffer->buffer_data = data;
+    obj_buffer->capacity = 0;
+    obj_buffer->external = 1;
+    obj_buffer->rendered = 0;
+    obj_buffer->type = VAImageBufferType;
+    obj_buffer->element_size = storage->size;
+    obj_buffer->max_num_elements = 1;
+    obj_buffer->num_elements = 1;
+
+    memset(&obj_image->image, 0, sizeof(obj_image->image));
+    obj_image->image.image_id = imageID;
+    obj_image->image.format.fourcc = VA_FOURCC_NV12;
+    obj_image->image.format.byte_order = VA_LSB_FIRST;
+    obj_image->image.format.bits_per_pixel = 12;
+    obj_image->image.buf = bufferID;
+    obj_image->image.width = obj_surface->width;
+    obj_image->image.height = obj_surface->height;
+    obj_image->image.data_size = storage->size;
+    obj_image->image.num_planes = 2;
+    obj_image->image.pitches[0] = storage->pitch;
+    obj_image->image.pitches[1] = storage->pitch;
+    obj_image->image.offsets[0] = 0;
+    obj_image->image.offsets[1] = storage->chroma_offset;
+    obj_image->derived_surface = surface;
+
+    obj_surface->derived_image = imageID;
+    *image = obj_image->image;
+    return VA_STATUS_SUCCESS;
+}
+
+VAStatus epiphany_DestroyImage(
 	VADriverContextP ctx,
 	VAImageID image
 )
 {
-    /* TODO */
+    INIT_DRIVER_DATA
+    object_image_p obj_image = IMAGE(image);
+    if (NULL == obj_image)
+    {
+        return VA_STATUS_ERROR_INVALID_IMAGE;
+    }
+
+    epiphany__destroy_image(driver_data, obj_image);
     return VA_STATUS_SUCCESS;
 }
 
@@ -485,8 +1149,50 @@ VAStatus epiphany_GetImage(
 	VAImageID image
 )
 {
-    /* TODO */
-    return VA_STATUS_SUCCESS;
+    INIT_DRIVER_DATA
+    object_surface_p obj_surface;
+    object_image_p obj_image;
+    object_buffer_p obj_buffer;
+    struct image_planes src, dst;
+    void *data;
+    VAStatus vaStatus = VA_STATUS_SUCCESS;
+
+    obj_surface = SURFACE(surface);
+    if (NULL == obj_surface)
+    {
+        return VA_STATUS_ERROR_INVALID_SURFACE;
+    }
+
+    obj_image = IMAGE(image);
+    if (NULL == obj_image)
+    {
+        return VA_STATUS_ERROR_INVALID_IMAGE;
+    }
+
+    obj_buffer = BUFFER(obj_image->image.buf);
+    if ((NULL == obj_buffer) || (NULL == obj_buffer->buffer_data))
+    {
+        return VA_STATUS_ERROR_INVALID_BUFFER;
+    }
+
+    /* The region is read from the surface and lands at the image origin */
+    if ((x < 0) || (y < 0) ||
+        ((unsigned int) x + width > (unsigned int) obj_surface->width) ||
+        ((unsigned int) y + height > (unsigned int) obj_surface->height) ||
+        (width > obj_image->image.width) || (height > obj_image->image.height))
+    {
+        return VA_STATUS_ERROR_INVALID_PARAMETER;
+    }
+
+    data = driver_data->backend->map_surface(driver_data, obj_surface);
+    epiphany__surface_planes(obj_surface, data, &src);
+    epiphany__image_planes(&obj_image->image, obj_buffer->buffer_data, &dst);
+    if (image_convert_copy(driver_data->convert_ops, &src, x, y, &dst, 0, 0, width, height))
+    {
+        vaStatus = VA_STATUS_ERROR_INVALID_IMAGE_FORMAT;
+    }
+    driver_data->backend->unmap_surface(driver_data, obj_surface);
+    return vaStatus;
 }
 
 
@@ -504,8 +1210,58 @@ VAStatus epiphany_PutImage(
 	unsigned int dest_height
 )
 {
-    /* TODO */
-    return VA_STATUS_SUCCESS;
+    INIT_DRIVER_DATA
+    object_surface_p obj_surface;
+    object_image_p obj_image;
+    object_buffer_p obj_buffer;
+    struct image_planes src, dst;
+    void *data;
+    VAStatus vaStatus = VA_STATUS_SUCCESS;
+
+    obj_surface = SURFACE(surface);
+    if (NULL == obj_surface)
+    {
+        return VA_STATUS_ERROR_INVALID_SURFACE;
+    }
+
+    obj_image = IMAGE(image);
+    if (NULL == obj_image)
+    {
+        return VA_STATUS_ERROR_INVALID_IMAGE;
+    }
+
+    obj_buffer = BUFFER(obj_image->image.buf);
+    if ((NULL == obj_buffer) || (NULL == obj_buffer->buffer_data))
+    {
+        return VA_STATUS_ERROR_INVALID_BUFFER;
+    }
+
+    /* No scaling */
+    if ((src_width != dest_width) || (src_height != dest_height))
+    {
+        return VA_STATUS_ERROR_UNIMPLEMENTED;
+    }
+
+    if ((src_x < 0) || (src_y < 0) || (dest_x < 0) || (dest_y < 0) ||
+        ((unsigned int) src_x + src_width > obj_image->image.width) ||
+        ((unsigned int) src_y + src_height > obj_image->image.height) ||
+        ((unsigned int) dest_x + dest_width > (unsigned int) obj_surface->width) ||
+        ((unsigned int) dest_y + dest_height > (unsigned int) obj_surface->height))
+    {
+        return VA_STATUS_ERROR_INVALID_PARAMETER;
+    }
+
+    /* Mapping waits for a picture still being decoded into the surface */
+    data = driver_data->backend->map_surface(driver_data, obj_surface);
+    epiphany__image_planes(&obj_image->image, obj_buffer->buffer_data, &src);
+    epiphany__surface_planes(obj_surface, data, &dst);
+    if (image_convert_copy(driver_data->convert_ops, &src, src_x, src_y, &dst, dest_x, dest_y,
+                           src_width, src_height))
+    {
+        vaStatus = VA_STATUS_ERROR_INVALID_IMAGE_FORMAT;
+    }
+    driver_data->backend->unmap_surface(driver_data, obj_surface);
+    return vaStatus;
 }
 
 VAStatus epiphany_QuerySubpictureFormats(
@@ -621,6 +1377,93 @@ VAStatus epiphany_DeassociateSubpicture(
     return VA_STATUS_SUCCESS;
 }
 
+static VAStatus epiphany__buffer_list_append(struct epiphany_buffer_list *list, VABufferID buffer_id)
+{
+    if (list->num_buffers == list->max_buffers)
+    {
+        int max_buffers = list->max_buffers ? 2 * list->max_buffers : 8;
+        VABufferID *buffers = realloc(list->buffers, max_buffers * sizeof(VABufferID));
+        if (NULL == buffers)
+        {
+            return VA_STATUS_ERROR_ALLOCATION_FAILED;
+        }
+        list->buffers = buffers;
+        list->max_buffers = max_buffers;
+    }
+    list->buffers[list->num_buffers++] = buffer_id;
+    return VA_STATUS_SUCCESS;
+}
+
+static void epiphany__buffer_list_release(struct epiphany_driver_data *driver_data, struct epiphany_buffer_list *list)
+{
+    int i;
+
+    for(i = 0; i < list->num_buffers; i++)
+    {
+        object_buffer_p obj_buffer = BUFFER(list->buffers[i]);
+        if (obj_buffer)
+        {
+            epiphany__destroy_buffer(driver_data, obj_buffer);
+        }
+    }
+    list->num_buffers = 0;
+}
+
+static void epiphany__buffer_list_destroy(struct epiphany_buffer_list *list)
+{
+    free(list->buffers);
+    list->buffers = NULL;
+    list->num_buffers = 0;
+    list->max_buffers = 0;
+}
+
+static void epiphany__release_buffer_slot(struct epiphany_driver_data *driver_data, VABufferID *slot)
+{
+    object_buffer_p obj_buffer = BUFFER(*slot);
+    if (obj_buffer)
+    {
+        epiphany__destroy_buffer(driver_data, obj_buffer);
+    }
+    *slot = VA_INVALID_ID;
+}
+
+void epiphany_init_picture(struct epiphany_picture *picture)
+{
+    picture->pic_param = VA_INVALID_ID;
+    picture->iq_matrix = VA_INVALID_ID;
+    picture->bit_plane = VA_INVALID_ID;
+    picture->huffman_table = VA_INVALID_ID;
+    memset(&picture->slice_params, 0, sizeof(picture->slice_params));
+    memset(&picture->slice_data, 0, sizeof(picture->slice_data));
+    memset(&picture->mb_params, 0, sizeof(picture->mb_params));
+    memset(&picture->residual_data, 0, sizeof(picture->residual_data));
+}
+
+/* Destroy every buffer rendered into picture */
+void epiphany_release_picture_buffers(struct epiphany_driver_data *driver_data, struct epiphany_picture *picture)
+{
+    /* vaDestroyBuffer() may be racing for the same buffers */
+    pthread_mutex_lock(&driver_data->buffer_mutex);
+    epiphany__release_buffer_slot(driver_data, &picture->pic_param);
+    epiphany__release_buffer_slot(driver_data, &picture->iq_matrix);
+    epiphany__release_buffer_slot(driver_data, &picture->bit_plane);
+    epiphany__release_buffer_slot(driver_data, &picture->huffman_table);
+    epiphany__buffer_list_release(driver_data, &picture->slice_params);
+    epiphany__buffer_list_release(driver_data, &picture->slice_data);
+    epiphany__buffer_list_release(driver_data, &picture->mb_params);
+    epiphany__buffer_list_release(driver_data, &picture->residual_data);
+    pthread_mutex_unlock(&driver_data->buffer_mutex);
+}
+
+/* Frees the buffer lists, the buffers themselves must be gone already */
+void epiphany_destroy_picture(struct epiphany_picture *picture)
+{
+    epiphany__buffer_list_destroy(&picture->slice_params);
+    epiphany__buffer_list_destroy(&picture->slice_data);
+    epiphany__buffer_list_destroy(&picture->mb_params);
+    epiphany__buffer_list_destroy(&picture->residual_data);
+}
+
 VAStatus epiphany_CreateContext(
 		VADriverContextP ctx,
 		VAConfigID config_id,
@@ -659,9 +1502,23 @@ VAStatus epiphany_CreateContext(
     *context = contextID;
     obj_context->current_render_target = -1;
     obj_context->config_id = config_id;
+    obj_context->profile = obj_config->profile;
+    obj_context->entrypoint = obj_config->entrypoint;
+    obj_context->decoder = NULL;
     obj_context->picture_width = picture_width;
     obj_context->picture_height = picture_height;
     obj_context->num_render_targets = num_render_targets;
+    obj_context->zero_copy_slice_data = epiphany__get_attribute(obj_config, VAConfigAttribEpiphanyZeroCopySliceData, 0);
+    obj_context->decode_weight = epiphany__get_attribute(obj_config, VAConfigAttribEpiphanyDecodeWeight, 1);
+    obj_context->decode_priority = epiphany__get_attribute(obj_config, VAConfigAttribEpiphanyDecodePriority, 0);
+    obj_context->decode_deadline = epiphany__get_attribute(obj_config, VAConfigAttribEpiphanyDecodeDeadline, 0);
+    obj_context->decode_flow = NULL;
+    obj_context->queue_pictures = 0;
+    obj_context->queue_delay_ns = 0;
+    obj_context->queue_max_delay_ns = 0;
+    obj_context->queue_deadlines_missed = 0;
+    epiphany_init_picture(&obj_context->picture);
+    epiphany__init_decode_threads(driver_data, obj_context);
     obj_context->render_targets = (VASurfaceID *) malloc(num_render_targets * sizeof(VASurfaceID));
     if (obj_context->render_targets == NULL)
     {
@@ -680,6 +1537,12 @@ VAStatus epiphany_CreateContext(
     }
     obj_context->flags = flag;
 
+    /* Contexts sharing surfaces keep their pictures in order */
+    if (VA_STATUS_SUCCESS == vaStatus)
+    {
+        vaStatus = epiphany_backend_open_context(driver_data, obj_context);
+    }
+
     /* Error recovery */
     if (VA_STATUS_SUCCESS != vaStatus)
     {
@@ -689,6 +1552,7 @@ VAStatus epiphany_CreateContext(
         obj_context->render_targets = NULL;
         obj_context->num_render_targets = 0;
         obj_context->flags = 0;
+        epiphany__destroy_decode_threads(obj_context);
         object_heap_free( &driver_data->context_heap, (object_base_p) obj_context);
     }
 
@@ -703,7 +1567,19 @@ VAStatus epiphany_DestroyContext(
 {
     INIT_DRIVER_DATA
     object_context_p obj_context = CONTEXT(context);
-    ASSERT(obj_context);
+    struct object_heap_stats context_stats;
+    int last_context;
+    if (NULL == obj_context)
+    {
+        return VA_STATUS_ERROR_INVALID_CONTEXT;
+    }
+
+    /* Queued pictures still use the decoder */
+    epiphany_backend_close_context(driver_data, obj_context);
+    if (driver_data->report_stats)
+    {
+        epiphany__report_context_stats(driver_data, obj_context);
+    }
 
     obj_context->context_id = -1;
     obj_context->config_id = -1;
@@ -718,26 +1594,34 @@ VAStatus epiphany_DestroyContext(
     obj_context->flags = 0;
 
     obj_context->current_render_target = -1;
+    epiphany_release_picture_buffers(driver_data, &obj_context->picture);
+    epiphany_destroy_picture(&obj_context->picture);
+    epiphany_backend_destroy_decoder(obj_context);
+    epiphany__destroy_decode_threads(obj_context);
 
     object_heap_free( &driver_data->context_heap, (object_base_p) obj_context);
 
+    /* A stream just ended, give back the memory of objects nothing uses any more */
+    object_heap_get_stats( &driver_data->context_heap, &context_stats );
+    last_context = (0 == context_stats.allocated);
+    epiphany__trim_heap( &driver_data->buffer_heap, last_context );
+    epiphany__trim_heap( &driver_data->surface_heap, last_context );
+    epiphany__trim_heap( &driver_data->context_heap, last_context );
+    if (last_context)
+    {
+        buffer_pool_trim( &driver_data->buffer_pool );
+    }
+    else
+    {
+        buffer_pool_shrink( &driver_data->buffer_pool,
+                            driver_data->buffer_pool.max_cached / EPIPHANY_BUFFER_POOL_TRIM_RATIO );
+    }
+
     return VA_STATUS_SUCCESS;
 }
 
 
 
-static VAStatus epiphany__allocate_buffer(object_buffer_p obj_buffer, int size)
-{
-    VAStatus vaStatus = VA_STATUS_SUCCESS;
-
-    obj_buffer->buffer_data = realloc(obj_buffer->buffer_data, size);
-    if (NULL == obj_buffer->buffer_data)
-    {
-        vaStatus = VA_STATUS_ERROR_ALLOCATION_FAILED;
-    }
-    return vaStatus;
-}
-
 VAStatus epiphany_CreateBuffer(
 		VADriverContextP ctx,
                 VAContextID context,	/* in */
@@ -752,6 +1636,7 @@ VAStatus epiphany_CreateBuffer(
     VAStatus vaStatus = VA_STATUS_SUCCESS;
     int bufferID;
     object_buffer_p obj_buffer;
+    object_context_p obj_context;
 
     /* Validate type */
     switch (type)
@@ -760,6 +1645,9 @@ VAStatus epiphany_CreateBuffer(
         case VAIQMatrixBufferType:
         case VABitPlaneBufferType:
         case VASliceGroupMapBufferType:
+#ifdef HAVE_VA_JPEG_DECODE
+        case VAHuffmanTableBufferType:
+#endif
         case VASliceParameterBufferType:
         case VASliceDataBufferType:
         case VAMacroblockParameterBufferType:
@@ -773,6 +1661,12 @@ VAStatus epiphany_CreateBuffer(
             return vaStatus;
     }
 
+    if (num_elements && (size > UINT_MAX / num_elements))
+    {
+        vaStatus = VA_STATUS_ERROR_ALLOCATION_FAILED;
+        return vaStatus;
+    }
+
     bufferID = object_heap_allocate( &driver_data->buffer_heap );
     obj_buffer = BUFFER(bufferID);
     if (NULL == obj_buffer)
@@ -782,15 +1676,34 @@ VAStatus epiphany_CreateBuffer(
     }
 
     obj_buffer->buffer_data = NULL;
+    obj_buffer->capacity = 0;
+    obj_buffer->external = 0;
+    obj_buffer->rendered = 0;
+    obj_buffer->type = type;
+    obj_buffer->element_size = size;
 
-    vaStatus = epiphany__allocate_buffer(obj_buffer, size * num_elements);
-    if (VA_STATUS_SUCCESS == vaStatus)
+    /* Bitstream data is only read, so wrap the client's memory when it opted in */
+    obj_context = CONTEXT(context);
+    if (data && (VASliceDataBufferType == type) && obj_context && obj_context->zero_copy_slice_data)
     {
+        obj_buffer->buffer_data = data;
+        obj_buffer->external = 1;
         obj_buffer->max_num_elements = num_elements;
         obj_buffer->num_elements = num_elements;
-        if (data)
+        STATS_ADD(driver_data->bytes_wrapped, size * num_elements);
+    }
+    else
+    {
+        vaStatus = epiphany__allocate_buffer(driver_data, obj_buffer, size * num_elements);
+        if (VA_STATUS_SUCCESS == vaStatus)
         {
-            memcpy(obj_buffer->buffer_data, data, size * num_elements);
+            obj_buffer->max_num_elements = num_elements;
+            obj_buffer->num_elements = num_elements;
+            if (data)
+            {
+                memcpy(obj_buffer->buffer_data, data, size * num_elements);
+                STATS_ADD(driver_data->bytes_copied, size * num_elements);
+            }
         }
     }
 
@@ -798,11 +1711,55 @@ VAStatus epiphany_CreateBuffer(
     {
         *buf_id = bufferID;
     }
+    else
+    {
+        object_heap_free( &driver_data->buffer_heap, (object_base_p) obj_buffer);
+    }
 
     return vaStatus;
 }
 
 
+/* Make room for num_elements, keeping the current contents */
+static VAStatus epiphany__grow_buffer(struct epiphany_driver_data *driver_data, object_buffer_p obj_buffer, unsigned int num_elements)
+{
+    unsigned int size;
+    size_t capacity;
+    void *buffer_data;
+
+    if (obj_buffer->element_size && (num_elements > UINT_MAX / obj_buffer->element_size))
+    {
+        return VA_STATUS_ERROR_ALLOCATION_FAILED;
+    }
+    size = obj_buffer->element_size * num_elements;
+
+    /* The pool rounds allocations up, often there is room already */
+    if (size > obj_buffer->capacity)
+    {
+        if (obj_buffer->external)
+        {
+            /* Client memory can't be resized behind the client's back */
+            return VA_STATUS_ERROR_INVALID_PARAMETER;
+        }
+
+        buffer_data = buffer_pool_alloc(&driver_data->buffer_pool, obj_buffer->type, size, &capacity);
+        if (NULL == buffer_data)
+        {
+            return VA_STATUS_ERROR_ALLOCATION_FAILED;
+        }
+        if (obj_buffer->buffer_data)
+        {
+            memcpy(buffer_data, obj_buffer->buffer_data, obj_buffer->element_size * obj_buffer->max_num_elements);
+        }
+        epiphany__release_buffer_data(driver_data, obj_buffer);
+        obj_buffer->buffer_data = buffer_data;
+        obj_buffer->capacity = capacity;
+    }
+
+    obj_buffer->max_num_elements = num_elements;
+    return VA_STATUS_SUCCESS;
+}
+
 VAStatus epiphany_BufferSetNumElements(
 		VADriverContextP ctx,
 		VABufferID buf_id,	/* in */
@@ -812,11 +1769,15 @@ VAStatus epiphany_BufferSetNumElements(
     INIT_DRIVER_DATA
     VAStatus vaStatus = VA_STATUS_SUCCESS;
     object_buffer_p obj_buffer = BUFFER(buf_id);
-    ASSERT(obj_buffer);
+    if (NULL == obj_buffer)
+    {
+        vaStatus = VA_STATUS_ERROR_INVALID_BUFFER;
+        return vaStatus;
+    }
 
-    if ((num_elements < 0) || (num_elements > obj_buffer->max_num_elements))
+    if (num_elements > obj_buffer->max_num_elements)
     {
-        vaStatus = VA_STATUS_ERROR_UNKNOWN;
+        vaStatus = epiphany__grow_buffer(driver_data, obj_buffer, num_elements);
     }
     if (VA_STATUS_SUCCESS == vaStatus)
     {
@@ -835,7 +1796,6 @@ VAStatus epiphany_MapBuffer(
     INIT_DRIVER_DATA
     VAStatus vaStatus = VA_STATUS_ERROR_UNKNOWN;
     object_buffer_p obj_buffer = BUFFER(buf_id);
-    ASSERT(obj_buffer);
     if (NULL == obj_buffer)
     {
         vaStatus = VA_STATUS_ERROR_INVALID_BUFFER;
@@ -859,27 +1819,112 @@ VAStatus epiphany_UnmapBuffer(
     return VA_STATUS_SUCCESS;
 }
 
-static void epiphany__destroy_buffer(struct epiphany_driver_data *driver_data, object_buffer_p obj_buffer)
+VAStatus epiphany_DestroyBuffer(
+		VADriverContextP ctx,
+		VABufferID buffer_id
+	)
 {
-    if (NULL != obj_buffer->buffer_data)
+    INIT_DRIVER_DATA
+    object_buffer_p obj_buffer;
+
+    pthread_mutex_lock(&driver_data->buffer_mutex);
+    obj_buffer = BUFFER(buffer_id);
+    if (NULL == obj_buffer)
     {
-        free(obj_buffer->buffer_data);
-        obj_buffer->buffer_data = NULL;
+        pthread_mutex_unlock(&driver_data->buffer_mutex);
+        return VA_STATUS_ERROR_INVALID_BUFFER;
     }
 
-    object_heap_free( &driver_data->buffer_heap, (object_base_p) obj_buffer);
+    /* Rendered buffers belong to their picture until it has been decoded */
+    if (!obj_buffer->rendered)
+    {
+        epiphany__destroy_buffer(driver_data, obj_buffer);
+    }
+    pthread_mutex_unlock(&driver_data->buffer_mutex);
+    return VA_STATUS_SUCCESS;
 }
 
-VAStatus epiphany_DestroyBuffer(
-		VADriverContextP ctx,
-		VABufferID buffer_id
-	)
+static int epiphany__is_picture_buffer(VABufferType type)
 {
-    INIT_DRIVER_DATA
-    object_buffer_p obj_buffer = BUFFER(buffer_id);
-    ASSERT(obj_buffer);
+    switch (type)
+    {
+        case VAPictureParameterBufferType:
+        case VAIQMatrixBufferType:
+        case VABitPlaneBufferType:
+#ifdef HAVE_VA_JPEG_DECODE
+        case VAHuffmanTableBufferType:
+#endif
+        case VASliceParameterBufferType:
+        case VASliceDataBufferType:
+        case VAMacroblockParameterBufferType:
+        case VAResidualDataBufferType:
+            return 1;
+        default:
+            return 0;
+    }
+}
 
-    epiphany__destroy_buffer(driver_data, obj_buffer);
+/* File a rendered buffer by type, a picture has at most one of each parameter buffer */
+static VAStatus epiphany__render_buffer(struct epiphany_driver_data *driver_data, struct epiphany_picture *picture, object_buffer_p obj_buffer)
+{
+    VABufferID buffer_id = obj_buffer->base.id;
+    VABufferID *slot = NULL;
+    struct epiphany_buffer_list *list = NULL;
+
+    switch (obj_buffer->type)
+    {
+        case VAPictureParameterBufferType:
+            slot = &picture->pic_param;
+            break;
+        case VAIQMatrixBufferType:
+            slot = &picture->iq_matrix;
+            break;
+        case VABitPlaneBufferType:
+            slot = &picture->bit_plane;
+            break;
+#ifdef HAVE_VA_JPEG_DECODE
+        case VAHuffmanTableBufferType:
+            slot = &picture->huffman_table;
+            break;
+#endif
+        case VASliceParameterBufferType:
+            list = &picture->slice_params;
+            break;
+        case VASliceDataBufferType:
+            list = &picture->slice_data;
+            break;
+        case VAMacroblockParameterBufferType:
+            list = &picture->mb_params;
+            break;
+        case VAResidualDataBufferType:
+            list = &picture->residual_data;
+            break;
+        default:
+            return VA_STATUS_ERROR_UNSUPPORTED_BUFFERTYPE;
+    }
+
+    if (slot && (*slot == buffer_id))
+    {
+        return VA_STATUS_SUCCESS;
+    }
+    if (obj_buffer->rendered)
+    {
+        /* Already owned by another picture */
+        return VA_STATUS_ERROR_INVALID_BUFFER;
+    }
+
+    if (slot)
+    {
+        pthread_mutex_lock(&driver_data->buffer_mutex);
+        epiphany__release_buffer_slot(driver_data, slot);
+        pthread_mutex_unlock(&driver_data->buffer_mutex);
+        *slot = buffer_id;
+    }
+    else if (VA_STATUS_SUCCESS != epiphany__buffer_list_append(list, buffer_id))
+    {
+        return VA_STATUS_ERROR_ALLOCATION_FAILED;
+    }
+    obj_buffer->rendered = 1;
     return VA_STATUS_SUCCESS;
 }
 
@@ -895,11 +1940,21 @@ VAStatus epiphany_BeginPicture(
     object_surface_p obj_surface;
 
     obj_context = CONTEXT(context);
-    ASSERT(obj_context);
+    if (NULL == obj_context)
+    {
+        vaStatus = VA_STATUS_ERROR_INVALID_CONTEXT;
+        return vaStatus;
+    }
 
     obj_surface = SURFACE(render_target);
-    ASSERT(obj_surface);
+    if (NULL == obj_surface)
+    {
+        vaStatus = VA_STATUS_ERROR_INVALID_SURFACE;
+        return vaStatus;
+    }
 
+    /* Drop whatever an abandoned picture left behind */
+    epiphany_release_picture_buffers(driver_data, &obj_context->picture);
     obj_context->current_render_target = obj_surface->base.id;
 
     return vaStatus;
@@ -919,29 +1974,44 @@ VAStatus epiphany_RenderPicture(
     int i;
 
     obj_context = CONTEXT(context);
-    ASSERT(obj_context);
+    if (NULL == obj_context)
+    {
+        vaStatus = VA_STATUS_ERROR_INVALID_CONTEXT;
+        return vaStatus;
+    }
 
     obj_surface = SURFACE(obj_context->current_render_target);
-    ASSERT(obj_surface);
+    if (NULL == obj_surface)
+    {
+        vaStatus = VA_STATUS_ERROR_INVALID_SURFACE;
+        return vaStatus;
+    }
 
     /* verify that we got valid buffer references */
     for(i = 0; i < num_buffers; i++)
     {
         object_buffer_p obj_buffer = BUFFER(buffers[i]);
-        ASSERT(obj_buffer);
         if (NULL == obj_buffer)
         {
             vaStatus = VA_STATUS_ERROR_INVALID_BUFFER;
-            break;
+            return vaStatus;
+        }
+        if (!epiphany__is_picture_buffer(obj_buffer->type))
+        {
+            vaStatus = VA_STATUS_ERROR_UNSUPPORTED_BUFFERTYPE;
+            return vaStatus;
         }
     }
-    
-    /* Release buffers */
+
+    /* The context takes ownership until vaEndPicture */
     for(i = 0; i < num_buffers; i++)
     {
         object_buffer_p obj_buffer = BUFFER(buffers[i]);
-        ASSERT(obj_buffer);
-        epiphany__destroy_buffer(driver_data, obj_buffer);
+        vaStatus = epiphany__render_buffer(driver_data, &obj_context->picture, obj_buffer);
+        if (VA_STATUS_SUCCESS != vaStatus)
+        {
+            break;
+        }
     }
 
     return vaStatus;
@@ -958,13 +2028,24 @@ VAStatus epiphany_EndPicture(
     object_surface_p obj_surface;
 
     obj_context = CONTEXT(context);
-    ASSERT(obj_context);
+    if (NULL == obj_context)
+    {
+        vaStatus = VA_STATUS_ERROR_INVALID_CONTEXT;
+        return vaStatus;
+    }
 
     obj_surface = SURFACE(obj_context->current_render_target);
-    ASSERT(obj_surface);
+    if (NULL == obj_surface)
+    {
+        vaStatus = VA_STATUS_ERROR_INVALID_SURFACE;
+        return vaStatus;
+    }
 
-    // For now, assume that we are done with rendering right away
     obj_context->current_render_target = -1;
+    STATS_ADD(driver_data->num_pictures, 1);
+
+    /* Decode errors are reported by vaSyncSurface() unless decoding is synchronous */
+    vaStatus = driver_data->backend->submit_picture(driver_data, obj_context, obj_surface);
 
     return vaStatus;
 }
@@ -980,7 +2061,14 @@ VAStatus epiphany_SyncSurface(
     object_surface_p obj_surface;
 
     obj_surface = SURFACE(render_target);
-    ASSERT(obj_surface);
+    if (NULL == obj_surface)
+    {
+        vaStatus = VA_STATUS_ERROR_INVALID_SURFACE;
+        return vaStatus;
+    }
+
+    /* Fails if the last picture decoded into the surface did */
+    vaStatus = driver_data->backend->wait_surface(driver_data, obj_surface);
 
     return vaStatus;
 }
@@ -996,9 +2084,20 @@ VAStatus epiphany_QuerySurfaceStatus(
     object_surface_p obj_surface;
 
     obj_surface = SURFACE(render_target);
-    ASSERT(obj_surface);
+    if (NULL == obj_surface)
+    {
+        vaStatus = VA_STATUS_ERROR_INVALID_SURFACE;
+        return vaStatus;
+    }
 
-    *status = VASurfaceReady;
+    if (driver_data->backend->surface_busy(driver_data, obj_surface))
+    {
+        *status = VASurfaceRendering;
+    }
+    else
+    {
+        *status = VASurfaceReady;
+    }
 
     return vaStatus;
 }
@@ -1081,8 +2180,17 @@ VAStatus epiphany_BufferInfo(
         unsigned int *num_elements /* out */
     )
 {
-    /* TODO */
-    return VA_STATUS_ERROR_UNIMPLEMENTED;
+    INIT_DRIVER_DATA
+    object_buffer_p obj_buffer = BUFFER(buf_id);
+    if (NULL == obj_buffer)
+    {
+        return VA_STATUS_ERROR_INVALID_BUFFER;
+    }
+
+    *type = obj_buffer->type;
+    *size = obj_buffer->element_size;
+    *num_elements = obj_buffer->num_elements;
+    return VA_STATUS_SUCCESS;
 }
 
     
@@ -1114,36 +2222,283 @@ VAStatus epiphany_UnlockSurface(
     return VA_STATUS_ERROR_UNIMPLEMENTED;
 }
 
+static void epiphany__report_heap_stats(const char *name, object_heap_p heap)
+{
+    struct object_heap_stats stats;
+
+    object_heap_get_stats(heap, &stats);
+    epiphany__information_message("%s heap: %d allocated, %d peak, %d reserved\n",
+                                  name, stats.allocated, stats.peak_allocated, stats.reserved);
+}
+
+static void epiphany__report_buffer_pool_stats(buffer_pool_p pool)
+{
+    struct buffer_pool_stats stats;
+    unsigned long requests;
+
+    buffer_pool_get_stats(pool, &stats);
+    requests = stats.hits + stats.misses;
+    epiphany__information_message("buffer pool: %lu/%lu hits (%lu%%), %zu bytes cached, %zu bytes in use\n",
+                                  stats.hits, requests, requests ? stats.hits * 100 / requests : 0,
+                                  stats.bytes_cached, stats.bytes_in_use);
+}
+
+static void epiphany__report_surface_pool_stats(surface_pool_p pool)
+{
+    struct surface_pool_stats stats;
+
+    surface_pool_get_stats(pool, &stats);
+    epiphany__information_message("surface pool: %lu/%lu hits, %zu bytes cached, %zu bytes in use\n",
+                                  stats.hits, stats.hits + stats.misses,
+                                  stats.bytes_cached, stats.bytes_in_use);
+}
+
+static void epiphany__report_decode_queue_stats(decode_queue_p queue)
+{
+    struct decode_queue_stats stats;
+
+    decode_queue_get_stats(queue, &stats);
+    epiphany__information_message("decode queue: %d threads, %lu pictures, %u most in flight, %lu waits blocked\n",
+                                  stats.num_threads, stats.submitted, stats.max_outstanding, stats.waits);
+}
+
+static void epiphany__report_thread_pool_stats(thread_pool_p pool)
+{
+    struct thread_pool_stats stats;
+
+    thread_pool_get_stats(pool, &stats);
+    epiphany__information_message("decode thread pool: %d workers, %lu tasks run, %lu stolen (%.1f%%)\n",
+                                  stats.num_threads, stats.tasks_run, stats.tasks_stolen,
+                                  stats.tasks_run ? 100.0 * stats.tasks_stolen / stats.tasks_run : 0.0);
+}
+
+static void epiphany__report_emesh_stats(emesh_p mesh)
+{
+    struct emesh_stats stats;
+    uint64_t per_launch;
+
+    emesh_get_stats(mesh, &stats);
+    per_launch = stats.launches ? stats.cycles / stats.launches : 0;
+    epiphany__information_message("emesh %dx%d: %lu launches, %llu cycles per launch (%llu us at %u MHz), "
+                                  "%llu compute and %llu stall cycles, %llu bytes DMA, %llu bytes off-chip, "
+                                  "%llu cycles eLink bound, %zu bytes local memory used\n",
+                                  stats.rows, stats.cols, stats.launches, (unsigned long long) per_launch,
+                                  (unsigned long long) (per_launch / stats.clock_mhz), stats.clock_mhz,
+                                  (unsigned long long) stats.compute_cycles,
+                                  (unsigned long long) stats.stall_cycles,
+                                  (unsigned long long) stats.dma_bytes,
+                                  (unsigned long long) stats.external_bytes,
+                                  (unsigned long long) stats.elink_bound_cycles, stats.max_local_used);
+}
+
+static void epiphany__report_buffer_data_stats(struct epiphany_driver_data *driver_data)
+{
+    unsigned long long pictures = driver_data->num_pictures;
+
+    epiphany__information_message("buffer data: %llu bytes copied, %llu bytes wrapped, %llu pictures, %llu bytes copied per picture\n",
+                                  driver_data->bytes_copied, driver_data->bytes_wrapped, pictures,
+                                  pictures ? driver_data->bytes_copied / pictures : 0);
+}
+
+static const char *epiphany__profile_name(int profile)
+{
+    switch (profile)
+    {
+        case VAProfileMPEG2Simple:              return "MPEG-2 Simple";
+        case VAProfileMPEG2Main:                return "MPEG-2 Main";
+        case VAProfileMPEG4Simple:              return "MPEG-4 Simple";
+        case VAProfileMPEG4AdvancedSimple:      return "MPEG-4 Advanced Simple";
+        case VAProfileMPEG4Main:                return "MPEG-4 Main";
+        case VAProfileH264Baseline:             return "H.264 Baseline";
+        case VAProfileH264Main:                 return "H.264 Main";
+        case VAProfileH264High:                 return "H.264 High";
+        case VAProfileVC1Simple:                return "VC-1 Simple";
+        case VAProfileVC1Main:                  return "VC-1 Main";
+        case VAProfileVC1Advanced:              return "VC-1 Advanced";
+#ifdef HAVE_VA_JPEG_DECODE
+        case VAProfileJPEGBaseline:             return "JPEG Baseline";
+#endif
+        default:                                return "unknown";
+    }
+}
+
+static void epiphany__report_decode_stats(struct epiphany_driver_data *driver_data)
+{
+    int i;
+
+    for (i = 0; i < EPIPHANY_MAX_PROFILE_STATS; i++)
+    {
+        unsigned long long pictures = driver_data->decode_pictures[i];
+        unsigned long long ns = driver_data->decode_ns[i];
+
+        if (0 == pictures)
+        {
+            continue;
+        }
+        epiphany__information_message("decode %s: %llu pictures in %llu ms, %.1f fps\n",
+                                      epiphany__profile_name(i), pictures, ns / 1000000,
+                                      ns ? pictures * 1e9 / ns : 0.0);
+    }
+    for (i = 0; i < EPIPHANY_MAX_STRATEGY_STATS; i++)
+    {
+        unsigned long long pictures = driver_data->strategy_pictures[i];
+
+        if (0 == pictures)
+        {
+            continue;
+        }
+        epiphany__information_message("decode strategy %s: %llu pictures, %.2f ms per picture, %.2f ms slowest\n",
+                                      epiphany__strategy_name(i), pictures,
+                                      driver_data->strategy_ns[i] / 1e6 / pictures,
+                                      driver_data->strategy_max_ns[i] / 1e6);
+    }
+    if (driver_data->pipeline_pictures)
+    {
+        double pictures = driver_data->pipeline_pictures;
+
+        epiphany__information_message("decode pipeline: %llu pictures, per picture %.2f ms waiting for room, "
+                                      "%.2f ms parsing, %.2f ms waiting for references or workers, %.2f ms reconstructing, "
+                                      "%llu most in flight\n",
+                                      driver_data->pipeline_pictures,
+                                      driver_data->pipeline_slot_ns / 1e6 / pictures,
+                                      driver_data->pipeline_parse_ns / 1e6 / pictures,
+                                      driver_data->pipeline_reference_ns / 1e6 / pictures,
+                                      driver_data->pipeline_reconstruct_ns / 1e6 / pictures,
+                                      driver_data->pipeline_max_in_flight);
+    }
+}
+
+/*
+ * vaTerminate visitors, called with the heap lock held for the whole walk
+ */
+static int epiphany__terminate_image(object_base_p obj, void *data)
+{
+    struct epiphany_driver_data *driver_data = data;
+    object_image_p obj_image = (object_image_p) obj;
+    object_buffer_p obj_buffer = BUFFER(obj_image->image.buf);
+    object_surface_p obj_surface = SURFACE(obj_image->derived_surface);
+
+    epiphany__information_message("vaTerminate: imageID %08x still allocated, destroying\n", obj_image->base.id);
+    if (obj_buffer)
+    {
+        epiphany__destroy_buffer(driver_data, obj_buffer);
+    }
+    if (obj_surface)
+    {
+        driver_data->backend->unmap_surface(driver_data, obj_surface);
+    }
+    return OBJECT_HEAP_VISIT_FREE;
+}
+
+static int epiphany__terminate_buffer(object_base_p obj, void *data)
+{
+    struct epiphany_driver_data *driver_data = data;
+    object_buffer_p obj_buffer = (object_buffer_p) obj;
+
+    epiphany__information_message("vaTerminate: bufferID %08x still allocated, destroying\n", obj_buffer->base.id);
+    epiphany__release_buffer_data(driver_data, obj_buffer);
+    return OBJECT_HEAP_VISIT_FREE;
+}
+
+static int epiphany__terminate_surface(object_base_p obj, void *data)
+{
+    struct epiphany_driver_data *driver_data = data;
+    object_surface_p obj_surface = (object_surface_p) obj;
+
+    epiphany__information_message("vaTerminate: surfaceID %08x still allocated, destroying\n", obj->id);
+    driver_data->backend->free_surface_storage(driver_data, obj_surface->storage);
+    obj_surface->storage = NULL;
+    return OBJECT_HEAP_VISIT_FREE;
+}
+
+static int epiphany__terminate_context(object_base_p obj, void *data)
+{
+    object_context_p obj_context = (object_context_p) obj;
+
+    epiphany__information_message("vaTerminate: contextID %08x still allocated, destroying\n", obj_context->base.id);
+    free(obj_context->render_targets);
+    obj_context->render_targets = NULL;
+    /* The buffers themselves went with the buffer heap */
+    epiphany_destroy_picture(&obj_context->picture);
+    epiphany_backend_destroy_decoder(obj_context);
+    epiphany__destroy_decode_threads(obj_context);
+    return OBJECT_HEAP_VISIT_FREE;
+}
+
+/* Reports the scheduling of contexts still there, their flows go with the decode queue */
+static int epiphany__terminate_context_stats(object_base_p obj, void *data)
+{
+    epiphany__report_context_stats(data, (object_context_p) obj);
+    return OBJECT_HEAP_VISIT_CONTINUE;
+}
+
+static int epiphany__terminate_config(object_base_p obj, void *data)
+{
+    return OBJECT_HEAP_VISIT_FREE;
+}
+
 VAStatus epiphany_Terminate( VADriverContextP ctx )
 {
     INIT_DRIVER_DATA
-    object_buffer_p obj_buffer;
-    object_config_p obj_config;
-    object_heap_iterator iter;
 
-    /* Clean up left over buffers */
-    obj_buffer = (object_buffer_p) object_heap_first( &driver_data->buffer_heap, &iter);
-    while (obj_buffer)
+    /* Finish the queued pictures before their objects go away */
+    driver_data->backend->wait_surface( driver_data, NULL );
+
+    if (driver_data->report_stats)
     {
-        epiphany__information_message("vaTerminate: bufferID %08x still allocated, destroying\n", obj_buffer->base.id);
-        epiphany__destroy_buffer(driver_data, obj_buffer);
-        obj_buffer = (object_buffer_p) object_heap_next( &driver_data->buffer_heap, &iter);
+        epiphany__report_heap_stats("config", &driver_data->config_heap);
+        epiphany__report_heap_stats("context", &driver_data->context_heap);
+        epiphany__report_heap_stats("surface", &driver_data->surface_heap);
+        epiphany__report_heap_stats("buffer", &driver_data->buffer_heap);
+        epiphany__report_heap_stats("image", &driver_data->image_heap);
+        epiphany__report_buffer_pool_stats(&driver_data->buffer_pool);
+        epiphany__report_buffer_data_stats(driver_data);
+        epiphany__report_decode_stats(driver_data);
+        epiphany__report_surface_pool_stats(&driver_data->surface_pool);
+        epiphany__report_decode_queue_stats(&driver_data->decode_queue);
+        object_heap_foreach( &driver_data->context_heap, epiphany__terminate_context_stats, driver_data );
+        if (driver_data->thread_pool)
+        {
+            epiphany__report_thread_pool_stats(driver_data->thread_pool);
+        }
+        if (driver_data->emesh)
+        {
+            epiphany__report_emesh_stats(driver_data->emesh);
+        }
     }
+
+    /* Nothing is queued on the shared workers any more */
+    if (driver_data->thread_pool)
+    {
+        thread_pool_destroy( driver_data->thread_pool );
+        free( driver_data->thread_pool );
+        driver_data->thread_pool = NULL;
+    }
+    pthread_mutex_destroy( &driver_data->thread_pool_mutex );
+
+    /* Clean up left over images, they hold buffers */
+    object_heap_foreach( &driver_data->image_heap, epiphany__terminate_image, driver_data );
+    object_heap_destroy( &driver_data->image_heap );
+
+    /* Clean up left over buffers */
+    object_heap_foreach( &driver_data->buffer_heap, epiphany__terminate_buffer, driver_data );
     object_heap_destroy( &driver_data->buffer_heap );
+    buffer_pool_destroy( &driver_data->buffer_pool );
 
-    /* TODO cleanup */
+    /* Clean up left over surfaces */
+    object_heap_foreach( &driver_data->surface_heap, epiphany__terminate_surface, driver_data );
     object_heap_destroy( &driver_data->surface_heap );
 
-    /* TODO cleanup */
+    driver_data->backend->terminate( driver_data );
+    pthread_mutex_destroy( &driver_data->buffer_mutex );
+    surface_pool_destroy( &driver_data->surface_pool );
+
+    /* Clean up left over contexts */
+    object_heap_foreach( &driver_data->context_heap, epiphany__terminate_context, driver_data );
     object_heap_destroy( &driver_data->context_heap );
 
     /* Clean up configIDs */
-    obj_config = (object_config_p) object_heap_first( &driver_data->config_heap, &iter);
-    while (obj_config)
-    {
-        object_heap_free( &driver_data->config_heap, (object_base_p) obj_config);
-        obj_config = (object_config_p) object_heap_next( &driver_data->config_heap, &iter);
-    }
+    object_heap_foreach( &driver_data->config_heap, epiphany__terminate_config, driver_data );
     object_heap_destroy( &driver_data->config_heap );
 
     free(ctx->pDriverData);
@@ -1158,6 +2513,8 @@ VAStatus VA_DRIVER_INIT_FUNC(  VADriverContextP ctx )
 {
     struct VADriverVTable * const vtable = ctx->vtable;
     int result;
+    size_t pool_size;
+    const char *backend;
     struct epiphany_driver_data *driver_data;
 
     ctx->version_major = VA_MAJOR_VERSION;
@@ -1218,6 +2575,31 @@ VAStatus VA_DRIVER_INIT_FUNC(  VADriverContextP ctx )
     driver_data = (struct epiphany_driver_data *) malloc( sizeof(*driver_data) );
     ctx->pDriverData = (void *) driver_data;
 
+    /* Settings come from the environment or the configuration file, see driver_config.h */
+    if (driver_config_init( &driver_data->config ) < 0)
+    {
+        epiphany__error_message("ignoring malformed lines of the configuration file\n");
+    }
+
+    /* Print object usage statistics at vaTerminate */
+    driver_data->report_stats = driver_config_enabled(&driver_data->config, "driver_stats");
+    driver_data->bytes_copied = 0;
+    driver_data->bytes_wrapped = 0;
+    driver_data->num_pictures = 0;
+    memset(driver_data->decode_pictures, 0, sizeof(driver_data->decode_pictures));
+    memset(driver_data->decode_ns, 0, sizeof(driver_data->decode_ns));
+    memset(driver_data->strategy_pictures, 0, sizeof(driver_data->strategy_pictures));
+    memset(driver_data->strategy_ns, 0, sizeof(driver_data->strategy_ns));
+    memset(driver_data->strategy_max_ns, 0, sizeof(driver_data->strategy_max_ns));
+    driver_data->pipeline_pictures = 0;
+    driver_data->pipeline_slot_ns = 0;
+    driver_data->pipeline_parse_ns = 0;
+    driver_data->pipeline_reference_ns = 0;
+    driver_data->pipeline_reconstruct_ns = 0;
+    driver_data->pipeline_max_in_flight = 0;
+    driver_data->thread_pool = NULL;
+    pthread_mutex_init( &driver_data->thread_pool_mutex, NULL );
+
     result = object_heap_init( &driver_data->config_heap, sizeof(struct object_config), CONFIG_ID_OFFSET );
     ASSERT( result == 0 );
 
@@ -1227,9 +2609,83 @@ VAStatus VA_DRIVER_INIT_FUNC(  VADriverContextP ctx )
     result = object_heap_init( &driver_data->surface_heap, sizeof(struct object_surface), SURFACE_ID_OFFSET );
     ASSERT( result == 0 );
 
-    result = object_heap_init( &driver_data->buffer_heap, sizeof(struct object_buffer), BUFFER_ID_OFFSET );
+    /* Buffers churn every frame, give them bigger buckets */
+    result = object_heap_init_bucket_size( &driver_data->buffer_heap, sizeof(struct object_buffer), BUFFER_ID_OFFSET, EPIPHANY_BUFFER_HEAP_BUCKET_SIZE );
     ASSERT( result == 0 );
 
+    result = object_heap_init( &driver_data->image_heap, sizeof(struct object_image), IMAGE_ID_OFFSET );
+    ASSERT( result == 0 );
+
+    pool_size = EPIPHANY_BUFFER_POOL_MAX_CACHED;
+    if (driver_config_get(&driver_data->config, "buffer_pool_mb"))
+    {
+        pool_size = (size_t) driver_config_get_int(&driver_data->config, "buffer_pool_mb", 0) << 20;
+    }
+    result = buffer_pool_init( &driver_data->buffer_pool, pool_size );
+    ASSERT( result == 0 );
+
+    pool_size = EPIPHANY_SURFACE_POOL_MAX_CACHED;
+    if (driver_config_get(&driver_data->config, "surface_pool_mb"))
+    {
+        pool_size = (size_t) driver_config_get_int(&driver_data->config, "surface_pool_mb", 0) << 20;
+    }
+    /* Huge pages cut TLB misses on big frames at the cost of some padding */
+    result = surface_pool_init( &driver_data->surface_pool, pool_size,
+                                driver_config_enabled(&driver_data->config, "surface_hugepages") );
+    ASSERT( result == 0 );
+
+    /* The backend picks the kernels and runs the decoding, EPIPHANY_EMESH alone selects the mesh */
+    pthread_mutex_init( &driver_data->buffer_mutex, NULL );
+    backend = driver_config_get(&driver_data->config, "backend");
+    if (NULL == backend)
+    {
+        backend = driver_config_get(&driver_data->config, "emesh") ? "emesh" : EPIPHANY_DEFAULT_BACKEND;
+    }
+    driver_data->backend = epiphany_backend_get_ops(backend);
+    if (NULL == driver_data->backend)
+    {
+        epiphany__error_message("unknown backend %s, using %s\n", backend, EPIPHANY_DEFAULT_BACKEND);
+    }
+    else if (VA_STATUS_SUCCESS != driver_data->backend->init(driver_data))
+    {
+        epiphany__error_message("backend %s failed to start, using %s\n", backend, EPIPHANY_DEFAULT_BACKEND);
+        driver_data->backend = NULL;
+    }
+    if (NULL == driver_data->backend)
+    {
+        driver_data->backend = epiphany_backend_get_ops(EPIPHANY_DEFAULT_BACKEND);
+        result = driver_data->backend->init(driver_data);
+        ASSERT( result == VA_STATUS_SUCCESS );
+    }
+    if (driver_data->emesh)
+    {
+        epiphany__information_message("emesh: only MPEG-2 (VLD and MoComp) runs on the mesh, "
+                                      "H.264, VC-1, MPEG-4 and JPEG decode on the host\n");
+    }
+
+    if (driver_data->report_stats)
+    {
+        if (driver_data->decode_queue.num_threads)
+        {
+            epiphany__information_message("backend: %s, decoding on %d queue threads\n", driver_data->backend->name,
+                                          driver_data->decode_queue.num_threads);
+        }
+        else
+        {
+            epiphany__information_message("backend: %s, decoding in vaEndPicture\n", driver_data->backend->name);
+        }
+        epiphany__information_message("image conversion: %s\n", driver_data->convert_ops->name);
+        epiphany__information_message("decoder dsp: %s\n", driver_data->dsp_ops->name);
+        epiphany__information_message("h264 dsp: %s\n", driver_data->h264_dsp_ops->name);
+        epiphany__information_message("jpeg dsp: %s\n", driver_data->jpeg_dsp_ops->name);
+        epiphany__information_message("mpeg4 dsp: %s\n", driver_data->mpeg4_dsp_ops->name);
+        epiphany__information_message("vc1 dsp: %s\n", driver_data->vc1_dsp_ops->name);
+        if (driver_data->emesh)
+        {
+            epiphany__information_message("emesh: %dx%d at %u MHz\n", driver_data->emesh->rows,
+                                          driver_data->emesh->cols, driver_data->emesh->params.clock_mhz);
+        }
+    }
 
     return VA_STATUS_SUCCESS;
 }
@@ -28,20 +28,108 @@
 
 #include <va/va.h>
 #include "object_heap.h"
+#include "buffer_pool.h"
+#include "decode_queue.h"
+#include "driver_config.h"
+#include "emesh.h"
+#include "surface_pool.h"
+#include "thread_pool.h"
+#include "image_convert.h"
+#include "dsp.h"
+#include "h264_dsp.h"
+#include "jpeg_dsp.h"
+#include "mpeg4_dsp.h"
+#include "vc1_dsp.h"
+#include "va_epiphany.h"
 
-#define EPIPHANY_MAX_PROFILES			11
+#define EPIPHANY_MAX_PROFILES			12
+#define EPIPHANY_MAX_PROFILE_STATS		16	/* Decode timings, indexed by VAProfile */
+#define EPIPHANY_MAX_STRATEGY_STATS		3	/* Indexed by VA_EPIPHANY_DECODE_* */
 #define EPIPHANY_MAX_ENTRYPOINTS		5
 #define EPIPHANY_MAX_CONFIG_ATTRIBUTES		10
 #define EPIPHANY_MAX_IMAGE_FORMATS		10
 #define EPIPHANY_MAX_SUBPIC_FORMATS		4
 #define EPIPHANY_MAX_DISPLAY_ATTRIBUTES		4
+#define EPIPHANY_MAX_SURFACE_SIZE		8192
 #define EPIPHANY_STR_VENDOR			"Epiphany Driver 0.1"
 
+#define CONFIG(id)  ((object_config_p) object_heap_lookup( &driver_data->config_heap, id ))
+#define CONTEXT(id) ((object_context_p) object_heap_lookup( &driver_data->context_heap, id ))
+#define SURFACE(id)	((object_surface_p) object_heap_lookup( &driver_data->surface_heap, id ))
+#define BUFFER(id)  ((object_buffer_p) object_heap_lookup( &driver_data->buffer_heap, id ))
+#define IMAGE(id)   ((object_image_p) object_heap_lookup( &driver_data->image_heap, id ))
+
+#define STATS_ADD(counter, n)	__atomic_fetch_add(&(counter), (n), __ATOMIC_RELAXED)
+#define STATS_MAX(counter, n) \
+    do { \
+        unsigned long long _max = __atomic_load_n(&(counter), __ATOMIC_RELAXED); \
+        while ((_max < (n)) && !__atomic_compare_exchange_n(&(counter), &_max, (n), 1, \
+                                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) \
+            ; \
+    } while (0)
+
+struct epiphany_backend_ops;
+
 struct epiphany_driver_data {
     struct object_heap	config_heap;
     struct object_heap	context_heap;
     struct object_heap	surface_heap;
     struct object_heap	buffer_heap;
+    struct object_heap	image_heap;
+    struct buffer_pool	buffer_pool;
+    struct surface_pool	surface_pool;
+    struct decode_queue	decode_queue;
+    pthread_mutex_t	buffer_mutex;	/* Serializes destroying rendered buffers */
+    struct driver_config	config;
+    const struct epiphany_backend_ops *backend;	/* Decodes the pictures, see epiphany_backend.h */
+    emesh_p		emesh;		/* Emulated mesh of the emesh backend, NULL otherwise */
+    const struct image_convert_ops *convert_ops;
+    const struct dsp_ops *dsp_ops;
+    const struct h264_dsp_ops *h264_dsp_ops;
+    const struct jpeg_dsp_ops *jpeg_dsp_ops;
+    const struct mpeg4_dsp_ops *mpeg4_dsp_ops;
+    const struct vc1_dsp_ops *vc1_dsp_ops;
+    int report_stats;
+    /* Slice data accounting, updated atomically */
+    unsigned long long bytes_copied;
+    unsigned long long bytes_wrapped;
+    unsigned long long num_pictures;
+    /* Pictures decoded and the time spent on them per profile, only kept when reporting stats */
+    unsigned long long decode_pictures[EPIPHANY_MAX_PROFILE_STATS];
+    unsigned long long decode_ns[EPIPHANY_MAX_PROFILE_STATS];
+    /* The same for VLD pictures by decode strategy, with the slowest picture, up to leaving the decode queue */
+    unsigned long long strategy_pictures[EPIPHANY_MAX_STRATEGY_STATS];
+    unsigned long long strategy_ns[EPIPHANY_MAX_STRATEGY_STATS];
+    unsigned long long strategy_max_ns[EPIPHANY_MAX_STRATEGY_STATS];
+    /* Stages of the pictures split into them, see VAConfigAttribEpiphanyDecodeDepth, only kept when reporting stats */
+    unsigned long long pipeline_pictures;
+    unsigned long long pipeline_slot_ns;        /* Waiting for a picture in flight to make room */
+    unsigned long long pipeline_parse_ns;
+    unsigned long long pipeline_reference_ns;   /* Parsed, waiting for the pictures referenced and a worker */
+    unsigned long long pipeline_reconstruct_ns; /* Reconstruction left after parsing, and deblocking */
+    unsigned long long pipeline_max_in_flight;
+    /* Workers shared by the contexts decoding on several threads, started by the first one */
+    thread_pool_p thread_pool;
+    pthread_mutex_t thread_pool_mutex;
+};
+
+/* Buffers of one type gathered for the current picture */
+struct epiphany_buffer_list {
+    VABufferID *buffers;
+    int num_buffers;
+    int max_buffers;
+};
+
+/* Buffers passed to vaRenderPicture for one picture */
+struct epiphany_picture {
+    VABufferID pic_param;
+    VABufferID iq_matrix;
+    VABufferID bit_plane;
+    VABufferID huffman_table;
+    struct epiphany_buffer_list slice_params;
+    struct epiphany_buffer_list slice_data;
+    struct epiphany_buffer_list mb_params;
+    struct epiphany_buffer_list residual_data;
 };
 
 struct object_config {
@@ -56,29 +144,75 @@ struct object_context {
     struct object_base base;
     VAContextID context_id;
     VAConfigID config_id;
+    VAProfile profile;
+    VAEntrypoint entrypoint;
     VASurfaceID current_render_target;
     int picture_width;
     int picture_height;
     int num_render_targets;
     int flags;
+    int zero_copy_slice_data;   /* VAConfigAttribEpiphanyZeroCopySliceData */
+    int decode_threads;         /* VAConfigAttribEpiphanyDecodeThreads */
+    int decode_strategy;        /* VAConfigAttribEpiphanyDecodeStrategy */
+    int decode_depth;           /* VAConfigAttribEpiphanyDecodeDepth */
+    int decode_weight;          /* VAConfigAttribEpiphanyDecodeWeight */
+    int decode_priority;        /* VAConfigAttribEpiphanyDecodePriority */
+    int decode_deadline;        /* VAConfigAttribEpiphanyDecodeDeadline, in microseconds */
+    thread_pool_p thread_pool;  /* The driver's pool helping decode jobs, NULL for one thread */
+    struct thread_pool_group thread_group;      /* Caps the threads of the pool decoding at decode_threads */
+    decode_flow_p decode_flow;  /* Where the decode queue schedules the pictures */
+    /* Time pictures waited in the decode queue, only kept when reporting stats */
+    unsigned long long queue_pictures;
+    unsigned long long queue_delay_ns;
+    unsigned long long queue_max_delay_ns;
+    unsigned long long queue_deadlines_missed;
     VASurfaceID *render_targets;
+    /* Owned by the context until vaEndPicture hands it to a decode job */
+    struct epiphany_picture picture;
+    void *decoder;              /* Codec state kept between pictures, only used by decode jobs */
 };
 
 struct object_surface {
     struct object_base base;
     VASurfaceID surface_id;
+    int width;
+    int height;
+    struct surface_storage *storage;    /* NV12 planes */
+    VAImageID derived_image;            /* VA_INVALID_ID unless vaDeriveImage()d */
+    struct decode_fence fence;          /* Decode jobs rendering into the surface */
 };
 
 struct object_buffer {
     struct object_base base;
     void *buffer_data;
+    size_t capacity;            /* Bytes of pool storage behind buffer_data */
+    int external;               /* buffer_data is client memory, never freed */
+    int rendered;               /* Owned by a picture, destroyed once it is decoded */
+    VABufferType type;
+    unsigned int element_size;
     int max_num_elements;
     int num_elements;
 };
 
+struct object_image {
+    struct object_base base;
+    VAImage image;
+    VASurfaceID derived_surface;        /* Surface whose planes image.buf wraps */
+};
+
 typedef struct object_config *object_config_p;
 typedef struct object_context *object_context_p;
 typedef struct object_surface *object_surface_p;
 typedef struct object_buffer *object_buffer_p;
+typedef struct object_image *object_image_p;
+
+/* Empties a picture for rendering buffers into */
+void epiphany_init_picture(struct epiphany_picture *picture);
+
+/* Destroy every buffer rendered into picture */
+void epiphany_release_picture_buffers(struct epiphany_driver_data *driver_data, struct epiphany_picture *picture);
+
+/* Frees the buffer lists, the buffers themselves must be gone already */
+void epiphany_destroy_picture(struct epiphany_picture *picture);
 
 #endif /* _EPIPHANY_DRV_VIDEO_H_ */
@@ -0,0 +1,3596 @@
+/*
+ * Copyright (c) 2012 Scott Tincman <sctincman@gmail.com>. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+/*
+ * H.264 VLD decoding (ITU-T H.264 | ISO/IEC 14496-10) on the host CPU.
+ *
+ * As with MPEG-2 the client parsed the headers, so this starts at the
+ * slice data: entropy decoding, intra prediction, motion vector
+ * prediction including both direct modes, weighted prediction and the
+ * inverse transforms, then the deblocking filter over the whole picture
+ * once all its slices are in. Entropy decoding is CAVLC or CABAC, the
+ * arithmetic decoder of the latter in h264_cabac.c. Progressive frames in
+ * 4:2:0 with 8 bit samples are supported, which is the Constrained
+ * Baseline, Main and High profiles short of interlacing. Interlaced
+ * pictures are refused rather than decoded wrong.
+ *
+ * Direct prediction in B slices needs the motion of another picture, so
+ * the decoder keeps the motion field of each surface it decoded for as
+ * long as the ReferenceFrames of later pictures name it.
+ *
+ * With a thread pool on the context, reconstruction is taken off the
+ * parsing thread: parsing leaves what each macroblock needs in a record of
+ * its own, and the pool reconstructs the macroblocks in wavefront order
+ * behind it, each one once the macroblock above and to the right of it is
+ * done. The deblocking filter then runs as a second wavefront.
+ *
+ * Slices don't predict from each other, so the slice strategy decodes
+ * each on the pool instead, unescaping into a buffer of its own. Only the
+ * deblocking filter crosses slice boundaries, and it was deferred until
+ * the whole picture is in anyway; it runs as the same second wavefront.
+ *
+ * With a decode depth above one, pictures reconstructed behind parsing
+ * don't hold the decode queue up until they are done: the queue moves on
+ * to parsing the next picture into another slot while the pool finishes
+ * the last one. A picture waits for the pictures in flight it references
+ * before reconstruction starts, and for those decoding into its surface or
+ * referencing it before parsing does.
+ */
+
+#include "config.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "epiphany_h264.h"
+#include "epiphany_backend.h"
+#include "bitstream.h"
+#include "h264_cabac.h"
+#include "vlc.h"
+#include "wavefront.h"
+
+/* slice_type % 5 */
+#define H264_SLICE_P            0
+#define H264_SLICE_B            1
+#define H264_SLICE_I            2
+
+/* Macroblock kinds */
+#define H264_MB_INTRA4x4        0x01
+#define H264_MB_INTRA8x8        0x02
+#define H264_MB_INTRA16x16      0x04
+#define H264_MB_PCM             0x08
+#define H264_MB_INTER           0x10
+#define H264_MB_DIRECT          0x20    /* B_Skip and B_Direct_16x16 */
+#define H264_MB_TRANSFORM8x8    0x40
+#define H264_MB_SKIP            0x80    /* P_Skip and B_Skip */
+#define H264_MB_INTRA           (H264_MB_INTRA4x4 | H264_MB_INTRA8x8 | H264_MB_INTRA16x16 | H264_MB_PCM)
+
+/* Prediction of a partition */
+#define H264_PRED_L0            1
+#define H264_PRED_L1            2
+#define H264_PRED_BI            3
+#define H264_PRED_DIRECT        4
+
+#define H264_MAX_REFS           32
+#define H264_MAX_FRAMES         (17 + VA_EPIPHANY_MAX_DECODE_DEPTH)    /* The references, the picture and those in flight */
+#define H264_NO_SLICE           0xffff
+#define H264_EDGE_STRIDE        32
+
+/*
+ * Motion vector prediction looks at the 4x4 blocks around the current
+ * one through a cache holding the macroblock and its neighbours, a row
+ * above it, a column left of it and the top right block
+ */
+#define H264_CACHE(x, y)        (((y) + 1) * 8 + (x) + 1)
+#define H264_REF_UNUSED         (-1)    /* Intra, or the list is not used */
+#define H264_REF_UNAVAILABLE    (-2)    /* Outside the slice, or not decoded yet */
+
+/* Motion of one macroblock, what deblocking and direct prediction need */
+struct h264_motion {
+    int16_t mv[2][16][2];       /* [list][4x4 block in raster order][x, y], quarter samples */
+    int8_t ref_idx[2][4];       /* [list][8x8 block], negative if the list is not used */
+    VASurfaceID ref_pic[2][4];  /* What ref_idx pointed at */
+};
+
+/* The motion field of a surface decoded into */
+struct h264_frame {
+    VASurfaceID surface;        /* VA_INVALID_SURFACE if the slot is free */
+    struct h264_motion *motion;
+};
+
+/* Per macroblock state of the picture */
+struct h264_mb {
+    uint8_t type;
+    int8_t qp;                  /* QPY, 0 for I_PCM */
+    uint16_t slice;             /* Index in the slice table, H264_NO_SLICE until decoded */
+    uint16_t coded;             /* 4x4 luma blocks with coefficients, by 8x8 for 8x8 transforms */
+    uint8_t non_zero[24];       /* TotalCoeff of the 4x4 luma blocks in raster order, then Cb and Cr */
+    int8_t intra_mode[16];      /* Intra4x4PredMode in raster order, 2 (DC) if not intra NxN */
+    /* What the CABAC contexts of the macroblocks to come look at */
+    uint8_t cbp;                /* coded_block_pattern, 0x2f for I_PCM */
+    uint8_t coded_dc;           /* coded_block_flag of the luma DC, Cb DC and Cr DC blocks, by bit */
+    uint8_t chroma_mode;        /* intra_chroma_pred_mode, 0 if not intra */
+    uint8_t direct;             /* 8x8 blocks predicted in direct mode, by bit */
+    uint8_t mvd[2][16][2];      /* Absolute mvd of the 4x4 blocks, up to 64 */
+};
+
+struct h264_reference {
+    VASurfaceID surface;
+    uint8_t *y;
+    uint8_t *uv;
+    int poc;
+    int long_term;
+};
+
+/* What motion compensation and deblocking need from a slice header */
+struct h264_slice_info {
+    struct h264_reference refs[2][H264_MAX_REFS];
+    int weight_mode;            /* 0 default, 1 explicit, 2 implicit */
+    int luma_log2_denom;
+    int chroma_log2_denom;
+    int luma_weight[2][H264_MAX_REFS][2];       /* [list][ref][weight, offset] */
+    int chroma_weight[2][H264_MAX_REFS][2][2];  /* [list][ref][Cb, Cr][weight, offset] */
+    int16_t implicit_weight[H264_MAX_REFS][H264_MAX_REFS];   /* w1 by ref_idx l0, l1 */
+    int disable_deblocking_filter_idc;
+    int alpha_offset;
+    int beta_offset;
+};
+
+/* A rectangle of 4x4 blocks sharing motion */
+struct h264_partition {
+    uint8_t x, y, width, height;
+    uint8_t pred;
+};
+
+/*
+ * What reconstructing a macroblock takes from parsing it. The residual is
+ * left zeroed behind by the inverse transforms.
+ */
+struct h264_mb_recon {
+    int16_t luma[256] __attribute__((aligned(16)));
+    int16_t chroma[2][4][16] __attribute__((aligned(16)));
+    struct h264_partition parts[16];
+    uint8_t num_parts;
+    uint8_t chroma_coded;
+    uint16_t luma_coded;        /* 4x4 blocks to inverse transform */
+    uint8_t luma_mode;          /* Intra16x16PredMode */
+    uint8_t chroma_mode;
+    uint8_t intra_avail;        /* H264_AVAIL_* of the neighbour macroblocks for intra prediction */
+    uint8_t pending;            /* Parsed and still to be reconstructed, for deferred reconstruction */
+};
+
+/* Slice data without the emulation prevention bytes */
+struct h264_rbsp {
+    uint8_t *data;
+    size_t size;                /* Allocated */
+};
+
+struct h264_slot;
+struct h264_slice_task;
+
+struct epiphany_h264_decoder {
+    int mb_width;
+    int mb_height;
+    struct h264_frame frames[H264_MAX_FRAMES];
+    struct h264_rbsp rbsp;
+    /* One per picture in flight, the decode depth of the context */
+    struct h264_slot *slots;
+    int num_slots;
+    pthread_mutex_t mutex;              /* Guards the pipelining state of the slots */
+    pthread_cond_t done;                /* A picture in flight finished */
+    int in_flight;
+    /* Decoding slices on the pool */
+    struct h264_slice_task *tasks;
+    int max_tasks;
+    unsigned int pending;               /* Slice tasks not finished, updated atomically */
+};
+
+struct h264_picture {
+    const struct h264_dsp_ops *dsp;
+    struct epiphany_h264_decoder *decoder;
+    struct h264_slot *slot;     /* Where the macroblock state goes */
+    const VAPictureParameterBufferH264 *pic_param;
+    int mb_width;
+    int mb_height;
+    int width;                  /* Luma samples of the coded frame */
+    int height;
+    uint8_t *y;
+    uint8_t *uv;
+    ptrdiff_t stride;
+    int poc;
+    struct h264_motion *motion;
+    int transform_8x8_mode;
+    int constrained_intra_pred;
+    int cabac;                  /* entropy_coding_mode_flag */
+    int direct_8x8_inference;
+    uint8_t chroma_qp[2][52];   /* QPc for each QPY */
+    /* LevelScale4x4 and LevelScale8x8 of 8.5.9, [list][qP % 6][raster position] */
+    int level_scale4[6][6][16];
+    int level_scale8[2][6][64];
+
+    int deferred;               /* Macroblocks are left in records to be reconstructed on the pool */
+    wavefront_p wavefront;      /* Reconstructing behind parsing, NULL if not or not started yet */
+
+    /* Slice state */
+    struct h264_rbsp *rbsp;
+    struct bitstream bs;
+    size_t end_bit;             /* rbsp_stop_one_bit */
+    int num_slices;
+    int slice_num;
+    int first_mb;               /* Macroblocks from here up to the current one are in the slice */
+    int end_mb;                 /* Where the next slice starts when decoding slices side by side */
+    struct h264_slice_info *slice;
+    int slice_type;
+    int qp;
+    int direct_spatial;
+    int num_ref_idx[2];
+    const struct h264_motion *col_motion;   /* Of RefPicList1[0], NULL if unknown */
+    int dist_scale_factor[H264_MAX_REFS];
+    struct h264_cabac cabac_engine;
+    int last_qp_delta;          /* mb_qp_delta of the previous macroblock of the slice, for CABAC */
+
+    /* Macroblock state */
+    int mb_x;
+    int mb_y;
+    struct h264_mb *mb;
+    struct h264_mb *mb_left;    /* Neighbours in the slice, or NULL */
+    struct h264_mb *mb_top;
+    struct h264_mb *mb_top_right;
+    struct h264_mb *mb_top_left;
+    struct h264_mb_recon *recon;        /* &mb_recon, or the macroblock's record when deferred */
+    uint8_t *dst_y;
+    uint8_t *dst_uv;
+    int8_t ref_cache[2][40];
+    int16_t mv_cache[2][40][2];
+    int8_t direct_ref[2][4];
+    int16_t direct_mv[2][16][2];
+    struct h264_mb_recon mb_recon;
+    uint8_t tmp[16 * 16 + 16 * 8] __attribute__((aligned(16)));
+    uint8_t edge[H264_EDGE_STRIDE * 21];
+};
+
+/*
+ * A picture from parsing to the end of its deblocking, with the macroblock
+ * state of its own. Pictures reconstructed on the pool stay in flight
+ * after parsing, the next one being parsed into another slot, until the
+ * pool is done with them; they wait for the pictures in flight they
+ * reference to be done first.
+ */
+struct h264_slot {
+    struct thread_pool_task task;       /* Finishes the picture once parsed and its references are done */
+    struct epiphany_h264_decoder *decoder;
+    struct h264_mb *mbs;
+    struct h264_slice_info *slices;
+    int max_slices;
+    struct h264_mb_recon *recon;        /* One per macroblock, allocated on first use */
+    struct h264_picture *rows;          /* Per row state of the reconstructing or deblocking threads */
+    struct wavefront wavefront;
+    /* Under the decoder's mutex */
+    int busy;                           /* In flight */
+    VASurfaceID surface;                /* Decoded into */
+    VASurfaceID refs[16];               /* ReferenceFrames, VA_INVALID_SURFACE for the unused ones */
+    int waiting;                        /* Slots in flight it references, plus one until parsed */
+    unsigned int dependents;            /* Slots referencing it, by bit */
+    /* The picture handed over to the pool */
+    struct epiphany_driver_data *driver_data;
+    object_surface_p obj_surface;       /* Held until the picture is done */
+    thread_pool_p pool;
+    unsigned long long parsed_ns;       /* For the stats */
+    struct h264_picture pic;
+};
+
+/* A slice decoded by a pool task, with picture state of its own */
+struct h264_slice_task {
+    struct thread_pool_task task;
+    struct epiphany_driver_data *driver_data;
+    thread_pool_p pool;
+    const VASliceParameterBufferH264 *param;
+    const uint8_t *data;
+    struct h264_rbsp rbsp;      /* Kept for the next picture */
+    struct h264_picture pic;
+};
+
+static const uint8_t h264_zigzag4[16] = {
+    0, 1, 4, 8, 5, 2, 3, 6, 9, 12, 13, 10, 7, 11, 14, 15,
+};
+
+static const uint8_t h264_zigzag8[64] = {
+     0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+};
+
+/* Raster position of the 4x4 luma blocks in decoding order */
+static const uint8_t h264_block_x[16] = { 0, 1, 0, 1, 2, 3, 2, 3, 0, 1, 0, 1, 2, 3, 2, 3 };
+static const uint8_t h264_block_y[16] = { 0, 0, 1, 1, 0, 0, 1, 1, 2, 2, 3, 3, 2, 2, 3, 3 };
+
+/* Table 8-13, normAdjust4x4 by qP % 6 for the three position classes */
+static const uint8_t h264_norm_adjust4[6][3] = {
+    { 10, 16, 13 }, { 11, 18, 14 }, { 13, 20, 16 },
+    { 14, 23, 18 }, { 16, 25, 20 }, { 18, 29, 23 },
+};
+
+/* Table 8-14, normAdjust8x8 by qP % 6 for the six position classes */
+static const uint8_t h264_norm_adjust8[6][6] = {
+    { 20, 18, 32, 19, 25, 24 }, { 22, 19, 35, 21, 28, 26 }, { 26, 23, 42, 24, 33, 31 },
+    { 28, 25, 45, 26, 35, 33 }, { 32, 28, 51, 30, 40, 38 }, { 36, 32, 58, 34, 46, 43 },
+};
+
+/* Table 8-15, QPc by qPI from 30 on */
+static const uint8_t h264_chroma_qp[22] = {
+    29, 30, 31, 32, 32, 33, 34, 34, 35, 35, 36, 36, 37, 37, 37, 38, 38, 38, 39, 39, 39, 39,
+};
+
+/* Table 9-4, coded_block_pattern by codeNum for Intra_4x4 and Intra_8x8, and for Inter */
+static const uint8_t h264_intra_cbp[48] = {
+    47, 31, 15,  0, 23, 27, 29, 30,  7, 11, 13, 14, 39, 43, 45, 46,
+    16,  3,  5, 10, 12, 19, 21, 26, 28, 35, 37, 42, 44,  1,  2,  4,
+     8, 17, 18, 20, 24,  6,  9, 22, 25, 32, 33, 34, 36, 40, 38, 41,
+};
+
+static const uint8_t h264_inter_cbp[48] = {
+     0, 16,  1,  2,  4,  8, 32,  3,  5, 10, 12, 15, 47,  7, 11, 13,
+    14,  6,  9, 31, 35, 37, 42, 44, 33, 34, 36, 40, 39, 43, 45, 46,
+    17, 18, 20, 24, 19, 21, 26, 28, 23, 27, 29, 30, 22, 25, 38, 41,
+};
+
+/* Table 7-14, the partition shape and predictions of B macroblock types 1 to 21 */
+static const uint8_t h264_b_mb_types[22][3] = {
+    { 0, 0, 0 },
+    { 0, H264_PRED_L0, 0 }, { 0, H264_PRED_L1, 0 }, { 0, H264_PRED_BI, 0 },
+    { 1, H264_PRED_L0, H264_PRED_L0 }, { 2, H264_PRED_L0, H264_PRED_L0 },
+    { 1, H264_PRED_L1, H264_PRED_L1 }, { 2, H264_PRED_L1, H264_PRED_L1 },
+    { 1, H264_PRED_L0, H264_PRED_L1 }, { 2, H264_PRED_L0, H264_PRED_L1 },
+    { 1, H264_PRED_L1, H264_PRED_L0 }, { 2, H264_PRED_L1, H264_PRED_L0 },
+    { 1, H264_PRED_L0, H264_PRED_BI }, { 2, H264_PRED_L0, H264_PRED_BI },
+    { 1, H264_PRED_L1, H264_PRED_BI }, { 2, H264_PRED_L1, H264_PRED_BI },
+    { 1, H264_PRED_BI, H264_PRED_L0 }, { 2, H264_PRED_BI, H264_PRED_L0 },
+    { 1, H264_PRED_BI, H264_PRED_L1 }, { 2, H264_PRED_BI, H264_PRED_L1 },
+    { 1, H264_PRED_BI, H264_PRED_BI }, { 2, H264_PRED_BI, H264_PRED_BI },
+};
+
+/* Table 7-18, the sub-partition shape (0 8x8, 1 8x4, 2 4x8, 3 4x4) and prediction of B sub-macroblocks */
+static const uint8_t h264_b_sub_mb_types[13][2] = {
+    { 0, H264_PRED_DIRECT },
+    { 0, H264_PRED_L0 }, { 0, H264_PRED_L1 }, { 0, H264_PRED_BI },
+    { 1, H264_PRED_L0 }, { 2, H264_PRED_L0 }, { 1, H264_PRED_L1 }, { 2, H264_PRED_L1 },
+    { 1, H264_PRED_BI }, { 2, H264_PRED_BI },
+    { 3, H264_PRED_L0 }, { 3, H264_PRED_L1 }, { 3, H264_PRED_BI },
+};
+
+/* Tables 8-16 and 8-17, deblocking thresholds by indexA and indexB */
+static const uint8_t h264_alpha[52] = {
+      0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+      4,   4,   5,   6,   7,   8,   9,  10,  12,  13,  15,  17,  20,  22,  25,  28,
+     32,  36,  40,  45,  50,  56,  63,  71,  80,  90, 101, 113, 127, 144, 162, 182,
+    203, 226, 255, 255,
+};
+
+static const uint8_t h264_beta[52] = {
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     2,  2,  2,  3,  3,  3,  3,  4,  4,  4,  6,  6,  7,  7,  8,  8,
+     9,  9, 10, 10, 11, 11, 12, 12, 13, 13, 14, 14, 15, 15, 16, 16,
+    17, 17, 18, 18,
+};
+
+/* tC0 by indexA for bS 1 to 3 */
+static const uint8_t h264_tc0[52][3] = {
+    { 0, 0, 0 }, { 0, 0, 0 }, { 0, 0, 0 }, { 0, 0, 0 }, { 0, 0, 0 }, { 0, 0, 0 },
+    { 0, 0, 0 }, { 0, 0, 0 }, { 0, 0, 0 }, { 0, 0, 0 }, { 0, 0, 0 }, { 0, 0, 0 },
+    { 0, 0, 0 }, { 0, 0, 0 }, { 0, 0, 0 }, { 0, 0, 0 }, { 0, 0, 0 }, { 0, 0, 1 },
+    { 0, 0, 1 }, { 0, 0, 1 }, { 0, 0, 1 }, { 0, 1, 1 }, { 0, 1, 1 }, { 1, 1, 1 },
+    { 1, 1, 1 }, { 1, 1, 1 }, { 1, 1, 1 }, { 1, 1, 2 }, { 1, 1, 2 }, { 1, 1, 2 },
+    { 1, 1, 2 }, { 1, 2, 3 }, { 1, 2, 3 }, { 2, 2, 3 }, { 2, 2, 4 }, { 2, 3, 4 },
+    { 2, 3, 4 }, { 3, 3, 5 }, { 3, 4, 6 }, { 3, 4, 6 }, { 4, 5, 7 }, { 4, 5, 8 },
+    { 4, 6, 9 }, { 5, 7, 10 }, { 6, 8, 11 }, { 6, 8, 13 }, { 7, 10, 14 }, { 8, 11, 16 },
+    { 9, 12, 18 }, { 10, 13, 20 }, { 11, 15, 23 }, { 13, 17, 25 },
+};
+
+/*
+ * Table 9-5, coeff_token lengths and codes by [nC range][TotalCoeff * 4 +
+ * TrailingOnes], the last range being the 6 bit fixed length code
+ */
+static const uint8_t h264_coeff_token_len[4][4 * 17] = {
+    {
+         1,  0,  0,  0,  6,  2,  0,  0,  8,  6,  3,  0,  9,  8,  7,  5,
+        10,  9,  8,  6, 11, 10,  9,  7, 13, 11, 10,  8, 13, 13, 11,  9,
+        13, 13, 13, 10, 14, 14, 13, 11, 14, 14, 14, 13, 15, 15, 14, 14,
+        15, 15, 15, 14, 16, 15, 15, 15, 16, 16, 16, 15, 16, 16, 16, 16,
+        16, 16, 16, 16,
+    },
+    {
+         2,  0,  0,  0,  6,  2,  0,  0,  6,  5,  3,  0,  7,  6,  6,  4,
+         8,  6,  6,  4,  8,  7,  7,  5,  9,  8,  8,  6, 11,  9,  9,  6,
+        11, 11, 11,  7, 12, 11, 11,  9, 12, 12, 12, 11, 12, 12, 12, 11,
+        13, 13, 13, 12, 13, 13, 13, 13, 13, 14, 13, 13, 14, 14, 14, 13,
+        14, 14, 14, 14,
+    },
+    {
+         4,  0,  0,  0,  6,  4,  0,  0,  6,  5,  4,  0,  6,  5,  5,  4,
+         7,  5,  5,  4,  7,  5,  5,  4,  7,  6,  6,  4,  7,  6,  6,  4,
+         8,  7,  7,  5,  8,  8,  7,  6,  9,  8,  8,  7,  9,  9,  8,  8,
+         9,  9,  9,  8, 10,  9,  9,  9, 10, 10, 10, 10, 10, 10, 10, 10,
+        10, 10, 10, 10,
+    },
+    {
+         6,  0,  0,  0,  6,  6,  0,  0,  6,  6,  6,  0,  6,  6,  6,  6,
+         6,  6,  6,  6,  6,  6,  6,  6,  6,  6,  6,  6,  6,  6,  6,  6,
+         6,  6,  6,  6,  6,  6,  6,  6,  6,  6,  6,  6,  6,  6,  6,  6,
+         6,  6,  6,  6,  6,  6,  6,  6,  6,  6,  6,  6,  6,  6,  6,  6,
+         6,  6,  6,  6,
+    },
+};
+
+static const uint8_t h264_coeff_token_code[4][4 * 17] = {
+    {
+         1,  0,  0,  0,  5,  1,  0,  0,  7,  4,  1,  0,  7,  6,  5,  3,
+         7,  6,  5,  3,  7,  6,  5,  4, 15,  6,  5,  4, 11, 14,  5,  4,
+         8, 10, 13,  4, 15, 14,  9,  4, 11, 10, 13, 12, 15, 14,  9, 12,
+        11, 10, 13,  8, 15,  1,  9, 12, 11, 14, 13,  8,  7, 10,  9, 12,
+         4,  6,  5,  8,
+    },
+    {
+         3,  0,  0,  0, 11,  2,  0,  0,  7,  7,  3,  0,  7, 10,  9,  5,
+         7,  6,  5,  4,  4,  6,  5,  6,  7,  6,  5,  8, 15,  6,  5,  4,
+        11, 14, 13,  4, 15, 10,  9,  4, 11, 14, 13, 12,  8, 10,  9,  8,
+        15, 14, 13, 12, 11, 10,  9, 12,  7, 11,  6,  8,  9,  8, 10,  1,
+         7,  6,  5,  4,
+    },
+    {
+        15,  0,  0,  0, 15, 14,  0,  0, 11, 15, 13,  0,  8, 12, 14, 12,
+        15, 10, 11, 11, 11,  8,  9, 10,  9, 14, 13,  9,  8, 10,  9,  8,
+        15, 14, 13, 13, 11, 14, 10, 12, 15, 10, 13, 12, 11, 14,  9, 12,
+         8, 10, 13,  8, 13,  7,  9, 12,  9, 12, 11, 10,  5,  8,  7,  6,
+         1,  4,  3,  2,
+    },
+    {
+         3,  0,  0,  0,  0,  1,  0,  0,  4,  5,  6,  0,  8,  9, 10, 11,
+        12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27,
+        28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40, 41, 42, 43,
+        44, 45, 46, 47, 48, 49, 50, 51, 52, 53, 54, 55, 56, 57, 58, 59,
+        60, 61, 62, 63,
+    },
+};
+
+/* coeff_token of chroma DC, nC -1 */
+static const uint8_t h264_chroma_dc_coeff_token_len[4 * 5] = {
+    2, 0, 0, 0, 6, 1, 0, 0, 6, 6, 3, 0, 6, 7, 7, 6, 6, 8, 8, 7,
+};
+
+static const uint8_t h264_chroma_dc_coeff_token_code[4 * 5] = {
+    1, 0, 0, 0, 7, 1, 0, 0, 4, 6, 1, 0, 3, 3, 2, 5, 2, 3, 2, 0,
+};
+
+/* Tables 9-7 and 9-8, total_zeros by TotalCoeff - 1 */
+static const uint8_t h264_total_zeros_len[15][16] = {
+    { 1, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 9 },
+    { 3, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 6, 6, 6, 6 },
+    { 4, 3, 3, 3, 4, 4, 3, 3, 4, 5, 5, 6, 5, 6 },
+    { 5, 3, 4, 4, 3, 3, 3, 4, 3, 4, 5, 5, 5 },
+    { 4, 4, 4, 3, 3, 3, 3, 3, 4, 5, 4, 5 },
+    { 6, 5, 3, 3, 3, 3, 3, 3, 4, 3, 6 },
+    { 6, 5, 3, 3, 3, 2, 3, 4, 3, 6 },
+    { 6, 4, 5, 3, 2, 2, 3, 3, 6 },
+    { 6, 6, 4, 2, 2, 3, 2, 5 },
+    { 5, 5, 3, 2, 2, 2, 4 },
+    { 4, 4, 3, 3, 1, 3 },
+    { 4, 4, 2, 1, 3 },
+    { 3, 3, 1, 2 },
+    { 2, 2, 1 },
+    { 1, 1 },
+};
+
+static const uint8_t h264_total_zeros_code[15][16] = {
+    { 1, 3, 2, 3, 2, 3, 2, 3, 2, 3, 2, 3, 2, 3, 2, 1 },
+    { 7, 6, 5, 4, 3, 5, 4, 3, 2, 3, 2, 3, 2, 1, 0 },
+    { 5, 7, 6, 5, 4, 3, 4, 3, 2, 3, 2, 1, 1, 0 },
+    { 3, 7, 5, 4, 6, 5, 4, 3, 3, 2, 2, 1, 0 },
+    { 5, 4, 3, 7, 6, 5, 4, 3, 2, 1, 1, 0 },
+    { 1, 1, 7, 6, 5, 4, 3, 2, 1, 1, 0 },
+    { 1, 1, 5, 4, 3, 3, 2, 1, 1, 0 },
+    { 1, 1, 1, 3, 3, 2, 2, 1, 0 },
+    { 1, 0, 1, 3, 2, 1, 1, 1 },
+    { 1, 0, 1, 3, 2, 1, 1 },
+    { 0, 1, 1, 2, 1, 3 },
+    { 0, 1, 1, 1, 1 },
+    { 0, 1, 1, 1 },
+    { 0, 1, 1 },
+    { 0, 1 },
+};
+
+/* Table 9-9, total_zeros of chroma DC by TotalCoeff - 1 */
+static const uint8_t h264_chroma_dc_total_zeros_len[3][4] = {
+    { 1, 2, 3, 3 }, { 1, 2, 2 }, { 1, 1 },
+};
+
+static const uint8_t h264_chroma_dc_total_zeros_code[3][4] = {
+    { 1, 1, 1, 0 }, { 1, 1, 0 }, { 1, 0 },
+};
+
+/* Table 9-10, run_before by zerosLeft - 1, the last row for more than 6 */
+static const uint8_t h264_run_len[7][15] = {
+    { 1, 1 },
+    { 1, 2, 2 },
+    { 2, 2, 2, 2 },
+    { 2, 2, 2, 3, 3 },
+    { 2, 2, 3, 3, 3, 3 },
+    { 2, 3, 3, 3, 3, 3, 3 },
+    { 3, 3, 3, 3, 3, 3, 3, 4, 5, 6, 7, 8, 9, 10, 11 },
+};
+
+static const uint8_t h264_run_code[7][15] = {
+    { 1, 0 },
+    { 1, 1, 0 },
+    { 3, 2, 1, 0 },
+    { 3, 2, 1, 1, 0 },
+    { 3, 2, 3, 2, 1, 0 },
+    { 3, 0, 1, 3, 2, 5, 4 },
+    { 7, 6, 5, 4, 3, 2, 1, 1, 1, 1, 1, 1, 1, 1, 1 },
+};
+
+/*
+ * Table 9-34, ctxIdxOffset of coded_block_flag, significant_coeff_flag,
+ * last_significant_coeff_flag and coeff_abs_level_minus1 by ctxBlockCat
+ */
+static const uint16_t h264_cabac_cbf_offset[5] = { 85, 89, 93, 97, 101 };
+static const uint16_t h264_cabac_sig_offset[6] = { 105, 120, 134, 149, 152, 402 };
+static const uint16_t h264_cabac_last_offset[6] = { 166, 181, 195, 210, 213, 417 };
+static const uint16_t h264_cabac_abs_offset[6] = { 227, 237, 247, 257, 266, 426 };
+
+/* Table 9-43, ctxIdxInc of the flags of 8x8 blocks in frame macroblocks by levelListIdx */
+static const uint8_t h264_cabac_sig_inc8x8[63] = {
+     0,  1,  2,  3,  4,  5,  5,  4,  4,  3,  3,  4,  4,  4,  5,  5,
+     4,  4,  4,  4,  3,  3,  6,  7,  7,  7,  8,  9, 10,  9,  8,  7,
+     7,  6, 11, 12, 13, 11,  6,  7,  8,  9, 14, 10,  9,  8,  6, 11,
+    12, 13, 11,  6,  9, 14, 10,  9, 11, 12, 13, 11, 14, 10, 12,
+};
+
+static const uint8_t h264_cabac_last_inc8x8[63] = {
+    0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+    3, 3, 3, 3, 3, 3, 3, 3, 4, 4, 4, 4, 4, 4, 4, 4,
+    5, 5, 5, 5, 6, 6, 6, 6, 7, 7, 7, 7, 8, 8, 8,
+};
+
+static struct vlc h264_coeff_token_vlc[4];
+static struct vlc h264_chroma_dc_coeff_token_vlc;
+static struct vlc h264_total_zeros_vlc[15];
+static struct vlc h264_chroma_dc_total_zeros_vlc[3];
+static struct vlc h264_run_vlc[7];
+
+static struct vlc_entry h264_coeff_token_table[4][1024];
+static struct vlc_entry h264_chroma_dc_coeff_token_table[256];
+static struct vlc_entry h264_total_zeros_table[15][512];
+static struct vlc_entry h264_chroma_dc_total_zeros_table[3][8];
+static struct vlc_entry h264_run_table[7][128];
+
+/* Scan of the 4x4 blocks an 8x8 block is sent as with CAVLC */
+static uint8_t h264_zigzag8_cavlc[4][16];
+
+static pthread_once_t h264_tables_once = PTHREAD_ONCE_INIT;
+static int h264_tables_status = -1;
+
+/* Builds the table for the codes of symbols 0 to num_codes - 1, skipping unused ones */
+static int
+h264_init_vlc(struct vlc *vlc, int bits, const uint8_t *lengths, const uint8_t *codes,
+              int num_codes, struct vlc_entry *table, int max_entries)
+{
+    struct vlc_code list[4 * 17];
+    int i, n = 0;
+
+    for (i = 0; i < num_codes; i++) {
+        if (lengths[i] == 0)
+            continue;
+        list[n].code = codes[i];
+        list[n].length = lengths[i];
+        list[n++].symbol = i;
+    }
+    return vlc_init(vlc, bits, list, n, table, max_entries);
+}
+
+static void
+h264_init_tables(void)
+{
+    int status = 0;
+    int i, j;
+
+    for (i = 0; i < 4; i++)
+        status |= h264_init_vlc(&h264_coeff_token_vlc[i], i == 3 ? 6 : 8, h264_coeff_token_len[i],
+                                h264_coeff_token_code[i], 4 * 17, h264_coeff_token_table[i], 1024);
+    status |= h264_init_vlc(&h264_chroma_dc_coeff_token_vlc, 8, h264_chroma_dc_coeff_token_len,
+                            h264_chroma_dc_coeff_token_code, 4 * 5,
+                            h264_chroma_dc_coeff_token_table, 256);
+    for (i = 0; i < 15; i++)
+        status |= h264_init_vlc(&h264_total_zeros_vlc[i], 9, h264_total_zeros_len[i],
+                                h264_total_zeros_code[i], 16 - i, h264_total_zeros_table[i], 512);
+    for (i = 0; i < 3; i++)
+        status |= h264_init_vlc(&h264_chroma_dc_total_zeros_vlc[i], 3,
+                                h264_chroma_dc_total_zeros_len[i], h264_chroma_dc_total_zeros_code[i],
+                                4 - i, h264_chroma_dc_total_zeros_table[i], 8);
+    for (i = 0; i < 7; i++)
+        status |= h264_init_vlc(&h264_run_vlc[i], 6, h264_run_len[i], h264_run_code[i],
+                                i == 6 ? 15 : i + 2, h264_run_table[i], 128);
+    for (i = 0; i < 4; i++) {
+        for (j = 0; j < 16; j++)
+            h264_zigzag8_cavlc[i][j] = h264_zigzag8[4 * j + i];
+    }
+    h264_tables_status = status;
+}
+
+static inline int
+h264_clip3(int low, int high, int value)
+{
+    return value < low ? low : (value > high ? high : value);
+}
+
+static inline int
+h264_median(int a, int b, int c)
+{
+    int max = a > b ? a : b, min = a < b ? a : b;
+
+    return c > max ? max : (c < min ? min : c);
+}
+
+/* PicOrderCnt() of a frame */
+static int
+h264_poc(const VAPictureH264 *va_pic)
+{
+    if ((va_pic->flags & (VA_PICTURE_H264_TOP_FIELD | VA_PICTURE_H264_BOTTOM_FIELD)) ==
+        VA_PICTURE_H264_TOP_FIELD)
+        return va_pic->TopFieldOrderCnt;
+    if ((va_pic->flags & (VA_PICTURE_H264_TOP_FIELD | VA_PICTURE_H264_BOTTOM_FIELD)) ==
+        VA_PICTURE_H264_BOTTOM_FIELD)
+        return va_pic->BottomFieldOrderCnt;
+    return va_pic->TopFieldOrderCnt < va_pic->BottomFieldOrderCnt ?
+           va_pic->TopFieldOrderCnt : va_pic->BottomFieldOrderCnt;
+}
+
+/* A decoder with a slot for each of num_slots pictures in flight */
+static struct epiphany_h264_decoder *
+h264_create_decoder(int num_slots)
+{
+    struct epiphany_h264_decoder *decoder = calloc(1, sizeof(*decoder));
+    int i;
+
+    if (NULL == decoder)
+        return NULL;
+    decoder->slots = calloc(num_slots, sizeof(*decoder->slots));
+    if (NULL == decoder->slots) {
+        free(decoder);
+        return NULL;
+    }
+    decoder->num_slots = num_slots;
+    for (i = 0; i < num_slots; i++) {
+        decoder->slots[i].decoder = decoder;
+        wavefront_init(&decoder->slots[i].wavefront);
+    }
+    for (i = 0; i < H264_MAX_FRAMES; i++)
+        decoder->frames[i].surface = VA_INVALID_SURFACE;
+    pthread_mutex_init(&decoder->mutex, NULL);
+    pthread_cond_init(&decoder->done, NULL);
+    return decoder;
+}
+
+/* Frees the macroblock state of a slot sized for another picture size */
+static void
+h264_clear_slot(struct h264_slot *slot)
+{
+    free(slot->mbs);
+    free(slot->recon);
+    free(slot->rows);
+    slot->mbs = NULL;
+    slot->recon = NULL;
+    slot->rows = NULL;
+}
+
+void
+epiphany_h264_destroy_decoder(void *data)
+{
+    struct epiphany_h264_decoder *decoder = data;
+    int i;
+
+    if (NULL == decoder)
+        return;
+    for (i = 0; i < H264_MAX_FRAMES; i++)
+        free(decoder->frames[i].motion);
+    for (i = 0; i < decoder->num_slots; i++) {
+        h264_clear_slot(&decoder->slots[i]);
+        free(decoder->slots[i].slices);
+        wavefront_destroy(&decoder->slots[i].wavefront);
+    }
+    free(decoder->slots);
+    free(decoder->rbsp.data);
+    for (i = 0; i < decoder->max_tasks; i++)
+        free(decoder->tasks[i].rbsp.data);
+    free(decoder->tasks);
+    pthread_cond_destroy(&decoder->done);
+    pthread_mutex_destroy(&decoder->mutex);
+    free(decoder);
+}
+
+/*
+ * Sizes the decoder for the picture, dropping motion kept at another size.
+ * No picture may be in flight.
+ */
+static void
+h264_resize_decoder(struct epiphany_h264_decoder *decoder, int mb_width, int mb_height)
+{
+    int i;
+
+    if (decoder->mb_width == mb_width && decoder->mb_height == mb_height)
+        return;
+    for (i = 0; i < H264_MAX_FRAMES; i++) {
+        free(decoder->frames[i].motion);
+        decoder->frames[i].motion = NULL;
+        decoder->frames[i].surface = VA_INVALID_SURFACE;
+    }
+    for (i = 0; i < decoder->num_slots; i++)
+        h264_clear_slot(&decoder->slots[i]);
+    decoder->mb_width = mb_width;
+    decoder->mb_height = mb_height;
+}
+
+static struct h264_frame *
+h264_find_frame(struct epiphany_h264_decoder *decoder, VASurfaceID surface)
+{
+    int i;
+
+    if (VA_INVALID_SURFACE == surface)
+        return NULL;
+    for (i = 0; i < H264_MAX_FRAMES; i++) {
+        if (decoder->frames[i].surface == surface)
+            return &decoder->frames[i];
+    }
+    return NULL;
+}
+
+/*
+ * Whether a picture in flight decodes into surface or references it
+ * Called with the decoder's mutex held
+ */
+static int
+h264_in_flight(const struct epiphany_h264_decoder *decoder, VASurfaceID surface)
+{
+    const struct h264_slot *slot;
+    int i, j;
+
+    for (i = 0; i < decoder->num_slots; i++) {
+        slot = &decoder->slots[i];
+        if (!slot->busy)
+            continue;
+        if (slot->surface == surface)
+            return 1;
+        for (j = 0; j < 16; j++) {
+            if (slot->refs[j] == surface)
+                return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * The reference picture manager: frees the motion of surfaces the
+ * picture no longer lists in ReferenceFrames and no picture in flight
+ * uses, and returns the frame of the one decoded into, NULL if there is
+ * no frame left
+ */
+static struct h264_frame *
+h264_claim_frame(struct epiphany_h264_decoder *decoder, const VAPictureParameterBufferH264 *pic_param)
+{
+    struct h264_frame *frame, *free_frame = NULL;
+    int i, j;
+
+    pthread_mutex_lock(&decoder->mutex);
+    for (i = 0; i < H264_MAX_FRAMES; i++) {
+        frame = &decoder->frames[i];
+        if (frame->surface != VA_INVALID_SURFACE && frame->surface != pic_param->CurrPic.picture_id) {
+            for (j = 0; j < 16; j++) {
+                if (!(pic_param->ReferenceFrames[j].flags & VA_PICTURE_H264_INVALID) &&
+                    pic_param->ReferenceFrames[j].picture_id == frame->surface)
+                    break;
+            }
+            if (j == 16 && !h264_in_flight(decoder, frame->surface))
+                frame->surface = VA_INVALID_SURFACE;
+        }
+        if (frame->surface == VA_INVALID_SURFACE && NULL == free_frame)
+            free_frame = frame;
+    }
+    pthread_mutex_unlock(&decoder->mutex);
+
+    frame = h264_find_frame(decoder, pic_param->CurrPic.picture_id);
+    if (NULL == frame)
+        frame = free_frame;
+    if (NULL == frame)
+        return NULL;
+    if (NULL == frame->motion) {
+        frame->motion = malloc((size_t) decoder->mb_width * decoder->mb_height * sizeof(*frame->motion));
+        if (NULL == frame->motion)
+            return NULL;
+    }
+    frame->surface = pic_param->CurrPic.picture_id;
+    return frame;
+}
+
+/*
+ * Looks a reference picture up in the surface heap. Missing ones, or ones
+ * of another size, are predicted from the picture itself like MPEG-2 does.
+ */
+static void
+h264_lookup_reference(struct epiphany_driver_data *driver_data, const struct h264_picture *pic,
+                      const VAPictureH264 *va_pic, struct h264_reference *ref)
+{
+    object_surface_p obj_surface = NULL;
+
+    if (!(va_pic->flags & VA_PICTURE_H264_INVALID))
+        obj_surface = SURFACE(va_pic->picture_id);
+    if (NULL == obj_surface || NULL == obj_surface->storage ||
+        obj_surface->storage->pitch != pic->stride ||
+        obj_surface->storage->luma_height < pic->height) {
+        ref->surface = VA_INVALID_SURFACE;
+        ref->y = pic->y;
+        ref->uv = pic->uv;
+    } else {
+        ref->surface = va_pic->picture_id;
+        ref->y = obj_surface->storage->data;
+        ref->uv = obj_surface->storage->data + obj_surface->storage->chroma_offset;
+    }
+    ref->poc = h264_poc(va_pic);
+    ref->long_term = (va_pic->flags & VA_PICTURE_H264_LONG_TERM_REFERENCE) != 0;
+}
+
+/* 8.5.9, folds the scaling lists into the normAdjust tables */
+static void
+h264_init_level_scale(struct h264_picture *pic, const VAIQMatrixBufferH264 *iq_matrix)
+{
+    int list, m, i;
+
+    for (list = 0; list < 6; list++) {
+        for (m = 0; m < 6; m++) {
+            for (i = 0; i < 16; i++) {
+                int pos = h264_zigzag4[i], x = pos & 3, y = pos >> 2;
+                int class = !(x & 1) && !(y & 1) ? 0 : ((x & 1) && (y & 1) ? 1 : 2);
+                int weight = iq_matrix ? iq_matrix->ScalingList4x4[list][i] : 16;
+
+                pic->level_scale4[list][m][pos] = weight * h264_norm_adjust4[m][class];
+            }
+        }
+    }
+    for (list = 0; list < 2; list++) {
+        for (m = 0; m < 6; m++) {
+            for (i = 0; i < 64; i++) {
+                int pos = h264_zigzag8[i], x = pos & 7, y = pos >> 3;
+                int weight = iq_matrix ? iq_matrix->ScalingList8x8[list][i] : 16;
+                int class;
+
+                if (!(x & 3) && !(y & 3))
+                    class = 0;
+                else if ((x & 1) && (y & 1))
+                    class = 1;
+                else if ((x & 3) == 2 && (y & 3) == 2)
+                    class = 2;
+                else if ((!(x & 3) && (y & 1)) || ((x & 1) && !(y & 3)))
+                    class = 3;
+                else if ((!(x & 3) && (y & 3) == 2) || ((x & 3) == 2 && !(y & 3)))
+                    class = 4;
+                else
+                    class = 5;
+                pic->level_scale8[list][m][pos] = weight * h264_norm_adjust8[m][class];
+            }
+        }
+    }
+}
+
+/*
+ * Copies a width x height region of samples of bytes_per_sample bytes
+ * at (x, y) of a plane to buf, replicating the plane edges where the
+ * region reaches outside
+ */
+static const uint8_t *
+h264_emulate_edge(uint8_t *buf, const uint8_t *plane, ptrdiff_t stride, int plane_width,
+                  int plane_height, int x, int y, int width, int height, int bytes_per_sample)
+{
+    int i, j, k;
+
+    for (j = 0; j < height; j++) {
+        int row = h264_clip3(0, plane_height - 1, y + j);
+        const uint8_t *src = plane + row * stride;
+        uint8_t *dst = buf + j * H264_EDGE_STRIDE;
+
+        for (i = 0; i < width; i++) {
+            int column = h264_clip3(0, plane_width - 1, x + i);
+
+            for (k = 0; k < bytes_per_sample; k++)
+                dst[i * bytes_per_sample + k] = src[column * bytes_per_sample + k];
+        }
+    }
+    return buf;
+}
+
+/*
+ * 8.4.2.2, predicts the width x height luma block at (x, y) of the
+ * picture, and the chroma under it, from ref displaced by mv
+ */
+static void
+h264_predict(struct h264_picture *pic, const struct h264_reference *ref, const int16_t *mv,
+             int x, int y, int width, int height, uint8_t *dst_y, uint8_t *dst_uv, ptrdiff_t dst_stride)
+{
+    int size = width == 16 ? H264_MC_16 : (width == 8 ? H264_MC_8 : H264_MC_4);
+    int sx = x + (mv[0] >> 2), sy = y + (mv[1] >> 2);
+    const uint8_t *src = ref->y + sy * pic->stride + sx;
+    ptrdiff_t src_stride = pic->stride;
+
+    if (sx < 2 || sy < 2 || sx + width + 3 > pic->width || sy + height + 3 > pic->height) {
+        src = h264_emulate_edge(pic->edge, ref->y, pic->stride, pic->width, pic->height,
+                                sx - 2, sy - 2, width + 5, height + 5, 1) + 2 * H264_EDGE_STRIDE + 2;
+        src_stride = H264_EDGE_STRIDE;
+    }
+    pic->dsp->put_qpel[size][((mv[1] & 3) << 2) | (mv[0] & 3)](dst_y, dst_stride, src, src_stride, height);
+
+    width /= 2;
+    height /= 2;
+    sx = x / 2 + (mv[0] >> 3);
+    sy = y / 2 + (mv[1] >> 3);
+    src = ref->uv + sy * pic->stride + 2 * sx;
+    src_stride = pic->stride;
+    if (sx < 0 || sy < 0 || sx + width + 1 > pic->width / 2 || sy + height + 1 > pic->height / 2) {
+        src = h264_emulate_edge(pic->edge, ref->uv, pic->stride, pic->width / 2, pic->height / 2,
+                                sx, sy, width + 1, height + 1, 2);
+        src_stride = H264_EDGE_STRIDE;
+    }
+    pic->dsp->put_chroma[size](dst_uv, dst_stride, src, src_stride, height, mv[0] & 7, mv[1] & 7);
+}
+
+/* 8.4.2, motion compensation of the partitions of the macroblock with weighting */
+static void
+h264_inter_predict(struct h264_picture *pic)
+{
+    const struct h264_dsp_ops *dsp = pic->dsp;
+    ptrdiff_t stride = pic->stride;
+    int i, list;
+
+    for (i = 0; i < pic->recon->num_parts; i++) {
+        const struct h264_partition *part = &pic->recon->parts[i];
+        int index = H264_CACHE(part->x, part->y);
+        int ref[2] = { pic->ref_cache[0][index], pic->ref_cache[1][index] };
+        int x = pic->mb_x * 16 + 4 * part->x, y = pic->mb_y * 16 + 4 * part->y;
+        int width = 4 * part->width, height = 4 * part->height;
+        uint8_t *dst_y = pic->dst_y + 4 * part->y * stride + 4 * part->x;
+        uint8_t *dst_uv = pic->dst_uv + 2 * part->y * stride + 4 * part->x;
+
+        if (ref[0] >= 0 && ref[1] >= 0) {
+            uint8_t *tmp_uv = pic->tmp + 16 * 16;
+
+            h264_predict(pic, &pic->slice->refs[0][ref[0]], pic->mv_cache[0][index], x, y, width, height,
+                         dst_y, dst_uv, stride);
+            h264_predict(pic, &pic->slice->refs[1][ref[1]], pic->mv_cache[1][index], x, y, width, height,
+                         pic->tmp, tmp_uv, 16);
+            if (pic->slice->weight_mode == 1) {
+                int w0[2], w1[2], offset[2], c;
+
+                w0[0] = w0[1] = pic->slice->luma_weight[0][ref[0]][0];
+                w1[0] = w1[1] = pic->slice->luma_weight[1][ref[1]][0];
+                offset[0] = offset[1] = (pic->slice->luma_weight[0][ref[0]][1] + pic->slice->luma_weight[1][ref[1]][1] + 1) >> 1;
+                dsp->biweight(dst_y, stride, pic->tmp, 16, width, height, pic->slice->luma_log2_denom,
+                              w0, w1, offset);
+                for (c = 0; c < 2; c++) {
+                    w0[c] = pic->slice->chroma_weight[0][ref[0]][c][0];
+                    w1[c] = pic->slice->chroma_weight[1][ref[1]][c][0];
+                    offset[c] = (pic->slice->chroma_weight[0][ref[0]][c][1] +
+                                 pic->slice->chroma_weight[1][ref[1]][c][1] + 1) >> 1;
+                }
+                dsp->biweight(dst_uv, stride, tmp_uv, 16, width, height / 2, pic->slice->chroma_log2_denom,
+                              w0, w1, offset);
+            } else if (pic->slice->weight_mode == 2 && pic->slice->implicit_weight[ref[0]][ref[1]] != 32) {
+                int w0[2], w1[2], offset[2] = { 0, 0 };
+
+                w1[0] = w1[1] = pic->slice->implicit_weight[ref[0]][ref[1]];
+                w0[0] = w0[1] = 64 - w1[0];
+                dsp->biweight(dst_y, stride, pic->tmp, 16, width, height, 5, w0, w1, offset);
+                dsp->biweight(dst_uv, stride, tmp_uv, 16, width, height / 2, 5, w0, w1, offset);
+            } else {
+                dsp->avg(dst_y, stride, pic->tmp, 16, width, height);
+                dsp->avg(dst_uv, stride, tmp_uv, 16, width, height / 2);
+            }
+            continue;
+        }
+
+        list = ref[0] >= 0 ? 0 : 1;
+        if (ref[list] < 0)
+            continue;
+        h264_predict(pic, &pic->slice->refs[list][ref[list]], pic->mv_cache[list][index], x, y, width, height,
+                     dst_y, dst_uv, stride);
+        if (pic->slice->weight_mode == 1) {
+            const int *luma = pic->slice->luma_weight[list][ref[list]];
+            const int (*chroma)[2] = pic->slice->chroma_weight[list][ref[list]];
+            int weight[2], offset[2];
+
+            if (luma[0] != 1 << pic->slice->luma_log2_denom || luma[1]) {
+                weight[0] = weight[1] = luma[0];
+                offset[0] = offset[1] = luma[1];
+                dsp->weight(dst_y, stride, width, height, pic->slice->luma_log2_denom, weight, offset);
+            }
+            if (chroma[0][0] != 1 << pic->slice->chroma_log2_denom || chroma[0][1] ||
+                chroma[1][0] != 1 << pic->slice->chroma_log2_denom || chroma[1][1]) {
+                weight[0] = chroma[0][0];
+                weight[1] = chroma[1][0];
+                offset[0] = chroma[0][1];
+                offset[1] = chroma[1][1];
+                dsp->weight(dst_uv, stride, width, height / 2, pic->slice->chroma_log2_denom, weight, offset);
+            }
+        }
+    }
+}
+
+/* Loads the motion of the neighbouring macroblocks into the cache */
+static void
+h264_fill_motion_cache(struct h264_picture *pic)
+{
+    const struct h264_motion *motion = pic->motion + pic->mb_y * pic->mb_width + pic->mb_x;
+    const struct h264_motion *m;
+    int list, i;
+
+    for (list = 0; list < 2; list++) {
+        int8_t *ref = pic->ref_cache[list];
+        int16_t (*mv)[2] = pic->mv_cache[list];
+
+        memset(ref, H264_REF_UNAVAILABLE, sizeof(pic->ref_cache[list]));
+        memset(mv, 0, sizeof(pic->mv_cache[list]));
+        if (pic->mb_left) {
+            m = motion - 1;
+            for (i = 0; i < 4; i++) {
+                ref[H264_CACHE(-1, i)] = m->ref_idx[list][(i >> 1) * 2 + 1];
+                memcpy(mv[H264_CACHE(-1, i)], m->mv[list][i * 4 + 3], sizeof(mv[0]));
+            }
+        }
+        if (pic->mb_top) {
+            m = motion - pic->mb_width;
+            for (i = 0; i < 4; i++) {
+                ref[H264_CACHE(i, -1)] = m->ref_idx[list][2 + (i >> 1)];
+                memcpy(mv[H264_CACHE(i, -1)], m->mv[list][12 + i], sizeof(mv[0]));
+            }
+        }
+        if (pic->mb_top_right) {
+            m = motion - pic->mb_width + 1;
+            ref[H264_CACHE(4, -1)] = m->ref_idx[list][2];
+            memcpy(mv[H264_CACHE(4, -1)], m->mv[list][12], sizeof(mv[0]));
+        }
+        if (pic->mb_top_left) {
+            m = motion - pic->mb_width - 1;
+            ref[H264_CACHE(-1, -1)] = m->ref_idx[list][3];
+            memcpy(mv[H264_CACHE(-1, -1)], m->mv[list][15], sizeof(mv[0]));
+        }
+    }
+}
+
+/* Stores the motion of a partition in the cache */
+static void
+h264_set_motion(struct h264_picture *pic, int list, const struct h264_partition *part, int ref,
+                const int16_t *mv)
+{
+    /* Read once: GCC 12.2 at -O2 loses mv[1] when this is not inlined */
+    int16_t mv_x = mv[0], mv_y = mv[1];
+    int x, y;
+
+    for (y = part->y; y < part->y + part->height; y++) {
+        for (x = part->x; x < part->x + part->width; x++) {
+            pic->ref_cache[list][H264_CACHE(x, y)] = ref;
+            pic->mv_cache[list][H264_CACHE(x, y)][0] = mv_x;
+            pic->mv_cache[list][H264_CACHE(x, y)][1] = mv_y;
+        }
+    }
+}
+
+/* Copies the motion of the macroblock out of the cache for the macroblocks and pictures to come */
+static void
+h264_save_motion(struct h264_picture *pic)
+{
+    struct h264_motion *motion = pic->motion + pic->mb_y * pic->mb_width + pic->mb_x;
+    int list, i;
+
+    for (list = 0; list < 2; list++) {
+        for (i = 0; i < 16; i++) {
+            int index = H264_CACHE(i & 3, i >> 2);
+
+            motion->mv[list][i][0] = pic->mv_cache[list][index][0];
+            motion->mv[list][i][1] = pic->mv_cache[list][index][1];
+        }
+        for (i = 0; i < 4; i++) {
+            int ref = pic->ref_cache[list][H264_CACHE((i & 1) * 2, (i >> 1) * 2)];
+
+            if (ref < 0) {
+                motion->ref_idx[list][i] = H264_REF_UNUSED;
+                motion->ref_pic[list][i] = VA_INVALID_SURFACE;
+            } else {
+                motion->ref_idx[list][i] = ref;
+                motion->ref_pic[list][i] = pic->slice->refs[list][ref].surface;
+            }
+        }
+    }
+}
+
+/* Loads the motion of the macroblock itself back into the cache, for reconstructing it after parsing */
+static void
+h264_load_motion(struct h264_picture *pic)
+{
+    const struct h264_motion *motion = pic->motion + pic->mb_y * pic->mb_width + pic->mb_x;
+    int list, i;
+
+    for (list = 0; list < 2; list++) {
+        for (i = 0; i < 16; i++) {
+            int index = H264_CACHE(i & 3, i >> 2);
+
+            pic->ref_cache[list][index] = motion->ref_idx[list][(i >> 3) * 2 + ((i & 3) >> 1)];
+            pic->mv_cache[list][index][0] = motion->mv[list][i][0];
+            pic->mv_cache[list][index][1] = motion->mv[list][i][1];
+        }
+    }
+}
+
+static void
+h264_save_intra_motion(struct h264_picture *pic)
+{
+    struct h264_motion *motion = pic->motion + pic->mb_y * pic->mb_width + pic->mb_x;
+    int i;
+
+    memset(motion->mv, 0, sizeof(motion->mv));
+    memset(motion->ref_idx, H264_REF_UNUSED, sizeof(motion->ref_idx));
+    for (i = 0; i < 4; i++)
+        motion->ref_pic[0][i] = motion->ref_pic[1][i] = VA_INVALID_SURFACE;
+}
+
+/* Partition shapes with their own predictor rules */
+#define H264_SHAPE_ANY          0
+#define H264_SHAPE_16x8_TOP     1
+#define H264_SHAPE_16x8_BOTTOM  2
+#define H264_SHAPE_8x16_LEFT    3
+#define H264_SHAPE_8x16_RIGHT   4
+
+/* 8.4.1.3, the motion vector predictor of a partition */
+static void
+h264_predict_mv(const struct h264_picture *pic, int list, int ref, const struct h264_partition *part,
+                int shape, int16_t *mvp)
+{
+    const int8_t *refs = pic->ref_cache[list];
+    const int16_t (*mvs)[2] = pic->mv_cache[list];
+    int a = H264_CACHE(part->x - 1, part->y);
+    int b = H264_CACHE(part->x, part->y - 1);
+    int c = H264_CACHE(part->x + part->width, part->y - 1);
+    int matches, i;
+
+    if (refs[c] == H264_REF_UNAVAILABLE)
+        c = H264_CACHE(part->x - 1, part->y - 1);
+
+    if ((shape == H264_SHAPE_16x8_TOP && refs[b] == ref) ||
+        (shape == H264_SHAPE_16x8_BOTTOM && refs[a] == ref) ||
+        (shape == H264_SHAPE_8x16_LEFT && refs[a] == ref) ||
+        (shape == H264_SHAPE_8x16_RIGHT && refs[c] == ref)) {
+        int n = shape == H264_SHAPE_16x8_TOP ? b : (shape == H264_SHAPE_8x16_RIGHT ? c : a);
+
+        mvp[0] = mvs[n][0];
+        mvp[1] = mvs[n][1];
+        return;
+    }
+
+    if (refs[b] == H264_REF_UNAVAILABLE && refs[c] == H264_REF_UNAVAILABLE &&
+        refs[a] != H264_REF_UNAVAILABLE) {
+        mvp[0] = mvs[a][0];
+        mvp[1] = mvs[a][1];
+        return;
+    }
+    matches = (refs[a] == ref) + (refs[b] == ref) + (refs[c] == ref);
+    for (i = 0; i < 2; i++) {
+        if (matches == 1)
+            mvp[i] = refs[a] == ref ? mvs[a][i] : (refs[b] == ref ? mvs[b][i] : mvs[c][i]);
+        else
+            mvp[i] = h264_median(mvs[a][i], mvs[b][i], mvs[c][i]);
+    }
+}
+
+/* 8.4.1.1, the motion of P_Skip */
+static void
+h264_predict_p_skip(struct h264_picture *pic, const struct h264_partition *part)
+{
+    const int8_t *refs = pic->ref_cache[0];
+    const int16_t (*mvs)[2] = pic->mv_cache[0];
+    int a = H264_CACHE(-1, 0), b = H264_CACHE(0, -1);
+    int16_t mv[2] = { 0, 0 };
+
+    if (refs[a] != H264_REF_UNAVAILABLE && refs[b] != H264_REF_UNAVAILABLE &&
+        !(refs[a] == 0 && mvs[a][0] == 0 && mvs[a][1] == 0) &&
+        !(refs[b] == 0 && mvs[b][0] == 0 && mvs[b][1] == 0))
+        h264_predict_mv(pic, 0, 0, part, H264_SHAPE_ANY, mv);
+    h264_set_motion(pic, 0, part, 0, mv);
+}
+
+/* The motion vector and reference of the colocated 4x4 block, 8.4.1.2.1 */
+static int
+h264_colocated(const struct h264_picture *pic, int x, int y, const int16_t **mv, VASurfaceID *ref_pic)
+{
+    static const int16_t zero[2] = { 0, 0 };
+    const struct h264_motion *col;
+    int block8, list;
+
+    if (pic->direct_8x8_inference) {
+        x = (x >> 1) * 3;
+        y = (y >> 1) * 3;
+    }
+    *mv = zero;
+    *ref_pic = VA_INVALID_SURFACE;
+    if (NULL == pic->col_motion)
+        return H264_REF_UNUSED;
+    col = pic->col_motion + pic->mb_y * pic->mb_width + pic->mb_x;
+    block8 = (y >> 1) * 2 + (x >> 1);
+    list = col->ref_idx[0][block8] >= 0 ? 0 : 1;
+    if (col->ref_idx[list][block8] < 0)
+        return H264_REF_UNUSED;
+    *mv = col->mv[list][y * 4 + x];
+    *ref_pic = col->ref_pic[list][block8];
+    return col->ref_idx[list][block8];
+}
+
+static inline int
+h264_min_positive(int a, int b)
+{
+    return a >= 0 && b >= 0 ? (a < b ? a : b) : (a > b ? a : b);
+}
+
+/* 8.4.1.2.2, spatial direct prediction of the whole macroblock into direct_ref and direct_mv */
+static void
+h264_direct_spatial(struct h264_picture *pic)
+{
+    static const struct h264_partition mb_part = { 0, 0, 4, 4, 0 };
+    int16_t mvp[2][2] = { { 0, 0 }, { 0, 0 } };
+    int ref[2], list, i;
+    int col_zero_allowed;
+
+    for (list = 0; list < 2; list++) {
+        const int8_t *refs = pic->ref_cache[list];
+        int c = refs[H264_CACHE(4, -1)];
+
+        if (c == H264_REF_UNAVAILABLE)
+            c = refs[H264_CACHE(-1, -1)];
+        ref[list] = h264_min_positive(refs[H264_CACHE(-1, 0)], h264_min_positive(refs[H264_CACHE(0, -1)], c));
+        if (ref[list] < 0)
+            ref[list] = H264_REF_UNUSED;
+    }
+    if (ref[0] < 0 && ref[1] < 0) {
+        /* directZeroPredictionFlag */
+        ref[0] = ref[1] = 0;
+        col_zero_allowed = 0;
+    } else {
+        for (list = 0; list < 2; list++) {
+            if (ref[list] >= 0)
+                h264_predict_mv(pic, list, ref[list], &mb_part, H264_SHAPE_ANY, mvp[list]);
+        }
+        col_zero_allowed = !pic->slice->refs[1][0].long_term;
+    }
+
+    for (i = 0; i < 16; i++) {
+        const int16_t *col_mv;
+        VASurfaceID col_pic;
+        int col_zero = 0;
+
+        if (col_zero_allowed && h264_colocated(pic, i & 3, i >> 2, &col_mv, &col_pic) == 0)
+            col_zero = col_mv[0] >= -1 && col_mv[0] <= 1 && col_mv[1] >= -1 && col_mv[1] <= 1;
+        for (list = 0; list < 2; list++) {
+            int zero = ref[list] < 0 || (ref[list] == 0 && col_zero);
+
+            pic->direct_mv[list][i][0] = zero ? 0 : mvp[list][0];
+            pic->direct_mv[list][i][1] = zero ? 0 : mvp[list][1];
+        }
+    }
+    for (i = 0; i < 4; i++) {
+        pic->direct_ref[0][i] = ref[0];
+        pic->direct_ref[1][i] = ref[1];
+    }
+}
+
+/* 8.4.1.2.3, temporal direct prediction into direct_ref and direct_mv */
+static void
+h264_direct_temporal(struct h264_picture *pic)
+{
+    int i, j;
+
+    for (i = 0; i < 16; i++) {
+        int block8 = (i >> 3) * 2 + ((i & 3) >> 1);
+        const int16_t *col_mv;
+        VASurfaceID col_pic;
+        int ref = 0, scale;
+
+        if (h264_colocated(pic, i & 3, i >> 2, &col_mv, &col_pic) >= 0) {
+            /* The lowest index in list 0 of the picture the colocated block referenced */
+            for (j = 0; j < pic->num_ref_idx[0]; j++) {
+                if (pic->slice->refs[0][j].surface == col_pic) {
+                    ref = j;
+                    break;
+                }
+            }
+        }
+        pic->direct_ref[0][block8] = ref;
+        pic->direct_ref[1][block8] = 0;
+        scale = pic->dist_scale_factor[ref];
+        for (j = 0; j < 2; j++) {
+            if (scale == INT32_MIN) {
+                pic->direct_mv[0][i][j] = col_mv[j];
+                pic->direct_mv[1][i][j] = 0;
+            } else {
+                pic->direct_mv[0][i][j] = (scale * col_mv[j] + 128) >> 8;
+                pic->direct_mv[1][i][j] = pic->direct_mv[0][i][j] - col_mv[j];
+            }
+        }
+    }
+}
+
+static void
+h264_predict_direct(struct h264_picture *pic)
+{
+    if (pic->direct_spatial)
+        h264_direct_spatial(pic);
+    else
+        h264_direct_temporal(pic);
+}
+
+/* Moves the direct motion of a partition into the cache for one list */
+static void
+h264_set_direct_motion(struct h264_picture *pic, int list, const struct h264_partition *part)
+{
+    int x, y;
+
+    for (y = part->y; y < part->y + part->height; y++) {
+        for (x = part->x; x < part->x + part->width; x++) {
+            int index = H264_CACHE(x, y);
+
+            pic->ref_cache[list][index] = pic->direct_ref[list][(y >> 1) * 2 + (x >> 1)];
+            pic->mv_cache[list][index][0] = pic->direct_mv[list][y * 4 + x][0];
+            pic->mv_cache[list][index][1] = pic->direct_mv[list][y * 4 + x][1];
+        }
+    }
+}
+
+static void
+h264_add_partition(struct h264_picture *pic, int x, int y, int width, int height, int pred)
+{
+    struct h264_partition *part = &pic->recon->parts[pic->recon->num_parts++];
+
+    part->x = x;
+    part->y = y;
+    part->width = width;
+    part->height = height;
+    part->pred = pred;
+}
+
+/* Partitions of a direct 8x8 block, or of the macroblock for block8 < 0 */
+static void
+h264_add_direct_partitions(struct h264_picture *pic, int block8)
+{
+    int x0 = block8 < 0 ? 0 : (block8 & 1) * 2, y0 = block8 < 0 ? 0 : (block8 >> 1) * 2;
+    int size = block8 < 0 ? 4 : 2;
+    int x, y;
+
+    /* Whole macroblocks of spatial direct commonly share one motion */
+    if (block8 < 0 && pic->direct_spatial &&
+        !memcmp(pic->direct_mv[0][0], pic->direct_mv[0][1], 15 * sizeof(pic->direct_mv[0][0])) &&
+        !memcmp(pic->direct_mv[1][0], pic->direct_mv[1][1], 15 * sizeof(pic->direct_mv[1][0]))) {
+        h264_add_partition(pic, 0, 0, 4, 4, H264_PRED_DIRECT);
+        return;
+    }
+    if (pic->direct_8x8_inference) {
+        for (y = y0; y < y0 + size; y += 2) {
+            for (x = x0; x < x0 + size; x += 2)
+                h264_add_partition(pic, x, y, 2, 2, H264_PRED_DIRECT);
+        }
+    } else {
+        for (y = y0; y < y0 + size; y++) {
+            for (x = x0; x < x0 + size; x++)
+                h264_add_partition(pic, x, y, 1, 1, H264_PRED_DIRECT);
+        }
+    }
+}
+
+/* te(v) */
+static int
+h264_get_ref_idx(struct bitstream *bs, int num_ref_idx)
+{
+    if (num_ref_idx == 2)
+        return !bitstream_get_bit(bs);
+    return (int) bitstream_get_ue(bs);
+}
+
+/* mb_skip_flag */
+static int
+h264_cabac_skip(struct h264_picture *pic)
+{
+    int inc = (pic->mb_left && !(pic->mb_left->type & H264_MB_SKIP)) +
+              (pic->mb_top && !(pic->mb_top->type & H264_MB_SKIP));
+
+    return h264_cabac_decode(&pic->cabac_engine, (pic->slice_type == H264_SLICE_B ? 24 : 11) + inc);
+}
+
+/*
+ * mb_type of I slices from ctxIdx 3, or the suffix of P and B slices from
+ * 17 and 32, 9.3.2.5
+ */
+static unsigned int
+h264_cabac_intra_mb_type(struct h264_picture *pic, int ctx, int intra_slice)
+{
+    struct h264_cabac *cabac = &pic->cabac_engine;
+    unsigned int mb_type;
+
+    if (intra_slice) {
+        int inc = (pic->mb_left && !(pic->mb_left->type & (H264_MB_INTRA4x4 | H264_MB_INTRA8x8))) +
+                  (pic->mb_top && !(pic->mb_top->type & (H264_MB_INTRA4x4 | H264_MB_INTRA8x8)));
+
+        if (!h264_cabac_decode(cabac, ctx + inc))
+            return 0;
+        ctx += 2;
+    } else if (!h264_cabac_decode(cabac, ctx)) {
+        return 0;
+    }
+    if (h264_cabac_terminate(cabac))
+        return 25;
+    mb_type = 1 + 12 * h264_cabac_decode(cabac, ctx + 1);
+    if (h264_cabac_decode(cabac, ctx + 2))
+        mb_type += 4 + 4 * h264_cabac_decode(cabac, ctx + 2 + intra_slice);
+    mb_type += 2 * h264_cabac_decode(cabac, ctx + 3 + intra_slice);
+    mb_type += h264_cabac_decode(cabac, ctx + 3 + 2 * intra_slice);
+    return mb_type;
+}
+
+/* mb_type, numbered as ue(v) numbers it: intra types follow the inter ones in P and B slices */
+static unsigned int
+h264_cabac_mb_type(struct h264_picture *pic)
+{
+    struct h264_cabac *cabac = &pic->cabac_engine;
+    int inc, bits;
+
+    if (pic->slice_type == H264_SLICE_I)
+        return h264_cabac_intra_mb_type(pic, 3, 1);
+    if (pic->slice_type == H264_SLICE_P) {
+        if (h264_cabac_decode(cabac, 14))
+            return 5 + h264_cabac_intra_mb_type(pic, 17, 0);
+        /* P_8x8ref0 is not allowed with CABAC */
+        if (!h264_cabac_decode(cabac, 15))
+            return 3 * h264_cabac_decode(cabac, 16);
+        return 2 - h264_cabac_decode(cabac, 17);
+    }
+
+    inc = (pic->mb_left && !(pic->mb_left->type & H264_MB_DIRECT)) +
+          (pic->mb_top && !(pic->mb_top->type & H264_MB_DIRECT));
+    if (!h264_cabac_decode(cabac, 27 + inc))
+        return 0;
+    if (!h264_cabac_decode(cabac, 30))
+        return 1 + h264_cabac_decode(cabac, 32);
+    bits = h264_cabac_decode(cabac, 31) << 3;
+    bits |= h264_cabac_decode(cabac, 32) << 2;
+    bits |= h264_cabac_decode(cabac, 32) << 1;
+    bits |= h264_cabac_decode(cabac, 32);
+    if (bits < 8)
+        return bits + 3;
+    if (bits == 13)
+        return 23 + h264_cabac_intra_mb_type(pic, 32, 0);
+    if (bits == 14)
+        return 11;
+    if (bits == 15)
+        return 22;
+    return ((bits << 1) | h264_cabac_decode(cabac, 32)) - 4;
+}
+
+/* sub_mb_type, numbered as ue(v) numbers it */
+static unsigned int
+h264_cabac_sub_mb_type(struct h264_picture *pic)
+{
+    struct h264_cabac *cabac = &pic->cabac_engine;
+    unsigned int type;
+
+    if (pic->slice_type == H264_SLICE_P) {
+        if (h264_cabac_decode(cabac, 21))
+            return 0;
+        if (!h264_cabac_decode(cabac, 22))
+            return 1;
+        return h264_cabac_decode(cabac, 23) ? 2 : 3;
+    }
+    if (!h264_cabac_decode(cabac, 36))
+        return 0;
+    if (!h264_cabac_decode(cabac, 37))
+        return 1 + h264_cabac_decode(cabac, 39);
+    type = 3;
+    if (h264_cabac_decode(cabac, 38)) {
+        if (h264_cabac_decode(cabac, 39))
+            return 11 + h264_cabac_decode(cabac, 39);
+        type += 4;
+    }
+    type += 2 * h264_cabac_decode(cabac, 39);
+    type += h264_cabac_decode(cabac, 39);
+    return type;
+}
+
+/*
+ * Whether the 4x4 block (x, y) left of or above the macroblock counts as
+ * having a reference index above 0 for the ref_idx contexts of 9.3.3.1.1.6:
+ * blocks predicted in direct mode don't
+ */
+static int
+h264_cabac_ref_above_zero(const struct h264_picture *pic, int list, int x, int y)
+{
+    if (pic->ref_cache[list][H264_CACHE(x, y)] <= 0)
+        return 0;
+    if (x < 0)
+        return !((pic->mb_left->direct >> ((y >> 1) * 2 + 1)) & 1);
+    return !((pic->mb_top->direct >> (2 + (x >> 1))) & 1);
+}
+
+/* ref_idx with ctxIdxInc inc for its first bin, up to H264_MAX_REFS */
+static int
+h264_cabac_ref_idx(struct h264_picture *pic, int inc)
+{
+    int ref = 0;
+
+    while (ref < H264_MAX_REFS && h264_cabac_decode(&pic->cabac_engine, 54 + inc)) {
+        ref++;
+        inc = inc < 4 ? 4 : 5;
+    }
+    return ref;
+}
+
+/* absMvdComp of the blocks left of and above 4x4 block (x, y) added up, 9.3.3.1.1.7 */
+static int
+h264_cabac_mvd_sum(const struct h264_picture *pic, int list, int comp, int x, int y)
+{
+    const struct h264_mb *mb = pic->mb;
+    int a = 0, b = 0;
+
+    if (x > 0)
+        a = mb->mvd[list][y * 4 + x - 1][comp];
+    else if (pic->mb_left)
+        a = pic->mb_left->mvd[list][y * 4 + 3][comp];
+    if (y > 0)
+        b = mb->mvd[list][(y - 1) * 4 + x][comp];
+    else if (pic->mb_top)
+        b = pic->mb_top->mvd[list][12 + x][comp];
+    return a + b;
+}
+
+/* One component of mvd_l0 or mvd_l1 from ctxIdx 40 or 47, UEG3 binarized */
+static int
+h264_cabac_mvd(struct h264_cabac *cabac, int ctx, int sum)
+{
+    int mvd, k;
+
+    if (!h264_cabac_decode(cabac, ctx + (sum < 3 ? 0 : (sum > 32 ? 2 : 1))))
+        return 0;
+    ctx += 3;
+    mvd = 1;
+    while (mvd < 9 && h264_cabac_decode(cabac, ctx)) {
+        if (mvd < 4)
+            ctx++;
+        mvd++;
+    }
+    if (mvd >= 9) {
+        for (k = 3; k < 24 && h264_cabac_bypass(cabac); k++)
+            mvd += 1 << k;
+        while (k--)
+            mvd += h264_cabac_bypass(cabac) << k;
+    }
+    return h264_cabac_bypass(cabac) ? -mvd : mvd;
+}
+
+/* intra_chroma_pred_mode */
+static int
+h264_cabac_chroma_mode(struct h264_picture *pic)
+{
+    int inc = (pic->mb_left && pic->mb_left->chroma_mode) + (pic->mb_top && pic->mb_top->chroma_mode);
+
+    if (!h264_cabac_decode(&pic->cabac_engine, 64 + inc))
+        return 0;
+    if (!h264_cabac_decode(&pic->cabac_engine, 67))
+        return 1;
+    return 2 + h264_cabac_decode(&pic->cabac_engine, 67);
+}
+
+/* coded_block_pattern, the prefix and suffix of 9.3.2.6 with the contexts of 9.3.3.1.1.4 */
+static int
+h264_cabac_cbp(struct h264_picture *pic)
+{
+    struct h264_cabac *cabac = &pic->cabac_engine;
+    /* Luma blocks of unavailable macroblocks count as coded, their chroma as not */
+    int left = pic->mb_left ? pic->mb_left->cbp : 0x0f;
+    int top = pic->mb_top ? pic->mb_top->cbp : 0x0f;
+    int cbp;
+
+    cbp = h264_cabac_decode(cabac, 73 + !(left & 2) + 2 * !(top & 4));
+    cbp |= h264_cabac_decode(cabac, 73 + !(cbp & 1) + 2 * !(top & 8)) << 1;
+    cbp |= h264_cabac_decode(cabac, 73 + !(left & 8) + 2 * !(cbp & 1)) << 2;
+    cbp |= h264_cabac_decode(cabac, 73 + !(cbp & 4) + 2 * !(cbp & 2)) << 3;
+    if (h264_cabac_decode(cabac, 77 + ((left >> 4) != 0) + 2 * ((top >> 4) != 0)))
+        cbp |= (1 + h264_cabac_decode(cabac, 81 + ((left >> 4) == 2) + 2 * ((top >> 4) == 2))) << 4;
+    return cbp;
+}
+
+/* mb_qp_delta, outside -26 to 25 when damaged */
+static int
+h264_cabac_qp_delta(struct h264_picture *pic)
+{
+    int ctx = pic->last_qp_delta != 0, value = 0;
+
+    while (value < 53 && h264_cabac_decode(&pic->cabac_engine, 60 + ctx)) {
+        ctx = ctx < 2 ? 2 : 3;
+        value++;
+    }
+    return value & 1 ? (value + 1) >> 1 : -(value >> 1);
+}
+
+static int
+h264_cabac_transform_8x8(struct h264_picture *pic)
+{
+    int inc = (pic->mb_left && (pic->mb_left->type & H264_MB_TRANSFORM8x8)) +
+              (pic->mb_top && (pic->mb_top->type & H264_MB_TRANSFORM8x8));
+
+    return h264_cabac_decode(&pic->cabac_engine, 399 + inc);
+}
+
+/*
+ * ctxIdxInc of the coded_block_flag of 4x4 block (x, y) of plane 0 luma,
+ * 1 Cb and 2 Cr, or of the DC block of the plane for ctxBlockCat 0 and 3,
+ * 9.3.3.1.1.9. Unavailable macroblocks count as coded for intra ones.
+ */
+static int
+h264_cabac_cbf_inc(const struct h264_picture *pic, int cat, int plane, int x, int y)
+{
+    const struct h264_mb *mb = pic->mb, *left = pic->mb_left, *top = pic->mb_top;
+    int intra = (mb->type & H264_MB_INTRA) != 0;
+    int width = plane ? 2 : 4, base = plane ? 12 + 4 * plane : 0;
+    int a, b;
+
+    if (cat == 0 || cat == 3) {
+        a = left ? (left->coded_dc >> plane) & 1 : intra;
+        b = top ? (top->coded_dc >> plane) & 1 : intra;
+        return a + 2 * b;
+    }
+    if (x > 0)
+        a = mb->non_zero[base + y * width + x - 1] != 0;
+    else
+        a = left ? left->non_zero[base + y * width + width - 1] != 0 : intra;
+    if (y > 0)
+        b = mb->non_zero[base + (y - 1) * width + x] != 0;
+    else
+        b = top ? top->non_zero[base + (width - 1) * width + x] != 0 : intra;
+    return a + 2 * b;
+}
+
+/*
+ * residual_block_cabac() of ctxBlockCat cat, scaled as h264_residual_block()
+ * does. cbf_inc is the ctxIdxInc of coded_block_flag, negative for 8x8
+ * blocks which have none in 4:2:0. Returns the number of coefficients.
+ */
+static int
+h264_cabac_residual_block(struct h264_cabac *cabac, int16_t *block, int cat, int cbf_inc, int max_coeff,
+                          const uint8_t *scan, const int *scale, int qp_shift, int shift)
+{
+    int sig = h264_cabac_sig_offset[cat], last = h264_cabac_last_offset[cat];
+    int level_ctx = h264_cabac_abs_offset[cat];
+    int max_gt1 = cat == 3 ? 3 : 4;
+    int index[64];
+    int count = 0, gt1 = 0, eq1 = 0, total, i;
+
+    if (cbf_inc >= 0 && !h264_cabac_decode(cabac, h264_cabac_cbf_offset[cat] + cbf_inc))
+        return 0;
+    for (i = 0; i < max_coeff - 1; i++) {
+        if (h264_cabac_decode(cabac, sig + (cat == 5 ? h264_cabac_sig_inc8x8[i] : i))) {
+            index[count++] = i;
+            if (h264_cabac_decode(cabac, last + (cat == 5 ? h264_cabac_last_inc8x8[i] : i)))
+                break;
+        }
+    }
+    if (i == max_coeff - 1)
+        index[count++] = i;
+
+    /* coeff_abs_level_minus1 and coeff_sign_flag, highest frequency first */
+    total = count;
+    while (count--) {
+        int pos = scan[index[count]];
+        int level, k;
+
+        if (!h264_cabac_decode(cabac, level_ctx + (gt1 ? 0 : (eq1 < 3 ? 1 + eq1 : 4)))) {
+            level = 1;
+            eq1++;
+        } else {
+            int ctx = level_ctx + 5 + (gt1 < max_gt1 ? gt1 : max_gt1);
+
+            for (level = 2; level < 15 && h264_cabac_decode(cabac, ctx); level++)
+                ;
+            if (level == 15) {
+                /* Exp-Golomb suffix */
+                for (k = 0; k < 24 && h264_cabac_bypass(cabac); k++)
+                    ;
+                level = 1;
+                while (k--)
+                    level = 2 * level + h264_cabac_bypass(cabac);
+                level += 14;
+            }
+            gt1++;
+        }
+        if (h264_cabac_bypass(cabac))
+            level = -level;
+        if (scale)
+            block[pos] = (level * scale[pos] * (1 << qp_shift) + (1 << (shift - 1))) >> shift;
+        else
+            block[pos] = level;
+    }
+    return total;
+}
+
+/*
+ * mb_pred() and sub_mb_pred() of P and B macroblocks, shape being 0 for
+ * 16x16, 1 for 16x8, 2 for 8x16 and 3 for 8x8. Fills the motion cache and
+ * the partition list, returns -1 on errors or whether all partitions are
+ * at least 8x8.
+ */
+static int
+h264_decode_motion(struct h264_picture *pic, int shape, const int *pred, int ref0_only)
+{
+    struct bitstream *bs = &pic->bs;
+    int sub_shape[4], sub_pred[4], ref[4][2];
+    int num_lists = pic->slice_type == H264_SLICE_B ? 2 : 1;
+    int num_parts = shape == 0 ? 1 : (shape == 3 ? 4 : 2);
+    int all_8x8 = 1, has_direct = 0;
+    int i, j, list;
+
+    pic->recon->num_parts = 0;
+    if (shape == 3) {
+        for (i = 0; i < 4; i++) {
+            unsigned int type = pic->cabac ? h264_cabac_sub_mb_type(pic) : bitstream_get_ue(bs);
+
+            if (pic->slice_type == H264_SLICE_B) {
+                if (type > 12)
+                    return -1;
+                sub_shape[i] = h264_b_sub_mb_types[type][0];
+                sub_pred[i] = h264_b_sub_mb_types[type][1];
+            } else {
+                if (type > 3)
+                    return -1;
+                sub_shape[i] = type;
+                sub_pred[i] = H264_PRED_L0;
+            }
+            if (sub_pred[i] == H264_PRED_DIRECT) {
+                has_direct = 1;
+                pic->mb->direct |= 1 << i;
+                all_8x8 &= pic->direct_8x8_inference;
+            } else {
+                all_8x8 &= sub_shape[i] == 0;
+            }
+        }
+    } else {
+        for (i = 0; i < num_parts; i++) {
+            sub_shape[i] = 0;
+            sub_pred[i] = pred[i];
+        }
+    }
+    if (has_direct)
+        h264_predict_direct(pic);
+
+    for (list = 0; list < num_lists; list++) {
+        for (i = 0; i < num_parts; i++) {
+            ref[i][list] = H264_REF_UNUSED;
+            if (sub_pred[i] == H264_PRED_DIRECT || !(sub_pred[i] & (1 << list)))
+                continue;
+            ref[i][list] = 0;
+            if (pic->num_ref_idx[list] > 1 && !ref0_only) {
+                if (pic->cabac) {
+                    /* The partitions left of and above this one, those of the macroblock decoded already */
+                    int x = shape == 2 || shape == 3 ? (i & 1) * 2 : 0;
+                    int y = shape == 1 ? 2 * i : (shape == 3 ? (i >> 1) * 2 : 0);
+                    int a = x ? ref[shape == 3 ? i - 1 : 0][list] > 0 : h264_cabac_ref_above_zero(pic, list, -1, y);
+                    int b = y ? ref[shape == 3 ? i - 2 : 0][list] > 0 : h264_cabac_ref_above_zero(pic, list, x, -1);
+
+                    ref[i][list] = h264_cabac_ref_idx(pic, a + 2 * b);
+                } else {
+                    ref[i][list] = h264_get_ref_idx(bs, pic->num_ref_idx[list]);
+                }
+                if (ref[i][list] >= pic->num_ref_idx[list])
+                    return -1;
+            }
+        }
+    }
+
+    for (list = 0; list < num_lists; list++) {
+        for (i = 0; i < num_parts; i++) {
+            struct h264_partition part;
+            int sub_width = sub_shape[i] & 2 ? 1 : 2, sub_height = sub_shape[i] & 1 ? 1 : 2;
+
+            if (shape == 3) {
+                part.x = (i & 1) * 2;
+                part.y = (i >> 1) * 2;
+                part.width = part.height = 2;
+            } else {
+                part.x = shape == 2 ? 2 * i : 0;
+                part.y = shape == 1 ? 2 * i : 0;
+                part.width = shape == 2 ? 2 : 4;
+                part.height = shape == 1 ? 2 : 4;
+            }
+            if (sub_pred[i] == H264_PRED_DIRECT) {
+                h264_set_direct_motion(pic, list, &part);
+                continue;
+            }
+            if (ref[i][list] < 0) {
+                static const int16_t zero[2] = { 0, 0 };
+
+                h264_set_motion(pic, list, &part, H264_REF_UNUSED, zero);
+                continue;
+            }
+            /* The sub-macroblock partitions in order */
+            for (j = 0; j < 4 / (sub_width * sub_height) * (shape == 3) + (shape != 3); j++) {
+                struct h264_partition sub = part;
+                int16_t mv[2];
+                int shape_rule = H264_SHAPE_ANY;
+
+                if (shape == 3) {
+                    sub.x += (j % (2 / sub_width)) * sub_width;
+                    sub.y += (j / (2 / sub_width)) * sub_height;
+                    sub.width = sub_width;
+                    sub.height = sub_height;
+                } else if (shape == 1) {
+                    shape_rule = i ? H264_SHAPE_16x8_BOTTOM : H264_SHAPE_16x8_TOP;
+                } else if (shape == 2) {
+                    shape_rule = i ? H264_SHAPE_8x16_RIGHT : H264_SHAPE_8x16_LEFT;
+                }
+                h264_predict_mv(pic, list, ref[i][list], &sub, shape_rule, mv);
+                if (pic->cabac) {
+                    int mvd[2], x, y;
+
+                    mvd[0] = h264_cabac_mvd(&pic->cabac_engine, 40, h264_cabac_mvd_sum(pic, list, 0, sub.x, sub.y));
+                    mvd[1] = h264_cabac_mvd(&pic->cabac_engine, 47, h264_cabac_mvd_sum(pic, list, 1, sub.x, sub.y));
+                    for (y = sub.y; y < sub.y + sub.height; y++) {
+                        for (x = sub.x; x < sub.x + sub.width; x++) {
+                            pic->mb->mvd[list][y * 4 + x][0] = abs(mvd[0]) < 64 ? abs(mvd[0]) : 64;
+                            pic->mb->mvd[list][y * 4 + x][1] = abs(mvd[1]) < 64 ? abs(mvd[1]) : 64;
+                        }
+                    }
+                    mv[0] += mvd[0];
+                    mv[1] += mvd[1];
+                } else {
+                    mv[0] += bitstream_get_se(bs);
+                    mv[1] += bitstream_get_se(bs);
+                }
+                h264_set_motion(pic, list, &sub, ref[i][list], mv);
+            }
+        }
+    }
+
+    /* Partitions for motion compensation */
+    for (i = 0; i < num_parts; i++) {
+        int sub_width = sub_shape[i] & 2 ? 1 : 2, sub_height = sub_shape[i] & 1 ? 1 : 2;
+        int x, y;
+
+        if (shape != 3)
+            h264_add_partition(pic, shape == 2 ? 2 * i : 0, shape == 1 ? 2 * i : 0,
+                               shape == 2 ? 2 : 4, shape == 1 ? 2 : 4, sub_pred[i]);
+        else if (sub_pred[i] == H264_PRED_DIRECT)
+            h264_add_direct_partitions(pic, i);
+        else {
+            for (y = 0; y < 2; y += sub_height) {
+                for (x = 0; x < 2; x += sub_width)
+                    h264_add_partition(pic, (i & 1) * 2 + x, (i >> 1) * 2 + y, sub_width, sub_height,
+                                       sub_pred[i]);
+            }
+        }
+    }
+    return all_8x8;
+}
+
+/*
+ * residual_block_cavlc() of up to max_coeff coefficients, coefficient i
+ * going to block[scan[i]]. With scale the levels are scaled as in 8.5.12.1
+ * by (scale << qp_shift) rounding off shift bits. Returns TotalCoeff, or
+ * -1 on errors.
+ */
+static int
+h264_residual_block(struct bitstream *bs, int16_t *block, int nc, int max_coeff, const uint8_t *scan,
+                    const int *scale, int qp_shift, int shift)
+{
+    int level[16];
+    int token, total_coeff, trailing_ones, total_zeros, suffix_length, zeros_left, pos, i;
+
+    if (nc < 0)
+        token = vlc_get(bs, &h264_chroma_dc_coeff_token_vlc);
+    else
+        token = vlc_get(bs, &h264_coeff_token_vlc[nc < 2 ? 0 : (nc < 4 ? 1 : (nc < 8 ? 2 : 3))]);
+    if (token == VLC_INVALID)
+        return -1;
+    total_coeff = token >> 2;
+    trailing_ones = token & 3;
+    if (total_coeff == 0)
+        return 0;
+    if (total_coeff > max_coeff)
+        return -1;
+
+    suffix_length = total_coeff > 10 && trailing_ones < 3;
+    for (i = 0; i < total_coeff; i++) {
+        uint32_t bits;
+        int prefix, level_code, suffix_size;
+
+        if (i < trailing_ones) {
+            level[i] = 1 - 2 * (int) bitstream_get_bit(bs);
+            continue;
+        }
+        bits = bitstream_show_bits(bs, 32);
+        if (bits == 0)
+            return -1;
+        prefix = __builtin_clz(bits);
+        if (prefix > 28)
+            return -1;
+        bitstream_skip_bits(bs, prefix + 1);
+
+        level_code = (prefix < 15 ? prefix : 15) << suffix_length;
+        suffix_size = prefix >= 15 ? prefix - 3 : (prefix == 14 && suffix_length == 0 ? 4 : suffix_length);
+        if (suffix_size)
+            level_code += bitstream_get_bits(bs, suffix_size);
+        if (prefix >= 15 && suffix_length == 0)
+            level_code += 15;
+        if (prefix >= 16)
+            level_code += (1 << (prefix - 3)) - 4096;
+        if (i == trailing_ones && trailing_ones < 3)
+            level_code += 2;
+        level[i] = level_code & 1 ? (-level_code - 1) >> 1 : (level_code + 2) >> 1;
+
+        if (suffix_length == 0)
+            suffix_length = 1;
+        if ((level[i] < 0 ? -level[i] : level[i]) > (3 << (suffix_length - 1)) && suffix_length < 6)
+            suffix_length++;
+    }
+
+    total_zeros = 0;
+    if (total_coeff < max_coeff) {
+        if (nc < 0)
+            total_zeros = vlc_get(bs, &h264_chroma_dc_total_zeros_vlc[total_coeff - 1]);
+        else
+            total_zeros = vlc_get(bs, &h264_total_zeros_vlc[total_coeff - 1]);
+        if (total_zeros < 0 || total_zeros > max_coeff - total_coeff)
+            return -1;
+    }
+
+    /* Levels come highest frequency first, each followed by its run_before */
+    zeros_left = total_zeros;
+    pos = total_coeff + total_zeros - 1;
+    for (i = 0;; i++) {
+        int run;
+
+        if (scale)
+            block[scan[pos]] = (level[i] * scale[scan[pos]] * (1 << qp_shift) + (1 << (shift - 1))) >> shift;
+        else
+            block[scan[pos]] = level[i];
+        if (i == total_coeff - 1)
+            break;
+        run = 0;
+        if (zeros_left > 0) {
+            run = vlc_get(bs, &h264_run_vlc[(zeros_left < 7 ? zeros_left : 7) - 1]);
+            if (run < 0 || run > zeros_left)
+                return -1;
+        }
+        zeros_left -= run;
+        pos -= run + 1;
+    }
+    return total_coeff;
+}
+
+/* nC of 9.2.1 for 4x4 block (x, y) of plane 0 luma, 1 Cb and 2 Cr */
+static int
+h264_predict_total_coeff(const struct h264_picture *pic, int plane, int x, int y)
+{
+    int width = plane ? 2 : 4, base = plane ? 12 + 4 * plane : 0;
+    const uint8_t *non_zero = pic->mb->non_zero + base;
+    int a = -1, b = -1;
+
+    if (x > 0)
+        a = non_zero[y * width + x - 1];
+    else if (pic->mb_left)
+        a = pic->mb_left->non_zero[base + y * width + width - 1];
+    if (y > 0)
+        b = non_zero[(y - 1) * width + x];
+    else if (pic->mb_top)
+        b = pic->mb_top->non_zero[base + (width - 1) * width + x];
+    if (a >= 0 && b >= 0)
+        return (a + b + 1) >> 1;
+    return a >= 0 ? a : (b >= 0 ? b : 0);
+}
+
+/* 8.5.10, the Intra16x16 DC transform and scaling into the 4x4 luma blocks */
+static void
+h264_luma_dc(struct h264_picture *pic, const int16_t *dc, int list, int qp)
+{
+    int scale = pic->level_scale4[list][qp % 6][0] << (qp / 6);
+    int tmp[16], i;
+
+    for (i = 0; i < 4; i++) {
+        const int16_t *c = dc + 4 * i;
+
+        tmp[4 * i] = c[0] + c[1] + c[2] + c[3];
+        tmp[4 * i + 1] = c[0] + c[1] - c[2] - c[3];
+        tmp[4 * i + 2] = c[0] - c[1] - c[2] + c[3];
+        tmp[4 * i + 3] = c[0] - c[1] + c[2] - c[3];
+    }
+    for (i = 0; i < 4; i++) {
+        int f[4];
+        int j;
+
+        f[0] = tmp[i] + tmp[4 + i] + tmp[8 + i] + tmp[12 + i];
+        f[1] = tmp[i] + tmp[4 + i] - tmp[8 + i] - tmp[12 + i];
+        f[2] = tmp[i] - tmp[4 + i] - tmp[8 + i] + tmp[12 + i];
+        f[3] = tmp[i] - tmp[4 + i] + tmp[8 + i] - tmp[12 + i];
+        for (j = 0; j < 4; j++) {
+            int block = 4 * j + i;
+
+            pic->recon->luma[16 * block] = (f[j] * scale + 32) >> 6;
+            if (pic->recon->luma[16 * block])
+                pic->recon->luma_coded |= 1 << block;
+        }
+    }
+}
+
+/* 8.5.11, the 2x2 chroma DC transform and scaling */
+static void
+h264_chroma_dc(struct h264_picture *pic, int c, const int16_t *dc, int list, int qp)
+{
+    int scale = pic->level_scale4[list][qp % 6][0];
+    int f[4], i;
+
+    f[0] = dc[0] + dc[1] + dc[2] + dc[3];
+    f[1] = dc[0] - dc[1] + dc[2] - dc[3];
+    f[2] = dc[0] + dc[1] - dc[2] - dc[3];
+    f[3] = dc[0] - dc[1] - dc[2] + dc[3];
+    for (i = 0; i < 4; i++) {
+        pic->recon->chroma[c][i][0] = ((f[i] * scale) << (qp / 6)) >> 5;
+        if (pic->recon->chroma[c][i][0])
+            pic->recon->chroma_coded |= 1 << (4 * c + i);
+    }
+}
+
+/*
+ * One block of residual_block_cavlc() or residual_block_cabac() of
+ * ctxBlockCat cat, 4x4 block (x, y) of plane 0 luma, 1 Cb or 2 Cr. Returns
+ * the number of coefficients, or -1 on errors.
+ */
+static int
+h264_read_block(struct h264_picture *pic, int16_t *block, int cat, int plane, int x, int y, int max_coeff,
+                const uint8_t *scan, const int *scale, int qp_shift, int shift)
+{
+    if (pic->cabac)
+        return h264_cabac_residual_block(&pic->cabac_engine, block, cat, h264_cabac_cbf_inc(pic, cat, plane, x, y),
+                                         max_coeff, scan, scale, qp_shift, shift);
+    return h264_residual_block(&pic->bs, block, cat == 3 ? -1 : h264_predict_total_coeff(pic, plane, x, y),
+                               max_coeff, scan, scale, qp_shift, shift);
+}
+
+/* residual() for coded_block_pattern cbp, returns -1 on errors */
+static int
+h264_decode_residual(struct h264_picture *pic, int cbp)
+{
+    struct bitstream *bs = &pic->bs;
+    struct h264_mb *mb = pic->mb;
+    int intra = (mb->type & H264_MB_INTRA) != 0;
+    int list = intra ? 0 : 3;
+    int qp = mb->qp;
+    int i8, i4, c, n;
+
+    if (mb->type & H264_MB_INTRA16x16) {
+        int16_t dc[16] = { 0 };
+
+        n = h264_read_block(pic, dc, 0, 0, 0, 0, 16, h264_zigzag4, NULL, 0, 0);
+        if (n < 0)
+            return -1;
+        if (n > 0)
+            mb->coded_dc |= 1;
+        h264_luma_dc(pic, dc, list, qp);
+    }
+
+    for (i8 = 0; i8 < 4; i8++) {
+        if (pic->cabac && (mb->type & H264_MB_TRANSFORM8x8)) {
+            /* One block of 64 coefficients rather than four interleaved ones */
+            int block = (i8 >> 1) * 8 + (i8 & 1) * 2;
+
+            n = 0;
+            if (cbp & (1 << i8)) {
+                n = h264_cabac_residual_block(&pic->cabac_engine, pic->recon->luma + 64 * i8, 5, -1, 64, h264_zigzag8,
+                                              pic->level_scale8[intra ? 0 : 1][qp % 6], qp / 6, 6);
+                if (n > 0)
+                    pic->recon->luma_coded |= 0x33 << block;
+            }
+            mb->non_zero[block] = mb->non_zero[block + 1] = mb->non_zero[block + 4] = mb->non_zero[block + 5] = n;
+            continue;
+        }
+        for (i4 = 0; i4 < 4; i4++) {
+            int block = (i8 >> 1) * 8 + (i8 & 1) * 2 + (i4 >> 1) * 4 + (i4 & 1);
+            int x = block & 3, y = block >> 2;
+
+            if (!(cbp & (1 << i8))) {
+                mb->non_zero[block] = 0;
+                continue;
+            }
+            if (mb->type & H264_MB_TRANSFORM8x8) {
+                n = h264_residual_block(bs, pic->recon->luma + 64 * i8, h264_predict_total_coeff(pic, 0, x, y), 16,
+                                        h264_zigzag8_cavlc[i4], pic->level_scale8[intra ? 0 : 1][qp % 6],
+                                        qp / 6, 6);
+                if (n > 0)
+                    pic->recon->luma_coded |= 0x33 << ((i8 >> 1) * 8 + (i8 & 1) * 2);
+            } else if (mb->type & H264_MB_INTRA16x16) {
+                n = h264_read_block(pic, pic->recon->luma + 16 * block, 1, 0, x, y, 15, h264_zigzag4 + 1,
+                                    pic->level_scale4[list][qp % 6], qp / 6, 4);
+                if (n > 0)
+                    pic->recon->luma_coded |= 1 << block;
+            } else {
+                n = h264_read_block(pic, pic->recon->luma + 16 * block, 2, 0, x, y, 16, h264_zigzag4,
+                                    pic->level_scale4[list][qp % 6], qp / 6, 4);
+                if (n > 0)
+                    pic->recon->luma_coded |= 1 << block;
+            }
+            if (n < 0)
+                return -1;
+            mb->non_zero[block] = n;
+        }
+    }
+    mb->coded = pic->recon->luma_coded;
+
+    if (cbp & 0x30) {
+        for (c = 0; c < 2; c++) {
+            int16_t dc[4] = { 0 };
+
+            n = h264_read_block(pic, dc, 3, 1 + c, 0, 0, 4, (const uint8_t *) "\0\1\2\3", NULL, 0, 0);
+            if (n < 0)
+                return -1;
+            if (n > 0)
+                mb->coded_dc |= 2 << c;
+            h264_chroma_dc(pic, c, dc, list + 1 + c, pic->chroma_qp[c][qp]);
+        }
+    }
+    for (c = 0; c < 2; c++) {
+        int qpc = pic->chroma_qp[c][qp];
+
+        for (i4 = 0; i4 < 4; i4++) {
+            n = 0;
+            if (cbp & 0x20) {
+                n = h264_read_block(pic, pic->recon->chroma[c][i4], 4, 1 + c, i4 & 1, i4 >> 1, 15, h264_zigzag4 + 1,
+                                    pic->level_scale4[list + 1 + c][qpc % 6], qpc / 6, 4);
+                if (n < 0)
+                    return -1;
+                if (n > 0)
+                    pic->recon->chroma_coded |= 1 << (4 * c + i4);
+            }
+            mb->non_zero[16 + 4 * c + i4] = n;
+        }
+    }
+    return 0;
+}
+
+/* Adds the decoded residual of the chroma blocks */
+static void
+h264_add_chroma_residual(struct h264_picture *pic)
+{
+    int c, i;
+
+    for (c = 0; c < 2; c++) {
+        for (i = 0; i < 4; i++) {
+            if (pic->recon->chroma_coded & (1 << (4 * c + i)))
+                pic->dsp->idct4_add_uv(pic->dst_uv + c + (i >> 1) * 4 * pic->stride + (i & 1) * 8,
+                                       pic->stride, pic->recon->chroma[c][i]);
+        }
+    }
+}
+
+/* Adds the decoded residual of the luma blocks of inter macroblocks */
+static void
+h264_add_luma_residual(struct h264_picture *pic)
+{
+    ptrdiff_t stride = pic->stride;
+    int i;
+
+    if (pic->mb->type & H264_MB_TRANSFORM8x8) {
+        for (i = 0; i < 4; i++) {
+            if (pic->recon->luma_coded & (1 << ((i >> 1) * 8 + (i & 1) * 2)))
+                pic->dsp->idct8_add(pic->dst_y + (i >> 1) * 8 * stride + (i & 1) * 8, stride, pic->recon->luma + 64 * i);
+        }
+    } else {
+        for (i = 0; i < 16; i++) {
+            if (pic->recon->luma_coded & (1 << i))
+                pic->dsp->idct4_add(pic->dst_y + (i >> 2) * 4 * stride + (i & 3) * 4, stride, pic->recon->luma + 16 * i);
+        }
+    }
+}
+
+/* Availability of the neighbours of an NxN intra block at (x, y) in 4x4 blocks, size 1 or 2 */
+static int
+h264_block_avail(const struct h264_picture *pic, int x, int y, int size)
+{
+    int mb = pic->recon->intra_avail;
+    int avail = 0;
+
+    if (x > 0 || (mb & H264_AVAIL_LEFT))
+        avail |= H264_AVAIL_LEFT;
+    if (y > 0 || (mb & H264_AVAIL_TOP))
+        avail |= H264_AVAIL_TOP;
+    if (x > 0 && y > 0)
+        avail |= H264_AVAIL_TOP_LEFT;
+    else if (x > 0)
+        avail |= mb & H264_AVAIL_TOP ? H264_AVAIL_TOP_LEFT : 0;
+    else if (y > 0)
+        avail |= mb & H264_AVAIL_LEFT ? H264_AVAIL_TOP_LEFT : 0;
+    else
+        avail |= mb & H264_AVAIL_TOP_LEFT;
+    if (y == 0) {
+        if (x + size < 4)
+            avail |= mb & H264_AVAIL_TOP ? H264_AVAIL_TOP_RIGHT : 0;
+        else
+            avail |= mb & H264_AVAIL_TOP_RIGHT;
+    } else if (x + size < 4) {
+        /* Blocks inside the macroblock are there when decoded before this one */
+        int right = x + size, top = y - 1;
+        int right_index = (top >> 1) * 8 + (right >> 1) * 4 + (top & 1) * 2 + (right & 1);
+        int index = (y >> 1) * 8 + (x >> 1) * 4 + (y & 1) * 2 + (x & 1);
+
+        if (right_index < index)
+            avail |= H264_AVAIL_TOP_RIGHT;
+    }
+    return avail;
+}
+
+/* 8.3.1.1 and 8.3.2.1, reads the NxN prediction modes in blocks of size 1 or 2 */
+static void
+h264_decode_intra_modes(struct h264_picture *pic, int size)
+{
+    struct h264_mb *mb = pic->mb;
+    int i, n = size == 1 ? 16 : 4;
+
+    for (i = 0; i < n; i++) {
+        int x = size == 1 ? h264_block_x[i] : (i & 1) * 2;
+        int y = size == 1 ? h264_block_y[i] : (i >> 1) * 2;
+        int mode_a = -1, mode_b = -1, mode;
+
+        if (x > 0)
+            mode_a = mb->intra_mode[y * 4 + x - 1];
+        else if (pic->recon->intra_avail & H264_AVAIL_LEFT)
+            mode_a = pic->mb_left->intra_mode[y * 4 + 3];
+        if (y > 0)
+            mode_b = mb->intra_mode[(y - 1) * 4 + x];
+        else if (pic->recon->intra_avail & H264_AVAIL_TOP)
+            mode_b = pic->mb_top->intra_mode[12 + x];
+        mode = mode_a < 0 || mode_b < 0 ? 2 : (mode_a < mode_b ? mode_a : mode_b);
+
+        if (pic->cabac) {
+            if (!h264_cabac_decode(&pic->cabac_engine, 68)) {
+                int rem = h264_cabac_decode(&pic->cabac_engine, 69);
+
+                rem |= h264_cabac_decode(&pic->cabac_engine, 69) << 1;
+                rem |= h264_cabac_decode(&pic->cabac_engine, 69) << 2;
+                mode = rem < mode ? rem : rem + 1;
+            }
+        } else if (!bitstream_get_bit(&pic->bs)) {
+            int rem = bitstream_get_bits(&pic->bs, 3);
+
+            mode = rem < mode ? rem : rem + 1;
+        }
+        mb->intra_mode[y * 4 + x] = mode;
+        if (size == 2)
+            mb->intra_mode[y * 4 + x + 1] = mb->intra_mode[y * 4 + x + 4] = mb->intra_mode[y * 4 + x + 5] = mode;
+    }
+}
+
+/* Whether an Intra16x16 or chroma prediction mode has the neighbours it needs */
+static int
+h264_intra_mode_valid(int avail, int needs_left, int needs_top)
+{
+    if (needs_left && !(avail & H264_AVAIL_LEFT))
+        return 0;
+    if (needs_top && !(avail & H264_AVAIL_TOP))
+        return 0;
+    if (needs_left && needs_top && !(avail & H264_AVAIL_TOP_LEFT))
+        return 0;
+    return 1;
+}
+
+/* Whether the Intra16x16 and chroma prediction modes of the macroblock have their neighbours */
+static int
+h264_intra_modes_valid(const struct h264_picture *pic)
+{
+    const struct h264_mb_recon *recon = pic->recon;
+    int avail = recon->intra_avail;
+    int luma_mode = recon->luma_mode, chroma_mode = recon->chroma_mode;
+
+    /* Chroma DC, horizontal, vertical and plane; Intra16x16 vertical, horizontal, DC and plane */
+    if (!h264_intra_mode_valid(avail, chroma_mode == H264_PRED_CHROMA_H || chroma_mode == H264_PRED_CHROMA_PLANE,
+                               chroma_mode == H264_PRED_CHROMA_V || chroma_mode == H264_PRED_CHROMA_PLANE))
+        return 0;
+    if ((pic->mb->type & H264_MB_INTRA16x16) &&
+        !h264_intra_mode_valid(avail, luma_mode == H264_PRED16_H || luma_mode == H264_PRED16_PLANE,
+                               luma_mode == H264_PRED16_V || luma_mode == H264_PRED16_PLANE))
+        return 0;
+    return 1;
+}
+
+/* Intra prediction and residual of an intra macroblock other than I_PCM */
+static void
+h264_intra_reconstruct(struct h264_picture *pic)
+{
+    const struct h264_dsp_ops *dsp = pic->dsp;
+    ptrdiff_t stride = pic->stride;
+    struct h264_mb *mb = pic->mb;
+    int avail = pic->recon->intra_avail;
+    int i;
+
+    if (mb->type & H264_MB_INTRA16x16) {
+        dsp->pred16x16[pic->recon->luma_mode](pic->dst_y, stride, avail);
+        h264_add_luma_residual(pic);
+    } else if (mb->type & H264_MB_INTRA8x8) {
+        for (i = 0; i < 4; i++) {
+            int x = (i & 1) * 2, y = (i >> 1) * 2;
+            uint8_t *dst = pic->dst_y + 4 * y * stride + 4 * x;
+
+            dsp->pred8x8[mb->intra_mode[y * 4 + x]](dst, stride, h264_block_avail(pic, x, y, 2));
+            if (pic->recon->luma_coded & (1 << (y * 4 + x)))
+                dsp->idct8_add(dst, stride, pic->recon->luma + 64 * i);
+        }
+    } else {
+        for (i = 0; i < 16; i++) {
+            int x = h264_block_x[i], y = h264_block_y[i], block = y * 4 + x;
+            uint8_t *dst = pic->dst_y + 4 * y * stride + 4 * x;
+
+            dsp->pred4x4[mb->intra_mode[block]](dst, stride, h264_block_avail(pic, x, y, 1));
+            if (pic->recon->luma_coded & (1 << block))
+                dsp->idct4_add(dst, stride, pic->recon->luma + 16 * block);
+        }
+    }
+    dsp->pred_chroma[pic->recon->chroma_mode](pic->dst_uv, stride, avail);
+    h264_add_chroma_residual(pic);
+}
+
+/* pcm_sample_luma and pcm_sample_chroma */
+static int
+h264_decode_pcm(struct h264_picture *pic)
+{
+    struct bitstream *bs = &pic->bs;
+    int x, y, c;
+
+    bitstream_byte_align(bs);
+    if (bitstream_bits_left(bs) < 384 * 8)
+        return -1;
+    for (y = 0; y < 16; y++) {
+        for (x = 0; x < 16; x++)
+            pic->dst_y[y * pic->stride + x] = bitstream_get_bits(bs, 8);
+    }
+    for (c = 0; c < 2; c++) {
+        for (y = 0; y < 8; y++) {
+            for (x = 0; x < 8; x++)
+                pic->dst_uv[y * pic->stride + 2 * x + c] = bitstream_get_bits(bs, 8);
+        }
+    }
+    memset(pic->mb->non_zero, 16, sizeof(pic->mb->non_zero));
+    pic->mb->coded = 0xffff;
+    pic->mb->cbp = 0x2f;
+    pic->mb->coded_dc = 7;
+    /* 9.3.1.2, the arithmetic decoder starts over after the samples */
+    if (pic->cabac)
+        h264_cabac_init_engine(&pic->cabac_engine, bs);
+    return 0;
+}
+
+/* Sets the macroblock state up for the macroblock at addr */
+static void
+h264_start_macroblock(struct h264_picture *pic, int addr)
+{
+    struct h264_mb *mbs = pic->slot->mbs;
+    int width = pic->mb_width;
+
+    pic->mb_x = addr % width;
+    pic->mb_y = addr / width;
+    pic->mb = &mbs[addr];
+    pic->mb->slice = pic->slice_num;
+    /* Neighbours in other slices may be decoded by another thread right now, so don't look at them */
+    pic->mb_left = pic->mb_x > 0 && addr - 1 >= pic->first_mb ? &mbs[addr - 1] : NULL;
+    pic->mb_top = pic->mb_y > 0 && addr - width >= pic->first_mb ? &mbs[addr - width] : NULL;
+    pic->mb_top_right = pic->mb_y > 0 && pic->mb_x < width - 1 &&
+                        addr - width + 1 >= pic->first_mb ? &mbs[addr - width + 1] : NULL;
+    pic->mb_top_left = pic->mb_y > 0 && pic->mb_x > 0 &&
+                       addr - width - 1 >= pic->first_mb ? &mbs[addr - width - 1] : NULL;
+    pic->dst_y = pic->y + pic->mb_y * 16 * pic->stride + pic->mb_x * 16;
+    pic->dst_uv = pic->uv + pic->mb_y * 8 * pic->stride + pic->mb_x * 16;
+    pic->mb->cbp = 0;
+    pic->mb->coded_dc = 0;
+    pic->mb->chroma_mode = 0;
+    pic->mb->direct = 0;
+    if (pic->cabac)
+        memset(pic->mb->mvd, 0, sizeof(pic->mb->mvd));
+    if (pic->deferred)
+        pic->recon = &pic->slot->recon[addr];
+    pic->recon->luma_coded = 0;
+    pic->recon->chroma_coded = 0;
+    pic->recon->pending = 0;
+}
+
+static inline int
+h264_intra_neighbour(const struct h264_picture *pic, const struct h264_mb *mb)
+{
+    return mb && (!pic->constrained_intra_pred || (mb->type & H264_MB_INTRA));
+}
+
+/* Prediction and residual of a parsed macroblock other than I_PCM */
+static void
+h264_reconstruct_macroblock(struct h264_picture *pic)
+{
+    if (pic->mb->type & H264_MB_INTRA) {
+        h264_intra_reconstruct(pic);
+        return;
+    }
+    h264_inter_predict(pic);
+    h264_add_luma_residual(pic);
+    h264_add_chroma_residual(pic);
+}
+
+/* Reconstructs the parsed macroblock, or leaves it to the pool */
+static void
+h264_finish_macroblock(struct h264_picture *pic)
+{
+    if (pic->deferred)
+        pic->recon->pending = 1;
+    else
+        h264_reconstruct_macroblock(pic);
+}
+
+/* P_Skip and B_Skip, once h264_start_macroblock() set the macroblock up */
+static void
+h264_skip_macroblock(struct h264_picture *pic)
+{
+    static const struct h264_partition mb_part = { 0, 0, 4, 4, H264_PRED_L0 };
+    struct h264_mb *mb = pic->mb;
+
+    mb->type = H264_MB_INTER | H264_MB_SKIP;
+    mb->qp = pic->qp;
+    mb->coded = 0;
+    memset(mb->non_zero, 0, sizeof(mb->non_zero));
+    memset(mb->intra_mode, 2, sizeof(mb->intra_mode));
+
+    h264_fill_motion_cache(pic);
+    pic->recon->num_parts = 0;
+    if (pic->slice_type == H264_SLICE_P) {
+        h264_predict_p_skip(pic, &mb_part);
+        h264_add_partition(pic, 0, 0, 4, 4, H264_PRED_L0);
+    } else {
+        mb->type |= H264_MB_DIRECT;
+        mb->direct = 0xf;
+        h264_predict_direct(pic);
+        h264_set_direct_motion(pic, 0, &mb_part);
+        h264_set_direct_motion(pic, 1, &mb_part);
+        h264_add_direct_partitions(pic, -1);
+    }
+    h264_save_motion(pic);
+    pic->last_qp_delta = 0;
+    h264_finish_macroblock(pic);
+}
+
+/* macroblock_layer() once h264_start_macroblock() set the macroblock up, returns -1 on errors */
+static int
+h264_decode_macroblock(struct h264_picture *pic)
+{
+    struct bitstream *bs = &pic->bs;
+    struct h264_mb *mb = pic->mb;
+    unsigned int mb_type, code;
+    int cbp = 0, chroma_mode = 0;
+
+    mb->qp = pic->qp;
+    memset(mb->intra_mode, 2, sizeof(mb->intra_mode));
+    mb_type = pic->cabac ? h264_cabac_mb_type(pic) : bitstream_get_ue(bs);
+
+    if ((pic->slice_type == H264_SLICE_P && mb_type < 5) ||
+        (pic->slice_type == H264_SLICE_B && mb_type < 23)) {
+        int pred[2], shape, all_8x8;
+
+        mb->type = H264_MB_INTER;
+        h264_fill_motion_cache(pic);
+        if (pic->slice_type == H264_SLICE_B && mb_type == 0) {
+            static const struct h264_partition mb_part = { 0, 0, 4, 4, H264_PRED_DIRECT };
+
+            mb->type |= H264_MB_DIRECT;
+            mb->direct = 0xf;
+            h264_predict_direct(pic);
+            h264_set_direct_motion(pic, 0, &mb_part);
+            h264_set_direct_motion(pic, 1, &mb_part);
+            pic->recon->num_parts = 0;
+            h264_add_direct_partitions(pic, -1);
+            all_8x8 = pic->direct_8x8_inference;
+        } else {
+            if (pic->slice_type == H264_SLICE_B) {
+                /* B_8x8 takes its predictions from the sub-macroblock types */
+                shape = mb_type == 22 ? 3 : h264_b_mb_types[mb_type][0];
+                pred[0] = mb_type == 22 ? 0 : h264_b_mb_types[mb_type][1];
+                pred[1] = mb_type == 22 ? 0 : h264_b_mb_types[mb_type][2];
+            } else {
+                shape = mb_type < 3 ? mb_type : 3;
+                pred[0] = pred[1] = H264_PRED_L0;
+            }
+            all_8x8 = h264_decode_motion(pic, shape, pred, mb_type == 4 && pic->slice_type == H264_SLICE_P);
+            if (all_8x8 < 0)
+                return -1;
+        }
+        h264_save_motion(pic);
+
+        if (pic->cabac) {
+            cbp = h264_cabac_cbp(pic);
+        } else {
+            code = bitstream_get_ue(bs);
+            if (code > 47)
+                return -1;
+            cbp = h264_inter_cbp[code];
+        }
+        if ((cbp & 15) && pic->transform_8x8_mode && all_8x8 &&
+            (pic->cabac ? h264_cabac_transform_8x8(pic) : bitstream_get_bit(bs)))
+            mb->type |= H264_MB_TRANSFORM8x8;
+    } else {
+        if (pic->slice_type != H264_SLICE_I)
+            mb_type -= pic->slice_type == H264_SLICE_P ? 5 : 23;
+        if (mb_type > 25)
+            return -1;
+        h264_save_intra_motion(pic);
+        pic->recon->intra_avail = (h264_intra_neighbour(pic, pic->mb_left) ? H264_AVAIL_LEFT : 0) |
+                           (h264_intra_neighbour(pic, pic->mb_top) ? H264_AVAIL_TOP : 0) |
+                           (h264_intra_neighbour(pic, pic->mb_top_right) ? H264_AVAIL_TOP_RIGHT : 0) |
+                           (h264_intra_neighbour(pic, pic->mb_top_left) ? H264_AVAIL_TOP_LEFT : 0);
+        if (mb_type == 25) {
+            mb->type = H264_MB_PCM;
+            mb->qp = 0;
+            pic->last_qp_delta = 0;
+            return h264_decode_pcm(pic);
+        }
+        if (mb_type == 0) {
+            mb->type = H264_MB_INTRA4x4;
+            if (pic->transform_8x8_mode && (pic->cabac ? h264_cabac_transform_8x8(pic) : bitstream_get_bit(bs)))
+                mb->type = H264_MB_INTRA8x8 | H264_MB_TRANSFORM8x8;
+            h264_decode_intra_modes(pic, mb->type & H264_MB_INTRA8x8 ? 2 : 1);
+        } else {
+            mb->type = H264_MB_INTRA16x16;
+            pic->recon->luma_mode = (mb_type - 1) % 4;
+            cbp = (((mb_type - 1) / 4) % 3) << 4 | (mb_type >= 13 ? 15 : 0);
+        }
+        chroma_mode = pic->cabac ? h264_cabac_chroma_mode(pic) : (int) bitstream_get_ue(bs);
+        if (chroma_mode > 3)
+            return -1;
+        pic->recon->chroma_mode = chroma_mode;
+        mb->chroma_mode = chroma_mode;
+        if (!(mb->type & H264_MB_INTRA16x16)) {
+            if (pic->cabac) {
+                cbp = h264_cabac_cbp(pic);
+            } else {
+                code = bitstream_get_ue(bs);
+                if (code > 47)
+                    return -1;
+                cbp = h264_intra_cbp[code];
+            }
+        }
+    }
+    mb->cbp = cbp;
+
+    if (cbp || (mb->type & H264_MB_INTRA16x16)) {
+        int delta = pic->cabac ? h264_cabac_qp_delta(pic) : bitstream_get_se(bs);
+
+        if (delta < -26 || delta > 25)
+            return -1;
+        pic->last_qp_delta = delta;
+        pic->qp = (pic->qp + delta + 52) % 52;
+        mb->qp = pic->qp;
+        if (h264_decode_residual(pic, cbp) < 0)
+            goto error;
+    } else {
+        memset(mb->non_zero, 0, sizeof(mb->non_zero));
+        mb->coded = 0;
+        pic->last_qp_delta = 0;
+    }
+    if ((mb->type & H264_MB_INTRA) && !h264_intra_modes_valid(pic))
+        goto error;
+    h264_finish_macroblock(pic);
+    return 0;
+
+error:
+    /* The residual is left zeroed for the next macroblock */
+    memset(pic->recon->luma, 0, sizeof(pic->recon->luma));
+    memset(pic->recon->chroma, 0, sizeof(pic->recon->chroma));
+    return -1;
+}
+
+static inline int
+h264_mv_differs(const int16_t *a, const int16_t *b)
+{
+    return abs(a[0] - b[0]) >= 4 || abs(a[1] - b[1]) >= 4;
+}
+
+/* 8.7.2.1, bS of the edge between 4x4 luma block p of mb_p and q of mb_q for inter macroblocks */
+static int
+h264_inter_strength(const struct h264_mb *mb_p, const struct h264_motion *p, int block_p,
+                    const struct h264_mb *mb_q, const struct h264_motion *q, int block_q)
+{
+    int p8 = (block_p >> 3) * 2 + ((block_p & 3) >> 1), q8 = (block_q >> 3) * 2 + ((block_q & 3) >> 1);
+    VASurfaceID p0 = p->ref_pic[0][p8], p1 = p->ref_pic[1][p8];
+    VASurfaceID q0 = q->ref_pic[0][q8], q1 = q->ref_pic[1][q8];
+    const int16_t *mv_p0 = p->mv[0][block_p], *mv_p1 = p->mv[1][block_p];
+    const int16_t *mv_q0 = q->mv[0][block_q], *mv_q1 = q->mv[1][block_q];
+
+    if (((mb_p->coded >> block_p) & 1) || ((mb_q->coded >> block_q) & 1))
+        return 2;
+    if (!((p0 == q0 && p1 == q1) || (p0 == q1 && p1 == q0)))
+        return 1;
+    if (p0 != p1) {
+        if (p0 == q0)
+            return h264_mv_differs(mv_p0, mv_q0) || h264_mv_differs(mv_p1, mv_q1);
+        return h264_mv_differs(mv_p0, mv_q1) || h264_mv_differs(mv_p1, mv_q0);
+    }
+    /* Both lists predict from the same picture, either pairing may match */
+    return (h264_mv_differs(mv_p0, mv_q0) || h264_mv_differs(mv_p1, mv_q1)) &&
+           (h264_mv_differs(mv_p0, mv_q1) || h264_mv_differs(mv_p1, mv_q0));
+}
+
+/*
+ * 8.7, filters the edges of one macroblock, left and top macroblock
+ * edges only when filter_left and filter_top
+ */
+static void
+h264_deblock_macroblock(struct h264_picture *pic, int addr, const struct h264_slice_info *info,
+                        int filter_left, int filter_top)
+{
+    const struct h264_dsp_ops *dsp = pic->dsp;
+    const struct h264_mb *mbs = pic->slot->mbs;
+    const struct h264_mb *mb = &mbs[addr];
+    const struct h264_motion *motion = pic->motion + addr;
+    int mb_x = addr % pic->mb_width, mb_y = addr / pic->mb_width;
+    uint8_t *y = pic->y + mb_y * 16 * pic->stride + mb_x * 16;
+    uint8_t *uv = pic->uv + mb_y * 8 * pic->stride + mb_x * 16;
+    ptrdiff_t stride = pic->stride;
+    int dir, edge, i, c;
+
+    for (dir = 0; dir < 2; dir++) {
+        for (edge = 0; edge < 4; edge++) {
+            const struct h264_mb *mb_p = mb;
+            const struct h264_motion *motion_p = motion;
+            int strength[4], qp_p, qp_av, index_a, index_b, alpha, beta;
+            int8_t tc0[4];
+
+            if (edge == 0) {
+                if (!(dir ? filter_top : filter_left))
+                    continue;
+                mb_p = dir ? mb - pic->mb_width : mb - 1;
+                motion_p = dir ? motion - pic->mb_width : motion - 1;
+            } else if ((edge & 1) && (mb->type & H264_MB_TRANSFORM8x8)) {
+                continue;
+            }
+
+            for (i = 0; i < 4; i++) {
+                int block_q = dir ? edge * 4 + i : i * 4 + edge;
+                int block_p = edge ? block_q - (dir ? 4 : 1) : (dir ? 12 + i : i * 4 + 3);
+
+                if ((mb->type & H264_MB_INTRA) || (mb_p->type & H264_MB_INTRA))
+                    strength[i] = edge ? 3 : 4;
+                else
+                    strength[i] = h264_inter_strength(mb_p, motion_p, block_p, mb, motion, block_q);
+            }
+            if (!(strength[0] | strength[1] | strength[2] | strength[3]))
+                continue;
+
+            qp_p = mb_p->qp;
+            qp_av = (qp_p + mb->qp + 1) >> 1;
+            index_a = h264_clip3(0, 51, qp_av + info->alpha_offset);
+            index_b = h264_clip3(0, 51, qp_av + info->beta_offset);
+            alpha = h264_alpha[index_a];
+            beta = h264_beta[index_b];
+            if (alpha && beta) {
+                uint8_t *pix = y + (dir ? edge * 4 * stride : edge * 4);
+
+                if (strength[0] == 4) {
+                    dsp->luma_filter_intra[dir](pix, stride, alpha, beta);
+                } else {
+                    for (i = 0; i < 4; i++)
+                        tc0[i] = strength[i] ? h264_tc0[index_a][strength[i] - 1] : -1;
+                    dsp->luma_filter[dir](pix, stride, alpha, beta, tc0);
+                }
+            }
+
+            if (edge & 1)
+                continue;
+            {
+                int chroma_alpha[2], chroma_beta[2];
+                int8_t chroma_tc0[2][4];
+                uint8_t *pix = uv + (dir ? edge * 2 * stride : edge * 4);
+
+                for (c = 0; c < 2; c++) {
+                    qp_av = (pic->chroma_qp[c][qp_p] + pic->chroma_qp[c][mb->qp] + 1) >> 1;
+                    index_a = h264_clip3(0, 51, qp_av + info->alpha_offset);
+                    index_b = h264_clip3(0, 51, qp_av + info->beta_offset);
+                    chroma_alpha[c] = h264_alpha[index_a];
+                    chroma_beta[c] = h264_beta[index_b];
+                    for (i = 0; i < 4; i++)
+                        chroma_tc0[c][i] = strength[i] && strength[i] < 4 ? h264_tc0[index_a][strength[i] - 1] : -1;
+                }
+                if (!(chroma_alpha[0] && chroma_beta[0]) && !(chroma_alpha[1] && chroma_beta[1]))
+                    continue;
+                if (strength[0] == 4)
+                    dsp->chroma_filter_intra[dir](pix, stride, chroma_alpha, chroma_beta);
+                else
+                    dsp->chroma_filter[dir](pix, stride, chroma_alpha, chroma_beta,
+                                            (const int8_t (*)[4]) chroma_tc0);
+            }
+        }
+    }
+}
+
+/* The deblocking filter of macroblock addr if it was decoded and its slice has it on */
+static void
+h264_deblock_address(struct h264_picture *pic, int addr)
+{
+    const struct h264_mb *mbs = pic->slot->mbs;
+    const struct h264_mb *mb = &mbs[addr];
+    const struct h264_slice_info *info;
+    int width = pic->mb_width;
+    int filter_left, filter_top;
+
+    if (mb->slice == H264_NO_SLICE)
+        return;
+    info = &pic->slot->slices[mb->slice];
+    if (info->disable_deblocking_filter_idc == 1)
+        return;
+    filter_left = addr % width > 0 && mbs[addr - 1].slice != H264_NO_SLICE &&
+                  (info->disable_deblocking_filter_idc != 2 || mbs[addr - 1].slice == mb->slice);
+    filter_top = addr >= width && mbs[addr - width].slice != H264_NO_SLICE &&
+                 (info->disable_deblocking_filter_idc != 2 || mbs[addr - width].slice == mb->slice);
+    h264_deblock_macroblock(pic, addr, info, filter_left, filter_top);
+}
+
+/* The deblocking filter over the decoded macroblocks of the picture in raster order */
+static void
+h264_deblock_picture(struct h264_picture *pic)
+{
+    int addr;
+
+    for (addr = 0; addr < pic->mb_width * pic->mb_height; addr++)
+        h264_deblock_address(pic, addr);
+}
+
+/* Reconstructs macroblock addr from its record if it was parsed */
+static void
+h264_reconstruct_address(struct h264_picture *pic, int addr)
+{
+    struct h264_slot *slot = pic->slot;
+    int x = addr % pic->mb_width, y = addr / pic->mb_width;
+
+    pic->recon = &slot->recon[addr];
+    if (slot->mbs[addr].slice == H264_NO_SLICE || !pic->recon->pending)
+        return;
+    pic->mb_x = x;
+    pic->mb_y = y;
+    pic->mb = &slot->mbs[addr];
+    pic->slice = &slot->slices[pic->mb->slice];
+    pic->dst_y = pic->y + y * 16 * pic->stride + x * 16;
+    pic->dst_uv = pic->uv + y * 8 * pic->stride + x * 16;
+    if (!(pic->mb->type & H264_MB_INTRA))
+        h264_load_motion(pic);
+    h264_reconstruct_macroblock(pic);
+    pic->recon->pending = 0;
+}
+
+/* Wavefront callback reconstructing macroblock (x, y) once parsed */
+static void
+h264_reconstruct_task(void *data, int x, int y)
+{
+    struct h264_slot *slot = data;
+
+    h264_reconstruct_address(&slot->rows[y], y * slot->rows[y].mb_width + x);
+}
+
+/*
+ * Wavefront callback deblocking macroblock (x, y). The filter reaches
+ * into the macroblocks to the left and above, which the one above and to
+ * the right of this one filters last.
+ */
+static void
+h264_deblock_task(void *data, int x, int y)
+{
+    struct h264_slot *slot = data;
+
+    h264_deblock_address(&slot->rows[y], y * slot->rows[y].mb_width + x);
+}
+
+/*
+ * Copies a NAL unit to an RBSP buffer without its emulation prevention
+ * bytes, returns the size or 0 on allocation failure
+ */
+static size_t
+h264_unescape(struct h264_rbsp *rbsp, const uint8_t *data, size_t size)
+{
+    size_t i, n = 0;
+    int zeros = 0;
+
+    if (rbsp->size < size) {
+        uint8_t *buffer = realloc(rbsp->data, size);
+
+        if (NULL == buffer)
+            return 0;
+        rbsp->data = buffer;
+        rbsp->size = size;
+    }
+    for (i = 0; i < size; i++) {
+        if (zeros >= 2 && data[i] == 3) {
+            zeros = 0;
+            continue;
+        }
+        rbsp->data[n++] = data[i];
+        zeros = data[i] ? 0 : zeros + 1;
+    }
+    return n;
+}
+
+/* Sets the slice state up, returns -1 for slices this decoder cannot handle */
+static int
+h264_init_slice(struct epiphany_driver_data *driver_data, struct h264_picture *pic,
+                const VASliceParameterBufferH264 *slice_param)
+{
+    const VAPictureParameterBufferH264 *pic_param = pic->pic_param;
+    int num_lists, list, i, j;
+
+    pic->slice_type = slice_param->slice_type % 5;
+    if (pic->slice_type > H264_SLICE_I)
+        return -1;
+    pic->qp = 26 + pic_param->pic_init_qp_minus26 + (signed char) slice_param->slice_qp_delta;
+    if (pic->qp < 0 || pic->qp > 51)
+        return -1;
+    pic->direct_spatial = slice_param->direct_spatial_mv_pred_flag;
+    num_lists = pic->slice_type == H264_SLICE_B ? 2 : (pic->slice_type == H264_SLICE_P ? 1 : 0);
+    pic->num_ref_idx[0] = num_lists > 0 ? slice_param->num_ref_idx_l0_active_minus1 + 1 : 0;
+    pic->num_ref_idx[1] = num_lists > 1 ? slice_param->num_ref_idx_l1_active_minus1 + 1 : 0;
+    if (pic->num_ref_idx[0] > H264_MAX_REFS || pic->num_ref_idx[1] > H264_MAX_REFS)
+        return -1;
+    for (list = 0; list < num_lists; list++) {
+        const VAPictureH264 *ref_list = list ? slice_param->RefPicList1 : slice_param->RefPicList0;
+
+        for (i = 0; i < pic->num_ref_idx[list]; i++)
+            h264_lookup_reference(driver_data, pic, &ref_list[i], &pic->slice->refs[list][i]);
+    }
+
+    pic->col_motion = NULL;
+    if (pic->slice_type == H264_SLICE_B) {
+        struct h264_frame *frame = h264_find_frame(pic->decoder, pic->slice->refs[1][0].surface);
+
+        if (frame && frame->motion != pic->motion)
+            pic->col_motion = frame->motion;
+    }
+
+    /* 8.4.1.2.3 and 8.4.2.3.1, scaling by POC distance for temporal direct and implicit weights */
+    for (i = 0; i < pic->num_ref_idx[0] && num_lists > 1; i++) {
+        for (j = 0; j < pic->num_ref_idx[1]; j++) {
+            const struct h264_reference *ref0 = &pic->slice->refs[0][i], *ref1 = &pic->slice->refs[1][j];
+            int tb = h264_clip3(-128, 127, pic->poc - ref0->poc);
+            int td = h264_clip3(-128, 127, ref1->poc - ref0->poc);
+            int scale = INT32_MIN;
+
+            if (!ref0->long_term && !ref1->long_term && td) {
+                int tx = (16384 + abs(td / 2)) / td;
+
+                scale = h264_clip3(-1024, 1023, (tb * tx + 32) >> 6);
+            }
+            if (j == 0)
+                pic->dist_scale_factor[i] = ref0->long_term || !td ? INT32_MIN : scale;
+            pic->slice->implicit_weight[i][j] = scale == INT32_MIN || (scale >> 2) < -64 || (scale >> 2) > 128 ?
+                                         32 : scale >> 2;
+        }
+    }
+
+    pic->slice->weight_mode = 0;
+    if ((pic->slice_type == H264_SLICE_P && pic_param->pic_fields.bits.weighted_pred_flag) ||
+        (pic->slice_type == H264_SLICE_B && pic_param->pic_fields.bits.weighted_bipred_idc == 1)) {
+        pic->slice->weight_mode = 1;
+        pic->slice->luma_log2_denom = slice_param->luma_log2_weight_denom & 7;
+        pic->slice->chroma_log2_denom = slice_param->chroma_log2_weight_denom & 7;
+        for (list = 0; list < num_lists; list++) {
+            int luma_flag = list ? slice_param->luma_weight_l1_flag : slice_param->luma_weight_l0_flag;
+            int chroma_flag = list ? slice_param->chroma_weight_l1_flag : slice_param->chroma_weight_l0_flag;
+
+            for (i = 0; i < pic->num_ref_idx[list]; i++) {
+                pic->slice->luma_weight[list][i][0] = 1 << pic->slice->luma_log2_denom;
+                pic->slice->luma_weight[list][i][1] = 0;
+                if (luma_flag) {
+                    pic->slice->luma_weight[list][i][0] = list ? slice_param->luma_weight_l1[i] : slice_param->luma_weight_l0[i];
+                    pic->slice->luma_weight[list][i][1] = list ? slice_param->luma_offset_l1[i] : slice_param->luma_offset_l0[i];
+                }
+                for (j = 0; j < 2; j++) {
+                    pic->slice->chroma_weight[list][i][j][0] = 1 << pic->slice->chroma_log2_denom;
+                    pic->slice->chroma_weight[list][i][j][1] = 0;
+                    if (chroma_flag) {
+                        pic->slice->chroma_weight[list][i][j][0] = list ? slice_param->chroma_weight_l1[i][j] :
+                                                                   slice_param->chroma_weight_l0[i][j];
+                        pic->slice->chroma_weight[list][i][j][1] = list ? slice_param->chroma_offset_l1[i][j] :
+                                                                   slice_param->chroma_offset_l0[i][j];
+                    }
+                }
+            }
+        }
+    } else if (pic->slice_type == H264_SLICE_B && pic_param->pic_fields.bits.weighted_bipred_idc == 2) {
+        pic->slice->weight_mode = 2;
+    }
+    return 0;
+}
+
+/*
+ * slice_data() with CABAC from macroblock addr, the bitstream at its
+ * start. Each macroblock ends in end_of_slice_flag; the arithmetic
+ * decoder reads up to the rbsp_stop_one_bit and no further, so reading
+ * past it means the data is damaged.
+ */
+static void
+h264_decode_cabac_slice(struct h264_picture *pic, const VASliceParameterBufferH264 *slice_param, int addr)
+{
+    bitstream_byte_align(&pic->bs);     /* cabac_alignment_one_bit */
+    h264_cabac_init_contexts(&pic->cabac_engine, pic->slice_type == H264_SLICE_I, slice_param->cabac_init_idc % 3, pic->qp);
+    h264_cabac_init_engine(&pic->cabac_engine, &pic->bs);
+    pic->last_qp_delta = 0;
+    for (;;) {
+        h264_start_macroblock(pic, addr);
+        if (pic->slice_type != H264_SLICE_I && h264_cabac_skip(pic))
+            h264_skip_macroblock(pic);
+        else if (h264_decode_macroblock(pic) < 0)
+            break;
+        addr++;
+        if (pic->wavefront)
+            wavefront_set_available(pic->wavefront, addr);
+        if (addr >= pic->end_mb || pic->bs.pos > pic->end_bit + 1 || h264_cabac_terminate(&pic->cabac_engine))
+            break;
+    }
+}
+
+/* Decodes the macroblocks of one slice until its data ends or is found damaged */
+static void
+h264_decode_slice(struct epiphany_driver_data *driver_data, struct h264_picture *pic,
+                  const VASliceParameterBufferH264 *slice_param, const uint8_t *data)
+{
+    struct h264_slot *slot = pic->slot;
+    size_t size = slice_param->slice_data_size, rbsp_size;
+    int end_mb = pic->end_mb;
+    int addr = slice_param->first_mb_in_slice;
+
+    data += slice_param->slice_data_offset;
+    /* Clients may or may not leave the start code in */
+    if (size >= 4 && !data[0] && !data[1] && !data[2] && data[3] == 1) {
+        data += 4;
+        size -= 4;
+    } else if (size >= 3 && !data[0] && !data[1] && data[2] == 1) {
+        data += 3;
+        size -= 3;
+    }
+    rbsp_size = h264_unescape(pic->rbsp, data, size);
+    while (rbsp_size > 0 && pic->rbsp->data[rbsp_size - 1] == 0)
+        rbsp_size--;
+    if (rbsp_size == 0 || addr >= end_mb || pic->num_slices >= slot->max_slices)
+        return;
+    /* Reconstruction behind parsing must not go back over published macroblocks */
+    if (pic->wavefront && addr < pic->wavefront->available)
+        return;
+    pic->end_bit = rbsp_size * 8 - 1 - __builtin_ctz(pic->rbsp->data[rbsp_size - 1]);
+    if (slice_param->slice_data_bit_offset >= pic->end_bit)
+        return;
+    pic->slice = &slot->slices[pic->num_slices];
+    if (h264_init_slice(driver_data, pic, slice_param) < 0)
+        return;
+    pic->slice->disable_deblocking_filter_idc = slice_param->disable_deblocking_filter_idc;
+    pic->slice->alpha_offset = 2 * (signed char) slice_param->slice_alpha_c0_offset_div2;
+    pic->slice->beta_offset = 2 * (signed char) slice_param->slice_beta_offset_div2;
+    pic->slice_num = pic->num_slices++;
+    pic->first_mb = addr;
+
+    bitstream_init(&pic->bs, pic->rbsp->data, rbsp_size, slice_param->slice_data_bit_offset);
+    if (pic->cabac) {
+        h264_decode_cabac_slice(pic, slice_param, addr);
+        return;
+    }
+    for (;;) {
+        if (pic->slice_type != H264_SLICE_I) {
+            uint32_t run = bitstream_get_ue(&pic->bs);
+
+            if (run > (uint32_t) (end_mb - addr))
+                break;
+            while (run--) {
+                h264_start_macroblock(pic, addr++);
+                h264_skip_macroblock(pic);
+            }
+            if (pic->wavefront)
+                wavefront_set_available(pic->wavefront, addr);
+            if (addr >= end_mb || pic->bs.pos >= pic->end_bit)
+                break;
+        }
+        h264_start_macroblock(pic, addr);
+        if (h264_decode_macroblock(pic) < 0)
+            break;
+        addr++;
+        if (pic->wavefront)
+            wavefront_set_available(pic->wavefront, addr);
+        if (addr >= end_mb || pic->bs.pos >= pic->end_bit)
+            break;
+    }
+}
+
+/* Sets pic up from the parameter buffers rendered into picture */
+static VAStatus
+h264_init_picture(struct epiphany_driver_data *driver_data, const struct epiphany_picture *picture,
+                  object_surface_p obj_surface, struct h264_picture *pic)
+{
+    const VAPictureParameterBufferH264 *pic_param;
+    object_buffer_p obj_buffer;
+    int c, qp;
+
+    obj_buffer = BUFFER(picture->pic_param);
+    if (NULL == obj_buffer || obj_buffer->element_size < sizeof(*pic_param) || NULL == obj_surface->storage)
+        return VA_STATUS_ERROR_INVALID_PARAMETER;
+    pic_param = obj_buffer->buffer_data;
+    if (pic_param->seq_fields.bits.chroma_format_idc != 1 ||
+        pic_param->bit_depth_luma_minus8 || pic_param->bit_depth_chroma_minus8 ||
+        pic_param->pic_fields.bits.field_pic_flag ||
+        pic_param->seq_fields.bits.mb_adaptive_frame_field_flag)
+        return VA_STATUS_ERROR_UNIMPLEMENTED;
+
+    memset(pic, 0, sizeof(*pic));
+    pic->dsp = driver_data->h264_dsp_ops;
+    pic->recon = &pic->mb_recon;
+    pic->pic_param = pic_param;
+    pic->mb_width = pic_param->picture_width_in_mbs_minus1 + 1;
+    pic->mb_height = pic_param->picture_height_in_mbs_minus1 + 1;
+    pic->end_mb = pic->mb_width * pic->mb_height;
+    pic->width = pic->mb_width * 16;
+    pic->height = pic->mb_height * 16;
+    if (pic->width > obj_surface->storage->pitch || pic->height > obj_surface->storage->luma_height)
+        return VA_STATUS_ERROR_INVALID_PARAMETER;
+    pic->y = obj_surface->storage->data;
+    pic->uv = obj_surface->storage->data + obj_surface->storage->chroma_offset;
+    pic->stride = obj_surface->storage->pitch;
+    pic->poc = h264_poc(&pic_param->CurrPic);
+    pic->transform_8x8_mode = pic_param->pic_fields.bits.transform_8x8_mode_flag;
+    pic->constrained_intra_pred = pic_param->pic_fields.bits.constrained_intra_pred_flag;
+    pic->cabac = pic_param->pic_fields.bits.entropy_coding_mode_flag;
+    pic->direct_8x8_inference = pic_param->seq_fields.bits.direct_8x8_inference_flag;
+    for (c = 0; c < 2; c++) {
+        int offset = c ? pic_param->second_chroma_qp_index_offset : pic_param->chroma_qp_index_offset;
+
+        for (qp = 0; qp < 52; qp++) {
+            int qpi = h264_clip3(0, 51, qp + offset);
+
+            pic->chroma_qp[c][qp] = qpi < 30 ? qpi : h264_chroma_qp[qpi - 30];
+        }
+    }
+    obj_buffer = BUFFER(picture->iq_matrix);
+    h264_init_level_scale(pic, obj_buffer && obj_buffer->element_size >= sizeof(VAIQMatrixBufferH264) ?
+                          obj_buffer->buffer_data : NULL);
+    return VA_STATUS_SUCCESS;
+}
+
+/* Walks the slice parameters rendered into a picture */
+struct h264_slice_iter {
+    int buffer;
+    int element;
+};
+
+/*
+ * The next slice parameters whose slice data is in its buffer, with the
+ * buffer in data, or NULL after the last one. Slice parameter buffers
+ * pair up with the slice data buffers in order.
+ */
+static const VASliceParameterBufferH264 *
+h264_next_slice(struct epiphany_driver_data *driver_data, const struct epiphany_picture *picture,
+                struct h264_slice_iter *iter, const uint8_t **data)
+{
+    while (iter->buffer < picture->slice_params.num_buffers && iter->buffer < picture->slice_data.num_buffers) {
+        object_buffer_p obj_params = BUFFER(picture->slice_params.buffers[iter->buffer]);
+        object_buffer_p obj_data = BUFFER(picture->slice_data.buffers[iter->buffer]);
+
+        if (obj_params && obj_data && obj_params->element_size >= sizeof(VASliceParameterBufferH264) &&
+            iter->element < obj_params->num_elements) {
+            const VASliceParameterBufferH264 *slice_param = (const VASliceParameterBufferH264 *)
+                ((const uint8_t *) obj_params->buffer_data + (size_t) iter->element++ * obj_params->element_size);
+            size_t data_size = (size_t) obj_data->element_size * obj_data->num_elements;
+
+            if (slice_param->slice_data_offset > data_size ||
+                slice_param->slice_data_size > data_size - slice_param->slice_data_offset)
+                continue;
+            *data = obj_data->buffer_data;
+            return slice_param;
+        }
+        iter->buffer++;
+        iter->element = 0;
+    }
+    return NULL;
+}
+
+/* Whether a slice has all its references, rather than predicting from the picture itself */
+static int
+h264_references_present(struct epiphany_driver_data *driver_data, const struct h264_picture *pic,
+                        const VASliceParameterBufferH264 *slice_param)
+{
+    int slice_type = slice_param->slice_type % 5;
+    struct h264_reference ref;
+    int list, i;
+
+    for (list = 0; list < 2; list++) {
+        const VAPictureH264 *ref_list = list ? slice_param->RefPicList1 : slice_param->RefPicList0;
+        int num_ref_idx = list ? slice_param->num_ref_idx_l1_active_minus1 + 1 :
+                          slice_param->num_ref_idx_l0_active_minus1 + 1;
+
+        if (slice_type >= H264_SLICE_I || (list && slice_type != H264_SLICE_B))
+            continue;
+        for (i = 0; i < num_ref_idx && i < H264_MAX_REFS; i++) {
+            h264_lookup_reference(driver_data, pic, &ref_list[i], &ref);
+            if (ref.y == pic->y)
+                return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Gives the threads working on the picture row by row state of their own
+ * Return 0 on success, -1 on allocation failure
+ */
+static int
+h264_init_rows(struct h264_slot *slot, const struct h264_picture *pic)
+{
+    int y;
+
+    if (NULL == slot->rows) {
+        slot->rows = malloc(pic->mb_height * sizeof(*slot->rows));
+        if (NULL == slot->rows)
+            return -1;
+    }
+    for (y = 0; y < pic->mb_height; y++)
+        slot->rows[y] = *pic;
+    return 0;
+}
+
+/* Deblocks the decoded picture on the pool, or on this thread if the rows can't be set up */
+static void
+h264_deblock_rows(struct h264_picture *pic, thread_pool_p pool)
+{
+    struct h264_slot *slot = pic->slot;
+    int num_mbs = pic->mb_width * pic->mb_height;
+
+    if (h264_init_rows(slot, pic) < 0 ||
+        wavefront_start(&slot->wavefront, pool, pic->mb_width, pic->mb_height, 2, num_mbs,
+                        h264_deblock_task, slot) < 0) {
+        h264_deblock_picture(pic);
+        return;
+    }
+    wavefront_wait(&slot->wavefront);
+}
+
+/*
+ * Allocates the records parsing leaves for deferred reconstruction
+ * Return 0 on success, -1 on allocation failure
+ */
+static int
+h264_init_records(struct h264_slot *slot, const struct h264_picture *pic)
+{
+    if (NULL == slot->recon) {
+        slot->recon = calloc((size_t) pic->mb_width * pic->mb_height, sizeof(*slot->recon));
+        if (NULL == slot->recon)
+            return -1;
+    }
+    return 0;
+}
+
+/*
+ * Starts reconstructing the records on the pool, the first available
+ * macroblocks being parsed already
+ * Return 0 on success, -1 if the rows can't be set up
+ */
+static int
+h264_start_wavefront(struct h264_picture *pic, thread_pool_p pool, int available)
+{
+    struct h264_slot *slot = pic->slot;
+
+    if (h264_init_rows(slot, pic) < 0 ||
+        wavefront_start(&slot->wavefront, pool, pic->mb_width, pic->mb_height, 2, available,
+                        h264_reconstruct_task, slot) < 0)
+        return -1;
+    pic->wavefront = &slot->wavefront;
+    return 0;
+}
+
+/*
+ * Reconstructs what parsing left of the picture in wavefront order, on
+ * this thread if the rows can't be set up, then deblocks it on the pool
+ */
+static void
+h264_finish_picture(struct h264_picture *pic, thread_pool_p pool)
+{
+    int num_mbs = pic->mb_width * pic->mb_height;
+    int addr;
+
+    if (NULL == pic->wavefront && h264_start_wavefront(pic, pool, num_mbs) < 0) {
+        for (addr = 0; addr < num_mbs; addr++)
+            h264_reconstruct_address(pic, addr);
+    }
+    if (pic->wavefront) {
+        wavefront_set_available(pic->wavefront, num_mbs);
+        wavefront_wait(pic->wavefront);
+        pic->wavefront = NULL;
+    }
+    h264_deblock_rows(pic, pool);
+}
+
+static unsigned long long
+h264_time_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Waits for room for a picture decoded into surface: a free slot, and no
+ * picture in flight decoding into the surface or referencing what is
+ * there. Returns the slot.
+ */
+static struct h264_slot *
+h264_acquire_slot(struct epiphany_h264_decoder *decoder, VASurfaceID surface)
+{
+    struct h264_slot *slot;
+    int i;
+
+    pthread_mutex_lock(&decoder->mutex);
+    for (;;) {
+        slot = NULL;
+        for (i = 0; i < decoder->num_slots && NULL == slot; i++) {
+            if (!decoder->slots[i].busy)
+                slot = &decoder->slots[i];
+        }
+        if (slot && !h264_in_flight(decoder, surface))
+            break;
+        pthread_cond_wait(&decoder->done, &decoder->mutex);
+    }
+    pthread_mutex_unlock(&decoder->mutex);
+    return slot;
+}
+
+/* Waits until no picture is in flight */
+static void
+h264_wait_idle(struct epiphany_h264_decoder *decoder)
+{
+    pthread_mutex_lock(&decoder->mutex);
+    while (decoder->in_flight)
+        pthread_cond_wait(&decoder->done, &decoder->mutex);
+    pthread_mutex_unlock(&decoder->mutex);
+}
+
+/*
+ * Puts the picture in slot in flight, after the pictures in flight it
+ * references. Returns the pictures in flight, negative if it waits for
+ * some of them.
+ */
+static int
+h264_start_slot(struct h264_slot *slot, const VAPictureParameterBufferH264 *pic_param, VASurfaceID surface)
+{
+    struct epiphany_h264_decoder *decoder = slot->decoder;
+    int index = slot - decoder->slots;
+    int in_flight, i, j;
+
+    pthread_mutex_lock(&decoder->mutex);
+    for (j = 0; j < 16; j++)
+        slot->refs[j] = pic_param->ReferenceFrames[j].flags & VA_PICTURE_H264_INVALID ?
+                        VA_INVALID_SURFACE : pic_param->ReferenceFrames[j].picture_id;
+    slot->waiting = 1;
+    for (i = 0; i < decoder->num_slots; i++) {
+        struct h264_slot *other = &decoder->slots[i];
+
+        if (!other->busy)
+            continue;
+        for (j = 0; j < 16; j++) {
+            if (slot->refs[j] == other->surface) {
+                other->dependents |= 1u << index;
+                slot->waiting++;
+                break;
+            }
+        }
+    }
+    slot->surface = surface;
+    slot->dependents = 0;
+    slot->busy = 1;
+    in_flight = ++decoder->in_flight;
+    if (slot->waiting > 1)
+        in_flight = -in_flight;
+    pthread_mutex_unlock(&decoder->mutex);
+    return in_flight;
+}
+
+/* Queues the slots whose bit is set in ready */
+static void
+h264_submit_slots(struct epiphany_h264_decoder *decoder, thread_pool_p pool, unsigned int ready)
+{
+    int i;
+
+    for (i = 0; i < decoder->num_slots; i++) {
+        if (ready & (1u << i))
+            thread_pool_submit(pool, &decoder->slots[i].task);
+    }
+}
+
+/* Marks the picture in slot parsed, queueing it unless references are still in flight */
+static void
+h264_parsed_slot(struct h264_slot *slot)
+{
+    struct epiphany_h264_decoder *decoder = slot->decoder;
+    int ready;
+
+    pthread_mutex_lock(&decoder->mutex);
+    ready = 0 == --slot->waiting;
+    pthread_mutex_unlock(&decoder->mutex);
+    if (ready)
+        thread_pool_submit(slot->pool, &slot->task);
+}
+
+/*
+ * Takes the finished picture in slot out of flight, queueing the pictures
+ * that only waited for it. The slot may be reused as soon as this returns.
+ */
+static void
+h264_complete_slot(struct h264_slot *slot, thread_pool_p pool)
+{
+    struct epiphany_h264_decoder *decoder = slot->decoder;
+    unsigned int ready = 0;
+    int i;
+
+    pthread_mutex_lock(&decoder->mutex);
+    for (i = 0; i < decoder->num_slots; i++) {
+        if ((slot->dependents & (1u << i)) && 0 == --decoder->slots[i].waiting)
+            ready |= 1u << i;
+    }
+    slot->dependents = 0;
+    slot->busy = 0;
+    decoder->in_flight--;
+    pthread_cond_broadcast(&decoder->done);
+    pthread_mutex_unlock(&decoder->mutex);
+    h264_submit_slots(decoder, pool, ready);
+}
+
+/* Pool task finishing a parsed picture once the pictures it references are done */
+static void
+h264_slot_task(struct thread_pool_task *task)
+{
+    struct h264_slot *slot = (struct h264_slot *) task;
+    struct epiphany_driver_data *driver_data = slot->driver_data;
+    object_surface_p obj_surface = slot->obj_surface;
+    thread_pool_p pool = slot->pool;
+    unsigned long long start = 0;
+
+    if (driver_data->report_stats) {
+        start = h264_time_ns();
+        STATS_ADD(driver_data->pipeline_reference_ns, start - slot->parsed_ns);
+    }
+    h264_finish_picture(&slot->pic, pool);
+    if (driver_data->report_stats)
+        STATS_ADD(driver_data->pipeline_reconstruct_ns, h264_time_ns() - start);
+    h264_complete_slot(slot, pool);
+    /* Last, the decoder may go once nothing is held */
+    epiphany_backend_release_surface(driver_data, obj_surface);
+}
+
+/* Pool task decoding one slice */
+static void
+h264_slice_task(struct thread_pool_task *task)
+{
+    struct h264_slice_task *slice_task = (struct h264_slice_task *) task;
+
+    h264_decode_slice(slice_task->driver_data, &slice_task->pic, slice_task->param, slice_task->data);
+    thread_pool_done(slice_task->pool, &slice_task->pic.decoder->pending);
+}
+
+/*
+ * Decodes the slices of the picture side by side on the pool, each up to
+ * where the next one starts, then deblocks the picture.
+ * Return 0 on success, -1 if the picture is to be decoded on one thread
+ */
+static int
+h264_decode_slices(struct epiphany_driver_data *driver_data, struct h264_picture *pic,
+                   const struct epiphany_picture *picture, int num_slices, thread_pool_p pool)
+{
+    struct epiphany_h264_decoder *decoder = pic->decoder;
+    const VASliceParameterBufferH264 *slice_param;
+    struct h264_slice_iter iter;
+    const uint8_t *data;
+    int i;
+
+    if (num_slices > decoder->max_tasks) {
+        struct h264_slice_task *tasks = realloc(decoder->tasks, num_slices * sizeof(*tasks));
+
+        if (NULL == tasks)
+            return -1;
+        for (i = decoder->max_tasks; i < num_slices; i++)
+            memset(&tasks[i].rbsp, 0, sizeof(tasks[i].rbsp));
+        decoder->tasks = tasks;
+        decoder->max_tasks = num_slices;
+    }
+
+    memset(&iter, 0, sizeof(iter));
+    for (i = 0; i < num_slices && (slice_param = h264_next_slice(driver_data, picture, &iter, &data)); i++) {
+        struct h264_slice_task *task = &decoder->tasks[i];
+
+        task->task.run = h264_slice_task;
+        task->driver_data = driver_data;
+        task->pool = pool;
+        task->param = slice_param;
+        task->data = data;
+        task->pic = *pic;
+        task->pic.rbsp = &task->rbsp;
+        task->pic.recon = &task->pic.mb_recon;
+        /* Each slice has its own entry in the slice table */
+        task->pic.num_slices = i;
+        if (i > 0)
+            decoder->tasks[i - 1].pic.end_mb = slice_param->first_mb_in_slice;
+    }
+    num_slices = i;
+    __atomic_store_n(&decoder->pending, num_slices, __ATOMIC_SEQ_CST);
+    for (i = 0; i < num_slices; i++)
+        thread_pool_submit(pool, &decoder->tasks[i].task);
+    thread_pool_wait(pool, &decoder->pending);
+
+    h264_deblock_rows(pic, pool);
+    return 0;
+}
+
+/*
+ * Pictures decoded with the rows strategy are parsed here, on the decode
+ * queue, into a slot of their own and finished by the pool while the next
+ * ones are parsed, as deep as the context allows. Others are decoded here
+ * once the pictures in flight are done.
+ */
+VAStatus
+epiphany_h264_decode_picture(struct epiphany_driver_data *driver_data,
+                             object_context_p obj_context,
+                             const struct epiphany_picture *picture,
+                             object_surface_p obj_surface)
+{
+    struct epiphany_h264_decoder *decoder = obj_context->decoder;
+    thread_pool_p pool = obj_context->thread_pool;
+    const VASliceParameterBufferH264 *slice_param;
+    const uint8_t *data;
+    struct h264_slice_iter iter;
+    struct h264_picture *pic;
+    struct h264_slot *slot;
+    struct h264_frame *frame;
+    unsigned long long start = 0, now = 0;
+    VAStatus vaStatus;
+    int num_slices, next_mb, strategy, in_flight, i;
+
+    if (pthread_once(&h264_tables_once, h264_init_tables) || h264_tables_status)
+        return VA_STATUS_ERROR_OPERATION_FAILED;
+
+    if (NULL == decoder) {
+        decoder = h264_create_decoder(obj_context->decode_depth);
+        if (NULL == decoder)
+            return VA_STATUS_ERROR_ALLOCATION_FAILED;
+        obj_context->decoder = decoder;
+    }
+    if (driver_data->report_stats)
+        start = h264_time_ns();
+    slot = h264_acquire_slot(decoder, obj_surface->base.id);
+    pic = &slot->pic;
+    vaStatus = h264_init_picture(driver_data, picture, obj_surface, pic);
+    if (VA_STATUS_SUCCESS != vaStatus)
+        return vaStatus;
+    if (pic->mb_width != decoder->mb_width || pic->mb_height != decoder->mb_height) {
+        h264_wait_idle(decoder);
+        h264_resize_decoder(decoder, pic->mb_width, pic->mb_height);
+    }
+    frame = h264_claim_frame(decoder, pic->pic_param);
+    if (NULL == frame) {
+        /* The pictures in flight keep the motion they use */
+        h264_wait_idle(decoder);
+        frame = h264_claim_frame(decoder, pic->pic_param);
+    }
+    if (NULL == slot->mbs)
+        slot->mbs = malloc((size_t) pic->mb_width * pic->mb_height * sizeof(*slot->mbs));
+    if (NULL == frame || NULL == slot->mbs)
+        return VA_STATUS_ERROR_ALLOCATION_FAILED;
+    pic->decoder = decoder;
+    pic->slot = slot;
+    pic->rbsp = &decoder->rbsp;
+    pic->motion = frame->motion;
+    for (i = 0; i < pic->mb_width * pic->mb_height; i++)
+        slot->mbs[i].slice = H264_NO_SLICE;
+
+    /*
+     * Sizes the slice table, which must not move under the threads working
+     * on the picture. Those need the slices in order and every reference
+     * there, or they would read what another thread is writing.
+     */
+    num_slices = 0;
+    next_mb = 0;
+    strategy = obj_context->decode_strategy;
+    memset(&iter, 0, sizeof(iter));
+    while ((slice_param = h264_next_slice(driver_data, picture, &iter, &data))) {
+        if ((int) slice_param->first_mb_in_slice < next_mb ||
+            (strategy != VA_EPIPHANY_DECODE_SERIAL && !h264_references_present(driver_data, pic, slice_param)))
+            strategy = VA_EPIPHANY_DECODE_SERIAL;
+        next_mb = slice_param->first_mb_in_slice + 1;
+        num_slices++;
+    }
+    if (num_slices > H264_NO_SLICE)
+        num_slices = H264_NO_SLICE;
+    if (num_slices > slot->max_slices) {
+        struct h264_slice_info *slices = realloc(slot->slices, num_slices * sizeof(*slices));
+
+        if (NULL == slices)
+            return VA_STATUS_ERROR_ALLOCATION_FAILED;
+        slot->slices = slices;
+        slot->max_slices = num_slices;
+    }
+
+    if (strategy != VA_EPIPHANY_DECODE_ROWS || h264_init_records(slot, pic) < 0) {
+        /* Reconstructed as parsed, so after what it references */
+        h264_wait_idle(decoder);
+        if (strategy == VA_EPIPHANY_DECODE_SLICES &&
+            0 == h264_decode_slices(driver_data, pic, picture, num_slices, pool))
+            return VA_STATUS_SUCCESS;
+        memset(&iter, 0, sizeof(iter));
+        while ((slice_param = h264_next_slice(driver_data, picture, &iter, &data)))
+            h264_decode_slice(driver_data, pic, slice_param, data);
+        h264_deblock_picture(pic);
+        return VA_STATUS_SUCCESS;
+    }
+
+    /* Reconstruction follows parsing right away unless it waits for references */
+    pic->deferred = 1;
+    in_flight = h264_start_slot(slot, pic->pic_param, obj_surface->base.id);
+    if (in_flight > 0)
+        h264_start_wavefront(pic, pool, 0);
+    if (driver_data->report_stats) {
+        now = h264_time_ns();
+        STATS_ADD(driver_data->pipeline_slot_ns, now - start);
+        start = now;
+        STATS_ADD(driver_data->pipeline_pictures, 1);
+        STATS_MAX(driver_data->pipeline_max_in_flight, (unsigned long long) abs(in_flight));
+    }
+    memset(&iter, 0, sizeof(iter));
+    while ((slice_param = h264_next_slice(driver_data, picture, &iter, &data)))
+        h264_decode_slice(driver_data, pic, slice_param, data);
+    if (driver_data->report_stats) {
+        now = h264_time_ns();
+        STATS_ADD(driver_data->pipeline_parse_ns, now - start);
+    }
+
+    if (decoder->num_slots == 1) {
+        h264_finish_picture(pic, pool);
+        if (driver_data->report_stats)
+            STATS_ADD(driver_data->pipeline_reconstruct_ns, h264_time_ns() - now);
+        h264_complete_slot(slot, pool);
+        return VA_STATUS_SUCCESS;
+    }
+
+    /* The surface stays busy until the pool is done with the picture */
+    epiphany_backend_hold_surface(driver_data, obj_surface);
+    slot->task.run = h264_slot_task;
+    slot->driver_data = driver_data;
+    slot->obj_surface = obj_surface;
+    slot->pool = pool;
+    slot->parsed_ns = now;
+    h264_parsed_slot(slot);
+    return VA_STATUS_SUCCESS;
+}
@@ -0,0 +1,833 @@
+/*
+ * Copyright (c) 2012 Scott Tincman <sctincman@gmail.com>. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+
+/*
+ * Baseline JPEG decoding (ITU-T T.81) on the host CPU.
+ *
+ * The client parsed the markers and passes the frame header, the
+ * quantization and Huffman tables and one slice per scan, whose data
+ * is the entropy coded segments of the scan with their restart markers.
+ * Huffman codes are looked up in vlc tables, short AC codes together
+ * with the bits of their coefficient. The blocks go through the dsp
+ * inverse DCT, luma straight into the render target when its MCUs fit,
+ * chroma into planes of the decoder that are resampled to the NV12 UV
+ * plane at the end. Pictures of one component are gray, CMYK and other
+ * 4 component pictures are refused.
+ */
+
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+
+#include "epiphany_jpeg.h"
+#include "vlc.h"
+
+#ifdef HAVE_VA_JPEG_DECODE
+
+#define JPEG_MAX_COMPONENTS     3
+#define JPEG_DC_SYMBOLS         12
+#define JPEG_AC_SYMBOLS         162
+#define JPEG_VLC_BITS           9
+/* The first level and the second levels a table of 16 bit codes can need */
+#define JPEG_VLC_ENTRIES        ((1 << JPEG_VLC_BITS) + JPEG_AC_SYMBOLS + 2 * (1 << (16 - JPEG_VLC_BITS)))
+/* Readable samples before and after the rows of the component planes */
+#define JPEG_PLANE_MARGIN       32
+#define JPEG_DC_LIMIT           0xffff
+
+/* A DHT table: the number of codes of each length, then their symbols */
+struct jpeg_huffman_spec {
+    uint8_t num_codes[16];
+    uint8_t values[JPEG_AC_SYMBOLS];
+};
+
+struct jpeg_huffman {
+    struct vlc vlc;
+    struct vlc_entry table[JPEG_VLC_ENTRIES];
+    /*
+     * For AC codes whose coefficient bits also fit the first level:
+     * (level << 8) | (run << 4) | bits of both, 0 for the others
+     */
+    int16_t fast_ac[1 << JPEG_VLC_BITS];
+    struct jpeg_huffman_spec spec;      /* What the table was built from */
+    int valid;
+};
+
+struct epiphany_jpeg_decoder {
+    /* Built tables by [class][index], kept as long as the pictures send the same ones */
+    struct jpeg_huffman huffman[2][2];
+    uint8_t *planes;            /* Of the components not decoded into the surface */
+    size_t planes_size;
+};
+
+struct jpeg_component {
+    int id;
+    int h;                      /* Sampling factors */
+    int v;
+    int width;                  /* Samples, without the padding to whole MCUs */
+    int height;
+    uint8_t *plane;
+    ptrdiff_t stride;
+    uint16_t quant[64];         /* Zigzag order */
+    const struct jpeg_huffman *dc;     /* Of the current scan */
+    const struct jpeg_huffman *ac;
+    int dc_pred;
+};
+
+/* MSB-first reader of entropy coded data, which drops stuffed zero bytes */
+struct jpeg_bits {
+    const uint8_t *data;
+    const uint8_t *end;
+    uint64_t buf;               /* Left aligned */
+    int count;                  /* Bits in buf */
+    int marker;                 /* A marker was reached, zeros are read from there */
+};
+
+struct jpeg_picture {
+    const struct dsp_ops *dsp;
+    const struct jpeg_dsp_ops *resample;
+    struct epiphany_jpeg_decoder *decoder;
+    int width;
+    int height;
+    int num_components;
+    int h_max;
+    int v_max;
+    int mcus_x;                 /* Of the interleaved scans */
+    int mcus_y;
+    int y_in_surface;
+    uint8_t *y;
+    uint8_t *uv;
+    ptrdiff_t stride;
+    struct jpeg_component components[JPEG_MAX_COMPONENTS];
+    struct jpeg_bits bits;
+    int16_t block[64] __attribute__((aligned(16)));
+};
+
+/* Zigzag index to raster index, with room for the run of a damaged code past the end */
+static const uint8_t jpeg_zigzag[64 + 16] = {
+     0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+    63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63,
+};
+
+/*
+ * The example tables of Annex K.3 by [class][index], luma then chroma.
+ * Motion JPEG leaves them out of its pictures.
+ */
+static const struct jpeg_huffman_spec jpeg_default_huffman[2][2] = {
+    {
+        {
+            { 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 },
+            { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 },
+        },
+        {
+            { 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0 },
+            { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 },
+        },
+    },
+    {
+        {
+            { 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d },
+            {
+                0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+                0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+                0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+                0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+                0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+                0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+                0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+                0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+                0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+                0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+                0xf9, 0xfa,
+            },
+        },
+        {
+            { 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77 },
+            {
+                0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+                0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+                0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+                0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+                0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+                0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+                0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+                0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+                0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+                0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+                0xf9, 0xfa,
+            },
+        },
+    },
+};
+
+static inline uint8_t
+clip_u8(int value)
+{
+    return value < 0 ? 0 : (value > 255 ? 255 : value);
+}
+
+static inline int16_t
+clip_s16(int value)
+{
+    return value < -32768 ? -32768 : (value > 32767 ? 32767 : value);
+}
+
+/* F.2.2.1, the value of the s bits that follow a category s */
+static inline int
+jpeg_extend(unsigned int bits, int s)
+{
+    return bits < (1u << (s - 1)) ? (int) bits - (1 << s) + 1 : (int) bits;
+}
+
+/*
+ * Builds a table from spec, which holds max_values symbols at most.
+ * Returns 0 on success, -1 if the code lengths do not make a prefix code.
+ */
+static int
+jpeg_build_huffman(struct jpeg_huffman *huffman, const struct jpeg_huffman_spec *spec,
+                   int max_values, int ac)
+{
+    struct vlc_code codes[JPEG_AC_SYMBOLS];
+    unsigned int code = 0;
+    int n = 0, length, i;
+
+    huffman->valid = 0;
+    /* C.2, canonical codes in order of length */
+    for (length = 1; length <= 16; length++) {
+        for (i = 0; i < spec->num_codes[length - 1]; i++) {
+            if (n >= max_values || code >= (1u << length))
+                return -1;
+            codes[n].code = code++;
+            codes[n].length = length;
+            codes[n].symbol = spec->values[n];
+            n++;
+        }
+        code <<= 1;
+    }
+    if (vlc_init(&huffman->vlc, JPEG_VLC_BITS, codes, n, huffman->table, JPEG_VLC_ENTRIES))
+        return -1;
+
+    memset(huffman->fast_ac, 0, sizeof(huffman->fast_ac));
+    for (i = 0; ac && i < (1 << JPEG_VLC_BITS); i++) {
+        const struct vlc_entry *entry = &huffman->table[i];
+        int run = entry->symbol >> 4, s = entry->symbol & 15, level;
+
+        if (entry->length <= 0 || 0 == s || entry->length + s > JPEG_VLC_BITS)
+            continue;
+        level = jpeg_extend((i >> (JPEG_VLC_BITS - entry->length - s)) & ((1 << s) - 1), s);
+        if (level >= -128 && level <= 127)
+            huffman->fast_ac[i] = (level * 256) | (run << 4) | (entry->length + s);
+    }
+    huffman->spec = *spec;
+    huffman->valid = 1;
+    return 0;
+}
+
+/* Refills the reader to 57 bits or more */
+static inline void
+jpeg_refill(struct jpeg_bits *bits)
+{
+    /* Whole bytes at once while none of the next 8 is 0xff */
+    if (!bits->marker && bits->end - bits->data >= 8) {
+        uint64_t word;
+        int n = (64 - bits->count) >> 3;
+
+        memcpy(&word, bits->data, sizeof(word));
+        if (0 == ((~word - 0x0101010101010101ULL) & word & 0x8080808080808080ULL)) {
+#ifndef WORDS_BIGENDIAN
+            word = __builtin_bswap64(word);
+#endif
+            bits->buf |= word >> (64 - 8 * n) << (64 - 8 * n - bits->count);
+            bits->data += n;
+            bits->count += 8 * n;
+            return;
+        }
+    }
+    while (bits->count <= 56) {
+        unsigned int byte = 0;
+
+        if (!bits->marker && bits->data < bits->end) {
+            byte = bits->data[0];
+            if (0xff != byte) {
+                bits->data++;
+            } else if (bits->data + 1 < bits->end && 0 == bits->data[1]) {
+                bits->data += 2;
+            } else {
+                /* Left for jpeg_restart to find */
+                bits->marker = 1;
+                byte = 0;
+            }
+        }
+        bits->buf |= (uint64_t) byte << (56 - bits->count);
+        bits->count += 8;
+    }
+}
+
+/* 1 <= n <= 16, which the callers refilled for */
+static inline unsigned int
+jpeg_show_bits(const struct jpeg_bits *bits, int n)
+{
+    return (unsigned int)(bits->buf >> (64 - n));
+}
+
+static inline void
+jpeg_skip_bits(struct jpeg_bits *bits, int n)
+{
+    bits->buf <<= n;
+    bits->count -= n;
+}
+
+static inline int
+jpeg_get_extended(struct jpeg_bits *bits, int s)
+{
+    unsigned int value = jpeg_show_bits(bits, s);
+
+    jpeg_skip_bits(bits, s);
+    return jpeg_extend(value, s);
+}
+
+/* vlc_get for the JPEG reader */
+static inline int
+jpeg_get_vlc(struct jpeg_bits *bits, const struct vlc *vlc)
+{
+    const struct vlc_entry *entry = &vlc->table[jpeg_show_bits(bits, vlc->bits)];
+
+    if (entry->length < 0) {
+        int sub_bits = -entry->length;
+
+        jpeg_skip_bits(bits, vlc->bits);
+        entry = &vlc->table[entry->symbol + jpeg_show_bits(bits, sub_bits)];
+    }
+    if (entry->length == 0)
+        return VLC_INVALID;
+    jpeg_skip_bits(bits, entry->length);
+    return entry->symbol;
+}
+
+/*
+ * Moves to the interval after the next RSTn marker, dropping the bits
+ * left of the one before. Damaged data without one reads as zeros.
+ */
+static void
+jpeg_restart(struct jpeg_bits *bits)
+{
+    const uint8_t *p = bits->data;
+
+    while (p + 1 < bits->end && !(0xff == p[0] && 0xd0 == (p[1] & 0xf8)))
+        p++;
+    bits->data = p + 1 < bits->end ? p + 2 : bits->end;
+    bits->buf = 0;
+    bits->count = 0;
+    bits->marker = 0;
+}
+
+/*
+ * Decodes and dequantizes the coefficients of a block of comp into
+ * block, which is all zeros. Returns the zigzag index of the last
+ * coefficient, or -1 for an invalid code.
+ */
+static int
+jpeg_decode_block(struct jpeg_bits *bits, struct jpeg_component *comp, int16_t *block)
+{
+    const struct jpeg_huffman *ac = comp->ac;
+    int k, s, level, last = 0;
+
+    if (bits->count < 32)
+        jpeg_refill(bits);
+    s = jpeg_get_vlc(bits, &comp->dc->vlc);
+    if (s < 0 || s > 16)
+        return -1;
+    if (s) {
+        comp->dc_pred += jpeg_get_extended(bits, s);
+        if (comp->dc_pred < -JPEG_DC_LIMIT || comp->dc_pred > JPEG_DC_LIMIT)
+            comp->dc_pred = comp->dc_pred < 0 ? -JPEG_DC_LIMIT : JPEG_DC_LIMIT;
+    }
+    /* With the level shift of samples by 128 */
+    block[0] = clip_s16(comp->dc_pred * comp->quant[0] + 1024);
+
+    for (k = 1; k < 64; k++) {
+        int fast;
+
+        if (bits->count < 32)
+            jpeg_refill(bits);
+        fast = ac->fast_ac[jpeg_show_bits(bits, JPEG_VLC_BITS)];
+        if (fast) {
+            k += (fast >> 4) & 15;
+            jpeg_skip_bits(bits, fast & 15);
+            level = fast >> 8;
+        } else {
+            int rs = jpeg_get_vlc(bits, &ac->vlc);
+
+            if (rs < 0)
+                return -1;
+            if (0 == (rs & 15)) {
+                /* EOB, or ZRL for 16 zeros */
+                if (0xf0 != rs)
+                    break;
+                k += 15;
+                continue;
+            }
+            k += rs >> 4;
+            level = jpeg_get_extended(bits, rs & 15);
+        }
+        if (k > 63)
+            return -1;
+        block[jpeg_zigzag[k]] = clip_s16(level * comp->quant[k]);
+        last = k;
+    }
+    return last;
+}
+
+/* The samples of a block with a DC coefficient only, as the dsp inverse DCT makes them */
+static inline uint8_t
+jpeg_idct_dc(int dc)
+{
+    int row = clip_s16((DSP_IDCT_W4 * dc + (1 << (DSP_IDCT_ROW_SHIFT - 1))) >> DSP_IDCT_ROW_SHIFT);
+
+    return clip_u8(clip_s16((DSP_IDCT_W4 * row + (1 << (DSP_IDCT_COL_SHIFT - 1))) >> DSP_IDCT_COL_SHIFT));
+}
+
+/* Decodes the next block of comp to dst, returns -1 on damage */
+static inline int
+jpeg_decode_to(struct jpeg_picture *pic, struct jpeg_component *comp, uint8_t *dst)
+{
+    int16_t *block = pic->block;
+    int last = jpeg_decode_block(&pic->bits, comp, block);
+    int i;
+
+    if (last < 0) {
+        memset(block, 0, sizeof(pic->block));
+        return -1;
+    }
+    if (0 == last) {
+        uint8_t value = jpeg_idct_dc(block[0]);
+
+        for (i = 0; i < 8; i++)
+            memset(dst + i * comp->stride, value, 8);
+        block[0] = 0;
+        return 0;
+    }
+    pic->dsp->idct(block);
+    pic->dsp->put_block(dst, comp->stride, block);
+    memset(block, 0, sizeof(pic->block));
+    return 0;
+}
+
+/* Decodes the MCUs of one scan, from its first to the first damage found */
+static void
+jpeg_decode_scan(struct jpeg_picture *pic, const VASliceParameterBufferJPEGBaseline *slice_param,
+                 const uint8_t *data)
+{
+    struct jpeg_component *scan[JPEG_MAX_COMPONENTS];
+    int num = slice_param->num_components;
+    int mcus_x, mcus_y, mcu, end, x, y, left, i, j;
+
+    if (num < 1 || num > pic->num_components)
+        return;
+    for (i = 0; i < num; i++) {
+        int selector = slice_param->components[i].component_selector;
+
+        scan[i] = NULL;
+        for (j = 0; j < pic->num_components; j++) {
+            if (pic->components[j].id == selector)
+                scan[i] = &pic->components[j];
+        }
+        if (NULL == scan[i] || slice_param->components[i].dc_table_selector > 1 ||
+            slice_param->components[i].ac_table_selector > 1)
+            return;
+        for (j = 0; j < i; j++) {
+            if (scan[j] == scan[i])
+                return;
+        }
+        scan[i]->dc = &pic->decoder->huffman[0][slice_param->components[i].dc_table_selector];
+        scan[i]->ac = &pic->decoder->huffman[1][slice_param->components[i].ac_table_selector];
+        scan[i]->dc_pred = 0;
+    }
+
+    /* A scan of one component has MCUs of one block over just the component, A.2.2 */
+    if (1 == num) {
+        mcus_x = (scan[0]->width + 7) / 8;
+        mcus_y = (scan[0]->height + 7) / 8;
+    } else {
+        mcus_x = pic->mcus_x;
+        mcus_y = pic->mcus_y;
+    }
+    if (slice_param->slice_horizontal_position >= (unsigned int) mcus_x ||
+        slice_param->slice_vertical_position >= (unsigned int) mcus_y)
+        return;
+    mcu = slice_param->slice_vertical_position * mcus_x + slice_param->slice_horizontal_position;
+    end = mcus_x * mcus_y;
+    if (slice_param->num_mcus < (unsigned int)(end - mcu))
+        end = mcu + slice_param->num_mcus;
+
+    pic->bits.data = data + slice_param->slice_data_offset;
+    pic->bits.end = pic->bits.data + slice_param->slice_data_size;
+    pic->bits.buf = 0;
+    pic->bits.count = 0;
+    pic->bits.marker = 0;
+    left = slice_param->restart_interval;
+    x = mcu % mcus_x;
+    y = mcu / mcus_x;
+    for (; mcu < end; mcu++) {
+        if (slice_param->restart_interval && 0 == left--) {
+            jpeg_restart(&pic->bits);
+            for (i = 0; i < num; i++)
+                scan[i]->dc_pred = 0;
+            left = slice_param->restart_interval - 1;
+        }
+        if (1 == num) {
+            struct jpeg_component *comp = scan[0];
+
+            if (jpeg_decode_to(pic, comp, comp->plane + 8 * (y * comp->stride + x)))
+                return;
+        } else {
+            for (i = 0; i < num; i++) {
+                struct jpeg_component *comp = scan[i];
+                uint8_t *dst = comp->plane + 8 * (y * comp->v * comp->stride + x * comp->h);
+                int bx, by;
+
+                for (by = 0; by < comp->v; by++) {
+                    for (bx = 0; bx < comp->h; bx++) {
+                        if (jpeg_decode_to(pic, comp, dst + 8 * (by * comp->stride + bx)))
+                            return;
+                    }
+                }
+            }
+        }
+        if (++x == mcus_x) {
+            x = 0;
+            y++;
+        }
+    }
+}
+
+/*
+ * Makes the chroma planes 4:2:0 and interleaves them into the UV plane,
+ * or makes it gray for pictures of one component
+ */
+static void
+jpeg_output_chroma(struct jpeg_picture *pic)
+{
+    const struct jpeg_component *cb = &pic->components[1];
+    const struct jpeg_component *cr = &pic->components[2];
+    int rows = (pic->height + 1) / 2, n = (pic->width + 1) / 2;
+    jpeg_interleave_func interleave;
+    int vy, i, j;
+
+    if (1 == pic->num_components) {
+        for (j = 0; j < rows; j++)
+            memset(pic->uv + j * pic->stride, 0x80, 2 * n);
+        return;
+    }
+
+    /* The samples the resampling reads past each edge repeat it */
+    for (i = 1; i < 3; i++) {
+        const struct jpeg_component *comp = &pic->components[i];
+
+        for (j = 0; j < comp->height; j++) {
+            uint8_t *row = comp->plane + j * comp->stride;
+
+            row[-1] = row[0];
+            row[comp->width] = row[comp->width - 1];
+        }
+    }
+
+    switch (pic->h_max / cb->h) {
+    case 1:
+        interleave = pic->resample->interleave[JPEG_CHROMA_DOWN];
+        break;
+    case 2:
+        interleave = pic->resample->interleave[JPEG_CHROMA_SAME];
+        break;
+    default:
+        interleave = pic->resample->interleave[JPEG_CHROMA_UP];
+        break;
+    }
+    vy = pic->v_max / cb->v;
+    for (j = 0; j < rows; j++) {
+        /* Both rows of the luma pair at full chroma height, or the one that covers them */
+        int r0 = 1 == vy ? 2 * j : (2 == vy ? j : j >> 1);
+        int r1 = 1 == vy ? 2 * j + 1 : r0;
+
+        if (r0 > cb->height - 1)
+            r0 = cb->height - 1;
+        if (r1 > cb->height - 1)
+            r1 = cb->height - 1;
+        interleave(pic->uv + j * pic->stride,
+                   cb->plane + r0 * cb->stride, cb->plane + r1 * cb->stride,
+                   cr->plane + r0 * cr->stride, cr->plane + r1 * cr->stride, n);
+    }
+}
+
+/*
+ * Points the components at the surface or at planes of the decoder,
+ * growing them as needed. Returns -1 if they cannot be allocated.
+ */
+static int
+jpeg_setup_planes(struct epiphany_jpeg_decoder *decoder, struct jpeg_picture *pic)
+{
+    size_t size = 0, offset = 0;
+    int i;
+
+    for (i = 0; i < pic->num_components; i++) {
+        struct jpeg_component *comp = &pic->components[i];
+
+        comp->stride = pic->mcus_x * comp->h * 8 + 2 * JPEG_PLANE_MARGIN;
+        if (i > 0 || !pic->y_in_surface)
+            size += (size_t) comp->stride * pic->mcus_y * comp->v * 8;
+    }
+    if (size > decoder->planes_size) {
+        free(decoder->planes);
+        decoder->planes_size = 0;
+        decoder->planes = calloc(1, size);
+        if (NULL == decoder->planes)
+            return -1;
+        decoder->planes_size = size;
+    }
+    for (i = 0; i < pic->num_components; i++) {
+        struct jpeg_component *comp = &pic->components[i];
+
+        if (0 == i && pic->y_in_surface) {
+            comp->plane = pic->y;
+            comp->stride = pic->stride;
+            continue;
+        }
+        comp->plane = decoder->planes + offset + JPEG_PLANE_MARGIN;
+        offset += (size_t) comp->stride * pic->mcus_y * comp->v * 8;
+    }
+    return 0;
+}
+
+/* Gets the Huffman tables of the picture ready, building those that changed */
+static VAStatus
+jpeg_setup_huffman(struct epiphany_driver_data *driver_data, const struct epiphany_picture *picture,
+                   struct epiphany_jpeg_decoder *decoder)
+{
+    const VAHuffmanTableBufferJPEGBaseline *huffman_table = NULL;
+    object_buffer_p obj_buffer;
+    int i;
+
+    obj_buffer = BUFFER(picture->huffman_table);
+    if (obj_buffer && obj_buffer->element_size >= sizeof(*huffman_table))
+        huffman_table = obj_buffer->buffer_data;
+    for (i = 0; i < 2; i++) {
+        struct jpeg_huffman_spec dc = jpeg_default_huffman[0][i];
+        struct jpeg_huffman_spec ac = jpeg_default_huffman[1][i];
+        struct jpeg_huffman *dc_table = &decoder->huffman[0][i];
+        struct jpeg_huffman *ac_table = &decoder->huffman[1][i];
+
+        if (huffman_table && huffman_table->load_huffman_table[i]) {
+            memcpy(dc.num_codes, huffman_table->huffman_table[i].num_dc_codes, 16);
+            memset(dc.values, 0, sizeof(dc.values));
+            memcpy(dc.values, huffman_table->huffman_table[i].dc_values, JPEG_DC_SYMBOLS);
+            memcpy(ac.num_codes, huffman_table->huffman_table[i].num_ac_codes, 16);
+            memcpy(ac.values, huffman_table->huffman_table[i].ac_values, JPEG_AC_SYMBOLS);
+        }
+        if (!dc_table->valid || memcmp(&dc_table->spec, &dc, sizeof(dc))) {
+            if (jpeg_build_huffman(dc_table, &dc, JPEG_DC_SYMBOLS, 0))
+                return VA_STATUS_ERROR_INVALID_PARAMETER;
+        }
+        if (!ac_table->valid || memcmp(&ac_table->spec, &ac, sizeof(ac))) {
+            if (jpeg_build_huffman(ac_table, &ac, JPEG_AC_SYMBOLS, 1))
+                return VA_STATUS_ERROR_INVALID_PARAMETER;
+        }
+    }
+    return VA_STATUS_SUCCESS;
+}
+
+/* Sets pic up from the parameter buffers rendered into picture */
+static VAStatus
+jpeg_init_picture(struct epiphany_driver_data *driver_data, const struct epiphany_picture *picture,
+                  object_surface_p obj_surface, struct jpeg_picture *pic)
+{
+    const VAPictureParameterBufferJPEGBaseline *pic_param;
+    const VAIQMatrixBufferJPEGBaseline *iq_matrix;
+    object_buffer_p obj_buffer;
+    int i, k;
+
+    obj_buffer = BUFFER(picture->pic_param);
+    if (NULL == obj_buffer || obj_buffer->element_size < sizeof(*pic_param) || NULL == obj_surface->storage)
+        return VA_STATUS_ERROR_INVALID_PARAMETER;
+    pic_param = obj_buffer->buffer_data;
+    if (pic_param->num_components != 1 && pic_param->num_components != 3)
+        return VA_STATUS_ERROR_UNIMPLEMENTED;
+    obj_buffer = BUFFER(picture->iq_matrix);
+    if (NULL == obj_buffer || obj_buffer->element_size < sizeof(*iq_matrix))
+        return VA_STATUS_ERROR_INVALID_PARAMETER;
+    iq_matrix = obj_buffer->buffer_data;
+
+    memset(pic, 0, sizeof(*pic));
+    pic->dsp = driver_data->dsp_ops;
+    pic->resample = driver_data->jpeg_dsp_ops;
+    pic->width = pic_param->picture_width;
+    pic->height = pic_param->picture_height;
+    pic->num_components = pic_param->num_components;
+    if (0 == pic->width || 0 == pic->height ||
+        pic->width > obj_surface->storage->pitch || pic->height > obj_surface->storage->luma_height)
+        return VA_STATUS_ERROR_INVALID_PARAMETER;
+    pic->y = obj_surface->storage->data;
+    pic->uv = obj_surface->storage->data + obj_surface->storage->chroma_offset;
+    pic->stride = obj_surface->storage->pitch;
+
+    for (i = 0; i < pic->num_components; i++) {
+        struct jpeg_component *comp = &pic->components[i];
+        int selector = pic_param->components[i].quantiser_table_selector;
+
+        comp->id = pic_param->components[i].component_id;
+        comp->h = pic_param->components[i].h_sampling_factor;
+        comp->v = pic_param->components[i].v_sampling_factor;
+        if (comp->h < 1 || comp->h > 4 || comp->v < 1 || comp->v > 4 ||
+            selector > 3 || !iq_matrix->load_quantiser_table[selector])
+            return VA_STATUS_ERROR_INVALID_PARAMETER;
+        for (k = 0; k < 64; k++)
+            comp->quant[k] = iq_matrix->quantiser_table[selector][k];
+        if (comp->h > pic->h_max)
+            pic->h_max = comp->h;
+        if (comp->v > pic->v_max)
+            pic->v_max = comp->v;
+    }
+    /* A gray picture is a single block wide MCU whatever its factors say */
+    if (1 == pic->num_components) {
+        pic->components[0].h = pic->components[0].v = 1;
+        pic->h_max = pic->v_max = 1;
+    }
+    /*
+     * The first component is the luma plane, the others have to divide
+     * it in ways the chroma resampling does, the same for both
+     */
+    if (pic->components[0].h != pic->h_max || pic->components[0].v != pic->v_max)
+        return VA_STATUS_ERROR_UNIMPLEMENTED;
+    for (i = 1; i < pic->num_components; i++) {
+        const struct jpeg_component *comp = &pic->components[i];
+
+        if (pic->h_max % comp->h || pic->v_max % comp->v || pic->h_max / comp->h == 3 ||
+            pic->v_max / comp->v == 3 || comp->h != pic->components[1].h || comp->v != pic->components[1].v)
+            return VA_STATUS_ERROR_UNIMPLEMENTED;
+    }
+    for (i = 0; i < pic->num_components; i++) {
+        struct jpeg_component *comp = &pic->components[i];
+
+        /* A.1.1 */
+        comp->width = (pic->width * comp->h + pic->h_max - 1) / pic->h_max;
+        comp->height = (pic->height * comp->v + pic->v_max - 1) / pic->v_max;
+    }
+    pic->mcus_x = (pic->width + 8 * pic->h_max - 1) / (8 * pic->h_max);
+    pic->mcus_y = (pic->height + 8 * pic->v_max - 1) / (8 * pic->v_max);
+    pic->y_in_surface = pic->mcus_x * pic->h_max * 8 <= pic->stride &&
+                        pic->mcus_y * pic->v_max * 8 <= (int) obj_surface->storage->luma_height;
+    return VA_STATUS_SUCCESS;
+}
+
+static struct epiphany_jpeg_decoder *
+jpeg_create_decoder(void)
+{
+    return calloc(1, sizeof(struct epiphany_jpeg_decoder));
+}
+
+void
+epiphany_jpeg_destroy_decoder(void *data)
+{
+    struct epiphany_jpeg_decoder *decoder = data;
+
+    if (NULL == decoder)
+        return;
+    free(decoder->planes);
+    free(decoder);
+}
+
+VAStatus
+epiphany_jpeg_decode_picture(struct epiphany_driver_data *driver_data,
+                             object_context_p obj_context,
+                             const struct epiphany_picture *picture,
+                             object_surface_p obj_surface)
+{
+    struct epiphany_jpeg_decoder *decoder = obj_context->decoder;
+    struct jpeg_picture *pic;
+    VAStatus vaStatus;
+    int i, j;
+
+    /* Too big for the stack of client threads */
+    pic = malloc(sizeof(*pic));
+    if (NULL == pic)
+        return VA_STATUS_ERROR_ALLOCATION_FAILED;
+    vaStatus = jpeg_init_picture(driver_data, picture, obj_surface, pic);
+    if (VA_STATUS_SUCCESS != vaStatus)
+        goto out;
+
+    if (NULL == decoder) {
+        decoder = jpeg_create_decoder();
+        if (NULL == decoder) {
+            vaStatus = VA_STATUS_ERROR_ALLOCATION_FAILED;
+            goto out;
+        }
+        obj_context->decoder = decoder;
+    }
+    pic->decoder = decoder;
+    vaStatus = jpeg_setup_huffman(driver_data, picture, decoder);
+    if (VA_STATUS_SUCCESS != vaStatus)
+        goto out;
+    if (jpeg_setup_planes(decoder, pic) < 0) {
+        vaStatus = VA_STATUS_ERROR_ALLOCATION_FAILED;
+        goto out;
+    }
+
+    /* Slice parameter buffers pair up with the slice data buffers in order */
+    for (i = 0; i < picture->slice_params.num_buffers && i < picture->slice_data.num_buffers; i++) {
+        object_buffer_p obj_params = BUFFER(picture->slice_params.buffers[i]);
+        object_buffer_p obj_data = BUFFER(picture->slice_data.buffers[i]);
+        size_t data_size;
+
+        if (NULL == obj_params || NULL == obj_data ||
+            obj_params->element_size < sizeof(VASliceParameterBufferJPEGBaseline))
+            continue;
+        data_size = (size_t) obj_data->element_size * obj_data->num_elements;
+        for (j = 0; j < obj_params->num_elements; j++) {
+            const VASliceParameterBufferJPEGBaseline *slice_param = (const VASliceParameterBufferJPEGBaseline *)
+                ((const uint8_t *) obj_params->buffer_data + (size_t) j * obj_params->element_size);
+
+            if (slice_param->slice_data_offset > data_size ||
+                slice_param->slice_data_size > data_size - slice_param->slice_data_offset)
+                continue;
+            jpeg_decode_scan(pic, slice_param, obj_data->buffer_data);
+        }
+    }
+
+    if (!pic->y_in_surface) {
+        const struct jpeg_component *y = &pic->components[0];
+
+        for (i = 0; i < pic->height; i++)
+            memcpy(pic->y + i * pic->stride, y->plane + i * y->stride, pic->width);
+    }
+    jpeg_output_chroma(pic);
+
+out:
+    free(pic);
+    return vaStatus;
+}
+
+#endif /* HAVE_VA_JPEG_DECODE */
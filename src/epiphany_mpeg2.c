@@ -0,0 +1,1829 @@
+/*
+ * Copyright (c) 2012 Scott Tincman <sctincman@gmail.com>. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+/*
+ * MPEG-2 main profile VLD decoding (ISO/IEC 13818-2) on the host CPU.
+ *
+ * The client parsed everything down to the slices, so this is the
+ * macroblock layer: variable length decoding, inverse quantisation, the
+ * inverse DCT and motion compensation. Both frame and field pictures are
+ * supported, 4:2:0 only. Damaged slices are cut short at the first
+ * macroblock that does not parse, hardware decoders behave the same way.
+ *
+ * Slices reset every prediction from neighbouring macroblocks and never
+ * leave their macroblock row, so with a thread pool on the context each
+ * row of a picture is a task of its own, decoding its slices in order.
+ *
+ * The MoComp entrypoint reuses the prediction and block store halves for
+ * clients that parse the bitstream and transform the blocks themselves.
+ * It is also the first path ported to the coprocessor: with an emulated
+ * mesh running, the macroblocks are reconstructed on its cores.
+ */
+
+#include "config.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "epiphany_mpeg2.h"
+#include "bitstream.h"
+#include "vlc.h"
+
+#define MPEG2_PICTURE_I         1
+#define MPEG2_PICTURE_P         2
+#define MPEG2_PICTURE_B         3
+
+#define MPEG2_TOP_FIELD         1
+#define MPEG2_BOTTOM_FIELD      2
+#define MPEG2_FRAME             3
+
+/* frame_motion_type and field_motion_type */
+#define MPEG2_MC_FIELD          1
+#define MPEG2_MC_FRAME          2       /* Frame pictures */
+#define MPEG2_MC_16X8           2       /* Field pictures */
+#define MPEG2_MC_DMV            3
+
+/* macroblock_type flags besides VA_MB_TYPE_MOTION_* */
+#define MPEG2_MB_QUANT          0x01
+
+/* Symbols beyond the values of the tables */
+#define MPEG2_MB_ESCAPE         34
+#define MPEG2_MB_STUFFING       35
+#define MPEG2_DCT_EOB           4095
+#define MPEG2_DCT_ESCAPE        4094
+#define MPEG2_DCT(run, level)   (((run) << 6) | (level))
+
+#define MPEG2_EDGE_STRIDE       32
+
+/* Rough cycle counts an Epiphany core would spend, charged to emulated cores */
+#define MPEG2_EMESH_MACROBLOCK_CYCLES   120     /* Command fetch and control */
+#define MPEG2_EMESH_SAMPLE_CYCLES       1       /* Per byte predicted, per half-sample direction */
+#define MPEG2_EMESH_BLOCK_CYCLES        160     /* Adding or storing a residual block */
+#define MPEG2_EMESH_IDCT_CYCLES         400     /* Inverse transform of a block */
+
+/* A slice parameter element and the slice data buffer it points into */
+struct mpeg2_slice {
+    const VASliceParameterBufferMPEG2 *param;
+    const uint8_t *data;
+};
+
+struct mpeg2_picture;
+
+/* The slices of one macroblock row, decoded by a pool task */
+struct mpeg2_row {
+    struct thread_pool_task task;
+    struct epiphany_mpeg2_decoder *decoder;
+    int first_slice;            /* In the decoder's slice table */
+    int num_slices;
+};
+
+struct epiphany_mpeg2_decoder {
+    /* Quantiser matrices in raster order, they persist until reloaded */
+    uint8_t intra_matrix[64];
+    uint8_t non_intra_matrix[64];
+    /* Decoding rows on the pool */
+    thread_pool_p pool;
+    const struct mpeg2_picture *picture;        /* Copied by each row task */
+    struct mpeg2_slice *slices;                 /* By row, in order within each */
+    int max_slices;
+    struct mpeg2_row *rows;
+    int max_rows;
+    unsigned int pending;                       /* Row tasks not finished, updated atomically */
+};
+
+/* A frame, or one field of it */
+struct mpeg2_view {
+    uint8_t *y;
+    uint8_t *uv;
+    ptrdiff_t stride;
+    int height;                 /* Luma lines */
+};
+
+struct mpeg2_motion {
+    int type;                   /* macroblock_type */
+    int motion_type;
+    int mv[2][2][2];            /* [vector][forward, backward][x, y] in half samples */
+    int field_select[2][2];     /* [vector][forward, backward] */
+    int dmv[2][2];              /* Dual prime vectors for the opposite parity */
+};
+
+/* A macroblock as a mesh core reconstructs it */
+struct mpeg2_mesh_macroblock {
+    int mb_x;
+    int mb_y;
+    int cbp;
+    int intra;
+    int dct_type;
+    int predict;                /* Motion compensated */
+    int load;                   /* Keeps the samples the macroblock leaves alone */
+    struct mpeg2_motion motion;
+    const int16_t *blocks[6];   /* Residual blocks, in the client's buffers for MoComp */
+    int first_block;            /* VLD: first coded block in the coefficient store */
+};
+
+/* The run of macroblocks one core reconstructs */
+struct mpeg2_mesh_work {
+    const struct mpeg2_picture *pic;
+    const struct mpeg2_mesh_macroblock *macroblocks;
+    int num_macroblocks;
+    int transform;              /* The blocks are coefficients (VLD), not residuals */
+};
+
+/* The macroblocks the mesh reconstructs, in the order the client sent or coded them */
+struct mpeg2_mesh_macroblocks {
+    struct mpeg2_mesh_macroblock *macroblocks;
+    int num_macroblocks;
+    int max_macroblocks;
+    /* VLD: the coded blocks the host decoded, in transform domain */
+    int16_t (*coefficients)[64];
+    int num_blocks;
+    int max_blocks;
+    int failed;                 /* Out of memory while decoding the slices */
+};
+
+struct mpeg2_picture {
+    const struct dsp_ops *dsp;
+    const struct epiphany_mpeg2_decoder *decoder;
+    int coding_type;
+    int structure;
+    int parity;                 /* Bottom field picture */
+    int top_field_first;
+    int frame_pred_frame_dct;
+    int concealment_motion_vectors;
+    int q_scale_type;
+    int intra_vlc_format;
+    int intra_dc_precision;
+    int is_first_field;
+    int f_code[2][2];
+    const uint8_t *scan;
+    int width;                  /* Luma samples in a line of macroblocks */
+    int height;                 /* Luma lines of the coded frame */
+    int mb_width;
+    int mb_height;              /* Macroblock rows of the frame or field */
+    struct surface_storage *current;
+    struct surface_storage *forward;
+    struct surface_storage *backward;
+    struct mpeg2_view dst;
+
+    /* Slice state */
+    struct bitstream bs;
+    int quantiser_scale;
+    int dc_pred[3];
+    int pmv[2][2][2];
+    struct mpeg2_motion last;   /* Repeated by skipped macroblocks of B pictures */
+    int16_t blocks[6][64] __attribute__((aligned(16)));
+    uint8_t edge[MPEG2_EDGE_STRIDE * 17];
+    uint8_t fetch[MPEG2_EDGE_STRIDE * 17];      /* Mesh DMA staging */
+    emesh_core_p core;          /* Mesh core running the picture, NULL on the host */
+    struct mpeg2_mesh_macroblocks *mesh;        /* VLD: macroblocks queued for the mesh, NULL otherwise */
+};
+
+static const uint8_t mpeg2_zigzag_scan[64] = {
+     0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+};
+
+static const uint8_t mpeg2_alternate_scan[64] = {
+     0,  8, 16, 24,  1,  9,  2, 10, 17, 25, 32, 40, 48, 56, 57, 49,
+    41, 33, 26, 18,  3, 11,  4, 12, 19, 27, 34, 42, 50, 58, 35, 43,
+    51, 59, 20, 28,  5, 13,  6, 14, 21, 29, 36, 44, 52, 60, 37, 45,
+    53, 61, 22, 30,  7, 15, 23, 31, 38, 46, 54, 62, 39, 47, 55, 63,
+};
+
+static const uint8_t mpeg2_default_intra_matrix[64] = {
+     8, 16, 19, 22, 26, 27, 29, 34,
+    16, 16, 22, 24, 27, 29, 34, 37,
+    19, 22, 26, 27, 29, 34, 34, 38,
+    22, 22, 26, 27, 29, 34, 37, 40,
+    22, 26, 27, 29, 32, 35, 40, 48,
+    26, 27, 29, 32, 35, 40, 48, 58,
+    26, 27, 29, 34, 38, 46, 56, 69,
+    27, 29, 35, 38, 46, 56, 69, 83,
+};
+
+static const uint8_t mpeg2_non_linear_quantiser_scale[32] = {
+     0,  1,  2,  3,  4,  5,  6,  7,  8, 10, 12, 14, 16, 18, 20, 22,
+    24, 28, 32, 36, 40, 44, 48, 52, 56, 64, 72, 80, 88, 96, 104, 112,
+};
+
+/* Table B.1, macroblock_address_increment */
+static const struct vlc_code mpeg2_mb_increment_codes[] = {
+    { 0x1, 1, 1 }, { 0x3, 3, 2 }, { 0x2, 3, 3 }, { 0x3, 4, 4 },
+    { 0x2, 4, 5 }, { 0x3, 5, 6 }, { 0x2, 5, 7 }, { 0x7, 7, 8 },
+    { 0x6, 7, 9 }, { 0xb, 8, 10 }, { 0xa, 8, 11 }, { 0x9, 8, 12 },
+    { 0x8, 8, 13 }, { 0x7, 8, 14 }, { 0x6, 8, 15 }, { 0x17, 10, 16 },
+    { 0x16, 10, 17 }, { 0x15, 10, 18 }, { 0x14, 10, 19 }, { 0x13, 10, 20 },
+    { 0x12, 10, 21 }, { 0x23, 11, 22 }, { 0x22, 11, 23 }, { 0x21, 11, 24 },
+    { 0x20, 11, 25 }, { 0x1f, 11, 26 }, { 0x1e, 11, 27 }, { 0x1d, 11, 28 },
+    { 0x1c, 11, 29 }, { 0x1b, 11, 30 }, { 0x1a, 11, 31 }, { 0x19, 11, 32 },
+    { 0x18, 11, 33 }, { 0x8, 11, MPEG2_MB_ESCAPE }, { 0xf, 11, MPEG2_MB_STUFFING },
+};
+
+#define MB_FWD  VA_MB_TYPE_MOTION_FORWARD
+#define MB_BWD  VA_MB_TYPE_MOTION_BACKWARD
+#define MB_PAT  VA_MB_TYPE_MOTION_PATTERN
+#define MB_INTRA VA_MB_TYPE_MOTION_INTRA
+
+/* Tables B.2 to B.4, macroblock_type in I, P and B pictures */
+static const struct vlc_code mpeg2_mb_type_i_codes[] = {
+    { 0x1, 1, MB_INTRA }, { 0x1, 2, MPEG2_MB_QUANT | MB_INTRA },
+};
+
+static const struct vlc_code mpeg2_mb_type_p_codes[] = {
+    { 0x1, 1, MB_FWD | MB_PAT },
+    { 0x1, 2, MB_PAT },
+    { 0x1, 3, MB_FWD },
+    { 0x3, 5, MB_INTRA },
+    { 0x2, 5, MPEG2_MB_QUANT | MB_FWD | MB_PAT },
+    { 0x1, 5, MPEG2_MB_QUANT | MB_PAT },
+    { 0x1, 6, MPEG2_MB_QUANT | MB_INTRA },
+};
+
+static const struct vlc_code mpeg2_mb_type_b_codes[] = {
+    { 0x2, 2, MB_FWD | MB_BWD },
+    { 0x3, 2, MB_FWD | MB_BWD | MB_PAT },
+    { 0x2, 3, MB_BWD },
+    { 0x3, 3, MB_BWD | MB_PAT },
+    { 0x2, 4, MB_FWD },
+    { 0x3, 4, MB_FWD | MB_PAT },
+    { 0x3, 5, MB_INTRA },
+    { 0x2, 5, MPEG2_MB_QUANT | MB_FWD | MB_BWD | MB_PAT },
+    { 0x3, 6, MPEG2_MB_QUANT | MB_FWD | MB_PAT },
+    { 0x2, 6, MPEG2_MB_QUANT | MB_BWD | MB_PAT },
+    { 0x1, 6, MPEG2_MB_QUANT | MB_INTRA },
+};
+
+/* Table B.9, coded_block_pattern, indexed by the pattern */
+static const uint16_t mpeg2_cbp_codes[64][2] = {
+    { 0x1, 9 }, { 0xb, 5 }, { 0x9, 5 }, { 0xd, 6 }, { 0xd, 4 }, { 0x17, 7 }, { 0x13, 7 }, { 0x1f, 8 },
+    { 0xc, 4 }, { 0x16, 7 }, { 0x12, 7 }, { 0x1e, 8 }, { 0x13, 5 }, { 0x1b, 8 }, { 0x17, 8 }, { 0x13, 8 },
+    { 0xb, 4 }, { 0x15, 7 }, { 0x11, 7 }, { 0x1d, 8 }, { 0x11, 5 }, { 0x19, 8 }, { 0x15, 8 }, { 0x11, 8 },
+    { 0xf, 6 }, { 0xf, 8 }, { 0xd, 8 }, { 0x3, 9 }, { 0xf, 5 }, { 0xb, 8 }, { 0x7, 8 }, { 0x7, 9 },
+    { 0xa, 4 }, { 0x14, 7 }, { 0x10, 7 }, { 0x1c, 8 }, { 0xe, 6 }, { 0xe, 8 }, { 0xc, 8 }, { 0x2, 9 },
+    { 0x10, 5 }, { 0x18, 8 }, { 0x14, 8 }, { 0x10, 8 }, { 0xe, 5 }, { 0xa, 8 }, { 0x6, 8 }, { 0x6, 9 },
+    { 0x12, 5 }, { 0x1a, 8 }, { 0x16, 8 }, { 0x12, 8 }, { 0xd, 5 }, { 0x9, 8 }, { 0x5, 8 }, { 0x5, 9 },
+    { 0xc, 5 }, { 0x8, 8 }, { 0x4, 8 }, { 0x4, 9 }, { 0x7, 3 }, { 0xa, 5 }, { 0x8, 5 }, { 0xc, 6 },
+};
+
+/* Table B.10, motion_code magnitude, the sign bit follows */
+static const uint16_t mpeg2_motion_codes[17][2] = {
+    { 0x1, 1 }, { 0x1, 2 }, { 0x1, 3 }, { 0x1, 4 }, { 0x3, 6 }, { 0x5, 7 }, { 0x4, 7 }, { 0x3, 7 },
+    { 0xb, 9 }, { 0xa, 9 }, { 0x9, 9 }, { 0x11, 10 }, { 0x10, 10 }, { 0xf, 10 }, { 0xe, 10 },
+    { 0xd, 10 }, { 0xc, 10 },
+};
+
+/* Tables B.12 and B.13, dct_dc_size_luminance and dct_dc_size_chrominance */
+static const uint16_t mpeg2_dc_luma_codes[12][2] = {
+    { 0x4, 3 }, { 0x0, 2 }, { 0x1, 2 }, { 0x5, 3 }, { 0x6, 3 }, { 0xe, 4 },
+    { 0x1e, 5 }, { 0x3e, 6 }, { 0x7e, 7 }, { 0xfe, 8 }, { 0x1fe, 9 }, { 0x1ff, 9 },
+};
+
+static const uint16_t mpeg2_dc_chroma_codes[12][2] = {
+    { 0x0, 2 }, { 0x1, 2 }, { 0x2, 2 }, { 0x6, 3 }, { 0xe, 4 }, { 0x1e, 5 },
+    { 0x3e, 6 }, { 0x7e, 7 }, { 0xfe, 8 }, { 0x1fe, 9 }, { 0x3fe, 10 }, { 0x3ff, 10 },
+};
+
+/*
+ * Tables B.14 and B.15, DCT coefficients table zero and one. Codes without
+ * the sign bit, by run and then level; runs go up to the levels listed in
+ * mpeg2_dct_max_level.
+ */
+static const uint8_t mpeg2_dct_max_level[32] = {
+    40, 18, 5, 4, 3, 3, 3, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+     2,  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+};
+
+#define MPEG2_DCT_CODES         111
+
+static const uint16_t mpeg2_dct_zero_codes[MPEG2_DCT_CODES][2] = {
+    /* run 0 */
+    { 0x3, 2 }, { 0x4, 4 }, { 0x5, 5 }, { 0x6, 7 }, { 0x26, 8 }, { 0x21, 8 }, { 0xa, 10 }, { 0x1d, 12 },
+    { 0x18, 12 }, { 0x13, 12 }, { 0x10, 12 }, { 0x1a, 13 }, { 0x19, 13 }, { 0x18, 13 }, { 0x17, 13 },
+    { 0x1f, 14 }, { 0x1e, 14 }, { 0x1d, 14 }, { 0x1c, 14 }, { 0x1b, 14 }, { 0x1a, 14 }, { 0x19, 14 },
+    { 0x18, 14 }, { 0x17, 14 }, { 0x16, 14 }, { 0x15, 14 }, { 0x14, 14 }, { 0x13, 14 }, { 0x12, 14 },
+    { 0x11, 14 }, { 0x10, 14 }, { 0x18, 15 }, { 0x17, 15 }, { 0x16, 15 }, { 0x15, 15 }, { 0x14, 15 },
+    { 0x13, 15 }, { 0x12, 15 }, { 0x11, 15 }, { 0x10, 15 },
+    /* run 1 */
+    { 0x3, 3 }, { 0x6, 6 }, { 0x25, 8 }, { 0xc, 10 }, { 0x1b, 12 }, { 0x16, 13 }, { 0x15, 13 },
+    { 0x1f, 15 }, { 0x1e, 15 }, { 0x1d, 15 }, { 0x1c, 15 }, { 0x1b, 15 }, { 0x1a, 15 }, { 0x19, 15 },
+    { 0x13, 16 }, { 0x12, 16 }, { 0x11, 16 }, { 0x10, 16 },
+    /* runs 2 to 6 */
+    { 0x5, 4 }, { 0x4, 7 }, { 0xb, 10 }, { 0x14, 12 }, { 0x14, 13 },
+    { 0x7, 5 }, { 0x24, 8 }, { 0x1c, 12 }, { 0x13, 13 },
+    { 0x6, 5 }, { 0xf, 10 }, { 0x12, 12 },
+    { 0x7, 6 }, { 0x9, 10 }, { 0x12, 13 },
+    { 0x5, 6 }, { 0x1e, 12 }, { 0x14, 16 },
+    /* runs 7 to 16 */
+    { 0x4, 6 }, { 0x15, 12 }, { 0x7, 7 }, { 0x11, 12 }, { 0x5, 7 }, { 0x11, 13 },
+    { 0x27, 8 }, { 0x10, 13 }, { 0x23, 8 }, { 0x1a, 16 }, { 0x22, 8 }, { 0x19, 16 },
+    { 0x20, 8 }, { 0x18, 16 }, { 0xe, 10 }, { 0x17, 16 }, { 0xd, 10 }, { 0x16, 16 },
+    { 0x8, 10 }, { 0x15, 16 },
+    /* runs 17 to 31 */
+    { 0x1f, 12 }, { 0x1a, 12 }, { 0x19, 12 }, { 0x17, 12 }, { 0x16, 12 },
+    { 0x1f, 13 }, { 0x1e, 13 }, { 0x1d, 13 }, { 0x1c, 13 }, { 0x1b, 13 },
+    { 0x1f, 16 }, { 0x1e, 16 }, { 0x1d, 16 }, { 0x1c, 16 }, { 0x1b, 16 },
+};
+
+static const uint16_t mpeg2_dct_one_codes[MPEG2_DCT_CODES][2] = {
+    /* run 0 */
+    { 0x2, 2 }, { 0x6, 3 }, { 0x7, 4 }, { 0x1c, 5 }, { 0x1d, 5 }, { 0x5, 6 }, { 0x4, 6 }, { 0x7b, 7 },
+    { 0x7c, 7 }, { 0x23, 8 }, { 0x22, 8 }, { 0xfa, 8 }, { 0xfb, 8 }, { 0xfe, 8 }, { 0xff, 8 },
+    { 0x1f, 14 }, { 0x1e, 14 }, { 0x1d, 14 }, { 0x1c, 14 }, { 0x1b, 14 }, { 0x1a, 14 }, { 0x19, 14 },
+    { 0x18, 14 }, { 0x17, 14 }, { 0x16, 14 }, { 0x15, 14 }, { 0x14, 14 }, { 0x13, 14 }, { 0x12, 14 },
+    { 0x11, 14 }, { 0x10, 14 }, { 0x18, 15 }, { 0x17, 15 }, { 0x16, 15 }, { 0x15, 15 }, { 0x14, 15 },
+    { 0x13, 15 }, { 0x12, 15 }, { 0x11, 15 }, { 0x10, 15 },
+    /* run 1 */
+    { 0x2, 3 }, { 0x6, 5 }, { 0x79, 7 }, { 0x27, 8 }, { 0x20, 8 }, { 0x16, 13 }, { 0x15, 13 },
+    { 0x1f, 15 }, { 0x1e, 15 }, { 0x1d, 15 }, { 0x1c, 15 }, { 0x1b, 15 }, { 0x1a, 15 }, { 0x19, 15 },
+    { 0x13, 16 }, { 0x12, 16 }, { 0x11, 16 }, { 0x10, 16 },
+    /* runs 2 to 6 */
+    { 0x5, 5 }, { 0x7, 7 }, { 0xfc, 8 }, { 0xc, 10 }, { 0x14, 13 },
+    { 0x7, 5 }, { 0x26, 8 }, { 0x1c, 12 }, { 0x13, 13 },
+    { 0x6, 6 }, { 0xfd, 8 }, { 0x12, 12 },
+    { 0x7, 6 }, { 0x4, 9 }, { 0x12, 13 },
+    { 0x6, 7 }, { 0x1e, 12 }, { 0x14, 16 },
+    /* runs 7 to 16 */
+    { 0x4, 7 }, { 0x15, 12 }, { 0x5, 7 }, { 0x11, 12 }, { 0x78, 7 }, { 0x11, 13 },
+    { 0x7a, 7 }, { 0x10, 13 }, { 0x21, 8 }, { 0x1a, 16 }, { 0x25, 8 }, { 0x19, 16 },
+    { 0x24, 8 }, { 0x18, 16 }, { 0x5, 9 }, { 0x17, 16 }, { 0x7, 9 }, { 0x16, 16 },
+    { 0xd, 10 }, { 0x15, 16 },
+    /* runs 17 to 31 */
+    { 0x1f, 12 }, { 0x1a, 12 }, { 0x19, 12 }, { 0x17, 12 }, { 0x16, 12 },
+    { 0x1f, 13 }, { 0x1e, 13 }, { 0x1d, 13 }, { 0x1c, 13 }, { 0x1b, 13 },
+    { 0x1f, 16 }, { 0x1e, 16 }, { 0x1d, 16 }, { 0x1c, 16 }, { 0x1b, 16 },
+};
+
+static struct vlc mpeg2_mb_increment_vlc;
+static struct vlc mpeg2_mb_type_vlc[3];
+static struct vlc mpeg2_cbp_vlc;
+static struct vlc mpeg2_motion_vlc;
+static struct vlc mpeg2_dc_luma_vlc;
+static struct vlc mpeg2_dc_chroma_vlc;
+static struct vlc mpeg2_dct_zero_vlc;
+static struct vlc mpeg2_dct_one_vlc;
+
+static struct vlc_entry mpeg2_mb_increment_table[512];
+static struct vlc_entry mpeg2_mb_type_table[3][64];
+static struct vlc_entry mpeg2_cbp_table[512];
+static struct vlc_entry mpeg2_motion_table[1024];
+static struct vlc_entry mpeg2_dc_luma_table[512];
+static struct vlc_entry mpeg2_dc_chroma_table[1024];
+static struct vlc_entry mpeg2_dct_zero_table[1024];
+static struct vlc_entry mpeg2_dct_one_table[1024];
+
+static pthread_once_t mpeg2_tables_once = PTHREAD_ONCE_INIT;
+static int mpeg2_tables_status = -1;
+
+/* Builds the table for codes given by symbol */
+static int
+mpeg2_init_indexed_vlc(struct vlc *vlc, int bits, const uint16_t (*codes)[2], int num_codes,
+                       struct vlc_entry *table, int max_entries)
+{
+    struct vlc_code list[64];
+    int i;
+
+    for (i = 0; i < num_codes; i++) {
+        list[i].code = codes[i][0];
+        list[i].length = codes[i][1];
+        list[i].symbol = i;
+    }
+    return vlc_init(vlc, bits, list, num_codes, table, max_entries);
+}
+
+static int
+mpeg2_init_dct_vlc(struct vlc *vlc, const uint16_t (*codes)[2], uint16_t eob_code, int eob_length,
+                   struct vlc_entry *table, int max_entries)
+{
+    struct vlc_code list[MPEG2_DCT_CODES + 2];
+    int run, level, i = 0;
+
+    for (run = 0; run < 32; run++) {
+        for (level = 1; level <= mpeg2_dct_max_level[run]; level++, i++) {
+            list[i].code = codes[i][0];
+            list[i].length = codes[i][1];
+            list[i].symbol = MPEG2_DCT(run, level);
+        }
+    }
+    list[i].code = 0x1;
+    list[i].length = 6;
+    list[i++].symbol = MPEG2_DCT_ESCAPE;
+    list[i].code = eob_code;
+    list[i].length = eob_length;
+    list[i++].symbol = MPEG2_DCT_EOB;
+    return vlc_init(vlc, 9, list, i, table, max_entries);
+}
+
+static void
+mpeg2_init_tables(void)
+{
+    int status = 0;
+
+    status |= vlc_init(&mpeg2_mb_increment_vlc, 8, mpeg2_mb_increment_codes,
+                       sizeof(mpeg2_mb_increment_codes) / sizeof(mpeg2_mb_increment_codes[0]),
+                       mpeg2_mb_increment_table, 512);
+    status |= vlc_init(&mpeg2_mb_type_vlc[0], 6, mpeg2_mb_type_i_codes,
+                       sizeof(mpeg2_mb_type_i_codes) / sizeof(mpeg2_mb_type_i_codes[0]),
+                       mpeg2_mb_type_table[0], 64);
+    status |= vlc_init(&mpeg2_mb_type_vlc[1], 6, mpeg2_mb_type_p_codes,
+                       sizeof(mpeg2_mb_type_p_codes) / sizeof(mpeg2_mb_type_p_codes[0]),
+                       mpeg2_mb_type_table[1], 64);
+    status |= vlc_init(&mpeg2_mb_type_vlc[2], 6, mpeg2_mb_type_b_codes,
+                       sizeof(mpeg2_mb_type_b_codes) / sizeof(mpeg2_mb_type_b_codes[0]),
+                       mpeg2_mb_type_table[2], 64);
+    status |= mpeg2_init_indexed_vlc(&mpeg2_cbp_vlc, 9, mpeg2_cbp_codes, 64, mpeg2_cbp_table, 512);
+    status |= mpeg2_init_indexed_vlc(&mpeg2_motion_vlc, 10, mpeg2_motion_codes, 17, mpeg2_motion_table, 1024);
+    status |= mpeg2_init_indexed_vlc(&mpeg2_dc_luma_vlc, 9, mpeg2_dc_luma_codes, 12,
+                                     mpeg2_dc_luma_table, 512);
+    status |= mpeg2_init_indexed_vlc(&mpeg2_dc_chroma_vlc, 10, mpeg2_dc_chroma_codes, 12,
+                                     mpeg2_dc_chroma_table, 1024);
+    status |= mpeg2_init_dct_vlc(&mpeg2_dct_zero_vlc, mpeg2_dct_zero_codes, 0x2, 2,
+                                 mpeg2_dct_zero_table, 1024);
+    status |= mpeg2_init_dct_vlc(&mpeg2_dct_one_vlc, mpeg2_dct_one_codes, 0x6, 4,
+                                 mpeg2_dct_one_table, 1024);
+    mpeg2_tables_status = status;
+}
+
+static void
+mpeg2_frame_view(const struct mpeg2_picture *pic, struct surface_storage *storage,
+                 struct mpeg2_view *view)
+{
+    view->y = storage->data;
+    view->uv = storage->data + storage->chroma_offset;
+    view->stride = storage->pitch;
+    view->height = pic->height;
+}
+
+static void
+mpeg2_field_view(const struct mpeg2_picture *pic, struct surface_storage *storage, int parity,
+                 struct mpeg2_view *view)
+{
+    view->y = storage->data + parity * storage->pitch;
+    view->uv = storage->data + storage->chroma_offset + parity * storage->pitch;
+    view->stride = 2 * storage->pitch;
+    view->height = pic->height / 2;
+}
+
+/* The frame holding the reference field of the given parity */
+static struct surface_storage *
+mpeg2_reference(const struct mpeg2_picture *pic, int backward, int parity)
+{
+    if (backward)
+        return pic->backward;
+    /* The second field of a P frame may predict from the first one */
+    if (pic->structure != MPEG2_FRAME && pic->coding_type == MPEG2_PICTURE_P &&
+        !pic->is_first_field && parity != pic->parity)
+        return pic->current;
+    return pic->forward;
+}
+
+/*
+ * Copies a width x height region of samples of bytes_per_sample bytes
+ * at (x, y) of a plane to buf, replicating the plane edges where the
+ * region reaches outside
+ */
+static const uint8_t *
+mpeg2_emulate_edge(uint8_t *buf, const uint8_t *plane, ptrdiff_t stride, int plane_width,
+                   int plane_height, int x, int y, int width, int height, int bytes_per_sample)
+{
+    int i, j, k;
+
+    for (j = 0; j < height; j++) {
+        int row = y + j < 0 ? 0 : (y + j >= plane_height ? plane_height - 1 : y + j);
+        const uint8_t *src = plane + row * stride;
+        uint8_t *dst = buf + j * MPEG2_EDGE_STRIDE;
+
+        for (i = 0; i < width; i++) {
+            int column = x + i < 0 ? 0 : (x + i >= plane_width ? plane_width - 1 : x + i);
+
+            for (k = 0; k < bytes_per_sample; k++)
+                dst[i * bytes_per_sample + k] = src[column * bytes_per_sample + k];
+        }
+    }
+    return buf;
+}
+
+/* Clamps v to [0, max - 1] */
+static inline int
+mpeg2_clamp(int v, int max)
+{
+    return v < 0 ? 0 : (v >= max ? max - 1 : v);
+}
+
+/*
+ * On a mesh core: DMAs the part of a width x height region at (x, y) that
+ * lies inside the plane into pic->fetch, replicating the plane edges into
+ * pic->edge when the region reaches outside
+ */
+static const uint8_t *
+mpeg2_emesh_fetch(struct mpeg2_picture *pic, const uint8_t *plane, ptrdiff_t stride, int plane_width,
+                  int plane_height, int x, int y, int width, int height, int bytes_per_sample)
+{
+    int x0 = mpeg2_clamp(x, plane_width), x1 = mpeg2_clamp(x + width - 1, plane_width);
+    int y0 = mpeg2_clamp(y, plane_height), y1 = mpeg2_clamp(y + height - 1, plane_height);
+
+    emesh_dma_copy(pic->core, 0, pic->fetch, MPEG2_EDGE_STRIDE, plane + y0 * stride + x0 * bytes_per_sample,
+                   stride, (x1 - x0 + 1) * bytes_per_sample, y1 - y0 + 1);
+    if (x0 == x && y0 == y && x1 - x0 + 1 == width && y1 - y0 + 1 == height)
+        return pic->fetch;
+    emesh_compute(pic->core, width * height * bytes_per_sample * MPEG2_EMESH_SAMPLE_CYCLES);
+    return mpeg2_emulate_edge(pic->edge, pic->fetch, MPEG2_EDGE_STRIDE, x1 - x0 + 1, y1 - y0 + 1,
+                              x - x0, y - y0, width, height, bytes_per_sample);
+}
+
+/*
+ * Returns where the prediction reads a width x height region at (x, y) of
+ * a plane from, through pic->edge when it reaches outside the plane
+ */
+static const uint8_t *
+mpeg2_fetch(struct mpeg2_picture *pic, const uint8_t *plane, ptrdiff_t stride, int plane_width,
+            int plane_height, int x, int y, int width, int height, int bytes_per_sample,
+            ptrdiff_t *src_stride)
+{
+    if (pic->core) {
+        *src_stride = MPEG2_EDGE_STRIDE;
+        return mpeg2_emesh_fetch(pic, plane, stride, plane_width, plane_height,
+                                 x, y, width, height, bytes_per_sample);
+    }
+    if (x < 0 || y < 0 || x + width > plane_width || y + height > plane_height) {
+        *src_stride = MPEG2_EDGE_STRIDE;
+        return mpeg2_emulate_edge(pic->edge, plane, stride, plane_width, plane_height,
+                                  x, y, width, height, bytes_per_sample);
+    }
+    *src_stride = stride;
+    return plane + y * stride + x * bytes_per_sample;
+}
+
+/*
+ * Predicts a 16 x height luma region, and the chroma under it, at (x, y)
+ * of ref displaced by mv
+ */
+static void
+mpeg2_predict(struct mpeg2_picture *pic, const struct mpeg2_view *ref,
+              uint8_t *dst_y, uint8_t *dst_uv, ptrdiff_t dst_stride,
+              int x, int y, int height, const int *mv, int avg)
+{
+    const dsp_mc_func (*mc)[4] = avg ? pic->dsp->avg_pixels : pic->dsp->put_pixels;
+    int mx = mv[0], my = mv[1];
+    int sx = x + (mx >> 1), sy = y + (my >> 1);
+    const uint8_t *src;
+    ptrdiff_t src_stride;
+
+    src = mpeg2_fetch(pic, ref->y, ref->stride, pic->width, ref->height,
+                      sx, sy, 16 + (mx & 1), height + (my & 1), 1, &src_stride);
+    mc[DSP_MC_16][((my & 1) << 1) | (mx & 1)](dst_y, dst_stride, src, src_stride, height);
+    if (pic->core)
+        emesh_compute(pic->core, 16 * height * (1 + (mx & 1) + (my & 1) + avg) * MPEG2_EMESH_SAMPLE_CYCLES);
+
+    /* 4:2:0 chroma vectors are halved, truncating toward zero */
+    mx /= 2;
+    my /= 2;
+    x /= 2;
+    y /= 2;
+    height /= 2;
+    sx = x + (mx >> 1);
+    sy = y + (my >> 1);
+    src = mpeg2_fetch(pic, ref->uv, ref->stride, pic->width / 2, ref->height / 2,
+                      sx, sy, 8 + (mx & 1), height + (my & 1), 2, &src_stride);
+    mc[DSP_MC_UV][((my & 1) << 1) | (mx & 1)](dst_uv, dst_stride, src, src_stride, height);
+    if (pic->core)
+        emesh_compute(pic->core, 16 * height * (1 + (mx & 1) + (my & 1) + avg) * MPEG2_EMESH_SAMPLE_CYCLES);
+}
+
+/* Forms the prediction of a non-intra macroblock into dst_y and dst_uv */
+static void
+mpeg2_predict_macroblock(struct mpeg2_picture *pic, uint8_t *dst_y, uint8_t *dst_uv, ptrdiff_t stride,
+                         int mb_x, int mb_y, const struct mpeg2_motion *motion)
+{
+    int x = mb_x * 16;
+    struct mpeg2_view ref;
+    int avg = 0, r, s;
+
+    if (pic->structure == MPEG2_FRAME) {
+        if (motion->motion_type == MPEG2_MC_DMV) {
+            /* Each field averages the same and the opposite parity predictions */
+            for (r = 0; r < 2; r++) {
+                mpeg2_field_view(pic, pic->forward, r, &ref);
+                mpeg2_predict(pic, &ref, dst_y + r * stride, dst_uv + r * stride, 2 * stride,
+                              x, mb_y * 8, 8, motion->mv[0][0], 0);
+                mpeg2_field_view(pic, pic->forward, !r, &ref);
+                mpeg2_predict(pic, &ref, dst_y + r * stride, dst_uv + r * stride, 2 * stride,
+                              x, mb_y * 8, 8, motion->dmv[r], 1);
+            }
+            return;
+        }
+        for (s = 0; s < 2; s++) {
+            if (!(motion->type & (s ? MB_BWD : MB_FWD)))
+                continue;
+            if (motion->motion_type == MPEG2_MC_FIELD) {
+                /* Top and bottom field lines of the macroblock separately */
+                for (r = 0; r < 2; r++) {
+                    mpeg2_field_view(pic, s ? pic->backward : pic->forward, motion->field_select[r][s], &ref);
+                    mpeg2_predict(pic, &ref, dst_y + r * stride, dst_uv + r * stride, 2 * stride,
+                                  x, mb_y * 8, 8, motion->mv[r][s], avg);
+                }
+            } else {
+                mpeg2_frame_view(pic, s ? pic->backward : pic->forward, &ref);
+                mpeg2_predict(pic, &ref, dst_y, dst_uv, stride, x, mb_y * 16, 16, motion->mv[0][s], avg);
+            }
+            avg = 1;
+        }
+        return;
+    }
+
+    if (motion->motion_type == MPEG2_MC_DMV) {
+        mpeg2_field_view(pic, mpeg2_reference(pic, 0, pic->parity), pic->parity, &ref);
+        mpeg2_predict(pic, &ref, dst_y, dst_uv, stride, x, mb_y * 16, 16, motion->mv[0][0], 0);
+        mpeg2_field_view(pic, mpeg2_reference(pic, 0, !pic->parity), !pic->parity, &ref);
+        mpeg2_predict(pic, &ref, dst_y, dst_uv, stride, x, mb_y * 16, 16, motion->dmv[0], 1);
+        return;
+    }
+    for (s = 0; s < 2; s++) {
+        if (!(motion->type & (s ? MB_BWD : MB_FWD)))
+            continue;
+        if (motion->motion_type == MPEG2_MC_16X8) {
+            /* Upper and lower halves of the macroblock separately */
+            for (r = 0; r < 2; r++) {
+                int parity = motion->field_select[r][s];
+
+                mpeg2_field_view(pic, mpeg2_reference(pic, s, parity), parity, &ref);
+                mpeg2_predict(pic, &ref, dst_y + r * 8 * stride, dst_uv + r * 4 * stride, stride,
+                              x, mb_y * 16 + r * 8, 8, motion->mv[r][s], avg);
+            }
+        } else {
+            int parity = motion->field_select[0][s];
+
+            mpeg2_field_view(pic, mpeg2_reference(pic, s, parity), parity, &ref);
+            mpeg2_predict(pic, &ref, dst_y, dst_uv, stride, x, mb_y * 16, 16, motion->mv[0][s], avg);
+        }
+        avg = 1;
+    }
+}
+
+static struct mpeg2_mesh_macroblock *
+mpeg2_mesh_add_macroblock(struct mpeg2_mesh_macroblocks *list, const struct mpeg2_picture *pic,
+                          int address, const struct mpeg2_motion *motion)
+{
+    struct mpeg2_mesh_macroblock *mb;
+
+    if (list->num_macroblocks == list->max_macroblocks) {
+        int max_macroblocks = list->max_macroblocks ? 2 * list->max_macroblocks : 256;
+
+        mb = realloc(list->macroblocks, max_macroblocks * sizeof(*mb));
+        if (NULL == mb)
+            return NULL;
+        list->macroblocks = mb;
+        list->max_macroblocks = max_macroblocks;
+    }
+    mb = &list->macroblocks[list->num_macroblocks++];
+    memset(mb, 0, sizeof(*mb));
+    mb->mb_x = address % pic->mb_width;
+    mb->mb_y = address / pic->mb_width;
+    mb->motion = *motion;
+    mb->intra = motion->type & MB_INTRA;
+    mb->predict = !mb->intra && (motion->type & (MB_FWD | MB_BWD));
+    mb->load = !mb->intra && !mb->predict;
+    return mb;
+}
+
+/* Forms the prediction of a non-intra macroblock */
+static void
+mpeg2_motion_compensate(struct mpeg2_picture *pic, int mb_x, int mb_y,
+                        const struct mpeg2_motion *motion)
+{
+    ptrdiff_t stride = pic->dst.stride;
+
+    /* The mesh cores predict the macroblock when they reconstruct it */
+    if (pic->mesh) {
+        if (NULL == mpeg2_mesh_add_macroblock(pic->mesh, pic, mb_y * pic->mb_width + mb_x, motion))
+            pic->mesh->failed = 1;
+        return;
+    }
+    mpeg2_predict_macroblock(pic, pic->dst.y + mb_y * 16 * stride + mb_x * 16,
+                             pic->dst.uv + mb_y * 8 * stride + mb_x * 16, stride, mb_x, mb_y, motion);
+}
+
+/* Stores (intra) or adds the spatial blocks of a macroblock to dst_y and dst_uv, then clears them */
+static void
+mpeg2_add_blocks(struct mpeg2_picture *pic, uint8_t *dst_y, uint8_t *dst_uv, ptrdiff_t stride,
+                 int cbp, int intra, int dct_type)
+{
+    const struct dsp_ops *dsp = pic->dsp;
+    /* Field DCT interleaves the lines of the top and bottom luma blocks */
+    ptrdiff_t block_stride = dct_type ? 2 * stride : stride;
+    ptrdiff_t block_offset = dct_type ? stride : 8 * stride;
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        uint8_t *dst = dst_y + (i & 1) * 8 + (i >> 1) * block_offset;
+
+        if (!(cbp & (32 >> i)))
+            continue;
+        if (intra)
+            dsp->put_block(dst, block_stride, pic->blocks[i]);
+        else
+            dsp->add_block(dst, block_stride, pic->blocks[i]);
+        memset(pic->blocks[i], 0, sizeof(pic->blocks[i]));
+    }
+
+    if (!(cbp & 3))
+        return;
+    if (intra)
+        dsp->put_block_uv(dst_uv, stride, pic->blocks[4], pic->blocks[5]);
+    else
+        dsp->add_block_uv(dst_uv, stride, pic->blocks[4], pic->blocks[5]);
+    memset(pic->blocks[4], 0, 2 * sizeof(pic->blocks[4]));
+}
+
+/* Stores (intra) or adds the spatial blocks of a macroblock, then clears them */
+static void
+mpeg2_store_blocks(struct mpeg2_picture *pic, int mb_x, int mb_y, int cbp, int intra, int dct_type)
+{
+    ptrdiff_t stride = pic->dst.stride;
+
+    mpeg2_add_blocks(pic, pic->dst.y + mb_y * 16 * stride + mb_x * 16,
+                     pic->dst.uv + mb_y * 8 * stride + mb_x * 16, stride, cbp, intra, dct_type);
+}
+
+/*
+ * VLD on the mesh: moves the coded blocks of a macroblock to the coefficient
+ * store for a core to transform and store or add, clearing them
+ */
+static void
+mpeg2_mesh_queue_blocks(struct mpeg2_picture *pic, int mb_x, int mb_y, int cbp, int intra, int dct_type)
+{
+    struct mpeg2_mesh_macroblocks *list = pic->mesh;
+    struct mpeg2_mesh_macroblock *mb = NULL;
+    struct mpeg2_motion motion;
+    int k;
+
+    if (intra) {
+        memset(&motion, 0, sizeof(motion));
+        motion.type = MB_INTRA;
+        mb = mpeg2_mesh_add_macroblock(list, pic, mb_y * pic->mb_width + mb_x, &motion);
+    } else if (list->num_macroblocks > 0) {
+        /* Queued by mpeg2_motion_compensate() */
+        mb = &list->macroblocks[list->num_macroblocks - 1];
+    }
+    if (list->num_blocks + 6 > list->max_blocks) {
+        int max_blocks = list->max_blocks ? 2 * list->max_blocks : 6 * 256;
+        int16_t (*coefficients)[64] = realloc(list->coefficients, max_blocks * sizeof(*coefficients));
+
+        if (NULL == coefficients) {
+            mb = NULL;
+        } else {
+            list->coefficients = coefficients;
+            list->max_blocks = max_blocks;
+        }
+    }
+    if (NULL == mb || mb->mb_x != mb_x || mb->mb_y != mb_y) {
+        list->failed = 1;
+        memset(pic->blocks, 0, sizeof(pic->blocks));
+        return;
+    }
+
+    mb->cbp = cbp;
+    mb->dct_type = dct_type;
+    mb->first_block = list->num_blocks;
+    for (k = 0; k < 6; k++) {
+        if (!(cbp & (32 >> k)))
+            continue;
+        memcpy(list->coefficients[list->num_blocks++], pic->blocks[k], sizeof(pic->blocks[k]));
+        memset(pic->blocks[k], 0, sizeof(pic->blocks[k]));
+    }
+}
+
+/* Transforms the coded blocks of a macroblock and stores or adds them */
+static void
+mpeg2_reconstruct(struct mpeg2_picture *pic, int mb_x, int mb_y, int cbp, int intra, int dct_type)
+{
+    int i;
+
+    if (pic->mesh) {
+        mpeg2_mesh_queue_blocks(pic, mb_x, mb_y, cbp, intra, dct_type);
+        return;
+    }
+    for (i = 0; i < 6; i++) {
+        if (cbp & (32 >> i))
+            pic->dsp->idct(pic->blocks[i]);
+    }
+    mpeg2_store_blocks(pic, mb_x, mb_y, cbp, intra, dct_type);
+}
+
+static void
+mpeg2_reset_dc_pred(struct mpeg2_picture *pic)
+{
+    pic->dc_pred[0] = pic->dc_pred[1] = pic->dc_pred[2] = 1 << (pic->intra_dc_precision + 7);
+}
+
+static int
+mpeg2_quantiser_scale(const struct mpeg2_picture *pic, int code)
+{
+    return pic->q_scale_type ? mpeg2_non_linear_quantiser_scale[code & 31] : (code & 31) * 2;
+}
+
+static inline int
+mpeg2_dequantise(int level, int weight, int quantiser_scale, int intra)
+{
+    int value = (2 * level + (intra ? 0 : (level > 0) - (level < 0))) * weight * quantiser_scale / 32;
+
+    return value < -2048 ? -2048 : (value > 2047 ? 2047 : value);
+}
+
+/*
+ * Decodes the coefficients of one block into raster order.
+ * Return 0 on success, -1 on a bitstream error
+ */
+static int
+mpeg2_decode_block(struct mpeg2_picture *pic, int16_t *block, int cc, int intra)
+{
+    struct bitstream *bs = &pic->bs;
+    const uint8_t *matrix = intra ? pic->decoder->intra_matrix : pic->decoder->non_intra_matrix;
+    const struct vlc *table = &mpeg2_dct_zero_vlc;
+    int qscale = pic->quantiser_scale;
+    int i = 0, sum = 0;
+
+    if (intra) {
+        int size = vlc_get(bs, cc ? &mpeg2_dc_chroma_vlc : &mpeg2_dc_luma_vlc);
+
+        if (size == VLC_INVALID)
+            return -1;
+        if (size) {
+            int diff = bitstream_get_bits(bs, size);
+
+            if (!(diff >> (size - 1)))
+                diff -= (1 << size) - 1;
+            pic->dc_pred[cc] += diff;
+        }
+        sum = block[0] = pic->dc_pred[cc] * (8 >> pic->intra_dc_precision);
+        i = 1;
+        if (pic->intra_vlc_format)
+            table = &mpeg2_dct_one_vlc;
+    } else if (bitstream_show_bits(bs, 1)) {
+        /* A first coefficient of run 0, level 1 is coded as '1s' */
+        int level = bitstream_get_bits(bs, 2) & 1 ? -1 : 1;
+
+        sum = block[0] = mpeg2_dequantise(level, matrix[0], qscale, 0);
+        i = 1;
+    }
+
+    for (;;) {
+        int symbol = vlc_get(bs, table);
+        int run, level, pos;
+
+        if (symbol == VLC_INVALID)
+            return -1;
+        if (symbol == MPEG2_DCT_EOB)
+            break;
+        if (symbol == MPEG2_DCT_ESCAPE) {
+            run = bitstream_get_bits(bs, 6);
+            level = bitstream_get_sbits(bs, 12);
+            if (level == 0 || level == -2048)
+                return -1;
+        } else {
+            run = symbol >> 6;
+            level = bitstream_get_bit(bs) ? -(symbol & 63) : symbol & 63;
+        }
+        i += run;
+        if (i > 63)
+            return -1;
+        pos = pic->scan[i++];
+        block[pos] = mpeg2_dequantise(level, matrix[pos], qscale, intra);
+        sum += block[pos];
+    }
+
+    /* Mismatch control, make the sum of the coefficients odd */
+    block[63] ^= ~sum & 1;
+    return 0;
+}
+
+static int
+mpeg2_decode_motion_vector(struct mpeg2_picture *pic, int f_code, int prediction, int *vector)
+{
+    struct bitstream *bs = &pic->bs;
+    int code = vlc_get(bs, &mpeg2_motion_vlc);
+    int r_size = f_code - 1;
+    int value = prediction;
+
+    if (code == VLC_INVALID || r_size < 0 || r_size > 8)
+        return -1;
+    if (code) {
+        int negative = bitstream_get_bit(bs);
+        int delta = ((code - 1) << r_size) + 1;
+
+        if (r_size)
+            delta += bitstream_get_bits(bs, r_size);
+        value += negative ? -delta : delta;
+        /* Vectors wrap around within the range of the f_code */
+        if (value < -(16 << r_size))
+            value += 32 << r_size;
+        else if (value > (16 << r_size) - 1)
+            value -= 32 << r_size;
+    }
+    *vector = value;
+    return 0;
+}
+
+static int
+mpeg2_decode_dmvector(struct bitstream *bs)
+{
+    if (!bitstream_get_bit(bs))
+        return 0;
+    return bitstream_get_bit(bs) ? -1 : 1;
+}
+
+/* Derives the dual prime vectors for the opposite parity fields */
+static void
+mpeg2_dual_prime_vectors(const struct mpeg2_picture *pic, struct mpeg2_motion *motion, const int *dmvector)
+{
+    int mx = motion->mv[0][0][0], my = motion->mv[0][0][1];
+
+    if (pic->structure == MPEG2_FRAME) {
+        /* Field distances: top from bottom and bottom from top */
+        int m = pic->top_field_first ? 1 : 3;
+
+        motion->dmv[0][0] = ((mx * m + (mx > 0)) >> 1) + dmvector[0];
+        motion->dmv[0][1] = ((my * m + (my > 0)) >> 1) + dmvector[1] - 1;
+        m = 4 - m;
+        motion->dmv[1][0] = ((mx * m + (mx > 0)) >> 1) + dmvector[0];
+        motion->dmv[1][1] = ((my * m + (my > 0)) >> 1) + dmvector[1] + 1;
+    } else {
+        motion->dmv[0][0] = ((mx + (mx > 0)) >> 1) + dmvector[0];
+        motion->dmv[0][1] = ((my + (my > 0)) >> 1) + dmvector[1] + (pic->parity ? 1 : -1);
+    }
+}
+
+/* motion_vectors(s) */
+static int
+mpeg2_decode_motion_vectors(struct mpeg2_picture *pic, struct mpeg2_motion *motion, int s)
+{
+    struct bitstream *bs = &pic->bs;
+    int frame = pic->structure == MPEG2_FRAME;
+    int dual_prime = motion->motion_type == MPEG2_MC_DMV;
+    int count, field_vectors, r, t;
+
+    if (frame) {
+        count = motion->motion_type == MPEG2_MC_FIELD ? 2 : 1;
+        field_vectors = motion->motion_type != MPEG2_MC_FRAME;
+    } else {
+        count = motion->motion_type == MPEG2_MC_16X8 ? 2 : 1;
+        field_vectors = 1;
+    }
+
+    for (r = 0; r < count; r++) {
+        int dmvector[2] = { 0, 0 };
+
+        if (field_vectors && !dual_prime)
+            motion->field_select[r][s] = bitstream_get_bit(bs);
+        for (t = 0; t < 2; t++) {
+            /* Field vectors of frame pictures are predicted in field units */
+            int halve = t == 1 && frame && field_vectors;
+            int vector;
+
+            if (mpeg2_decode_motion_vector(pic, pic->f_code[s][t], pic->pmv[r][s][t] >> halve, &vector))
+                return -1;
+            pic->pmv[r][s][t] = vector * (1 << halve);
+            motion->mv[r][s][t] = vector;
+            if (dual_prime)
+                dmvector[t] = mpeg2_decode_dmvector(bs);
+        }
+        if (dual_prime)
+            mpeg2_dual_prime_vectors(pic, motion, dmvector);
+    }
+    if (count == 1) {
+        pic->pmv[1][s][0] = pic->pmv[0][s][0];
+        pic->pmv[1][s][1] = pic->pmv[0][s][1];
+    }
+    return 0;
+}
+
+/* The prediction of P macroblocks without vectors: no motion, same parity */
+static void
+mpeg2_zero_motion(const struct mpeg2_picture *pic, struct mpeg2_motion *motion)
+{
+    memset(motion, 0, sizeof(*motion));
+    motion->type = MB_FWD;
+    motion->motion_type = pic->structure == MPEG2_FRAME ? MPEG2_MC_FRAME : MPEG2_MC_FIELD;
+    motion->field_select[0][0] = pic->parity;
+}
+
+static void
+mpeg2_skip_macroblock(struct mpeg2_picture *pic, int mb_x, int mb_y)
+{
+    struct mpeg2_motion motion;
+
+    mpeg2_reset_dc_pred(pic);
+    if (pic->coding_type == MPEG2_PICTURE_B) {
+        /* Same vectors as the macroblock before */
+        motion = pic->last;
+    } else {
+        mpeg2_zero_motion(pic, &motion);
+        memset(pic->pmv, 0, sizeof(pic->pmv));
+    }
+    mpeg2_motion_compensate(pic, mb_x, mb_y, &motion);
+}
+
+/* Return 0 on success, -1 on a bitstream error */
+static int
+mpeg2_decode_macroblock(struct mpeg2_picture *pic, int mb_x, int mb_y)
+{
+    struct bitstream *bs = &pic->bs;
+    struct mpeg2_motion motion;
+    int concealment, cbp, dct_type = 0, i;
+
+    memset(&motion, 0, sizeof(motion));
+    motion.type = vlc_get(bs, &mpeg2_mb_type_vlc[pic->coding_type - 1]);
+    if (motion.type == VLC_INVALID)
+        return -1;
+    concealment = (motion.type & MB_INTRA) && pic->concealment_motion_vectors;
+
+    if (motion.type & (MB_FWD | MB_BWD)) {
+        if (pic->structure == MPEG2_FRAME && pic->frame_pred_frame_dct)
+            motion.motion_type = MPEG2_MC_FRAME;
+        else
+            motion.motion_type = bitstream_get_bits(bs, 2);
+        if (motion.motion_type == 0)
+            return -1;
+    } else if (concealment) {
+        motion.motion_type = pic->structure == MPEG2_FRAME ? MPEG2_MC_FRAME : MPEG2_MC_FIELD;
+    }
+    if (pic->structure == MPEG2_FRAME && !pic->frame_pred_frame_dct &&
+        (motion.type & (MB_INTRA | MB_PAT)))
+        dct_type = bitstream_get_bit(bs);
+    if (motion.type & MPEG2_MB_QUANT)
+        pic->quantiser_scale = mpeg2_quantiser_scale(pic, bitstream_get_bits(bs, 5));
+
+    if ((motion.type & MB_FWD) || concealment) {
+        if (mpeg2_decode_motion_vectors(pic, &motion, 0))
+            return -1;
+    }
+    if (motion.type & MB_BWD) {
+        if (mpeg2_decode_motion_vectors(pic, &motion, 1))
+            return -1;
+    }
+
+    if (motion.type & MB_INTRA) {
+        /* Concealment vectors are only there for error concealment */
+        if (concealment)
+            bitstream_skip_bits(bs, 1);
+        else
+            memset(pic->pmv, 0, sizeof(pic->pmv));
+        cbp = 0x3f;
+    } else {
+        mpeg2_reset_dc_pred(pic);
+        cbp = 0;
+        if (motion.type & MB_PAT) {
+            cbp = vlc_get(bs, &mpeg2_cbp_vlc);
+            if (cbp == VLC_INVALID)
+                return -1;
+        }
+        if (pic->coding_type == MPEG2_PICTURE_P && !(motion.type & MB_FWD)) {
+            mpeg2_zero_motion(pic, &motion);
+            memset(pic->pmv, 0, sizeof(pic->pmv));
+        }
+        mpeg2_motion_compensate(pic, mb_x, mb_y, &motion);
+        pic->last = motion;
+    }
+
+    for (i = 0; i < 6; i++) {
+        if ((cbp & (32 >> i)) &&
+            mpeg2_decode_block(pic, pic->blocks[i], i < 4 ? 0 : i - 3, motion.type & MB_INTRA))
+            return -1;
+    }
+    mpeg2_reconstruct(pic, mb_x, mb_y, cbp, motion.type & MB_INTRA, dct_type);
+    return 0;
+}
+
+/* Returns the next macroblock_address_increment, -1 on error */
+static int
+mpeg2_decode_address_increment(struct mpeg2_picture *pic)
+{
+    int increment = 0;
+
+    while (bitstream_bits_left(&pic->bs) > 0) {
+        int symbol = vlc_get(&pic->bs, &mpeg2_mb_increment_vlc);
+
+        if (symbol == MPEG2_MB_ESCAPE)
+            increment += 33;
+        else if (symbol == VLC_INVALID)
+            return -1;
+        else if (symbol != MPEG2_MB_STUFFING)
+            return increment + symbol;
+    }
+    return -1;
+}
+
+static void
+mpeg2_decode_slice(struct mpeg2_picture *pic, const VASliceParameterBufferMPEG2 *slice_param,
+                   const uint8_t *slice_data)
+{
+    int mb_y = slice_param->slice_vertical_position;
+    int mb_x, increment, i;
+
+    if (mb_y >= pic->mb_height)
+        return;
+
+    bitstream_init(&pic->bs, slice_data + slice_param->slice_data_offset,
+                   slice_param->slice_data_size, slice_param->macroblock_offset);
+    pic->quantiser_scale = mpeg2_quantiser_scale(pic, slice_param->quantiser_scale_code);
+    mpeg2_reset_dc_pred(pic);
+    memset(pic->pmv, 0, sizeof(pic->pmv));
+    memset(&pic->last, 0, sizeof(pic->last));
+
+    /* The first increment gives the column of the first macroblock */
+    increment = mpeg2_decode_address_increment(pic);
+    mb_x = increment - 1;
+    while (increment > 0 && mb_x < pic->mb_width) {
+        if (mpeg2_decode_macroblock(pic, mb_x, mb_y)) {
+            memset(pic->blocks, 0, sizeof(pic->blocks));
+            break;
+        }
+        /* The slice ends where the 23 zero bits of a start code begin */
+        if (bitstream_show_bits(&pic->bs, 23) == 0)
+            break;
+        increment = mpeg2_decode_address_increment(pic);
+        for (i = 1; i < increment && mb_x + i < pic->mb_width; i++)
+            mpeg2_skip_macroblock(pic, mb_x + i, mb_y);
+        mb_x += increment;
+    }
+}
+
+static void
+mpeg2_load_matrices(struct epiphany_mpeg2_decoder *decoder, const VAIQMatrixBufferMPEG2 *iq_matrix)
+{
+    int i;
+
+    /* VA-API passes the matrices in zigzag order */
+    if (iq_matrix->load_intra_quantiser_matrix) {
+        for (i = 0; i < 64; i++)
+            decoder->intra_matrix[mpeg2_zigzag_scan[i]] = iq_matrix->intra_quantiser_matrix[i];
+    }
+    if (iq_matrix->load_non_intra_quantiser_matrix) {
+        for (i = 0; i < 64; i++)
+            decoder->non_intra_matrix[mpeg2_zigzag_scan[i]] = iq_matrix->non_intra_quantiser_matrix[i];
+    }
+}
+
+static struct epiphany_mpeg2_decoder *
+mpeg2_create_decoder(void)
+{
+    struct epiphany_mpeg2_decoder *decoder = calloc(1, sizeof(*decoder));
+
+    if (decoder) {
+        memcpy(decoder->intra_matrix, mpeg2_default_intra_matrix, 64);
+        memset(decoder->non_intra_matrix, 16, 64);
+    }
+    return decoder;
+}
+
+void
+epiphany_mpeg2_destroy_decoder(void *data)
+{
+    struct epiphany_mpeg2_decoder *decoder = data;
+
+    if (NULL == decoder)
+        return;
+    free(decoder->slices);
+    free(decoder->rows);
+    free(decoder);
+}
+
+/* Reference frames of other sizes can't be predicted from, use the picture itself */
+static struct surface_storage *
+mpeg2_lookup_reference(struct epiphany_driver_data *driver_data, VASurfaceID surface,
+                       struct surface_storage *current)
+{
+    object_surface_p obj_surface = SURFACE(surface);
+
+    if (NULL == obj_surface || NULL == obj_surface->storage ||
+        obj_surface->storage->pitch != current->pitch ||
+        obj_surface->storage->luma_height != current->luma_height)
+        return current;
+    return obj_surface->storage;
+}
+
+/* Sets pic up from the parameter buffers rendered into picture */
+static VAStatus
+mpeg2_init_picture(struct epiphany_driver_data *driver_data, const struct epiphany_picture *picture,
+                   object_surface_p obj_surface, struct mpeg2_picture *pic)
+{
+    const VAPictureParameterBufferMPEG2 *pic_param;
+    object_buffer_p obj_buffer;
+
+    obj_buffer = BUFFER(picture->pic_param);
+    if (NULL == obj_buffer || obj_buffer->element_size < sizeof(*pic_param))
+        return VA_STATUS_ERROR_INVALID_PARAMETER;
+    pic_param = obj_buffer->buffer_data;
+    if (pic_param->picture_coding_type < MPEG2_PICTURE_I ||
+        pic_param->picture_coding_type > MPEG2_PICTURE_B ||
+        pic_param->picture_coding_extension.bits.picture_structure == 0 ||
+        pic_param->horizontal_size > obj_surface->width ||
+        pic_param->vertical_size > obj_surface->height)
+        return VA_STATUS_ERROR_INVALID_PARAMETER;
+
+    memset(pic, 0, sizeof(*pic));
+    pic->dsp = driver_data->dsp_ops;
+    pic->coding_type = pic_param->picture_coding_type;
+    pic->structure = pic_param->picture_coding_extension.bits.picture_structure;
+    pic->parity = pic->structure == MPEG2_BOTTOM_FIELD;
+    pic->top_field_first = pic_param->picture_coding_extension.bits.top_field_first;
+    pic->frame_pred_frame_dct = pic_param->picture_coding_extension.bits.frame_pred_frame_dct;
+    pic->concealment_motion_vectors = pic_param->picture_coding_extension.bits.concealment_motion_vectors;
+    pic->q_scale_type = pic_param->picture_coding_extension.bits.q_scale_type;
+    pic->intra_vlc_format = pic_param->picture_coding_extension.bits.intra_vlc_format;
+    pic->intra_dc_precision = pic_param->picture_coding_extension.bits.intra_dc_precision;
+    pic->is_first_field = pic_param->picture_coding_extension.bits.is_first_field;
+    pic->f_code[0][0] = (pic_param->f_code >> 12) & 0xf;
+    pic->f_code[0][1] = (pic_param->f_code >> 8) & 0xf;
+    pic->f_code[1][0] = (pic_param->f_code >> 4) & 0xf;
+    pic->f_code[1][1] = pic_param->f_code & 0xf;
+    pic->scan = pic_param->picture_coding_extension.bits.alternate_scan ?
+                mpeg2_alternate_scan : mpeg2_zigzag_scan;
+    pic->mb_width = (pic_param->horizontal_size + 15) / 16;
+    pic->width = pic->mb_width * 16;
+    /* Interlaced frames are coded in pairs of field macroblock rows */
+    if (pic_param->picture_coding_extension.bits.progressive_frame)
+        pic->height = (pic_param->vertical_size + 15) & ~15;
+    else
+        pic->height = (pic_param->vertical_size + 31) & ~31;
+
+    pic->current = obj_surface->storage;
+    pic->forward = mpeg2_lookup_reference(driver_data, pic_param->forward_reference_picture, pic->current);
+    pic->backward = mpeg2_lookup_reference(driver_data, pic_param->backward_reference_picture, pic->current);
+    if (pic->structure == MPEG2_FRAME)
+        mpeg2_frame_view(pic, pic->current, &pic->dst);
+    else
+        mpeg2_field_view(pic, pic->current, pic->parity, &pic->dst);
+    pic->mb_height = pic->dst.height / 16;
+    return VA_STATUS_SUCCESS;
+}
+
+/* Walks the slice parameters rendered into a picture */
+struct mpeg2_slice_iter {
+    int buffer;
+    int element;
+};
+
+/*
+ * The next slice parameters whose slice data is in its buffer, with the
+ * buffer in data, or NULL after the last one. Slice parameter buffers
+ * pair up with the slice data buffers in order.
+ */
+static const VASliceParameterBufferMPEG2 *
+mpeg2_next_slice(struct epiphany_driver_data *driver_data, const struct epiphany_picture *picture,
+                 struct mpeg2_slice_iter *iter, const uint8_t **data)
+{
+    while (iter->buffer < picture->slice_params.num_buffers && iter->buffer < picture->slice_data.num_buffers) {
+        object_buffer_p obj_params = BUFFER(picture->slice_params.buffers[iter->buffer]);
+        object_buffer_p obj_data = BUFFER(picture->slice_data.buffers[iter->buffer]);
+
+        if (obj_params && obj_data && obj_params->element_size >= sizeof(VASliceParameterBufferMPEG2) &&
+            iter->element < obj_params->num_elements) {
+            const VASliceParameterBufferMPEG2 *slice_param = (const VASliceParameterBufferMPEG2 *)
+                ((const uint8_t *) obj_params->buffer_data + (size_t) iter->element++ * obj_params->element_size);
+            size_t data_size = (size_t) obj_data->element_size * obj_data->num_elements;
+
+            if (slice_param->slice_data_offset > data_size ||
+                slice_param->slice_data_size > data_size - slice_param->slice_data_offset)
+                continue;
+            *data = obj_data->buffer_data;
+            return slice_param;
+        }
+        iter->buffer++;
+        iter->element = 0;
+    }
+    return NULL;
+}
+
+/*
+ * Missing references are replaced by the picture being decoded, which then
+ * can't have its macroblocks reconstructed side by side
+ */
+static int
+mpeg2_predicts_from_itself(const struct mpeg2_picture *pic)
+{
+    return (pic->coding_type != MPEG2_PICTURE_I && pic->forward == pic->current) ||
+           (pic->coding_type == MPEG2_PICTURE_B && pic->backward == pic->current);
+}
+
+/*
+ * Reconstructs a run of macroblocks on one mesh core. A macroblock is
+ * predicted into local memory while its residual blocks arrive on the
+ * second DMA channel, which then writes it back while the next command
+ * is fetched. VLD blocks are inverse transformed first.
+ */
+static void
+mpeg2_mesh_kernel(emesh_core_p core, void *arg)
+{
+    const struct mpeg2_mesh_work *work = arg;
+    struct mpeg2_picture *pic = emesh_local_alloc(core, sizeof(*pic));
+    struct mpeg2_mesh_macroblock *mb = emesh_local_alloc(core, sizeof(*mb));
+    uint8_t *mb_y = emesh_local_alloc(core, 16 * 16);
+    uint8_t *mb_uv = emesh_local_alloc(core, 16 * 8);
+    int i, k;
+
+    /* Only the picture parameters, the block and edge buffers start out in local memory */
+    emesh_dma_copy(core, 0, pic, 0, work->pic, 0, offsetof(struct mpeg2_picture, blocks), 1);
+    memset(pic->blocks, 0, sizeof(pic->blocks));
+    pic->core = core;
+
+    for (i = 0; i < work->num_macroblocks; i++) {
+        ptrdiff_t stride = pic->dst.stride;
+        uint8_t *dst_y, *dst_uv;
+
+        emesh_dma_copy(core, 0, mb, 0, &work->macroblocks[i], 0, sizeof(*mb), 1);
+        emesh_compute(core, MPEG2_EMESH_MACROBLOCK_CYCLES);
+        dst_y = pic->dst.y + mb->mb_y * 16 * stride + mb->mb_x * 16;
+        dst_uv = pic->dst.uv + mb->mb_y * 8 * stride + mb->mb_x * 16;
+
+        /* The previous macroblock is out of the buffers */
+        emesh_dma_wait(core, 1);
+        for (k = 0; k < 6; k++) {
+            if (mb->cbp & (32 >> k))
+                emesh_dma_start(core, 1, pic->blocks[k], 0, mb->blocks[k], 0, sizeof(pic->blocks[k]), 1);
+        }
+        if (mb->load) {
+            emesh_dma_copy(core, 0, mb_y, 16, dst_y, stride, 16, 16);
+            emesh_dma_copy(core, 0, mb_uv, 16, dst_uv, stride, 16, 8);
+        }
+        if (mb->predict)
+            mpeg2_predict_macroblock(pic, mb_y, mb_uv, 16, mb->mb_x, mb->mb_y, &mb->motion);
+
+        emesh_dma_wait(core, 1);
+        for (k = 0; k < 6; k++) {
+            if (!(mb->cbp & (32 >> k)))
+                continue;
+            if (work->transform) {
+                pic->dsp->idct(pic->blocks[k]);
+                emesh_compute(core, MPEG2_EMESH_IDCT_CYCLES);
+            }
+            emesh_compute(core, MPEG2_EMESH_BLOCK_CYCLES);
+        }
+        mpeg2_add_blocks(pic, mb_y, mb_uv, 16, mb->cbp, mb->intra, mb->dct_type);
+        emesh_dma_start(core, 1, dst_y, stride, mb_y, 16, 16, 16);
+        emesh_dma_start(core, 1, dst_uv, stride, mb_uv, 16, 16, 8);
+    }
+    emesh_dma_wait(core, 1);
+}
+
+/*
+ * Has every core reconstruct an even share of the macroblocks. Macroblocks
+ * don't depend on each other within a picture, one sent or coded twice
+ * ends up as either.
+ */
+static void
+mpeg2_mesh_run(emesh_p mesh, const struct mpeg2_picture *pic, const struct mpeg2_mesh_macroblocks *list,
+               int transform)
+{
+    struct mpeg2_mesh_work work[EMESH_MAX_ROWS * EMESH_MAX_COLS];
+    void *args[EMESH_MAX_ROWS * EMESH_MAX_COLS];
+    int num_cores, i;
+
+    num_cores = list->num_macroblocks < mesh->num_cores ? list->num_macroblocks : mesh->num_cores;
+    if (num_cores == 0)
+        return;
+    for (i = 0; i < num_cores; i++) {
+        int first = (int) ((int64_t) list->num_macroblocks * i / num_cores);
+        int last = (int) ((int64_t) list->num_macroblocks * (i + 1) / num_cores);
+
+        work[i].pic = pic;
+        work[i].macroblocks = list->macroblocks + first;
+        work[i].num_macroblocks = last - first;
+        work[i].transform = transform;
+        args[i] = &work[i];
+    }
+    emesh_run(mesh, mpeg2_mesh_kernel, args, num_cores);
+}
+
+/*
+ * The VLD entrypoint on the mesh: the host decodes the slices into mesh
+ * macroblocks, with their blocks still in transform domain, and the cores
+ * transform, predict and store them like MoComp macroblocks
+ */
+static VAStatus
+mpeg2_mesh_decode_picture(struct epiphany_driver_data *driver_data, struct mpeg2_picture *pic,
+                          const struct epiphany_picture *picture)
+{
+    const VASliceParameterBufferMPEG2 *slice_param;
+    struct mpeg2_mesh_macroblocks list;
+    struct mpeg2_slice_iter iter;
+    const uint8_t *data;
+    VAStatus vaStatus = VA_STATUS_SUCCESS;
+    int i, k, n;
+
+    memset(&list, 0, sizeof(list));
+    pic->mesh = &list;
+    memset(&iter, 0, sizeof(iter));
+    while ((slice_param = mpeg2_next_slice(driver_data, picture, &iter, &data)))
+        mpeg2_decode_slice(pic, slice_param, data);
+    pic->mesh = NULL;
+
+    if (list.failed) {
+        vaStatus = VA_STATUS_ERROR_ALLOCATION_FAILED;
+    } else {
+        /* The coefficient store has stopped moving */
+        for (i = 0; i < list.num_macroblocks; i++) {
+            struct mpeg2_mesh_macroblock *mb = &list.macroblocks[i];
+
+            for (k = 0, n = mb->first_block; k < 6; k++) {
+                if (mb->cbp & (32 >> k))
+                    mb->blocks[k] = list.coefficients[n++];
+            }
+        }
+        mpeg2_mesh_run(driver_data->emesh, pic, &list, 1);
+    }
+    free(list.macroblocks);
+    free(list.coefficients);
+    return vaStatus;
+}
+
+/* Decodes the slices of a row with picture state of its own */
+static void
+mpeg2_row_task(struct thread_pool_task *task)
+{
+    struct mpeg2_row *row = (struct mpeg2_row *) task;
+    struct epiphany_mpeg2_decoder *decoder = row->decoder;
+    struct mpeg2_picture pic = *decoder->picture;
+    int i;
+
+    for (i = row->first_slice; i < row->first_slice + row->num_slices; i++)
+        mpeg2_decode_slice(&pic, decoder->slices[i].param, decoder->slices[i].data);
+    thread_pool_done(decoder->pool, &decoder->pending);
+}
+
+/*
+ * Decodes the macroblock rows of the picture side by side on the pool.
+ * Return 0 on success, -1 if the picture is to be decoded on one thread
+ */
+static int
+mpeg2_decode_rows(struct epiphany_driver_data *driver_data, struct epiphany_mpeg2_decoder *decoder,
+                  const struct mpeg2_picture *pic, const struct epiphany_picture *picture, thread_pool_p pool)
+{
+    const VASliceParameterBufferMPEG2 *slice_param;
+    struct mpeg2_slice_iter iter;
+    const uint8_t *data;
+    int num_slices = 0, num_rows = 0, y;
+
+    if (mpeg2_predicts_from_itself(pic))
+        return -1;
+
+    if (pic->mb_height > decoder->max_rows) {
+        struct mpeg2_row *rows = realloc(decoder->rows, pic->mb_height * sizeof(*rows));
+
+        if (NULL == rows)
+            return -1;
+        decoder->rows = rows;
+        decoder->max_rows = pic->mb_height;
+    }
+    for (y = 0; y < pic->mb_height; y++)
+        decoder->rows[y].num_slices = 0;
+    memset(&iter, 0, sizeof(iter));
+    while ((slice_param = mpeg2_next_slice(driver_data, picture, &iter, &data))) {
+        if (slice_param->slice_vertical_position < (unsigned int) pic->mb_height) {
+            decoder->rows[slice_param->slice_vertical_position].num_slices++;
+            num_slices++;
+        }
+    }
+    if (num_slices > decoder->max_slices) {
+        struct mpeg2_slice *slices = realloc(decoder->slices, num_slices * sizeof(*slices));
+
+        if (NULL == slices)
+            return -1;
+        decoder->slices = slices;
+        decoder->max_slices = num_slices;
+    }
+
+    /* Sorts the slices by row, keeping their order within each */
+    num_slices = 0;
+    for (y = 0; y < pic->mb_height; y++) {
+        decoder->rows[y].first_slice = num_slices;
+        num_slices += decoder->rows[y].num_slices;
+        num_rows += decoder->rows[y].num_slices > 0;
+        decoder->rows[y].num_slices = 0;
+    }
+    memset(&iter, 0, sizeof(iter));
+    while ((slice_param = mpeg2_next_slice(driver_data, picture, &iter, &data))) {
+        struct mpeg2_row *row = &decoder->rows[slice_param->slice_vertical_position];
+
+        if (slice_param->slice_vertical_position >= (unsigned int) pic->mb_height)
+            continue;
+        decoder->slices[row->first_slice + row->num_slices].param = slice_param;
+        decoder->slices[row->first_slice + row->num_slices].data = data;
+        row->num_slices++;
+    }
+
+    decoder->pool = pool;
+    decoder->picture = pic;
+    __atomic_store_n(&decoder->pending, num_rows, __ATOMIC_SEQ_CST);
+    for (y = 0; y < pic->mb_height; y++) {
+        struct mpeg2_row *row = &decoder->rows[y];
+
+        if (0 == row->num_slices)
+            continue;
+        row->task.run = mpeg2_row_task;
+        row->decoder = decoder;
+        thread_pool_submit(pool, &row->task);
+    }
+    thread_pool_wait(pool, &decoder->pending);
+    return 0;
+}
+
+VAStatus
+epiphany_mpeg2_decode_picture(struct epiphany_driver_data *driver_data,
+                              object_context_p obj_context,
+                              const struct epiphany_picture *picture,
+                              object_surface_p obj_surface)
+{
+    struct epiphany_mpeg2_decoder *decoder = obj_context->decoder;
+    const VASliceParameterBufferMPEG2 *slice_param;
+    struct mpeg2_slice_iter iter;
+    struct mpeg2_picture pic;
+    object_buffer_p obj_buffer;
+    const uint8_t *data;
+    VAStatus vaStatus;
+
+    if (pthread_once(&mpeg2_tables_once, mpeg2_init_tables) || mpeg2_tables_status)
+        return VA_STATUS_ERROR_OPERATION_FAILED;
+
+    vaStatus = mpeg2_init_picture(driver_data, picture, obj_surface, &pic);
+    if (VA_STATUS_SUCCESS != vaStatus)
+        return vaStatus;
+
+    if (NULL == decoder) {
+        decoder = mpeg2_create_decoder();
+        if (NULL == decoder)
+            return VA_STATUS_ERROR_ALLOCATION_FAILED;
+        obj_context->decoder = decoder;
+    }
+    obj_buffer = BUFFER(picture->iq_matrix);
+    if (obj_buffer && obj_buffer->element_size >= sizeof(VAIQMatrixBufferMPEG2))
+        mpeg2_load_matrices(decoder, obj_buffer->buffer_data);
+    pic.decoder = decoder;
+
+    if (driver_data->emesh && !mpeg2_predicts_from_itself(&pic))
+        return mpeg2_mesh_decode_picture(driver_data, &pic, picture);
+    if (obj_context->thread_pool &&
+        0 == mpeg2_decode_rows(driver_data, decoder, &pic, picture, obj_context->thread_pool))
+        return VA_STATUS_SUCCESS;
+    memset(&iter, 0, sizeof(iter));
+    while ((slice_param = mpeg2_next_slice(driver_data, picture, &iter, &data)))
+        mpeg2_decode_slice(&pic, slice_param, data);
+    return VA_STATUS_SUCCESS;
+}
+
+/* Walks the residual blocks of all residual data buffers in order */
+struct mpeg2_residuals {
+    struct epiphany_driver_data *driver_data;
+    const struct epiphany_buffer_list *buffers;
+    int index;                  /* Next buffer */
+    const int16_t *block;
+    size_t num_blocks;          /* Left in the current buffer */
+};
+
+static const int16_t *
+mpeg2_next_residual_block(struct mpeg2_residuals *residuals)
+{
+    struct epiphany_driver_data *driver_data = residuals->driver_data;
+
+    while (residuals->num_blocks == 0) {
+        object_buffer_p obj_buffer;
+
+        if (residuals->index >= residuals->buffers->num_buffers)
+            return NULL;
+        obj_buffer = BUFFER(residuals->buffers->buffers[residuals->index++]);
+        if (obj_buffer) {
+            residuals->block = obj_buffer->buffer_data;
+            residuals->num_blocks = (size_t) obj_buffer->element_size * obj_buffer->num_elements /
+                                    (64 * sizeof(int16_t));
+        }
+    }
+    residuals->num_blocks--;
+    return (residuals->block += 64) - 64;
+}
+
+/* The prediction a VAMacroblockParameterBufferMPEG2 describes */
+static void
+mpeg2_macroblock_motion(const struct mpeg2_picture *pic, const VAMacroblockParameterBufferMPEG2 *mb_param,
+                        struct mpeg2_motion *motion)
+{
+    int r, s, t;
+
+    memset(motion, 0, sizeof(*motion));
+    motion->type = mb_param->macroblock_type & (MB_FWD | MB_BWD | MB_INTRA);
+    if (pic->structure == MPEG2_FRAME)
+        motion->motion_type = mb_param->macroblock_modes.bits.frame_motion_type;
+    else
+        motion->motion_type = mb_param->macroblock_modes.bits.field_motion_type;
+    for (r = 0; r < 2; r++) {
+        for (s = 0; s < 2; s++) {
+            motion->field_select[r][s] = (mb_param->motion_vertical_field_select >> (2 * r + s)) & 1;
+            for (t = 0; t < 2; t++)
+                motion->mv[r][s][t] = mb_param->PMV[r][s][t];
+        }
+    }
+    /* Dual prime passes the derived vectors in the unused backward slots */
+    if (motion->motion_type == MPEG2_MC_DMV) {
+        for (t = 0; t < 2; t++) {
+            motion->dmv[0][t] = mb_param->PMV[0][1][t];
+            motion->dmv[1][t] = mb_param->PMV[1][1][t];
+        }
+    }
+    if (pic->coding_type == MPEG2_PICTURE_P && !(motion->type & (MB_FWD | MB_INTRA)))
+        mpeg2_zero_motion(pic, motion);
+}
+
+/*
+ * Motion compensation of the whole macroblock array first, then the
+ * residuals in a second pass, so each loop keeps one set of kernels busy.
+ */
+static VAStatus
+mpeg2_render_macroblocks(struct mpeg2_picture *pic, const uint8_t *mb_params, size_t element_size,
+                         int num_elements, struct mpeg2_residuals *residuals)
+{
+    int num_macroblocks = pic->mb_width * pic->mb_height;
+    int i, j, k;
+
+    for (i = 0; i < num_elements; i++) {
+        const VAMacroblockParameterBufferMPEG2 *mb_param =
+            (const VAMacroblockParameterBufferMPEG2 *) (mb_params + (size_t) i * element_size);
+        int address = mb_param->macroblock_address;
+        struct mpeg2_motion motion;
+
+        if (address >= num_macroblocks)
+            continue;
+        mpeg2_macroblock_motion(pic, mb_param, &motion);
+        if (motion.type & MB_INTRA)
+            continue;
+        mpeg2_motion_compensate(pic, address % pic->mb_width, address / pic->mb_width, &motion);
+        /* Skipped macroblocks follow, predicted like in the bitstream */
+        pic->last = motion;
+        for (j = 1; j <= mb_param->num_skipped_macroblocks && address + j < num_macroblocks; j++)
+            mpeg2_skip_macroblock(pic, (address + j) % pic->mb_width, (address + j) / pic->mb_width);
+    }
+
+    for (i = 0; i < num_elements; i++) {
+        const VAMacroblockParameterBufferMPEG2 *mb_param =
+            (const VAMacroblockParameterBufferMPEG2 *) (mb_params + (size_t) i * element_size);
+        int address = mb_param->macroblock_address;
+        int cbp = mb_param->coded_block_pattern & 0x3f;
+
+        for (k = 0; k < 6; k++) {
+            const int16_t *block;
+
+            if (!(cbp & (32 >> k)))
+                continue;
+            block = mpeg2_next_residual_block(residuals);
+            if (NULL == block) {
+                memset(pic->blocks, 0, sizeof(pic->blocks));
+                return VA_STATUS_ERROR_INVALID_PARAMETER;
+            }
+            memcpy(pic->blocks[k], block, sizeof(pic->blocks[k]));
+        }
+        if (address < num_macroblocks)
+            mpeg2_store_blocks(pic, address % pic->mb_width, address / pic->mb_width, cbp,
+                               mb_param->macroblock_type & MB_INTRA,
+                               mb_param->macroblock_modes.bits.dct_type);
+        else
+            memset(pic->blocks, 0, sizeof(pic->blocks));
+    }
+    return VA_STATUS_SUCCESS;
+}
+
+/*
+ * Turns a VAMacroblockParameterBufferMPEG2 array into mesh macroblocks,
+ * expanding the skipped ones and finding the residual blocks like
+ * mpeg2_render_macroblocks() does
+ */
+static VAStatus
+mpeg2_mesh_add_macroblocks(struct mpeg2_mesh_macroblocks *list, struct mpeg2_picture *pic,
+                           const uint8_t *mb_params, size_t element_size, int num_elements,
+                           struct mpeg2_residuals *residuals)
+{
+    int num_macroblocks = pic->mb_width * pic->mb_height;
+    const int16_t *blocks[6];
+    int i, j, k;
+
+    for (i = 0; i < num_elements; i++) {
+        const VAMacroblockParameterBufferMPEG2 *mb_param =
+            (const VAMacroblockParameterBufferMPEG2 *) (mb_params + (size_t) i * element_size);
+        int address = mb_param->macroblock_address;
+        int cbp = mb_param->coded_block_pattern & 0x3f;
+        struct mpeg2_mesh_macroblock *mb;
+        struct mpeg2_motion motion;
+
+        for (k = 0; k < 6; k++) {
+            blocks[k] = NULL;
+            if (!(cbp & (32 >> k)))
+                continue;
+            blocks[k] = mpeg2_next_residual_block(residuals);
+            if (NULL == blocks[k])
+                return VA_STATUS_ERROR_INVALID_PARAMETER;
+        }
+        if (address >= num_macroblocks)
+            continue;
+
+        mpeg2_macroblock_motion(pic, mb_param, &motion);
+        mb = mpeg2_mesh_add_macroblock(list, pic, address, &motion);
+        if (NULL == mb)
+            return VA_STATUS_ERROR_ALLOCATION_FAILED;
+        mb->cbp = cbp;
+        mb->dct_type = mb_param->macroblock_modes.bits.dct_type;
+        memcpy(mb->blocks, blocks, sizeof(blocks));
+        /* Intra macroblocks only write their coded blocks */
+        if (mb->intra) {
+            mb->load = cbp != 0x3f;
+            continue;
+        }
+
+        for (j = 1; j <= mb_param->num_skipped_macroblocks && address + j < num_macroblocks; j++) {
+            if (pic->coding_type != MPEG2_PICTURE_B)
+                mpeg2_zero_motion(pic, &motion);
+            if (NULL == mpeg2_mesh_add_macroblock(list, pic, address + j, &motion))
+                return VA_STATUS_ERROR_ALLOCATION_FAILED;
+        }
+    }
+    return VA_STATUS_SUCCESS;
+}
+
+/* The MoComp entrypoint on the mesh, the host lays the macroblocks out */
+static VAStatus
+mpeg2_mesh_render_macroblocks(struct epiphany_driver_data *driver_data, struct mpeg2_picture *pic,
+                              const struct epiphany_picture *picture, struct mpeg2_residuals *residuals)
+{
+    struct mpeg2_mesh_macroblocks list;
+    VAStatus vaStatus = VA_STATUS_SUCCESS;
+    int i;
+
+    memset(&list, 0, sizeof(list));
+    for (i = 0; i < picture->mb_params.num_buffers; i++) {
+        object_buffer_p obj_buffer = BUFFER(picture->mb_params.buffers[i]);
+
+        if (NULL == obj_buffer || obj_buffer->element_size < sizeof(VAMacroblockParameterBufferMPEG2))
+            continue;
+        vaStatus = mpeg2_mesh_add_macroblocks(&list, pic, obj_buffer->buffer_data, obj_buffer->element_size,
+                                              obj_buffer->num_elements, residuals);
+        if (VA_STATUS_SUCCESS != vaStatus)
+            break;
+    }
+
+    if (VA_STATUS_SUCCESS == vaStatus)
+        mpeg2_mesh_run(driver_data->emesh, pic, &list, 0);
+    free(list.macroblocks);
+    return vaStatus;
+}
+
+VAStatus
+epiphany_mpeg2_render_macroblocks(struct epiphany_driver_data *driver_data,
+                                  object_context_p obj_context,
+                                  const struct epiphany_picture *picture,
+                                  object_surface_p obj_surface)
+{
+    struct mpeg2_picture pic;
+    struct mpeg2_residuals residuals;
+    VAStatus vaStatus;
+    int i;
+
+    vaStatus = mpeg2_init_picture(driver_data, picture, obj_surface, &pic);
+    if (VA_STATUS_SUCCESS != vaStatus)
+        return vaStatus;
+
+    memset(&residuals, 0, sizeof(residuals));
+    residuals.driver_data = driver_data;
+    residuals.buffers = &picture->residual_data;
+    if (driver_data->emesh && !mpeg2_predicts_from_itself(&pic))
+        return mpeg2_mesh_render_macroblocks(driver_data, &pic, picture, &residuals);
+    for (i = 0; i < picture->mb_params.num_buffers; i++) {
+        object_buffer_p obj_buffer = BUFFER(picture->mb_params.buffers[i]);
+
+        if (NULL == obj_buffer || obj_buffer->element_size < sizeof(VAMacroblockParameterBufferMPEG2))
+            continue;
+        vaStatus = mpeg2_render_macroblocks(&pic, obj_buffer->buffer_data, obj_buffer->element_size,
+                                            obj_buffer->num_elements, &residuals);
+        if (VA_STATUS_SUCCESS != vaStatus)
+            return vaStatus;
+    }
+    return VA_STATUS_SUCCESS;
+}
@@ -0,0 +1,1860 @@
+/*
+ * Copyright (c) 2012 Scott Tincman <sctincman@gmail.com>. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * MPEG-4 Part 2 VLD decoding (ISO/IEC 14496-2) on the host CPU.
+ *
+ * The client parsed the VOL and VOP headers, so this starts at the
+ * macroblock layer: entropy decoding, DC/AC prediction, both inverse
+ * quantization methods, motion vector prediction, quarter sample motion
+ * compensation, global motion compensation of S(GMC)-VOPs and video
+ * packets with their resync markers. Rectangular progressive VOPs of
+ * the Simple and Advanced Simple profiles are supported. Interlaced
+ * VOPs, data partitioning, static sprites and short video headers are
+ * refused rather than decoded wrong.
+ *
+ * Direct prediction and skipping in B-VOPs need the motion of the
+ * following anchor VOP, so the decoder keeps the motion field of each
+ * surface it decoded for as long as pictures refer to it.
+ */
+
+#include "config.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "epiphany_mpeg4.h"
+#include "bitstream.h"
+#include "vlc.h"
+
+/* VAPictureParameterBufferMPEG4.vop_fields.bits.vop_coding_type */
+#define MPEG4_VOP_I             0
+#define MPEG4_VOP_P             1
+#define MPEG4_VOP_B             2
+#define MPEG4_VOP_S             3
+
+/* VAPictureParameterBufferMPEG4.vol_fields.bits.sprite_enable */
+#define MPEG4_SPRITE_STATIC     1
+#define MPEG4_SPRITE_GMC        2
+
+/* B-VOP mb_type */
+#define MPEG4_B_DIRECT          0
+#define MPEG4_B_INTERPOLATE     1
+#define MPEG4_B_BACKWARD        2
+#define MPEG4_B_FORWARD         3
+
+/* struct mpeg4_motion.flags */
+#define MPEG4_MB_INTRA          0x01
+#define MPEG4_MB_4MV            0x02
+#define MPEG4_MB_NOT_CODED      0x04    /* Skipped, so the B-VOP macroblocks at its place are too */
+#define MPEG4_MB_GMC            0x08
+
+#define MPEG4_MAX_FRAMES        4       /* The references, the picture and one spare */
+#define MPEG4_EDGE_STRIDE       32
+#define MPEG4_MCBPC_I_STUFFING  8
+#define MPEG4_MCBPC_P_STUFFING  20
+#define MPEG4_TCOEF_ESCAPE      102
+
+/* Motion of a macroblock, in half or quarter samples */
+struct mpeg4_motion {
+    int16_t mv[4][2];           /* Of each luma block */
+    uint8_t flags;
+};
+
+/* The motion field of a surface decoded into */
+struct mpeg4_frame {
+    VASurfaceID surface;        /* VA_INVALID_SURFACE if the slot is free */
+    struct mpeg4_motion *motion;
+};
+
+/* Prediction state of an 8x8 block */
+struct mpeg4_block {
+    int16_t dc;                 /* Dequantized DC, 1024 for blocks that are not intra */
+    int16_t ac[16];             /* Quantized AC of the first column at 1-7, of the first row at 9-15 */
+};
+
+/* Per macroblock state of the picture */
+struct mpeg4_mb {
+    uint8_t quant;
+};
+
+struct epiphany_mpeg4_decoder {
+    int mb_width;
+    int mb_height;
+    struct mpeg4_mb *mbs;
+    struct mpeg4_block *blocks; /* Luma in raster order of blocks, then Cb and Cr */
+    struct mpeg4_frame frames[MPEG4_MAX_FRAMES];
+};
+
+struct mpeg4_reference {
+    uint8_t *y;
+    uint8_t *uv;
+};
+
+struct mpeg4_picture {
+    const struct dsp_ops *dsp;
+    const struct mpeg4_dsp_ops *mc;
+    struct epiphany_mpeg4_decoder *decoder;
+    const VAPictureParameterBufferMPEG4 *pic_param;
+    int type;
+    int mb_width;
+    int mb_height;
+    int mb_num;
+    int width;                  /* Luma samples of the VOP */
+    int height;
+    int edge_width;             /* Where references are extended: past whole macroblocks */
+    int edge_height;
+    uint8_t *y;
+    uint8_t *uv;
+    ptrdiff_t stride;
+    struct mpeg4_reference refs[2];
+    struct mpeg4_motion *motion;                /* Of this picture, for later B-VOPs */
+    const struct mpeg4_motion *col_motion;      /* Of the backward reference, NULL if unknown */
+
+    /* VOL and VOP */
+    int quant_type;             /* MPEG quantization with the matrices */
+    int quarter_sample;
+    int rnd;                    /* vop_rounding_type */
+    int intra_dc_thr;           /* Quantizers from which intra DC is coded as AC */
+    int fcode[2];
+    int resync;                 /* Resync markers may be present */
+    int quant_precision;
+    int mb_num_bits;
+    int time_increment_bits;
+    int trb;
+    int trd;
+    uint8_t intra_matrix[64];   /* Raster order */
+    uint8_t inter_matrix[64];
+
+    /* Sprite warping of S(GMC)-VOPs as the reference decoder sets it up */
+    int gmc;
+    int sprite_points;          /* After reducing translations to one point */
+    int sprite_accuracy;
+    int sprite_offset[2][2];    /* Luma and chroma, x and y */
+    int sprite_delta[2][2];
+    int sprite_shift[2];
+
+    /* Slice state */
+    struct bitstream bs;
+    int packet_start;           /* Address of the first macroblock of the video packet */
+    int quant;
+    int16_t last_mv[2][2];      /* B-VOP forward and backward predictors */
+
+    /* Macroblock state */
+    int mb_x;
+    int mb_y;
+    uint8_t *dst_y;
+    uint8_t *dst_uv;
+    int16_t blocks[6][64] __attribute__((aligned(16)));
+    uint8_t tmp[16 * 16 + 16 * 8] __attribute__((aligned(16)));
+    uint8_t edge[MPEG4_EDGE_STRIDE * 17];
+};
+
+/* Table B-6, mcbpc of I-VOPs: cbpc, cbpc | 4 with dquant, then stuffing */
+static const uint16_t mpeg4_mcbpc_i_codes[9][2] = {
+    { 0x1, 1 }, { 0x1, 3 }, { 0x2, 3 }, { 0x3, 3 }, { 0x1, 4 }, { 0x1, 6 }, { 0x2, 6 }, { 0x3, 6 },
+    { 0x1, 9 },
+};
+
+/*
+ * Table B-7, mcbpc of P-VOPs: bit 2 is intra, bit 3 dquant and bit 4
+ * four vectors over cbpc, then stuffing
+ */
+static const uint16_t mpeg4_mcbpc_p_codes[21][2] = {
+    { 0x1, 1 }, { 0x3, 4 }, { 0x2, 4 }, { 0x5, 6 }, { 0x3, 5 }, { 0x4, 8 }, { 0x3, 8 }, { 0x3, 7 },
+    { 0x3, 3 }, { 0x7, 7 }, { 0x6, 7 }, { 0x5, 9 }, { 0x4, 6 }, { 0x4, 9 }, { 0x3, 9 }, { 0x2, 9 },
+    { 0x2, 3 }, { 0x5, 7 }, { 0x4, 7 }, { 0x5, 8 }, { 0x1, 9 },
+};
+
+/* Table B-8, cbpy of intra macroblocks */
+static const uint16_t mpeg4_cbpy_codes[16][2] = {
+    { 0x3, 4 }, { 0x5, 5 }, { 0x4, 5 }, { 0x9, 4 }, { 0x3, 5 }, { 0x7, 4 }, { 0x2, 6 }, { 0xb, 4 },
+    { 0x2, 5 }, { 0x3, 6 }, { 0x5, 4 }, { 0xa, 4 }, { 0x4, 4 }, { 0x8, 4 }, { 0x6, 4 }, { 0x3, 2 },
+};
+
+/* Table B-12, motion codes 0 to 32 of the magnitudes */
+static const uint16_t mpeg4_motion_codes[33][2] = {
+    { 0x1, 1 }, { 0x1, 2 }, { 0x1, 3 }, { 0x1, 4 }, { 0x3, 6 }, { 0x5, 7 }, { 0x4, 7 }, { 0x3, 7 },
+    { 0xb, 9 }, { 0xa, 9 }, { 0x9, 9 }, { 0x11, 10 }, { 0x10, 10 }, { 0xf, 10 }, { 0xe, 10 }, { 0xd, 10 },
+    { 0xc, 10 }, { 0xb, 10 }, { 0xa, 10 }, { 0x9, 10 }, { 0x8, 10 }, { 0x7, 10 }, { 0x6, 10 }, { 0x5, 10 },
+    { 0x4, 10 }, { 0x7, 11 }, { 0x6, 11 }, { 0x5, 11 }, { 0x4, 11 }, { 0x3, 11 }, { 0x2, 11 }, { 0x3, 12 },
+    { 0x2, 12 },
+};
+
+/* Tables B-13 and B-14, dct_dc_size_luminance and dct_dc_size_chrominance */
+static const uint16_t mpeg4_dc_luma_codes[13][2] = {
+    { 0x3, 3 }, { 0x3, 2 }, { 0x2, 2 }, { 0x2, 3 }, { 0x1, 3 }, { 0x1, 4 }, { 0x1, 5 }, { 0x1, 6 },
+    { 0x1, 7 }, { 0x1, 8 }, { 0x1, 9 }, { 0x1, 10 }, { 0x1, 11 },
+};
+
+static const uint16_t mpeg4_dc_chroma_codes[13][2] = {
+    { 0x3, 2 }, { 0x2, 2 }, { 0x1, 2 }, { 0x1, 3 }, { 0x1, 4 }, { 0x1, 5 }, { 0x1, 6 }, { 0x1, 7 },
+    { 0x1, 8 }, { 0x1, 9 }, { 0x1, 10 }, { 0x1, 11 }, { 0x1, 12 },
+};
+
+/* Table B-4, mb_type of B-VOPs in MPEG4_B_* order */
+static const uint16_t mpeg4_b_type_codes[4][2] = {
+    { 0x1, 1 }, { 0x1, 2 }, { 0x1, 3 }, { 0x1, 4 },
+};
+
+/* Table B-33, dmv_length of the sprite trajectory */
+static const uint16_t mpeg4_sprite_codes[15][2] = {
+    { 0x0, 2 }, { 0x2, 3 }, { 0x3, 3 }, { 0x4, 3 }, { 0x5, 3 }, { 0x6, 3 }, { 0xe, 4 }, { 0x1e, 5 },
+    { 0x3e, 6 }, { 0x7e, 7 }, { 0xfe, 8 }, { 0x1fe, 9 }, { 0x3fe, 10 }, { 0x7fe, 11 }, { 0xffe, 12 },
+};
+
+/*
+ * Tables B-16 and B-17, the TCOEF codes of intra and inter blocks. The
+ * last code of each is the escape, the others index the run and level
+ * tables; those from MPEG4_INTRA_LAST and MPEG4_INTER_LAST are the last
+ * coefficient of the block.
+ */
+#define MPEG4_INTRA_LAST        67
+#define MPEG4_INTER_LAST        58
+
+static const uint16_t mpeg4_intra_tcoef_codes[103][2] = {
+    { 0x2, 2 }, { 0x6, 3 }, { 0xf, 4 }, { 0xd, 5 }, { 0xc, 5 }, { 0x15, 6 }, { 0x13, 6 },
+    { 0x12, 6 }, { 0x17, 7 }, { 0x1f, 8 }, { 0x1e, 8 }, { 0x1d, 8 }, { 0x25, 9 }, { 0x24, 9 },
+    { 0x23, 9 }, { 0x21, 9 }, { 0x21, 10 }, { 0x20, 10 }, { 0xf, 10 }, { 0xe, 10 }, { 0x7, 11 },
+    { 0x6, 11 }, { 0x20, 11 }, { 0x21, 11 }, { 0x50, 12 }, { 0x51, 12 }, { 0x52, 12 }, { 0xe, 4 },
+    { 0x14, 6 }, { 0x16, 7 }, { 0x1c, 8 }, { 0x20, 9 }, { 0x1f, 9 }, { 0xd, 10 }, { 0x22, 11 },
+    { 0x53, 12 }, { 0x55, 12 }, { 0xb, 5 }, { 0x15, 7 }, { 0x1e, 9 }, { 0xc, 10 }, { 0x56, 12 },
+    { 0x11, 6 }, { 0x1b, 8 }, { 0x1d, 9 }, { 0xb, 10 }, { 0x10, 6 }, { 0x22, 9 }, { 0xa, 10 },
+    { 0xd, 6 }, { 0x1c, 9 }, { 0x8, 10 }, { 0x12, 7 }, { 0x1b, 9 }, { 0x54, 12 }, { 0x14, 7 },
+    { 0x1a, 9 }, { 0x57, 12 }, { 0x19, 8 }, { 0x9, 10 }, { 0x18, 8 }, { 0x23, 11 }, { 0x17, 8 },
+    { 0x19, 9 }, { 0x18, 9 }, { 0x7, 10 }, { 0x58, 12 }, { 0x7, 4 }, { 0xc, 6 }, { 0x16, 8 },
+    { 0x17, 9 }, { 0x6, 10 }, { 0x5, 11 }, { 0x4, 11 }, { 0x59, 12 }, { 0xf, 6 }, { 0x16, 9 },
+    { 0x5, 10 }, { 0xe, 6 }, { 0x4, 10 }, { 0x11, 7 }, { 0x24, 11 }, { 0x10, 7 }, { 0x25, 11 },
+    { 0x13, 7 }, { 0x5a, 12 }, { 0x15, 8 }, { 0x5b, 12 }, { 0x14, 8 }, { 0x13, 8 }, { 0x1a, 8 },
+    { 0x15, 9 }, { 0x14, 9 }, { 0x13, 9 }, { 0x12, 9 }, { 0x11, 9 }, { 0x26, 11 }, { 0x27, 11 },
+    { 0x5c, 12 }, { 0x5d, 12 }, { 0x5e, 12 }, { 0x5f, 12 }, { 0x3, 7 },
+};
+
+static const uint8_t mpeg4_intra_tcoef_run[102] = {
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  1,  1,  1,  1,  1,
+     1,  1,  1,  1,  1,  2,  2,  2,  2,  2,  3,  3,  3,  3,  4,  4,
+     4,  5,  5,  5,  6,  6,  6,  7,  7,  7,  8,  8,  9,  9, 10, 11,
+    12, 13, 14,  0,  0,  0,  0,  0,  0,  0,  0,  1,  1,  1,  2,  2,
+     3,  3,  4,  4,  5,  5,  6,  6,  7,  8,  9, 10, 11, 12, 13, 14,
+    15, 16, 17, 18, 19, 20,
+};
+
+static const uint8_t mpeg4_intra_tcoef_level[102] = {
+     1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15, 16,
+    17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27,  1,  2,  3,  4,  5,
+     6,  7,  8,  9, 10,  1,  2,  3,  4,  5,  1,  2,  3,  4,  1,  2,
+     3,  1,  2,  3,  1,  2,  3,  1,  2,  3,  1,  2,  1,  2,  1,  1,
+     1,  1,  1,  1,  2,  3,  4,  5,  6,  7,  8,  1,  2,  3,  1,  2,
+     1,  2,  1,  2,  1,  2,  1,  2,  1,  1,  1,  1,  1,  1,  1,  1,
+     1,  1,  1,  1,  1,  1,
+};
+
+static const uint16_t mpeg4_inter_tcoef_codes[103][2] = {
+    { 0x2, 2 }, { 0xf, 4 }, { 0x15, 6 }, { 0x17, 7 }, { 0x1f, 8 }, { 0x25, 9 }, { 0x24, 9 },
+    { 0x21, 10 }, { 0x20, 10 }, { 0x7, 11 }, { 0x6, 11 }, { 0x20, 11 }, { 0x6, 3 }, { 0x14, 6 },
+    { 0x1e, 8 }, { 0xf, 10 }, { 0x21, 11 }, { 0x50, 12 }, { 0xe, 4 }, { 0x1d, 8 }, { 0xe, 10 },
+    { 0x51, 12 }, { 0xd, 5 }, { 0x23, 9 }, { 0xd, 10 }, { 0xc, 5 }, { 0x22, 9 }, { 0x52, 12 },
+    { 0xb, 5 }, { 0xc, 10 }, { 0x53, 12 }, { 0x13, 6 }, { 0xb, 10 }, { 0x54, 12 }, { 0x12, 6 },
+    { 0xa, 10 }, { 0x11, 6 }, { 0x9, 10 }, { 0x10, 6 }, { 0x8, 10 }, { 0x16, 7 }, { 0x55, 12 },
+    { 0x15, 7 }, { 0x14, 7 }, { 0x1c, 8 }, { 0x1b, 8 }, { 0x21, 9 }, { 0x20, 9 }, { 0x1f, 9 },
+    { 0x1e, 9 }, { 0x1d, 9 }, { 0x1c, 9 }, { 0x1b, 9 }, { 0x1a, 9 }, { 0x22, 11 }, { 0x23, 11 },
+    { 0x56, 12 }, { 0x57, 12 }, { 0x7, 4 }, { 0x19, 9 }, { 0x5, 11 }, { 0xf, 6 }, { 0x4, 11 },
+    { 0xe, 6 }, { 0xd, 6 }, { 0xc, 6 }, { 0x13, 7 }, { 0x12, 7 }, { 0x11, 7 }, { 0x10, 7 },
+    { 0x1a, 8 }, { 0x19, 8 }, { 0x18, 8 }, { 0x17, 8 }, { 0x16, 8 }, { 0x15, 8 }, { 0x14, 8 },
+    { 0x13, 8 }, { 0x18, 9 }, { 0x17, 9 }, { 0x16, 9 }, { 0x15, 9 }, { 0x14, 9 }, { 0x13, 9 },
+    { 0x12, 9 }, { 0x11, 9 }, { 0x7, 10 }, { 0x6, 10 }, { 0x5, 10 }, { 0x4, 10 }, { 0x24, 11 },
+    { 0x25, 11 }, { 0x26, 11 }, { 0x27, 11 }, { 0x58, 12 }, { 0x59, 12 }, { 0x5a, 12 }, { 0x5b, 12 },
+    { 0x5c, 12 }, { 0x5d, 12 }, { 0x5e, 12 }, { 0x5f, 12 }, { 0x3, 7 },
+};
+
+static const uint8_t mpeg4_inter_tcoef_run[102] = {
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  1,  1,  1,  1,
+     1,  1,  2,  2,  2,  2,  3,  3,  3,  4,  4,  4,  5,  5,  5,  6,
+     6,  6,  7,  7,  8,  8,  9,  9, 10, 10, 11, 12, 13, 14, 15, 16,
+    17, 18, 19, 20, 21, 22, 23, 24, 25, 26,  0,  0,  0,  1,  1,  2,
+     3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15, 16, 17, 18,
+    19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34,
+    35, 36, 37, 38, 39, 40,
+};
+
+static const uint8_t mpeg4_inter_tcoef_level[102] = {
+     1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12,  1,  2,  3,  4,
+     5,  6,  1,  2,  3,  4,  1,  2,  3,  1,  2,  3,  1,  2,  3,  1,
+     2,  3,  1,  2,  1,  2,  1,  2,  1,  2,  1,  1,  1,  1,  1,  1,
+     1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  2,  3,  1,  2,  1,
+     1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,
+     1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,
+     1,  1,  1,  1,  1,  1,
+};
+
+/* Figure 7-2, the zigzag and alternate scans */
+static const uint8_t mpeg4_zigzag_scan[64] = {
+     0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+};
+
+static const uint8_t mpeg4_alternate_horizontal_scan[64] = {
+     0,  1,  2,  3,  8,  9, 16, 17, 10, 11,  4,  5,  6,  7, 15, 14,
+    13, 12, 19, 18, 24, 25, 32, 33, 26, 27, 20, 21, 22, 23, 28, 29,
+    30, 31, 34, 35, 40, 41, 48, 49, 42, 43, 36, 37, 38, 39, 44, 45,
+    46, 47, 50, 51, 56, 57, 58, 59, 52, 53, 54, 55, 60, 61, 62, 63,
+};
+
+static const uint8_t mpeg4_alternate_vertical_scan[64] = {
+     0,  8, 16, 24,  1,  9,  2, 10, 17, 25, 32, 40, 48, 56, 57, 49,
+    41, 33, 26, 18,  3, 11,  4, 12, 19, 27, 34, 42, 50, 58, 35, 43,
+    51, 59, 20, 28,  5, 13,  6, 14, 21, 29, 36, 44, 52, 60, 37, 45,
+    53, 61, 22, 30,  7, 15, 23, 31, 38, 46, 54, 62, 39, 47, 55, 63,
+};
+
+/* 6.3.3, the default matrices in raster order */
+static const uint8_t mpeg4_default_intra_matrix[64] = {
+     8, 17, 18, 19, 21, 23, 25, 27,
+    17, 18, 19, 21, 23, 25, 27, 28,
+    20, 21, 22, 23, 24, 26, 28, 30,
+    21, 22, 23, 24, 26, 28, 30, 32,
+    22, 23, 24, 26, 28, 30, 32, 35,
+    23, 24, 26, 28, 30, 32, 35, 38,
+    25, 26, 28, 30, 32, 35, 38, 41,
+    27, 28, 30, 32, 35, 38, 41, 45,
+};
+
+static const uint8_t mpeg4_default_inter_matrix[64] = {
+    16, 17, 18, 19, 20, 21, 22, 23,
+    17, 18, 19, 20, 21, 22, 23, 24,
+    18, 19, 20, 21, 22, 23, 24, 25,
+    19, 20, 21, 22, 23, 24, 26, 27,
+    20, 21, 22, 23, 25, 26, 27, 28,
+    21, 22, 23, 24, 26, 27, 28, 30,
+    22, 23, 24, 26, 27, 28, 30, 31,
+    23, 24, 25, 27, 28, 30, 31, 33,
+};
+
+/* Table 6-21, the quantizers from which intra_dc_vlc_thr codes intra DC as AC */
+static const uint8_t mpeg4_intra_dc_thr[8] = { 32, 13, 15, 17, 19, 21, 23, 1 };
+
+/* Table 6-30, dquant */
+static const int8_t mpeg4_dquant_table[4] = { -1, -2, 1, 2 };
+
+/* Table 7-9, the chroma rounding of the sum of four luma vectors */
+static const uint8_t mpeg4_chroma_round[16] = { 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 2, 2 };
+
+/* Leading zeros of the resync marker, by the bit position in a byte it starts at */
+static const uint16_t mpeg4_resync_prefix[8] = {
+    0x7f00, 0x7e00, 0x7c00, 0x7800, 0x7000, 0x6000, 0x4000, 0x0000,
+};
+
+static struct vlc mpeg4_mcbpc_i_vlc;
+static struct vlc mpeg4_mcbpc_p_vlc;
+static struct vlc mpeg4_cbpy_vlc;
+static struct vlc mpeg4_motion_vlc;
+static struct vlc mpeg4_dc_luma_vlc;
+static struct vlc mpeg4_dc_chroma_vlc;
+static struct vlc mpeg4_b_type_vlc;
+static struct vlc mpeg4_sprite_vlc;
+static struct vlc mpeg4_tcoef_vlc[2];   /* Intra, inter */
+
+static struct vlc_entry mpeg4_mcbpc_i_table[512];
+static struct vlc_entry mpeg4_mcbpc_p_table[512];
+static struct vlc_entry mpeg4_cbpy_table[64];
+static struct vlc_entry mpeg4_motion_table[4096];
+static struct vlc_entry mpeg4_dc_luma_table[2048];
+static struct vlc_entry mpeg4_dc_chroma_table[4096];
+static struct vlc_entry mpeg4_b_type_table[16];
+static struct vlc_entry mpeg4_sprite_table[4096];
+static struct vlc_entry mpeg4_tcoef_table[2][4096];
+
+static const uint16_t (*const mpeg4_tcoef_codes[2])[2] = {
+    mpeg4_intra_tcoef_codes, mpeg4_inter_tcoef_codes,
+};
+static const uint8_t *const mpeg4_tcoef_run[2] = { mpeg4_intra_tcoef_run, mpeg4_inter_tcoef_run };
+static const uint8_t *const mpeg4_tcoef_level[2] = { mpeg4_intra_tcoef_level, mpeg4_inter_tcoef_level };
+static const uint8_t mpeg4_tcoef_last[2] = { MPEG4_INTRA_LAST, MPEG4_INTER_LAST };
+
+/* The largest level of each run and run of each level, for the escapes */
+static uint8_t mpeg4_max_level[2][2][64];
+static uint8_t mpeg4_max_run[2][2][64];
+
+static pthread_once_t mpeg4_tables_once = PTHREAD_ONCE_INIT;
+static int mpeg4_tables_status = -1;
+
+/* Builds the table for the codes of symbols 0 to num_codes - 1 */
+static int
+mpeg4_init_vlc(struct vlc *vlc, int bits, const uint16_t (*codes)[2], int num_codes,
+               struct vlc_entry *table, int max_entries)
+{
+    struct vlc_code list[103];
+    int i;
+
+    for (i = 0; i < num_codes; i++) {
+        list[i].code = codes[i][0];
+        list[i].length = codes[i][1];
+        list[i].symbol = i;
+    }
+    return vlc_init(vlc, bits, list, num_codes, table, max_entries);
+}
+
+static void
+mpeg4_init_tables(void)
+{
+    int status = 0;
+    int i, j;
+
+    status |= mpeg4_init_vlc(&mpeg4_mcbpc_i_vlc, 9, mpeg4_mcbpc_i_codes, 9, mpeg4_mcbpc_i_table, 512);
+    status |= mpeg4_init_vlc(&mpeg4_mcbpc_p_vlc, 9, mpeg4_mcbpc_p_codes, 21, mpeg4_mcbpc_p_table, 512);
+    status |= mpeg4_init_vlc(&mpeg4_cbpy_vlc, 6, mpeg4_cbpy_codes, 16, mpeg4_cbpy_table, 64);
+    status |= mpeg4_init_vlc(&mpeg4_motion_vlc, 12, mpeg4_motion_codes, 33, mpeg4_motion_table, 4096);
+    status |= mpeg4_init_vlc(&mpeg4_dc_luma_vlc, 11, mpeg4_dc_luma_codes, 13, mpeg4_dc_luma_table, 2048);
+    status |= mpeg4_init_vlc(&mpeg4_dc_chroma_vlc, 12, mpeg4_dc_chroma_codes, 13,
+                             mpeg4_dc_chroma_table, 4096);
+    status |= mpeg4_init_vlc(&mpeg4_b_type_vlc, 4, mpeg4_b_type_codes, 4, mpeg4_b_type_table, 16);
+    status |= mpeg4_init_vlc(&mpeg4_sprite_vlc, 12, mpeg4_sprite_codes, 15, mpeg4_sprite_table, 4096);
+    for (i = 0; i < 2; i++) {
+        status |= mpeg4_init_vlc(&mpeg4_tcoef_vlc[i], 12, mpeg4_tcoef_codes[i], 103,
+                                 mpeg4_tcoef_table[i], 4096);
+        for (j = 0; j < MPEG4_TCOEF_ESCAPE; j++) {
+            int last = j >= mpeg4_tcoef_last[i];
+            int run = mpeg4_tcoef_run[i][j], level = mpeg4_tcoef_level[i][j];
+
+            if (level > mpeg4_max_level[i][last][run])
+                mpeg4_max_level[i][last][run] = level;
+            if (run > mpeg4_max_run[i][last][level])
+                mpeg4_max_run[i][last][level] = run;
+        }
+    }
+    mpeg4_tables_status = status;
+}
+
+static inline int
+mpeg4_clip3(int low, int high, int value)
+{
+    return value < low ? low : (value > high ? high : value);
+}
+
+static inline int
+mpeg4_median(int a, int b, int c)
+{
+    int max = a > b ? a : b, min = a < b ? a : b;
+
+    return c > max ? max : (c < min ? min : c);
+}
+
+static struct epiphany_mpeg4_decoder *
+mpeg4_create_decoder(void)
+{
+    struct epiphany_mpeg4_decoder *decoder = calloc(1, sizeof(*decoder));
+    int i;
+
+    if (decoder) {
+        for (i = 0; i < MPEG4_MAX_FRAMES; i++)
+            decoder->frames[i].surface = VA_INVALID_SURFACE;
+    }
+    return decoder;
+}
+
+void
+epiphany_mpeg4_destroy_decoder(void *data)
+{
+    struct epiphany_mpeg4_decoder *decoder = data;
+    int i;
+
+    if (NULL == decoder)
+        return;
+    for (i = 0; i < MPEG4_MAX_FRAMES; i++)
+        free(decoder->frames[i].motion);
+    free(decoder->mbs);
+    free(decoder->blocks);
+    free(decoder);
+}
+
+/* Sizes the macroblock arrays for the picture, dropping motion kept at another size */
+static int
+mpeg4_resize_decoder(struct epiphany_mpeg4_decoder *decoder, int mb_width, int mb_height)
+{
+    size_t num_mbs = (size_t) mb_width * mb_height;
+    int i;
+
+    if (decoder->mbs && decoder->mb_width == mb_width && decoder->mb_height == mb_height)
+        return 0;
+    for (i = 0; i < MPEG4_MAX_FRAMES; i++) {
+        free(decoder->frames[i].motion);
+        decoder->frames[i].motion = NULL;
+        decoder->frames[i].surface = VA_INVALID_SURFACE;
+    }
+    free(decoder->mbs);
+    free(decoder->blocks);
+    decoder->mbs = malloc(num_mbs * sizeof(*decoder->mbs));
+    decoder->blocks = malloc(6 * num_mbs * sizeof(*decoder->blocks));
+    if (NULL == decoder->mbs || NULL == decoder->blocks) {
+        free(decoder->mbs);
+        decoder->mbs = NULL;
+        return -1;
+    }
+    decoder->mb_width = mb_width;
+    decoder->mb_height = mb_height;
+    return 0;
+}
+
+static struct mpeg4_frame *
+mpeg4_find_frame(struct epiphany_mpeg4_decoder *decoder, VASurfaceID surface)
+{
+    int i;
+
+    if (VA_INVALID_SURFACE == surface)
+        return NULL;
+    for (i = 0; i < MPEG4_MAX_FRAMES; i++) {
+        if (decoder->frames[i].surface == surface)
+            return &decoder->frames[i];
+    }
+    return NULL;
+}
+
+/*
+ * Frees the motion of surfaces the picture does not refer to and returns
+ * the slot of the one decoded into
+ */
+static struct mpeg4_frame *
+mpeg4_claim_frame(struct epiphany_mpeg4_decoder *decoder, const VAPictureParameterBufferMPEG4 *pic_param,
+                  VASurfaceID surface)
+{
+    struct mpeg4_frame *frame, *free_frame = NULL;
+    int i;
+
+    for (i = 0; i < MPEG4_MAX_FRAMES; i++) {
+        frame = &decoder->frames[i];
+        if (frame->surface != surface &&
+            frame->surface != pic_param->forward_reference_picture &&
+            frame->surface != pic_param->backward_reference_picture)
+            frame->surface = VA_INVALID_SURFACE;
+        if (frame->surface == VA_INVALID_SURFACE && NULL == free_frame)
+            free_frame = frame;
+    }
+
+    frame = mpeg4_find_frame(decoder, surface);
+    if (NULL == frame)
+        frame = free_frame;
+    if (NULL == frame)
+        return NULL;
+    if (NULL == frame->motion) {
+        frame->motion = malloc((size_t) decoder->mb_width * decoder->mb_height * sizeof(*frame->motion));
+        if (NULL == frame->motion)
+            return NULL;
+    }
+    frame->surface = surface;
+    return frame;
+}
+
+/*
+ * Looks a reference picture up in the surface heap. Missing ones, or ones
+ * of another size, are predicted from the picture itself like MPEG-2 does.
+ */
+static void
+mpeg4_lookup_reference(struct epiphany_driver_data *driver_data, const struct mpeg4_picture *pic,
+                       VASurfaceID surface, struct mpeg4_reference *ref)
+{
+    object_surface_p obj_surface = NULL;
+
+    if (VA_INVALID_SURFACE != surface)
+        obj_surface = SURFACE(surface);
+    if (NULL == obj_surface || NULL == obj_surface->storage ||
+        obj_surface->storage->pitch != pic->stride ||
+        obj_surface->storage->luma_height < pic->mb_height * 16) {
+        ref->y = pic->y;
+        ref->uv = pic->uv;
+    } else {
+        ref->y = obj_surface->storage->data;
+        ref->uv = obj_surface->storage->data + obj_surface->storage->chroma_offset;
+    }
+}
+
+/* Copies a width x height region around (x, y) of a plane, replicating its edge samples */
+static const uint8_t *
+mpeg4_emulate_edge(uint8_t *buf, const uint8_t *plane, ptrdiff_t stride, int plane_width,
+                   int plane_height, int x, int y, int width, int height, int bytes_per_sample)
+{
+    int i, j, k;
+
+    for (j = 0; j < height; j++) {
+        int row = mpeg4_clip3(0, plane_height - 1, y + j);
+        const uint8_t *src = plane + row * stride;
+        uint8_t *dst = buf + j * MPEG4_EDGE_STRIDE;
+
+        for (i = 0; i < width; i++) {
+            int column = mpeg4_clip3(0, plane_width - 1, x + i);
+
+            for (k = 0; k < bytes_per_sample; k++)
+                dst[i * bytes_per_sample + k] = src[column * bytes_per_sample + k];
+        }
+    }
+    return buf;
+}
+
+/* Divides rounding halves away from zero */
+static inline int64_t
+mpeg4_rounded_div(int64_t a, int64_t b)
+{
+    return (a >= 0 ? a + (b >> 1) : a - (b >> 1)) / b;
+}
+
+static inline int
+mpeg4_rshift(int a, int b)
+{
+    return a > 0 ? (a + ((1 << b) >> 1)) >> b : (a + ((1 << b) >> 1) - 1) >> b;
+}
+
+/* Table 7-1, the DC scalers of luma and chroma blocks */
+static inline int
+mpeg4_dc_scale(int quant, int chroma)
+{
+    if (quant <= 4)
+        return 8;
+    if (chroma)
+        return quant <= 24 ? (quant + 13) / 2 : quant - 6;
+    if (quant <= 8)
+        return 2 * quant;
+    return quant <= 24 ? quant + 8 : 2 * quant - 16;
+}
+
+/*
+ * Derives the warping of S(GMC)-VOPs from the sprite trajectory (7.8.4)
+ * the way the reference decoder does: translations collapse to the one
+ * point form of 7.8.7, anything else becomes 16.16 fixed point offsets
+ * and deltas. Returns -1 for warps the fixed point form cannot hold.
+ */
+static int
+mpeg4_init_sprite(struct mpeg4_picture *pic, const VAPictureParameterBufferMPEG4 *pic_param)
+{
+    int acc = pic_param->vol_fields.bits.sprite_warping_accuracy;
+    int a = 2 << acc, rho = 3 - acc, r = 16 / a;
+    int w = pic->width, h = pic->height;
+    int alpha = 1, beta = 0, w2, h2, min_ab, w3, h3, shift;
+    int64_t d[3][2] = { { 0, 0 }, { 0, 0 }, { 0, 0 } };
+    int64_t sprite_ref[3][2], virtual_ref[2][2];
+    int64_t offset[2][2], delta[2][2];
+    int i;
+
+    pic->sprite_accuracy = acc;
+    for (i = 0; i < pic_param->no_of_sprite_warping_points && i < 3; i++) {
+        d[i][0] = pic_param->sprite_trajectory_du[i];
+        d[i][1] = pic_param->sprite_trajectory_dv[i];
+    }
+    while ((1 << alpha) < w)
+        alpha++;
+    while ((1 << beta) < h)
+        beta++;
+    w2 = 1 << alpha;
+    h2 = 1 << beta;
+
+    /* The VOP is rectangular, with its corners at (0, 0), (w, 0) and (0, h) */
+    sprite_ref[0][0] = (a >> 1) * d[0][0];
+    sprite_ref[0][1] = (a >> 1) * d[0][1];
+    sprite_ref[1][0] = (a >> 1) * (2 * w + d[0][0] + d[1][0]);
+    sprite_ref[1][1] = (a >> 1) * (d[0][1] + d[1][1]);
+    sprite_ref[2][0] = (a >> 1) * (d[0][0] + d[2][0]);
+    sprite_ref[2][1] = (a >> 1) * (2 * h + d[0][1] + d[2][1]);
+
+    virtual_ref[0][0] = 16 * w2 + mpeg4_rounded_div((w - w2) * r * sprite_ref[0][0] +
+                                                    w2 * (r * sprite_ref[1][0] - 16LL * w), w);
+    virtual_ref[0][1] = mpeg4_rounded_div((w - w2) * r * sprite_ref[0][1] + w2 * r * sprite_ref[1][1], w);
+    virtual_ref[1][0] = mpeg4_rounded_div((h - h2) * r * sprite_ref[0][0] + h2 * r * sprite_ref[2][0], h);
+    virtual_ref[1][1] = 16 * h2 + mpeg4_rounded_div((h - h2) * r * sprite_ref[0][1] +
+                                                    h2 * (r * sprite_ref[2][1] - 16LL * h), h);
+
+    switch (pic_param->no_of_sprite_warping_points) {
+    case 0:
+        offset[0][0] = offset[0][1] = offset[1][0] = offset[1][1] = 0;
+        delta[0][0] = delta[1][1] = a;
+        delta[0][1] = delta[1][0] = 0;
+        pic->sprite_shift[0] = pic->sprite_shift[1] = 0;
+        break;
+    case 1:
+        offset[0][0] = sprite_ref[0][0];
+        offset[0][1] = sprite_ref[0][1];
+        offset[1][0] = (sprite_ref[0][0] >> 1) | (sprite_ref[0][0] & 1);
+        offset[1][1] = (sprite_ref[0][1] >> 1) | (sprite_ref[0][1] & 1);
+        delta[0][0] = delta[1][1] = a;
+        delta[0][1] = delta[1][0] = 0;
+        pic->sprite_shift[0] = pic->sprite_shift[1] = 0;
+        break;
+    case 2:
+        shift = alpha + rho;
+        delta[0][0] = -r * sprite_ref[0][0] + virtual_ref[0][0];
+        delta[0][1] = r * sprite_ref[0][1] - virtual_ref[0][1];
+        delta[1][0] = -r * sprite_ref[0][1] + virtual_ref[0][1];
+        delta[1][1] = -r * sprite_ref[0][0] + virtual_ref[0][0];
+        offset[0][0] = sprite_ref[0][0] * ((int64_t) 1 << shift) + ((int64_t) 1 << (shift - 1));
+        offset[0][1] = sprite_ref[0][1] * ((int64_t) 1 << shift) + ((int64_t) 1 << (shift - 1));
+        offset[1][0] = delta[0][0] + delta[0][1] + 2LL * w2 * r * sprite_ref[0][0] - 16LL * w2 +
+                       ((int64_t) 1 << (shift + 1));
+        offset[1][1] = delta[1][0] + delta[1][1] + 2LL * w2 * r * sprite_ref[0][1] - 16LL * w2 +
+                       ((int64_t) 1 << (shift + 1));
+        pic->sprite_shift[0] = shift;
+        pic->sprite_shift[1] = shift + 2;
+        break;
+    case 3:
+        min_ab = alpha < beta ? alpha : beta;
+        w3 = w2 >> min_ab;
+        h3 = h2 >> min_ab;
+        shift = alpha + beta + rho - min_ab;
+        delta[0][0] = (-r * sprite_ref[0][0] + virtual_ref[0][0]) * h3;
+        delta[0][1] = (-r * sprite_ref[0][0] + virtual_ref[1][0]) * w3;
+        delta[1][0] = (-r * sprite_ref[0][1] + virtual_ref[0][1]) * h3;
+        delta[1][1] = (-r * sprite_ref[0][1] + virtual_ref[1][1]) * w3;
+        offset[0][0] = sprite_ref[0][0] * ((int64_t) 1 << shift) + ((int64_t) 1 << (shift - 1));
+        offset[0][1] = sprite_ref[0][1] * ((int64_t) 1 << shift) + ((int64_t) 1 << (shift - 1));
+        offset[1][0] = delta[0][0] + delta[0][1] + 2LL * w2 * h3 * r * sprite_ref[0][0] - 16LL * w2 * h3 +
+                       ((int64_t) 1 << (shift + 1));
+        offset[1][1] = delta[1][0] + delta[1][1] + 2LL * w2 * h3 * r * sprite_ref[0][1] - 16LL * w2 * h3 +
+                       ((int64_t) 1 << (shift + 1));
+        pic->sprite_shift[0] = shift;
+        pic->sprite_shift[1] = shift + 2;
+        break;
+    default:
+        return -1;
+    }
+
+    if (delta[0][0] == (int64_t) a << pic->sprite_shift[0] && delta[0][1] == 0 &&
+        delta[1][0] == 0 && delta[1][1] == (int64_t) a << pic->sprite_shift[0]) {
+        offset[0][0] >>= pic->sprite_shift[0];
+        offset[0][1] >>= pic->sprite_shift[0];
+        offset[1][0] >>= pic->sprite_shift[1];
+        offset[1][1] >>= pic->sprite_shift[1];
+        delta[0][0] = delta[1][1] = a;
+        delta[0][1] = delta[1][0] = 0;
+        pic->sprite_shift[0] = pic->sprite_shift[1] = 0;
+        pic->sprite_points = 1;
+    } else {
+        int shift_y = 16 - pic->sprite_shift[0], shift_c = 16 - pic->sprite_shift[1];
+
+        if (shift_y < 0 || shift_c < 0)
+            return -1;
+        for (i = 0; i < 2; i++) {
+            if (llabs(offset[0][i]) >= INT32_MAX >> shift_y || llabs(offset[1][i]) >= INT32_MAX >> shift_c ||
+                llabs(delta[0][i]) >= INT32_MAX >> shift_y || llabs(delta[1][i]) >= INT32_MAX >> shift_y)
+                return -1;
+        }
+        for (i = 0; i < 2; i++) {
+            offset[0][i] *= 1 << shift_y;
+            offset[1][i] *= 1 << shift_c;
+            delta[0][i] *= 1 << shift_y;
+            delta[1][i] *= 1 << shift_y;
+            pic->sprite_shift[i] = 16;
+        }
+        /* The kernels step through the plane in 32 bits */
+        for (i = 0; i < 2; i++) {
+            int64_t x = delta[i][0] * (w + 16LL), y = delta[i][1] * (h + 16LL);
+
+            if (llabs(x) >= INT32_MAX || llabs(y) >= INT32_MAX ||
+                llabs(offset[0][i] + x) >= INT32_MAX || llabs(offset[0][i] + y) >= INT32_MAX ||
+                llabs(offset[0][i] + x + y) >= INT32_MAX)
+                return -1;
+        }
+        pic->sprite_points = pic_param->no_of_sprite_warping_points;
+    }
+    for (i = 0; i < 4; i++) {
+        pic->sprite_offset[i >> 1][i & 1] = (int) offset[i >> 1][i & 1];
+        pic->sprite_delta[i >> 1][i & 1] = (int) delta[i >> 1][i & 1];
+    }
+    return 0;
+}
+
+/* The vector component n of macroblocks whose mcsel says they are predicted by the sprite (7.8.7.3) */
+static int
+mpeg4_gmc_vector(const struct mpeg4_picture *pic, int n)
+{
+    int len = 1 << (pic->fcode[0] + 4), acc = pic->sprite_accuracy;
+    int sum = 0, x, y;
+
+    if (1 == pic->sprite_points) {
+        sum = mpeg4_rshift(pic->sprite_offset[0][n] * (1 << pic->quarter_sample), acc);
+    } else {
+        int dx = pic->sprite_delta[n][0], dy = pic->sprite_delta[n][1];
+        int shift = pic->sprite_shift[0];
+        int v;
+
+        if (n)
+            dy -= 1 << (shift + acc + 1);
+        else
+            dx -= 1 << (shift + acc + 1);
+        for (y = 0; y < 16; y++) {
+            v = pic->sprite_offset[0][n] + dx * pic->mb_x * 16 + dy * (pic->mb_y * 16 + y);
+            for (x = 0; x < 16; x++, v += dx)
+                sum += v >> shift;
+        }
+        sum = mpeg4_rshift(sum, acc + 8 - pic->quarter_sample);
+    }
+    return mpeg4_clip3(-len, len - 1, sum);
+}
+
+/*
+ * Predicts the size x size luma block at (x, y) from ref displaced by the
+ * vector mx, my, replicating the edges of the reference VOP
+ */
+static void
+mpeg4_predict_luma(struct mpeg4_picture *pic, uint8_t *dst, ptrdiff_t dst_stride, const uint8_t *ref,
+                   int x, int y, int mx, int my, int size, int rnd)
+{
+    int qpel = pic->quarter_sample, table = 16 == size ? MPEG4_MC_16 : MPEG4_MC_8;
+    int ix = x + (mx >> (1 + qpel)), iy = y + (my >> (1 + qpel));
+    const uint8_t *src = ref + iy * pic->stride + ix;
+    ptrdiff_t src_stride = pic->stride;
+
+    if (ix < 0 || iy < 0 || ix + size + 1 > pic->edge_width || iy + size + 1 > pic->edge_height) {
+        src = mpeg4_emulate_edge(pic->edge, ref, pic->stride, pic->edge_width, pic->edge_height,
+                                 ix, iy, size + 1, size + 1, 1);
+        src_stride = MPEG4_EDGE_STRIDE;
+    }
+    if (qpel)
+        pic->mc->put_qpel[table][((my & 3) << 2) | (mx & 3)](dst, dst_stride, src, src_stride, rnd);
+    else
+        pic->mc->put_hpel[table][((my & 1) << 1) | (mx & 1)](dst, dst_stride, src, src_stride, rnd);
+}
+
+/* The same for the 8x8 chroma block of the macroblock, with a vector in half chroma samples */
+static void
+mpeg4_predict_chroma(struct mpeg4_picture *pic, uint8_t *dst, ptrdiff_t dst_stride, const uint8_t *ref,
+                     int mx, int my, int rnd)
+{
+    int width = pic->edge_width >> 1, height = pic->edge_height >> 1;
+    int ix = pic->mb_x * 8 + (mx >> 1), iy = pic->mb_y * 8 + (my >> 1);
+    const uint8_t *src = ref + iy * pic->stride + ix * 2;
+    ptrdiff_t src_stride = pic->stride;
+
+    if (ix < 0 || iy < 0 || ix + 9 > width || iy + 9 > height) {
+        src = mpeg4_emulate_edge(pic->edge, ref, pic->stride, width, height, ix, iy, 9, 9, 2);
+        src_stride = MPEG4_EDGE_STRIDE;
+    }
+    pic->mc->put_hpel_uv[((my & 1) << 1) | (mx & 1)](dst, dst_stride, src, src_stride, rnd);
+}
+
+/*
+ * Predicts the macroblock from one reference with the vectors of its luma
+ * blocks, or of all of it unless four is set. Chroma vectors follow 7.6.2.
+ */
+static void
+mpeg4_predict_mb(struct mpeg4_picture *pic, uint8_t *dst_y, uint8_t *dst_uv, ptrdiff_t dst_stride,
+                 const struct mpeg4_reference *ref, const int16_t (*mv)[2], int four, int rnd)
+{
+    int x = pic->mb_x * 16, y = pic->mb_y * 16;
+    int c[2], i, j;
+
+    if (four) {
+        for (i = 0; i < 4; i++) {
+            mpeg4_predict_luma(pic, dst_y + (i >> 1) * 8 * dst_stride + (i & 1) * 8, dst_stride, ref->y,
+                               x + (i & 1) * 8, y + (i >> 1) * 8, mv[i][0], mv[i][1], 8, rnd);
+        }
+    } else {
+        mpeg4_predict_luma(pic, dst_y, dst_stride, ref->y, x, y, mv[0][0], mv[0][1], 16, rnd);
+    }
+
+    for (j = 0; j < 2; j++) {
+        if (four) {
+            int sum = 0;
+
+            for (i = 0; i < 4; i++)
+                sum += pic->quarter_sample ? mv[i][j] / 2 : mv[i][j];
+            c[j] = mpeg4_chroma_round[sum & 15] + ((sum >> 3) & ~1);
+        } else {
+            int m = pic->quarter_sample ? mv[0][j] / 2 : mv[0][j];
+
+            c[j] = (m >> 1) | (m & 1);
+        }
+    }
+    mpeg4_predict_chroma(pic, dst_uv, dst_stride, ref->uv, c[0], c[1], rnd);
+}
+
+/* Predicts the macroblock by warping the forward reference as the sprite (7.8.7) */
+static void
+mpeg4_predict_gmc(struct mpeg4_picture *pic)
+{
+    const struct mpeg4_reference *ref = &pic->refs[0];
+    int acc = pic->sprite_accuracy, rnd = pic->rnd;
+    int (*delta)[2] = pic->sprite_delta;
+    int i;
+
+    if (1 == pic->sprite_points) {
+        for (i = 0; i < 2; i++) {
+            int size = i ? 8 : 16, bytes = i ? 2 : 1;
+            int width = i ? pic->edge_width >> 1 : pic->edge_width;
+            int height = i ? pic->edge_height >> 1 : pic->edge_height;
+            int ox = pic->sprite_offset[i][0], oy = pic->sprite_offset[i][1];
+            int ix = pic->mb_x * size + (ox >> (acc + 1)), iy = pic->mb_y * size + (oy >> (acc + 1));
+            const uint8_t *plane = i ? ref->uv : ref->y;
+            const uint8_t *src = plane + iy * pic->stride + ix * bytes;
+            ptrdiff_t src_stride = pic->stride;
+            int fx = (ox * (1 << (3 - acc))) & 15, fy = (oy * (1 << (3 - acc))) & 15;
+
+            if (ix < 0 || iy < 0 || ix + size + 1 > width || iy + size + 1 > height) {
+                src = mpeg4_emulate_edge(pic->edge, plane, pic->stride, width, height,
+                                         ix, iy, size + 1, size + 1, bytes);
+                src_stride = MPEG4_EDGE_STRIDE;
+            }
+            if (i)
+                pic->mc->gmc1_uv(pic->dst_uv, pic->stride, src, src_stride, fx, fy, 128 - rnd);
+            else
+                pic->mc->gmc1(pic->dst_y, pic->stride, src, src_stride, fx, fy, 128 - rnd);
+        }
+    } else {
+        int shift = acc + 1, r = (1 << (2 * acc + 1)) - rnd;
+        int ox = pic->sprite_offset[0][0] + delta[0][0] * pic->mb_x * 16 + delta[0][1] * pic->mb_y * 16;
+        int oy = pic->sprite_offset[0][1] + delta[1][0] * pic->mb_x * 16 + delta[1][1] * pic->mb_y * 16;
+
+        for (i = 0; i < 2; i++) {
+            pic->mc->gmc(pic->dst_y + i * 8, pic->stride, ref->y, pic->stride, 16,
+                         ox + delta[0][0] * 8 * i, oy + delta[1][0] * 8 * i,
+                         delta[0][0], delta[0][1], delta[1][0], delta[1][1],
+                         shift, r, pic->edge_width, pic->edge_height);
+        }
+        ox = pic->sprite_offset[1][0] + delta[0][0] * pic->mb_x * 8 + delta[0][1] * pic->mb_y * 8;
+        oy = pic->sprite_offset[1][1] + delta[1][0] * pic->mb_x * 8 + delta[1][1] * pic->mb_y * 8;
+        pic->mc->gmc_uv(pic->dst_uv, pic->stride, ref->uv, pic->stride, 8, ox, oy,
+                        delta[0][0], delta[0][1], delta[1][0], delta[1][1],
+                        shift, r, pic->edge_width >> 1, pic->edge_height >> 1);
+    }
+}
+
+/*
+ * Returns the prediction state of block n of the macroblock displaced by
+ * dx, dy blocks, or NULL if that is outside the VOP or the video packet
+ */
+static struct mpeg4_block *
+mpeg4_block_state(const struct mpeg4_picture *pic, int n, int dx, int dy)
+{
+    struct epiphany_mpeg4_decoder *decoder = pic->decoder;
+    int x, y;
+
+    if (n < 4) {
+        x = pic->mb_x * 2 + (n & 1) + dx;
+        y = pic->mb_y * 2 + (n >> 1) + dy;
+        if (x < 0 || y < 0 || (y >> 1) * pic->mb_width + (x >> 1) < pic->packet_start)
+            return NULL;
+        return &decoder->blocks[y * 2 * pic->mb_width + x];
+    }
+    x = pic->mb_x + dx;
+    y = pic->mb_y + dy;
+    if (x < 0 || y < 0 || y * pic->mb_width + x < pic->packet_start)
+        return NULL;
+    return &decoder->blocks[n * pic->mb_num + y * pic->mb_width + x];
+}
+
+/*
+ * Reads a TCOEF event of Table B-16 (intra) or B-17 (inter) with the
+ * three escape modes of 7.4.1.3
+ */
+static int
+mpeg4_read_tcoef(struct mpeg4_picture *pic, int inter, int *last, int *run, int *level)
+{
+    struct bitstream *bs = &pic->bs;
+    int symbol = vlc_get(bs, &mpeg4_tcoef_vlc[inter]);
+    int mode = 0;
+
+    if (MPEG4_TCOEF_ESCAPE == symbol) {
+        if (!bitstream_get_bit(bs)) {
+            mode = 1;
+        } else if (!bitstream_get_bit(bs)) {
+            mode = 2;
+        } else {
+            *last = bitstream_get_bit(bs);
+            *run = bitstream_get_bits(bs, 6);
+            bitstream_skip_bits(bs, 1);                 /* marker_bit */
+            *level = bitstream_get_sbits(bs, 12);
+            bitstream_skip_bits(bs, 1);                 /* marker_bit */
+            return 0 == *level ? -1 : 0;
+        }
+        symbol = vlc_get(bs, &mpeg4_tcoef_vlc[inter]);
+    }
+    if (symbol < 0 || symbol >= MPEG4_TCOEF_ESCAPE)
+        return -1;
+
+    *last = symbol >= mpeg4_tcoef_last[inter];
+    *run = mpeg4_tcoef_run[inter][symbol];
+    *level = mpeg4_tcoef_level[inter][symbol];
+    if (1 == mode)
+        *level += mpeg4_max_level[inter][*last][*run];
+    else if (2 == mode)
+        *run += mpeg4_max_run[inter][*last][*level] + 1;
+    if (bitstream_get_bit(bs))
+        *level = -*level;
+    return 0;
+}
+
+/* Reads dct_dc_size and dct_dc_differential of an intra block */
+static int
+mpeg4_read_dc(struct mpeg4_picture *pic, int chroma, int *diff)
+{
+    struct bitstream *bs = &pic->bs;
+    int size = vlc_get(bs, chroma ? &mpeg4_dc_chroma_vlc : &mpeg4_dc_luma_vlc);
+    int value;
+
+    if (size < 0)
+        return -1;
+    *diff = 0;
+    if (0 == size)
+        return 0;
+    value = bitstream_get_bits(bs, size);
+    *diff = value >> (size - 1) ? value : value - (1 << size) + 1;
+    if (size > 8)
+        bitstream_skip_bits(bs, 1);                     /* marker_bit */
+    return 0;
+}
+
+/* Inverse quantization of 7.4.4 with saturation and, for the second method, mismatch control */
+static int
+mpeg4_dequantize(const struct mpeg4_picture *pic, int level, int position, int intra)
+{
+    int quant = pic->quant, magnitude = level < 0 ? -level : level;
+
+    if (pic->quant_type) {
+        if (intra)
+            magnitude = (magnitude * 2 * quant * pic->intra_matrix[position]) >> 4;
+        else
+            magnitude = ((2 * magnitude + 1) * quant * pic->inter_matrix[position]) >> 4;
+    } else {
+        magnitude = magnitude * 2 * quant + ((quant - 1) | 1);
+    }
+    if (level < 0)
+        return magnitude > 2048 ? -2048 : -magnitude;
+    return magnitude > 2047 ? 2047 : magnitude;
+}
+
+static void
+mpeg4_mismatch_control(int16_t *block)
+{
+    int sum = 0, i;
+
+    for (i = 0; i < 64; i++)
+        sum += block[i];
+    if (!(sum & 1))
+        block[63] ^= 1;
+}
+
+/*
+ * Decodes intra block n into pic->blocks[n], predicting its DC and, with
+ * ac_pred, its first row or column from the neighbours (7.4.3), and
+ * leaves it dequantized
+ */
+static int
+mpeg4_decode_intra_block(struct mpeg4_picture *pic, int n, int coded, int use_dc_vlc, int ac_pred)
+{
+    struct epiphany_mpeg4_decoder *decoder = pic->decoder;
+    int16_t *block = pic->blocks[n];
+    struct mpeg4_block *state = mpeg4_block_state(pic, n, 0, 0);
+    const struct mpeg4_block *a = mpeg4_block_state(pic, n, -1, 0);
+    const struct mpeg4_block *b = mpeg4_block_state(pic, n, -1, -1);
+    const struct mpeg4_block *c = mpeg4_block_state(pic, n, 0, -1);
+    int dc_a = a ? a->dc : 1024, dc_b = b ? b->dc : 1024, dc_c = c ? c->dc : 1024;
+    int scale = mpeg4_dc_scale(pic->quant, n >= 4);
+    /* Predict from the left unless the vertical gradient is the smaller one */
+    int left = abs(dc_a - dc_b) >= abs(dc_b - dc_c);
+    const uint8_t *scan = mpeg4_zigzag_scan;
+    int i = 0, last, run, level, dc;
+
+    if (ac_pred)
+        scan = left ? mpeg4_alternate_vertical_scan : mpeg4_alternate_horizontal_scan;
+    if (use_dc_vlc) {
+        if (mpeg4_read_dc(pic, n >= 4, &level) < 0)
+            return -1;
+        block[0] = level;
+        i = 1;
+    }
+    if (coded) {
+        do {
+            if (mpeg4_read_tcoef(pic, 0, &last, &run, &level) < 0)
+                return -1;
+            i += run;
+            if (i > 63)
+                return -1;
+            block[scan[i++]] = level;
+        } while (!last);
+    }
+
+    dc = (block[0] + ((left ? dc_a : dc_c) + (scale >> 1)) / scale) * scale;
+    state->dc = mpeg4_clip3(0, 2047, dc);
+
+    if (ac_pred && (left ? a : c)) {
+        /* Neighbours in another macroblock may have been quantized differently */
+        const struct mpeg4_block *from = left ? a : c;
+        int neighbour = pic->mb_y * pic->mb_width + pic->mb_x;
+        int quant;
+
+        if (left && (n >= 4 || !(n & 1)))
+            neighbour -= 1;
+        else if (!left && (n >= 4 || n < 2))
+            neighbour -= pic->mb_width;
+        quant = decoder->mbs[neighbour].quant;
+        for (i = 1; i < 8; i++) {
+            int ac = from->ac[left ? i : 8 + i];
+
+            if (quant != pic->quant)
+                ac = mpeg4_rounded_div(ac * quant, pic->quant);
+            block[left ? i << 3 : i] += ac;
+        }
+    }
+    for (i = 1; i < 8; i++) {
+        state->ac[i] = block[i << 3];
+        state->ac[8 + i] = block[i];
+    }
+
+    block[0] = dc;
+    for (i = 1; i < 64; i++) {
+        if (block[i])
+            block[i] = mpeg4_dequantize(pic, block[i], i, 1);
+    }
+    if (pic->quant_type)
+        mpeg4_mismatch_control(block);
+    return 0;
+}
+
+/* Decodes a coded inter block into pic->blocks[n] and dequantizes it */
+static int
+mpeg4_decode_inter_block(struct mpeg4_picture *pic, int n)
+{
+    int16_t *block = pic->blocks[n];
+    int i = 0, last, run, level;
+
+    do {
+        if (mpeg4_read_tcoef(pic, 1, &last, &run, &level) < 0)
+            return -1;
+        i += run;
+        if (i > 63)
+            return -1;
+        block[mpeg4_zigzag_scan[i]] = mpeg4_dequantize(pic, level, mpeg4_zigzag_scan[i], 0);
+        i++;
+    } while (!last);
+    if (pic->quant_type)
+        mpeg4_mismatch_control(block);
+    return 0;
+}
+
+/* Transforms the coded blocks of the macroblock and stores (intra) or adds them */
+static void
+mpeg4_reconstruct(struct mpeg4_picture *pic, int cbp, int intra)
+{
+    const struct dsp_ops *dsp = pic->dsp;
+    ptrdiff_t stride = pic->stride;
+    int i;
+
+    for (i = 0; i < 6; i++) {
+        if (cbp & (32 >> i))
+            dsp->idct(pic->blocks[i]);
+    }
+    for (i = 0; i < 4; i++) {
+        uint8_t *dst = pic->dst_y + (i & 1) * 8 + (i >> 1) * 8 * stride;
+
+        if (!(cbp & (32 >> i)))
+            continue;
+        if (intra)
+            dsp->put_block(dst, stride, pic->blocks[i]);
+        else
+            dsp->add_block(dst, stride, pic->blocks[i]);
+        memset(pic->blocks[i], 0, sizeof(pic->blocks[i]));
+    }
+
+    if (!(cbp & 3))
+        return;
+    if (intra)
+        dsp->put_block_uv(pic->dst_uv, stride, pic->blocks[4], pic->blocks[5]);
+    else
+        dsp->add_block_uv(pic->dst_uv, stride, pic->blocks[4], pic->blocks[5]);
+    memset(pic->blocks[4], 0, 2 * sizeof(pic->blocks[4]));
+}
+
+/* Marks the blocks of a macroblock that is not intra as unusable for DC and AC prediction */
+static void
+mpeg4_clear_block_states(struct mpeg4_picture *pic)
+{
+    int n;
+
+    for (n = 0; n < 6; n++) {
+        struct mpeg4_block *state = mpeg4_block_state(pic, n, 0, 0);
+
+        state->dc = 1024;
+        memset(state->ac, 0, sizeof(state->ac));
+    }
+}
+
+/*
+ * Reads one component of a motion vector difference (6.3.6.2) and adds it
+ * to pred, wrapping the sum into the range of fcode (7.6.3.1)
+ */
+static int
+mpeg4_read_mv(struct mpeg4_picture *pic, int fcode, int pred, int16_t *mv)
+{
+    struct bitstream *bs = &pic->bs;
+    int code = vlc_get(bs, &mpeg4_motion_vlc), shift = fcode - 1, bits = 5 + fcode;
+    int value = code, sign;
+
+    if (code < 0)
+        return -1;
+    if (0 == code) {
+        *mv = pred;
+        return 0;
+    }
+    sign = bitstream_get_bit(bs);
+    if (shift)
+        value = (((value - 1) << shift) | bitstream_get_bits(bs, shift)) + 1;
+    value = pred + (sign ? -value : value);
+    *mv = (int32_t) ((uint32_t) value << (32 - bits)) >> (32 - bits);
+    return 0;
+}
+
+/*
+ * Predicts the vector of luma block n (of all of the macroblock for 0)
+ * as the median of its neighbours, of which those outside the VOP or the
+ * video packet do not count (7.6.5)
+ */
+static void
+mpeg4_predict_mv(const struct mpeg4_picture *pic, int n, int pred[2])
+{
+    /* Blocks A, B and C of Figure 7-32 relative to the first block of the macroblock */
+    static const int8_t candidates[4][3][2] = {
+        { { -1, 0 }, { 0, -1 }, { 2, -1 } },
+        { { 0, 0 }, { 1, -1 }, { 2, -1 } },
+        { { -1, 1 }, { 0, 0 }, { 1, 0 } },
+        { { 0, 1 }, { 0, 0 }, { 1, 0 } },
+    };
+    int mv[3][2], valid = 0, last = 0, i;
+
+    for (i = 0; i < 3; i++) {
+        int x = pic->mb_x * 2 + candidates[n][i][0], y = pic->mb_y * 2 + candidates[n][i][1];
+        int address = (y >> 1) * pic->mb_width + (x >> 1);
+
+        mv[i][0] = mv[i][1] = 0;
+        if (x < 0 || y < 0 || x >= 2 * pic->mb_width || address < pic->packet_start)
+            continue;
+        mv[i][0] = pic->motion[address].mv[(y & 1) * 2 + (x & 1)][0];
+        mv[i][1] = pic->motion[address].mv[(y & 1) * 2 + (x & 1)][1];
+        valid++;
+        last = i;
+    }
+    if (1 == valid) {
+        pred[0] = mv[last][0];
+        pred[1] = mv[last][1];
+    } else {
+        pred[0] = mpeg4_median(mv[0][0], mv[1][0], mv[2][0]);
+        pred[1] = mpeg4_median(mv[0][1], mv[1][1], mv[2][1]);
+    }
+}
+
+static inline void
+mpeg4_dquant(struct mpeg4_picture *pic, int delta)
+{
+    pic->quant = mpeg4_clip3(1, 31, pic->quant + delta);
+}
+
+/* The intra macroblock after its mcbpc, in any type of VOP */
+static int
+mpeg4_decode_intra_mb(struct mpeg4_picture *pic, int cbpc, int dquant)
+{
+    struct bitstream *bs = &pic->bs;
+    int address = pic->mb_y * pic->mb_width + pic->mb_x;
+    int ac_pred = bitstream_get_bit(bs);
+    int cbpy = vlc_get(bs, &mpeg4_cbpy_vlc);
+    int use_dc_vlc = pic->quant < pic->intra_dc_thr;
+    int cbp, i;
+
+    if (cbpy < 0)
+        return -1;
+    cbp = (cbpc & 3) | (cbpy << 2);
+    if (dquant)
+        mpeg4_dquant(pic, mpeg4_dquant_table[bitstream_get_bits(bs, 2)]);
+    pic->decoder->mbs[address].quant = pic->quant;
+    pic->motion[address].flags = MPEG4_MB_INTRA;
+
+    for (i = 0; i < 6; i++) {
+        if (mpeg4_decode_intra_block(pic, i, cbp & (32 >> i), use_dc_vlc, ac_pred) < 0)
+            return -1;
+    }
+    mpeg4_reconstruct(pic, 0x3f, 1);
+    return 0;
+}
+
+static int
+mpeg4_decode_i_mb(struct mpeg4_picture *pic)
+{
+    int mcbpc;
+
+    do {
+        mcbpc = vlc_get(&pic->bs, &mpeg4_mcbpc_i_vlc);
+        if (mcbpc < 0)
+            return -1;
+    } while (MPEG4_MCBPC_I_STUFFING == mcbpc);
+    return mpeg4_decode_intra_mb(pic, mcbpc, mcbpc & 4);
+}
+
+/* Macroblocks of P-VOPs and S(GMC)-VOPs */
+static int
+mpeg4_decode_p_mb(struct mpeg4_picture *pic)
+{
+    struct bitstream *bs = &pic->bs;
+    int address = pic->mb_y * pic->mb_width + pic->mb_x;
+    struct mpeg4_motion *motion = &pic->motion[address];
+    int mcbpc, cbpy, cbp, mcsel = 0, i;
+
+    do {
+        if (bitstream_get_bit(bs)) {
+            /* not_coded: predicted from the sprite in S(GMC)-VOPs, copied otherwise */
+            pic->decoder->mbs[address].quant = pic->quant;
+            mpeg4_clear_block_states(pic);
+            if (pic->gmc) {
+                motion->flags = MPEG4_MB_GMC;
+                for (i = 0; i < 4; i++) {
+                    motion->mv[i][0] = mpeg4_gmc_vector(pic, 0);
+                    motion->mv[i][1] = mpeg4_gmc_vector(pic, 1);
+                }
+                mpeg4_predict_gmc(pic);
+            } else {
+                motion->flags = MPEG4_MB_NOT_CODED;
+                mpeg4_predict_mb(pic, pic->dst_y, pic->dst_uv, pic->stride, &pic->refs[0],
+                                 motion->mv, 0, pic->rnd);
+            }
+            return 0;
+        }
+        mcbpc = vlc_get(bs, &mpeg4_mcbpc_p_vlc);
+        if (mcbpc < 0)
+            return -1;
+    } while (MPEG4_MCBPC_P_STUFFING == mcbpc);
+    if (mcbpc & 4)
+        return mpeg4_decode_intra_mb(pic, mcbpc, mcbpc & 8);
+
+    if (pic->gmc && !(mcbpc & 16))
+        mcsel = bitstream_get_bit(bs);
+    cbpy = vlc_get(bs, &mpeg4_cbpy_vlc);
+    if (cbpy < 0)
+        return -1;
+    cbp = (mcbpc & 3) | ((cbpy ^ 15) << 2);
+    if (mcbpc & 8)
+        mpeg4_dquant(pic, mpeg4_dquant_table[bitstream_get_bits(bs, 2)]);
+    pic->decoder->mbs[address].quant = pic->quant;
+    mpeg4_clear_block_states(pic);
+
+    if (mcsel) {
+        motion->flags = MPEG4_MB_GMC;
+        for (i = 0; i < 4; i++) {
+            motion->mv[i][0] = mpeg4_gmc_vector(pic, 0);
+            motion->mv[i][1] = mpeg4_gmc_vector(pic, 1);
+        }
+        mpeg4_predict_gmc(pic);
+    } else {
+        int four = mcbpc & 16, pred[2];
+
+        motion->flags = four ? MPEG4_MB_4MV : 0;
+        for (i = 0; i < (four ? 4 : 1); i++) {
+            mpeg4_predict_mv(pic, i, pred);
+            if (mpeg4_read_mv(pic, pic->fcode[0], pred[0], &motion->mv[i][0]) < 0 ||
+                mpeg4_read_mv(pic, pic->fcode[0], pred[1], &motion->mv[i][1]) < 0)
+                return -1;
+        }
+        for (; i < 4; i++) {
+            motion->mv[i][0] = motion->mv[0][0];
+            motion->mv[i][1] = motion->mv[0][1];
+        }
+        mpeg4_predict_mb(pic, pic->dst_y, pic->dst_uv, pic->stride, &pic->refs[0], motion->mv, four, pic->rnd);
+    }
+
+    for (i = 0; i < 6; i++) {
+        if ((cbp & (32 >> i)) && mpeg4_decode_inter_block(pic, i) < 0)
+            return -1;
+    }
+    mpeg4_reconstruct(pic, cbp, 0);
+    return 0;
+}
+
+/* Macroblocks of B-VOPs, whose motion nothing refers to later */
+static int
+mpeg4_decode_b_mb(struct mpeg4_picture *pic)
+{
+    struct bitstream *bs = &pic->bs;
+    int address = pic->mb_y * pic->mb_width + pic->mb_x;
+    const struct mpeg4_motion *col = pic->col_motion ? &pic->col_motion[address] : NULL;
+    int16_t mv[2][4][2];
+    int type = MPEG4_B_DIRECT, cbp = 0, four = 0, coded, i, j;
+
+    pic->decoder->mbs[address].quant = pic->quant;
+    mpeg4_clear_block_states(pic);
+    memset(mv, 0, sizeof(mv));
+
+    /* Skipped where the macroblock of the next anchor VOP was */
+    if (col && (col->flags & MPEG4_MB_NOT_CODED)) {
+        mpeg4_predict_mb(pic, pic->dst_y, pic->dst_uv, pic->stride, &pic->refs[0], mv[0], 0, 0);
+        return 0;
+    }
+
+    /* modb of '1' is a direct macroblock without vector delta or blocks */
+    coded = !bitstream_get_bit(bs);
+    if (coded) {
+        /* '01' leaves cbpb out, '00' codes it */
+        int has_cbp = !bitstream_get_bit(bs);
+
+        type = vlc_get(bs, &mpeg4_b_type_vlc);
+        if (type < 0)
+            return -1;
+        if (has_cbp)
+            cbp = bitstream_get_bits(bs, 6);
+        if (MPEG4_B_DIRECT != type && cbp && bitstream_get_bit(bs))
+            mpeg4_dquant(pic, bitstream_get_bit(bs) ? 2 : -2);
+        pic->decoder->mbs[address].quant = pic->quant;
+    }
+
+    if (MPEG4_B_DIRECT == type) {
+        int16_t delta[2] = { 0, 0 };
+
+        /* Direct mode of 7.6.9.5 scales the vectors of the next anchor VOP by TRB / TRD */
+        if (coded && (mpeg4_read_mv(pic, 1, 0, &delta[0]) < 0 || mpeg4_read_mv(pic, 1, 0, &delta[1]) < 0))
+            return -1;
+        four = pic->quarter_sample || (col && (col->flags & MPEG4_MB_4MV));
+        for (i = 0; i < 4; i++) {
+            for (j = 0; j < 2; j++) {
+                int c = col ? col->mv[i][j] : 0;
+
+                mv[0][i][j] = c * pic->trb / pic->trd + delta[j];
+                mv[1][i][j] = delta[j] ? mv[0][i][j] - c : c * (pic->trb - pic->trd) / pic->trd;
+            }
+        }
+    } else {
+        if (MPEG4_B_BACKWARD != type) {
+            if (mpeg4_read_mv(pic, pic->fcode[0], pic->last_mv[0][0], &mv[0][0][0]) < 0 ||
+                mpeg4_read_mv(pic, pic->fcode[0], pic->last_mv[0][1], &mv[0][0][1]) < 0)
+                return -1;
+            pic->last_mv[0][0] = mv[0][0][0];
+            pic->last_mv[0][1] = mv[0][0][1];
+        }
+        if (MPEG4_B_FORWARD != type) {
+            if (mpeg4_read_mv(pic, pic->fcode[1], pic->last_mv[1][0], &mv[1][0][0]) < 0 ||
+                mpeg4_read_mv(pic, pic->fcode[1], pic->last_mv[1][1], &mv[1][0][1]) < 0)
+                return -1;
+            pic->last_mv[1][0] = mv[1][0][0];
+            pic->last_mv[1][1] = mv[1][0][1];
+        }
+    }
+
+    if (MPEG4_B_BACKWARD == type) {
+        mpeg4_predict_mb(pic, pic->dst_y, pic->dst_uv, pic->stride, &pic->refs[1], mv[1], 0, 0);
+    } else {
+        mpeg4_predict_mb(pic, pic->dst_y, pic->dst_uv, pic->stride, &pic->refs[0], mv[0], four, 0);
+        if (MPEG4_B_FORWARD != type) {
+            mpeg4_predict_mb(pic, pic->tmp, pic->tmp + 16 * 16, 16, &pic->refs[1], mv[1], four, 0);
+            pic->mc->avg(pic->dst_y, pic->stride, pic->tmp, 16, 16, 16);
+            pic->mc->avg(pic->dst_uv, pic->stride, pic->tmp + 16 * 16, 16, 16, 8);
+        }
+    }
+
+    for (i = 0; i < 6; i++) {
+        if ((cbp & (32 >> i)) && mpeg4_decode_inter_block(pic, i) < 0)
+            return -1;
+    }
+    mpeg4_reconstruct(pic, cbp, 0);
+    return 0;
+}
+
+/* Starts a video packet at macroblock address */
+static void
+mpeg4_start_packet(struct mpeg4_picture *pic, int address)
+{
+    pic->packet_start = address;
+    memset(pic->last_mv, 0, sizeof(pic->last_mv));
+}
+
+/* Zeros of resync_marker, 6.3.5.2; B-VOPs use at least 17 like encoders write them */
+static int
+mpeg4_resync_length(const struct mpeg4_picture *pic)
+{
+    int fcode = pic->fcode[0] > pic->fcode[1] ? pic->fcode[0] : pic->fcode[1];
+
+    switch (pic->type) {
+    case MPEG4_VOP_I:
+        return 16;
+    case MPEG4_VOP_B:
+        return 15 + (fcode > 2 ? fcode : 2);
+    default:
+        return 15 + pic->fcode[0];
+    }
+}
+
+/* Skips the sprite_trajectory() of a header */
+static void
+mpeg4_skip_sprite_trajectory(struct mpeg4_picture *pic)
+{
+    int i, length;
+
+    for (i = 0; i < 2 * pic->pic_param->no_of_sprite_warping_points; i++) {
+        length = vlc_get(&pic->bs, &mpeg4_sprite_vlc);
+        if (length > 0)
+            bitstream_skip_bits(&pic->bs, length);
+        bitstream_skip_bits(&pic->bs, 1);               /* marker_bit */
+    }
+}
+
+/*
+ * After a macroblock, skips macroblock stuffing and checks for the
+ * stuffing and resync marker (6.3.5.2) of the next video packet. Leaves
+ * the stream after the marker and returns 1 if there is one.
+ */
+static int
+mpeg4_resync(struct mpeg4_picture *pic)
+{
+    struct bitstream *bs = &pic->bs;
+    size_t pos;
+    int zeros = 0;
+
+    if (MPEG4_VOP_I == pic->type) {
+        while (1 == bitstream_show_bits(bs, 9))
+            bitstream_skip_bits(bs, 9);
+    } else if (MPEG4_VOP_B != pic->type) {
+        while (1 == bitstream_show_bits(bs, 10))
+            bitstream_skip_bits(bs, 10);
+    }
+    if (bitstream_show_bits(bs, 16) != mpeg4_resync_prefix[bs->pos & 7])
+        return 0;
+
+    pos = bs->pos;
+    bitstream_skip_bits(bs, 1);
+    bitstream_byte_align(bs);
+    while (zeros <= 32 && !bitstream_get_bit(bs))
+        zeros++;
+    if (zeros != mpeg4_resync_length(pic)) {
+        bs->pos = pos;
+        return 0;
+    }
+    return 1;
+}
+
+/* video_packet_header() after the resync marker, 6.2.5.2 */
+static int
+mpeg4_read_packet_header(struct mpeg4_picture *pic)
+{
+    struct bitstream *bs = &pic->bs;
+    int address = bitstream_get_bits(bs, pic->mb_num_bits);
+    int quant = bitstream_get_bits(bs, pic->quant_precision);
+
+    if (address <= 0 || address >= pic->mb_num)
+        return -1;
+    if (quant)
+        pic->quant = quant;
+    if (bitstream_get_bit(bs)) {
+        /* header_extension_code repeats what the VOP header said */
+        while (bitstream_get_bit(bs) && bitstream_bits_left(bs) > 0)
+            ;                                           /* modulo_time_base */
+        bitstream_skip_bits(bs, 1 + pic->time_increment_bits + 1 + 2 + 3);
+        if (pic->gmc)
+            mpeg4_skip_sprite_trajectory(pic);
+        if (MPEG4_VOP_I != pic->type)
+            bitstream_skip_bits(bs, 3);                 /* vop_fcode_forward */
+        if (MPEG4_VOP_B == pic->type)
+            bitstream_skip_bits(bs, 3);                 /* vop_fcode_backward */
+    }
+    mpeg4_start_packet(pic, address);
+    return 0;
+}
+
+/*
+ * Clients may hand the whole VOP over, start code and header included,
+ * rather than its first video packet. Skips to its macroblocks, returning
+ * 1 if there are none, or -1 if there is no VOP header after all.
+ */
+static int
+mpeg4_skip_vop_header(struct mpeg4_picture *pic)
+{
+    struct bitstream *bs = &pic->bs;
+
+    while (bitstream_bits_left(bs) >= 32 && 0x1b6 != bitstream_show_bits(bs, 32))
+        bitstream_skip_bits(bs, 8);
+    if (bitstream_bits_left(bs) < 32)
+        return -1;
+    bitstream_skip_bits(bs, 32 + 2);                    /* vop_start_code, vop_coding_type */
+    while (bitstream_get_bit(bs) && bitstream_bits_left(bs) > 0)
+        ;                                               /* modulo_time_base */
+    bitstream_skip_bits(bs, 1 + pic->time_increment_bits + 1);
+    if (!bitstream_get_bit(bs))                         /* vop_coded */
+        return 1;
+    if (MPEG4_VOP_P == pic->type || pic->gmc)
+        bitstream_skip_bits(bs, 1);                     /* vop_rounding_type */
+    bitstream_skip_bits(bs, 3);                         /* intra_dc_vlc_thr */
+    if (pic->gmc)
+        mpeg4_skip_sprite_trajectory(pic);
+    pic->quant = bitstream_get_bits(bs, pic->quant_precision);
+    if (MPEG4_VOP_I != pic->type)
+        bitstream_skip_bits(bs, 3);                     /* vop_fcode_forward */
+    if (MPEG4_VOP_B == pic->type)
+        bitstream_skip_bits(bs, 3);                     /* vop_fcode_backward */
+    return 0;
+}
+
+static inline void
+mpeg4_set_mb(struct mpeg4_picture *pic, int address)
+{
+    pic->mb_x = address % pic->mb_width;
+    pic->mb_y = address / pic->mb_width;
+    pic->dst_y = pic->y + pic->mb_y * 16 * pic->stride + pic->mb_x * 16;
+    pic->dst_uv = pic->uv + pic->mb_y * 8 * pic->stride + pic->mb_x * 16;
+}
+
+/* A VOP that is not coded repeats its forward reference, and B-VOPs skip where it is */
+static void
+mpeg4_copy_reference(struct mpeg4_picture *pic)
+{
+    int16_t mv[4][2] = { { 0, 0 } };
+    int address;
+
+    for (address = 0; address < pic->mb_num; address++) {
+        mpeg4_set_mb(pic, address);
+        pic->motion[address].flags = MPEG4_MB_NOT_CODED;
+        mpeg4_predict_mb(pic, pic->dst_y, pic->dst_uv, pic->stride, &pic->refs[0], mv, 0, 0);
+    }
+}
+
+/*
+ * Decodes the video packets in the data of one slice, from the one it
+ * starts with to the end of its data or the first damage found
+ */
+static void
+mpeg4_decode_slice(struct mpeg4_picture *pic, const VASliceParameterBufferMPEG4 *slice_param,
+                   const uint8_t *data)
+{
+    size_t size = slice_param->slice_data_size;
+    int address = slice_param->macroblock_number;
+    int status;
+
+    data += slice_param->slice_data_offset;
+    if (0 == size)
+        return;
+    pic->quant = slice_param->quant_scale;
+    if (size >= 3 && !data[0] && !data[1] && data[2] == 1) {
+        bitstream_init(&pic->bs, data, size, 0);
+        status = mpeg4_skip_vop_header(pic);
+        if (status > 0)
+            mpeg4_copy_reference(pic);
+        if (status)
+            return;
+        address = 0;
+    } else {
+        if (slice_param->macroblock_offset >= size * 8)
+            return;
+        bitstream_init(&pic->bs, data, size, slice_param->macroblock_offset);
+    }
+    if (address >= pic->mb_num || pic->quant < 1 || pic->quant > 31)
+        return;
+
+    mpeg4_start_packet(pic, address);
+    for (;;) {
+        mpeg4_set_mb(pic, address);
+        if (0 == pic->mb_x)
+            memset(pic->last_mv, 0, sizeof(pic->last_mv));
+        switch (pic->type) {
+        case MPEG4_VOP_I:
+            status = mpeg4_decode_i_mb(pic);
+            break;
+        case MPEG4_VOP_B:
+            status = mpeg4_decode_b_mb(pic);
+            break;
+        default:
+            status = mpeg4_decode_p_mb(pic);
+            break;
+        }
+        if (status < 0 || bitstream_bits_left(&pic->bs) < 0 || ++address >= pic->mb_num)
+            return;
+        if (pic->resync && mpeg4_resync(pic)) {
+            if (mpeg4_read_packet_header(pic) < 0)
+                return;
+            address = pic->packet_start;
+        }
+    }
+}
+
+/* Sets pic up from the parameter buffers rendered into picture */
+static VAStatus
+mpeg4_init_picture(struct epiphany_driver_data *driver_data, const struct epiphany_picture *picture,
+                   object_surface_p obj_surface, struct mpeg4_picture *pic)
+{
+    const VAPictureParameterBufferMPEG4 *pic_param;
+    const VAIQMatrixBufferMPEG4 *iq_matrix = NULL;
+    object_buffer_p obj_buffer;
+    int i;
+
+    obj_buffer = BUFFER(picture->pic_param);
+    if (NULL == obj_buffer || obj_buffer->element_size < sizeof(*pic_param) || NULL == obj_surface->storage)
+        return VA_STATUS_ERROR_INVALID_PARAMETER;
+    pic_param = obj_buffer->buffer_data;
+    if (pic_param->vol_fields.bits.short_video_header || pic_param->vol_fields.bits.interlaced ||
+        pic_param->vol_fields.bits.chroma_format != 1 || !pic_param->vol_fields.bits.obmc_disable ||
+        pic_param->vol_fields.bits.data_partitioned || pic_param->vol_fields.bits.reversible_vlc ||
+        MPEG4_SPRITE_STATIC == pic_param->vol_fields.bits.sprite_enable)
+        return VA_STATUS_ERROR_UNIMPLEMENTED;
+
+    memset(pic, 0, sizeof(*pic));
+    pic->dsp = driver_data->dsp_ops;
+    pic->mc = driver_data->mpeg4_dsp_ops;
+    pic->pic_param = pic_param;
+    pic->type = pic_param->vop_fields.bits.vop_coding_type;
+    pic->width = pic_param->vop_width;
+    pic->height = pic_param->vop_height;
+    pic->mb_width = (pic->width + 15) / 16;
+    pic->mb_height = (pic->height + 15) / 16;
+    pic->edge_width = pic->mb_width * 16;
+    pic->edge_height = pic->mb_height * 16;
+    pic->mb_num = pic->mb_width * pic->mb_height;
+    if (0 == pic->mb_width || 0 == pic->mb_height ||
+        pic->mb_width * 16 > obj_surface->storage->pitch ||
+        pic->mb_height * 16 > obj_surface->storage->luma_height)
+        return VA_STATUS_ERROR_INVALID_PARAMETER;
+    pic->y = obj_surface->storage->data;
+    pic->uv = obj_surface->storage->data + obj_surface->storage->chroma_offset;
+    pic->stride = obj_surface->storage->pitch;
+
+    pic->quant_type = pic_param->vol_fields.bits.quant_type;
+    pic->quarter_sample = pic_param->vol_fields.bits.quarter_sample;
+    pic->resync = !pic_param->vol_fields.bits.resync_marker_disable;
+    pic->quant_precision = pic_param->quant_precision;
+    pic->fcode[0] = pic_param->vop_fcode_forward;
+    pic->fcode[1] = pic_param->vop_fcode_backward;
+    pic->intra_dc_thr = mpeg4_intra_dc_thr[pic_param->vop_fields.bits.intra_dc_vlc_thr];
+    pic->trb = pic_param->TRB;
+    pic->trd = pic_param->TRD;
+    if (pic->quant_precision < 3 || pic->quant_precision > 9 ||
+        (MPEG4_VOP_I != pic->type && (pic->fcode[0] < 1 || pic->fcode[0] > 7)) ||
+        (MPEG4_VOP_B == pic->type && (pic->fcode[1] < 1 || pic->fcode[1] > 7 || pic->trd <= 0)))
+        return VA_STATUS_ERROR_INVALID_PARAMETER;
+    /* B-VOPs round up, the others as vop_rounding_type says */
+    if (MPEG4_VOP_B != pic->type)
+        pic->rnd = pic_param->vop_fields.bits.vop_rounding_type;
+    pic->mb_num_bits = 1;
+    while ((1 << pic->mb_num_bits) < pic->mb_num)
+        pic->mb_num_bits++;
+    pic->time_increment_bits = 1;
+    while ((1 << pic->time_increment_bits) < pic_param->vop_time_increment_resolution)
+        pic->time_increment_bits++;
+
+    /* Matrices the VOL does not load are the defaults of 6.3.3 */
+    memcpy(pic->intra_matrix, mpeg4_default_intra_matrix, 64);
+    memcpy(pic->inter_matrix, mpeg4_default_inter_matrix, 64);
+    obj_buffer = BUFFER(picture->iq_matrix);
+    if (obj_buffer && obj_buffer->element_size >= sizeof(*iq_matrix))
+        iq_matrix = obj_buffer->buffer_data;
+    for (i = 0; iq_matrix && i < 64; i++) {
+        /* VA-API passes the matrices in zigzag order */
+        if (iq_matrix->load_intra_quant_mat)
+            pic->intra_matrix[mpeg4_zigzag_scan[i]] = iq_matrix->intra_quant_mat[i];
+        if (iq_matrix->load_non_intra_quant_mat)
+            pic->inter_matrix[mpeg4_zigzag_scan[i]] = iq_matrix->non_intra_quant_mat[i];
+    }
+    for (i = 0; pic->quant_type && i < 64; i++) {
+        if (0 == pic->intra_matrix[i] || 0 == pic->inter_matrix[i])
+            return VA_STATUS_ERROR_INVALID_PARAMETER;
+    }
+
+    if (MPEG4_VOP_S == pic->type) {
+        if (MPEG4_SPRITE_GMC != pic_param->vol_fields.bits.sprite_enable ||
+            pic_param->no_of_sprite_warping_points > 3)
+            return VA_STATUS_ERROR_INVALID_PARAMETER;
+        /* Warps too large for the 16.16 form are not decoded by the reference decoder either */
+        if (mpeg4_init_sprite(pic, pic_param) < 0)
+            return VA_STATUS_ERROR_UNIMPLEMENTED;
+        pic->gmc = 1;
+    }
+    return VA_STATUS_SUCCESS;
+}
+
+VAStatus
+epiphany_mpeg4_decode_picture(struct epiphany_driver_data *driver_data,
+                              object_context_p obj_context,
+                              const struct epiphany_picture *picture,
+                              object_surface_p obj_surface)
+{
+    struct epiphany_mpeg4_decoder *decoder = obj_context->decoder;
+    const VAPictureParameterBufferMPEG4 *pic_param;
+    VASurfaceID surface = obj_surface->base.id;
+    struct mpeg4_picture *pic;
+    struct mpeg4_frame *frame;
+    VAStatus vaStatus;
+    int i, j;
+
+    if (pthread_once(&mpeg4_tables_once, mpeg4_init_tables) || mpeg4_tables_status)
+        return VA_STATUS_ERROR_OPERATION_FAILED;
+
+    /* Too big for the stack of client threads */
+    pic = malloc(sizeof(*pic));
+    if (NULL == pic)
+        return VA_STATUS_ERROR_ALLOCATION_FAILED;
+    vaStatus = mpeg4_init_picture(driver_data, picture, obj_surface, pic);
+    if (VA_STATUS_SUCCESS != vaStatus)
+        goto out;
+    pic_param = pic->pic_param;
+
+    if (NULL == decoder) {
+        decoder = mpeg4_create_decoder();
+        if (NULL == decoder) {
+            vaStatus = VA_STATUS_ERROR_ALLOCATION_FAILED;
+            goto out;
+        }
+        obj_context->decoder = decoder;
+    }
+    if (mpeg4_resize_decoder(decoder, pic->mb_width, pic->mb_height) < 0 ||
+        NULL == (frame = mpeg4_claim_frame(decoder, pic_param, surface))) {
+        vaStatus = VA_STATUS_ERROR_ALLOCATION_FAILED;
+        goto out;
+    }
+    pic->decoder = decoder;
+    pic->motion = frame->motion;
+    memset(pic->motion, 0, (size_t) pic->mb_num * sizeof(*pic->motion));
+
+    mpeg4_lookup_reference(driver_data, pic, pic_param->forward_reference_picture, &pic->refs[0]);
+    mpeg4_lookup_reference(driver_data, pic, pic_param->backward_reference_picture, &pic->refs[1]);
+    if (MPEG4_VOP_B == pic->type) {
+        struct mpeg4_frame *col = mpeg4_find_frame(decoder, pic_param->backward_reference_picture);
+
+        if (col && col != frame)
+            pic->col_motion = col->motion;
+    }
+
+    memset(decoder->mbs, 0, (size_t) pic->mb_num * sizeof(*decoder->mbs));
+    memset(decoder->blocks, 0, 6 * (size_t) pic->mb_num * sizeof(*decoder->blocks));
+
+    /* Slice parameter buffers pair up with the slice data buffers in order */
+    for (i = 0; i < picture->slice_params.num_buffers && i < picture->slice_data.num_buffers; i++) {
+        object_buffer_p obj_params = BUFFER(picture->slice_params.buffers[i]);
+        object_buffer_p obj_data = BUFFER(picture->slice_data.buffers[i]);
+        size_t data_size;
+
+        if (NULL == obj_params || NULL == obj_data ||
+            obj_params->element_size < sizeof(VASliceParameterBufferMPEG4))
+            continue;
+        data_size = (size_t) obj_data->element_size * obj_data->num_elements;
+        for (j = 0; j < obj_params->num_elements; j++) {
+            const VASliceParameterBufferMPEG4 *slice_param = (const VASliceParameterBufferMPEG4 *)
+                ((const uint8_t *) obj_params->buffer_data + (size_t) j * obj_params->element_size);
+
+            if (slice_param->slice_data_offset > data_size ||
+                slice_param->slice_data_size > data_size - slice_param->slice_data_offset)
+                continue;
+            mpeg4_decode_slice(pic, slice_param, obj_data->buffer_data);
+        }
+    }
+
+out:
+    free(pic);
+    return vaStatus;
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2012 Scott Tincman <sctincman@gmail.com>. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef _EPIPHANY_MPEG4_H_
+#define _EPIPHANY_MPEG4_H_
+
+#include "epiphany_drv_video.h"
+
+/*
+ * Host CPU MPEG-4 Part 2 decoding of the Simple, Advanced Simple and
+ * Main profiles, next to the other codecs. Pictures are decoded from
+ * the buffers rendered into the context straight into the NV12 planes
+ * of the render target.
+ */
+
+/*
+ * Decodes the buffers rendered into picture into obj_surface
+ */
+VAStatus
+epiphany_mpeg4_decode_picture(struct epiphany_driver_data *driver_data,
+                              object_context_p obj_context,
+                              const struct epiphany_picture *picture,
+                              object_surface_p obj_surface);
+
+/*
+ * Frees the decoder state kept in obj_context->decoder
+ */
+void
+epiphany_mpeg4_destroy_decoder(void *decoder);
+
+#endif /* _EPIPHANY_MPEG4_H_ */
@@ -0,0 +1,3280 @@
+/*
+ * Copyright (c) 2012 Scott Tincman <sctincman@gmail.com>. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+/*
+ * VC-1 VLD decoding (SMPTE 421M) on the host CPU.
+ *
+ * The client parsed the sequence, entry point and picture headers,
+ * including the bitplanes, so this starts at the macroblock layer:
+ * entropy decoding, DC/AC prediction, motion vector prediction, the
+ * variable size inverse transforms, motion compensation with intensity
+ * compensation, then overlap smoothing and the in-loop deblocking filter
+ * over the whole picture once all its slices are in. Progressive frames
+ * of the Simple, Main and Advanced profiles are supported. Interlaced
+ * pictures, range reduction and multiresolution coding are refused
+ * rather than decoded wrong.
+ *
+ * Direct prediction in B pictures needs the motion of the following
+ * anchor picture, so the decoder keeps the motion field of each surface
+ * it decoded for as long as pictures refer to it.
+ */
+
+#include "config.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "epiphany_vc1.h"
+#include "bitstream.h"
+#include "vlc.h"
+
+/* VAPictureParameterBufferVC1.sequence_fields.bits.profile */
+#define VC1_PROFILE_SIMPLE      0
+#define VC1_PROFILE_MAIN        1
+#define VC1_PROFILE_ADVANCED    3
+
+/* picture_fields.bits.picture_type */
+#define VC1_PICTURE_I           0
+#define VC1_PICTURE_P           1
+#define VC1_PICTURE_B           2
+#define VC1_PICTURE_BI          3
+#define VC1_PICTURE_SKIPPED     4
+
+/* mv_fields.bits.mv_mode, VAMvModeVC1 */
+#define VC1_MV_1MV              0
+#define VC1_MV_1MV_HPEL         1
+#define VC1_MV_1MV_HPEL_BILINEAR 2
+#define VC1_MV_MIXED            3
+#define VC1_MV_INTENSITY_COMP   4
+
+/* conditional_overlap_flag */
+#define VC1_CONDOVER_NONE       0
+#define VC1_CONDOVER_ALL        1
+#define VC1_CONDOVER_SELECT     2
+
+/* pic_quantizer_fields.bits.dq_profile */
+#define VC1_DQPROFILE_FOUR_EDGES    0
+#define VC1_DQPROFILE_DOUBLE_EDGES  1
+#define VC1_DQPROFILE_SINGLE_EDGE   2
+#define VC1_DQPROFILE_ALL_MBS       3
+
+/* Transform types of a block, what TTMB and TTBLK code */
+#define VC1_TT_8x8              0
+#define VC1_TT_8x4_BOTTOM       1
+#define VC1_TT_8x4_TOP          2
+#define VC1_TT_8x4              3
+#define VC1_TT_4x8_RIGHT        4
+#define VC1_TT_4x8_LEFT         5
+#define VC1_TT_4x8              6
+#define VC1_TT_4x4              7
+#define VC1_TT_MB               8       /* TTMB applies to all blocks of the macroblock */
+
+/* The AC coding sets, indexing the coefficient tables */
+#define VC1_CS_HIGH_MOT_INTRA   0
+#define VC1_CS_HIGH_MOT_INTER   1
+#define VC1_CS_LOW_MOT_INTRA    2
+#define VC1_CS_LOW_MOT_INTER    3
+#define VC1_CS_MID_RATE_INTRA   4
+#define VC1_CS_MID_RATE_INTER   5
+#define VC1_CS_HIGH_RATE_INTRA  6
+#define VC1_CS_HIGH_RATE_INTER  7
+
+/* BMVTYPE */
+#define VC1_BMV_FORWARD         0
+#define VC1_BMV_BACKWARD        1
+#define VC1_BMV_INTERPOLATED    2
+
+/* Bits of the bitplane buffer nibbles */
+#define VC1_BP_FIELDTX          0x01    /* I */
+#define VC1_BP_ACPRED           0x02
+#define VC1_BP_OVERFLAGS        0x04
+#define VC1_BP_SKIPMB           0x02    /* P and B */
+#define VC1_BP_MVTYPEMB         0x04    /* P */
+#define VC1_BP_DIRECTMB         0x01    /* B */
+
+#define VC1_MAX_FRAMES          4       /* The references, the picture and one spare */
+#define VC1_EDGE_STRIDE         32
+#define VC1_DC_ESCAPE           119
+#define VC1_MV_ESCAPE           35
+#define VC1_MV_INTRA            36
+
+/* The motion field of a surface decoded into, one vector per macroblock */
+struct vc1_frame {
+    VASurfaceID surface;        /* VA_INVALID_SURFACE if the slot is free */
+    int16_t (*motion)[2];
+};
+
+/* Prediction state of an 8x8 block */
+struct vc1_block {
+    int16_t dc;                 /* Quantized DC */
+    int16_t ac[16];             /* Quantized AC of the first column at 1-7, of the first row at 9-15 */
+    uint8_t intra;
+    uint8_t coded;              /* I pictures, what CBPCY predicts from */
+};
+
+/* Per macroblock state of the picture */
+struct vc1_mb {
+    uint8_t quant;              /* MQUANT, 0 if skipped */
+    uint8_t intra;              /* Intra blocks, bit n for block n */
+    uint8_t overlap;            /* Intra blocks are overlap smoothed */
+    uint32_t cbp;               /* 4x4 regions with coefficients, 4 bits per block from bit 4n */
+    uint32_t tt;                /* VC1_TT_* of each block, 4 bits per block from bit 4n */
+    int16_t chroma_mv[2];
+};
+
+struct epiphany_vc1_decoder {
+    int mb_width;
+    int mb_height;
+    struct vc1_mb *mbs;
+    struct vc1_block *blocks;   /* Luma in raster order of blocks, then Cb and Cr */
+    int16_t (*mv[2])[2];        /* Forward and backward motion of each luma block */
+    int16_t *intra;             /* Signed intra samples awaiting overlap smoothing, Y then Cb and Cr */
+    uint8_t *slice_start;       /* Macroblock rows that start a slice */
+    struct vc1_frame frames[VC1_MAX_FRAMES];
+    uint8_t *rbsp;              /* Advanced profile slice data without the emulation prevention bytes */
+    size_t rbsp_size;
+    /* The last intensity compensation, which B pictures after it see too */
+    VASurfaceID ic_source;
+    VASurfaceID ic_target;
+    uint8_t ic_luma[256];
+    uint8_t ic_chroma[256];
+    uint8_t *ic_frame;          /* Intensity compensated copy of a reference */
+    size_t ic_frame_size;
+};
+
+struct vc1_reference {
+    uint8_t *y;
+    uint8_t *uv;
+};
+
+struct vc1_picture {
+    const struct vc1_dsp_ops *dsp;
+    struct epiphany_vc1_decoder *decoder;
+    const VAPictureParameterBufferVC1 *pic_param;
+    const uint8_t *bitplane;    /* NULL if none was rendered */
+    int profile;
+    int type;
+    int mb_width;
+    int mb_height;
+    int width;                  /* Luma samples of the decoded frame */
+    int height;
+    int coded_width;
+    int coded_height;
+    uint8_t *y;
+    uint8_t *uv;
+    ptrdiff_t stride;
+    struct vc1_reference refs[2];
+    int16_t (*motion)[2];       /* Of this picture, for later B pictures */
+    const int16_t (*col_motion)[2];     /* Of the backward reference, NULL if unknown */
+
+    /* Picture layer */
+    int pq;
+    int halfpq;
+    int uniform;                /* PQUANTIZER */
+    int pqindex_low;            /* PQINDEX <= 8 */
+    int dquantfrm;
+    int dqprofile;
+    int dqedges;                /* Bit 0 left, 1 top, 2 right, 3 bottom */
+    int dqbilevel;
+    int altpq;
+    int overlap;                /* Overlap smoothing of all intra blocks of I pictures */
+    int condover;
+    int loop_filter;
+    int mv_mode;
+    int quarter_sample;
+    int mspel;
+    int rnd;
+    int fastuvmc;
+    int range_x;                /* MV range in quarter samples */
+    int range_y;
+    int k_x;
+    int k_y;
+    int bfraction;
+    int ttmbf;
+    int ttfrm;
+    int tt_index;
+    int codingset;              /* Luma intra blocks */
+    int codingset2;             /* Chroma intra blocks and inter blocks */
+    int dc_table;
+    const struct vlc *cbpcy_vlc;
+    const struct vlc *mv_vlc;
+    int use_ic;
+
+    /* Slice state */
+    struct bitstream bs;
+    int first_row;              /* Row the slice starts at */
+    int esc3_level_length;
+    int esc3_run_length;
+
+    /* Macroblock state */
+    int mb_x;
+    int mb_y;
+    struct vc1_mb *mb;
+    uint8_t *dst_y;
+    uint8_t *dst_uv;
+    int quant;                  /* MQUANT */
+    int explicit_quant;         /* MQUANT was coded, so HALFQP does not apply */
+    int ac_pred;
+    int mb_intra;
+    int mb_has_coeffs;
+    int16_t block[64] __attribute__((aligned(16)));
+    int16_t intra_block[64] __attribute__((aligned(16)));
+    uint8_t tmp[16 * 16 + 16 * 8] __attribute__((aligned(16)));
+    uint8_t edge[VC1_EDGE_STRIDE * 19];
+};
+
+/*
+ * The AC coefficient codes of the eight coding sets. The last code of
+ * each is the escape, the others index the run and level tables.
+ */
+/* High motion intra */
+static const uint32_t vc1_ac_code0[186] = {
+        1,     5,    13,    18,    14,    21,    19,    63,
+       75,   287,   184,   995,   370,   589,   986,   733,
+     8021,  1465, 16046,     0,    16,     8,    32,    41,
+      500,   563,   480,   298,   989,  1290,  7977,  2626,
+     4722,  5943,     3,    17,   196,    75,   180,  2004,
+      837,   727,  1983,  2360,  3003,  2398,    19,   120,
+      105,   562,  1121,  1004,  1312,  7978, 15952, 15953,
+     5254,    12,    36,   148,  2240,  3849,  7920,    61,
+       83,   416,   726,  3848,    19,   124,  1985,  1196,
+       27,   160,   836,  3961,   121,   993,   724,  8966,
+       33,   572,  4014,  9182,    53,   373,  1971,   197,
+      372,  1925,    72,   419,  1182,    44,   250,  2006,
+      146,  1484,  7921,   163,  1005,  2366,   482,  4723,
+     1988,  5255,   657,   659,  3978,  1289,  1288,  1933,
+     1982,  1932,  1198,  3002,  8967,  2970,  5942,    14,
+       69,   499,  1146,  1500,  9183,    25,    40,   374,
+     1181,  9181,    48,   162,   751,  1464,    63,   165,
+      987,  2367,    68,  1995,  2399,    99,   963,    21,
+     2294,    23,  1176,    44,  1970,    47,  8020,   141,
+     1981,   142,  4482,   251,  1291,    45,  1984,   121,
+     8031,   122,  8022,   561,   996,   417,   323,   503,
+      367,   658,   743,   364,   365,   988,  3979,  1177,
+      984,  1934,   725,  8030,  7979,  1935,  1197, 16047,
+     9180,    74,
+};
+
+static const uint8_t vc1_ac_len0[186] = {
+     2,  3,  4,  5,  6,  7,  8,  8,  9,  9, 10, 10, 11, 12, 12, 13,
+    13, 14, 14,  4,  5,  7,  8,  9,  9, 10, 11, 12, 12, 13, 13, 14,
+    15, 15,  5,  7,  8, 10, 11, 11, 12, 13, 13, 14, 14, 15,  5,  7,
+     9, 10, 11, 12, 13, 13, 14, 14, 15,  6,  9, 11, 12, 14, 15,  6,
+     9, 11, 13, 14,  7,  9, 11, 14,  7, 10, 12, 14,  7, 10, 13, 14,
+     8, 10, 12, 14,  8, 11, 13,  8, 11, 13,  9, 11, 13,  9, 10, 11,
+    10, 13, 15, 10, 12, 14, 11, 15, 11, 15, 12, 12, 12, 13, 13, 13,
+    13, 13, 14, 14, 14, 14, 15,  4,  7,  9, 11, 13, 14,  5,  9, 11,
+    13, 14,  6, 10, 12, 14,  6, 10, 12, 14,  7, 11, 15,  7, 12,  8,
+    12,  8, 13,  8, 13,  8, 13,  8, 13,  8, 13,  8, 13,  8, 11,  9,
+    13,  9, 13, 10, 10, 11, 11, 11, 12, 12, 12, 12, 12, 12, 12, 13,
+    12, 13, 13, 13, 13, 13, 14, 14, 14,  9,
+};
+
+static const uint8_t vc1_ac_run0[185] = {
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,
+     1,  1,  2,  2,  2,  2,  2,  2,  2,  2,  2,  2,  2,  2,  3,  3,
+     3,  3,  3,  3,  3,  3,  3,  3,  3,  4,  4,  4,  4,  4,  4,  5,
+     5,  5,  5,  5,  6,  6,  6,  6,  7,  7,  7,  7,  8,  8,  8,  8,
+     9,  9,  9,  9, 10, 10, 10, 11, 11, 11, 12, 12, 12, 13, 13, 13,
+    14, 14, 14, 15, 15, 15, 16, 16, 17, 17, 18, 19, 20, 21, 22, 23,
+    24, 25, 26, 27, 28, 29, 30,  0,  0,  0,  0,  0,  0,  1,  1,  1,
+     1,  1,  2,  2,  2,  2,  3,  3,  3,  3,  4,  4,  4,  5,  5,  6,
+     6,  7,  7,  8,  8,  9,  9, 10, 10, 11, 11, 12, 12, 13, 13, 14,
+    14, 15, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28,
+    29, 30, 31, 32, 33, 34, 35, 36, 37,
+};
+
+static const uint8_t vc1_ac_level0[185] = {
+     1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15, 16,
+    17, 18, 19,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13,
+    14, 15,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12,  1,  2,
+     3,  4,  5,  6,  7,  8,  9, 10, 11,  1,  2,  3,  4,  5,  6,  1,
+     2,  3,  4,  5,  1,  2,  3,  4,  1,  2,  3,  4,  1,  2,  3,  4,
+     1,  2,  3,  4,  1,  2,  3,  1,  2,  3,  1,  2,  3,  1,  2,  3,
+     1,  2,  3,  1,  2,  3,  1,  2,  1,  2,  1,  1,  1,  1,  1,  1,
+     1,  1,  1,  1,  1,  1,  1,  1,  2,  3,  4,  5,  6,  1,  2,  3,
+     4,  5,  1,  2,  3,  4,  1,  2,  3,  4,  1,  2,  3,  1,  2,  1,
+     2,  1,  2,  1,  2,  1,  2,  1,  2,  1,  2,  1,  2,  1,  2,  1,
+     2,  1,  2,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,
+     1,  1,  1,  1,  1,  1,  1,  1,  1,
+};
+
+/* High motion inter */
+static const uint32_t vc1_ac_code1[169] = {
+        0,     3,    11,    20,    63,    93,   162,   172,
+      366,   522,   738,  1074,  1481,  2087,  2900,  1254,
+     4191,  5930,  8370, 11598, 14832, 16757, 23198,     4,
+       30,    66,   182,   371,   917,  1838,  2964,  5796,
+     8371, 11845,     5,    64,    73,   655,  1483,  1162,
+     2525, 29666,    24,    37,   138,  1307,  3679,  2505,
+     5020,    41,    79,  1042,  1165, 11841,    56,   270,
+     1448,  4188, 14834,    88,   543,  3710, 14847,    35,
+      739,  1253, 11840,   161,  1470,  2504,   131,   314,
+     5921,    68,   630, 14838,   139,  1263, 23195,   520,
+     7422,   921,  7348,   926, 14835,  1451, 29667,  1847,
+    23199,  2093,  3689,  3688,  1075,  2939, 11768, 11862,
+    11863, 14839, 20901,     3,    42,   228,   654,  1845,
+     4184,  7418, 11769, 16756,     9,    84,   920,  1163,
+     5021,    13,   173,  2086, 11596,    17,   363,  2943,
+    20900,    25,   539,  5885,    29,   916, 10451,    43,
+     1468, 23194,    47,   583,    16,  2613,    62,  2938,
+       89,  4190,    38,  2511,    85,  7349,    87,  3675,
+      160,  5224,   368,   144,   462,   538,   536,   360,
+      542,   580,  1846,   312,  1305,  3678,  1836,  2901,
+     2524,  8379,  1164,  5923, 11844,  5797,  1304, 14846,
+      361,
+};
+
+static const uint8_t vc1_ac_len1[169] = {
+     3,  4,  5,  6,  6,  7,  8,  9,  9, 10, 10, 11, 11, 12, 12, 13,
+    13, 13, 14, 14, 14, 15, 15,  4,  5,  7,  8,  9, 10, 11, 12, 13,
+    14, 14,  5,  7,  9, 10, 11, 13, 14, 15,  5,  8, 10, 11, 12, 14,
+    15,  6,  9, 11, 13, 14,  6,  9, 11, 13, 14,  7, 10, 12, 14,  8,
+    10, 13, 14,  8, 11, 14,  8, 11, 13,  9, 12, 14, 10, 13, 15, 10,
+    13, 10, 13, 10, 14, 11, 15, 11, 15, 12, 12, 12, 11, 12, 14, 14,
+    14, 14, 15,  3,  6,  8, 10, 11, 13, 13, 14, 15,  4,  8, 10, 13,
+    15,  4,  9, 12, 14,  5,  9, 12, 15,  5, 10, 13,  5, 10, 14,  6,
+    11, 15,  6, 12,  7, 12,  6, 12,  7, 13,  8, 14,  8, 13,  8, 12,
+     8, 13,  9, 10,  9, 10, 10,  9, 10, 12, 11, 11, 11, 12, 11, 12,
+    14, 14, 13, 13, 14, 13, 11, 14,  9,
+};
+
+static const uint8_t vc1_ac_run1[168] = {
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  1,  1,  1,  1,  1,  1,  1,  1,  1,
+     1,  1,  2,  2,  2,  2,  2,  2,  2,  2,  3,  3,  3,  3,  3,  3,
+     3,  4,  4,  4,  4,  4,  5,  5,  5,  5,  5,  6,  6,  6,  6,  7,
+     7,  7,  7,  8,  8,  8,  9,  9,  9, 10, 10, 10, 11, 11, 11, 12,
+    12, 13, 13, 14, 14, 15, 15, 16, 16, 17, 18, 19, 20, 21, 22, 23,
+    24, 25, 26,  0,  0,  0,  0,  0,  0,  0,  0,  0,  1,  1,  1,  1,
+     1,  2,  2,  2,  2,  3,  3,  3,  3,  4,  4,  4,  5,  5,  5,  6,
+     6,  6,  7,  7,  8,  8,  9,  9, 10, 10, 11, 11, 12, 12, 13, 13,
+    14, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28,
+    29, 30, 31, 32, 33, 34, 35, 36,
+};
+
+static const uint8_t vc1_ac_level1[168] = {
+     1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15, 16,
+    17, 18, 19, 20, 21, 22, 23,  1,  2,  3,  4,  5,  6,  7,  8,  9,
+    10, 11,  1,  2,  3,  4,  5,  6,  7,  8,  1,  2,  3,  4,  5,  6,
+     7,  1,  2,  3,  4,  5,  1,  2,  3,  4,  5,  1,  2,  3,  4,  1,
+     2,  3,  4,  1,  2,  3,  1,  2,  3,  1,  2,  3,  1,  2,  3,  1,
+     2,  1,  2,  1,  2,  1,  2,  1,  2,  1,  1,  1,  1,  1,  1,  1,
+     1,  1,  1,  1,  2,  3,  4,  5,  6,  7,  8,  9,  1,  2,  3,  4,
+     5,  1,  2,  3,  4,  1,  2,  3,  4,  1,  2,  3,  1,  2,  3,  1,
+     2,  3,  1,  2,  1,  2,  1,  2,  1,  2,  1,  2,  1,  2,  1,  2,
+     1,  2,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,
+     1,  1,  1,  1,  1,  1,  1,  1,
+};
+
+/* Low motion intra */
+static const uint32_t vc1_ac_code2[133] = {
+       1,    6,   15,   22,   32,   24,    8,  154,
+      86,  318,  240,  933,  119,  495,  154,   93,
+       1,   17,    2,   11,   18,  470,  638,  401,
+     234,  988,  315,    4,   20,  158,    9,  428,
+     482,  970,   95,   23,   78,   94,  243,  429,
+     236, 1520,   14,  225,  932,  156,  317,   59,
+      28,   20, 2494,    6,  122,  400,  311,   27,
+       8, 1884,  113,  215, 2495,    7,  175, 1228,
+      52,  613,  159,  224,   22,  807,   21,  381,
+    3771,   20,  246,  484,  203, 2461,  202,  764,
+     383, 1229,  765, 1278,  314,   10,   66,  467,
+    1245,   18,  232,   76,  310,   57,  612, 3770,
+       0,  174, 2460,   31, 1246,   67, 1244,    3,
+     971,    6, 2462,   42, 1521,   15, 2558,   51,
+    2559,  152, 2463,  234,  316,   46,  402,  310,
+     106,   21,  943,  483,  116,  235,  761,   92,
+     237,  989,  806,   94,   22,
+};
+
+static const uint8_t vc1_ac_len2[133] = {
+     2,  3,  4,  5,  6,  7,  8,  8,  9,  9, 10, 10, 11, 11, 12, 13,
+     4,  5,  7,  8,  9,  9, 10, 11, 12, 12, 13,  5,  7,  8, 10, 11,
+    11, 12, 13,  5,  7,  9, 10, 11, 12, 13,  6,  8, 10, 12, 13,  6,
+     9, 11, 12,  7,  9, 11, 13,  7, 10, 11,  7, 10, 12,  8, 10, 11,
+     8, 10, 12,  8, 11, 12,  9, 11, 12,  9, 10, 11, 10, 12, 10, 12,
+    11, 11, 12, 11, 13,  4,  7,  9, 11,  5,  8, 11, 13,  6, 10, 12,
+     7, 10, 12,  7, 11,  7, 11,  8, 12,  8, 12,  8, 13,  8, 12,  8,
+    12,  8, 12,  8, 13,  8, 11,  9,  9, 11, 10, 11, 11, 12, 12, 13,
+    12, 12, 12, 13,  7,
+};
+
+static const uint8_t vc1_ac_run2[132] = {
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  2,  2,  2,  2,  2,
+     2,  2,  2,  3,  3,  3,  3,  3,  3,  3,  4,  4,  4,  4,  4,  5,
+     5,  5,  5,  6,  6,  6,  6,  7,  7,  7,  8,  8,  8,  9,  9,  9,
+    10, 10, 10, 11, 11, 11, 12, 12, 12, 13, 13, 13, 14, 14, 15, 15,
+    16, 17, 18, 19, 20,  0,  0,  0,  0,  1,  1,  1,  1,  2,  2,  2,
+     3,  3,  3,  4,  4,  5,  5,  6,  6,  7,  7,  8,  8,  9,  9, 10,
+    10, 11, 11, 12, 12, 13, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22,
+    23, 24, 25, 26,
+};
+
+static const uint8_t vc1_ac_level2[132] = {
+     1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15, 16,
+     1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11,  1,  2,  3,  4,  5,
+     6,  7,  8,  1,  2,  3,  4,  5,  6,  7,  1,  2,  3,  4,  5,  1,
+     2,  3,  4,  1,  2,  3,  4,  1,  2,  3,  1,  2,  3,  1,  2,  3,
+     1,  2,  3,  1,  2,  3,  1,  2,  3,  1,  2,  3,  1,  2,  1,  2,
+     1,  1,  1,  1,  1,  1,  2,  3,  4,  1,  2,  3,  4,  1,  2,  3,
+     1,  2,  3,  1,  2,  1,  2,  1,  2,  1,  2,  1,  2,  1,  2,  1,
+     2,  1,  2,  1,  2,  1,  2,  1,  1,  1,  1,  1,  1,  1,  1,  1,
+     1,  1,  1,  1,
+};
+
+/* Low motion inter */
+static const uint32_t vc1_ac_code3[149] = {
+        4,    20,    23,   127,   340,   498,   191,   101,
+     2730,  1584,  5527,   951, 11042,  3046,    11,    55,
+       98,     7,   358,   206,  5520,  1526,  3047,     7,
+      109,     3,   799,  1522,     2,    97,    85,   479,
+       26,    30,  2761, 11043,    30,    31,  2755, 11051,
+        6,     4,   760,    25,     6,  1597,    87,   386,
+    10914,     4,   384,  1436,   125,   356,  1901,     2,
+      397,  5505,   173,    96,  3175,    28,   238,     3,
+      719,   217,  5504,     2,   387,    87,    97,    49,
+      102,  1585,  1586,   172,   797,   118,    58,   357,
+     3174,     3,    84,   683,    22,  1527,     5,   248,
+     2729,    95,     4,    28,  5456,     4,   119,  1900,
+       14,    10,    12,  1378,     4,   796,     6,   200,
+       13,   474,     7,   201,     1,    46,    20,  5526,
+       10,  2754,    22,   347,    21,   346,    15,    94,
+      126,   171,    45,   216,    11,    20,   691,   499,
+       58,     0,    88,    46,    94,  1379,   236,    84,
+     2753,  5462,   762,   385,  5463,  1437, 10915, 11050,
+      478,  1596,   207,  5524,    13,
+};
+
+static const uint8_t vc1_ac_len3[149] = {
+     3,  5,  7,  8,  9, 10, 11, 12, 12, 13, 13, 14, 14, 15,  4,  7,
+     9, 11, 12, 13, 13, 14, 15,  5,  8, 11, 12, 14,  6,  9, 12, 14,
+     6, 10, 12, 14,  6, 10, 12, 14,  7, 11, 13,  7, 11, 13,  7, 11,
+    14,  8, 11, 14,  8, 12, 15,  9, 11, 13,  8, 12, 14,  9, 13,  9,
+    13,  9, 13, 11, 11, 12, 12, 11, 12, 13, 13, 13, 12, 12, 11, 12,
+    14,  2,  7, 10, 13, 14,  4,  9, 12, 15,  4, 10, 13,  5, 11, 15,
+     5, 12,  5, 11,  6, 12,  6, 13,  6, 13,  6, 13,  7, 14,  7, 13,
+     7, 12,  7, 14,  7, 14,  8, 15,  8,  8,  9,  9,  9, 10, 10, 10,
+    10, 10, 10,  9, 10, 11, 12, 12, 12, 13, 13, 11, 13, 14, 14, 14,
+    14, 13, 13, 13,  9,
+};
+
+static const uint8_t vc1_ac_run3[148] = {
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  1,  1,
+     1,  1,  1,  1,  1,  1,  1,  2,  2,  2,  2,  2,  3,  3,  3,  3,
+     4,  4,  4,  4,  5,  5,  5,  5,  6,  6,  6,  7,  7,  7,  8,  8,
+     8,  9,  9,  9, 10, 10, 10, 11, 11, 11, 12, 12, 12, 13, 13, 14,
+    14, 15, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28,
+    29,  0,  0,  0,  0,  0,  1,  1,  1,  1,  2,  2,  2,  3,  3,  3,
+     4,  4,  5,  5,  6,  6,  7,  7,  8,  8,  9,  9, 10, 10, 11, 11,
+    12, 12, 13, 13, 14, 14, 15, 15, 16, 17, 18, 19, 20, 21, 22, 23,
+    24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39,
+    40, 41, 42, 43,
+};
+
+static const uint8_t vc1_ac_level3[148] = {
+     1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,  1,  2,
+     3,  4,  5,  6,  7,  8,  9,  1,  2,  3,  4,  5,  1,  2,  3,  4,
+     1,  2,  3,  4,  1,  2,  3,  4,  1,  2,  3,  1,  2,  3,  1,  2,
+     3,  1,  2,  3,  1,  2,  3,  1,  2,  3,  1,  2,  3,  1,  2,  1,
+     2,  1,  2,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,
+     1,  1,  2,  3,  4,  5,  1,  2,  3,  4,  1,  2,  3,  1,  2,  3,
+     1,  2,  1,  2,  1,  2,  1,  2,  1,  2,  1,  2,  1,  2,  1,  2,
+     1,  2,  1,  2,  1,  2,  1,  2,  1,  1,  1,  1,  1,  1,  1,  1,
+     1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,
+     1,  1,  1,  1,
+};
+
+/* Mid rate intra */
+static const uint32_t vc1_ac_code4[103] = {
+     2,  6, 15, 13, 12, 21, 19, 18,
+    23, 31, 30, 29, 37, 36, 35, 33,
+    33, 32, 15, 14,  7,  6, 32, 33,
+    80, 81, 82, 14, 20, 22, 28, 32,
+    31, 13, 34, 83, 85, 11, 21, 30,
+    12, 86, 17, 27, 29, 11, 16, 34,
+    10, 13, 28,  8, 18, 27, 84, 20,
+    26, 87, 25,  9, 24, 35, 23, 25,
+    24,  7, 88,  7, 12, 22, 23,  6,
+     5,  4, 89, 15, 22,  5, 14,  4,
+    17, 36, 16, 37, 19, 90, 21, 91,
+    20, 19, 26, 21, 20, 19, 18, 17,
+    38, 39, 92, 93, 94, 95,  3,
+};
+
+static const uint8_t vc1_ac_len4[103] = {
+     2,  3,  4,  5,  5,  6,  6,  6,  7,  8,  8,  8,  9,  9,  9,  9,
+    10, 10, 10, 10, 11, 11, 11, 11, 12, 12, 12,  4,  6,  7,  8,  9,
+     9, 10, 11, 12, 12,  5,  7,  9, 10, 12,  6,  8,  9, 10,  6,  9,
+    10,  6,  9, 10,  7,  9, 12,  7,  9, 12,  8, 10,  8, 11,  8,  9,
+     9, 10, 12,  4,  6,  8,  9, 10, 11, 11, 12,  6,  9, 10,  6, 10,
+     7, 11,  7, 11,  7, 12,  8, 12,  8,  8,  8,  9,  9,  9,  9,  9,
+    11, 11, 12, 12, 12, 12,  7,
+};
+
+static const uint8_t vc1_ac_run4[102] = {
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  1,  1,  1,  1,  1,
+     1,  1,  1,  1,  1,  2,  2,  2,  2,  2,  3,  3,  3,  3,  4,  4,
+     4,  5,  5,  5,  6,  6,  6,  7,  7,  7,  8,  8,  9,  9, 10, 11,
+    12, 13, 14,  0,  0,  0,  0,  0,  0,  0,  0,  1,  1,  1,  2,  2,
+     3,  3,  4,  4,  5,  5,  6,  6,  7,  8,  9, 10, 11, 12, 13, 14,
+    15, 16, 17, 18, 19, 20,
+};
+
+static const uint8_t vc1_ac_level4[102] = {
+     1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15, 16,
+    17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27,  1,  2,  3,  4,  5,
+     6,  7,  8,  9, 10,  1,  2,  3,  4,  5,  1,  2,  3,  4,  1,  2,
+     3,  1,  2,  3,  1,  2,  3,  1,  2,  3,  1,  2,  1,  2,  1,  1,
+     1,  1,  1,  1,  2,  3,  4,  5,  6,  7,  8,  1,  2,  3,  1,  2,
+     1,  2,  1,  2,  1,  2,  1,  2,  1,  1,  1,  1,  1,  1,  1,  1,
+     1,  1,  1,  1,  1,  1,
+};
+
+/* Mid rate inter */
+static const uint32_t vc1_ac_code5[103] = {
+     2, 15, 21, 23, 31, 37, 36, 33,
+    32,  7,  6, 32,  6, 20, 30, 15,
+    33, 80, 14, 29, 14, 81, 13, 35,
+    13, 12, 34, 82, 11, 12, 83, 19,
+    11, 84, 18, 10, 17,  9, 16,  8,
+    22, 85, 21, 20, 28, 27, 33, 32,
+    31, 30, 29, 28, 27, 26, 34, 35,
+    86, 87,  7, 25,  5, 15,  4, 14,
+    13, 12, 19, 18, 17, 16, 26, 25,
+    24, 23, 22, 21, 20, 19, 24, 23,
+    22, 21, 20, 19, 18, 17,  7,  6,
+     5,  4, 36, 37, 38, 39, 88, 89,
+    90, 91, 92, 93, 94, 95,  3,
+};
+
+static const uint8_t vc1_ac_len5[103] = {
+     2,  4,  6,  7,  8,  9,  9, 10, 10, 11, 11, 11,  3,  6,  8, 10,
+    11, 12,  4,  8, 10, 12,  5,  9, 10,  5,  9, 12,  5, 10, 12,  6,
+    10, 12,  6, 10,  6, 10,  6, 10,  7, 12,  7,  7,  8,  8,  9,  9,
+     9,  9,  9,  9,  9,  9, 11, 11, 12, 12,  4,  9, 11,  6, 11,  6,
+     6,  6,  7,  7,  7,  7,  8,  8,  8,  8,  8,  8,  8,  8,  9,  9,
+     9,  9,  9,  9,  9,  9, 10, 10, 10, 10, 11, 11, 11, 11, 12, 12,
+    12, 12, 12, 12, 12, 12,  7,
+};
+
+static const uint8_t vc1_ac_run5[102] = {
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  1,  1,  1,  1,
+     1,  1,  2,  2,  2,  2,  3,  3,  3,  4,  4,  4,  5,  5,  5,  6,
+     6,  6,  7,  7,  8,  8,  9,  9, 10, 10, 11, 12, 13, 14, 15, 16,
+    17, 18, 19, 20, 21, 22, 23, 24, 25, 26,  0,  0,  0,  1,  1,  2,
+     3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15, 16, 17, 18,
+    19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34,
+    35, 36, 37, 38, 39, 40,
+};
+
+static const uint8_t vc1_ac_level5[102] = {
+     1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12,  1,  2,  3,  4,
+     5,  6,  1,  2,  3,  4,  1,  2,  3,  1,  2,  3,  1,  2,  3,  1,
+     2,  3,  1,  2,  1,  2,  1,  2,  1,  2,  1,  1,  1,  1,  1,  1,
+     1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  2,  3,  1,  2,  1,
+     1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,
+     1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,
+     1,  1,  1,  1,  1,  1,
+};
+
+/* High rate intra */
+static const uint32_t vc1_ac_code6[163] = {
+        0,     3,    13,     5,    28,    22,    63,    58,
+       46,    34,   123,   103,    95,    71,    38,   239,
+      205,   193,   169,    79,   498,   477,   409,   389,
+      349,   283,  1007,   993,   968,   817,   771,   753,
+      672,   563,   294,  1984,  1903,  1900,  1633,  1540,
+     1394,  1361,  1130,   628,  3879,  3876,  3803,  3214,
+     3083,  3082,  2787,  2262,  1168,  1173,  7961,  7605,
+        9,    16,    41,    98,   243,   173,   485,   377,
+      156,   945,   686,   295,  1902,  1392,   629,  3877,
+     3776,  2720,  2263,  7756,     8,    99,   175,   379,
+      947,  2013,  1600,  3981,  3009,  1169,    40,   195,
+      337,   673,  1395,  3779,  7989,   101,   474,   687,
+      631,  2249,  6017,    37,   280,  1606,  2726,  6016,
+      201,   801,  3995,  6430,    72,  1996,  2721,   384,
+     1125,  6405,   994,  3777, 15515,   756,  2248,  1985,
+     2344,  1505, 12813,  3778, 25624,  7988,   120,   341,
+     1362,  6431,   250,  2012,  6407,   172,   585,  5041,
+      502,  2786,   476,  1261,   388,  6404,   342,  2521,
+      999,  2345,   946, 15208,   757,  5040,   802, 15209,
+      564, 31029,  1991, 51251,  1632, 31028,   587, 51250,
+     2727,  7960,   122,
+};
+
+static const uint8_t vc1_ac_len6[163] = {
+     2,  3,  4,  4,  5,  5,  6,  6,  6,  6,  7,  7,  7,  7,  7,  8,
+     8,  8,  8,  8,  9,  9,  9,  9,  9,  9, 10, 10, 10, 10, 10, 10,
+    10, 10, 10, 11, 11, 11, 11, 11, 11, 11, 11, 11, 12, 12, 12, 12,
+    12, 12, 12, 12, 12, 12, 13, 13,  4,  5,  6,  7,  8,  8,  9,  9,
+     9, 10, 10, 10, 11, 11, 11, 12, 12, 12, 12, 13,  5,  7,  8,  9,
+    10, 11, 11, 12, 12, 12,  6,  8,  9, 10, 11, 12, 13,  7,  9, 10,
+    11, 12, 13,  7,  9, 11, 12, 13,  8, 10, 12, 13,  8, 11, 12,  9,
+    11, 13, 10, 12, 14, 10, 12, 11, 13, 11, 14, 12, 15, 13,  7,  9,
+    11, 13,  8, 11, 13,  8, 11, 14,  9, 12,  9, 12,  9, 13,  9, 13,
+    10, 13, 10, 14, 10, 14, 10, 14, 10, 15, 11, 16, 11, 15, 11, 16,
+    12, 13,  7,
+};
+
+static const uint8_t vc1_ac_run6[162] = {
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  1,  1,  1,  1,  1,  1,  1,  1,
+     1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  2,  2,  2,  2,
+     2,  2,  2,  2,  2,  2,  3,  3,  3,  3,  3,  3,  3,  4,  4,  4,
+     4,  4,  4,  5,  5,  5,  5,  5,  6,  6,  6,  6,  7,  7,  7,  8,
+     8,  8,  9,  9,  9, 10, 10, 11, 11, 12, 12, 13, 13, 14,  0,  0,
+     0,  0,  1,  1,  1,  2,  2,  2,  3,  3,  4,  4,  5,  5,  6,  6,
+     7,  7,  8,  8,  9,  9, 10, 10, 11, 11, 12, 12, 13, 13, 14, 14,
+    15, 16,
+};
+
+static const uint8_t vc1_ac_level6[162] = {
+     1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15, 16,
+    17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32,
+    33, 34, 35, 36, 37, 38, 39, 40, 41, 42, 43, 44, 45, 46, 47, 48,
+    49, 50, 51, 52, 53, 54, 55, 56,  1,  2,  3,  4,  5,  6,  7,  8,
+     9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20,  1,  2,  3,  4,
+     5,  6,  7,  8,  9, 10,  1,  2,  3,  4,  5,  6,  7,  1,  2,  3,
+     4,  5,  6,  1,  2,  3,  4,  5,  1,  2,  3,  4,  1,  2,  3,  1,
+     2,  3,  1,  2,  3,  1,  2,  1,  2,  1,  2,  1,  2,  1,  1,  2,
+     3,  4,  1,  2,  3,  1,  2,  3,  1,  2,  1,  2,  1,  2,  1,  2,
+     1,  2,  1,  2,  1,  2,  1,  2,  1,  2,  1,  2,  1,  2,  1,  2,
+     1,  1,
+};
+
+/* High rate inter */
+static const uint32_t vc1_ac_code7[175] = {
+          2,       0,      30,       4,      18,     112,      26,      95,
+         71,     467,     181,      87,     949,     365,     354,    1998,
+       1817,    1681,     710,     342,    3986,    3374,    3360,    1438,
+       1128,     678,    7586,    7264,    6723,    2845,    2240,    1373,
+          3,      10,     119,     229,     473,     997,     358,    1684,
+        338,    1439,    7996,    6731,    1374,      12,     125,      68,
+        992,    1897,    3633,    7974,    1372,      27,     226,     933,
+        713,    7971,   15175,       7,     472,     728,    7975,   13460,
+         53,     993,    1436,   14531,      12,     357,    7459,    5688,
+        104,    1683,   14917,      32,    3984,   31990,     232,    1423,
+      11503,      69,    2874,     497,   15174,     423,    5750,      86,
+      26922,     909,   58121,     170,  116241,     735,   46009,     712,
+     232480,     432,   91024,    3999,   92017,    3792,  464963,    3370,
+    1023628,    1121, 1023630,    2919,    1375,      63,     109,    3728,
+       1358,      19,     281,    2918,      11,     565,   31989,     117,
+       3364,   63977,      46,    7970,      33,    1359,      20,   14916,
+        228,   31991,      94,   29061,      55,   11379,     475,   23005,
+        455,   26923,     422,   22757,     180,  127952,     176,   45513,
+        998,   92016,     366,  255906,     283, 1023629,     217, 1023631,
+        168,  182051,    1865,  929924,    1686,  364101,     734,  728200,
+        561, 1859850,     433, 7439405,    3371, 3719703,    3375, 1456403,
+       1458, 1456402,    1129, 7439404,    6722,    2241,     115,
+};
+
+static const uint8_t vc1_ac_len7[175] = {
+     2,  3,  5,  5,  6,  7,  7,  8,  8,  9,  9,  9, 10, 10, 10, 11,
+    11, 11, 11, 11, 12, 12, 12, 12, 12, 12, 13, 13, 13, 13, 13, 13,
+     3,  5,  7,  8,  9, 10, 10, 11, 11, 12, 13, 13, 13,  4,  7,  8,
+    10, 11, 12, 13, 13,  5,  8, 10, 11, 13, 14,  5,  9, 11, 13, 14,
+     6, 10, 12, 14,  6, 10, 13, 14,  7, 11, 14,  7, 12, 15,  8, 12,
+    15,  8, 13,  9, 14,  9, 14,  9, 15, 10, 16, 10, 17, 11, 17, 11,
+    18, 11, 18, 12, 18, 12, 19, 12, 20, 12, 20, 13, 13,  6,  9, 12,
+    13,  6, 10, 13,  6, 11, 15,  7, 12, 16,  7, 13,  7, 13,  7, 14,
+     8, 15,  8, 15,  8, 15,  9, 16,  9, 15,  9, 16,  9, 17,  9, 17,
+    10, 18, 10, 18, 10, 20, 10, 20, 10, 19, 11, 20, 11, 20, 11, 21,
+    11, 21, 11, 23, 12, 22, 12, 22, 12, 22, 12, 23, 13, 13,  7,
+};
+
+static const uint8_t vc1_ac_run7[174] = {
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  2,  2,  2,
+     2,  2,  2,  2,  2,  3,  3,  3,  3,  3,  3,  4,  4,  4,  4,  4,
+     5,  5,  5,  5,  6,  6,  6,  6,  7,  7,  7,  8,  8,  8,  9,  9,
+     9, 10, 10, 11, 11, 12, 12, 13, 13, 14, 14, 15, 15, 16, 16, 17,
+    17, 18, 18, 19, 19, 20, 20, 21, 21, 22, 22, 23, 24,  0,  0,  0,
+     0,  1,  1,  1,  2,  2,  2,  3,  3,  3,  4,  4,  5,  5,  6,  6,
+     7,  7,  8,  8,  9,  9, 10, 10, 11, 11, 12, 12, 13, 13, 14, 14,
+    15, 15, 16, 16, 17, 17, 18, 18, 19, 19, 20, 20, 21, 21, 22, 22,
+    23, 23, 24, 24, 25, 25, 26, 26, 27, 27, 28, 28, 29, 30,
+};
+
+static const uint8_t vc1_ac_level7[174] = {
+     1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15, 16,
+    17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32,
+     1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13,  1,  2,  3,
+     4,  5,  6,  7,  8,  1,  2,  3,  4,  5,  6,  1,  2,  3,  4,  5,
+     1,  2,  3,  4,  1,  2,  3,  4,  1,  2,  3,  1,  2,  3,  1,  2,
+     3,  1,  2,  1,  2,  1,  2,  1,  2,  1,  2,  1,  2,  1,  2,  1,
+     2,  1,  2,  1,  2,  1,  2,  1,  2,  1,  2,  1,  1,  1,  2,  3,
+     4,  1,  2,  3,  1,  2,  3,  1,  2,  3,  1,  2,  1,  2,  1,  2,
+     1,  2,  1,  2,  1,  2,  1,  2,  1,  2,  1,  2,  1,  2,  1,  2,
+     1,  2,  1,  2,  1,  2,  1,  2,  1,  2,  1,  2,  1,  2,  1,  2,
+     1,  2,  1,  2,  1,  2,  1,  2,  1,  2,  1,  2,  1,  1,
+};
+
+/* Codes of the coding sets from the first with LAST set */
+static const uint8_t vc1_ac_last[8] = {
+    119,  99,  85,  81,  67,  58, 126, 109,
+};
+
+/* DC differentials, luma and chroma of the low motion tables then of the high motion ones */
+static const uint32_t vc1_dc_code[4][120] = {
+    {
+               1,        1,        1,        1,        5,        7,        8,       12,
+               0,        2,       18,       26,        3,        7,       39,       55,
+               5,       76,      108,      109,        8,       25,      155,       27,
+             154,       19,       52,       53,       97,       72,      196,       74,
+             198,      199,      146,      395,      147,      387,      386,      150,
+             151,      384,      788,      789,     1541,     1540,     1542,     3086,
+          197581,   197577,   197576,   197578,   197579,   197580,   197582,   197583,
+          197584,   197585,   197586,   197587,   197588,   197589,   197590,   197591,
+          197592,   197593,   197594,   197595,   197596,   197597,   197598,   197599,
+          197600,   197601,   197602,   197603,   197604,   197605,   197606,   197607,
+          197608,   197609,   197610,   197611,   197612,   197613,   197614,   197615,
+          197616,   197617,   197618,   197619,   197620,   197621,   197622,   197623,
+          197624,   197625,   197626,   197627,   197628,   197629,   197630,   197631,
+          395136,   395137,   395138,   395139,   395140,   395141,   395142,   395143,
+          395144,   395145,   395146,   395147,   395148,   395149,   395150,   395151,
+    },
+    {
+               0,        1,        5,        9,       13,       17,       29,       31,
+              33,       49,       56,       51,       57,       61,       97,      121,
+             128,      200,      202,      240,      129,      192,      201,      263,
+             262,      406,      387,      483,      482,      522,      523,     1545,
+            1042,     1043,     1547,     1041,     1546,     1631,     1040,     1629,
+            1630,     3256,     3088,     3257,     6179,    12357,    24713,    49424,
+         3163208,  3163209,  3163210,  3163211,  3163212,  3163213,  3163214,  3163215,
+         3163216,  3163217,  3163218,  3163219,  3163220,  3163221,  3163222,  3163223,
+         3163224,  3163225,  3163226,  3163227,  3163228,  3163229,  3163230,  3163231,
+         3163232,  3163233,  3163234,  3163235,  3163236,  3163237,  3163238,  3163239,
+         3163240,  3163241,  3163242,  3163243,  3163244,  3163245,  3163246,  3163247,
+         3163248,  3163249,  3163250,  3163251,  3163252,  3163253,  3163254,  3163255,
+         3163256,  3163257,  3163258,  3163259,  3163260,  3163261,  3163262,  3163263,
+         6326400,  6326401,  6326402,  6326403,  6326404,  6326405,  6326406,  6326407,
+         6326408,  6326409,  6326410,  6326411,  6326412,  6326413,  6326414,  6326415,
+    },
+    {
+               2,        3,        3,        2,        5,        1,        3,        8,
+               0,        5,       13,       15,       19,        8,       24,       28,
+              36,        4,        6,       18,       50,       59,       74,       75,
+              11,       38,       39,      102,      116,      117,       20,       28,
+              31,       29,       43,       61,      413,      415,       84,      825,
+             824,      829,      171,      241,     1656,      242,      480,      481,
+             340,     3314,      972,      683,     6631,      974,     6630,     1364,
+            1951,     1365,     3901,     3895,     3900,     3893,     7789,     7784,
+           15576,    15571,    15577,    31140,   996538,   996532,   996533,   996534,
+          996535,   996536,   996537,   996539,   996540,   996541,   996542,   996543,
+         1993024,  1993025,  1993026,  1993027,  1993028,  1993029,  1993030,  1993031,
+         1993032,  1993033,  1993034,  1993035,  1993036,  1993037,  1993038,  1993039,
+         1993040,  1993041,  1993042,  1993043,  1993044,  1993045,  1993046,  1993047,
+         1993048,  1993049,  1993050,  1993051,  1993052,  1993053,  1993054,  1993055,
+         1993056,  1993057,  1993058,  1993059,  1993060,  1993061,  1993062,  1993063,
+    },
+    {
+               0,        1,        4,        7,       11,       13,       21,       40,
+              48,       50,       82,       98,      102,      166,      198,      207,
+             335,      398,      412,      669,      826,     1336,     1596,     1598,
+            1599,     1654,     2675,     3194,     3311,     5349,     6621,    10696,
+           10697,    25565,    13240,    13241,    51126,    25560,    25567,    51123,
+           51124,    51125,    25566,    51127,    51128,    51129,   102245,   204488,
+        13087304, 13087305, 13087306, 13087307, 13087308, 13087309, 13087310, 13087311,
+        13087312, 13087313, 13087314, 13087315, 13087316, 13087317, 13087318, 13087319,
+        13087320, 13087321, 13087322, 13087323, 13087324, 13087325, 13087326, 13087327,
+        13087328, 13087329, 13087330, 13087331, 13087332, 13087333, 13087334, 13087335,
+        13087336, 13087337, 13087338, 13087339, 13087340, 13087341, 13087342, 13087343,
+        13087344, 13087345, 13087346, 13087347, 13087348, 13087349, 13087350, 13087351,
+        13087352, 13087353, 13087354, 13087355, 13087356, 13087357, 13087358, 13087359,
+        26174592, 26174593, 26174594, 26174595, 26174596, 26174597, 26174598, 26174599,
+        26174600, 26174601, 26174602, 26174603, 26174604, 26174605, 26174606, 26174607,
+    },
+};
+
+static const uint8_t vc1_dc_len[4][120] = {
+    {
+         1,  2,  4,  5,  5,  5,  6,  6,  7,  7,  7,  7,  8,  8,  8,  8,
+         9,  9,  9,  9, 10, 10, 10, 10, 10, 11, 11, 11, 12, 13, 13, 13,
+        13, 13, 14, 14, 14, 14, 14, 14, 14, 14, 15, 15, 16, 16, 16, 17,
+        23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23,
+        23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23,
+        23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23,
+        23, 23, 23, 23, 23, 23, 23, 23, 24, 24, 24, 24, 24, 24, 24, 24,
+        24, 24, 24, 24, 24, 24, 24, 24,
+    },
+    {
+         2,  2,  3,  4,  4,  5,  5,  5,  6,  6,  6,  6,  6,  6,  7,  7,
+         8,  8,  8,  8,  8,  8,  8,  9,  9,  9,  9,  9,  9, 10, 10, 11,
+        11, 11, 11, 11, 11, 11, 11, 11, 11, 12, 12, 12, 13, 14, 15, 16,
+        22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22,
+        22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22,
+        22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22,
+        22, 22, 22, 22, 22, 22, 22, 22, 23, 23, 23, 23, 23, 23, 23, 23,
+        23, 23, 23, 23, 23, 23, 23, 23,
+    },
+    {
+         2,  2,  3,  4,  4,  5,  5,  5,  6,  6,  6,  6,  6,  7,  7,  7,
+         7,  8,  8,  8,  8,  8,  8,  8,  9,  9,  9,  9,  9,  9, 10, 10,
+        10, 10, 11, 11, 11, 11, 12, 12, 12, 12, 13, 13, 13, 13, 14, 14,
+        14, 14, 15, 15, 15, 15, 15, 16, 16, 16, 17, 17, 17, 17, 18, 18,
+        19, 19, 19, 20, 25, 25, 25, 25, 25, 25, 25, 25, 25, 25, 25, 25,
+        26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26,
+        26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26,
+        26, 26, 26, 26, 26, 26, 26, 26,
+    },
+    {
+         2,  2,  3,  3,  4,  4,  5,  6,  6,  6,  7,  7,  7,  8,  8,  8,
+         9,  9,  9, 10, 10, 11, 11, 11, 11, 11, 12, 12, 12, 13, 13, 14,
+        14, 15, 14, 14, 16, 15, 15, 16, 16, 16, 15, 16, 16, 16, 17, 18,
+        24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24,
+        24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24,
+        24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24,
+        24, 24, 24, 24, 24, 24, 24, 24, 25, 25, 25, 25, 25, 25, 25, 25,
+        25, 25, 25, 25, 25, 25, 25, 25,
+    },
+};
+
+/* CBPCY of I pictures */
+static const uint32_t vc1_cbpcy_i_code[64] = {
+       1,   23,    9,    5,    6,   71,   32,   16,    2,  124,   58,   29,    2,  236,  119,    0,
+       3,  183,   44,   19,    1,  360,   70,   63,   30, 1810,  181,   66,   34,  453,  286,  135,
+       6,    3,   30,   28,   18,  904,   68,  112,   31,  574,   57,  142,    1,  454,  182,   69,
+      20,  575,  125,   24,    7,  455,  134,   25,   21,  475,    2,   70,   13, 1811,  474,  361,
+};
+
+static const uint8_t vc1_cbpcy_i_len[64] = {
+     1,  6,  5,  5,  5,  9,  7,  7,  5,  9,  7,  7,  6,  9,  8,  8,
+     5,  9,  7,  7,  6, 10,  8,  8,  6, 13,  9,  8,  7, 11, 10,  9,
+     4,  9,  7,  6,  7, 12,  9,  9,  6, 11,  8,  9,  7, 11,  9,  9,
+     6, 11,  9,  9,  7, 11,  9,  9,  6, 10,  9,  9,  8, 13, 10, 10,
+};
+
+/* CBPCY of P and B pictures by CBPTAB */
+static const uint32_t vc1_cbpcy_p_code[4][64] = {
+    {
+          0,   6,  15,  13,  13,  11,   3,  13,   5,   8,  49,  10,  12, 114, 102, 119,
+          1,  54,  96,   8,  10, 111,   5,  15,  12,  10,   2,  12,  13, 115,  53,  63,
+          1,   7,   1,   7,  14,  12,   4,  14,   1,   9,  97,  11,   7,  58,  52,  62,
+          4, 103,   1,   9,  11,  56, 101, 118,   4, 110, 100,  30,   2,   5,   4,   3,
+    },
+    {
+          0,   9,   1,  18,   5,  14, 237,  26,   3, 121,   3,  22,  13,  16,   6,  30,
+          2,  10,   1,  20,  12, 241,   5,  28,  16,  12,   3,  24,  28, 124, 239, 247,
+          1, 240,   1,  19,  18,  15,   4,  27,   1, 122,   2,  23,   1,  17,   7,  31,
+          1,  11,   2,  21,  19, 246, 238,  29,  17,  13, 236,  25,  58,  63,   8, 125,
+    },
+    {
+          0, 201,  25, 231,   5, 221,   1,   3,   2, 414,   2, 241,  16, 225, 195, 492,
+          2, 412,   1, 240,   7, 224,  98, 245,   1, 220,  96,   5,   9, 230, 101, 247,
+          1, 102,   1, 415,  24,   3,   2, 244,   3,  54,   3, 484,  17, 114, 200, 493,
+          3, 413,   1,   4,  13, 113,  99, 485,   4, 111, 194, 243,   5,  29,  26,  31,
+    },
+    {
+          0,  28,  12,  44,   3,  36,  20,  52,   2,  32,  16,  48,   8,  40,  24,  28,
+          1,  30,  14,  46,   6,  38,  22,  54,   3,  34,  18,  50,  10,  42,  26,  30,
+          1,  29,  13,  45,   5,  37,  21,  53,   2,  33,  17,  49,   9,  41,  25,  29,
+          1,  31,  15,  47,   7,  39,  23,  55,   4,  35,  19,  51,  11,  43,  27,  31,
+    },
+};
+
+static const uint8_t vc1_cbpcy_p_len[4][64] = {
+    {
+        13, 13,  7, 13,  7, 13, 13, 12,  6, 13,  7, 12,  6,  8,  8,  8,
+         5,  7,  8, 12,  6,  8, 13, 12,  7, 13, 13, 12,  6,  8,  7,  7,
+         6, 13,  8, 12,  7, 13, 13, 12,  7, 13,  8, 12,  5,  7,  7,  7,
+         6,  8, 13, 12,  6,  7,  8,  8,  5,  8,  8,  6,  3,  3,  3,  2,
+    },
+    {
+        14, 13,  8, 13,  3, 13,  8, 13,  3,  7,  8, 13,  4, 13, 13, 13,
+         3, 13, 13, 13,  4,  8, 13, 13,  5, 13, 13, 13,  5,  7,  8,  8,
+         3,  8, 14, 13,  5, 13, 13, 13,  4,  7, 13, 13,  6, 13, 13, 13,
+         5, 13,  8, 13,  5,  8,  8, 13,  5, 13,  8, 13,  6,  6, 13,  7,
+    },
+    {
+        13,  8,  6,  8,  4,  8, 13, 12,  4,  9,  8,  8,  5,  8,  8,  9,
+         5,  9, 10,  8,  4,  8,  7,  8,  6,  8,  7, 13,  4,  8,  7,  8,
+         5,  7,  8,  9,  6, 13, 13,  8,  4,  6,  8,  9,  5,  7,  8,  9,
+         5,  9,  9, 13,  5,  7,  7,  9,  4,  7,  8,  8,  3,  5,  5,  5,
+    },
+    {
+         9,  9,  9,  9,  2,  9,  9,  9,  2,  9,  9,  9,  9,  9,  9,  8,
+         3,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  8,
+         2,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  8,
+         9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  8,
+    },
+};
+
+/* MVDATA by MVTAB */
+static const uint32_t vc1_mv_code[4][73] = {
+    {
+           0,    2,    3,    8,  576,    3,    2,    6,    5,  577,  578,    7,    8,    9,   40,   19,
+          37,   82,   21,   22,   23,  579,  580,  166,   96,  167,   49,  194,  195,  581,  582,  583,
+         292,  293,  294,   13,    2,    7,   24,   50,  102,  295,   13,    7,    8,   18,   50,  103,
+          38,   20,   21,   22,   39,  204,  103,   23,   24,   25,  104,  410,  105,  106,  107,  108,
+         109,  220,  411,  442,  222,  443,  446,  447,    7,
+    },
+    {
+           0,    4,    5,    3,    4,    3,    4,    5,   20,    6,   21,   44,   45,   46, 3008,   95,
+         112,  113,   57, 3009, 3010,  116,  117, 3011,  118, 3012, 3013, 3014, 3015, 3016, 3017, 3018,
+        3019, 3020, 3021, 3022,    1,    4,   15,  160,  161,   41,    6,   11,   42,  162,   43,  119,
+          56,   57,   58,  163,  236,  237, 3023,  119,  120,  242,  122,  486, 1512,  487,  246,  494,
+        1513,  495, 1514, 1515, 1516, 1517, 1518, 1519,   31,
+    },
+    {
+           0,  512,  513,  514,  515,    2,    3,  258,  259,  260,  261,  262,  263,  264,  265,  266,
+         267,  268,  269,  270,  271,  272,  273,  274,  275,  276,  277,  278,  279,  280,  281,  282,
+         283,  284,  285,  286,    1,    5,  287,  288,  289,  290,    6,    7,  291,  292,  293,  294,
+         295,  296,  297,  298,  299,  300,  301,  302,  303,  304,  305,  306,  307,  308,  309,  310,
+         311,  312,  313,  314,  315,  316,  317,  318,  319,
+    },
+    {
+           0,    1,    1,    2,    3,    4,    1,    5,    4,    3,    5,    8,    6,    9,   10,   11,
+          12,    7,  104,   14,  105,    4,   10,   15,   11,    6,   14,    8,  106,  107,  108,   15,
+         109,    9,   55,   10,    1,    2,    1,    2,    3,   12,    6,    2,    6,    7,   28,    7,
+          15,    8,    5,   18,   29,  152,   77,   24,   25,   26,   39,  108,   13,  109,   55,   56,
+          57,  116,   11,  153,  234,  235,  118,  119,   15,
+    },
+};
+
+static const uint8_t vc1_mv_len[4][73] = {
+    {
+         6,  7,  7,  8, 14,  6,  5,  6,  7, 14, 14,  6,  6,  6,  8,  9,
+        10,  9,  7,  7,  7, 14, 14, 10,  9, 10,  8, 10, 10, 14, 14, 14,
+        13, 13, 13,  6,  3,  5,  6,  8,  9, 13,  5,  4,  4,  5,  7,  9,
+         6,  5,  5,  5,  6,  9,  8,  5,  5,  5,  7, 10,  7,  7,  7,  7,
+         7,  8, 10,  9,  8,  9,  9,  9,  3,
+    },
+    {
+         5,  7,  7,  6,  6,  5,  5,  6,  7,  5,  7,  8,  8,  8, 14,  9,
+         9,  9,  8, 14, 14,  9,  9, 14,  9, 14, 14, 14, 14, 14, 14, 14,
+        14, 14, 14, 14,  2,  3,  6,  8,  8,  6,  3,  4,  6,  8,  6,  9,
+         6,  6,  6,  8,  8,  8, 14,  7,  7,  8,  7,  9, 13,  9,  8,  9,
+        13,  9, 13, 13, 13, 13, 13, 13,  5,
+    },
+    {
+         3, 12, 12, 12, 12,  3,  4, 11, 11, 11, 11, 11, 11, 11, 11, 11,
+        11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11,
+        11, 11, 11, 11,  1,  5, 11, 11, 11, 11,  4,  4, 11, 11, 11, 11,
+        11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11,
+        11, 11, 11, 11, 11, 11, 11, 11, 11,
+    },
+    {
+        15, 11, 15, 15, 15, 15, 12, 15, 12, 11, 12, 12, 15, 12, 12, 12,
+        12, 15, 15, 12, 15, 10, 11, 12, 11, 10, 11, 10, 15, 15, 15, 11,
+        15, 10, 14, 10,  4,  4,  5,  7,  8,  9,  5,  3,  4,  5,  6,  8,
+         5,  4,  3,  5,  6,  8,  7,  5,  5,  5,  6,  7,  9,  7,  6,  6,
+         6,  7, 10,  8,  8,  8,  7,  7,  4,
+    },
+};
+
+/* TTMB by PQUANT range, VC1_TT_* or-ed with VC1_TT_MB for the macroblock level codes */
+static const uint32_t vc1_ttmb_code[3][16] = {
+    {
+           3,   46,   95,    0,   22,   21,    1,    4,   20,  753,  377,  379, 3008, 3009, 1505,  378,
+    },
+    {
+           6,    6,    3,    7,   15,   14,    0,    2,    2,   20,   17,   11,    9,   33,   21,   32,
+    },
+    {
+           6,    0,   14,    5,    2,    3,    3,   15,    2,  129,   33,    9,  257,   65,   17,  256,
+    },
+};
+
+static const uint8_t vc1_ttmb_len[3][16] = {
+    {
+         2,  6,  7,  2,  5,  5,  2,  3,  5, 10,  9,  9, 12, 12, 11,  9,
+    },
+    {
+         3,  4,  4,  4,  4,  4,  3,  3,  2,  7,  7,  6,  6,  8,  7,  8,
+    },
+    {
+         3,  3,  4,  5,  3,  3,  4,  4,  2, 10,  8,  6, 11,  9,  7, 11,
+    },
+};
+
+/* The 8x8 scans: inter, intra, and intra after AC prediction from the top and from the left */
+static const uint8_t vc1_scan8x8[4][64] = {
+    {
+         0,  8,  1,  2,  9, 16, 24, 17, 10,  3,  4, 11, 18, 25, 32, 40,
+        48, 56, 41, 33, 26, 19, 12,  5,  6, 13, 20, 27, 34, 49, 57, 58,
+        50, 42, 35, 28, 21, 14,  7, 15, 22, 29, 36, 43, 51, 59, 60, 52,
+        44, 37, 30, 23, 31, 38, 45, 53, 61, 62, 54, 46, 39, 47, 55, 63,
+    },
+    {
+         0,  8,  1,  2,  9, 16, 24, 17, 10,  3,  4, 11, 18, 25, 32, 40,
+        33, 48, 26, 19, 12,  5,  6, 13, 20, 27, 34, 41, 56, 49, 57, 42,
+        35, 28, 21, 14,  7, 15, 22, 29, 36, 43, 50, 58, 51, 59, 44, 37,
+        30, 23, 31, 38, 45, 52, 60, 53, 61, 46, 39, 47, 54, 62, 55, 63,
+    },
+    {
+         0,  1,  8,  2,  3,  9, 16, 24, 17, 10,  4,  5, 11, 18, 25, 32,
+        40, 48, 33, 26, 19, 12,  6,  7, 13, 20, 27, 34, 41, 56, 49, 57,
+        42, 35, 28, 21, 14, 15, 22, 29, 36, 43, 50, 58, 51, 44, 37, 30,
+        23, 31, 38, 45, 52, 59, 60, 53, 46, 39, 47, 54, 61, 62, 55, 63,
+    },
+    {
+         0,  8, 16,  1, 24, 32, 40,  9,  2,  3, 10, 17, 25, 48, 56, 41,
+        33, 26, 18, 11,  4,  5, 12, 19, 27, 34, 49, 57, 50, 42, 35, 28,
+        20, 13,  6,  7, 14, 21, 29, 36, 43, 51, 58, 59, 52, 44, 37, 30,
+        22, 15, 23, 31, 38, 45, 60, 53, 46, 39, 47, 54, 61, 62, 55, 63,
+    },
+};
+
+/* BFRACTION in 1/256, the codes past these are BI pictures and reserved */
+static const uint8_t vc1_bfraction[21] = {
+    128,  85, 170,  64, 192,  51, 102, 153, 204,  43, 215,  37,  74, 111, 148, 185, 222,  32,  96, 160, 224,
+};
+
+/* TTBLK by PQUANT range, and the VC1_TT_* each codes */
+static const uint32_t vc1_ttblk_code[3][8] = {
+    { 0, 1, 3, 5, 16, 17, 18, 19 },
+    { 3, 0, 1, 2,  3,  5,  8,  9 },
+    { 1, 0, 1, 4,  6,  7, 10, 11 },
+};
+
+static const uint8_t vc1_ttblk_len[3][8] = {
+    { 2, 2, 2, 3, 5, 5, 5, 5 },
+    { 2, 3, 3, 3, 3, 3, 4, 4 },
+    { 2, 3, 3, 3, 3, 3, 4, 4 },
+};
+
+static const uint8_t vc1_ttblk_to_tt[3][8] = {
+    { VC1_TT_8x4, VC1_TT_4x8, VC1_TT_8x8, VC1_TT_4x4,
+      VC1_TT_8x4_TOP, VC1_TT_8x4_BOTTOM, VC1_TT_4x8_RIGHT, VC1_TT_4x8_LEFT },
+    { VC1_TT_8x8, VC1_TT_4x8_RIGHT, VC1_TT_4x8_LEFT, VC1_TT_4x4,
+      VC1_TT_8x4, VC1_TT_4x8, VC1_TT_8x4_BOTTOM, VC1_TT_8x4_TOP },
+    { VC1_TT_8x8, VC1_TT_4x8, VC1_TT_4x4, VC1_TT_8x4_BOTTOM,
+      VC1_TT_4x8_RIGHT, VC1_TT_4x8_LEFT, VC1_TT_8x4, VC1_TT_8x4_TOP },
+};
+
+/* SUBBLKPAT of 4x4 transforms by PQUANT range, for the patterns 1 to 15 */
+static const uint32_t vc1_subblkpat_code[3][15] = {
+    { 14, 12,  7, 11,  9, 26,  2, 10, 27,  8,  0,  6,  1, 15,  1 },
+    { 14,  0,  8, 15, 10,  4, 23, 13,  5,  9, 25,  3, 24, 22,  1 },
+    {  5,  6,  2,  2,  8,  0, 28,  3,  1,  3, 29,  1, 19, 18, 15 },
+};
+
+static const uint8_t vc1_subblkpat_len[3][15] = {
+    { 5, 5, 5, 5, 5, 6, 4, 5, 6, 5, 4, 5, 4, 5, 1 },
+    { 4, 3, 4, 4, 4, 5, 5, 4, 5, 4, 5, 4, 5, 5, 2 },
+    { 3, 3, 4, 3, 4, 5, 5, 3, 5, 4, 5, 4, 5, 5, 4 },
+};
+
+/* The 8x4 and 4x8 scans of the Simple and Main profiles, then of the Advanced one, in 8 wide raster order */
+static const uint8_t vc1_scan8x4[2][32] = {
+    {
+         0,  1,  2,  8,  3,  9, 10, 16,  4, 11, 17, 24, 18, 12,  5, 19,
+        25, 13, 20, 26, 27,  6, 21, 28, 14, 22, 29,  7, 30, 15, 23, 31,
+    },
+    {
+         0,  8,  1, 16,  2,  9, 10,  3, 24, 17,  4, 11, 18, 12,  5, 19,
+        25, 13, 20, 26, 27,  6, 21, 28, 14, 22, 29,  7, 30, 15, 23, 31,
+    },
+};
+
+static const uint8_t vc1_scan4x8[2][32] = {
+    {
+         0,  8,  1, 16,  9, 24, 17,  2, 32, 10, 25, 40, 18, 48, 33, 26,
+        56, 41, 34,  3, 49, 57, 11, 42, 19, 50, 27, 58, 35, 43, 51, 59,
+    },
+    {
+         0,  1,  8,  2,  9, 16, 17, 24, 10, 32, 25, 18, 40,  3, 33, 26,
+        48, 11, 56, 41, 34, 49, 57, 42, 19, 50, 27, 58, 35, 43, 51, 59,
+    },
+};
+
+static const uint8_t vc1_scan4x4[16] = {
+    0, 8, 16, 1, 9, 24, 17, 2, 10, 18, 25, 3, 11, 26, 19, 27,
+};
+
+/* DCStepSize by quantizer, for luma and chroma alike */
+static const uint8_t vc1_dc_scale[32] = {
+     0,  2,  4,  8,  8,  8,  9,  9, 10, 10, 11, 11, 12, 12, 13, 13,
+    14, 14, 15, 15, 16, 16, 17, 17, 18, 18, 19, 19, 20, 20, 21, 21,
+};
+
+/* What the DC of unavailable blocks predicts, 1024 / DCStepSize, for the Simple and Main profiles */
+static const uint16_t vc1_dc_pred[32] = {
+       0, 1024,  512,  341,  256,  205,  171,  146,  128,  114,  102,   93,   85,   79,   73,   68,
+      64,   60,   57,   54,   51,   49,   47,   45,   43,   41,   39,   38,   37,   35,   34,   33,
+};
+
+/* The size of the MV differentials of MVDATA and what they start at */
+static const uint8_t vc1_mv_size[6] = { 0, 2, 3, 4, 5, 8 };
+static const uint8_t vc1_mv_offset[6] = { 0, 1, 3, 7, 15, 31 };
+
+static const uint32_t *const vc1_ac_code[8] = {
+    vc1_ac_code0, vc1_ac_code1, vc1_ac_code2, vc1_ac_code3,
+    vc1_ac_code4, vc1_ac_code5, vc1_ac_code6, vc1_ac_code7,
+};
+
+static const uint8_t *const vc1_ac_len[8] = {
+    vc1_ac_len0, vc1_ac_len1, vc1_ac_len2, vc1_ac_len3,
+    vc1_ac_len4, vc1_ac_len5, vc1_ac_len6, vc1_ac_len7,
+};
+
+static const uint8_t *const vc1_ac_run[8] = {
+    vc1_ac_run0, vc1_ac_run1, vc1_ac_run2, vc1_ac_run3,
+    vc1_ac_run4, vc1_ac_run5, vc1_ac_run6, vc1_ac_run7,
+};
+
+static const uint8_t *const vc1_ac_level[8] = {
+    vc1_ac_level0, vc1_ac_level1, vc1_ac_level2, vc1_ac_level3,
+    vc1_ac_level4, vc1_ac_level5, vc1_ac_level6, vc1_ac_level7,
+};
+
+/* Codes in each AC coding set, the escape included */
+static const uint8_t vc1_ac_size[8] = { 186, 169, 133, 149, 103, 103, 163, 175 };
+
+static struct vlc vc1_ac_vlc[8];
+static struct vlc vc1_dc_vlc[4];
+static struct vlc vc1_cbpcy_i_vlc;
+static struct vlc vc1_cbpcy_p_vlc[4];
+static struct vlc vc1_mv_vlc[4];
+static struct vlc vc1_ttmb_vlc[3];
+static struct vlc vc1_ttblk_vlc[3];
+static struct vlc vc1_subblkpat_vlc[3];
+
+static struct vlc_entry vc1_ac_table0[1104];
+static struct vlc_entry vc1_ac_table1[962];
+static struct vlc_entry vc1_ac_table2[642];
+static struct vlc_entry vc1_ac_table3[940];
+static struct vlc_entry vc1_ac_table4[554];
+static struct vlc_entry vc1_ac_table5[554];
+static struct vlc_entry vc1_ac_table6[918];
+static struct vlc_entry vc1_ac_table7[7520];
+static struct vlc_entry vc1_dc_table0[8210];
+static struct vlc_entry vc1_dc_table1[6144];
+static struct vlc_entry vc1_dc_table2[20508];
+static struct vlc_entry vc1_dc_table3[12296];
+static struct vlc_entry vc1_cbpcy_i_table[244];
+static struct vlc_entry vc1_cbpcy_p_table[4][266];
+static struct vlc_entry vc1_mv_table[4][400];
+static struct vlc_entry vc1_ttmb_table[3][160];
+static struct vlc_entry vc1_ttblk_table[3][32];
+static struct vlc_entry vc1_subblkpat_table[3][64];
+
+/* The largest level for each run and run for each level, [last][run or level] */
+static uint8_t vc1_max_level[8][2][64];
+static uint8_t vc1_max_run[8][2][64];
+
+/* 2^18 / (i + 1) rounded, to rescale predictions between quantizers */
+static int vc1_dqscale[63];
+
+static pthread_once_t vc1_tables_once = PTHREAD_ONCE_INIT;
+static int vc1_tables_status = -1;
+
+/* Builds the table for the codes of symbols 0 to num_codes - 1 */
+static int
+vc1_init_vlc(struct vlc *vlc, int bits, const uint8_t *lengths, const uint32_t *codes,
+             int num_codes, struct vlc_entry *table, int max_entries)
+{
+    struct vlc_code list[186];
+    int i;
+
+    for (i = 0; i < num_codes; i++) {
+        list[i].code = codes[i];
+        list[i].length = lengths[i];
+        list[i].symbol = i;
+    }
+    return vlc_init(vlc, bits, list, num_codes, table, max_entries);
+}
+
+static void
+vc1_init_tables(void)
+{
+    static struct vlc_entry *const ac_tables[8] = {
+        vc1_ac_table0, vc1_ac_table1, vc1_ac_table2, vc1_ac_table3,
+        vc1_ac_table4, vc1_ac_table5, vc1_ac_table6, vc1_ac_table7,
+    };
+    static const int ac_entries[8] = { 1104, 962, 642, 940, 554, 554, 918, 7520 };
+    static struct vlc_entry *const dc_tables[4] = {
+        vc1_dc_table0, vc1_dc_table1, vc1_dc_table2, vc1_dc_table3,
+    };
+    static const int dc_entries[4] = { 8210, 6144, 20508, 12296 };
+    int status = 0;
+    int i, j;
+
+    for (i = 0; i < 8; i++) {
+        status |= vc1_init_vlc(&vc1_ac_vlc[i], i == 7 ? 12 : 9, vc1_ac_len[i], vc1_ac_code[i],
+                               vc1_ac_size[i], ac_tables[i], ac_entries[i]);
+        for (j = 0; j < vc1_ac_size[i] - 1; j++) {
+            int last = j >= vc1_ac_last[i], run = vc1_ac_run[i][j], level = vc1_ac_level[i][j];
+
+            if (level > vc1_max_level[i][last][run])
+                vc1_max_level[i][last][run] = level;
+            if (run > vc1_max_run[i][last][level])
+                vc1_max_run[i][last][level] = run;
+        }
+    }
+    for (i = 0; i < 4; i++) {
+        status |= vc1_init_vlc(&vc1_dc_vlc[i], 12, vc1_dc_len[i], vc1_dc_code[i], 120,
+                               dc_tables[i], dc_entries[i]);
+        status |= vc1_init_vlc(&vc1_cbpcy_p_vlc[i], 7, vc1_cbpcy_p_len[i], vc1_cbpcy_p_code[i], 64,
+                               vc1_cbpcy_p_table[i], 266);
+        status |= vc1_init_vlc(&vc1_mv_vlc[i], 7, vc1_mv_len[i], vc1_mv_code[i], 73,
+                               vc1_mv_table[i], 400);
+    }
+    status |= vc1_init_vlc(&vc1_cbpcy_i_vlc, 7, vc1_cbpcy_i_len, vc1_cbpcy_i_code, 64,
+                           vc1_cbpcy_i_table, 244);
+    for (i = 0; i < 3; i++) {
+        status |= vc1_init_vlc(&vc1_ttmb_vlc[i], 7, vc1_ttmb_len[i], vc1_ttmb_code[i], 16,
+                               vc1_ttmb_table[i], 160);
+        status |= vc1_init_vlc(&vc1_ttblk_vlc[i], 5, vc1_ttblk_len[i], vc1_ttblk_code[i], 8,
+                               vc1_ttblk_table[i], 32);
+        status |= vc1_init_vlc(&vc1_subblkpat_vlc[i], 6, vc1_subblkpat_len[i], vc1_subblkpat_code[i], 15,
+                               vc1_subblkpat_table[i], 64);
+    }
+    for (i = 0; i < 63; i++)
+        vc1_dqscale[i] = (0x40000 + (i + 1) / 2) / (i + 1);
+    vc1_tables_status = status;
+}
+
+static inline int
+vc1_clip3(int low, int high, int value)
+{
+    return value < low ? low : (value > high ? high : value);
+}
+
+static inline int
+vc1_median(int a, int b, int c)
+{
+    int max = a > b ? a : b, min = a < b ? a : b;
+
+    return c > max ? max : (c < min ? min : c);
+}
+
+/* The mean of the middle two of four, rounded towards zero */
+static inline int
+vc1_median4(int a, int b, int c, int d)
+{
+    int low = a < b ? a : b, high = a < b ? b : a;
+    int low2 = c < d ? c : d, high2 = c < d ? d : c;
+
+    return ((high < high2 ? high : high2) + (low > low2 ? low : low2)) / 2;
+}
+
+static struct epiphany_vc1_decoder *
+vc1_create_decoder(void)
+{
+    struct epiphany_vc1_decoder *decoder = calloc(1, sizeof(*decoder));
+    int i;
+
+    if (decoder) {
+        for (i = 0; i < VC1_MAX_FRAMES; i++)
+            decoder->frames[i].surface = VA_INVALID_SURFACE;
+        decoder->ic_source = VA_INVALID_SURFACE;
+        decoder->ic_target = VA_INVALID_SURFACE;
+    }
+    return decoder;
+}
+
+void
+epiphany_vc1_destroy_decoder(void *data)
+{
+    struct epiphany_vc1_decoder *decoder = data;
+    int i;
+
+    if (NULL == decoder)
+        return;
+    for (i = 0; i < VC1_MAX_FRAMES; i++)
+        free(decoder->frames[i].motion);
+    free(decoder->mbs);
+    free(decoder->blocks);
+    free(decoder->mv[0]);
+    free(decoder->mv[1]);
+    free(decoder->intra);
+    free(decoder->slice_start);
+    free(decoder->rbsp);
+    free(decoder->ic_frame);
+    free(decoder);
+}
+
+/* Sizes the macroblock arrays for the picture, dropping motion kept at another size */
+static int
+vc1_resize_decoder(struct epiphany_vc1_decoder *decoder, int mb_width, int mb_height)
+{
+    size_t num_mbs = (size_t) mb_width * mb_height;
+    int i;
+
+    if (decoder->mbs && decoder->mb_width == mb_width && decoder->mb_height == mb_height)
+        return 0;
+    for (i = 0; i < VC1_MAX_FRAMES; i++) {
+        free(decoder->frames[i].motion);
+        decoder->frames[i].motion = NULL;
+        decoder->frames[i].surface = VA_INVALID_SURFACE;
+    }
+    free(decoder->mbs);
+    free(decoder->blocks);
+    free(decoder->mv[0]);
+    free(decoder->mv[1]);
+    free(decoder->intra);
+    free(decoder->slice_start);
+    decoder->mbs = malloc(num_mbs * sizeof(*decoder->mbs));
+    decoder->blocks = malloc(6 * num_mbs * sizeof(*decoder->blocks));
+    decoder->mv[0] = malloc(4 * num_mbs * sizeof(*decoder->mv[0]));
+    decoder->mv[1] = malloc(4 * num_mbs * sizeof(*decoder->mv[1]));
+    decoder->intra = malloc(384 * num_mbs * sizeof(*decoder->intra));
+    decoder->slice_start = malloc(mb_height);
+    if (NULL == decoder->mbs || NULL == decoder->blocks || NULL == decoder->mv[0] ||
+        NULL == decoder->mv[1] || NULL == decoder->intra || NULL == decoder->slice_start) {
+        free(decoder->mbs);
+        decoder->mbs = NULL;
+        return -1;
+    }
+    decoder->mb_width = mb_width;
+    decoder->mb_height = mb_height;
+    return 0;
+}
+
+static struct vc1_frame *
+vc1_find_frame(struct epiphany_vc1_decoder *decoder, VASurfaceID surface)
+{
+    int i;
+
+    if (VA_INVALID_SURFACE == surface)
+        return NULL;
+    for (i = 0; i < VC1_MAX_FRAMES; i++) {
+        if (decoder->frames[i].surface == surface)
+            return &decoder->frames[i];
+    }
+    return NULL;
+}
+
+/*
+ * Frees the motion of surfaces the picture does not refer to and returns
+ * the slot of the one decoded into
+ */
+static struct vc1_frame *
+vc1_claim_frame(struct epiphany_vc1_decoder *decoder, const VAPictureParameterBufferVC1 *pic_param,
+                VASurfaceID surface)
+{
+    struct vc1_frame *frame, *free_frame = NULL;
+    int i;
+
+    for (i = 0; i < VC1_MAX_FRAMES; i++) {
+        frame = &decoder->frames[i];
+        if (frame->surface != surface &&
+            frame->surface != pic_param->forward_reference_picture &&
+            frame->surface != pic_param->backward_reference_picture)
+            frame->surface = VA_INVALID_SURFACE;
+        if (frame->surface == VA_INVALID_SURFACE && NULL == free_frame)
+            free_frame = frame;
+    }
+
+    frame = vc1_find_frame(decoder, surface);
+    if (NULL == frame)
+        frame = free_frame;
+    if (NULL == frame)
+        return NULL;
+    if (NULL == frame->motion) {
+        frame->motion = malloc((size_t) decoder->mb_width * decoder->mb_height * sizeof(*frame->motion));
+        if (NULL == frame->motion)
+            return NULL;
+    }
+    frame->surface = surface;
+    return frame;
+}
+
+/*
+ * Looks a reference picture up in the surface heap. Missing ones, or ones
+ * of another size, are predicted from the picture itself like MPEG-2 does.
+ */
+static void
+vc1_lookup_reference(struct epiphany_driver_data *driver_data, const struct vc1_picture *pic,
+                     VASurfaceID surface, struct vc1_reference *ref)
+{
+    object_surface_p obj_surface = NULL;
+
+    if (VA_INVALID_SURFACE != surface)
+        obj_surface = SURFACE(surface);
+    if (NULL == obj_surface || NULL == obj_surface->storage ||
+        obj_surface->storage->pitch != pic->stride ||
+        obj_surface->storage->luma_height < pic->height) {
+        ref->y = pic->y;
+        ref->uv = pic->uv;
+    } else {
+        ref->y = obj_surface->storage->data;
+        ref->uv = obj_surface->storage->data + obj_surface->storage->chroma_offset;
+    }
+}
+
+/* Copies a width x height region around (x, y) of a plane, replicating its edge samples */
+static const uint8_t *
+vc1_emulate_edge(uint8_t *buf, const uint8_t *plane, ptrdiff_t stride, int plane_width,
+                 int plane_height, int x, int y, int width, int height, int bytes_per_sample)
+{
+    int i, j, k;
+
+    for (j = 0; j < height; j++) {
+        int row = vc1_clip3(0, plane_height - 1, y + j);
+        const uint8_t *src = plane + row * stride;
+        uint8_t *dst = buf + j * VC1_EDGE_STRIDE;
+
+        for (i = 0; i < width; i++) {
+            int column = vc1_clip3(0, plane_width - 1, x + i);
+
+            for (k = 0; k < bytes_per_sample; k++)
+                dst[i * bytes_per_sample + k] = src[column * bytes_per_sample + k];
+        }
+    }
+    return buf;
+}
+
+/*
+ * 8.3.8, the intensity compensation tables of LUMSCALE and LUMSHIFT as
+ * the reference decoder computes them
+ */
+static void
+vc1_init_intensity_compensation(struct epiphany_vc1_decoder *decoder, int lumscale, int lumshift)
+{
+    int scale, shift, i;
+
+    if (!lumscale) {
+        scale = -64;
+        shift = (255 - lumshift * 2) * 64;
+        if (lumshift > 31)
+            shift += 128 << 6;
+    } else {
+        scale = lumscale + 32;
+        if (lumshift > 31)
+            shift = (lumshift - 64) * 64;
+        else
+            shift = lumshift << 6;
+    }
+    for (i = 0; i < 256; i++) {
+        decoder->ic_luma[i] = vc1_clip3(0, 255, (scale * i + shift + 32) >> 6);
+        decoder->ic_chroma[i] = vc1_clip3(0, 255, (scale * (i - 128) + 128 * 64 + 32) >> 6);
+    }
+}
+
+/*
+ * Remaps the forward reference through the intensity compensation tables
+ * into a copy the picture predicts from instead
+ */
+static int
+vc1_compensate_reference(struct vc1_picture *pic)
+{
+    struct epiphany_vc1_decoder *decoder = pic->decoder;
+    size_t luma_size = pic->stride * pic->height;
+    size_t size = luma_size + luma_size / 2;
+    const uint8_t *src;
+    uint8_t *dst;
+    int i, j;
+
+    if (decoder->ic_frame_size < size) {
+        uint8_t *frame = realloc(decoder->ic_frame, size);
+
+        if (NULL == frame)
+            return -1;
+        decoder->ic_frame = frame;
+        decoder->ic_frame_size = size;
+    }
+    for (j = 0; j < pic->height; j++) {
+        src = pic->refs[0].y + j * pic->stride;
+        dst = decoder->ic_frame + j * pic->stride;
+        for (i = 0; i < pic->width; i++)
+            dst[i] = decoder->ic_luma[src[i]];
+    }
+    for (j = 0; j < pic->height / 2; j++) {
+        src = pic->refs[0].uv + j * pic->stride;
+        dst = decoder->ic_frame + luma_size + j * pic->stride;
+        for (i = 0; i < pic->width; i++)
+            dst[i] = decoder->ic_chroma[src[i]];
+    }
+    pic->refs[0].y = decoder->ic_frame;
+    pic->refs[0].uv = decoder->ic_frame + luma_size;
+    return 0;
+}
+
+/* A flag of the current macroblock from the bitplane buffer, two macroblocks a byte */
+static inline int
+vc1_bitplane_flag(const struct vc1_picture *pic, int flag)
+{
+    int n = pic->mb_y * pic->mb_width + pic->mb_x;
+    int bits = pic->bitplane[n >> 1];
+
+    return ((n & 1 ? bits : bits >> 4) & flag) != 0;
+}
+
+/* A bitplane flag coded either in the bitplane buffer or raw in the macroblock layer */
+static inline int
+vc1_read_flag(struct vc1_picture *pic, int raw, int flag)
+{
+    if (raw)
+        return bitstream_get_bit(&pic->bs);
+    return pic->bitplane ? vc1_bitplane_flag(pic, flag) : 0;
+}
+
+/* Codes '0', '10' and '11' */
+static inline int
+vc1_decode012(struct bitstream *bs)
+{
+    if (!bitstream_get_bit(bs))
+        return 0;
+    return bitstream_get_bit(bs) + 1;
+}
+
+/* Codes '1', '01' and '00' */
+static inline int
+vc1_decode210(struct bitstream *bs)
+{
+    if (bitstream_get_bit(bs))
+        return 0;
+    return 2 - bitstream_get_bit(bs);
+}
+
+/* 7.1.3.4 and 7.1.3.5, MQUANT of the macroblock */
+static void
+vc1_read_mquant(struct vc1_picture *pic)
+{
+    struct bitstream *bs = &pic->bs;
+    int quant = pic->pq, explicit_quant = 0;
+
+    if (pic->dquantfrm) {
+        if (pic->dqprofile == VC1_DQPROFILE_ALL_MBS) {
+            if (pic->dqbilevel) {
+                if (bitstream_get_bit(bs)) {
+                    quant = pic->altpq;
+                    explicit_quant = 1;
+                }
+            } else {
+                int mqdiff = bitstream_get_bits(bs, 3);
+
+                quant = mqdiff != 7 ? pic->pq + mqdiff : (int) bitstream_get_bits(bs, 5);
+                explicit_quant = 1;
+            }
+        }
+        if (((pic->dqedges & 1) && 0 == pic->mb_x) ||
+            ((pic->dqedges & 2) && 0 == pic->mb_y) ||
+            ((pic->dqedges & 4) && pic->mb_x == pic->mb_width - 1) ||
+            ((pic->dqedges & 8) && pic->mb_y == pic->mb_height - 1)) {
+            quant = pic->altpq;
+            explicit_quant = 1;
+        }
+        if (quant < 1 || quant > 31) {
+            quant = 1;
+            explicit_quant = 1;
+        }
+    }
+    pic->quant = quant;
+    pic->explicit_quant = explicit_quant;
+}
+
+/* 8.1.3.4, an AC coefficient as run, level and whether it is the last one */
+static int
+vc1_read_ac_coeff(struct vc1_picture *pic, int codingset, int *last, int *run, int *level)
+{
+    struct bitstream *bs = &pic->bs;
+    int index, escape, sign;
+
+    index = vlc_get(bs, &vc1_ac_vlc[codingset]);
+    if (index < 0)
+        return -1;
+    if (index == vc1_ac_size[codingset] - 1) {
+        escape = vc1_decode210(bs);
+        if (escape == 2) {
+            /* Escape mode 3, the lengths are sent with the first one of the slice */
+            *last = bitstream_get_bit(bs);
+            if (0 == pic->esc3_level_length) {
+                if (pic->pq < 8 || pic->dquantfrm) {
+                    pic->esc3_level_length = bitstream_get_bits(bs, 3);
+                    if (0 == pic->esc3_level_length)
+                        pic->esc3_level_length = bitstream_get_bits(bs, 2) + 8;
+                } else {
+                    pic->esc3_level_length = 2;
+                    while (pic->esc3_level_length < 8 && !bitstream_get_bit(bs))
+                        pic->esc3_level_length++;
+                }
+                pic->esc3_run_length = 3 + bitstream_get_bits(bs, 2);
+            }
+            *run = bitstream_get_bits(bs, pic->esc3_run_length);
+            sign = bitstream_get_bit(bs);
+            *level = bitstream_get_bits(bs, pic->esc3_level_length);
+            *level = sign ? -*level : *level;
+            return 0;
+        }
+        index = vlc_get(bs, &vc1_ac_vlc[codingset]);
+        if (index < 0 || index == vc1_ac_size[codingset] - 1)
+            return -1;
+        *last = index >= vc1_ac_last[codingset];
+        *run = vc1_ac_run[codingset][index];
+        *level = vc1_ac_level[codingset][index];
+        if (0 == escape)
+            *level += vc1_max_level[codingset][*last][*run];
+        else
+            *run += vc1_max_run[codingset][*last][*level] + 1;
+    } else {
+        *last = index >= vc1_ac_last[codingset];
+        *run = vc1_ac_run[codingset][index];
+        *level = vc1_ac_level[codingset][index];
+    }
+    if (bitstream_get_bit(bs))
+        *level = -*level;
+    return 0;
+}
+
+/* Index of block n of the current macroblock in decoder->blocks, 0-3 luma, 4 Cb and 5 Cr */
+static inline int
+vc1_block_index(const struct vc1_picture *pic, int n)
+{
+    int num_mbs = pic->mb_width * pic->mb_height;
+
+    if (n < 4)
+        return (2 * pic->mb_y + (n >> 1)) * 2 * pic->mb_width + 2 * pic->mb_x + (n & 1);
+    return n * num_mbs + pic->mb_y * pic->mb_width + pic->mb_x;
+}
+
+/* Rescales a prediction made at one DC step size to another, like the reference decoder */
+static inline int
+vc1_rescale(int value, int scale, int inverse_scale)
+{
+    return (int) ((unsigned int) value * scale * inverse_scale + 0x20000) >> 18;
+}
+
+/* The AC step size of a quantizer without the non-uniform offset, less one */
+static inline int
+vc1_ac_step(const struct vc1_picture *pic, int quant)
+{
+    return quant * 2 + (quant == pic->pq ? pic->halfpq : 0) - 1;
+}
+
+/*
+ * 8.1.4, decodes intra block n of the macroblock into pic->block as
+ * dequantized coefficients: the DC differential with its prediction,
+ * then the AC coefficients with theirs. The quantized DC and first row
+ * and column are kept for the blocks predicting from this one.
+ */
+static int
+vc1_decode_intra_block(struct vc1_picture *pic, int n, int coded, int codingset)
+{
+    struct bitstream *bs = &pic->bs;
+    struct epiphany_vc1_decoder *decoder = pic->decoder;
+    int mb_pos = pic->mb_y * pic->mb_width + pic->mb_x;
+    int wrap = n < 4 ? 2 * pic->mb_width : pic->mb_width;
+    struct vc1_block *blk = &decoder->blocks[vc1_block_index(pic, n)];
+    const struct vc1_block *pred_blk;
+    int16_t *block = pic->block;
+    int quant = pic->quant, dc_scale = vc1_dc_scale[quant];
+    int scale = quant * 2 + (pic->explicit_quant ? 0 : pic->halfpq);
+    int a_avail, c_avail, a = 0, b = 0, c = 0, dir, q2 = 0, use_pred, dcdiff, i, k;
+    const uint8_t *scan;
+
+    a_avail = (n == 2 || n == 3 || pic->mb_y != pic->first_row) && blk[-wrap].intra;
+    c_avail = (n == 1 || n == 3 || pic->mb_x) && blk[-1].intra;
+    if (a_avail)
+        a = blk[-wrap].dc;
+    if (c_avail)
+        c = blk[-1].dc;
+    if (a_avail && c_avail)
+        b = blk[-wrap - 1].dc;
+
+    if (pic->profile != VC1_PROFILE_ADVANCED && (pic->type == VC1_PICTURE_I || pic->type == VC1_PICTURE_BI)) {
+        /* The picture edges predict a constant, all there is to compare otherwise */
+        int outside = pic->overlap && pic->pq >= 9 ? 0 : vc1_dc_pred[dc_scale];
+
+        if (!a_avail)
+            a = b = outside;
+        if (!c_avail)
+            b = c = outside;
+        dir = abs(a - b) <= abs(b - c);
+        dcdiff = dir ? c : a;
+    } else {
+        int inverse = vc1_dqscale[dc_scale - 1];
+
+        if (c_avail && n != 1 && n != 3) {
+            q2 = decoder->mbs[mb_pos - 1].quant;
+            if (q2 && q2 != quant)
+                c = vc1_rescale(c, vc1_dc_scale[q2], inverse);
+        }
+        if (a_avail && n != 2 && n != 3) {
+            q2 = decoder->mbs[mb_pos - pic->mb_width].quant;
+            if (q2 && q2 != quant)
+                a = vc1_rescale(a, vc1_dc_scale[q2], inverse);
+        }
+        if (a_avail && c_avail && n != 3) {
+            int pos = mb_pos;
+
+            if (n != 1)
+                pos--;
+            if (n != 2)
+                pos -= pic->mb_width;
+            q2 = decoder->mbs[pos].quant;
+            if (q2 && q2 != quant)
+                b = vc1_rescale(b, vc1_dc_scale[q2], inverse);
+        }
+        if (c_avail && (!a_avail || abs(a - b) <= abs(b - c))) {
+            dir = 1;
+            dcdiff = c;
+        } else if (a_avail) {
+            dir = 0;
+            dcdiff = a;
+        } else {
+            dir = 1;
+            dcdiff = 0;
+        }
+    }
+
+    /* The DC differential */
+    i = vlc_get(bs, &vc1_dc_vlc[2 * pic->dc_table + (n >= 4)]);
+    if (i < 0)
+        return -1;
+    if (i) {
+        int m = quant == 1 ? 2 : (quant == 2 ? 1 : 0);
+
+        if (VC1_DC_ESCAPE == i)
+            i = bitstream_get_bits(bs, 8 + m);
+        else if (m)
+            i = (i << m) + bitstream_get_bits(bs, m) - ((1 << m) - 1);
+        if (bitstream_get_bit(bs))
+            i = -i;
+    }
+    dcdiff += i;
+    blk->dc = dcdiff;
+    memset(block, 0, sizeof(pic->block));
+    block[0] = dcdiff * dc_scale;
+
+    /* The predicting block and its quantizer */
+    pred_blk = dir ? &blk[-1] : &blk[-wrap];
+    use_pred = pic->ac_pred && (dir ? c_avail : a_avail);
+    q2 = quant;
+    if (use_pred) {
+        if (dir && n != 1 && n != 3)
+            q2 = decoder->mbs[mb_pos - 1].quant;
+        else if (!dir && n != 2 && n != 3)
+            q2 = decoder->mbs[mb_pos - pic->mb_width].quant;
+    }
+
+    if (coded) {
+        int last = 0, run, level;
+
+        if (pic->type != VC1_PICTURE_I && pic->type != VC1_PICTURE_BI)
+            scan = vc1_scan8x8[0];
+        else if (pic->ac_pred)
+            scan = vc1_scan8x8[dir ? 3 : 2];
+        else
+            scan = vc1_scan8x8[1];
+        for (i = 1; !last; i++) {
+            if (vc1_read_ac_coeff(pic, codingset, &last, &run, &level) < 0)
+                return -1;
+            i += run;
+            if (i > 63)
+                break;
+            block[scan[i]] = level;
+        }
+
+        if (use_pred) {
+            const int16_t *ac = pred_blk->ac + (dir ? 0 : 8);
+            int step = dir ? 8 : 1;
+
+            if (q2 && q2 != quant) {
+                int inverse = vc1_dqscale[vc1_ac_step(pic, quant) - 1], q = vc1_ac_step(pic, q2);
+
+                for (k = 1; k < 8; k++)
+                    block[k * step] += vc1_rescale(ac[k], q, inverse);
+            } else {
+                for (k = 1; k < 8; k++)
+                    block[k * step] += ac[k];
+            }
+        }
+        for (k = 1; k < 8; k++) {
+            blk->ac[k] = block[k * 8];
+            blk->ac[k + 8] = block[k];
+        }
+        for (k = 1; k < 64; k++) {
+            if (block[k]) {
+                block[k] *= scale;
+                if (!pic->uniform)
+                    block[k] += block[k] < 0 ? -quant : quant;
+            }
+        }
+    } else {
+        memset(blk->ac, 0, sizeof(blk->ac));
+        if (use_pred) {
+            int offset = dir ? 0 : 8, step = dir ? 8 : 1;
+
+            memcpy(blk->ac + offset, pred_blk->ac + offset, 8 * sizeof(*blk->ac));
+            if (q2 && q2 != quant) {
+                int inverse = vc1_dqscale[vc1_ac_step(pic, quant) - 1], q = vc1_ac_step(pic, q2);
+
+                for (k = 1; k < 8; k++)
+                    blk->ac[offset + k] = vc1_rescale(blk->ac[offset + k], q, inverse);
+            }
+            for (k = 1; k < 8; k++) {
+                block[k * step] = blk->ac[offset + k] * scale;
+                if (!pic->uniform && block[k * step])
+                    block[k * step] += block[k * step] < 0 ? -quant : quant;
+            }
+        }
+    }
+    blk->intra = 1;
+    return 0;
+}
+
+/*
+ * 8.1.4.2 and 8.3.6, decodes inter block n of the macroblock and adds
+ * its residual to dst. ttmb is the transform type of TTMB or TTFRM, or
+ * -1 if the block has its own TTBLK. Returns the mask of the 4x4
+ * regions that had coefficients, from bit 3 in raster order.
+ */
+static int
+vc1_decode_inter_block(struct vc1_picture *pic, int n, int ttmb, int first_block, uint8_t *dst,
+                       int *tt_out)
+{
+    struct bitstream *bs = &pic->bs;
+    int16_t *block = pic->block;
+    int quant = pic->quant, scale = quant * 2 + (pic->explicit_quant ? 0 : pic->halfpq);
+    int tt = ttmb & 7, subblkpat = 0, which = 0, pat, i, j, code;
+    const uint8_t *scan;
+    int num_parts, part_size, last, run, level;
+
+    if (ttmb < 0) {
+        code = vlc_get(bs, &vc1_ttblk_vlc[pic->tt_index]);
+        if (code < 0)
+            return -1;
+        tt = vc1_ttblk_to_tt[pic->tt_index][code];
+    }
+    if (VC1_TT_4x4 == tt) {
+        code = vlc_get(bs, &vc1_subblkpat_vlc[pic->tt_index]);
+        if (code < 0)
+            return -1;
+        subblkpat = ~(code + 1);
+    }
+    if (tt != VC1_TT_8x8 && tt != VC1_TT_4x4 &&
+        (pic->ttmbf || (ttmb >= 0 && (ttmb & VC1_TT_MB) && !first_block))) {
+        /* Which halves are coded follows the block */
+        subblkpat = vc1_decode012(bs);
+        if (subblkpat)
+            subblkpat ^= 3;
+        if (VC1_TT_8x4_TOP == tt || VC1_TT_8x4_BOTTOM == tt)
+            tt = VC1_TT_8x4;
+        if (VC1_TT_4x8_RIGHT == tt || VC1_TT_4x8_LEFT == tt)
+            tt = VC1_TT_4x8;
+    }
+    if (VC1_TT_8x4_TOP == tt || VC1_TT_8x4_BOTTOM == tt) {
+        subblkpat = 2 - (VC1_TT_8x4_TOP == tt);
+        tt = VC1_TT_8x4;
+    }
+    if (VC1_TT_4x8_RIGHT == tt || VC1_TT_4x8_LEFT == tt) {
+        subblkpat = 2 - (VC1_TT_4x8_LEFT == tt);
+        tt = VC1_TT_4x8;
+    }
+
+    /* subblkpat has a bit set for each part without coefficients, the first part in the top bit */
+    switch (tt) {
+    case VC1_TT_8x8:
+        pat = 0xf;
+        num_parts = 1;
+        part_size = 64;
+        scan = vc1_scan8x8[0];
+        break;
+    case VC1_TT_8x4:
+        pat = ~((subblkpat & 2) * 6 + (subblkpat & 1) * 3) & 0xf;
+        num_parts = 2;
+        part_size = 32;
+        scan = vc1_scan8x4[pic->profile == VC1_PROFILE_ADVANCED];
+        break;
+    case VC1_TT_4x8:
+        pat = ~(subblkpat * 5) & 0xf;
+        num_parts = 2;
+        part_size = 32;
+        scan = vc1_scan4x8[pic->profile == VC1_PROFILE_ADVANCED];
+        break;
+    default:
+        pat = ~subblkpat & 0xf;
+        num_parts = 4;
+        part_size = 16;
+        scan = vc1_scan4x4;
+        break;
+    }
+
+    memset(block, 0, sizeof(pic->block));
+    for (j = 0; j < num_parts; j++) {
+        static const uint8_t offsets[3][4] = { { 0, 32 }, { 0, 4 }, { 0, 4, 32, 36 } };
+        int offset = num_parts == 1 ? 0 : offsets[VC1_TT_8x4 == tt ? 0 : (VC1_TT_4x8 == tt ? 1 : 2)][j];
+
+        if (subblkpat & (1 << (num_parts - 1 - j)))
+            continue;
+        which |= num_parts == 4 ? 8 >> j : 1 << j;
+        for (i = 0, last = 0; !last; i++) {
+            if (vc1_read_ac_coeff(pic, pic->codingset2, &last, &run, &level) < 0)
+                return -1;
+            i += run;
+            if (i >= part_size)
+                break;
+            level *= scale;
+            if (!pic->uniform && level)
+                level += level < 0 ? -quant : quant;
+            block[scan[i] + offset] = level;
+        }
+    }
+
+    if (n < 4) {
+        switch (tt) {
+        case VC1_TT_8x8:
+            pic->dsp->idct8x8_add(dst, pic->stride, block);
+            break;
+        case VC1_TT_8x4:
+            pic->dsp->idct8x4_add(dst, pic->stride, block, which);
+            break;
+        case VC1_TT_4x8:
+            pic->dsp->idct4x8_add(dst, pic->stride, block, which);
+            break;
+        default:
+            pic->dsp->idct4x4_add(dst, pic->stride, block, which);
+            break;
+        }
+    } else {
+        switch (tt) {
+        case VC1_TT_8x8:
+            pic->dsp->idct8x8_add_uv(dst, pic->stride, block);
+            break;
+        case VC1_TT_8x4:
+            pic->dsp->idct8x4_add_uv(dst, pic->stride, block, which);
+            break;
+        case VC1_TT_4x8:
+            pic->dsp->idct4x8_add_uv(dst, pic->stride, block, which);
+            break;
+        default:
+            pic->dsp->idct4x4_add_uv(dst, pic->stride, block, which);
+            break;
+        }
+    }
+    *tt_out |= tt << (4 * n);
+    return pat;
+}
+
+/*
+ * 8.3.6.5, predicts the 16x16 or 8x8 luma block at (x, y) of the
+ * picture from ref displaced by mv
+ */
+static void
+vc1_predict_luma(struct vc1_picture *pic, const uint8_t *ref, int x, int y, const int16_t *mv,
+                 int size, uint8_t *dst, ptrdiff_t dst_stride)
+{
+    int width = VC1_MC_16 == size ? 16 : 8;
+    int sx = x + (mv[0] >> 2), sy = y + (mv[1] >> 2);
+    const uint8_t *src;
+    ptrdiff_t src_stride = pic->stride;
+
+    /* Vectors pointing far outside the picture see its edge */
+    if (pic->profile != VC1_PROFILE_ADVANCED) {
+        sx = vc1_clip3(-16, pic->width, sx);
+        sy = vc1_clip3(-16, pic->height, sy);
+    } else {
+        sx = vc1_clip3(-17, pic->coded_width, sx);
+        sy = vc1_clip3(-18, pic->coded_height + 1, sy);
+    }
+    if (sx < 1 || sy < 1 || sx + width + 2 > pic->width || sy + width + 2 > pic->height) {
+        src = vc1_emulate_edge(pic->edge, ref, pic->stride, pic->width, pic->height,
+                               sx - 1, sy - 1, width + 3, width + 3, 1) + VC1_EDGE_STRIDE + 1;
+        src_stride = VC1_EDGE_STRIDE;
+    } else {
+        src = ref + sy * pic->stride + sx;
+    }
+    if (pic->mspel)
+        pic->dsp->put_mspel[size][((mv[1] & 3) << 2) | (mv[0] & 3)](dst, dst_stride, src, src_stride, pic->rnd);
+    else
+        pic->dsp->put_hpel[size][(mv[1] & 2) | ((mv[0] & 2) >> 1)](dst, dst_stride, src, src_stride, pic->rnd);
+}
+
+/* The same for the 8x8 chroma block at (x, y) of the chroma planes, mv in chroma quarter samples */
+static void
+vc1_predict_chroma(struct vc1_picture *pic, const uint8_t *ref, int x, int y, const int16_t *mv,
+                   uint8_t *dst, ptrdiff_t dst_stride)
+{
+    int sx = x + (mv[0] >> 2), sy = y + (mv[1] >> 2);
+    const uint8_t *src;
+    ptrdiff_t src_stride = pic->stride;
+
+    if (pic->profile != VC1_PROFILE_ADVANCED) {
+        sx = vc1_clip3(-8, pic->width / 2, sx);
+        sy = vc1_clip3(-8, pic->height / 2, sy);
+    } else {
+        sx = vc1_clip3(-8, pic->coded_width >> 1, sx);
+        sy = vc1_clip3(-8, pic->coded_height >> 1, sy);
+    }
+    if (sx < 0 || sy < 0 || sx + 9 > pic->width / 2 || sy + 9 > pic->height / 2) {
+        src = vc1_emulate_edge(pic->edge, ref, pic->stride, pic->width / 2, pic->height / 2,
+                               sx, sy, 9, 9, 2);
+        src_stride = VC1_EDGE_STRIDE;
+    } else {
+        src = ref + sy * pic->stride + 2 * sx;
+    }
+    pic->dsp->put_chroma(dst, dst_stride, src, src_stride, mv[0] & 3, mv[1] & 3, pic->rnd);
+}
+
+/*
+ * 8.3.5.4.3, the chroma vector of a luma one. The vector before the
+ * FASTUVMC rounding is what the loop filter compares. The backward half
+ * of an interpolated B macroblock rounds away from zero instead, as the
+ * reference decoder does.
+ */
+static void
+vc1_chroma_mv(const struct vc1_picture *pic, int mx, int my, int away,
+              int16_t *uvmv, int16_t *filter_mv)
+{
+    int uvmx = (mx + ((mx & 3) == 3)) >> 1, uvmy = (my + ((my & 3) == 3)) >> 1;
+
+    if (filter_mv) {
+        filter_mv[0] = uvmx;
+        filter_mv[1] = uvmy;
+    }
+    if (pic->fastuvmc && away) {
+        uvmx += uvmx < 0 ? -(uvmx & 1) : (uvmx & 1);
+        uvmy += uvmy < 0 ? -(uvmy & 1) : (uvmy & 1);
+    } else if (pic->fastuvmc) {
+        uvmx += uvmx < 0 ? (uvmx & 1) : -(uvmx & 1);
+        uvmy += uvmy < 0 ? (uvmy & 1) : -(uvmy & 1);
+    }
+    uvmv[0] = uvmx;
+    uvmv[1] = uvmy;
+}
+
+/*
+ * Predicts the whole macroblock from ref displaced by mv, into dst_y and
+ * dst_uv with a stride of dst_stride. The chroma vector the loop filter
+ * compares goes to filter_mv unless it is NULL.
+ */
+static void
+vc1_predict_mb(struct vc1_picture *pic, const struct vc1_reference *ref, const int16_t *mv, int away,
+               uint8_t *dst_y, uint8_t *dst_uv, ptrdiff_t dst_stride, int16_t *filter_mv)
+{
+    int16_t uvmv[2];
+
+    vc1_predict_luma(pic, ref->y, pic->mb_x * 16, pic->mb_y * 16, mv, VC1_MC_16, dst_y, dst_stride);
+    vc1_chroma_mv(pic, mv[0], mv[1], away, uvmv, filter_mv);
+    vc1_predict_chroma(pic, ref->uv, pic->mb_x * 8, pic->mb_y * 8, uvmv, dst_uv, dst_stride);
+}
+
+/*
+ * 8.4.5.7, the prediction of B macroblocks: from one reference, or the
+ * average of both with the backward one predicted into pic->tmp first
+ */
+static void
+vc1_predict_b(struct vc1_picture *pic, int type, const int16_t *mv_forward, const int16_t *mv_backward)
+{
+    if (VC1_BMV_BACKWARD == type) {
+        vc1_predict_mb(pic, &pic->refs[1], mv_backward, 0, pic->dst_y, pic->dst_uv, pic->stride, NULL);
+        return;
+    }
+    vc1_predict_mb(pic, &pic->refs[0], mv_forward, 0, pic->dst_y, pic->dst_uv, pic->stride, NULL);
+    if (VC1_BMV_INTERPOLATED == type) {
+        vc1_predict_mb(pic, &pic->refs[1], mv_backward, 1, pic->tmp, pic->tmp + 16 * 16, 16, NULL);
+        pic->dsp->avg(pic->dst_y, pic->stride, pic->tmp, 16, 16, 16);
+        pic->dsp->avg(pic->dst_uv, pic->stride, pic->tmp + 16 * 16, 16, 16, 8);
+    }
+}
+
+/*
+ * 7.1.3.7, MVDATA and BLKMVDATA. Returns the differential in dmv, whether
+ * the macroblock or block is intra, and whether it has coefficients.
+ */
+static int
+vc1_read_mvdata(struct vc1_picture *pic, int *dmv, int *intra, int *has_coeffs)
+{
+    struct bitstream *bs = &pic->bs;
+    int index = vlc_get(bs, pic->mv_vlc), i;
+
+    if (index < 0)
+        return -1;
+    index++;
+    *has_coeffs = index > VC1_MV_INTRA;
+    if (*has_coeffs)
+        index -= VC1_MV_INTRA + 1;
+    *intra = 0;
+    dmv[0] = dmv[1] = 0;
+    if (VC1_MV_ESCAPE == index) {
+        dmv[0] = bitstream_get_bits(bs, pic->k_x - 1 + pic->quarter_sample);
+        dmv[1] = bitstream_get_bits(bs, pic->k_y - 1 + pic->quarter_sample);
+    } else if (VC1_MV_INTRA == index) {
+        *intra = 1;
+    } else if (index) {
+        for (i = 0; i < 2; i++) {
+            int part = i ? index / 6 : index % 6;
+            int size = vc1_mv_size[part] - (!pic->quarter_sample && 5 == part);
+
+            dmv[i] = vc1_mv_offset[part];
+            if (size > 0) {
+                int value = bitstream_get_bits(bs, size), sign = -(value & 1);
+
+                dmv[i] = (sign ^ ((value >> 1) + dmv[i])) - sign;
+            }
+        }
+    }
+    return 0;
+}
+
+/*
+ * 8.3.5.3, predicts the vector of luma block n of a P macroblock, or all
+ * four of them if one_mv, and adds the differential. Intra blocks get a
+ * zero vector.
+ */
+static void
+vc1_predict_p_mv(struct vc1_picture *pic, int n, const int *dmv, int one_mv, int intra)
+{
+    int wrap = 2 * pic->mb_width, xy = vc1_block_index(pic, n);
+    int16_t (*mv)[2] = pic->decoder->mv[0];
+    int a_valid, b_valid, c_valid, offset, count, px, py, qx, qy, limit, sum;
+    const int16_t zero[2] = { 0, 0 };
+    const int16_t *a, *b, *c;
+
+    if (intra) {
+        mv[xy][0] = mv[xy][1] = 0;
+        if (one_mv) {
+            memset(mv[xy], 0, 2 * sizeof(*mv));
+            memset(mv[xy + wrap], 0, 2 * sizeof(*mv));
+        }
+        return;
+    }
+
+    if (one_mv)
+        offset = pic->mb_x == pic->mb_width - 1 ? -1 : 2;
+    else if (0 == n)
+        offset = pic->mb_x ? -1 : 1;
+    else if (1 == n)
+        offset = pic->mb_x == pic->mb_width - 1 ? -1 : 1;
+    else
+        offset = 2 == n ? 1 : -1;
+    a_valid = pic->mb_y != pic->first_row || n == 2 || n == 3;
+    b_valid = a_valid && (!one_mv || pic->mb_width > 1);
+    c_valid = pic->mb_x || n == 1 || n == 3;
+    a = a_valid ? mv[xy - wrap] : zero;
+    b = b_valid ? mv[xy - wrap + offset] : zero;
+    c = c_valid ? mv[xy - 1] : zero;
+
+    count = a_valid + b_valid + c_valid;
+    if (count > 1) {
+        px = vc1_median(a[0], b[0], c[0]);
+        py = vc1_median(a[1], b[1], c[1]);
+    } else {
+        const int16_t *p = a_valid ? a : (c_valid ? c : b);
+
+        px = p[0];
+        py = p[1];
+    }
+
+    /* Pull the predictor back into the picture */
+    qx = (pic->mb_x << 6) + (n == 1 || n == 3 ? 32 : 0);
+    qy = (pic->mb_y << 6) + (n == 2 || n == 3 ? 32 : 0);
+    limit = one_mv ? -60 : -28;
+    if (qx + px < limit)
+        px = limit - qx;
+    if (qy + py < limit)
+        py = limit - qy;
+    if (qx + px > (pic->mb_width << 6) - 4)
+        px = (pic->mb_width << 6) - 4 - qx;
+    if (qy + py > (pic->mb_height << 6) - 4)
+        py = (pic->mb_height << 6) - 4 - qy;
+
+    /* Hybrid prediction, the choice is coded if the predictors are far apart */
+    if (a_valid && c_valid) {
+        sum = abs(px - a[0]) + abs(py - a[1]);
+        if (sum <= 32)
+            sum = abs(px - c[0]) + abs(py - c[1]);
+        if (sum > 32) {
+            const int16_t *p = bitstream_get_bit(&pic->bs) ? a : c;
+
+            px = p[0];
+            py = p[1];
+        }
+    }
+
+    /* The differential is in half samples outside of the quarter sample modes, the sum wraps around the range */
+    px += pic->quarter_sample ? dmv[0] : 2 * dmv[0];
+    py += pic->quarter_sample ? dmv[1] : 2 * dmv[1];
+    mv[xy][0] = ((px + pic->range_x) & (2 * pic->range_x - 1)) - pic->range_x;
+    mv[xy][1] = ((py + pic->range_y) & (2 * pic->range_y - 1)) - pic->range_y;
+    if (one_mv) {
+        memcpy(mv[xy + 1], mv[xy], sizeof(*mv));
+        memcpy(mv[xy + wrap], mv[xy], sizeof(*mv));
+        memcpy(mv[xy + wrap + 1], mv[xy], sizeof(*mv));
+    }
+}
+
+/* 8.4.5.4, scales a vector of the backward reference by BFRACTION, backwards if inverse */
+static inline int
+vc1_scale_mv(const struct vc1_picture *pic, int value, int inverse)
+{
+    int n = pic->bfraction - (inverse ? 256 : 0);
+
+    if (!pic->quarter_sample)
+        return 2 * ((value * n + 255) >> 9);
+    return (value * n + 128) >> 8;
+}
+
+/*
+ * 8.4.5.4 to 8.4.5.6, the forward and backward vectors of a B macroblock.
+ * Both start out as the direct ones scaled from the colocated macroblock,
+ * then the ones the type uses are predicted and the differentials added.
+ * The vectors are kept with luma block 0 of the macroblock.
+ */
+static void
+vc1_predict_b_mv(struct vc1_picture *pic, int dmv[2][2], int direct, int type, int intra)
+{
+    int wrap = 2 * pic->mb_width, xy = vc1_block_index(pic, 0);
+    int mb_pos = pic->mb_y * pic->mb_width + pic->mb_x;
+    int shift = pic->profile != VC1_PROFILE_ADVANCED ? 5 : 6;
+    int dir, i, px, py, qx, qy, limit;
+
+    if (intra) {
+        for (dir = 0; dir < 2; dir++)
+            pic->decoder->mv[dir][xy][0] = pic->decoder->mv[dir][xy][1] = 0;
+        return;
+    }
+
+    for (dir = 0; dir < 2; dir++) {
+        int16_t *mv = pic->decoder->mv[dir][xy];
+
+        for (i = 0; i < 2; i++) {
+            int col = pic->col_motion ? pic->col_motion[mb_pos][i] : 0;
+            int position = (i ? pic->mb_y : pic->mb_x) << 6;
+            int size = (i ? pic->mb_height : pic->mb_width) << 6;
+
+            mv[i] = vc1_clip3(-60 - position, size - 4 - position, vc1_scale_mv(pic, col, dir));
+        }
+    }
+    if (direct)
+        return;
+
+    for (dir = 0; dir < 2; dir++) {
+        int16_t (*mv)[2] = pic->decoder->mv[dir];
+        const int16_t zero[2] = { 0, 0 };
+        const int16_t *a, *b, *c;
+
+        if (type != VC1_BMV_INTERPOLATED && type != dir)
+            continue;
+        c = pic->mb_x ? mv[xy - 2] : zero;
+        if (pic->mb_y != pic->first_row) {
+            a = mv[xy - 2 * wrap];
+            b = mv[xy - 2 * wrap + (pic->mb_x == pic->mb_width - 1 ? -2 : 2)];
+            if (1 == pic->mb_width) {
+                px = a[0];
+                py = a[1];
+            } else {
+                px = vc1_median(a[0], b[0], c[0]);
+                py = vc1_median(a[1], b[1], c[1]);
+            }
+        } else {
+            px = c[0];
+            py = c[1];
+        }
+
+        qx = pic->mb_x << shift;
+        qy = pic->mb_y << shift;
+        limit = 4 - (1 << shift);
+        if (qx + px < limit)
+            px = limit - qx;
+        if (qy + py < limit)
+            py = limit - qy;
+        if (qx + px > (pic->mb_width << shift) - 4)
+            px = (pic->mb_width << shift) - 4 - qx;
+        if (qy + py > (pic->mb_height << shift) - 4)
+            py = (pic->mb_height << shift) - 4 - qy;
+
+        px += pic->quarter_sample ? dmv[dir][0] : 2 * dmv[dir][0];
+        py += pic->quarter_sample ? dmv[dir][1] : 2 * dmv[dir][1];
+        mv[xy][0] = ((px + pic->range_x) & (2 * pic->range_x - 1)) - pic->range_x;
+        mv[xy][1] = ((py + pic->range_y) & (2 * pic->range_y - 1)) - pic->range_y;
+    }
+}
+
+/* Marks the blocks of the macroblock in intra as intra, the others predict a DC of 0 */
+static void
+vc1_reset_blocks(struct vc1_picture *pic, int intra)
+{
+    int n;
+
+    for (n = 0; n < 6; n++) {
+        struct vc1_block *blk = &pic->decoder->blocks[vc1_block_index(pic, n)];
+
+        blk->intra = (intra >> n) & 1;
+        if (!blk->intra)
+            blk->dc = 0;
+    }
+    pic->mb->intra = intra;
+}
+
+/* Inverse transforms intra block n and keeps its samples for the overlap and output passes */
+static void
+vc1_store_intra_block(struct vc1_picture *pic, int n)
+{
+    int16_t *dst = pic->decoder->intra;
+    ptrdiff_t stride = pic->width;
+    int j;
+
+    pic->dsp->idct8x8(pic->block);
+    if (n < 4) {
+        dst += (pic->mb_y * 16 + (n & 2) * 4) * stride + pic->mb_x * 16 + (n & 1) * 8;
+    } else {
+        stride /= 2;
+        dst += pic->width * pic->height + (n - 4) * stride * (pic->height / 2) +
+               pic->mb_y * 8 * stride + pic->mb_x * 8;
+    }
+    for (j = 0; j < 8; j++)
+        memcpy(dst + j * stride, pic->block + j * 8, 8 * sizeof(*dst));
+}
+
+/*
+ * Decodes the blocks of a macroblock whose prediction is in place, intra
+ * ones as flagged in intra and inter ones as flagged in coded
+ */
+static int
+vc1_decode_blocks(struct vc1_picture *pic, int intra, int coded, int ttmb)
+{
+    struct vc1_mb *mb = pic->mb;
+    int first_block = 1, n, pat;
+
+    for (n = 0; n < 6; n++) {
+        int is_coded = (coded >> n) & 1;
+
+        if ((intra >> n) & 1) {
+            if (vc1_decode_intra_block(pic, n, is_coded, n < 4 ? pic->codingset : pic->codingset2) < 0)
+                return -1;
+            vc1_store_intra_block(pic, n);
+            mb->cbp |= 0xf << (4 * n);
+        } else if (is_coded) {
+            uint8_t *dst = n < 4 ? pic->dst_y + (n & 1) * 8 + (n & 2) * 4 * pic->stride : pic->dst_uv + n - 4;
+            int tt = 0;
+
+            pat = vc1_decode_inter_block(pic, n, ttmb, first_block, dst, &tt);
+            if (pat < 0)
+                return -1;
+            mb->cbp |= pat << (4 * n);
+            mb->tt |= tt;
+            if (!pic->ttmbf && ttmb < VC1_TT_MB)
+                ttmb = -1;
+            first_block = 0;
+        }
+    }
+    return 0;
+}
+
+/* The coded block pattern bits of CBPCY in block order */
+static inline int
+vc1_cbp_to_coded(int cbp)
+{
+    int coded = 0, n;
+
+    for (n = 0; n < 6; n++)
+        coded |= ((cbp >> (5 - n)) & 1) << n;
+    return coded;
+}
+
+/* 8.1.1 and 7.1.3, a macroblock of an I or BI picture */
+static int
+vc1_decode_i_mb(struct vc1_picture *pic)
+{
+    const VAPictureParameterBufferVC1 *pic_param = pic->pic_param;
+    struct epiphany_vc1_decoder *decoder = pic->decoder;
+    struct vc1_mb *mb = pic->mb;
+    int cbp, coded, n, overflag = 0;
+
+    cbp = vlc_get(&pic->bs, &vc1_cbpcy_i_vlc);
+    if (cbp < 0)
+        return -1;
+    if (pic->profile == VC1_PROFILE_ADVANCED) {
+        pic->ac_pred = vc1_read_flag(pic, pic_param->raw_coding.flags.ac_pred, VC1_BP_ACPRED);
+        if (VC1_CONDOVER_SELECT == pic->condover)
+            overflag = vc1_read_flag(pic, pic_param->raw_coding.flags.overflags, VC1_BP_OVERFLAGS);
+        vc1_read_mquant(pic);
+        mb->overlap = pic->overlap &&
+                      (pic->pq >= 9 || VC1_CONDOVER_ALL == pic->condover || overflag);
+    } else {
+        pic->ac_pred = bitstream_get_bit(&pic->bs);
+        pic->quant = pic->pq;
+        pic->explicit_quant = 0;
+        mb->overlap = pic->overlap && pic->pq >= 9;
+    }
+    mb->quant = pic->quant;
+    vc1_reset_blocks(pic, 0x3f);
+
+    /* The coded flags of luma blocks are predicted from the left, top left and top ones, not across slices */
+    coded = vc1_cbp_to_coded(cbp);
+    for (n = 0; n < 4; n++) {
+        int wrap = 2 * pic->mb_width, index = vc1_block_index(pic, n);
+        int bx = 2 * pic->mb_x + (n & 1), by = 2 * (pic->mb_y - pic->first_row) + (n >> 1);
+        int a = bx ? decoder->blocks[index - 1].coded : 0;
+        int b = bx && by ? decoder->blocks[index - wrap - 1].coded : 0;
+        int c = by ? decoder->blocks[index - wrap].coded : 0;
+
+        coded ^= (b == c ? a : c) << n;
+        decoder->blocks[index].coded = (coded >> n) & 1;
+    }
+    return vc1_decode_blocks(pic, 0x3f, coded, 0);
+}
+
+/*
+ * 8.3.5.4.3 and 8.3.6.5, the chroma prediction of a 4MV macroblock from
+ * the vectors of its inter luma blocks. Returns the vector B pictures
+ * take as the macroblock's, zero if chroma is intra.
+ */
+static void
+vc1_predict_4mv_chroma(struct vc1_picture *pic, int intra, int16_t *motion)
+{
+    int16_t (*mv)[2] = &pic->decoder->mv[0][vc1_block_index(pic, 0)];
+    int wrap = 2 * pic->mb_width, valid[4], count = 0, tx, ty, n;
+    const int16_t *mvs[4] = { mv[0], mv[1], mv[wrap], mv[wrap + 1] };
+    int16_t uvmv[2];
+
+    for (n = 0; n < 4; n++) {
+        if (!((intra >> n) & 1))
+            valid[count++] = n;
+    }
+    if (4 == count) {
+        tx = vc1_median4(mvs[0][0], mvs[1][0], mvs[2][0], mvs[3][0]);
+        ty = vc1_median4(mvs[0][1], mvs[1][1], mvs[2][1], mvs[3][1]);
+    } else if (3 == count) {
+        tx = vc1_median(mvs[valid[0]][0], mvs[valid[1]][0], mvs[valid[2]][0]);
+        ty = vc1_median(mvs[valid[0]][1], mvs[valid[1]][1], mvs[valid[2]][1]);
+    } else if (2 == count) {
+        tx = (mvs[valid[0]][0] + mvs[valid[1]][0]) / 2;
+        ty = (mvs[valid[0]][1] + mvs[valid[1]][1]) / 2;
+    } else {
+        motion[0] = motion[1] = 0;
+        return;
+    }
+    motion[0] = tx;
+    motion[1] = ty;
+    vc1_chroma_mv(pic, tx, ty, 0, uvmv, pic->mb->chroma_mv);
+    vc1_predict_chroma(pic, pic->refs[0].uv, pic->mb_x * 8, pic->mb_y * 8, uvmv, pic->dst_uv, pic->stride);
+}
+
+/* Predicts luma block n of a 4MV macroblock from its vector */
+static void
+vc1_predict_4mv_luma(struct vc1_picture *pic, int n)
+{
+    const int16_t *mv = pic->decoder->mv[0][vc1_block_index(pic, n)];
+    int x = (n & 1) * 8, y = (n & 2) * 4;
+
+    vc1_predict_luma(pic, pic->refs[0].y, pic->mb_x * 16 + x, pic->mb_y * 16 + y, mv, VC1_MC_8,
+                     pic->dst_y + y * pic->stride + x, pic->stride);
+}
+
+/* 8.3, a macroblock of a P picture */
+static int
+vc1_decode_p_mb(struct vc1_picture *pic)
+{
+    const VAPictureParameterBufferVC1 *pic_param = pic->pic_param;
+    struct bitstream *bs = &pic->bs;
+    struct vc1_mb *mb = pic->mb;
+    int16_t *motion = pic->motion[pic->mb_y * pic->mb_width + pic->mb_x];
+    int four_mv = 0, skipped, cbp, ttmb = pic->ttfrm, dmv[2] = { 0, 0 }, intra = 0, coded = 0;
+    int is_intra, has_coeffs, n;
+
+    if (VC1_MV_MIXED == pic->mv_mode)
+        four_mv = vc1_read_flag(pic, pic_param->raw_coding.flags.mv_type_mb, VC1_BP_MVTYPEMB);
+    skipped = vc1_read_flag(pic, pic_param->raw_coding.flags.skip_mb, VC1_BP_SKIPMB);
+    pic->quant = pic->pq;
+    pic->explicit_quant = 0;
+    pic->ac_pred = 0;
+
+    if (!four_mv) {
+        int16_t *mv = pic->decoder->mv[0][vc1_block_index(pic, 0)];
+
+        if (skipped) {
+            vc1_reset_blocks(pic, 0);
+            vc1_predict_p_mv(pic, 0, dmv, 1, 0);
+            vc1_predict_mb(pic, &pic->refs[0], mv, 0, pic->dst_y, pic->dst_uv, pic->stride, mb->chroma_mv);
+            memcpy(motion, mv, sizeof(*pic->motion));
+            return 0;
+        }
+        if (vc1_read_mvdata(pic, dmv, &is_intra, &has_coeffs) < 0)
+            return -1;
+        vc1_predict_p_mv(pic, 0, dmv, 1, is_intra);
+        cbp = 0;
+        if (is_intra && !has_coeffs) {
+            vc1_read_mquant(pic);
+            pic->ac_pred = bitstream_get_bit(bs);
+        } else if (has_coeffs) {
+            if (is_intra)
+                pic->ac_pred = bitstream_get_bit(bs);
+            cbp = vlc_get(bs, pic->cbpcy_vlc);
+            if (cbp < 0)
+                return -1;
+            vc1_read_mquant(pic);
+        }
+        mb->quant = pic->quant;
+        if (!pic->ttmbf && !is_intra && has_coeffs) {
+            ttmb = vlc_get(bs, &vc1_ttmb_vlc[pic->tt_index]);
+            if (ttmb < 0)
+                return -1;
+        }
+        intra = is_intra ? 0x3f : 0;
+        vc1_reset_blocks(pic, intra);
+        mb->overlap = is_intra && pic->overlap && pic->pq >= 9;
+        if (!is_intra)
+            vc1_predict_mb(pic, &pic->refs[0], mv, 0, pic->dst_y, pic->dst_uv, pic->stride, mb->chroma_mv);
+        memcpy(motion, mv, sizeof(*pic->motion));
+        return vc1_decode_blocks(pic, intra, vc1_cbp_to_coded(cbp), ttmb);
+    }
+
+    if (skipped) {
+        vc1_reset_blocks(pic, 0);
+        for (n = 0; n < 4; n++) {
+            vc1_predict_p_mv(pic, n, dmv, 0, 0);
+            vc1_predict_4mv_luma(pic, n);
+        }
+        vc1_predict_4mv_chroma(pic, 0, motion);
+        return 0;
+    }
+    cbp = vlc_get(bs, pic->cbpcy_vlc);
+    if (cbp < 0)
+        return -1;
+    for (n = 0; n < 4; n++) {
+        dmv[0] = dmv[1] = 0;
+        is_intra = has_coeffs = 0;
+        if ((cbp >> (5 - n)) & 1) {
+            if (vc1_read_mvdata(pic, dmv, &is_intra, &has_coeffs) < 0)
+                return -1;
+        }
+        vc1_predict_p_mv(pic, n, dmv, 0, is_intra);
+        if (!is_intra)
+            vc1_predict_4mv_luma(pic, n);
+        intra |= is_intra << n;
+        coded |= has_coeffs << n;
+    }
+    /* Chroma is intra when most of luma is */
+    if ((intra & 1) + ((intra >> 1) & 1) + ((intra >> 2) & 1) + ((intra >> 3) & 1) >= 3)
+        intra |= 0x30;
+    coded |= ((cbp >> 1) & 1) << 4 | (cbp & 1) << 5;
+    vc1_reset_blocks(pic, intra);
+    vc1_predict_4mv_chroma(pic, intra, motion);
+    if (0 == intra && 0 == (coded & ~intra))
+        return 0;
+
+    vc1_read_mquant(pic);
+    mb->quant = pic->quant;
+    mb->overlap = pic->overlap && pic->pq >= 9;
+    /* ACPRED is only sent if some intra block has a neighbour to predict from */
+    for (n = 0; n < 6; n++) {
+        const struct vc1_block *blk = &pic->decoder->blocks[vc1_block_index(pic, n)];
+        int wrap = n < 4 ? 2 * pic->mb_width : pic->mb_width;
+
+        if (((intra >> n) & 1) &&
+            (((pic->mb_y != pic->first_row || n == 2 || n == 3) && blk[-wrap].intra) ||
+             ((pic->mb_x || n == 1 || n == 3) && blk[-1].intra))) {
+            pic->ac_pred = bitstream_get_bit(bs);
+            break;
+        }
+    }
+    if (!pic->ttmbf && (coded & ~intra)) {
+        ttmb = vlc_get(bs, &vc1_ttmb_vlc[pic->tt_index]);
+        if (ttmb < 0)
+            return -1;
+    }
+    return vc1_decode_blocks(pic, intra, coded, ttmb);
+}
+
+/* 8.4, a macroblock of a B picture */
+static int
+vc1_decode_b_mb(struct vc1_picture *pic)
+{
+    const VAPictureParameterBufferVC1 *pic_param = pic->pic_param;
+    struct bitstream *bs = &pic->bs;
+    struct vc1_mb *mb = pic->mb;
+    int xy = vc1_block_index(pic, 0);
+    int direct, skipped, cbp = 0, ttmb = pic->ttfrm, dmv[2][2] = { { 0, 0 }, { 0, 0 } };
+    int type = VC1_BMV_BACKWARD, is_intra = 0, has_coeffs = 0;
+
+    direct = vc1_read_flag(pic, pic_param->raw_coding.flags.direct_mb, VC1_BP_DIRECTMB);
+    skipped = vc1_read_flag(pic, pic_param->raw_coding.flags.skip_mb, VC1_BP_SKIPMB);
+    pic->quant = pic->pq;
+    pic->explicit_quant = 0;
+    pic->ac_pred = 0;
+    vc1_reset_blocks(pic, 0);
+
+    if (!direct) {
+        if (!skipped) {
+            if (vc1_read_mvdata(pic, dmv[0], &is_intra, &has_coeffs) < 0)
+                return -1;
+            dmv[1][0] = dmv[0][0];
+            dmv[1][1] = dmv[0][1];
+        }
+        if (skipped || !is_intra) {
+            /* BMVTYPE, the shorter code goes to the nearer reference */
+            switch (vc1_decode012(bs)) {
+            case 0:
+                type = pic->bfraction >= 128 ? VC1_BMV_BACKWARD : VC1_BMV_FORWARD;
+                break;
+            case 1:
+                type = pic->bfraction >= 128 ? VC1_BMV_FORWARD : VC1_BMV_BACKWARD;
+                break;
+            default:
+                type = VC1_BMV_INTERPOLATED;
+                dmv[0][0] = dmv[0][1] = 0;
+                break;
+            }
+        }
+    }
+
+    if (skipped || direct) {
+        if (direct)
+            type = VC1_BMV_INTERPOLATED;
+        if (direct && !skipped) {
+            cbp = vlc_get(bs, pic->cbpcy_vlc);
+            if (cbp < 0)
+                return -1;
+            vc1_read_mquant(pic);
+            if (!pic->ttmbf) {
+                ttmb = vlc_get(bs, &vc1_ttmb_vlc[pic->tt_index]);
+                if (ttmb < 0)
+                    return -1;
+            }
+        }
+        mb->quant = pic->quant;
+        vc1_predict_b_mv(pic, dmv, direct, type, 0);
+        vc1_predict_b(pic, type, pic->decoder->mv[0][xy], pic->decoder->mv[1][xy]);
+        return vc1_decode_blocks(pic, 0, vc1_cbp_to_coded(cbp), ttmb);
+    }
+
+    if (!has_coeffs && !is_intra) {
+        /* No coefficients, and no second vector */
+        vc1_predict_b_mv(pic, dmv, 0, type, 0);
+        vc1_predict_b(pic, type, pic->decoder->mv[0][xy], pic->decoder->mv[1][xy]);
+        return 0;
+    }
+    if (is_intra && !has_coeffs) {
+        vc1_read_mquant(pic);
+        pic->ac_pred = bitstream_get_bit(bs);
+        vc1_predict_b_mv(pic, dmv, 0, type, 1);
+    } else {
+        if (VC1_BMV_INTERPOLATED == type) {
+            /* The forward differential follows the backward one */
+            if (vc1_read_mvdata(pic, dmv[0], &is_intra, &has_coeffs) < 0)
+                return -1;
+            if (!has_coeffs) {
+                vc1_predict_b_mv(pic, dmv, 0, type, 0);
+                vc1_predict_b(pic, type, pic->decoder->mv[0][xy], pic->decoder->mv[1][xy]);
+                return 0;
+            }
+        }
+        vc1_predict_b_mv(pic, dmv, 0, type, is_intra);
+        if (!is_intra)
+            vc1_predict_b(pic, type, pic->decoder->mv[0][xy], pic->decoder->mv[1][xy]);
+        else
+            pic->ac_pred = bitstream_get_bit(bs);
+        cbp = vlc_get(bs, pic->cbpcy_vlc);
+        if (cbp < 0)
+            return -1;
+        vc1_read_mquant(pic);
+        if (!pic->ttmbf && !is_intra) {
+            ttmb = vlc_get(bs, &vc1_ttmb_vlc[pic->tt_index]);
+            if (ttmb < 0)
+                return -1;
+        }
+    }
+    mb->quant = pic->quant;
+    if (is_intra)
+        vc1_reset_blocks(pic, 0x3f);
+    return vc1_decode_blocks(pic, is_intra ? 0x3f : 0, vc1_cbp_to_coded(cbp), ttmb);
+}
+
+/* Whether block n of the macroblock at mb_pos is intra and overlap smoothed */
+static inline int
+vc1_smoothed(const struct vc1_picture *pic, int mb_pos, int n)
+{
+    const struct vc1_mb *mb = &pic->decoder->mbs[mb_pos];
+
+    return mb->overlap && ((mb->intra >> n) & 1);
+}
+
+/*
+ * 8.5, overlap smoothing of the edges between smoothed intra blocks, all
+ * the vertical edges of the picture first and then the horizontal ones.
+ * Edges at the top of a slice are left alone.
+ */
+static void
+vc1_overlap_picture(struct vc1_picture *pic)
+{
+    struct epiphany_vc1_decoder *decoder = pic->decoder;
+    ptrdiff_t stride = pic->width, chroma_stride = pic->width / 2;
+    int16_t *chroma = decoder->intra + pic->width * pic->height;
+    int chroma_size = chroma_stride * (pic->height / 2);
+    int mb_x, mb_y, n, dir;
+
+    for (dir = 0; dir < 2; dir++) {
+        for (mb_y = 0; mb_y < pic->mb_height; mb_y++) {
+            for (mb_x = 0; mb_x < pic->mb_width; mb_x++) {
+                int mb_pos = mb_y * pic->mb_width + mb_x;
+                int neighbour = dir ? mb_pos - pic->mb_width : mb_pos - 1;
+                int outside = dir ? 0 == mb_y || decoder->slice_start[mb_y] : 0 == mb_x;
+                void (*overlap)(int16_t *, ptrdiff_t) = dir ? pic->dsp->overlap_v : pic->dsp->overlap_h;
+
+                if (!decoder->mbs[mb_pos].overlap || !decoder->mbs[mb_pos].intra)
+                    continue;
+                for (n = 0; n < 6; n++) {
+                    int16_t *src;
+                    int inner = n < 4 && (dir ? n >= 2 : (n & 1));
+
+                    if (!vc1_smoothed(pic, mb_pos, n))
+                        continue;
+                    if (inner) {
+                        if (!vc1_smoothed(pic, mb_pos, dir ? n - 2 : n - 1))
+                            continue;
+                    } else if (outside || !vc1_smoothed(pic, neighbour, n < 4 ? (dir ? n + 2 : n + 1) : n)) {
+                        continue;
+                    }
+                    if (n < 4)
+                        src = decoder->intra + (mb_y * 16 + (n & 2) * 4) * stride + mb_x * 16 + (n & 1) * 8;
+                    else
+                        src = chroma + (n - 4) * chroma_size + mb_y * 8 * chroma_stride + mb_x * 8;
+                    overlap(src, n < 4 ? stride : chroma_stride);
+                }
+            }
+        }
+    }
+}
+
+/*
+ * Writes the intra blocks out, clamped. Their samples are signed but for
+ * the I pictures of the Simple and Main profiles without smoothing.
+ */
+static void
+vc1_put_intra_blocks(struct vc1_picture *pic)
+{
+    struct epiphany_vc1_decoder *decoder = pic->decoder;
+    ptrdiff_t chroma_stride = pic->width / 2;
+    int chroma_size = chroma_stride * (pic->height / 2);
+    int offset = 128, mb_x, mb_y, n, i, j;
+
+    if (pic->profile != VC1_PROFILE_ADVANCED && (VC1_PICTURE_I == pic->type || VC1_PICTURE_BI == pic->type) &&
+        !(pic->overlap && pic->pq >= 9))
+        offset = 0;
+    for (mb_y = 0; mb_y < pic->mb_height; mb_y++) {
+        for (mb_x = 0; mb_x < pic->mb_width; mb_x++) {
+            int intra = decoder->mbs[mb_y * pic->mb_width + mb_x].intra;
+
+            for (n = 0; intra && n < 6; n++) {
+                const int16_t *src;
+                uint8_t *dst;
+                ptrdiff_t src_stride;
+
+                if (!((intra >> n) & 1))
+                    continue;
+                if (n < 4) {
+                    src_stride = pic->width;
+                    src = decoder->intra + (mb_y * 16 + (n & 2) * 4) * src_stride + mb_x * 16 + (n & 1) * 8;
+                    dst = pic->y + (mb_y * 16 + (n & 2) * 4) * pic->stride + mb_x * 16 + (n & 1) * 8;
+                    for (j = 0; j < 8; j++) {
+                        for (i = 0; i < 8; i++)
+                            dst[j * pic->stride + i] = vc1_clip3(0, 255, src[j * src_stride + i] + offset);
+                    }
+                } else {
+                    src_stride = chroma_stride;
+                    src = decoder->intra + pic->width * pic->height + (n - 4) * chroma_size +
+                          mb_y * 8 * src_stride + mb_x * 8;
+                    dst = pic->uv + mb_y * 8 * pic->stride + mb_x * 16 + n - 4;
+                    for (j = 0; j < 8; j++) {
+                        for (i = 0; i < 8; i++)
+                            dst[j * pic->stride + 2 * i] = vc1_clip3(0, 255, src[j * src_stride + i] + offset);
+                    }
+                }
+            }
+        }
+    }
+}
+
+/*
+ * 8.6.2, which halves of an edge of block n of the macroblock at mb_pos
+ * a P picture filters, bit 0 for the top or left one: the edge before
+ * the block, or with inner the one across the middle of a 4x4, 8x4 or
+ * 4x8 transformed block. Edges by intra blocks or between different
+ * motion are filtered all along, others where either side has
+ * coefficients.
+ */
+static int
+vc1_p_edge_halves(const struct vc1_picture *pic, int mb_pos, int n, int dir, int inner)
+{
+    struct epiphany_vc1_decoder *decoder = pic->decoder;
+    const struct vc1_mb *q_mb = &decoder->mbs[mb_pos], *p_mb;
+    int q_cbp = (q_mb->cbp >> (4 * n)) & 0xf, p_cbp, p_pos = mb_pos, pn = n, idx;
+    const int16_t *p_mv, *q_mv;
+
+    if (inner) {
+        int tt = (q_mb->tt >> (4 * n)) & 0xf;
+
+        if (0 == dir && (VC1_TT_4x4 == tt || VC1_TT_4x8 == tt))
+            return (q_cbp & 0xc ? 1 : 0) | (q_cbp & 0x3 ? 2 : 0);
+        if (1 == dir && (VC1_TT_4x4 == tt || VC1_TT_8x4 == tt))
+            return (q_cbp & 0xa ? 1 : 0) | (q_cbp & 0x5 ? 2 : 0);
+        return 0;
+    }
+
+    /* The block on the other side, in this macroblock or the one left of or above it */
+    if (n >= 4) {
+        p_pos -= dir ? pic->mb_width : 1;
+    } else if (0 == dir) {
+        pn = n ^ 1;
+        if (!(n & 1))
+            p_pos--;
+    } else {
+        pn = n ^ 2;
+        if (!(n & 2))
+            p_pos -= pic->mb_width;
+    }
+    p_mb = &decoder->mbs[p_pos];
+    if (((p_mb->intra >> pn) & 1) || ((q_mb->intra >> n) & 1))
+        return 3;
+    if (n >= 4) {
+        p_mv = p_mb->chroma_mv;
+        q_mv = q_mb->chroma_mv;
+    } else {
+        int p_x = p_pos % pic->mb_width, p_y = p_pos / pic->mb_width;
+        int q_x = mb_pos % pic->mb_width, q_y = mb_pos / pic->mb_width;
+        int wrap = 2 * pic->mb_width;
+
+        p_mv = decoder->mv[0][(2 * p_y + (pn >> 1)) * wrap + 2 * p_x + (pn & 1)];
+        q_mv = decoder->mv[0][(2 * q_y + (n >> 1)) * wrap + 2 * q_x + (n & 1)];
+    }
+    if (p_mv[0] != q_mv[0] || p_mv[1] != q_mv[1])
+        return 3;
+
+    p_cbp = (p_mb->cbp >> (4 * pn)) & 0xf;
+    if (0 == dir) {
+        idx = (p_cbp | q_cbp >> 1) & 5;
+        return (idx & 4 ? 1 : 0) | (idx & 1 ? 2 : 0);
+    }
+    idx = (p_cbp | q_cbp >> 2) & 3;
+    return (idx & 2 ? 1 : 0) | (idx & 1 ? 2 : 0);
+}
+
+/*
+ * 8.6, the in-loop deblocking filter: the horizontal block edges of the
+ * picture, the horizontal edges inside blocks, then the same for the
+ * vertical edges. I and B pictures filter all the 8x8 block edges.
+ * Neither picture edges nor slice tops are filtered.
+ */
+static void
+vc1_loop_filter_picture(struct vc1_picture *pic)
+{
+    const struct vc1_dsp_ops *dsp = pic->dsp;
+    ptrdiff_t stride = pic->stride;
+    int is_p = VC1_PICTURE_P == pic->type;
+    int dir, inner, mb_x, mb_y, n, halves, first, second;
+
+    for (dir = 1; dir >= 0; dir--) {
+        for (inner = 0; inner <= is_p; inner++) {
+            for (mb_y = 0; mb_y < pic->mb_height; mb_y++) {
+                for (mb_x = 0; mb_x < pic->mb_width; mb_x++) {
+                    int mb_pos = mb_y * pic->mb_width + mb_x;
+                    int outside = dir ? 0 == mb_y || pic->decoder->slice_start[mb_y] : 0 == mb_x;
+                    /* Offset from the first sample of the block to the second half of the edge */
+                    ptrdiff_t half = dir ? 4 : 4 * stride;
+                    uint8_t *pix;
+
+                    for (n = 0; n < 4; n++) {
+                        if (!inner && outside && !(dir ? n & 2 : n & 1))
+                            continue;
+                        halves = is_p ? vc1_p_edge_halves(pic, mb_pos, n, dir, inner) : 3;
+                        pix = pic->y + (mb_y * 16 + (n & 2) * 4) * stride + mb_x * 16 + (n & 1) * 8;
+                        if (inner)
+                            pix += dir ? 4 * stride : 4;
+                        if (3 == halves) {
+                            dsp->loop_filter[dir](pix, stride, 8, pic->pq);
+                        } else {
+                            if (halves & 1)
+                                dsp->loop_filter[dir](pix, stride, 4, pic->pq);
+                            if (halves & 2)
+                                dsp->loop_filter[dir](pix + half, stride, 4, pic->pq);
+                        }
+                    }
+
+                    if (!inner && outside)
+                        continue;
+                    /* The components of the chroma blocks filtered on each half */
+                    first = second = 3;
+                    if (is_p) {
+                        int cb = vc1_p_edge_halves(pic, mb_pos, 4, dir, inner);
+                        int cr = vc1_p_edge_halves(pic, mb_pos, 5, dir, inner);
+
+                        first = (cb & 1) | (cr & 1) << 1;
+                        second = (cb >> 1) | (cr >> 1) << 1;
+                    }
+                    pix = pic->uv + mb_y * 8 * stride + mb_x * 16;
+                    if (inner)
+                        pix += dir ? 4 * stride : 8;
+                    half = dir ? 8 : 4 * stride;
+                    if (first == second) {
+                        if (first)
+                            dsp->loop_filter_uv[dir](pix, stride, 8, pic->pq, first);
+                    } else {
+                        if (first)
+                            dsp->loop_filter_uv[dir](pix, stride, 4, pic->pq, first);
+                        if (second)
+                            dsp->loop_filter_uv[dir](pix + half, stride, 4, pic->pq, second);
+                    }
+                }
+            }
+        }
+    }
+}
+
+
+/*
+ * Copies Advanced profile slice data to the decoder's buffer without its
+ * emulation prevention bytes, returns the size or 0 on allocation failure
+ */
+static size_t
+vc1_unescape(struct epiphany_vc1_decoder *decoder, const uint8_t *data, size_t size)
+{
+    size_t i, n = 0;
+    int zeros = 0;
+
+    if (decoder->rbsp_size < size) {
+        uint8_t *rbsp = realloc(decoder->rbsp, size);
+
+        if (NULL == rbsp)
+            return 0;
+        decoder->rbsp = rbsp;
+        decoder->rbsp_size = size;
+    }
+    for (i = 0; i < size; i++) {
+        if (zeros >= 2 && data[i] == 3 && i + 1 < size && data[i + 1] < 4) {
+            zeros = 0;
+            continue;
+        }
+        decoder->rbsp[n++] = data[i];
+        zeros = data[i] ? 0 : zeros + 1;
+    }
+    return n;
+}
+
+/*
+ * Decodes the macroblock rows of one slice, up to the row the next one
+ * starts at, until its data ends or is found damaged
+ */
+static void
+vc1_decode_slice(struct vc1_picture *pic, const VASliceParameterBufferVC1 *slice_param, const uint8_t *data)
+{
+    struct epiphany_vc1_decoder *decoder = pic->decoder;
+    size_t size = slice_param->slice_data_size;
+    int first_row = slice_param->slice_vertical_position;
+    int last_row, status;
+
+    if (first_row >= pic->mb_height)
+        return;
+    for (last_row = first_row + 1; last_row < pic->mb_height; last_row++) {
+        if (decoder->slice_start[last_row])
+            break;
+    }
+
+    data += slice_param->slice_data_offset;
+    if (VC1_PROFILE_ADVANCED == pic->profile) {
+        /* Clients may or may not leave the start code in */
+        if (size >= 4 && !data[0] && !data[1] && data[2] == 1) {
+            data += 4;
+            size -= 4;
+        }
+        size = vc1_unescape(decoder, data, size);
+        data = decoder->rbsp;
+    }
+    if (0 == size || slice_param->macroblock_offset >= size * 8)
+        return;
+
+    bitstream_init(&pic->bs, data, size, slice_param->macroblock_offset);
+    pic->first_row = first_row;
+    pic->esc3_level_length = 0;
+    pic->esc3_run_length = 0;
+    for (pic->mb_y = first_row; pic->mb_y < last_row; pic->mb_y++) {
+        for (pic->mb_x = 0; pic->mb_x < pic->mb_width; pic->mb_x++) {
+            pic->mb = &decoder->mbs[pic->mb_y * pic->mb_width + pic->mb_x];
+            pic->dst_y = pic->y + pic->mb_y * 16 * pic->stride + pic->mb_x * 16;
+            pic->dst_uv = pic->uv + pic->mb_y * 8 * pic->stride + pic->mb_x * 16;
+            switch (pic->type) {
+            case VC1_PICTURE_P:
+                status = vc1_decode_p_mb(pic);
+                break;
+            case VC1_PICTURE_B:
+                status = vc1_decode_b_mb(pic);
+                break;
+            default:
+                status = vc1_decode_i_mb(pic);
+                break;
+            }
+            if (status < 0 || bitstream_bits_left(&pic->bs) < 0)
+                return;
+        }
+    }
+}
+
+/* Sets pic up from the parameter buffers rendered into picture */
+static VAStatus
+vc1_init_picture(struct epiphany_driver_data *driver_data, const struct epiphany_picture *picture,
+                 object_surface_p obj_surface, struct vc1_picture *pic)
+{
+    static const int frame_tt[4] = { VC1_TT_8x8, VC1_TT_8x4, VC1_TT_4x8, VC1_TT_4x4 };
+    static const int intra_cs[3] = { VC1_CS_LOW_MOT_INTRA, VC1_CS_HIGH_MOT_INTRA, VC1_CS_MID_RATE_INTRA };
+    static const int inter_cs[3] = { VC1_CS_LOW_MOT_INTER, VC1_CS_HIGH_MOT_INTER, VC1_CS_MID_RATE_INTER };
+    const VAPictureParameterBufferVC1 *pic_param;
+    object_buffer_p obj_buffer;
+    int idx1, idx2;
+
+    obj_buffer = BUFFER(picture->pic_param);
+    if (NULL == obj_buffer || obj_buffer->element_size < sizeof(*pic_param) || NULL == obj_surface->storage)
+        return VA_STATUS_ERROR_INVALID_PARAMETER;
+    pic_param = obj_buffer->buffer_data;
+    if (pic_param->sequence_fields.bits.interlace || pic_param->picture_fields.bits.frame_coding_mode ||
+        pic_param->sequence_fields.bits.multires || pic_param->picture_resolution_index ||
+        pic_param->range_reduction_frame)
+        return VA_STATUS_ERROR_UNIMPLEMENTED;
+    if (pic_param->picture_fields.bits.picture_type > VC1_PICTURE_SKIPPED ||
+        pic_param->b_picture_fraction >= sizeof(vc1_bfraction))
+        return VA_STATUS_ERROR_INVALID_PARAMETER;
+
+    memset(pic, 0, sizeof(*pic));
+    pic->dsp = driver_data->vc1_dsp_ops;
+    pic->pic_param = pic_param;
+    pic->profile = pic_param->sequence_fields.bits.profile;
+    pic->type = pic_param->picture_fields.bits.picture_type;
+    pic->coded_width = pic_param->coded_width;
+    pic->coded_height = pic_param->coded_height;
+    pic->mb_width = (pic->coded_width + 15) / 16;
+    pic->mb_height = (pic->coded_height + 15) / 16;
+    pic->width = pic->mb_width * 16;
+    pic->height = pic->mb_height * 16;
+    if (0 == pic->mb_width || 0 == pic->mb_height ||
+        pic->width > obj_surface->storage->pitch || pic->height > obj_surface->storage->luma_height)
+        return VA_STATUS_ERROR_INVALID_PARAMETER;
+    pic->y = obj_surface->storage->data;
+    pic->uv = obj_surface->storage->data + obj_surface->storage->chroma_offset;
+    pic->stride = obj_surface->storage->pitch;
+    obj_buffer = BUFFER(picture->bit_plane);
+    if (obj_buffer && (size_t) obj_buffer->element_size * obj_buffer->num_elements >=
+        ((size_t) pic->mb_width * pic->mb_height + 1) / 2)
+        pic->bitplane = obj_buffer->buffer_data;
+
+    /* Nothing follows PTYPE in the picture layer of skipped pictures */
+    if (VC1_PICTURE_SKIPPED == pic->type)
+        return VA_STATUS_SUCCESS;
+
+    pic->pq = pic_param->pic_quantizer_fields.bits.pic_quantizer_scale;
+    pic->halfpq = pic_param->pic_quantizer_fields.bits.half_qp;
+    pic->uniform = pic_param->pic_quantizer_fields.bits.pic_quantizer_type;
+    /* With the implicit quantizer PQUANTIZER is PQINDEX <= 8, else PQUANT is PQINDEX */
+    pic->pqindex_low = pic_param->pic_quantizer_fields.bits.quantizer ? pic->pq <= 8 : pic->uniform;
+    if (0 == pic->pq)
+        return VA_STATUS_ERROR_INVALID_PARAMETER;
+    if (pic_param->pic_quantizer_fields.bits.dquant == 2) {
+        pic->dquantfrm = 1;
+        pic->dqprofile = VC1_DQPROFILE_FOUR_EDGES;
+    } else if (pic_param->pic_quantizer_fields.bits.dquant) {
+        pic->dquantfrm = pic_param->pic_quantizer_fields.bits.dq_frame;
+        pic->dqprofile = pic_param->pic_quantizer_fields.bits.dq_profile;
+    }
+    switch (pic->dqprofile) {
+    case VC1_DQPROFILE_SINGLE_EDGE:
+        pic->dqedges = 1 << pic_param->pic_quantizer_fields.bits.dq_sb_edge;
+        break;
+    case VC1_DQPROFILE_DOUBLE_EDGES:
+        pic->dqedges = (3 << pic_param->pic_quantizer_fields.bits.dq_db_edge) % 15;
+        break;
+    case VC1_DQPROFILE_FOUR_EDGES:
+        pic->dqedges = 15;
+        break;
+    }
+    pic->dqbilevel = pic_param->pic_quantizer_fields.bits.dq_binary_level;
+    pic->altpq = pic_param->pic_quantizer_fields.bits.alt_pic_quantizer;
+    pic->overlap = pic_param->sequence_fields.bits.overlap;
+    pic->condover = pic_param->conditional_overlap_flag;
+    pic->loop_filter = pic_param->entrypoint_fields.bits.loopfilter;
+
+    pic->mv_mode = pic_param->mv_fields.bits.mv_mode;
+    if (VC1_MV_INTENSITY_COMP == pic->mv_mode) {
+        pic->use_ic = 1;
+        pic->mv_mode = pic_param->mv_fields.bits.mv_mode2;
+    }
+    if (pic->mv_mode > VC1_MV_MIXED)
+        return VA_STATUS_ERROR_INVALID_PARAMETER;
+    pic->quarter_sample = pic->mv_mode != VC1_MV_1MV_HPEL && pic->mv_mode != VC1_MV_1MV_HPEL_BILINEAR;
+    pic->mspel = pic->mv_mode != VC1_MV_1MV_HPEL_BILINEAR;
+    pic->rnd = pic_param->rounding_control;
+    pic->fastuvmc = pic_param->fast_uvmc_flag;
+    pic->k_x = pic_param->mv_fields.bits.extended_mv_range + 9 + (pic_param->mv_fields.bits.extended_mv_range >> 1);
+    pic->k_y = pic_param->mv_fields.bits.extended_mv_range + 8;
+    pic->range_x = 1 << (pic->k_x - 1);
+    pic->range_y = 1 << (pic->k_y - 1);
+    pic->bfraction = vc1_bfraction[pic_param->b_picture_fraction];
+
+    pic->ttmbf = !pic_param->transform_fields.bits.variable_sized_transform_flag ||
+                 pic_param->transform_fields.bits.mb_level_transform_type_flag;
+    pic->ttfrm = pic_param->transform_fields.bits.variable_sized_transform_flag ?
+                 frame_tt[pic_param->transform_fields.bits.frame_level_transform_type] : VC1_TT_8x8;
+    pic->tt_index = pic->pq < 5 ? 0 : (pic->pq < 13 ? 1 : 2);
+    idx1 = pic_param->transform_fields.bits.transform_ac_codingset_idx1;
+    idx2 = pic_param->transform_fields.bits.transform_ac_codingset_idx2;
+    if (idx1 > 2 || idx2 > 2 || pic_param->cbp_table > 3 || pic_param->mv_fields.bits.mv_table > 3)
+        return VA_STATUS_ERROR_INVALID_PARAMETER;
+    if (VC1_PICTURE_I == pic->type || VC1_PICTURE_BI == pic->type)
+        pic->codingset = idx2 || !pic->pqindex_low ? intra_cs[idx2] : VC1_CS_HIGH_RATE_INTRA;
+    else
+        pic->codingset = idx1 || !pic->pqindex_low ? intra_cs[idx1] : VC1_CS_HIGH_RATE_INTRA;
+    pic->codingset2 = idx1 || !pic->pqindex_low ? inter_cs[idx1] : VC1_CS_HIGH_RATE_INTER;
+    pic->dc_table = pic_param->transform_fields.bits.intra_transform_dc_table;
+    pic->cbpcy_vlc = &vc1_cbpcy_p_vlc[pic_param->cbp_table];
+    pic->mv_vlc = &vc1_mv_vlc[pic_param->mv_fields.bits.mv_table];
+    return VA_STATUS_SUCCESS;
+}
+
+/* Skipped P pictures repeat their reference */
+static void
+vc1_copy_reference(struct vc1_picture *pic)
+{
+    int j;
+
+    if (pic->refs[0].y == pic->y)
+        return;
+    for (j = 0; j < pic->height; j++)
+        memcpy(pic->y + j * pic->stride, pic->refs[0].y + j * pic->stride, pic->width);
+    for (j = 0; j < pic->height / 2; j++)
+        memcpy(pic->uv + j * pic->stride, pic->refs[0].uv + j * pic->stride, pic->width);
+}
+
+VAStatus
+epiphany_vc1_decode_picture(struct epiphany_driver_data *driver_data,
+                            object_context_p obj_context,
+                            const struct epiphany_picture *picture,
+                            object_surface_p obj_surface)
+{
+    struct epiphany_vc1_decoder *decoder = obj_context->decoder;
+    const VAPictureParameterBufferVC1 *pic_param;
+    VASurfaceID surface = obj_surface->base.id;
+    struct vc1_picture *pic;
+    struct vc1_frame *frame;
+    size_t num_mbs;
+    VAStatus vaStatus;
+    int i, j;
+
+    if (pthread_once(&vc1_tables_once, vc1_init_tables) || vc1_tables_status)
+        return VA_STATUS_ERROR_OPERATION_FAILED;
+
+    /* Too big for the stack of client threads */
+    pic = malloc(sizeof(*pic));
+    if (NULL == pic)
+        return VA_STATUS_ERROR_ALLOCATION_FAILED;
+    vaStatus = vc1_init_picture(driver_data, picture, obj_surface, pic);
+    if (VA_STATUS_SUCCESS != vaStatus)
+        goto out;
+    pic_param = pic->pic_param;
+
+    if (NULL == decoder) {
+        decoder = vc1_create_decoder();
+        if (NULL == decoder) {
+            vaStatus = VA_STATUS_ERROR_ALLOCATION_FAILED;
+            goto out;
+        }
+        obj_context->decoder = decoder;
+    }
+    if (vc1_resize_decoder(decoder, pic->mb_width, pic->mb_height) < 0 ||
+        NULL == (frame = vc1_claim_frame(decoder, pic_param, surface))) {
+        vaStatus = VA_STATUS_ERROR_ALLOCATION_FAILED;
+        goto out;
+    }
+    pic->decoder = decoder;
+    pic->motion = frame->motion;
+    num_mbs = (size_t) pic->mb_width * pic->mb_height;
+    memset(pic->motion, 0, num_mbs * sizeof(*pic->motion));
+
+    vc1_lookup_reference(driver_data, pic, pic_param->forward_reference_picture, &pic->refs[0]);
+    vc1_lookup_reference(driver_data, pic, pic_param->backward_reference_picture, &pic->refs[1]);
+    if (VC1_PICTURE_SKIPPED == pic->type) {
+        vc1_copy_reference(pic);
+        goto out;
+    }
+    if (VC1_PICTURE_B == pic->type) {
+        struct vc1_frame *col = vc1_find_frame(decoder, pic_param->backward_reference_picture);
+
+        if (col && col != frame)
+            pic->col_motion = (const int16_t (*)[2]) col->motion;
+    }
+
+    /* B pictures see the intensity compensation of the P picture after them */
+    if (VC1_PICTURE_P == pic->type && pic->use_ic) {
+        vc1_init_intensity_compensation(decoder, pic_param->luma_scale, pic_param->luma_shift);
+        decoder->ic_source = pic_param->forward_reference_picture;
+        decoder->ic_target = surface;
+    } else if (VC1_PICTURE_P == pic->type || VC1_PICTURE_I == pic->type) {
+        decoder->ic_source = VA_INVALID_SURFACE;
+        decoder->ic_target = VA_INVALID_SURFACE;
+    }
+    if ((VC1_PICTURE_P == pic->type && pic->use_ic) ||
+        (VC1_PICTURE_B == pic->type && VA_INVALID_SURFACE != decoder->ic_source &&
+         pic_param->forward_reference_picture == decoder->ic_source &&
+         pic_param->backward_reference_picture == decoder->ic_target)) {
+        if (vc1_compensate_reference(pic) < 0) {
+            vaStatus = VA_STATUS_ERROR_ALLOCATION_FAILED;
+            goto out;
+        }
+    }
+
+    memset(decoder->mbs, 0, num_mbs * sizeof(*decoder->mbs));
+    memset(decoder->blocks, 0, 6 * num_mbs * sizeof(*decoder->blocks));
+    memset(decoder->slice_start, 0, pic->mb_height);
+    for (i = 0; i < picture->slice_params.num_buffers; i++) {
+        object_buffer_p obj_params = BUFFER(picture->slice_params.buffers[i]);
+
+        if (NULL == obj_params || obj_params->element_size < sizeof(VASliceParameterBufferVC1))
+            continue;
+        for (j = 0; j < obj_params->num_elements; j++) {
+            const VASliceParameterBufferVC1 *slice_param = (const VASliceParameterBufferVC1 *)
+                ((const uint8_t *) obj_params->buffer_data + (size_t) j * obj_params->element_size);
+
+            if (slice_param->slice_vertical_position < (unsigned int) pic->mb_height)
+                decoder->slice_start[slice_param->slice_vertical_position] = 1;
+        }
+    }
+
+    /* Slice parameter buffers pair up with the slice data buffers in order */
+    for (i = 0; i < picture->slice_params.num_buffers && i < picture->slice_data.num_buffers; i++) {
+        object_buffer_p obj_params = BUFFER(picture->slice_params.buffers[i]);
+        object_buffer_p obj_data = BUFFER(picture->slice_data.buffers[i]);
+        size_t data_size;
+
+        if (NULL == obj_params || NULL == obj_data ||
+            obj_params->element_size < sizeof(VASliceParameterBufferVC1))
+            continue;
+        data_size = (size_t) obj_data->element_size * obj_data->num_elements;
+        for (j = 0; j < obj_params->num_elements; j++) {
+            const VASliceParameterBufferVC1 *slice_param = (const VASliceParameterBufferVC1 *)
+                ((const uint8_t *) obj_params->buffer_data + (size_t) j * obj_params->element_size);
+
+            if (slice_param->slice_data_offset > data_size ||
+                slice_param->slice_data_size > data_size - slice_param->slice_data_offset)
+                continue;
+            vc1_decode_slice(pic, slice_param, obj_data->buffer_data);
+        }
+    }
+    if (VC1_PICTURE_B != pic->type)
+        vc1_overlap_picture(pic);
+    vc1_put_intra_blocks(pic);
+    if (pic->loop_filter)
+        vc1_loop_filter_picture(pic);
+
+out:
+    free(pic);
+    return vaStatus;
+}
@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2012 Scott Tincman <sctincman@gmail.com>. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef H264_CABAC_H
+#define H264_CABAC_H
+
+#include <stdint.h>
+#include "bitstream.h"
+
+/*
+ * The CABAC arithmetic decoding engine of H.264 (9.3.1.2 and 9.3.3.2).
+ * Renormalization reads the bits it shifts in straight from the slice
+ * data, so the bitstream position is exact, as I_PCM samples need.
+ */
+
+/* Contexts of frame macroblocks in 4:2:0, ctxIdx 0 to 459 */
+#define H264_CABAC_CONTEXTS     460
+
+struct h264_cabac {
+    struct bitstream *bs;
+    uint32_t range;             /* codIRange */
+    uint32_t offset;            /* codIOffset */
+    uint8_t state[H264_CABAC_CONTEXTS];     /* pStateIdx << 1 | valMPS */
+};
+
+extern const uint8_t h264_cabac_lps_range[64][4];
+extern const uint8_t h264_cabac_lps_next[64];
+
+/* 9.3.1.1, the context variables for a slice */
+void
+h264_cabac_init_contexts(struct h264_cabac *cabac, int intra_slice, int cabac_init_idc, int qp);
+
+/* 9.3.1.2, starting at a byte aligned position of bs */
+static inline void
+h264_cabac_init_engine(struct h264_cabac *cabac, struct bitstream *bs)
+{
+    cabac->bs = bs;
+    cabac->range = 510;
+    cabac->offset = bitstream_get_bits(bs, 9);
+}
+
+static inline void
+h264_cabac_renorm(struct h264_cabac *cabac)
+{
+    if (cabac->range < 256) {
+        int n = __builtin_clz(cabac->range) - 23;
+
+        cabac->range <<= n;
+        cabac->offset = (cabac->offset << n) | bitstream_get_bits(cabac->bs, n);
+    }
+}
+
+/* 9.3.3.2.1, DecodeDecision with context ctx */
+static inline int
+h264_cabac_decode(struct h264_cabac *cabac, int ctx)
+{
+    uint8_t *state = &cabac->state[ctx];
+    int s = *state >> 1, mps = *state & 1;
+    uint32_t lps = h264_cabac_lps_range[s][(cabac->range >> 6) & 3];
+    int bin;
+
+    cabac->range -= lps;
+    if (cabac->offset >= cabac->range) {
+        bin = !mps;
+        cabac->offset -= cabac->range;
+        cabac->range = lps;
+        *state = h264_cabac_lps_next[s] << 1 | (s == 0 ? !mps : mps);
+    } else {
+        bin = mps;
+        if (s < 62)
+            *state += 2;
+    }
+    h264_cabac_renorm(cabac);
+    return bin;
+}
+
+/* 9.3.3.2.3, DecodeBypass */
+static inline int
+h264_cabac_bypass(struct h264_cabac *cabac)
+{
+    cabac->offset = (cabac->offset << 1) | bitstream_get_bit(cabac->bs);
+    if (cabac->offset >= cabac->range) {
+        cabac->offset -= cabac->range;
+        return 1;
+    }
+    return 0;
+}
+
+/* 9.3.3.2.2, DecodeTerminate */
+static inline int
+h264_cabac_terminate(struct h264_cabac *cabac)
+{
+    cabac->range -= 2;
+    if (cabac->offset >= cabac->range)
+        return 1;
+    h264_cabac_renorm(cabac);
+    return 0;
+}
+
+#endif /* H264_CABAC_H */
@@ -0,0 +1,886 @@
+/*
+ * Copyright (c) 2012 Scott Tincman <sctincman@gmail.com>. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "config.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "h264_dsp.h"
+
+static inline uint8_t
+clip_u8(int value)
+{
+    return value < 0 ? 0 : (value > 255 ? 255 : value);
+}
+
+static inline int
+clip3(int low, int high, int value)
+{
+    return value < low ? low : (value > high ? high : value);
+}
+
+/* 8.5.12.2, one 4 point pass over values step apart */
+static inline void
+idct4_1d(int *x, int step)
+{
+    int e = x[0] + x[2 * step];
+    int f = x[0] - x[2 * step];
+    int g = (x[step] >> 1) - x[3 * step];
+    int h = x[step] + (x[3 * step] >> 1);
+
+    x[0] = e + h;
+    x[step] = f + g;
+    x[2 * step] = f - g;
+    x[3 * step] = e - h;
+}
+
+static void
+idct4_add_step(uint8_t *dst, ptrdiff_t stride, int step, int16_t *block)
+{
+    int x[16], i, j;
+
+    for (i = 0; i < 16; i++)
+        x[i] = block[i];
+    for (i = 0; i < 4; i++)
+        idct4_1d(x + 4 * i, 1);
+    for (i = 0; i < 4; i++)
+        idct4_1d(x + i, 4);
+    for (j = 0; j < 4; j++) {
+        for (i = 0; i < 4; i++)
+            dst[i * step] = clip_u8(dst[i * step] + ((x[4 * j + i] + 32) >> 6));
+        dst += stride;
+    }
+    memset(block, 0, 16 * sizeof(*block));
+}
+
+static void
+idct4_add_c(uint8_t *dst, ptrdiff_t stride, int16_t *block)
+{
+    idct4_add_step(dst, stride, 1, block);
+}
+
+static void
+idct4_add_uv_c(uint8_t *dst, ptrdiff_t stride, int16_t *block)
+{
+    idct4_add_step(dst, stride, 2, block);
+}
+
+/* 8.5.13.2, one 8 point pass */
+static inline void
+idct8_1d(int *x, int step)
+{
+    int d0 = x[0], d1 = x[step], d2 = x[2 * step], d3 = x[3 * step];
+    int d4 = x[4 * step], d5 = x[5 * step], d6 = x[6 * step], d7 = x[7 * step];
+    int a0 = d0 + d4, a4 = d0 - d4;
+    int a2 = (d2 >> 1) - d6, a6 = d2 + (d6 >> 1);
+    int b0 = a0 + a6, b2 = a4 + a2, b4 = a4 - a2, b6 = a0 - a6;
+    int a1 = -d3 + d5 - d7 - (d7 >> 1);
+    int a3 = d1 + d7 - d3 - (d3 >> 1);
+    int a5 = -d1 + d7 + d5 + (d5 >> 1);
+    int a7 = d3 + d5 + d1 + (d1 >> 1);
+    int b1 = a1 + (a7 >> 2), b7 = a7 - (a1 >> 2);
+    int b3 = a3 + (a5 >> 2), b5 = (a3 >> 2) - a5;
+
+    x[0] = b0 + b7;
+    x[step] = b2 + b5;
+    x[2 * step] = b4 + b3;
+    x[3 * step] = b6 + b1;
+    x[4 * step] = b6 - b1;
+    x[5 * step] = b4 - b3;
+    x[6 * step] = b2 - b5;
+    x[7 * step] = b0 - b7;
+}
+
+static void
+idct8_add_c(uint8_t *dst, ptrdiff_t stride, int16_t *block)
+{
+    int x[64], i, j;
+
+    for (i = 0; i < 64; i++)
+        x[i] = block[i];
+    for (i = 0; i < 8; i++)
+        idct8_1d(x + 8 * i, 1);
+    for (i = 0; i < 8; i++)
+        idct8_1d(x + i, 8);
+    for (j = 0; j < 8; j++) {
+        for (i = 0; i < 8; i++)
+            dst[i] = clip_u8(dst[i] + ((x[8 * j + i] + 32) >> 6));
+        dst += stride;
+    }
+    memset(block, 0, 64 * sizeof(*block));
+}
+
+/*
+ * Directional prediction of an n x n block shared by the 4x4 and 8x8
+ * modes (8.3.1.2 and 8.3.2.2), from the top samples t[-1..2n-1] and the
+ * left ones l[-1..n-1], t[-1] and l[-1] both being the corner.
+ */
+static void
+pred_directional(uint8_t *dst, ptrdiff_t stride, const int *t, const int *l, int n, int mode)
+{
+    int x, y, z, v;
+
+    for (y = 0; y < n; y++) {
+        for (x = 0; x < n; x++) {
+            switch (mode) {
+            case 3:     /* Diagonal_Down_Left */
+                if (x == n - 1 && y == n - 1)
+                    v = (t[2 * n - 2] + 3 * t[2 * n - 1] + 2) >> 2;
+                else
+                    v = (t[x + y] + 2 * t[x + y + 1] + t[x + y + 2] + 2) >> 2;
+                break;
+            case 4:     /* Diagonal_Down_Right */
+                if (x > y)
+                    v = (t[x - y - 2] + 2 * t[x - y - 1] + t[x - y] + 2) >> 2;
+                else if (x < y)
+                    v = (l[y - x - 2] + 2 * l[y - x - 1] + l[y - x] + 2) >> 2;
+                else
+                    v = (t[0] + 2 * t[-1] + l[0] + 2) >> 2;
+                break;
+            case 5:     /* Vertical_Right */
+                z = 2 * x - y;
+                if (z >= 0 && !(z & 1))
+                    v = (t[x - (y >> 1) - 1] + t[x - (y >> 1)] + 1) >> 1;
+                else if (z > 0)
+                    v = (t[x - (y >> 1) - 2] + 2 * t[x - (y >> 1) - 1] + t[x - (y >> 1)] + 2) >> 2;
+                else if (z == -1)
+                    v = (l[0] + 2 * l[-1] + t[0] + 2) >> 2;
+                else
+                    v = (l[y - 2 * x - 1] + 2 * l[y - 2 * x - 2] + l[y - 2 * x - 3] + 2) >> 2;
+                break;
+            case 6:     /* Horizontal_Down */
+                z = 2 * y - x;
+                if (z >= 0 && !(z & 1))
+                    v = (l[y - (x >> 1) - 1] + l[y - (x >> 1)] + 1) >> 1;
+                else if (z > 0)
+                    v = (l[y - (x >> 1) - 2] + 2 * l[y - (x >> 1) - 1] + l[y - (x >> 1)] + 2) >> 2;
+                else if (z == -1)
+                    v = (l[0] + 2 * l[-1] + t[0] + 2) >> 2;
+                else
+                    v = (t[x - 2 * y - 1] + 2 * t[x - 2 * y - 2] + t[x - 2 * y - 3] + 2) >> 2;
+                break;
+            case 7:     /* Vertical_Left */
+                if (!(y & 1))
+                    v = (t[x + (y >> 1)] + t[x + (y >> 1) + 1] + 1) >> 1;
+                else
+                    v = (t[x + (y >> 1)] + 2 * t[x + (y >> 1) + 1] + t[x + (y >> 1) + 2] + 2) >> 2;
+                break;
+            default:    /* Horizontal_Up */
+                z = x + 2 * y;
+                if (z < 2 * n - 3 && !(z & 1))
+                    v = (l[y + (x >> 1)] + l[y + (x >> 1) + 1] + 1) >> 1;
+                else if (z < 2 * n - 3)
+                    v = (l[y + (x >> 1)] + 2 * l[y + (x >> 1) + 1] + l[y + (x >> 1) + 2] + 2) >> 2;
+                else if (z == 2 * n - 3)
+                    v = (l[n - 2] + 3 * l[n - 1] + 2) >> 2;
+                else
+                    v = l[n - 1];
+                break;
+            }
+            dst[y * stride + x] = v;
+        }
+    }
+}
+
+/* Vertical, Horizontal and DC prediction of an n x n block from t and l */
+static void
+pred_flat(uint8_t *dst, ptrdiff_t stride, const int *t, const int *l, int n, int mode, int avail)
+{
+    int x, y, dc = 0;
+
+    if (mode == 2) {
+        if ((avail & (H264_AVAIL_LEFT | H264_AVAIL_TOP)) == (H264_AVAIL_LEFT | H264_AVAIL_TOP)) {
+            for (x = 0; x < n; x++)
+                dc += t[x] + l[x];
+            dc = (dc + n) / (2 * n);
+        } else if (avail & (H264_AVAIL_LEFT | H264_AVAIL_TOP)) {
+            const int *e = avail & H264_AVAIL_LEFT ? l : t;
+
+            for (x = 0; x < n; x++)
+                dc += e[x];
+            dc = (dc + n / 2) / n;
+        } else {
+            dc = 128;
+        }
+    }
+    for (y = 0; y < n; y++) {
+        for (x = 0; x < n; x++)
+            dst[y * stride + x] = mode == 0 ? t[x] : (mode == 1 ? l[y] : dc);
+    }
+}
+
+/* Gathers the neighbours of an n x n block, missing ones repeat the last available */
+static void
+pred_edges(const uint8_t *dst, ptrdiff_t stride, int n, int avail, int *t, int *l)
+{
+    int i;
+
+    for (i = -1; i < 2 * n; i++)
+        t[i] = 128;
+    for (i = 0; i < n; i++)
+        l[i] = 128;
+    if (avail & H264_AVAIL_TOP) {
+        for (i = 0; i < n; i++)
+            t[i] = dst[i - stride];
+        for (i = n; i < 2 * n; i++)
+            t[i] = avail & H264_AVAIL_TOP_RIGHT ? dst[i - stride] : t[n - 1];
+    }
+    if (avail & H264_AVAIL_LEFT) {
+        for (i = 0; i < n; i++)
+            l[i] = dst[i * stride - 1];
+    }
+    if (avail & H264_AVAIL_TOP_LEFT)
+        t[-1] = dst[-stride - 1];
+    l[-1] = t[-1];
+}
+
+static void
+pred4x4_c(uint8_t *dst, ptrdiff_t stride, int avail, int mode)
+{
+    int top[9], left[5];
+
+    pred_edges(dst, stride, 4, avail, top + 1, left + 1);
+    if (mode <= 2)
+        pred_flat(dst, stride, top + 1, left + 1, 4, mode, avail);
+    else
+        pred_directional(dst, stride, top + 1, left + 1, 4, mode);
+}
+
+/* 8.3.2.2.1, the neighbours of 8x8 blocks are low pass filtered first */
+static void
+pred8x8_c(uint8_t *dst, ptrdiff_t stride, int avail, int mode)
+{
+    int top[17], left[9], ft[17], fl[9];
+    int *t = top + 1, *l = left + 1;
+    int i;
+
+    pred_edges(dst, stride, 8, avail, t, l);
+    memcpy(ft, top, sizeof(ft));
+    memcpy(fl, left, sizeof(fl));
+    if (avail & H264_AVAIL_TOP) {
+        if (avail & H264_AVAIL_TOP_LEFT)
+            ft[1] = (t[-1] + 2 * t[0] + t[1] + 2) >> 2;
+        else
+            ft[1] = (3 * t[0] + t[1] + 2) >> 2;
+        for (i = 1; i < 15; i++)
+            ft[i + 1] = (t[i - 1] + 2 * t[i] + t[i + 1] + 2) >> 2;
+        ft[16] = (t[14] + 3 * t[15] + 2) >> 2;
+    }
+    if (avail & H264_AVAIL_TOP_LEFT) {
+        if ((avail & (H264_AVAIL_TOP | H264_AVAIL_LEFT)) == (H264_AVAIL_TOP | H264_AVAIL_LEFT))
+            ft[0] = (t[0] + 2 * t[-1] + l[0] + 2) >> 2;
+        else if (avail & H264_AVAIL_TOP)
+            ft[0] = (3 * t[-1] + t[0] + 2) >> 2;
+        else if (avail & H264_AVAIL_LEFT)
+            ft[0] = (3 * t[-1] + l[0] + 2) >> 2;
+        fl[0] = ft[0];
+    }
+    if (avail & H264_AVAIL_LEFT) {
+        if (avail & H264_AVAIL_TOP_LEFT)
+            fl[1] = (l[-1] + 2 * l[0] + l[1] + 2) >> 2;
+        else
+            fl[1] = (3 * l[0] + l[1] + 2) >> 2;
+        for (i = 1; i < 7; i++)
+            fl[i + 1] = (l[i - 1] + 2 * l[i] + l[i + 1] + 2) >> 2;
+        fl[8] = (l[6] + 3 * l[7] + 2) >> 2;
+    }
+    if (mode <= 2)
+        pred_flat(dst, stride, ft + 1, fl + 1, 8, mode, avail);
+    else
+        pred_directional(dst, stride, ft + 1, fl + 1, 8, mode);
+}
+
+#define PRED_MODES(size)                                                        \
+static void pred##size##_0_c(uint8_t *d, ptrdiff_t s, int a) { pred##size##_c(d, s, a, 0); } \
+static void pred##size##_1_c(uint8_t *d, ptrdiff_t s, int a) { pred##size##_c(d, s, a, 1); } \
+static void pred##size##_2_c(uint8_t *d, ptrdiff_t s, int a) { pred##size##_c(d, s, a, 2); } \
+static void pred##size##_3_c(uint8_t *d, ptrdiff_t s, int a) { pred##size##_c(d, s, a, 3); } \
+static void pred##size##_4_c(uint8_t *d, ptrdiff_t s, int a) { pred##size##_c(d, s, a, 4); } \
+static void pred##size##_5_c(uint8_t *d, ptrdiff_t s, int a) { pred##size##_c(d, s, a, 5); } \
+static void pred##size##_6_c(uint8_t *d, ptrdiff_t s, int a) { pred##size##_c(d, s, a, 6); } \
+static void pred##size##_7_c(uint8_t *d, ptrdiff_t s, int a) { pred##size##_c(d, s, a, 7); } \
+static void pred##size##_8_c(uint8_t *d, ptrdiff_t s, int a) { pred##size##_c(d, s, a, 8); }
+
+PRED_MODES(4x4)
+PRED_MODES(8x8)
+
+static void
+pred16x16_v_c(uint8_t *dst, ptrdiff_t stride, int avail)
+{
+    int y;
+
+    for (y = 0; y < 16; y++)
+        memcpy(dst + y * stride, dst - stride, 16);
+}
+
+static void
+pred16x16_h_c(uint8_t *dst, ptrdiff_t stride, int avail)
+{
+    int y;
+
+    for (y = 0; y < 16; y++)
+        memset(dst + y * stride, dst[y * stride - 1], 16);
+}
+
+static void
+pred16x16_dc_c(uint8_t *dst, ptrdiff_t stride, int avail)
+{
+    int i, dc = 0;
+
+    if (avail & H264_AVAIL_TOP) {
+        for (i = 0; i < 16; i++)
+            dc += dst[i - stride];
+    }
+    if (avail & H264_AVAIL_LEFT) {
+        for (i = 0; i < 16; i++)
+            dc += dst[i * stride - 1];
+    }
+    if ((avail & (H264_AVAIL_LEFT | H264_AVAIL_TOP)) == (H264_AVAIL_LEFT | H264_AVAIL_TOP))
+        dc = (dc + 16) >> 5;
+    else if (avail & (H264_AVAIL_LEFT | H264_AVAIL_TOP))
+        dc = (dc + 8) >> 4;
+    else
+        dc = 128;
+    for (i = 0; i < 16; i++)
+        memset(dst + i * stride, dc, 16);
+}
+
+/*
+ * Plane prediction of an n x n block of samples step bytes apart, with
+ * the gradient scale of 8.3.3.4 and 8.3.4.4
+ */
+static void
+pred_plane(uint8_t *dst, ptrdiff_t stride, int step, int n, int scale)
+{
+    const uint8_t *top = dst - stride;
+    int h = 0, v = 0, a, b, c, x, y;
+
+    for (x = 0; x < n / 2; x++) {
+        h += (x + 1) * (top[(n / 2 + x) * step] - top[(n / 2 - 2 - x) * step]);
+        v += (x + 1) * (dst[(n / 2 + x) * stride - step] - dst[(n / 2 - 2 - x) * stride - step]);
+    }
+    a = 16 * (dst[(n - 1) * stride - step] + top[(n - 1) * step]);
+    b = (scale * h + 32) >> 6;
+    c = (scale * v + 32) >> 6;
+    for (y = 0; y < n; y++) {
+        for (x = 0; x < n; x++)
+            dst[y * stride + x * step] = clip_u8((a + b * (x - n / 2 + 1) + c * (y - n / 2 + 1) + 16) >> 5);
+    }
+}
+
+static void
+pred16x16_plane_c(uint8_t *dst, ptrdiff_t stride, int avail)
+{
+    pred_plane(dst, stride, 1, 16, 5);
+}
+
+/* 8.3.4.1-3, each 4x4 chroma block has its own DC from the neighbours it touches */
+static void
+pred_chroma_dc_c(uint8_t *dst, ptrdiff_t stride, int avail)
+{
+    int c, i, bx, by;
+
+    for (c = 0; c < 2; c++) {
+        for (by = 0; by < 2; by++) {
+            for (bx = 0; bx < 2; bx++) {
+                uint8_t *block = dst + 4 * by * stride + 8 * bx + c;
+                const uint8_t *above = dst - stride + 8 * bx + c;
+                int top = 0, left = 0, dc;
+                int use_top = avail & H264_AVAIL_TOP, use_left = avail & H264_AVAIL_LEFT;
+
+                for (i = 0; i < 4; i++) {
+                    if (use_top)
+                        top += above[2 * i];
+                    if (use_left)
+                        left += block[i * stride - 2 - 8 * bx];
+                }
+                /* The off diagonal blocks prefer the edge they lie along */
+                if (bx != by && use_top && use_left) {
+                    if (bx)
+                        use_left = 0;
+                    else
+                        use_top = 0;
+                }
+                if (use_top && use_left)
+                    dc = (top + left + 4) >> 3;
+                else if (use_top)
+                    dc = (top + 2) >> 2;
+                else if (use_left)
+                    dc = (left + 2) >> 2;
+                else
+                    dc = 128;
+                for (i = 0; i < 16; i++)
+                    block[(i >> 2) * stride + 2 * (i & 3)] = dc;
+            }
+        }
+    }
+}
+
+static void
+pred_chroma_h_c(uint8_t *dst, ptrdiff_t stride, int avail)
+{
+    int x, y;
+
+    for (y = 0; y < 8; y++) {
+        for (x = 0; x < 16; x++)
+            dst[y * stride + x] = dst[y * stride - 2 + (x & 1)];
+    }
+}
+
+static void
+pred_chroma_v_c(uint8_t *dst, ptrdiff_t stride, int avail)
+{
+    int y;
+
+    for (y = 0; y < 8; y++)
+        memcpy(dst + y * stride, dst - stride, 16);
+}
+
+static void
+pred_chroma_plane_c(uint8_t *dst, ptrdiff_t stride, int avail)
+{
+    pred_plane(dst, stride, 2, 8, 34);
+    pred_plane(dst + 1, stride, 2, 8, 34);
+}
+
+/* 8.4.2.2.1, the half sample 6 tap filter over values step apart */
+static inline int
+tap6(const uint8_t *p, ptrdiff_t step)
+{
+    return p[-2 * step] - 5 * (p[-step] + p[2 * step]) + 20 * (p[0] + p[step]) + p[3 * step];
+}
+
+/*
+ * Luma sample interpolation, the full, horizontal half, vertical half and
+ * centre sample planes are built first and the quarter samples average
+ * two of them as in table 8-12
+ */
+static inline void
+put_qpel_c(uint8_t *dst, ptrdiff_t dst_stride, const uint8_t *src, ptrdiff_t src_stride,
+           int width, int height, int mx, int my)
+{
+    uint8_t g[17][17], b[17][16], h[16][17], j[16][16];
+    int raw[21][16];
+    const uint8_t *p, *q;
+    ptrdiff_t q_stride;
+    int x, y, dx, dy;
+
+    for (y = 0; y <= height; y++) {
+        for (x = 0; x <= width; x++)
+            g[y][x] = src[y * src_stride + x];
+    }
+    for (y = -2; y < height + 3; y++) {
+        for (x = 0; x < width; x++)
+            raw[y + 2][x] = tap6(src + y * src_stride + x, 1);
+    }
+    for (y = 0; y <= height; y++) {
+        for (x = 0; x < width; x++)
+            b[y][x] = clip_u8((raw[y + 2][x] + 16) >> 5);
+    }
+    for (y = 0; y < height; y++) {
+        for (x = 0; x <= width; x++)
+            h[y][x] = clip_u8((tap6(src + y * src_stride + x, src_stride) + 16) >> 5);
+        for (x = 0; x < width; x++)
+            j[y][x] = clip_u8((raw[y][x] - 5 * (raw[y + 1][x] + raw[y + 4][x]) +
+                               20 * (raw[y + 2][x] + raw[y + 3][x]) + raw[y + 5][x] + 512) >> 10);
+    }
+
+    /* First plane of the pair */
+    switch ((my << 2) | mx) {
+    case 0: case 1: case 4: p = &g[0][0]; dx = 17; break;
+    case 3: p = &g[0][1]; dx = 17; break;
+    case 12: p = &g[1][0]; dx = 17; break;
+    case 2: case 5: case 6: case 7: p = &b[0][0]; dx = 16; break;
+    case 13: case 14: case 15: p = &b[1][0]; dx = 16; break;
+    case 8: case 9: p = &h[0][0]; dx = 17; break;
+    case 11: p = &h[0][1]; dx = 17; break;
+    default: p = &j[0][0]; dx = 16; break;   /* 10 */
+    }
+    /* Second one, NULL if the position is on a plane */
+    switch ((my << 2) | mx) {
+    case 1: case 3: q = &b[0][0]; dy = 16; break;
+    case 4: case 12: case 5: case 13: q = &h[0][0]; dy = 17; break;
+    case 7: case 15: q = &h[0][1]; dy = 17; break;
+    case 6: case 9: case 11: case 14: q = &j[0][0]; dy = 16; break;
+    default: q = NULL; dy = 0; break;
+    }
+    q_stride = dy;
+    for (y = 0; y < height; y++) {
+        for (x = 0; x < width; x++)
+            dst[x] = q ? (p[y * dx + x] + q[y * q_stride + x] + 1) >> 1 : p[y * dx + x];
+        dst += dst_stride;
+    }
+}
+
+#define QPEL_C(width, name, mx, my)                                             \
+static void                                                                     \
+put_qpel##name##_##mx##my##_c(uint8_t *dst, ptrdiff_t dst_stride,               \
+                              const uint8_t *src, ptrdiff_t src_stride, int height) \
+{                                                                               \
+    put_qpel_c(dst, dst_stride, src, src_stride, width, height, mx, my);        \
+}
+
+#define QPEL_C_ALL(width, name)                                                 \
+    QPEL_C(width, name, 0, 0) QPEL_C(width, name, 1, 0)                         \
+    QPEL_C(width, name, 2, 0) QPEL_C(width, name, 3, 0)                         \
+    QPEL_C(width, name, 0, 1) QPEL_C(width, name, 1, 1)                         \
+    QPEL_C(width, name, 2, 1) QPEL_C(width, name, 3, 1)                         \
+    QPEL_C(width, name, 0, 2) QPEL_C(width, name, 1, 2)                         \
+    QPEL_C(width, name, 2, 2) QPEL_C(width, name, 3, 2)                         \
+    QPEL_C(width, name, 0, 3) QPEL_C(width, name, 1, 3)                         \
+    QPEL_C(width, name, 2, 3) QPEL_C(width, name, 3, 3)
+
+QPEL_C_ALL(16, 16)
+QPEL_C_ALL(8, 8)
+QPEL_C_ALL(4, 4)
+
+#define QPEL_TABLE(name, suffix) {                                              \
+    put_qpel##name##_00_##suffix, put_qpel##name##_10_##suffix,                 \
+    put_qpel##name##_20_##suffix, put_qpel##name##_30_##suffix,                 \
+    put_qpel##name##_01_##suffix, put_qpel##name##_11_##suffix,                 \
+    put_qpel##name##_21_##suffix, put_qpel##name##_31_##suffix,                 \
+    put_qpel##name##_02_##suffix, put_qpel##name##_12_##suffix,                 \
+    put_qpel##name##_22_##suffix, put_qpel##name##_32_##suffix,                 \
+    put_qpel##name##_03_##suffix, put_qpel##name##_13_##suffix,                 \
+    put_qpel##name##_23_##suffix, put_qpel##name##_33_##suffix,                 \
+}
+
+/* 8.4.2.2.2, bilinear eighth sample chroma over the interleaved plane */
+static inline void
+put_chroma_c(uint8_t *dst, ptrdiff_t dst_stride, const uint8_t *src, ptrdiff_t src_stride,
+             int width, int height, int mx, int my)
+{
+    int a = (8 - mx) * (8 - my), b = mx * (8 - my), c = (8 - mx) * my, d = mx * my;
+    int x, y;
+
+    for (y = 0; y < height; y++) {
+        for (x = 0; x < 2 * width; x++)
+            dst[x] = (a * src[x] + b * src[x + 2] + c * src[x + src_stride] +
+                      d * src[x + src_stride + 2] + 32) >> 6;
+        dst += dst_stride;
+        src += src_stride;
+    }
+}
+
+static void
+put_chroma8_c(uint8_t *dst, ptrdiff_t dst_stride, const uint8_t *src, ptrdiff_t src_stride,
+              int height, int mx, int my)
+{
+    put_chroma_c(dst, dst_stride, src, src_stride, 8, height, mx, my);
+}
+
+static void
+put_chroma4_c(uint8_t *dst, ptrdiff_t dst_stride, const uint8_t *src, ptrdiff_t src_stride,
+              int height, int mx, int my)
+{
+    put_chroma_c(dst, dst_stride, src, src_stride, 4, height, mx, my);
+}
+
+static void
+put_chroma2_c(uint8_t *dst, ptrdiff_t dst_stride, const uint8_t *src, ptrdiff_t src_stride,
+              int height, int mx, int my)
+{
+    put_chroma_c(dst, dst_stride, src, src_stride, 2, height, mx, my);
+}
+
+static void
+avg_c(uint8_t *dst, ptrdiff_t dst_stride, const uint8_t *src, ptrdiff_t src_stride,
+      int width, int height)
+{
+    int x, y;
+
+    for (y = 0; y < height; y++) {
+        for (x = 0; x < width; x++)
+            dst[x] = (dst[x] + src[x] + 1) >> 1;
+        dst += dst_stride;
+        src += src_stride;
+    }
+}
+
+/* 8.4.2.3.2 */
+static void
+weight_c(uint8_t *dst, ptrdiff_t stride, int width, int height, int log2_denom,
+         const int *weight, const int *offset)
+{
+    int round = log2_denom ? 1 << (log2_denom - 1) : 0;
+    int x, y;
+
+    for (y = 0; y < height; y++) {
+        for (x = 0; x < width; x++)
+            dst[x] = clip_u8(((dst[x] * weight[x & 1] + round) >> log2_denom) + offset[x & 1]);
+        dst += stride;
+    }
+}
+
+static void
+biweight_c(uint8_t *dst, ptrdiff_t dst_stride, const uint8_t *src, ptrdiff_t src_stride,
+           int width, int height, int log2_denom, const int *weight0, const int *weight1,
+           const int *offset)
+{
+    int x, y;
+
+    for (y = 0; y < height; y++) {
+        for (x = 0; x < width; x++)
+            dst[x] = clip_u8(((dst[x] * weight0[x & 1] + src[x] * weight1[x & 1] +
+                               (1 << log2_denom)) >> (log2_denom + 1)) + offset[x & 1]);
+        dst += dst_stride;
+        src += src_stride;
+    }
+}
+
+/*
+ * 8.7.2.3 and 8.7.2.4 over count samples along an edge, xstride across it
+ * and ystride along it
+ */
+static inline void
+filter_edge_c(uint8_t *pix, ptrdiff_t xstride, ptrdiff_t ystride, int count,
+              int alpha, int beta, int tc0, int chroma)
+{
+    int i;
+
+    for (i = 0; i < count; i++, pix += ystride) {
+        int p0 = pix[-xstride], p1 = pix[-2 * xstride];
+        int q0 = pix[0], q1 = pix[xstride];
+        int tc, delta;
+
+        if (abs(p0 - q0) >= alpha || abs(p1 - p0) >= beta || abs(q1 - q0) >= beta)
+            continue;
+        if (chroma) {
+            tc = tc0 + 1;
+        } else {
+            int p2 = pix[-3 * xstride], q2 = pix[2 * xstride];
+            int ap = abs(p2 - p0) < beta, aq = abs(q2 - q0) < beta;
+
+            tc = tc0 + ap + aq;
+            if (ap)
+                pix[-2 * xstride] = p1 + clip3(-tc0, tc0, (p2 + ((p0 + q0 + 1) >> 1) - (p1 << 1)) >> 1);
+            if (aq)
+                pix[xstride] = q1 + clip3(-tc0, tc0, (q2 + ((p0 + q0 + 1) >> 1) - (q1 << 1)) >> 1);
+        }
+        delta = clip3(-tc, tc, (((q0 - p0) << 2) + (p1 - q1) + 4) >> 3);
+        pix[-xstride] = clip_u8(p0 + delta);
+        pix[0] = clip_u8(q0 - delta);
+    }
+}
+
+static inline void
+filter_edge_intra_c(uint8_t *pix, ptrdiff_t xstride, ptrdiff_t ystride, int count,
+                    int alpha, int beta, int chroma)
+{
+    int i;
+
+    for (i = 0; i < count; i++, pix += ystride) {
+        int p0 = pix[-xstride], p1 = pix[-2 * xstride];
+        int q0 = pix[0], q1 = pix[xstride];
+
+        if (abs(p0 - q0) >= alpha || abs(p1 - p0) >= beta || abs(q1 - q0) >= beta)
+            continue;
+        if (!chroma && abs(p0 - q0) < (alpha >> 2) + 2) {
+            int p2 = pix[-3 * xstride], q2 = pix[2 * xstride];
+
+            if (abs(p2 - p0) < beta) {
+                int p3 = pix[-4 * xstride];
+
+                pix[-xstride] = (p2 + 2 * p1 + 2 * p0 + 2 * q0 + q1 + 4) >> 3;
+                pix[-2 * xstride] = (p2 + p1 + p0 + q0 + 2) >> 2;
+                pix[-3 * xstride] = (2 * p3 + 3 * p2 + p1 + p0 + q0 + 4) >> 3;
+            } else {
+                pix[-xstride] = (2 * p1 + p0 + q1 + 2) >> 2;
+            }
+            if (abs(q2 - q0) < beta) {
+                int q3 = pix[3 * xstride];
+
+                pix[0] = (p1 + 2 * p0 + 2 * q0 + 2 * q1 + q2 + 4) >> 3;
+                pix[xstride] = (p0 + q0 + q1 + q2 + 2) >> 2;
+                pix[2 * xstride] = (2 * q3 + 3 * q2 + q1 + q0 + p0 + 4) >> 3;
+            } else {
+                pix[0] = (2 * q1 + q0 + p1 + 2) >> 2;
+            }
+        } else {
+            pix[-xstride] = (2 * p1 + p0 + q1 + 2) >> 2;
+            pix[0] = (2 * q1 + q0 + p1 + 2) >> 2;
+        }
+    }
+}
+
+static void
+luma_filter_v_c(uint8_t *pix, ptrdiff_t stride, int alpha, int beta, const int8_t *tc0)
+{
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        if (tc0[i] >= 0)
+            filter_edge_c(pix + 4 * i * stride, 1, stride, 4, alpha, beta, tc0[i], 0);
+    }
+}
+
+static void
+luma_filter_h_c(uint8_t *pix, ptrdiff_t stride, int alpha, int beta, const int8_t *tc0)
+{
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        if (tc0[i] >= 0)
+            filter_edge_c(pix + 4 * i, stride, 1, 4, alpha, beta, tc0[i], 0);
+    }
+}
+
+static void
+luma_filter_intra_v_c(uint8_t *pix, ptrdiff_t stride, int alpha, int beta)
+{
+    filter_edge_intra_c(pix, 1, stride, 16, alpha, beta, 0);
+}
+
+static void
+luma_filter_intra_h_c(uint8_t *pix, ptrdiff_t stride, int alpha, int beta)
+{
+    filter_edge_intra_c(pix, stride, 1, 16, alpha, beta, 0);
+}
+
+static void
+chroma_filter_v_c(uint8_t *pix, ptrdiff_t stride, const int *alpha, const int *beta,
+                  const int8_t (*tc0)[4])
+{
+    int c, i;
+
+    for (c = 0; c < 2; c++) {
+        for (i = 0; i < 4; i++) {
+            if (tc0[c][i] >= 0)
+                filter_edge_c(pix + c + 2 * i * stride, 2, stride, 2, alpha[c], beta[c], tc0[c][i], 1);
+        }
+    }
+}
+
+static void
+chroma_filter_h_c(uint8_t *pix, ptrdiff_t stride, const int *alpha, const int *beta,
+                  const int8_t (*tc0)[4])
+{
+    int c, i;
+
+    for (c = 0; c < 2; c++) {
+        for (i = 0; i < 4; i++) {
+            if (tc0[c][i] >= 0)
+                filter_edge_c(pix + c + 4 * i, stride, 2, 2, alpha[c], beta[c], tc0[c][i], 1);
+        }
+    }
+}
+
+static void
+chroma_filter_intra_v_c(uint8_t *pix, ptrdiff_t stride, const int *alpha, const int *beta)
+{
+    filter_edge_intra_c(pix, 2, stride, 8, alpha[0], beta[0], 1);
+    filter_edge_intra_c(pix + 1, 2, stride, 8, alpha[1], beta[1], 1);
+}
+
+static void
+chroma_filter_intra_h_c(uint8_t *pix, ptrdiff_t stride, const int *alpha, const int *beta)
+{
+    filter_edge_intra_c(pix, stride, 2, 8, alpha[0], beta[0], 1);
+    filter_edge_intra_c(pix + 1, stride, 2, 8, alpha[1], beta[1], 1);
+}
+
+const struct h264_dsp_ops h264_dsp_c = {
+    "c",
+    idct4_add_c,
+    idct8_add_c,
+    idct4_add_uv_c,
+    {
+        pred4x4_0_c, pred4x4_1_c, pred4x4_2_c, pred4x4_3_c, pred4x4_4_c,
+        pred4x4_5_c, pred4x4_6_c, pred4x4_7_c, pred4x4_8_c,
+    },
+    {
+        pred8x8_0_c, pred8x8_1_c, pred8x8_2_c, pred8x8_3_c, pred8x8_4_c,
+        pred8x8_5_c, pred8x8_6_c, pred8x8_7_c, pred8x8_8_c,
+    },
+    { pred16x16_v_c, pred16x16_h_c, pred16x16_dc_c, pred16x16_plane_c },
+    { pred_chroma_dc_c, pred_chroma_h_c, pred_chroma_v_c, pred_chroma_plane_c },
+    {
+        QPEL_TABLE(16, c),
+        QPEL_TABLE(8, c),
+        QPEL_TABLE(4, c),
+    },
+    { put_chroma8_c, put_chroma4_c, put_chroma2_c },
+    avg_c,
+    weight_c,
+    biweight_c,
+    { luma_filter_v_c, luma_filter_h_c },
+    { luma_filter_intra_v_c, luma_filter_intra_h_c },
+    { chroma_filter_v_c, chroma_filter_h_c },
+    { chroma_filter_intra_v_c, chroma_filter_intra_h_c },
+};
+
+#if defined(__x86_64__) || defined(__i386__)
+static struct h264_dsp_ops h264_dsp_sse2;
+#endif
+static pthread_once_t h264_dsp_once = PTHREAD_ONCE_INIT;
+
+static void
+h264_dsp_init(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    h264_dsp_sse2 = h264_dsp_c;
+    h264_dsp_sse2.name = "sse2";
+    h264_dsp_init_sse2(&h264_dsp_sse2);
+#endif
+}
+
+/* Best first */
+static const struct h264_dsp_ops *const h264_dsp_all[] = {
+#if defined(__x86_64__) || defined(__i386__)
+    &h264_dsp_sse2,
+#endif
+    &h264_dsp_c,
+};
+
+static int
+h264_dsp_cpu_supports(const struct h264_dsp_ops *ops)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (ops == &h264_dsp_sse2)
+        return __builtin_cpu_supports("sse2");
+#endif
+    return 1;
+}
+
+const struct h264_dsp_ops *
+h264_dsp_get_ops(const char *name)
+{
+    unsigned int i;
+    const struct h264_dsp_ops *best = NULL;
+
+    pthread_once(&h264_dsp_once, h264_dsp_init);
+    for (i = 0; i < sizeof(h264_dsp_all) / sizeof(h264_dsp_all[0]); i++) {
+        const struct h264_dsp_ops *ops = h264_dsp_all[i];
+
+        if (!h264_dsp_cpu_supports(ops))
+            continue;
+        if (!best)
+            best = ops;
+        if (name && !strcmp(name, ops->name))
+            return ops;
+    }
+    return best;
+}
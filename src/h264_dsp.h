@@ -0,0 +1,153 @@
+/*
+ * Copyright (c) 2012 Scott Tincman <sctincman@gmail.com>. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef H264_DSP_H
+#define H264_DSP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Pixel kernels of the H.264 decoder: the 4x4 and 8x8 integer transforms,
+ * intra prediction, quarter sample motion compensation, weighted
+ * prediction and the deblocking filter. Chroma kernels work on the
+ * interleaved NV12 plane directly. As with the dsp ones there is a C
+ * version and SIMD versions picked at runtime that match it exactly.
+ */
+
+/* Block widths for the motion compensation tables */
+#define H264_MC_16      0
+#define H264_MC_8       1
+#define H264_MC_4       2
+
+/* Neighbours intra prediction may read, besides the samples it predicts */
+#define H264_AVAIL_LEFT         0x1
+#define H264_AVAIL_TOP          0x2
+#define H264_AVAIL_TOP_RIGHT    0x4
+#define H264_AVAIL_TOP_LEFT     0x8
+
+/* Intra_16x16 prediction modes */
+#define H264_PRED16_V           0
+#define H264_PRED16_H           1
+#define H264_PRED16_DC          2
+#define H264_PRED16_PLANE       3
+
+/* intra_chroma_pred_mode */
+#define H264_PRED_CHROMA_DC     0
+#define H264_PRED_CHROMA_H      1
+#define H264_PRED_CHROMA_V      2
+#define H264_PRED_CHROMA_PLANE  3
+
+typedef void (*h264_qpel_func)(uint8_t *dst, ptrdiff_t dst_stride,
+                               const uint8_t *src, ptrdiff_t src_stride, int height);
+typedef void (*h264_chroma_mc_func)(uint8_t *dst, ptrdiff_t dst_stride,
+                                    const uint8_t *src, ptrdiff_t src_stride,
+                                    int height, int mx, int my);
+typedef void (*h264_pred_func)(uint8_t *dst, ptrdiff_t stride, int avail);
+
+struct h264_dsp_ops {
+    const char *name;
+    /*
+     * Inverse transform of a raster order block of scaled coefficients,
+     * added to dst and clamped. The block is cleared for the next one.
+     */
+    void (*idct4_add)(uint8_t *dst, ptrdiff_t stride, int16_t *block);
+    void (*idct8_add)(uint8_t *dst, ptrdiff_t stride, int16_t *block);
+    /* The same for one component of NV12 chroma, dst steps two bytes */
+    void (*idct4_add_uv)(uint8_t *dst, ptrdiff_t stride, int16_t *block);
+
+    /*
+     * Intra prediction from the reconstructed samples around dst, indexed
+     * by mode. 8x8 blocks filter the neighbours first, chroma predicts
+     * both 8x8 components of a macroblock.
+     */
+    h264_pred_func pred4x4[9];
+    h264_pred_func pred8x8[9];
+    h264_pred_func pred16x16[4];
+    h264_pred_func pred_chroma[4];
+
+    /*
+     * Luma prediction at quarter sample offsets, indexed by [H264_MC_*]
+     * [(frac_y << 2) | frac_x]. src needs 2 samples of margin before the
+     * block and 3 after it in both directions.
+     */
+    h264_qpel_func put_qpel[3][16];
+    /*
+     * Chroma prediction at eighth sample offsets mx, my for 8, 4 and 2
+     * samples of NV12 chroma, indexed by [H264_MC_*]. src needs one
+     * sample of margin after the block.
+     */
+    h264_chroma_mc_func put_chroma[3];
+    /* Averages width x height bytes of src into dst rounding up */
+    void (*avg)(uint8_t *dst, ptrdiff_t dst_stride, const uint8_t *src, ptrdiff_t src_stride,
+                int width, int height);
+    /*
+     * Explicit weighted prediction of width x height bytes in place, and
+     * of dst and src combined into dst. weight and offset are indexed by
+     * the parity of the byte so one call does both NV12 components.
+     */
+    void (*weight)(uint8_t *dst, ptrdiff_t stride, int width, int height, int log2_denom,
+                   const int *weight, const int *offset);
+    void (*biweight)(uint8_t *dst, ptrdiff_t dst_stride, const uint8_t *src, ptrdiff_t src_stride,
+                     int width, int height, int log2_denom, const int *weight0,
+                     const int *weight1, const int *offset);
+
+    /*
+     * Deblocking of a 16 sample luma edge starting at the first q0
+     * sample, indexed by direction: 0 filters a vertical edge, 1 a
+     * horizontal one. tc0 holds one value per 4 samples along the edge,
+     * negative where bS is 0. The intra versions are the bS 4 filters.
+     */
+    void (*luma_filter[2])(uint8_t *pix, ptrdiff_t stride, int alpha, int beta, const int8_t *tc0);
+    void (*luma_filter_intra[2])(uint8_t *pix, ptrdiff_t stride, int alpha, int beta);
+    /*
+     * The same for the 8 sample edges of both NV12 chroma components,
+     * alpha, beta and tc0 are given per component. tc0 has one value per
+     * 2 samples along the edge.
+     */
+    void (*chroma_filter[2])(uint8_t *pix, ptrdiff_t stride, const int *alpha, const int *beta,
+                             const int8_t (*tc0)[4]);
+    void (*chroma_filter_intra[2])(uint8_t *pix, ptrdiff_t stride, const int *alpha,
+                                   const int *beta);
+};
+
+extern const struct h264_dsp_ops h264_dsp_c;
+#if defined(__x86_64__) || defined(__i386__)
+/*
+ * Only the hot kernels have SIMD versions, so those tables start as a
+ * copy of the C one and this replaces what it has
+ */
+void
+h264_dsp_init_sse2(struct h264_dsp_ops *ops);
+#endif
+
+/*
+ * Returns the kernels called name ("c" or "sse2"), or the best ones this
+ * CPU supports if name is NULL or not supported
+ */
+const struct h264_dsp_ops *
+h264_dsp_get_ops(const char *name);
+
+#endif /* H264_DSP_H */
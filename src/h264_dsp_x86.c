@@ -0,0 +1,925 @@
+/*
+ * Copyright (c) 2012 Scott Tincman <sctincman@gmail.com>. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+/*
+ * SSE2 versions of the hot H.264 kernels: the inverse transforms, luma
+ * and chroma motion compensation, weighted prediction and the luma
+ * deblocking filters. The rest stay C.
+ */
+
+#include "config.h"
+#include <string.h>
+#include "h264_dsp.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+#define SSE2    __attribute__((target("sse2")))
+
+static inline SSE2 __m128i
+load4(const uint8_t *p)
+{
+    int32_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return _mm_cvtsi32_si128(v);
+}
+
+static inline SSE2 void
+store4(uint8_t *p, __m128i v)
+{
+    int32_t x = _mm_cvtsi128_si32(v);
+
+    memcpy(p, &x, sizeof(x));
+}
+
+static inline SSE2 __m128i
+load8(const uint8_t *p)
+{
+    return _mm_loadl_epi64((const __m128i *) p);
+}
+
+static inline SSE2 __m128i
+load16(const uint8_t *p)
+{
+    return _mm_loadu_si128((const __m128i *) p);
+}
+
+/* Sign extends the low four 16-bit lanes */
+static inline SSE2 __m128i
+widen_lo(__m128i v)
+{
+    return _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+}
+
+static inline SSE2 __m128i
+widen_hi(__m128i v)
+{
+    return _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+}
+
+static inline SSE2 void
+transpose4x4(__m128i *r0, __m128i *r1, __m128i *r2, __m128i *r3)
+{
+    __m128i a0 = _mm_unpacklo_epi32(*r0, *r1), a1 = _mm_unpackhi_epi32(*r0, *r1);
+    __m128i a2 = _mm_unpacklo_epi32(*r2, *r3), a3 = _mm_unpackhi_epi32(*r2, *r3);
+
+    *r0 = _mm_unpacklo_epi64(a0, a2);
+    *r1 = _mm_unpackhi_epi64(a0, a2);
+    *r2 = _mm_unpacklo_epi64(a1, a3);
+    *r3 = _mm_unpackhi_epi64(a1, a3);
+}
+
+/*
+ * The transforms keep 32-bit lanes like the C code, so any coefficients
+ * give the same samples and not just the ones a conforming stream has
+ */
+static inline SSE2 void
+idct4_1d(__m128i *x)
+{
+    __m128i e = _mm_add_epi32(x[0], x[2]);
+    __m128i f = _mm_sub_epi32(x[0], x[2]);
+    __m128i g = _mm_sub_epi32(_mm_srai_epi32(x[1], 1), x[3]);
+    __m128i h = _mm_add_epi32(x[1], _mm_srai_epi32(x[3], 1));
+
+    x[0] = _mm_add_epi32(e, h);
+    x[1] = _mm_add_epi32(f, g);
+    x[2] = _mm_sub_epi32(f, g);
+    x[3] = _mm_sub_epi32(e, h);
+}
+
+/* Adds (x + 32) >> 6 to 4 or 8 samples of dst */
+static inline SSE2 __m128i
+add_residual(__m128i d, __m128i lo, __m128i hi)
+{
+    const __m128i bias = _mm_set1_epi32(32);
+
+    lo = _mm_srai_epi32(_mm_add_epi32(lo, bias), 6);
+    hi = _mm_srai_epi32(_mm_add_epi32(hi, bias), 6);
+    d = _mm_unpacklo_epi8(d, _mm_setzero_si128());
+    return _mm_packus_epi16(_mm_adds_epi16(d, _mm_packs_epi32(lo, hi)), d);
+}
+
+static SSE2 void
+idct4_add_sse2(uint8_t *dst, ptrdiff_t stride, int16_t *block)
+{
+    __m128i b0 = _mm_loadu_si128((const __m128i *) block);
+    __m128i b1 = _mm_loadu_si128((const __m128i *)(block + 8));
+    __m128i x[4];
+    int j;
+
+    x[0] = widen_lo(b0);
+    x[1] = widen_hi(b0);
+    x[2] = widen_lo(b1);
+    x[3] = widen_hi(b1);
+
+    /* Rows as columns of the transposed block, then back */
+    transpose4x4(&x[0], &x[1], &x[2], &x[3]);
+    idct4_1d(x);
+    transpose4x4(&x[0], &x[1], &x[2], &x[3]);
+    idct4_1d(x);
+
+    for (j = 0; j < 4; j++, dst += stride)
+        store4(dst, add_residual(load4(dst), x[j], x[j]));
+    _mm_storeu_si128((__m128i *) block, _mm_setzero_si128());
+    _mm_storeu_si128((__m128i *)(block + 8), _mm_setzero_si128());
+}
+
+static inline SSE2 void
+idct8_1d(__m128i *x)
+{
+    __m128i a0 = _mm_add_epi32(x[0], x[4]), a4 = _mm_sub_epi32(x[0], x[4]);
+    __m128i a2 = _mm_sub_epi32(_mm_srai_epi32(x[2], 1), x[6]);
+    __m128i a6 = _mm_add_epi32(x[2], _mm_srai_epi32(x[6], 1));
+    __m128i b0 = _mm_add_epi32(a0, a6), b2 = _mm_add_epi32(a4, a2);
+    __m128i b4 = _mm_sub_epi32(a4, a2), b6 = _mm_sub_epi32(a0, a6);
+    __m128i a1 = _mm_sub_epi32(_mm_sub_epi32(_mm_sub_epi32(x[5], x[3]), x[7]),
+                               _mm_srai_epi32(x[7], 1));
+    __m128i a3 = _mm_sub_epi32(_mm_sub_epi32(_mm_add_epi32(x[1], x[7]), x[3]),
+                               _mm_srai_epi32(x[3], 1));
+    __m128i a5 = _mm_add_epi32(_mm_add_epi32(_mm_sub_epi32(x[7], x[1]), x[5]),
+                               _mm_srai_epi32(x[5], 1));
+    __m128i a7 = _mm_add_epi32(_mm_add_epi32(_mm_add_epi32(x[3], x[5]), x[1]),
+                               _mm_srai_epi32(x[1], 1));
+    __m128i b1 = _mm_add_epi32(a1, _mm_srai_epi32(a7, 2));
+    __m128i b7 = _mm_sub_epi32(a7, _mm_srai_epi32(a1, 2));
+    __m128i b3 = _mm_add_epi32(a3, _mm_srai_epi32(a5, 2));
+    __m128i b5 = _mm_sub_epi32(_mm_srai_epi32(a3, 2), a5);
+
+    x[0] = _mm_add_epi32(b0, b7);
+    x[1] = _mm_add_epi32(b2, b5);
+    x[2] = _mm_add_epi32(b4, b3);
+    x[3] = _mm_add_epi32(b6, b1);
+    x[4] = _mm_sub_epi32(b6, b1);
+    x[5] = _mm_sub_epi32(b4, b3);
+    x[6] = _mm_sub_epi32(b2, b5);
+    x[7] = _mm_sub_epi32(b0, b7);
+}
+
+/* lo and hi hold columns 0-3 and 4-7 of the 8 rows */
+static inline SSE2 void
+transpose8x8_epi32(__m128i *lo, __m128i *hi)
+{
+    __m128i t;
+    int i;
+
+    transpose4x4(&lo[0], &lo[1], &lo[2], &lo[3]);
+    transpose4x4(&hi[0], &hi[1], &hi[2], &hi[3]);
+    transpose4x4(&lo[4], &lo[5], &lo[6], &lo[7]);
+    transpose4x4(&hi[4], &hi[5], &hi[6], &hi[7]);
+    for (i = 0; i < 4; i++) {
+        t = hi[i];
+        hi[i] = lo[4 + i];
+        lo[4 + i] = t;
+    }
+}
+
+static SSE2 void
+idct8_add_sse2(uint8_t *dst, ptrdiff_t stride, int16_t *block)
+{
+    __m128i lo[8], hi[8];
+    int j;
+
+    for (j = 0; j < 8; j++) {
+        __m128i b = _mm_loadu_si128((const __m128i *)(block + 8 * j));
+
+        lo[j] = widen_lo(b);
+        hi[j] = widen_hi(b);
+        _mm_storeu_si128((__m128i *)(block + 8 * j), _mm_setzero_si128());
+    }
+
+    transpose8x8_epi32(lo, hi);
+    idct8_1d(lo);
+    idct8_1d(hi);
+    transpose8x8_epi32(lo, hi);
+    idct8_1d(lo);
+    idct8_1d(hi);
+
+    for (j = 0; j < 8; j++, dst += stride)
+        _mm_storel_epi64((__m128i *) dst, add_residual(load8(dst), lo[j], hi[j]));
+}
+
+/*
+ * Luma motion compensation. The half sample planes are built 8 samples at
+ * a time in 16-bit lanes, which hold the 6 tap sums exactly; the centre
+ * plane filters those sums again and needs 32-bit ones. Quarter samples
+ * are the pavgb of two planes as in the C code.
+ */
+#define QPEL_FULL       0
+#define QPEL_H          1       /* b, horizontal half samples */
+#define QPEL_V          2       /* h, vertical half samples */
+#define QPEL_HV         3       /* j, centre half samples */
+#define QPEL_NONE       4
+
+/* Plane and its one sample offsets in x and y, as in put_qpel_c() */
+struct qpel_plane {
+    int8_t kind, dx, dy;
+};
+
+static const struct qpel_plane qpel_first[16] = {
+    { QPEL_FULL, 0, 0 }, { QPEL_FULL, 0, 0 }, { QPEL_H, 0, 0 }, { QPEL_FULL, 1, 0 },
+    { QPEL_FULL, 0, 0 }, { QPEL_H, 0, 0 }, { QPEL_H, 0, 0 }, { QPEL_H, 0, 0 },
+    { QPEL_V, 0, 0 }, { QPEL_V, 0, 0 }, { QPEL_HV, 0, 0 }, { QPEL_V, 1, 0 },
+    { QPEL_FULL, 0, 1 }, { QPEL_H, 0, 1 }, { QPEL_H, 0, 1 }, { QPEL_H, 0, 1 },
+};
+
+static const struct qpel_plane qpel_second[16] = {
+    { QPEL_NONE, 0, 0 }, { QPEL_H, 0, 0 }, { QPEL_NONE, 0, 0 }, { QPEL_H, 0, 0 },
+    { QPEL_V, 0, 0 }, { QPEL_V, 0, 0 }, { QPEL_HV, 0, 0 }, { QPEL_V, 1, 0 },
+    { QPEL_NONE, 0, 0 }, { QPEL_HV, 0, 0 }, { QPEL_NONE, 0, 0 }, { QPEL_HV, 0, 0 },
+    { QPEL_V, 0, 0 }, { QPEL_V, 0, 0 }, { QPEL_HV, 0, 0 }, { QPEL_V, 1, 0 },
+};
+
+/* p[-2] - 5 p[-1] + 20 p[0] + 20 p[1] - 5 p[2] + p[3] in 16-bit lanes */
+static inline SSE2 __m128i
+tap6_epi16(__m128i m2, __m128i m1, __m128i p0, __m128i p1, __m128i p2, __m128i p3)
+{
+    __m128i outer = _mm_add_epi16(m2, p3);
+    __m128i mid = _mm_add_epi16(m1, p2);
+    __m128i inner = _mm_add_epi16(p0, p1);
+
+    mid = _mm_add_epi16(mid, _mm_slli_epi16(mid, 2));
+    inner = _mm_add_epi16(_mm_slli_epi16(inner, 4), _mm_slli_epi16(inner, 2));
+    return _mm_add_epi16(_mm_sub_epi16(outer, mid), inner);
+}
+
+static inline SSE2 __m128i
+widen_u8(const uint8_t *p)
+{
+    return _mm_unpacklo_epi8(load8(p), _mm_setzero_si128());
+}
+
+/* Horizontal 6 tap sums of 8 samples */
+static inline SSE2 __m128i
+tap6_row(const uint8_t *p)
+{
+    return tap6_epi16(widen_u8(p - 2), widen_u8(p - 1), widen_u8(p), widen_u8(p + 1),
+                      widen_u8(p + 2), widen_u8(p + 3));
+}
+
+static inline SSE2 __m128i
+round5(__m128i lo, __m128i hi)
+{
+    const __m128i bias = _mm_set1_epi16(16);
+
+    return _mm_packus_epi16(_mm_srai_epi16(_mm_add_epi16(lo, bias), 5),
+                            _mm_srai_epi16(_mm_add_epi16(hi, bias), 5));
+}
+
+static inline SSE2 void
+store_row(uint8_t *dst, __m128i v, int width)
+{
+    if (width == 16)
+        _mm_storeu_si128((__m128i *) dst, v);
+    else
+        _mm_storel_epi64((__m128i *) dst, v);
+}
+
+static SSE2 void
+qpel_h(uint8_t *dst, ptrdiff_t dst_stride, const uint8_t *src, ptrdiff_t src_stride,
+       int width, int height)
+{
+    int y;
+
+    for (y = 0; y < height; y++, dst += dst_stride, src += src_stride) {
+        __m128i lo = tap6_row(src);
+        __m128i hi = width == 16 ? tap6_row(src + 8) : lo;
+
+        store_row(dst, round5(lo, hi), width);
+    }
+}
+
+static SSE2 void
+qpel_v(uint8_t *dst, ptrdiff_t dst_stride, const uint8_t *src, ptrdiff_t src_stride,
+       int width, int height)
+{
+    int x, y;
+
+    for (x = 0; x < width; x += 8) {
+        const uint8_t *s = src + x - 2 * src_stride;
+        __m128i r0 = widen_u8(s), r1 = widen_u8(s + src_stride);
+        __m128i r2 = widen_u8(s + 2 * src_stride), r3 = widen_u8(s + 3 * src_stride);
+        __m128i r4 = widen_u8(s + 4 * src_stride);
+        uint8_t *d = dst + x;
+
+        s += 5 * src_stride;
+        for (y = 0; y < height; y++, d += dst_stride, s += src_stride) {
+            __m128i r5 = widen_u8(s);
+
+            _mm_storel_epi64((__m128i *) d, round5(tap6_epi16(r0, r1, r2, r3, r4, r5), r5));
+            r0 = r1;
+            r1 = r2;
+            r2 = r3;
+            r3 = r4;
+            r4 = r5;
+        }
+    }
+}
+
+/* (r0 - 5 r1 + 20 r2 + 20 r3 - 5 r4 + r5 + 512) >> 10 of 16-bit sums */
+static inline SSE2 __m128i
+tap6_centre(const __m128i *r)
+{
+    const __m128i c01 = _mm_set_epi16(-5, 1, -5, 1, -5, 1, -5, 1);
+    const __m128i c23 = _mm_set1_epi16(20);
+    const __m128i c45 = _mm_set_epi16(1, -5, 1, -5, 1, -5, 1, -5);
+    const __m128i bias = _mm_set1_epi32(512);
+    __m128i lo, hi;
+
+    lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(r[0], r[1]), c01),
+                       _mm_madd_epi16(_mm_unpacklo_epi16(r[2], r[3]), c23));
+    lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(r[4], r[5]), c45));
+    hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(r[0], r[1]), c01),
+                       _mm_madd_epi16(_mm_unpackhi_epi16(r[2], r[3]), c23));
+    hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(r[4], r[5]), c45));
+    lo = _mm_srai_epi32(_mm_add_epi32(lo, bias), 10);
+    hi = _mm_srai_epi32(_mm_add_epi32(hi, bias), 10);
+    lo = _mm_packs_epi32(lo, hi);
+    return _mm_packus_epi16(lo, lo);
+}
+
+static SSE2 void
+qpel_hv(uint8_t *dst, ptrdiff_t dst_stride, const uint8_t *src, ptrdiff_t src_stride,
+        int width, int height)
+{
+    int x, y;
+
+    for (x = 0; x < width; x += 8) {
+        const uint8_t *s = src + x - 2 * src_stride;
+        __m128i r[6];
+        uint8_t *d = dst + x;
+
+        for (y = 0; y < 5; y++, s += src_stride)
+            r[y] = tap6_row(s);
+        for (y = 0; y < height; y++, d += dst_stride, s += src_stride) {
+            r[5] = tap6_row(s);
+            _mm_storel_epi64((__m128i *) d, tap6_centre(r));
+            r[0] = r[1];
+            r[1] = r[2];
+            r[2] = r[3];
+            r[3] = r[4];
+            r[4] = r[5];
+        }
+    }
+}
+
+static SSE2 void
+qpel_copy(uint8_t *dst, ptrdiff_t dst_stride, const uint8_t *src, ptrdiff_t src_stride,
+          int width, int height)
+{
+    int y;
+
+    for (y = 0; y < height; y++, dst += dst_stride, src += src_stride)
+        store_row(dst, width == 16 ? load16(src) : load8(src), width);
+}
+
+static inline SSE2 void
+qpel_plane(uint8_t *dst, ptrdiff_t dst_stride, const uint8_t *src, ptrdiff_t src_stride,
+           int width, int height, const struct qpel_plane *plane)
+{
+    src += plane->dy * src_stride + plane->dx;
+    switch (plane->kind) {
+    case QPEL_FULL:
+        qpel_copy(dst, dst_stride, src, src_stride, width, height);
+        break;
+    case QPEL_H:
+        qpel_h(dst, dst_stride, src, src_stride, width, height);
+        break;
+    case QPEL_V:
+        qpel_v(dst, dst_stride, src, src_stride, width, height);
+        break;
+    default:
+        qpel_hv(dst, dst_stride, src, src_stride, width, height);
+        break;
+    }
+}
+
+static inline SSE2 void
+put_qpel_sse2(uint8_t *dst, ptrdiff_t dst_stride, const uint8_t *src, ptrdiff_t src_stride,
+              int width, int height, int pos)
+{
+    uint8_t tmp[16 * 16];
+    int y;
+
+    qpel_plane(dst, dst_stride, src, src_stride, width, height, &qpel_first[pos]);
+    if (qpel_second[pos].kind == QPEL_NONE)
+        return;
+    qpel_plane(tmp, 16, src, src_stride, width, height, &qpel_second[pos]);
+    for (y = 0; y < height; y++, dst += dst_stride) {
+        if (width == 16)
+            store_row(dst, _mm_avg_epu8(load16(dst), load16(tmp + 16 * y)), 16);
+        else
+            store_row(dst, _mm_avg_epu8(load8(dst), load8(tmp + 16 * y)), 8);
+    }
+}
+
+#define QPEL_SSE2(width, mx, my)                                                \
+static SSE2 void                                                                \
+put_qpel##width##_##mx##my##_sse2(uint8_t *dst, ptrdiff_t dst_stride,           \
+                                  const uint8_t *src, ptrdiff_t src_stride, int height) \
+{                                                                               \
+    put_qpel_sse2(dst, dst_stride, src, src_stride, width, height, (my << 2) | mx); \
+}
+
+#define QPEL_SSE2_ALL(width)                                                    \
+    QPEL_SSE2(width, 0, 0) QPEL_SSE2(width, 1, 0)                               \
+    QPEL_SSE2(width, 2, 0) QPEL_SSE2(width, 3, 0)                               \
+    QPEL_SSE2(width, 0, 1) QPEL_SSE2(width, 1, 1)                               \
+    QPEL_SSE2(width, 2, 1) QPEL_SSE2(width, 3, 1)                               \
+    QPEL_SSE2(width, 0, 2) QPEL_SSE2(width, 1, 2)                               \
+    QPEL_SSE2(width, 2, 2) QPEL_SSE2(width, 3, 2)                               \
+    QPEL_SSE2(width, 0, 3) QPEL_SSE2(width, 1, 3)                               \
+    QPEL_SSE2(width, 2, 3) QPEL_SSE2(width, 3, 3)
+
+QPEL_SSE2_ALL(16)
+QPEL_SSE2_ALL(8)
+
+#define QPEL_TABLE(width) {                                                     \
+    put_qpel##width##_00_sse2, put_qpel##width##_10_sse2,                       \
+    put_qpel##width##_20_sse2, put_qpel##width##_30_sse2,                       \
+    put_qpel##width##_01_sse2, put_qpel##width##_11_sse2,                       \
+    put_qpel##width##_21_sse2, put_qpel##width##_31_sse2,                       \
+    put_qpel##width##_02_sse2, put_qpel##width##_12_sse2,                       \
+    put_qpel##width##_22_sse2, put_qpel##width##_32_sse2,                       \
+    put_qpel##width##_03_sse2, put_qpel##width##_13_sse2,                       \
+    put_qpel##width##_23_sse2, put_qpel##width##_33_sse2,                       \
+}
+
+static const h264_qpel_func put_qpel16_sse2[16] = QPEL_TABLE(16);
+static const h264_qpel_func put_qpel8_sse2[16] = QPEL_TABLE(8);
+
+/* Bilinear chroma of 8 bytes of the interleaved plane in 16-bit lanes */
+static inline SSE2 __m128i
+chroma_taps(__m128i s0, __m128i s1, __m128i s2, __m128i s3, const __m128i *coeff)
+{
+    __m128i sum = _mm_add_epi16(_mm_mullo_epi16(s0, coeff[0]), _mm_mullo_epi16(s1, coeff[1]));
+
+    sum = _mm_add_epi16(sum, _mm_mullo_epi16(s2, coeff[2]));
+    sum = _mm_add_epi16(sum, _mm_mullo_epi16(s3, coeff[3]));
+    return _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(32)), 6);
+}
+
+static inline SSE2 void
+put_chroma_sse2(uint8_t *dst, ptrdiff_t dst_stride, const uint8_t *src, ptrdiff_t src_stride,
+                int bytes, int height, int mx, int my)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i coeff[4];
+    int y;
+
+    coeff[0] = _mm_set1_epi16((8 - mx) * (8 - my));
+    coeff[1] = _mm_set1_epi16(mx * (8 - my));
+    coeff[2] = _mm_set1_epi16((8 - mx) * my);
+    coeff[3] = _mm_set1_epi16(mx * my);
+    for (y = 0; y < height; y++, dst += dst_stride, src += src_stride) {
+        if (bytes == 16) {
+            __m128i s0 = load16(src), s1 = load16(src + 2);
+            __m128i s2 = load16(src + src_stride), s3 = load16(src + src_stride + 2);
+            __m128i lo = chroma_taps(_mm_unpacklo_epi8(s0, zero), _mm_unpacklo_epi8(s1, zero),
+                                     _mm_unpacklo_epi8(s2, zero), _mm_unpacklo_epi8(s3, zero),
+                                     coeff);
+            __m128i hi = chroma_taps(_mm_unpackhi_epi8(s0, zero), _mm_unpackhi_epi8(s1, zero),
+                                     _mm_unpackhi_epi8(s2, zero), _mm_unpackhi_epi8(s3, zero),
+                                     coeff);
+
+            _mm_storeu_si128((__m128i *) dst, _mm_packus_epi16(lo, hi));
+        } else {
+            __m128i lo = chroma_taps(widen_u8(src), widen_u8(src + 2), widen_u8(src + src_stride),
+                                     widen_u8(src + src_stride + 2), coeff);
+
+            _mm_storel_epi64((__m128i *) dst, _mm_packus_epi16(lo, lo));
+        }
+    }
+}
+
+static SSE2 void
+put_chroma8_sse2(uint8_t *dst, ptrdiff_t dst_stride, const uint8_t *src, ptrdiff_t src_stride,
+                 int height, int mx, int my)
+{
+    put_chroma_sse2(dst, dst_stride, src, src_stride, 16, height, mx, my);
+}
+
+static SSE2 void
+put_chroma4_sse2(uint8_t *dst, ptrdiff_t dst_stride, const uint8_t *src, ptrdiff_t src_stride,
+                 int height, int mx, int my)
+{
+    put_chroma_sse2(dst, dst_stride, src, src_stride, 8, height, mx, my);
+}
+
+static SSE2 void
+avg_sse2(uint8_t *dst, ptrdiff_t dst_stride, const uint8_t *src, ptrdiff_t src_stride,
+         int width, int height)
+{
+    int x, y;
+
+    for (y = 0; y < height; y++, dst += dst_stride, src += src_stride) {
+        for (x = 0; x + 16 <= width; x += 16)
+            _mm_storeu_si128((__m128i *)(dst + x), _mm_avg_epu8(load16(dst + x), load16(src + x)));
+        if (x + 8 <= width) {
+            _mm_storel_epi64((__m128i *)(dst + x), _mm_avg_epu8(load8(dst + x), load8(src + x)));
+            x += 8;
+        }
+        for (; x < width; x++)
+            dst[x] = (dst[x] + src[x] + 1) >> 1;
+    }
+}
+
+/*
+ * Weighted prediction pairs each sample with a second value for
+ * _mm_madd_epi16, 1 against the rounding term or the sample of the other
+ * prediction, so the sums are the 32-bit ones of the C code
+ */
+static inline SSE2 __m128i
+weight_pack(__m128i lo, __m128i hi, __m128i shift, __m128i offset)
+{
+    lo = _mm_add_epi32(_mm_sra_epi32(lo, shift), offset);
+    hi = _mm_add_epi32(_mm_sra_epi32(hi, shift), offset);
+    lo = _mm_packs_epi32(lo, hi);
+    return _mm_packus_epi16(lo, lo);
+}
+
+static inline SSE2 __m128i
+weight8(__m128i d, __m128i coeff, __m128i shift, __m128i offset)
+{
+    d = _mm_unpacklo_epi8(d, _mm_setzero_si128());
+    return weight_pack(_mm_madd_epi16(_mm_unpacklo_epi16(d, _mm_set1_epi16(1)), coeff),
+                       _mm_madd_epi16(_mm_unpackhi_epi16(d, _mm_set1_epi16(1)), coeff),
+                       shift, offset);
+}
+
+static SSE2 void
+weight_sse2(uint8_t *dst, ptrdiff_t stride, int width, int height, int log2_denom,
+            const int *weight, const int *offset)
+{
+    int round = log2_denom ? 1 << (log2_denom - 1) : 0;
+    __m128i coeff = _mm_set_epi16(round, weight[1], round, weight[0],
+                                  round, weight[1], round, weight[0]);
+    __m128i off = _mm_set_epi32(offset[1], offset[0], offset[1], offset[0]);
+    __m128i shift = _mm_cvtsi32_si128(log2_denom);
+    int x, y;
+
+    for (y = 0; y < height; y++, dst += stride) {
+        for (x = 0; x + 8 <= width; x += 8)
+            _mm_storel_epi64((__m128i *)(dst + x), weight8(load8(dst + x), coeff, shift, off));
+        if (x + 4 <= width) {
+            store4(dst + x, weight8(load4(dst + x), coeff, shift, off));
+            x += 4;
+        }
+        for (; x < width; x++) {
+            int v = ((dst[x] * weight[x & 1] + round) >> log2_denom) + offset[x & 1];
+
+            dst[x] = v < 0 ? 0 : (v > 255 ? 255 : v);
+        }
+    }
+}
+
+static inline SSE2 __m128i
+biweight8(__m128i d, __m128i s, __m128i coeff, __m128i round, __m128i shift, __m128i offset)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i ds;
+
+    ds = _mm_unpacklo_epi8(d, s);
+    return weight_pack(_mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi8(ds, zero), coeff), round),
+                       _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi8(ds, zero), coeff), round),
+                       shift, offset);
+}
+
+static SSE2 void
+biweight_sse2(uint8_t *dst, ptrdiff_t dst_stride, const uint8_t *src, ptrdiff_t src_stride,
+              int width, int height, int log2_denom, const int *weight0, const int *weight1,
+              const int *offset)
+{
+    __m128i coeff = _mm_set_epi16(weight1[1], weight0[1], weight1[0], weight0[0],
+                                  weight1[1], weight0[1], weight1[0], weight0[0]);
+    __m128i round = _mm_set1_epi32(1 << log2_denom);
+    __m128i off = _mm_set_epi32(offset[1], offset[0], offset[1], offset[0]);
+    __m128i shift = _mm_cvtsi32_si128(log2_denom + 1);
+    int x, y;
+
+    for (y = 0; y < height; y++, dst += dst_stride, src += src_stride) {
+        for (x = 0; x + 8 <= width; x += 8)
+            _mm_storel_epi64((__m128i *)(dst + x),
+                             biweight8(load8(dst + x), load8(src + x), coeff, round, shift, off));
+        if (x + 4 <= width) {
+            store4(dst + x, biweight8(load4(dst + x), load4(src + x), coeff, round, shift, off));
+            x += 4;
+        }
+        for (; x < width; x++) {
+            int v = ((dst[x] * weight0[x & 1] + src[x] * weight1[x & 1] + (1 << log2_denom)) >>
+                     (log2_denom + 1)) + offset[x & 1];
+
+            dst[x] = v < 0 ? 0 : (v > 255 ? 255 : v);
+        }
+    }
+}
+
+/*
+ * Luma deblocking of 8 lines across the edge at once, one per 16-bit lane.
+ * p[0..3] are p0..p3 and q[0..3] q0..q3. Horizontal edges load the rows
+ * directly, vertical ones transpose 8 rows of the 8 samples around the
+ * edge first.
+ */
+static inline SSE2 __m128i
+abs_diff(__m128i a, __m128i b)
+{
+    return _mm_max_epi16(_mm_sub_epi16(a, b), _mm_sub_epi16(b, a));
+}
+
+static inline SSE2 __m128i
+select_epi16(__m128i mask, __m128i a, __m128i b)
+{
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+static inline SSE2 __m128i
+filter_mask(const __m128i *p, const __m128i *q, __m128i alpha, __m128i beta)
+{
+    __m128i mask = _mm_cmplt_epi16(abs_diff(p[0], q[0]), alpha);
+
+    mask = _mm_and_si128(mask, _mm_cmplt_epi16(abs_diff(p[1], p[0]), beta));
+    return _mm_and_si128(mask, _mm_cmplt_epi16(abs_diff(q[1], q[0]), beta));
+}
+
+static inline SSE2 __m128i
+clip_epi16(__m128i v, __m128i low, __m128i high)
+{
+    return _mm_min_epi16(_mm_max_epi16(v, low), high);
+}
+
+static inline SSE2 void
+luma_filter8(__m128i *p, __m128i *q, __m128i alpha, __m128i beta, __m128i tc0)
+{
+    const __m128i one = _mm_set1_epi16(1);
+    __m128i mask, ap, aq, tc, avg, delta, neg, p1, q1;
+
+    mask = _mm_and_si128(filter_mask(p, q, alpha, beta),
+                         _mm_cmpgt_epi16(tc0, _mm_set1_epi16(-1)));
+    ap = _mm_and_si128(mask, _mm_cmplt_epi16(abs_diff(p[2], p[0]), beta));
+    aq = _mm_and_si128(mask, _mm_cmplt_epi16(abs_diff(q[2], q[0]), beta));
+    tc = _mm_sub_epi16(_mm_sub_epi16(tc0, ap), aq);
+    avg = _mm_srai_epi16(_mm_add_epi16(_mm_add_epi16(p[0], q[0]), one), 1);
+    neg = _mm_sub_epi16(_mm_setzero_si128(), tc0);
+
+    delta = _mm_srai_epi16(_mm_sub_epi16(_mm_add_epi16(p[2], avg), _mm_slli_epi16(p[1], 1)), 1);
+    p1 = _mm_add_epi16(p[1], clip_epi16(delta, neg, tc0));
+    delta = _mm_srai_epi16(_mm_sub_epi16(_mm_add_epi16(q[2], avg), _mm_slli_epi16(q[1], 1)), 1);
+    q1 = _mm_add_epi16(q[1], clip_epi16(delta, neg, tc0));
+
+    delta = _mm_add_epi16(_mm_slli_epi16(_mm_sub_epi16(q[0], p[0]), 2), _mm_sub_epi16(p[1], q[1]));
+    delta = _mm_srai_epi16(_mm_add_epi16(delta, _mm_set1_epi16(4)), 3);
+    delta = _mm_and_si128(mask, clip_epi16(delta, _mm_sub_epi16(_mm_setzero_si128(), tc), tc));
+    p[0] = _mm_add_epi16(p[0], delta);
+    q[0] = _mm_sub_epi16(q[0], delta);
+    p[1] = select_epi16(ap, p1, p[1]);
+    q[1] = select_epi16(aq, q1, q[1]);
+}
+
+/* (a + 2 b + 2 c + 2 d + e + 4) >> 3 */
+static inline SSE2 __m128i
+tap5(__m128i a, __m128i b, __m128i c, __m128i d, __m128i e)
+{
+    __m128i sum = _mm_slli_epi16(_mm_add_epi16(_mm_add_epi16(b, c), d), 1);
+
+    sum = _mm_add_epi16(_mm_add_epi16(sum, a), _mm_add_epi16(e, _mm_set1_epi16(4)));
+    return _mm_srai_epi16(sum, 3);
+}
+
+static inline SSE2 void
+luma_filter_intra8(__m128i *p, __m128i *q, __m128i alpha, __m128i beta)
+{
+    const __m128i two = _mm_set1_epi16(2);
+    __m128i mask, strong, ap, aq, weak_p, weak_q, pq;
+
+    mask = filter_mask(p, q, alpha, beta);
+    strong = _mm_cmplt_epi16(abs_diff(p[0], q[0]),
+                             _mm_add_epi16(_mm_srai_epi16(alpha, 2), two));
+    ap = _mm_and_si128(strong, _mm_cmplt_epi16(abs_diff(p[2], p[0]), beta));
+    aq = _mm_and_si128(strong, _mm_cmplt_epi16(abs_diff(q[2], q[0]), beta));
+    ap = _mm_and_si128(mask, ap);
+    aq = _mm_and_si128(mask, aq);
+
+    /* (2 p1 + p0 + q1 + 2) >> 2 */
+    weak_p = _mm_srai_epi16(_mm_add_epi16(_mm_add_epi16(_mm_slli_epi16(p[1], 1), p[0]),
+                                          _mm_add_epi16(q[1], two)), 2);
+    weak_q = _mm_srai_epi16(_mm_add_epi16(_mm_add_epi16(_mm_slli_epi16(q[1], 1), q[0]),
+                                          _mm_add_epi16(p[1], two)), 2);
+    pq = _mm_add_epi16(p[0], q[0]);
+
+    {
+        __m128i p0 = tap5(p[2], p[1], p[0], q[0], q[1]);
+        __m128i p1 = _mm_srai_epi16(_mm_add_epi16(_mm_add_epi16(p[2], p[1]),
+                                                  _mm_add_epi16(pq, two)), 2);
+        __m128i p2 = _mm_add_epi16(_mm_slli_epi16(_mm_add_epi16(p[3], p[2]), 1),
+                                   _mm_add_epi16(p[2], p[1]));
+        __m128i q0 = tap5(q[2], q[1], q[0], p[0], p[1]);
+        __m128i q1 = _mm_srai_epi16(_mm_add_epi16(_mm_add_epi16(q[2], q[1]),
+                                                  _mm_add_epi16(pq, two)), 2);
+        __m128i q2 = _mm_add_epi16(_mm_slli_epi16(_mm_add_epi16(q[3], q[2]), 1),
+                                   _mm_add_epi16(q[2], q[1]));
+
+        p2 = _mm_srai_epi16(_mm_add_epi16(_mm_add_epi16(p2, pq), _mm_set1_epi16(4)), 3);
+        q2 = _mm_srai_epi16(_mm_add_epi16(_mm_add_epi16(q2, pq), _mm_set1_epi16(4)), 3);
+
+        weak_p = select_epi16(mask, weak_p, p[0]);
+        weak_q = select_epi16(mask, weak_q, q[0]);
+        p[0] = select_epi16(ap, p0, weak_p);
+        p[1] = select_epi16(ap, p1, p[1]);
+        p[2] = select_epi16(ap, p2, p[2]);
+        q[0] = select_epi16(aq, q0, weak_q);
+        q[1] = select_epi16(aq, q1, q[1]);
+        q[2] = select_epi16(aq, q2, q[2]);
+    }
+}
+
+/* tc0 of the 8 lines starting at line, one value per 4 of them */
+static inline SSE2 __m128i
+luma_tc0(const int8_t *tc0, int line)
+{
+    int a = tc0[line >> 2], b = tc0[(line >> 2) + 1];
+
+    return _mm_set_epi16(b, b, b, b, a, a, a, a);
+}
+
+/* Loads the 4 lines either side of a horizontal edge, 8 samples from pix */
+static inline SSE2 void
+load_rows(const uint8_t *pix, ptrdiff_t stride, __m128i *p, __m128i *q)
+{
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        p[i] = widen_u8(pix - (i + 1) * stride);
+        q[i] = widen_u8(pix + i * stride);
+    }
+}
+
+static inline SSE2 void
+store_rows(uint8_t *pix, ptrdiff_t stride, const __m128i *p, const __m128i *q, int count)
+{
+    int i;
+
+    for (i = 0; i < count; i++) {
+        _mm_storel_epi64((__m128i *)(pix - (i + 1) * stride), _mm_packus_epi16(p[i], p[i]));
+        _mm_storel_epi64((__m128i *)(pix + i * stride), _mm_packus_epi16(q[i], q[i]));
+    }
+}
+
+/* The same across a vertical edge, through an 8x8 transpose */
+static inline SSE2 void
+transpose8x8_epi16(__m128i *r)
+{
+    __m128i a0 = _mm_unpacklo_epi16(r[0], r[1]), a1 = _mm_unpackhi_epi16(r[0], r[1]);
+    __m128i a2 = _mm_unpacklo_epi16(r[2], r[3]), a3 = _mm_unpackhi_epi16(r[2], r[3]);
+    __m128i a4 = _mm_unpacklo_epi16(r[4], r[5]), a5 = _mm_unpackhi_epi16(r[4], r[5]);
+    __m128i a6 = _mm_unpacklo_epi16(r[6], r[7]), a7 = _mm_unpackhi_epi16(r[6], r[7]);
+    __m128i b0 = _mm_unpacklo_epi32(a0, a2), b1 = _mm_unpackhi_epi32(a0, a2);
+    __m128i b2 = _mm_unpacklo_epi32(a1, a3), b3 = _mm_unpackhi_epi32(a1, a3);
+    __m128i b4 = _mm_unpacklo_epi32(a4, a6), b5 = _mm_unpackhi_epi32(a4, a6);
+    __m128i b6 = _mm_unpacklo_epi32(a5, a7), b7 = _mm_unpackhi_epi32(a5, a7);
+
+    r[0] = _mm_unpacklo_epi64(b0, b4);
+    r[1] = _mm_unpackhi_epi64(b0, b4);
+    r[2] = _mm_unpacklo_epi64(b1, b5);
+    r[3] = _mm_unpackhi_epi64(b1, b5);
+    r[4] = _mm_unpacklo_epi64(b2, b6);
+    r[5] = _mm_unpackhi_epi64(b2, b6);
+    r[6] = _mm_unpacklo_epi64(b3, b7);
+    r[7] = _mm_unpackhi_epi64(b3, b7);
+}
+
+static inline SSE2 void
+load_columns(const uint8_t *pix, ptrdiff_t stride, __m128i *p, __m128i *q)
+{
+    __m128i r[8];
+    int i;
+
+    for (i = 0; i < 8; i++)
+        r[i] = widen_u8(pix + i * stride - 4);
+    transpose8x8_epi16(r);
+    for (i = 0; i < 4; i++) {
+        p[i] = r[3 - i];
+        q[i] = r[4 + i];
+    }
+}
+
+static inline SSE2 void
+store_columns(uint8_t *pix, ptrdiff_t stride, const __m128i *p, const __m128i *q)
+{
+    __m128i r[8];
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        r[3 - i] = p[i];
+        r[4 + i] = q[i];
+    }
+    transpose8x8_epi16(r);
+    for (i = 0; i < 8; i++)
+        _mm_storel_epi64((__m128i *)(pix + i * stride - 4), _mm_packus_epi16(r[i], r[i]));
+}
+
+static SSE2 void
+luma_filter_v_sse2(uint8_t *pix, ptrdiff_t stride, int alpha, int beta, const int8_t *tc0)
+{
+    __m128i a = _mm_set1_epi16(alpha), b = _mm_set1_epi16(beta);
+    __m128i p[4], q[4];
+    int i;
+
+    for (i = 0; i < 16; i += 8) {
+        if (tc0[i >> 2] < 0 && tc0[(i >> 2) + 1] < 0)
+            continue;
+        load_columns(pix + i * stride, stride, p, q);
+        luma_filter8(p, q, a, b, luma_tc0(tc0, i));
+        store_columns(pix + i * stride, stride, p, q);
+    }
+}
+
+static SSE2 void
+luma_filter_h_sse2(uint8_t *pix, ptrdiff_t stride, int alpha, int beta, const int8_t *tc0)
+{
+    __m128i a = _mm_set1_epi16(alpha), b = _mm_set1_epi16(beta);
+    __m128i p[4], q[4];
+    int i;
+
+    for (i = 0; i < 16; i += 8) {
+        if (tc0[i >> 2] < 0 && tc0[(i >> 2) + 1] < 0)
+            continue;
+        load_rows(pix + i, stride, p, q);
+        luma_filter8(p, q, a, b, luma_tc0(tc0, i));
+        store_rows(pix + i, stride, p, q, 2);
+    }
+}
+
+static SSE2 void
+luma_filter_intra_v_sse2(uint8_t *pix, ptrdiff_t stride, int alpha, int beta)
+{
+    __m128i a = _mm_set1_epi16(alpha), b = _mm_set1_epi16(beta);
+    __m128i p[4], q[4];
+    int i;
+
+    for (i = 0; i < 16; i += 8) {
+        load_columns(pix + i * stride, stride, p, q);
+        luma_filter_intra8(p, q, a, b);
+        store_columns(pix + i * stride, stride, p, q);
+    }
+}
+
+static SSE2 void
+luma_filter_intra_h_sse2(uint8_t *pix, ptrdiff_t stride, int alpha, int beta)
+{
+    __m128i a = _mm_set1_epi16(alpha), b = _mm_set1_epi16(beta);
+    __m128i p[4], q[4];
+    int i;
+
+    for (i = 0; i < 16; i += 8) {
+        load_rows(pix + i, stride, p, q);
+        luma_filter_intra8(p, q, a, b);
+        store_rows(pix + i, stride, p, q, 3);
+    }
+}
+
+void
+h264_dsp_init_sse2(struct h264_dsp_ops *ops)
+{
+    int i;
+
+    ops->idct4_add = idct4_add_sse2;
+    ops->idct8_add = idct8_add_sse2;
+    for (i = 0; i < 16; i++) {
+        ops->put_qpel[H264_MC_16][i] = put_qpel16_sse2[i];
+        ops->put_qpel[H264_MC_8][i] = put_qpel8_sse2[i];
+    }
+    ops->put_chroma[H264_MC_16] = put_chroma8_sse2;
+    ops->put_chroma[H264_MC_8] = put_chroma4_sse2;
+    ops->avg = avg_sse2;
+    ops->weight = weight_sse2;
+    ops->biweight = biweight_sse2;
+    ops->luma_filter[0] = luma_filter_v_sse2;
+    ops->luma_filter[1] = luma_filter_h_sse2;
+    ops->luma_filter_intra[0] = luma_filter_intra_v_sse2;
+    ops->luma_filter_intra[1] = luma_filter_intra_h_sse2;
+}
+
+#endif /* __x86_64__ || __i386__ */
@@ -0,0 +1,375 @@
+/*
+ * Copyright (c) 2012 Scott Tincman <sctincman@gmail.com>. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "config.h"
+#include <string.h>
+#include <va/va.h>
+#include "image_convert.h"
+
+#define PREFETCH(ptr)   __builtin_prefetch(ptr)
+
+static inline uint8_t
+clamp_u8(int value)
+{
+    return value < 0 ? 0 : (value > 255 ? 255 : value);
+}
+
+/*
+ * Reference kernels, the SIMD ones finish their rows with these
+ */
+static void
+split_uv_c(const uint8_t *uv, uint8_t *u, uint8_t *v, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        u[i] = uv[2 * i];
+        v[i] = uv[2 * i + 1];
+    }
+}
+
+static void
+merge_uv_c(const uint8_t *u, const uint8_t *v, uint8_t *uv, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        uv[2 * i] = u[i];
+        uv[2 * i + 1] = v[i];
+    }
+}
+
+static void
+nv12_to_yuy2_c(const uint8_t *y, const uint8_t *uv, uint8_t *yuy2, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i += 2) {
+        yuy2[2 * i] = y[i];
+        yuy2[2 * i + 1] = uv[i];
+        yuy2[2 * i + 2] = (i + 1 < n) ? y[i + 1] : y[i];
+        yuy2[2 * i + 3] = uv[i + 1];
+    }
+}
+
+static void
+yuy2_to_nv12_c(const uint8_t *src0, const uint8_t *src1, uint8_t *y0, uint8_t *y1, uint8_t *uv, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        y0[i] = src0[2 * i];
+        y1[i] = src1[2 * i];
+    }
+    for (i = 0; i < n; i += 2) {
+        uv[i] = (src0[2 * i + 1] + src1[2 * i + 1] + 1) >> 1;
+        uv[i + 1] = (src0[2 * i + 3] + src1[2 * i + 3] + 1) >> 1;
+    }
+}
+
+static void
+nv12_to_bgra_c(const uint8_t *y, const uint8_t *uv, uint8_t *bgra, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        int d = uv[i & ~1] - 128;
+        int e = uv[(i & ~1) + 1] - 128;
+        int c = IMAGE_CONVERT_Y_SCALE * (y[i] - 16) + 32;
+
+        bgra[4 * i + 0] = clamp_u8((c + IMAGE_CONVERT_B_U * d) >> 6);
+        bgra[4 * i + 1] = clamp_u8((c - IMAGE_CONVERT_G_U * d - IMAGE_CONVERT_G_V * e) >> 6);
+        bgra[4 * i + 2] = clamp_u8((c + IMAGE_CONVERT_R_V * e) >> 6);
+        bgra[4 * i + 3] = 0xff;
+    }
+}
+
+static inline uint8_t
+bgra_luma(const uint8_t *bgra)
+{
+    return ((IMAGE_CONVERT_Y_R * bgra[2] + IMAGE_CONVERT_Y_G * bgra[1] +
+             IMAGE_CONVERT_Y_B * bgra[0] + 128) >> 8) + 16;
+}
+
+static void
+bgra_to_nv12_c(const uint8_t *src0, const uint8_t *src1, uint8_t *y0, uint8_t *y1, uint8_t *uv, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        y0[i] = bgra_luma(src0 + 4 * i);
+        y1[i] = bgra_luma(src1 + 4 * i);
+    }
+    for (i = 0; i < n; i += 2) {
+        /* Average the 2x2 block, the last column of an odd width stands alone */
+        int next = (i + 1 < n) ? 4 : 0;
+        int b = (src0[4 * i + 0] + src0[4 * i + next + 0] + src1[4 * i + 0] + src1[4 * i + next + 0] + 2) >> 2;
+        int g = (src0[4 * i + 1] + src0[4 * i + next + 1] + src1[4 * i + 1] + src1[4 * i + next + 1] + 2) >> 2;
+        int r = (src0[4 * i + 2] + src0[4 * i + next + 2] + src1[4 * i + 2] + src1[4 * i + next + 2] + 2) >> 2;
+
+        uv[i] = ((IMAGE_CONVERT_U_R * r + IMAGE_CONVERT_U_G * g + IMAGE_CONVERT_U_B * b + 128) >> 8) + 128;
+        uv[i + 1] = ((IMAGE_CONVERT_V_R * r + IMAGE_CONVERT_V_G * g + IMAGE_CONVERT_V_B * b + 128) >> 8) + 128;
+    }
+}
+
+const struct image_convert_ops image_convert_c = {
+    "c",
+    split_uv_c,
+    merge_uv_c,
+    nv12_to_yuy2_c,
+    yuy2_to_nv12_c,
+    nv12_to_bgra_c,
+    bgra_to_nv12_c,
+};
+
+/* Best first */
+static const struct image_convert_ops *const image_convert_all[] = {
+#if defined(__x86_64__) || defined(__i386__)
+#ifdef HAVE_TARGET_AVX2
+    &image_convert_avx2,
+#endif
+    &image_convert_sse2,
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+    &image_convert_neon,
+#endif
+    &image_convert_c,
+};
+
+static int
+image_convert_cpu_supports(const struct image_convert_ops *ops)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+#ifdef HAVE_TARGET_AVX2
+    if (ops == &image_convert_avx2)
+        return __builtin_cpu_supports("avx2");
+#endif
+    if (ops == &image_convert_sse2)
+        return __builtin_cpu_supports("sse2");
+#endif
+    /* NEON kernels are only built when the whole driver targets NEON */
+    return 1;
+}
+
+/*
+ * Returns the kernels called name, or the best ones this CPU supports if
+ * name is NULL or not supported
+ */
+const struct image_convert_ops *
+image_convert_get_ops(const char *name)
+{
+    unsigned int i;
+    const struct image_convert_ops *best = NULL;
+
+    for (i = 0; i < sizeof(image_convert_all) / sizeof(image_convert_all[0]); i++) {
+        const struct image_convert_ops *ops = image_convert_all[i];
+
+        if (!image_convert_cpu_supports(ops))
+            continue;
+        if (!best)
+            best = ops;
+        if (name && !strcmp(name, ops->name))
+            return ops;
+    }
+    return best;
+}
+
+static int
+image_convert_format_supported(unsigned int fourcc)
+{
+    switch (fourcc) {
+    case VA_FOURCC_NV12:
+    case VA_FOURCC_I420:
+    case VA_FOURCC_YV12:
+    case VA_FOURCC_YUY2:
+    case VA_FOURCC_BGRA:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/*
+ * Returns non-zero if regions can be copied between the two fourccs
+ */
+int
+image_convert_supported(unsigned int src_fourcc, unsigned int dst_fourcc)
+{
+    if (src_fourcc == VA_FOURCC_NV12)
+        return image_convert_format_supported(dst_fourcc);
+    if (dst_fourcc == VA_FOURCC_NV12)
+        return image_convert_format_supported(src_fourcc);
+    return 0;
+}
+
+static inline uint8_t *
+plane_at(const struct image_planes *planes, int plane, int x, int y)
+{
+    return planes->data[plane] + (size_t)y * planes->pitch[plane] + x;
+}
+
+/* Copies rows of bytes, the crop window makes each row its own stream */
+static void
+copy_plane(const uint8_t *src, unsigned int src_pitch, uint8_t *dst, unsigned int dst_pitch,
+           int bytes, int rows)
+{
+    int r;
+
+    for (r = 0; r < rows; r++, src += src_pitch, dst += dst_pitch) {
+        PREFETCH(src + src_pitch);
+        if (src != dst)
+            memcpy(dst, src, bytes);
+    }
+}
+
+static int
+image_convert_from_nv12(const struct image_convert_ops *ops,
+                        const struct image_planes *src, int src_x, int src_y,
+                        const struct image_planes *dst, int dst_x, int dst_y,
+                        int width, int height)
+{
+    const uint8_t *y = plane_at(src, 0, src_x, src_y);
+    int chroma_width = (width + 1) >> 1;
+    int chroma_height = (height + 1) >> 1;
+    int u_plane = 1, v_plane = 2;
+    int r;
+
+    switch (dst->fourcc) {
+    case VA_FOURCC_NV12:
+        copy_plane(y, src->pitch[0], plane_at(dst, 0, dst_x, dst_y), dst->pitch[0], width, height);
+        copy_plane(plane_at(src, 1, src_x & ~1, src_y >> 1), src->pitch[1],
+                   plane_at(dst, 1, dst_x & ~1, dst_y >> 1), dst->pitch[1],
+                   2 * chroma_width, chroma_height);
+        return 0;
+
+    case VA_FOURCC_YV12:
+        u_plane = 2;
+        v_plane = 1;
+        /* Fall through */
+    case VA_FOURCC_I420:
+        copy_plane(y, src->pitch[0], plane_at(dst, 0, dst_x, dst_y), dst->pitch[0], width, height);
+        for (r = 0; r < chroma_height; r++) {
+            const uint8_t *uv = plane_at(src, 1, src_x & ~1, (src_y >> 1) + r);
+
+            PREFETCH(uv + src->pitch[1]);
+            ops->split_uv(uv,
+                          plane_at(dst, u_plane, dst_x >> 1, (dst_y >> 1) + r),
+                          plane_at(dst, v_plane, dst_x >> 1, (dst_y >> 1) + r),
+                          chroma_width);
+        }
+        return 0;
+
+    case VA_FOURCC_YUY2:
+        for (r = 0; r < height; r++, y += src->pitch[0]) {
+            PREFETCH(y + src->pitch[0]);
+            ops->nv12_to_yuy2(y, plane_at(src, 1, src_x & ~1, (src_y + r) >> 1),
+                              plane_at(dst, 0, 2 * (dst_x & ~1), dst_y + r), width);
+        }
+        return 0;
+
+    case VA_FOURCC_BGRA:
+        for (r = 0; r < height; r++, y += src->pitch[0]) {
+            PREFETCH(y + src->pitch[0]);
+            ops->nv12_to_bgra(y, plane_at(src, 1, src_x & ~1, (src_y + r) >> 1),
+                              plane_at(dst, 0, 4 * dst_x, dst_y + r), width);
+        }
+        return 0;
+
+    default:
+        return -1;
+    }
+}
+
+static int
+image_convert_to_nv12(const struct image_convert_ops *ops,
+                      const struct image_planes *src, int src_x, int src_y,
+                      const struct image_planes *dst, int dst_x, int dst_y,
+                      int width, int height)
+{
+    uint8_t *y = plane_at(dst, 0, dst_x, dst_y);
+    int chroma_width = (width + 1) >> 1;
+    int chroma_height = (height + 1) >> 1;
+    int u_plane = 1, v_plane = 2;
+    int r, bpp;
+
+    switch (src->fourcc) {
+    case VA_FOURCC_YV12:
+        u_plane = 2;
+        v_plane = 1;
+        /* Fall through */
+    case VA_FOURCC_I420:
+        copy_plane(plane_at(src, 0, src_x, src_y), src->pitch[0], y, dst->pitch[0], width, height);
+        for (r = 0; r < chroma_height; r++) {
+            const uint8_t *u = plane_at(src, u_plane, src_x >> 1, (src_y >> 1) + r);
+            const uint8_t *v = plane_at(src, v_plane, src_x >> 1, (src_y >> 1) + r);
+
+            PREFETCH(u + src->pitch[u_plane]);
+            PREFETCH(v + src->pitch[v_plane]);
+            ops->merge_uv(u, v, plane_at(dst, 1, dst_x & ~1, (dst_y >> 1) + r), chroma_width);
+        }
+        return 0;
+
+    case VA_FOURCC_YUY2:
+    case VA_FOURCC_BGRA:
+        bpp = (VA_FOURCC_YUY2 == src->fourcc) ? 2 : 4;
+        for (r = 0; r < height; r += 2) {
+            /* An odd last line pairs up with itself */
+            int next = (r + 1 < height) ? 1 : 0;
+            const uint8_t *src0 = plane_at(src, 0, bpp * src_x, src_y + r);
+            const uint8_t *src1 = src0 + next * src->pitch[0];
+            uint8_t *y0 = y + (size_t)r * dst->pitch[0];
+            uint8_t *y1 = y0 + next * dst->pitch[0];
+            uint8_t *uv = plane_at(dst, 1, dst_x & ~1, (dst_y + r) >> 1);
+
+            PREFETCH(src1 + src->pitch[0]);
+            if (VA_FOURCC_YUY2 == src->fourcc)
+                ops->yuy2_to_nv12(src0, src1, y0, y1, uv, width);
+            else
+                ops->bgra_to_nv12(src0, src1, y0, y1, uv, width);
+        }
+        return 0;
+
+    default:
+        return -1;
+    }
+}
+
+/*
+ * Copies a width x height region at (src_x, src_y) of src to (dst_x, dst_y)
+ * of dst. One side must be NV12.
+ * Return 0 on success, -1 if the formats can't be converted
+ */
+int
+image_convert_copy(const struct image_convert_ops *ops,
+                   const struct image_planes *src, int src_x, int src_y,
+                   const struct image_planes *dst, int dst_x, int dst_y,
+                   int width, int height)
+{
+    if (!image_convert_supported(src->fourcc, dst->fourcc))
+        return -1;
+    if (VA_FOURCC_NV12 == src->fourcc)
+        return image_convert_from_nv12(ops, src, src_x, src_y, dst, dst_x, dst_y, width, height);
+    return image_convert_to_nv12(ops, src, src_x, src_y, dst, dst_x, dst_y, width, height);
+}
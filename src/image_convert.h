@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) 2012 Scott Tincman <sctincman@gmail.com>. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef IMAGE_CONVERT_H
+#define IMAGE_CONVERT_H
+
+#include <stdint.h>
+
+/*
+ * Copies regions between NV12 surfaces and images in the formats handed out
+ * by vaQueryImageFormats(). The per-row kernels come in a portable C version
+ * and SIMD versions, picked at runtime for the CPU we run on.
+ *
+ * Colour conversion uses BT.601 limited range coefficients in 6-bit fixed
+ * point. The SIMD kernels produce exactly what the C kernels produce.
+ */
+
+/* YUV to RGB, Q6: r = (75 * (y - 16) + 102 * (v - 128) + 32) >> 6, ... */
+#define IMAGE_CONVERT_Y_SCALE   75
+#define IMAGE_CONVERT_R_V       102
+#define IMAGE_CONVERT_G_U       25
+#define IMAGE_CONVERT_G_V       52
+#define IMAGE_CONVERT_B_U       129
+
+/* RGB to YUV, Q8: y = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16, ... */
+#define IMAGE_CONVERT_Y_R       66
+#define IMAGE_CONVERT_Y_G       129
+#define IMAGE_CONVERT_Y_B       25
+#define IMAGE_CONVERT_U_R       (-38)
+#define IMAGE_CONVERT_U_G       (-74)
+#define IMAGE_CONVERT_U_B       112
+#define IMAGE_CONVERT_V_R       112
+#define IMAGE_CONVERT_V_G       (-94)
+#define IMAGE_CONVERT_V_B       (-18)
+
+/* Not all VA-API versions define it */
+#ifndef VA_FOURCC_I420
+#define VA_FOURCC_I420          0x30323449
+#endif
+
+struct image_convert_ops {
+    const char *name;
+    /* n chroma samples of interleaved UV to separate U and V rows */
+    void (*split_uv)(const uint8_t *uv, uint8_t *u, uint8_t *v, int n);
+    /* n chroma samples of separate U and V rows to interleaved UV */
+    void (*merge_uv)(const uint8_t *u, const uint8_t *v, uint8_t *uv, int n);
+    /* n pixels of an NV12 line to YUY2 */
+    void (*nv12_to_yuy2)(const uint8_t *y, const uint8_t *uv, uint8_t *yuy2, int n);
+    /* n pixels of two YUY2 lines to two Y lines and the UV line they share */
+    void (*yuy2_to_nv12)(const uint8_t *src0, const uint8_t *src1, uint8_t *y0, uint8_t *y1, uint8_t *uv, int n);
+    /* n pixels of an NV12 line to BGRA */
+    void (*nv12_to_bgra)(const uint8_t *y, const uint8_t *uv, uint8_t *bgra, int n);
+    /* n pixels of two BGRA lines to two Y lines and the UV line they share */
+    void (*bgra_to_nv12)(const uint8_t *src0, const uint8_t *src1, uint8_t *y0, uint8_t *y1, uint8_t *uv, int n);
+};
+
+/* Planes of a surface or an image, in VAImage plane order */
+struct image_planes {
+    unsigned int fourcc;
+    uint8_t *data[3];
+    unsigned int pitch[3];
+};
+
+extern const struct image_convert_ops image_convert_c;
+#if defined(__x86_64__) || defined(__i386__)
+extern const struct image_convert_ops image_convert_sse2;
+#ifdef HAVE_TARGET_AVX2
+extern const struct image_convert_ops image_convert_avx2;
+#endif
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+extern const struct image_convert_ops image_convert_neon;
+#endif
+
+/*
+ * Returns the kernels called name ("c", "sse2", "avx2" or "neon"), or the
+ * best ones this CPU supports if name is NULL or not supported
+ */
+const struct image_convert_ops *
+image_convert_get_ops(const char *name);
+
+/*
+ * Returns non-zero if regions can be copied between the two fourccs
+ */
+int
+image_convert_supported(unsigned int src_fourcc, unsigned int dst_fourcc);
+
+/*
+ * Copies a width x height region at (src_x, src_y) of src to (dst_x, dst_y)
+ * of dst. One side must be NV12. Chroma positions are rounded down to even
+ * luma positions.
+ * Return 0 on success, -1 if the formats can't be converted
+ */
+int
+image_convert_copy(const struct image_convert_ops *ops,
+                   const struct image_planes *src, int src_x, int src_y,
+                   const struct image_planes *dst, int dst_x, int dst_y,
+                   int width, int height);
+
+#endif /* IMAGE_CONVERT_H */
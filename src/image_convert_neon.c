@@ -0,0 +1,195 @@
+/*
+ * Copyright (c) 2012 Scott Tincman <sctincman@gmail.com>. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * NEON versions of the image_convert kernels, built when the compiler
+ * targets NEON (always on AArch64, -mfpu=neon on ARMv7 hosts).
+ */
+
+#include "config.h"
+#include "image_convert.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+
+#include <arm_neon.h>
+
+static void
+split_uv_neon(const uint8_t *uv, uint8_t *u, uint8_t *v, int n)
+{
+    int i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        uint8x16x2_t c = vld2q_u8(uv + 2 * i);
+
+        vst1q_u8(u + i, c.val[0]);
+        vst1q_u8(v + i, c.val[1]);
+    }
+    image_convert_c.split_uv(uv + 2 * i, u + i, v + i, n - i);
+}
+
+static void
+merge_uv_neon(const uint8_t *u, const uint8_t *v, uint8_t *uv, int n)
+{
+    int i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        uint8x16x2_t c;
+
+        c.val[0] = vld1q_u8(u + i);
+        c.val[1] = vld1q_u8(v + i);
+        vst2q_u8(uv + 2 * i, c);
+    }
+    image_convert_c.merge_uv(u + i, v + i, uv + 2 * i, n - i);
+}
+
+static void
+nv12_to_yuy2_neon(const uint8_t *y, const uint8_t *uv, uint8_t *yuy2, int n)
+{
+    int i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        uint8x16x2_t p;
+
+        p.val[0] = vld1q_u8(y + i);
+        p.val[1] = vld1q_u8(uv + i);
+        vst2q_u8(yuy2 + 2 * i, p);
+    }
+    image_convert_c.nv12_to_yuy2(y + i, uv + i, yuy2 + 2 * i, n - i);
+}
+
+static void
+yuy2_to_nv12_neon(const uint8_t *src0, const uint8_t *src1, uint8_t *y0, uint8_t *y1, uint8_t *uv, int n)
+{
+    int i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        uint8x16x2_t p0 = vld2q_u8(src0 + 2 * i);
+        uint8x16x2_t p1 = vld2q_u8(src1 + 2 * i);
+
+        vst1q_u8(y0 + i, p0.val[0]);
+        vst1q_u8(y1 + i, p1.val[0]);
+        vst1q_u8(uv + i, vrhaddq_u8(p0.val[1], p1.val[1]));
+    }
+    image_convert_c.yuy2_to_nv12(src0 + 2 * i, src1 + 2 * i, y0 + i, y1 + i, uv + i, n - i);
+}
+
+/* Eight pixels, u and v hold each chroma sample twice */
+static inline uint8x8x4_t
+yuv_to_bgra_neon(uint8x8_t y, uint8x8_t u, uint8x8_t v)
+{
+    int16x8_t d = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(u)), vdupq_n_s16(128));
+    int16x8_t e = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(v)), vdupq_n_s16(128));
+    int16x8_t l = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(y)), vdupq_n_s16(16));
+    int16x8_t c = vaddq_s16(vmulq_n_s16(l, IMAGE_CONVERT_Y_SCALE), vdupq_n_s16(32));
+    int16x8_t b, g, r;
+    uint8x8x4_t p;
+
+    /* Saturating adds stand in for the clamping of the C version */
+    b = vqaddq_s16(c, vmulq_n_s16(d, IMAGE_CONVERT_B_U));
+    g = vqaddq_s16(vqaddq_s16(c, vmulq_n_s16(d, -IMAGE_CONVERT_G_U)), vmulq_n_s16(e, -IMAGE_CONVERT_G_V));
+    r = vqaddq_s16(c, vmulq_n_s16(e, IMAGE_CONVERT_R_V));
+    p.val[0] = vqmovun_s16(vshrq_n_s16(b, 6));
+    p.val[1] = vqmovun_s16(vshrq_n_s16(g, 6));
+    p.val[2] = vqmovun_s16(vshrq_n_s16(r, 6));
+    p.val[3] = vdup_n_u8(0xff);
+    return p;
+}
+
+static void
+nv12_to_bgra_neon(const uint8_t *y, const uint8_t *uv, uint8_t *bgra, int n)
+{
+    int i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        uint8x16_t l = vld1q_u8(y + i);
+        uint8x8x2_t c = vld2_u8(uv + i);                /* 8 U and 8 V */
+        uint8x8x2_t u = vzip_u8(c.val[0], c.val[0]);    /* U0 U0 U1 U1 ... */
+        uint8x8x2_t v = vzip_u8(c.val[1], c.val[1]);
+
+        vst4_u8(bgra + 4 * i, yuv_to_bgra_neon(vget_low_u8(l), u.val[0], v.val[0]));
+        vst4_u8(bgra + 4 * i + 32, yuv_to_bgra_neon(vget_high_u8(l), u.val[1], v.val[1]));
+    }
+    image_convert_c.nv12_to_bgra(y + i, uv + i, bgra + 4 * i, n - i);
+}
+
+static inline uint8x8_t
+bgra_luma_neon(uint8x8x4_t p)
+{
+    uint16x8_t sum = vmull_u8(p.val[2], vdup_n_u8(IMAGE_CONVERT_Y_R));
+
+    sum = vmlal_u8(sum, p.val[1], vdup_n_u8(IMAGE_CONVERT_Y_G));
+    sum = vmlal_u8(sum, p.val[0], vdup_n_u8(IMAGE_CONVERT_Y_B));
+    return vadd_u8(vshrn_n_u16(vaddq_u16(sum, vdupq_n_u16(128)), 8), vdup_n_u8(16));
+}
+
+/* Rounded mean of the four 2x2 blocks of two rows */
+static inline int16x4_t
+block_mean_neon(uint8x8_t row0, uint8x8_t row1)
+{
+    return vreinterpret_s16_u16(vrshr_n_u16(vadd_u16(vpaddl_u8(row0), vpaddl_u8(row1)), 2));
+}
+
+static inline int16x4_t
+bgra_chroma_neon(int16x4_t b, int16x4_t g, int16x4_t r, int16_t cr, int16_t cg, int16_t cb)
+{
+    int16x4_t sum = vmul_n_s16(r, cr);
+
+    sum = vmla_n_s16(sum, g, cg);
+    sum = vmla_n_s16(sum, b, cb);
+    return vadd_s16(vshr_n_s16(vadd_s16(sum, vdup_n_s16(128)), 8), vdup_n_s16(128));
+}
+
+static void
+bgra_to_nv12_neon(const uint8_t *src0, const uint8_t *src1, uint8_t *y0, uint8_t *y1, uint8_t *uv, int n)
+{
+    int i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        uint8x8x4_t p0 = vld4_u8(src0 + 4 * i);
+        uint8x8x4_t p1 = vld4_u8(src1 + 4 * i);
+        int16x4_t b = block_mean_neon(p0.val[0], p1.val[0]);
+        int16x4_t g = block_mean_neon(p0.val[1], p1.val[1]);
+        int16x4_t r = block_mean_neon(p0.val[2], p1.val[2]);
+        int16x4x2_t c;
+
+        vst1_u8(y0 + i, bgra_luma_neon(p0));
+        vst1_u8(y1 + i, bgra_luma_neon(p1));
+        c = vzip_s16(bgra_chroma_neon(b, g, r, IMAGE_CONVERT_U_R, IMAGE_CONVERT_U_G, IMAGE_CONVERT_U_B),
+                     bgra_chroma_neon(b, g, r, IMAGE_CONVERT_V_R, IMAGE_CONVERT_V_G, IMAGE_CONVERT_V_B));
+        vst1_u8(uv + i, vqmovun_s16(vcombine_s16(c.val[0], c.val[1])));
+    }
+    image_convert_c.bgra_to_nv12(src0 + 4 * i, src1 + 4 * i, y0 + i, y1 + i, uv + i, n - i);
+}
+
+const struct image_convert_ops image_convert_neon = {
+    "neon",
+    split_uv_neon,
+    merge_uv_neon,
+    nv12_to_yuy2_neon,
+    yuy2_to_nv12_neon,
+    nv12_to_bgra_neon,
+    bgra_to_nv12_neon,
+};
+
+#endif /* __ARM_NEON */
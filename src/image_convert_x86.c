@@ -0,0 +1,381 @@
+/*
+ * Copyright (c) 2012 Scott Tincman <sctincman@gmail.com>. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * SSE2 and AVX2 versions of the image_convert kernels. Each function carries
+ * its own target attribute so the rest of the driver keeps the baseline
+ * instruction set, image_convert_get_ops() checks the CPU before use.
+ */
+
+#include "config.h"
+#include "image_convert.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+#define SSE2    __attribute__((target("sse2")))
+#define AVX2    __attribute__((target("avx2")))
+
+static SSE2 void
+split_uv_sse2(const uint8_t *uv, uint8_t *u, uint8_t *v, int n)
+{
+    const __m128i low = _mm_set1_epi16(0x00ff);
+    int i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(uv + 2 * i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(uv + 2 * i + 16));
+
+        _mm_storeu_si128((__m128i *)(u + i),
+                         _mm_packus_epi16(_mm_and_si128(a, low), _mm_and_si128(b, low)));
+        _mm_storeu_si128((__m128i *)(v + i),
+                         _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8)));
+    }
+    image_convert_c.split_uv(uv + 2 * i, u + i, v + i, n - i);
+}
+
+static SSE2 void
+merge_uv_sse2(const uint8_t *u, const uint8_t *v, uint8_t *uv, int n)
+{
+    int i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(u + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(v + i));
+
+        _mm_storeu_si128((__m128i *)(uv + 2 * i), _mm_unpacklo_epi8(a, b));
+        _mm_storeu_si128((__m128i *)(uv + 2 * i + 16), _mm_unpackhi_epi8(a, b));
+    }
+    image_convert_c.merge_uv(u + i, v + i, uv + 2 * i, n - i);
+}
+
+static SSE2 void
+nv12_to_yuy2_sse2(const uint8_t *y, const uint8_t *uv, uint8_t *yuy2, int n)
+{
+    int i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(y + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(uv + i));
+
+        _mm_storeu_si128((__m128i *)(yuy2 + 2 * i), _mm_unpacklo_epi8(a, b));
+        _mm_storeu_si128((__m128i *)(yuy2 + 2 * i + 16), _mm_unpackhi_epi8(a, b));
+    }
+    image_convert_c.nv12_to_yuy2(y + i, uv + i, yuy2 + 2 * i, n - i);
+}
+
+static SSE2 void
+yuy2_to_nv12_sse2(const uint8_t *src0, const uint8_t *src1, uint8_t *y0, uint8_t *y1, uint8_t *uv, int n)
+{
+    const __m128i low = _mm_set1_epi16(0x00ff);
+    int i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        __m128i a0 = _mm_loadu_si128((const __m128i *)(src0 + 2 * i));
+        __m128i b0 = _mm_loadu_si128((const __m128i *)(src0 + 2 * i + 16));
+        __m128i a1 = _mm_loadu_si128((const __m128i *)(src1 + 2 * i));
+        __m128i b1 = _mm_loadu_si128((const __m128i *)(src1 + 2 * i + 16));
+        __m128i c0 = _mm_packus_epi16(_mm_srli_epi16(a0, 8), _mm_srli_epi16(b0, 8));
+        __m128i c1 = _mm_packus_epi16(_mm_srli_epi16(a1, 8), _mm_srli_epi16(b1, 8));
+
+        _mm_storeu_si128((__m128i *)(y0 + i),
+                         _mm_packus_epi16(_mm_and_si128(a0, low), _mm_and_si128(b0, low)));
+        _mm_storeu_si128((__m128i *)(y1 + i),
+                         _mm_packus_epi16(_mm_and_si128(a1, low), _mm_and_si128(b1, low)));
+        _mm_storeu_si128((__m128i *)(uv + i), _mm_avg_epu8(c0, c1));
+    }
+    image_convert_c.yuy2_to_nv12(src0 + 2 * i, src1 + 2 * i, y0 + i, y1 + i, uv + i, n - i);
+}
+
+/*
+ * Eight pixels of 16-bit luma and their interleaved 16-bit chroma to 16-bit
+ * B, G and R. Adds saturate where the C version clamps, which gives the same
+ * bytes after packing.
+ */
+static inline SSE2 void
+yuv_to_rgb_sse2(__m128i y, __m128i uv, __m128i *b, __m128i *g, __m128i *r)
+{
+    const __m128i low = _mm_set1_epi32(0x0000ffff);
+    __m128i u = _mm_or_si128(_mm_and_si128(uv, low), _mm_slli_epi32(uv, 16));
+    __m128i v = _mm_or_si128(_mm_srli_epi32(uv, 16), _mm_andnot_si128(low, uv));
+    __m128i d = _mm_sub_epi16(u, _mm_set1_epi16(128));
+    __m128i e = _mm_sub_epi16(v, _mm_set1_epi16(128));
+    __m128i c = _mm_add_epi16(_mm_mullo_epi16(_mm_sub_epi16(y, _mm_set1_epi16(16)),
+                                              _mm_set1_epi16(IMAGE_CONVERT_Y_SCALE)),
+                              _mm_set1_epi16(32));
+
+    *b = _mm_srai_epi16(_mm_adds_epi16(c, _mm_mullo_epi16(d, _mm_set1_epi16(IMAGE_CONVERT_B_U))), 6);
+    *g = _mm_srai_epi16(_mm_adds_epi16(_mm_adds_epi16(c, _mm_mullo_epi16(d, _mm_set1_epi16(-IMAGE_CONVERT_G_U))),
+                                       _mm_mullo_epi16(e, _mm_set1_epi16(-IMAGE_CONVERT_G_V))), 6);
+    *r = _mm_srai_epi16(_mm_adds_epi16(c, _mm_mullo_epi16(e, _mm_set1_epi16(IMAGE_CONVERT_R_V))), 6);
+}
+
+static SSE2 void
+nv12_to_bgra_sse2(const uint8_t *y, const uint8_t *uv, uint8_t *bgra, int n)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i alpha = _mm_set1_epi8(-1);
+    int i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        __m128i yv = _mm_loadu_si128((const __m128i *)(y + i));
+        __m128i cv = _mm_loadu_si128((const __m128i *)(uv + i));
+        __m128i b0, g0, r0, b1, g1, r1, b, g, r, bg, ra;
+
+        yuv_to_rgb_sse2(_mm_unpacklo_epi8(yv, zero), _mm_unpacklo_epi8(cv, zero), &b0, &g0, &r0);
+        yuv_to_rgb_sse2(_mm_unpackhi_epi8(yv, zero), _mm_unpackhi_epi8(cv, zero), &b1, &g1, &r1);
+        b = _mm_packus_epi16(b0, b1);
+        g = _mm_packus_epi16(g0, g1);
+        r = _mm_packus_epi16(r0, r1);
+
+        bg = _mm_unpacklo_epi8(b, g);
+        ra = _mm_unpacklo_epi8(r, alpha);
+        _mm_storeu_si128((__m128i *)(bgra + 4 * i), _mm_unpacklo_epi16(bg, ra));
+        _mm_storeu_si128((__m128i *)(bgra + 4 * i + 16), _mm_unpackhi_epi16(bg, ra));
+        bg = _mm_unpackhi_epi8(b, g);
+        ra = _mm_unpackhi_epi8(r, alpha);
+        _mm_storeu_si128((__m128i *)(bgra + 4 * i + 32), _mm_unpacklo_epi16(bg, ra));
+        _mm_storeu_si128((__m128i *)(bgra + 4 * i + 48), _mm_unpackhi_epi16(bg, ra));
+    }
+    image_convert_c.nv12_to_bgra(y + i, uv + i, bgra + 4 * i, n - i);
+}
+
+/* Eight BGRA pixels to 16-bit B, G and R */
+static inline SSE2 void
+load_bgra_sse2(const uint8_t *src, __m128i *b, __m128i *g, __m128i *r)
+{
+    const __m128i mask = _mm_set1_epi32(0xff);
+    __m128i p0 = _mm_loadu_si128((const __m128i *)src);
+    __m128i p1 = _mm_loadu_si128((const __m128i *)(src + 16));
+
+    *b = _mm_packs_epi32(_mm_and_si128(p0, mask), _mm_and_si128(p1, mask));
+    *g = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p0, 8), mask),
+                         _mm_and_si128(_mm_srli_epi32(p1, 8), mask));
+    *r = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p0, 16), mask),
+                         _mm_and_si128(_mm_srli_epi32(p1, 16), mask));
+}
+
+/* The sums fit 16 bits unsigned, so wrapping adds and a logical shift do */
+static inline SSE2 __m128i
+bgra_luma_sse2(__m128i b, __m128i g, __m128i r)
+{
+    __m128i sum = _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(IMAGE_CONVERT_Y_R)),
+                                _mm_mullo_epi16(g, _mm_set1_epi16(IMAGE_CONVERT_Y_G)));
+
+    sum = _mm_add_epi16(sum, _mm_mullo_epi16(b, _mm_set1_epi16(IMAGE_CONVERT_Y_B)));
+    sum = _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(128)), 8);
+    return _mm_add_epi16(sum, _mm_set1_epi16(16));
+}
+
+/* Rounded mean of the 2x2 blocks of two rows, four results repeated twice */
+static inline SSE2 __m128i
+block_mean_sse2(__m128i row0, __m128i row1)
+{
+    __m128i sum = _mm_add_epi16(row0, row1);
+
+    sum = _mm_and_si128(_mm_add_epi16(sum, _mm_srli_epi32(sum, 16)), _mm_set1_epi32(0xffff));
+    sum = _mm_srli_epi32(_mm_add_epi32(sum, _mm_set1_epi32(2)), 2);
+    return _mm_packs_epi32(sum, sum);
+}
+
+static inline SSE2 __m128i
+bgra_chroma_sse2(__m128i b, __m128i g, __m128i r, int cr, int cg, int cb)
+{
+    __m128i sum = _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(cr)),
+                                _mm_mullo_epi16(g, _mm_set1_epi16(cg)));
+
+    sum = _mm_add_epi16(sum, _mm_mullo_epi16(b, _mm_set1_epi16(cb)));
+    sum = _mm_srai_epi16(_mm_add_epi16(sum, _mm_set1_epi16(128)), 8);
+    return _mm_add_epi16(sum, _mm_set1_epi16(128));
+}
+
+static SSE2 void
+bgra_to_nv12_sse2(const uint8_t *src0, const uint8_t *src1, uint8_t *y0, uint8_t *y1, uint8_t *uv, int n)
+{
+    int i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        __m128i b0, g0, r0, b1, g1, r1, b, g, r, u, v;
+
+        load_bgra_sse2(src0 + 4 * i, &b0, &g0, &r0);
+        load_bgra_sse2(src1 + 4 * i, &b1, &g1, &r1);
+        u = bgra_luma_sse2(b0, g0, r0);
+        _mm_storel_epi64((__m128i *)(y0 + i), _mm_packus_epi16(u, u));
+        v = bgra_luma_sse2(b1, g1, r1);
+        _mm_storel_epi64((__m128i *)(y1 + i), _mm_packus_epi16(v, v));
+
+        b = block_mean_sse2(b0, b1);
+        g = block_mean_sse2(g0, g1);
+        r = block_mean_sse2(r0, r1);
+        u = bgra_chroma_sse2(b, g, r, IMAGE_CONVERT_U_R, IMAGE_CONVERT_U_G, IMAGE_CONVERT_U_B);
+        v = bgra_chroma_sse2(b, g, r, IMAGE_CONVERT_V_R, IMAGE_CONVERT_V_G, IMAGE_CONVERT_V_B);
+        u = _mm_unpacklo_epi16(u, v);
+        _mm_storel_epi64((__m128i *)(uv + i), _mm_packus_epi16(u, u));
+    }
+    image_convert_c.bgra_to_nv12(src0 + 4 * i, src1 + 4 * i, y0 + i, y1 + i, uv + i, n - i);
+}
+
+const struct image_convert_ops image_convert_sse2 = {
+    "sse2",
+    split_uv_sse2,
+    merge_uv_sse2,
+    nv12_to_yuy2_sse2,
+    yuy2_to_nv12_sse2,
+    nv12_to_bgra_sse2,
+    bgra_to_nv12_sse2,
+};
+
+#ifdef HAVE_TARGET_AVX2
+
+/* 256-bit packs and unpacks work per 128-bit lane, the permutes restore order */
+
+static AVX2 void
+split_uv_avx2(const uint8_t *uv, uint8_t *u, uint8_t *v, int n)
+{
+    const __m256i low = _mm256_set1_epi16(0x00ff);
+    int i;
+
+    for (i = 0; i + 32 <= n; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(uv + 2 * i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(uv + 2 * i + 32));
+        __m256i uu = _mm256_packus_epi16(_mm256_and_si256(a, low), _mm256_and_si256(b, low));
+        __m256i vv = _mm256_packus_epi16(_mm256_srli_epi16(a, 8), _mm256_srli_epi16(b, 8));
+
+        _mm256_storeu_si256((__m256i *)(u + i), _mm256_permute4x64_epi64(uu, 0xd8));
+        _mm256_storeu_si256((__m256i *)(v + i), _mm256_permute4x64_epi64(vv, 0xd8));
+    }
+    split_uv_sse2(uv + 2 * i, u + i, v + i, n - i);
+}
+
+static AVX2 void
+merge_uv_avx2(const uint8_t *u, const uint8_t *v, uint8_t *uv, int n)
+{
+    int i;
+
+    for (i = 0; i + 32 <= n; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(u + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(v + i));
+        __m256i lo = _mm256_unpacklo_epi8(a, b);
+        __m256i hi = _mm256_unpackhi_epi8(a, b);
+
+        _mm256_storeu_si256((__m256i *)(uv + 2 * i), _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256((__m256i *)(uv + 2 * i + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+    merge_uv_sse2(u + i, v + i, uv + 2 * i, n - i);
+}
+
+static AVX2 void
+nv12_to_yuy2_avx2(const uint8_t *y, const uint8_t *uv, uint8_t *yuy2, int n)
+{
+    int i;
+
+    for (i = 0; i + 32 <= n; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(y + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(uv + i));
+        __m256i lo = _mm256_unpacklo_epi8(a, b);
+        __m256i hi = _mm256_unpackhi_epi8(a, b);
+
+        _mm256_storeu_si256((__m256i *)(yuy2 + 2 * i), _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256((__m256i *)(yuy2 + 2 * i + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+    nv12_to_yuy2_sse2(y + i, uv + i, yuy2 + 2 * i, n - i);
+}
+
+static AVX2 void
+yuy2_to_nv12_avx2(const uint8_t *src0, const uint8_t *src1, uint8_t *y0, uint8_t *y1, uint8_t *uv, int n)
+{
+    const __m256i low = _mm256_set1_epi16(0x00ff);
+    int i;
+
+    for (i = 0; i + 32 <= n; i += 32) {
+        __m256i a0 = _mm256_loadu_si256((const __m256i *)(src0 + 2 * i));
+        __m256i b0 = _mm256_loadu_si256((const __m256i *)(src0 + 2 * i + 32));
+        __m256i a1 = _mm256_loadu_si256((const __m256i *)(src1 + 2 * i));
+        __m256i b1 = _mm256_loadu_si256((const __m256i *)(src1 + 2 * i + 32));
+        __m256i l0 = _mm256_packus_epi16(_mm256_and_si256(a0, low), _mm256_and_si256(b0, low));
+        __m256i l1 = _mm256_packus_epi16(_mm256_and_si256(a1, low), _mm256_and_si256(b1, low));
+        __m256i c0 = _mm256_packus_epi16(_mm256_srli_epi16(a0, 8), _mm256_srli_epi16(b0, 8));
+        __m256i c1 = _mm256_packus_epi16(_mm256_srli_epi16(a1, 8), _mm256_srli_epi16(b1, 8));
+
+        _mm256_storeu_si256((__m256i *)(y0 + i), _mm256_permute4x64_epi64(l0, 0xd8));
+        _mm256_storeu_si256((__m256i *)(y1 + i), _mm256_permute4x64_epi64(l1, 0xd8));
+        _mm256_storeu_si256((__m256i *)(uv + i),
+                            _mm256_permute4x64_epi64(_mm256_avg_epu8(c0, c1), 0xd8));
+    }
+    yuy2_to_nv12_sse2(src0 + 2 * i, src1 + 2 * i, y0 + i, y1 + i, uv + i, n - i);
+}
+
+static AVX2 void
+nv12_to_bgra_avx2(const uint8_t *y, const uint8_t *uv, uint8_t *bgra, int n)
+{
+    const __m256i low = _mm256_set1_epi32(0x0000ffff);
+    const __m256i alpha = _mm256_set1_epi8(-1);
+    int i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        /* Zero extension keeps pixel order, unlike the in-lane unpacks */
+        __m256i yw = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(y + i)));
+        __m256i cw = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(uv + i)));
+        __m256i u = _mm256_or_si256(_mm256_and_si256(cw, low), _mm256_slli_epi32(cw, 16));
+        __m256i v = _mm256_or_si256(_mm256_srli_epi32(cw, 16), _mm256_andnot_si256(low, cw));
+        __m256i d = _mm256_sub_epi16(u, _mm256_set1_epi16(128));
+        __m256i e = _mm256_sub_epi16(v, _mm256_set1_epi16(128));
+        __m256i c = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_sub_epi16(yw, _mm256_set1_epi16(16)),
+                                                        _mm256_set1_epi16(IMAGE_CONVERT_Y_SCALE)),
+                                     _mm256_set1_epi16(32));
+        __m256i b, g, r, bg, ra, p0, p1;
+
+        b = _mm256_srai_epi16(_mm256_adds_epi16(c, _mm256_mullo_epi16(d, _mm256_set1_epi16(IMAGE_CONVERT_B_U))), 6);
+        g = _mm256_srai_epi16(_mm256_adds_epi16(_mm256_adds_epi16(c, _mm256_mullo_epi16(d, _mm256_set1_epi16(-IMAGE_CONVERT_G_U))),
+                                                _mm256_mullo_epi16(e, _mm256_set1_epi16(-IMAGE_CONVERT_G_V))), 6);
+        r = _mm256_srai_epi16(_mm256_adds_epi16(c, _mm256_mullo_epi16(e, _mm256_set1_epi16(IMAGE_CONVERT_R_V))), 6);
+
+        b = _mm256_packus_epi16(b, b);
+        g = _mm256_packus_epi16(g, g);
+        r = _mm256_packus_epi16(r, r);
+        bg = _mm256_unpacklo_epi8(b, g);
+        ra = _mm256_unpacklo_epi8(r, alpha);
+        p0 = _mm256_unpacklo_epi16(bg, ra);     /* Pixels 0-3 and 8-11 */
+        p1 = _mm256_unpackhi_epi16(bg, ra);     /* Pixels 4-7 and 12-15 */
+        _mm256_storeu_si256((__m256i *)(bgra + 4 * i), _mm256_permute2x128_si256(p0, p1, 0x20));
+        _mm256_storeu_si256((__m256i *)(bgra + 4 * i + 32), _mm256_permute2x128_si256(p0, p1, 0x31));
+    }
+    image_convert_c.nv12_to_bgra(y + i, uv + i, bgra + 4 * i, n - i);
+}
+
+/* There is no AVX2 BGRA to NV12 kernel yet, use the SSE2 one */
+const struct image_convert_ops image_convert_avx2 = {
+    "avx2",
+    split_uv_avx2,
+    merge_uv_avx2,
+    nv12_to_yuy2_avx2,
+    yuy2_to_nv12_avx2,
+    nv12_to_bgra_avx2,
+    bgra_to_nv12_sse2,
+};
+
+#endif /* HAVE_TARGET_AVX2 */
+
+#endif /* __x86_64__ || __i386__ */
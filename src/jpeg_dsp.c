@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2012 Scott Tincman <sctincman@gmail.com>. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+
+#include "config.h"
+#include <pthread.h>
+#include <string.h>
+#include "jpeg_dsp.h"
+
+static void
+interleave_down_c(uint8_t *uv, const uint8_t *cb0, const uint8_t *cb1,
+                  const uint8_t *cr0, const uint8_t *cr1, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        uv[2 * i] = (cb0[2 * i] + cb0[2 * i + 1] + cb1[2 * i] + cb1[2 * i + 1] + 2) >> 2;
+        uv[2 * i + 1] = (cr0[2 * i] + cr0[2 * i + 1] + cr1[2 * i] + cr1[2 * i + 1] + 2) >> 2;
+    }
+}
+
+static void
+interleave_same_c(uint8_t *uv, const uint8_t *cb0, const uint8_t *cb1,
+                  const uint8_t *cr0, const uint8_t *cr1, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        uv[2 * i] = (cb0[i] + cb1[i] + 1) >> 1;
+        uv[2 * i + 1] = (cr0[i] + cr1[i] + 1) >> 1;
+    }
+}
+
+/*
+ * Sample k of a row upsampled twice from the sums of two rows: 3/4 of
+ * the nearest source sample and 1/4 of the next nearest, rounding the
+ * even and odd ones differently so they do not drift
+ */
+static inline int
+upsample(const uint8_t *r0, const uint8_t *r1, int k)
+{
+    int i = k >> 1;
+    int j = k & 1 ? i + 1 : i - 1;
+
+    return (3 * (r0[i] + r1[i]) + r0[j] + r1[j] + (k & 1 ? 4 : 2)) >> 3;
+}
+
+static void
+interleave_up_c(uint8_t *uv, const uint8_t *cb0, const uint8_t *cb1,
+                const uint8_t *cr0, const uint8_t *cr1, int n)
+{
+    int k;
+
+    for (k = 0; k < n; k++) {
+        uv[2 * k] = upsample(cb0, cb1, k);
+        uv[2 * k + 1] = upsample(cr0, cr1, k);
+    }
+}
+
+const struct jpeg_dsp_ops jpeg_dsp_c = {
+    "c",
+    { interleave_down_c, interleave_same_c, interleave_up_c },
+};
+#if defined(__x86_64__) || defined(__i386__)
+static struct jpeg_dsp_ops jpeg_dsp_sse2;
+#endif
+static pthread_once_t jpeg_dsp_once = PTHREAD_ONCE_INIT;
+
+static void
+jpeg_dsp_init(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    jpeg_dsp_sse2 = jpeg_dsp_c;
+    jpeg_dsp_sse2.name = "sse2";
+    jpeg_dsp_init_sse2(&jpeg_dsp_sse2);
+#endif
+}
+
+/* Best first */
+static const struct jpeg_dsp_ops *const jpeg_dsp_all[] = {
+#if defined(__x86_64__) || defined(__i386__)
+    &jpeg_dsp_sse2,
+#endif
+    &jpeg_dsp_c,
+};
+
+static int
+jpeg_dsp_cpu_supports(const struct jpeg_dsp_ops *ops)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (ops == &jpeg_dsp_sse2)
+        return __builtin_cpu_supports("sse2");
+#endif
+    return 1;
+}
+
+const struct jpeg_dsp_ops *
+jpeg_dsp_get_ops(const char *name)
+{
+    unsigned int i;
+    const struct jpeg_dsp_ops *best = NULL;
+
+    pthread_once(&jpeg_dsp_once, jpeg_dsp_init);
+    for (i = 0; i < sizeof(jpeg_dsp_all) / sizeof(jpeg_dsp_all[0]); i++) {
+        const struct jpeg_dsp_ops *ops = jpeg_dsp_all[i];
+
+        if (!jpeg_dsp_cpu_supports(ops))
+            continue;
+        if (!best)
+            best = ops;
+        if (name && !strcmp(name, ops->name))
+            return ops;
+    }
+    return best;
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2012 Scott Tincman <sctincman@gmail.com>. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+
+#ifndef JPEG_DSP_H
+#define JPEG_DSP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Chroma resampling of the JPEG decoder. JPEG pictures come with their
+ * chroma at 4:4:4, 4:2:2, 4:2:0, 4:4:0 or 4:1:1, the surfaces are NV12,
+ * so each row of the UV plane is made from one or two rows of the Cb
+ * and Cr planes and interleaved. Like the dsp kernels they come in a C
+ * version and SIMD versions picked at runtime that match it exactly.
+ */
+
+/* Source columns per UV pair, indexing the interleave table */
+#define JPEG_CHROMA_DOWN        0       /* Two: 4:4:4 and 4:4:0, a box filter */
+#define JPEG_CHROMA_SAME        1       /* One: 4:2:2 and 4:2:0 */
+#define JPEG_CHROMA_UP          2       /* A half: 4:1:1, the triangle filter of libjpeg */
+
+/*
+ * Writes n UV pairs from the average of rows 0 and 1 of Cb and Cr,
+ * which may be the same row. The sample before the first of each row
+ * and the one after the last of it must be readable and should repeat
+ * the edge, as the upsampling filter reads them.
+ */
+typedef void (*jpeg_interleave_func)(uint8_t *uv, const uint8_t *cb0, const uint8_t *cb1,
+                                     const uint8_t *cr0, const uint8_t *cr1, int n);
+
+struct jpeg_dsp_ops {
+    const char *name;
+    jpeg_interleave_func interleave[3];
+};
+
+extern const struct jpeg_dsp_ops jpeg_dsp_c;
+#if defined(__x86_64__) || defined(__i386__)
+/* Fills in the SIMD kernels of a copy of the C table */
+void
+jpeg_dsp_init_sse2(struct jpeg_dsp_ops *ops);
+#endif
+
+/*
+ * Returns the kernels called name ("c" or "sse2"), or the best ones this
+ * CPU supports if name is NULL or not supported
+ */
+const struct jpeg_dsp_ops *
+jpeg_dsp_get_ops(const char *name);
+
+#endif /* JPEG_DSP_H */
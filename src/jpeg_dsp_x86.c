@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) 2012 Scott Tincman <sctincman@gmail.com>. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+
+/*
+ * SSE2 versions of the JPEG chroma resampling. Sums of four samples and
+ * the upsampling filter fit 16-bit lanes, so they match the C ones
+ * exactly. Rows shorter than one vector are left to the C kernels, the
+ * last vector of longer ones overlaps the one before it.
+ */
+
+#include "config.h"
+#include "jpeg_dsp.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+#define SSE2    __attribute__((target("sse2")))
+
+static inline SSE2 __m128i
+load8(const uint8_t *p)
+{
+    return _mm_loadl_epi64((const __m128i *) p);
+}
+
+static inline SSE2 __m128i
+load16(const uint8_t *p)
+{
+    return _mm_loadu_si128((const __m128i *) p);
+}
+
+/* Zero extends 8 bytes to 16-bit lanes */
+static inline SSE2 __m128i
+widen8(const uint8_t *p)
+{
+    return _mm_unpacklo_epi8(load8(p), _mm_setzero_si128());
+}
+
+/* Interleaves 16 Cb and 16 Cr samples into 16 UV pairs */
+static inline SSE2 void
+store_uv(uint8_t *uv, __m128i cb, __m128i cr)
+{
+    _mm_storeu_si128((__m128i *) uv, _mm_unpacklo_epi8(cb, cr));
+    _mm_storeu_si128((__m128i *) (uv + 16), _mm_unpackhi_epi8(cb, cr));
+}
+
+/* Sums of the horizontal pairs of 16 samples of two rows, in 8 lanes */
+static inline SSE2 __m128i
+sum_pairs(const uint8_t *r0, const uint8_t *r1)
+{
+    __m128i mask = _mm_set1_epi16(0xff);
+    __m128i a = load16(r0), b = load16(r1);
+
+    return _mm_add_epi16(_mm_add_epi16(_mm_and_si128(a, mask), _mm_srli_epi16(a, 8)),
+                         _mm_add_epi16(_mm_and_si128(b, mask), _mm_srli_epi16(b, 8)));
+}
+
+static SSE2 void
+interleave_down_sse2(uint8_t *uv, const uint8_t *cb0, const uint8_t *cb1,
+                     const uint8_t *cr0, const uint8_t *cr1, int n)
+{
+    __m128i two = _mm_set1_epi16(2);
+    int i;
+
+    if (n < 8) {
+        jpeg_dsp_c.interleave[JPEG_CHROMA_DOWN](uv, cb0, cb1, cr0, cr1, n);
+        return;
+    }
+    for (i = 0;; i += 8) {
+        __m128i cb, cr;
+
+        if (i > n - 8)
+            i = n - 8;
+        cb = _mm_srli_epi16(_mm_add_epi16(sum_pairs(cb0 + 2 * i, cb1 + 2 * i), two), 2);
+        cr = _mm_srli_epi16(_mm_add_epi16(sum_pairs(cr0 + 2 * i, cr1 + 2 * i), two), 2);
+        _mm_storeu_si128((__m128i *) (uv + 2 * i), _mm_or_si128(cb, _mm_slli_epi16(cr, 8)));
+        if (i == n - 8)
+            break;
+    }
+}
+
+static SSE2 void
+interleave_same_sse2(uint8_t *uv, const uint8_t *cb0, const uint8_t *cb1,
+                     const uint8_t *cr0, const uint8_t *cr1, int n)
+{
+    int i;
+
+    if (n < 16) {
+        jpeg_dsp_c.interleave[JPEG_CHROMA_SAME](uv, cb0, cb1, cr0, cr1, n);
+        return;
+    }
+    for (i = 0;; i += 16) {
+        if (i > n - 16)
+            i = n - 16;
+        store_uv(uv + 2 * i, _mm_avg_epu8(load16(cb0 + i), load16(cb1 + i)),
+                 _mm_avg_epu8(load16(cr0 + i), load16(cr1 + i)));
+        if (i == n - 16)
+            break;
+    }
+}
+
+/* 16 samples upsampled from the 8 at the sums of two rows at i */
+static inline SSE2 __m128i
+upsample16(const uint8_t *r0, const uint8_t *r1, int i)
+{
+    __m128i prev = _mm_add_epi16(widen8(r0 + i - 1), widen8(r1 + i - 1));
+    __m128i cur = _mm_add_epi16(widen8(r0 + i), widen8(r1 + i));
+    __m128i next = _mm_add_epi16(widen8(r0 + i + 1), widen8(r1 + i + 1));
+    __m128i cur3 = _mm_add_epi16(cur, _mm_add_epi16(cur, cur));
+    __m128i even = _mm_add_epi16(_mm_add_epi16(cur3, prev), _mm_set1_epi16(2));
+    __m128i odd = _mm_add_epi16(_mm_add_epi16(cur3, next), _mm_set1_epi16(4));
+
+    even = _mm_srli_epi16(even, 3);
+    odd = _mm_srli_epi16(odd, 3);
+    return _mm_unpacklo_epi8(_mm_packus_epi16(even, even), _mm_packus_epi16(odd, odd));
+}
+
+static SSE2 void
+interleave_up_sse2(uint8_t *uv, const uint8_t *cb0, const uint8_t *cb1,
+                   const uint8_t *cr0, const uint8_t *cr1, int n)
+{
+    int k;
+
+    if (n < 16) {
+        jpeg_dsp_c.interleave[JPEG_CHROMA_UP](uv, cb0, cb1, cr0, cr1, n);
+        return;
+    }
+    for (k = 0;; k += 16) {
+        /* Vectors start at even pairs, the source sample of a pair being k / 2 */
+        if (k > n - 16)
+            k = (n - 16) & ~1;
+        store_uv(uv + 2 * k, upsample16(cb0, cb1, k >> 1), upsample16(cr0, cr1, k >> 1));
+        if (k >= n - 17)
+            break;
+    }
+    /* An odd count ends with a pair the aligned vectors miss */
+    if (n & 1)
+        jpeg_dsp_c.interleave[JPEG_CHROMA_UP](uv + 2 * (n - 1), cb0 + ((n - 1) >> 1), cb1 + ((n - 1) >> 1),
+                                              cr0 + ((n - 1) >> 1), cr1 + ((n - 1) >> 1), 1);
+}
+
+void
+jpeg_dsp_init_sse2(struct jpeg_dsp_ops *ops)
+{
+    ops->interleave[JPEG_CHROMA_DOWN] = interleave_down_sse2;
+    ops->interleave[JPEG_CHROMA_SAME] = interleave_same_sse2;
+    ops->interleave[JPEG_CHROMA_UP] = interleave_up_sse2;
+}
+
+#endif /* __x86_64__ || __i386__ */
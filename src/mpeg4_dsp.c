@@ -0,0 +1,391 @@
+/*
+ * Copyright (c) 2012 Scott Tincman <sctincman@gmail.com>. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "config.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mpeg4_dsp.h"
+
+static inline uint8_t
+clip_u8(int value)
+{
+    return value < 0 ? 0 : (value > 255 ? 255 : value);
+}
+
+/*
+ * 7.6.2.2, the 8 tap filter at sample x of a block of size + 1 samples
+ * step apart, mirrored back into the block at both of its ends
+ */
+static inline int
+qpel_filter(const uint8_t *src, ptrdiff_t step, int x, int size)
+{
+    static const int taps[8] = { -1, 3, -6, 20, 20, -6, 3, -1 };
+    int i, j, sum = 0;
+
+    for (i = 0; i < 8; i++) {
+        j = x + i - 3;
+        if (j < 0)
+            j = -1 - j;
+        else if (j > size)
+            j = 2 * size + 1 - j;
+        sum += taps[i] * src[j * step];
+    }
+    return sum;
+}
+
+/* Horizontal half samples of rows rows */
+static void
+qpel_h_c(uint8_t *dst, ptrdiff_t dst_stride, const uint8_t *src, ptrdiff_t src_stride,
+         int size, int rows, int rnd)
+{
+    int x, y;
+
+    for (y = 0; y < rows; y++) {
+        for (x = 0; x < size; x++)
+            dst[x] = clip_u8((qpel_filter(src, 1, x, size) + 16 - rnd) >> 5);
+        dst += dst_stride;
+        src += src_stride;
+    }
+}
+
+/* Vertical half samples of size rows from size + 1 */
+static void
+qpel_v_c(uint8_t *dst, ptrdiff_t dst_stride, const uint8_t *src, ptrdiff_t src_stride,
+         int size, int rnd)
+{
+    int x, y;
+
+    for (y = 0; y < size; y++) {
+        for (x = 0; x < size; x++)
+            dst[x] = clip_u8((qpel_filter(src + x, src_stride, y, size) + 16 - rnd) >> 5);
+        dst += dst_stride;
+    }
+}
+
+/* The average of two predictions, rounding down when rnd is set */
+static void
+l2_c(uint8_t *dst, ptrdiff_t dst_stride, const uint8_t *a, ptrdiff_t a_stride,
+     const uint8_t *b, ptrdiff_t b_stride, int width, int rows, int rnd)
+{
+    int x, y;
+
+    for (y = 0; y < rows; y++) {
+        for (x = 0; x < width; x++)
+            dst[x] = (a[x] + b[x] + 1 - rnd) >> 1;
+        dst += dst_stride;
+        a += a_stride;
+        b += b_stride;
+    }
+}
+
+/*
+ * The quarter samples between full and half samples are their average;
+ * the diagonal ones average the horizontal quarter samples with their
+ * vertical half samples as in the reference decoder
+ */
+static inline void
+put_qpel_c(uint8_t *dst, ptrdiff_t dst_stride, const uint8_t *src, ptrdiff_t src_stride,
+           int size, int dxy, int rnd)
+{
+    uint8_t half[17 * 16], halfv[16 * 16];
+    int fx = dxy & 3, fy = dxy >> 2;
+
+    if (!fy) {
+        if (!fx) {
+            l2_c(dst, dst_stride, src, src_stride, src, src_stride, size, size, 0);
+        } else if (fx == 2) {
+            qpel_h_c(dst, dst_stride, src, src_stride, size, size, rnd);
+        } else {
+            qpel_h_c(half, 16, src, src_stride, size, size, rnd);
+            l2_c(dst, dst_stride, src + (fx == 3), src_stride, half, 16, size, size, rnd);
+        }
+        return;
+    }
+    if (!fx) {
+        if (fy == 2) {
+            qpel_v_c(dst, dst_stride, src, src_stride, size, rnd);
+        } else {
+            qpel_v_c(halfv, 16, src, src_stride, size, rnd);
+            l2_c(dst, dst_stride, src + (fy == 3) * src_stride, src_stride, halfv, 16,
+                 size, size, rnd);
+        }
+        return;
+    }
+    qpel_h_c(half, 16, src, src_stride, size, size + 1, rnd);
+    if (fx != 2)
+        l2_c(half, 16, half, 16, src + (fx == 3), src_stride, size, size + 1, rnd);
+    if (fy == 2) {
+        qpel_v_c(dst, dst_stride, half, 16, size, rnd);
+    } else {
+        qpel_v_c(halfv, 16, half, 16, size, rnd);
+        l2_c(dst, dst_stride, half + (fy == 3) * 16, 16, halfv, 16, size, size, rnd);
+    }
+}
+
+#define QPEL_C(size, fx, fy)                                                    \
+static void                                                                     \
+put_qpel##size##_##fx##fy##_c(uint8_t *dst, ptrdiff_t dst_stride,               \
+                              const uint8_t *src, ptrdiff_t src_stride, int rnd) \
+{                                                                               \
+    put_qpel_c(dst, dst_stride, src, src_stride, size, (fy << 2) | fx, rnd);    \
+}
+
+#define QPEL_SIZE_C(size)                                                       \
+QPEL_C(size, 0, 0) QPEL_C(size, 1, 0) QPEL_C(size, 2, 0) QPEL_C(size, 3, 0)     \
+QPEL_C(size, 0, 1) QPEL_C(size, 1, 1) QPEL_C(size, 2, 1) QPEL_C(size, 3, 1)     \
+QPEL_C(size, 0, 2) QPEL_C(size, 1, 2) QPEL_C(size, 2, 2) QPEL_C(size, 3, 2)     \
+QPEL_C(size, 0, 3) QPEL_C(size, 1, 3) QPEL_C(size, 2, 3) QPEL_C(size, 3, 3)
+
+QPEL_SIZE_C(16)
+QPEL_SIZE_C(8)
+
+#define QPEL_TABLE(size, suffix) {                                              \
+    put_qpel##size##_00_##suffix, put_qpel##size##_10_##suffix,                 \
+    put_qpel##size##_20_##suffix, put_qpel##size##_30_##suffix,                 \
+    put_qpel##size##_01_##suffix, put_qpel##size##_11_##suffix,                 \
+    put_qpel##size##_21_##suffix, put_qpel##size##_31_##suffix,                 \
+    put_qpel##size##_02_##suffix, put_qpel##size##_12_##suffix,                 \
+    put_qpel##size##_22_##suffix, put_qpel##size##_32_##suffix,                 \
+    put_qpel##size##_03_##suffix, put_qpel##size##_13_##suffix,                 \
+    put_qpel##size##_23_##suffix, put_qpel##size##_33_##suffix,                 \
+}
+
+/*
+ * 7.6.2.1, bilinear half samples of width bytes whose horizontal
+ * neighbours are step apart, rounding down when rnd is set
+ */
+static inline void
+put_hpel_c(uint8_t *dst, ptrdiff_t dst_stride, const uint8_t *src, ptrdiff_t src_stride,
+           int width, int height, int step, int hx, int hy, int rnd)
+{
+    int x, y;
+
+    for (y = 0; y < height; y++) {
+        for (x = 0; x < width; x++) {
+            if (hx && hy)
+                dst[x] = (src[x] + src[x + step] + src[x + src_stride] +
+                          src[x + src_stride + step] + 2 - rnd) >> 2;
+            else if (hx || hy)
+                dst[x] = (src[x] + src[x + (hy ? src_stride : step)] + 1 - rnd) >> 1;
+            else
+                dst[x] = src[x];
+        }
+        dst += dst_stride;
+        src += src_stride;
+    }
+}
+
+#define HPEL_C(name, width, height, step, hx, hy)                               \
+static void                                                                     \
+put_hpel##name##_##hx##hy##_c(uint8_t *dst, ptrdiff_t dst_stride,               \
+                              const uint8_t *src, ptrdiff_t src_stride, int rnd) \
+{                                                                               \
+    put_hpel_c(dst, dst_stride, src, src_stride, width, height, step, hx, hy, rnd); \
+}
+
+HPEL_C(16, 16, 16, 1, 0, 0) HPEL_C(16, 16, 16, 1, 1, 0)
+HPEL_C(16, 16, 16, 1, 0, 1) HPEL_C(16, 16, 16, 1, 1, 1)
+HPEL_C(8, 8, 8, 1, 0, 0) HPEL_C(8, 8, 8, 1, 1, 0)
+HPEL_C(8, 8, 8, 1, 0, 1) HPEL_C(8, 8, 8, 1, 1, 1)
+HPEL_C(_uv, 16, 8, 2, 0, 0) HPEL_C(_uv, 16, 8, 2, 1, 0)
+HPEL_C(_uv, 16, 8, 2, 0, 1) HPEL_C(_uv, 16, 8, 2, 1, 1)
+
+/* 7.8.7.3 with a single warping point, at 1/16 sample */
+static inline void
+gmc1_c(uint8_t *dst, ptrdiff_t dst_stride, const uint8_t *src, ptrdiff_t src_stride,
+       int width, int height, int step, int fx, int fy, int rounder)
+{
+    int a = (16 - fx) * (16 - fy), b = fx * (16 - fy), c = (16 - fx) * fy, d = fx * fy;
+    int x, y;
+
+    for (y = 0; y < height; y++) {
+        for (x = 0; x < width; x++)
+            dst[x] = (a * src[x] + b * src[x + step] + c * src[x + src_stride] +
+                      d * src[x + src_stride + step] + rounder) >> 8;
+        dst += dst_stride;
+        src += src_stride;
+    }
+}
+
+static void
+gmc1_luma_c(uint8_t *dst, ptrdiff_t dst_stride, const uint8_t *src, ptrdiff_t src_stride,
+            int fx, int fy, int rounder)
+{
+    gmc1_c(dst, dst_stride, src, src_stride, 16, 16, 1, fx, fy, rounder);
+}
+
+static void
+gmc1_uv_c(uint8_t *dst, ptrdiff_t dst_stride, const uint8_t *src, ptrdiff_t src_stride,
+          int fx, int fy, int rounder)
+{
+    gmc1_c(dst, dst_stride, src, src_stride, 16, 8, 2, fx, fy, rounder);
+}
+
+/*
+ * 7.8.7.3 in general, one 8 sample wide column of samples step apart.
+ * Positions outside the plane take its nearest edge sample.
+ */
+static inline void
+gmc_c(uint8_t *dst, ptrdiff_t dst_stride, const uint8_t *src, ptrdiff_t src_stride, int step,
+      int h, int ox, int oy, int dxx, int dxy, int dyx, int dyy,
+      int shift, int r, int width, int height)
+{
+    int s = 1 << shift;
+    int x, y;
+
+    for (y = 0; y < h; y++) {
+        int vx = ox, vy = oy;
+
+        for (x = 0; x < 8; x++) {
+            int sx = vx >> 16, sy = vy >> 16;
+            int fx = sx & (s - 1), fy = sy & (s - 1);
+            int x0, x1, y0, y1;
+
+            sx >>= shift;
+            sy >>= shift;
+            x0 = sx < 0 ? 0 : (sx >= width ? width - 1 : sx);
+            x1 = sx + 1 < 0 ? 0 : (sx + 1 >= width ? width - 1 : sx + 1);
+            y0 = sy < 0 ? 0 : (sy >= height ? height - 1 : sy);
+            y1 = sy + 1 < 0 ? 0 : (sy + 1 >= height ? height - 1 : sy + 1);
+            x0 *= step;
+            x1 *= step;
+            y0 *= src_stride;
+            y1 *= src_stride;
+            dst[x * step] = ((src[y0 + x0] * (s - fx) + src[y0 + x1] * fx) * (s - fy) +
+                             (src[y1 + x0] * (s - fx) + src[y1 + x1] * fx) * fy + r) >> (2 * shift);
+            vx += dxx;
+            vy += dyx;
+        }
+        ox += dxy;
+        oy += dyy;
+        dst += dst_stride;
+    }
+}
+
+static void
+gmc_luma_c(uint8_t *dst, ptrdiff_t dst_stride, const uint8_t *src, ptrdiff_t src_stride,
+           int h, int ox, int oy, int dxx, int dxy, int dyx, int dyy,
+           int shift, int r, int width, int height)
+{
+    gmc_c(dst, dst_stride, src, src_stride, 1, h, ox, oy, dxx, dxy, dyx, dyy,
+          shift, r, width, height);
+}
+
+static void
+gmc_uv_c(uint8_t *dst, ptrdiff_t dst_stride, const uint8_t *src, ptrdiff_t src_stride,
+         int h, int ox, int oy, int dxx, int dxy, int dyx, int dyy,
+         int shift, int r, int width, int height)
+{
+    gmc_c(dst, dst_stride, src, src_stride, 2, h, ox, oy, dxx, dxy, dyx, dyy,
+          shift, r, width, height);
+    gmc_c(dst + 1, dst_stride, src + 1, src_stride, 2, h, ox, oy, dxx, dxy, dyx, dyy,
+          shift, r, width, height);
+}
+
+static void
+avg_c(uint8_t *dst, ptrdiff_t dst_stride, const uint8_t *src, ptrdiff_t src_stride,
+      int width, int height)
+{
+    int x, y;
+
+    for (y = 0; y < height; y++) {
+        for (x = 0; x < width; x++)
+            dst[x] = (dst[x] + src[x] + 1) >> 1;
+        dst += dst_stride;
+        src += src_stride;
+    }
+}
+
+const struct mpeg4_dsp_ops mpeg4_dsp_c = {
+    "c",
+    {
+        QPEL_TABLE(16, c),
+        QPEL_TABLE(8, c),
+    },
+    {
+        { put_hpel16_00_c, put_hpel16_10_c, put_hpel16_01_c, put_hpel16_11_c },
+        { put_hpel8_00_c, put_hpel8_10_c, put_hpel8_01_c, put_hpel8_11_c },
+    },
+    { put_hpel_uv_00_c, put_hpel_uv_10_c, put_hpel_uv_01_c, put_hpel_uv_11_c },
+    gmc1_luma_c,
+    gmc1_uv_c,
+    gmc_luma_c,
+    gmc_uv_c,
+    avg_c,
+};
+#if defined(__x86_64__) || defined(__i386__)
+static struct mpeg4_dsp_ops mpeg4_dsp_sse2;
+#endif
+static pthread_once_t mpeg4_dsp_once = PTHREAD_ONCE_INIT;
+
+static void
+mpeg4_dsp_init(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    mpeg4_dsp_sse2 = mpeg4_dsp_c;
+    mpeg4_dsp_sse2.name = "sse2";
+    mpeg4_dsp_init_sse2(&mpeg4_dsp_sse2);
+#endif
+}
+
+/* Best first */
+static const struct mpeg4_dsp_ops *const mpeg4_dsp_all[] = {
+#if defined(__x86_64__) || defined(__i386__)
+    &mpeg4_dsp_sse2,
+#endif
+    &mpeg4_dsp_c,
+};
+
+static int
+mpeg4_dsp_cpu_supports(const struct mpeg4_dsp_ops *ops)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (ops == &mpeg4_dsp_sse2)
+        return __builtin_cpu_supports("sse2");
+#endif
+    return 1;
+}
+
+const struct mpeg4_dsp_ops *
+mpeg4_dsp_get_ops(const char *name)
+{
+    unsigned int i;
+    const struct mpeg4_dsp_ops *best = NULL;
+
+    pthread_once(&mpeg4_dsp_once, mpeg4_dsp_init);
+    for (i = 0; i < sizeof(mpeg4_dsp_all) / sizeof(mpeg4_dsp_all[0]); i++) {
+        const struct mpeg4_dsp_ops *ops = mpeg4_dsp_all[i];
+
+        if (!mpeg4_dsp_cpu_supports(ops))
+            continue;
+        if (!best)
+            best = ops;
+        if (name && !strcmp(name, ops->name))
+            return ops;
+    }
+    return best;
+}
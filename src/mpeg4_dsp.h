@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2012 Scott Tincman <sctincman@gmail.com>. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef MPEG4_DSP_H
+#define MPEG4_DSP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Motion compensation kernels of the MPEG-4 Part 2 decoder: quarter and
+ * half sample prediction and global motion compensation. Chroma kernels
+ * work on the interleaved NV12 plane directly. As with the dsp ones
+ * there is a C version and SIMD versions picked at runtime that match it
+ * exactly.
+ */
+
+/* Block widths for the motion compensation tables */
+#define MPEG4_MC_16     0
+#define MPEG4_MC_8      1
+
+typedef void (*mpeg4_mc_func)(uint8_t *dst, ptrdiff_t dst_stride,
+                              const uint8_t *src, ptrdiff_t src_stride, int rnd);
+
+struct mpeg4_dsp_ops {
+    const char *name;
+    /*
+     * Luma prediction at quarter sample offsets of 7.6.2.2, indexed by
+     * [MPEG4_MC_*][(frac_y << 2) | frac_x]. The 8 tap filter mirrors the
+     * block at its edges, so it only reads one sample after the block in
+     * both directions. rnd is vop_rounding_type: set, it rounds down.
+     */
+    mpeg4_mc_func put_qpel[2][16];
+    /*
+     * Bilinear half sample luma prediction, indexed by [MPEG4_MC_*]
+     * [(half_y << 1) | half_x]. They need one sample of margin after the
+     * block.
+     */
+    mpeg4_mc_func put_hpel[2][4];
+    /* The same for 8 samples of both NV12 components */
+    mpeg4_mc_func put_hpel_uv[4];
+    /*
+     * Translational sprite warping of 7.8.7: a bilinear 1/16 sample
+     * prediction at fx, fy of 16 luma samples or 8 samples of both NV12
+     * components, over 16 and 8 rows. rounder is 128 - rnd.
+     */
+    void (*gmc1)(uint8_t *dst, ptrdiff_t dst_stride, const uint8_t *src, ptrdiff_t src_stride,
+                 int fx, int fy, int rounder);
+    void (*gmc1_uv)(uint8_t *dst, ptrdiff_t dst_stride, const uint8_t *src, ptrdiff_t src_stride,
+                    int fx, int fy, int rounder);
+    /*
+     * General sprite warping of 8 samples over h rows. The sample at
+     * column x and row y comes from (ox + dxx x + dxy y, oy + dyx x +
+     * dyy y) in 16.16 fixed point over the whole plane src, whose edges
+     * at width and height are replicated. The bilinear weights have
+     * shift bits and r rounds the result. The chroma version does both
+     * NV12 components at once.
+     */
+    void (*gmc)(uint8_t *dst, ptrdiff_t dst_stride, const uint8_t *src, ptrdiff_t src_stride,
+                int h, int ox, int oy, int dxx, int dxy, int dyx, int dyy,
+                int shift, int r, int width, int height);
+    void (*gmc_uv)(uint8_t *dst, ptrdiff_t dst_stride, const uint8_t *src, ptrdiff_t src_stride,
+                   int h, int ox, int oy, int dxx, int dxy, int dyx, int dyy,
+                   int shift, int r, int width, int height);
+    /* Averages width x height bytes of src into dst rounding up */
+    void (*avg)(uint8_t *dst, ptrdiff_t dst_stride, const uint8_t *src, ptrdiff_t src_stride,
+                int width, int height);
+};
+
+extern const struct mpeg4_dsp_ops mpeg4_dsp_c;
+#if defined(__x86_64__) || defined(__i386__)
+/*
+ * Only the hot kernels have SIMD versions, so those tables start as a
+ * copy of the C one and this replaces what it has
+ */
+void
+mpeg4_dsp_init_sse2(struct mpeg4_dsp_ops *ops);
+#endif
+
+/*
+ * Returns the kernels called name ("c" or "sse2"), or the best ones this
+ * CPU supports if name is NULL or not supported
+ */
+const struct mpeg4_dsp_ops *
+mpeg4_dsp_get_ops(const char *name);
+
+#endif /* MPEG4_DSP_H */
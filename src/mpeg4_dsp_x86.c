@@ -0,0 +1,473 @@
+/*
+ * Copyright (c) 2012 Scott Tincman <sctincman@gmail.com>. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+/*
+ * SSE2 versions of the MPEG-4 motion compensation: the quarter sample
+ * filters, half sample prediction and sprite warping. The filters work
+ * in 16-bit lanes, where no intermediate of the 8 bit samples overflows,
+ * so they match the C ones exactly.
+ */
+
+#include "config.h"
+#include <string.h>
+#include "mpeg4_dsp.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+#define SSE2    __attribute__((target("sse2")))
+
+static inline SSE2 __m128i
+load8(const uint8_t *p)
+{
+    return _mm_loadl_epi64((const __m128i *) p);
+}
+
+static inline SSE2 __m128i
+load16(const uint8_t *p)
+{
+    return _mm_loadu_si128((const __m128i *) p);
+}
+
+/* Zero extends 8 bytes to 16-bit lanes */
+static inline SSE2 __m128i
+widen8(const uint8_t *p)
+{
+    return _mm_unpacklo_epi8(load8(p), _mm_setzero_si128());
+}
+
+/* Stores width (8 or 16) bytes */
+static inline SSE2 void
+store(uint8_t *p, __m128i v, int width)
+{
+    if (width == 16)
+        _mm_storeu_si128((__m128i *) p, v);
+    else
+        _mm_storel_epi64((__m128i *) p, v);
+}
+
+static inline SSE2 __m128i
+load(const uint8_t *p, int width)
+{
+    return width == 16 ? load16(p) : load8(p);
+}
+
+/* The average of two byte vectors, rounding down when rnd is set */
+static inline SSE2 __m128i
+avg8(__m128i a, __m128i b, int rnd)
+{
+    __m128i r = _mm_avg_epu8(a, b);
+
+    if (rnd)
+        r = _mm_sub_epi8(r, _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1)));
+    return r;
+}
+
+/*
+ * The 8 tap filter over 8 lanes of 16-bit samples t[0] to t[7], with
+ * the rounding added and shifted down to bytes in the low half
+ */
+static inline SSE2 __m128i
+qpel_taps(const __m128i *t, __m128i round)
+{
+    __m128i s = _mm_mullo_epi16(_mm_add_epi16(t[3], t[4]), _mm_set1_epi16(20));
+
+    s = _mm_sub_epi16(s, _mm_mullo_epi16(_mm_add_epi16(t[2], t[5]), _mm_set1_epi16(6)));
+    s = _mm_add_epi16(s, _mm_mullo_epi16(_mm_add_epi16(t[1], t[6]), _mm_set1_epi16(3)));
+    s = _mm_sub_epi16(s, _mm_add_epi16(t[0], t[7]));
+    s = _mm_srai_epi16(_mm_add_epi16(s, round), 5);
+    return _mm_packus_epi16(s, s);
+}
+
+/*
+ * Horizontal half samples of rows rows. Each row is copied with its
+ * mirrored ends so the taps are plain loads.
+ */
+static SSE2 void
+qpel_h_sse2(uint8_t *dst, ptrdiff_t dst_stride, const uint8_t *src, ptrdiff_t src_stride,
+            int size, int rows, int rnd)
+{
+    __m128i round = _mm_set1_epi16(16 - rnd);
+    uint8_t row[32];
+    __m128i t[8];
+    int i, x, y;
+
+    for (y = 0; y < rows; y++) {
+        memcpy(row + 3, src, size + 1);
+        for (i = 0; i < 3; i++) {
+            row[i] = src[2 - i];
+            row[size + 4 + i] = src[size - i];
+        }
+        for (x = 0; x < size; x += 8) {
+            for (i = 0; i < 8; i++)
+                t[i] = widen8(row + x + i);
+            _mm_storel_epi64((__m128i *) (dst + x), qpel_taps(t, round));
+        }
+        dst += dst_stride;
+        src += src_stride;
+    }
+}
+
+/* Vertical half samples of size rows from size + 1, mirrored the same way */
+static SSE2 void
+qpel_v_sse2(uint8_t *dst, ptrdiff_t dst_stride, const uint8_t *src, ptrdiff_t src_stride,
+            int size, int rnd)
+{
+    __m128i round = _mm_set1_epi16(16 - rnd);
+    const uint8_t *rows[24];
+    __m128i t[8];
+    int i, j, x, y;
+
+    for (i = 0; i < size + 7; i++) {
+        j = i - 3;
+        if (j < 0)
+            j = -1 - j;
+        else if (j > size)
+            j = 2 * size + 1 - j;
+        rows[i] = src + j * src_stride;
+    }
+    for (y = 0; y < size; y++) {
+        for (x = 0; x < size; x += 8) {
+            for (i = 0; i < 8; i++)
+                t[i] = widen8(rows[y + i] + x);
+            _mm_storel_epi64((__m128i *) (dst + x), qpel_taps(t, round));
+        }
+        dst += dst_stride;
+    }
+}
+
+static SSE2 void
+l2_sse2(uint8_t *dst, ptrdiff_t dst_stride, const uint8_t *a, ptrdiff_t a_stride,
+        const uint8_t *b, ptrdiff_t b_stride, int width, int rows, int rnd)
+{
+    int y;
+
+    for (y = 0; y < rows; y++) {
+        store(dst, avg8(load(a, width), load(b, width), rnd), width);
+        dst += dst_stride;
+        a += a_stride;
+        b += b_stride;
+    }
+}
+
+/* The same composition of the filters as the C version */
+static inline SSE2 void
+put_qpel_sse2(uint8_t *dst, ptrdiff_t dst_stride, const uint8_t *src, ptrdiff_t src_stride,
+              int size, int dxy, int rnd)
+{
+    uint8_t half[17 * 16], halfv[16 * 16];
+    int fx = dxy & 3, fy = dxy >> 2;
+
+    if (!fy) {
+        if (!fx) {
+            l2_sse2(dst, dst_stride, src, src_stride, src, src_stride, size, size, 0);
+        } else if (fx == 2) {
+            qpel_h_sse2(dst, dst_stride, src, src_stride, size, size, rnd);
+        } else {
+            qpel_h_sse2(half, 16, src, src_stride, size, size, rnd);
+            l2_sse2(dst, dst_stride, src + (fx == 3), src_stride, half, 16, size, size, rnd);
+        }
+        return;
+    }
+    if (!fx) {
+        if (fy == 2) {
+            qpel_v_sse2(dst, dst_stride, src, src_stride, size, rnd);
+        } else {
+            qpel_v_sse2(halfv, 16, src, src_stride, size, rnd);
+            l2_sse2(dst, dst_stride, src + (fy == 3) * src_stride, src_stride, halfv, 16,
+                    size, size, rnd);
+        }
+        return;
+    }
+    qpel_h_sse2(half, 16, src, src_stride, size, size + 1, rnd);
+    if (fx != 2)
+        l2_sse2(half, 16, half, 16, src + (fx == 3), src_stride, size, size + 1, rnd);
+    if (fy == 2) {
+        qpel_v_sse2(dst, dst_stride, half, 16, size, rnd);
+    } else {
+        qpel_v_sse2(halfv, 16, half, 16, size, rnd);
+        l2_sse2(dst, dst_stride, half + (fy == 3) * 16, 16, halfv, 16, size, size, rnd);
+    }
+}
+
+#define QPEL_SSE2(size, fx, fy)                                                 \
+static SSE2 void                                                                \
+put_qpel##size##_##fx##fy##_sse2(uint8_t *dst, ptrdiff_t dst_stride,            \
+                                 const uint8_t *src, ptrdiff_t src_stride, int rnd) \
+{                                                                               \
+    put_qpel_sse2(dst, dst_stride, src, src_stride, size, (fy << 2) | fx, rnd); \
+}
+
+#define QPEL_SIZE_SSE2(size)                                                    \
+QPEL_SSE2(size, 0, 0) QPEL_SSE2(size, 1, 0) QPEL_SSE2(size, 2, 0) QPEL_SSE2(size, 3, 0) \
+QPEL_SSE2(size, 0, 1) QPEL_SSE2(size, 1, 1) QPEL_SSE2(size, 2, 1) QPEL_SSE2(size, 3, 1) \
+QPEL_SSE2(size, 0, 2) QPEL_SSE2(size, 1, 2) QPEL_SSE2(size, 2, 2) QPEL_SSE2(size, 3, 2) \
+QPEL_SSE2(size, 0, 3) QPEL_SSE2(size, 1, 3) QPEL_SSE2(size, 2, 3) QPEL_SSE2(size, 3, 3)
+
+QPEL_SIZE_SSE2(16)
+QPEL_SIZE_SSE2(8)
+
+/* Bilinear half samples of width bytes, horizontal neighbours step apart */
+static inline SSE2 void
+put_hpel_sse2(uint8_t *dst, ptrdiff_t dst_stride, const uint8_t *src, ptrdiff_t src_stride,
+              int width, int height, int step, int hx, int hy, int rnd)
+{
+    __m128i round = _mm_set1_epi16(2 - rnd);
+    __m128i zero = _mm_setzero_si128();
+    int y;
+
+    for (y = 0; y < height; y++) {
+        __m128i a = load(src, width), r;
+
+        if (hx && hy) {
+            __m128i b = load(src + step, width);
+            __m128i c = load(src + src_stride, width);
+            __m128i d = load(src + src_stride + step, width);
+            __m128i lo = _mm_add_epi16(_mm_add_epi16(_mm_unpacklo_epi8(a, zero),
+                                                     _mm_unpacklo_epi8(b, zero)),
+                                       _mm_add_epi16(_mm_unpacklo_epi8(c, zero),
+                                                     _mm_unpacklo_epi8(d, zero)));
+            __m128i hi = _mm_add_epi16(_mm_add_epi16(_mm_unpackhi_epi8(a, zero),
+                                                     _mm_unpackhi_epi8(b, zero)),
+                                       _mm_add_epi16(_mm_unpackhi_epi8(c, zero),
+                                                     _mm_unpackhi_epi8(d, zero)));
+
+            r = _mm_packus_epi16(_mm_srli_epi16(_mm_add_epi16(lo, round), 2),
+                                 _mm_srli_epi16(_mm_add_epi16(hi, round), 2));
+        } else if (hx || hy) {
+            r = avg8(a, load(src + (hy ? src_stride : step), width), rnd);
+        } else {
+            r = a;
+        }
+        store(dst, r, width);
+        dst += dst_stride;
+        src += src_stride;
+    }
+}
+
+#define HPEL_SSE2(name, width, height, step, hx, hy)                            \
+static SSE2 void                                                                \
+put_hpel##name##_##hx##hy##_sse2(uint8_t *dst, ptrdiff_t dst_stride,            \
+                                 const uint8_t *src, ptrdiff_t src_stride, int rnd) \
+{                                                                               \
+    put_hpel_sse2(dst, dst_stride, src, src_stride, width, height, step, hx, hy, rnd); \
+}
+
+HPEL_SSE2(16, 16, 16, 1, 0, 0) HPEL_SSE2(16, 16, 16, 1, 1, 0)
+HPEL_SSE2(16, 16, 16, 1, 0, 1) HPEL_SSE2(16, 16, 16, 1, 1, 1)
+HPEL_SSE2(8, 8, 8, 1, 0, 0) HPEL_SSE2(8, 8, 8, 1, 1, 0)
+HPEL_SSE2(8, 8, 8, 1, 0, 1) HPEL_SSE2(8, 8, 8, 1, 1, 1)
+HPEL_SSE2(_uv, 16, 8, 2, 0, 0) HPEL_SSE2(_uv, 16, 8, 2, 1, 0)
+HPEL_SSE2(_uv, 16, 8, 2, 0, 1) HPEL_SSE2(_uv, 16, 8, 2, 1, 1)
+
+/* Single point warping of 16 bytes per row, horizontal neighbours step apart */
+static inline SSE2 void
+gmc1_sse2(uint8_t *dst, ptrdiff_t dst_stride, const uint8_t *src, ptrdiff_t src_stride,
+          int height, int step, int fx, int fy, int rounder)
+{
+    __m128i a = _mm_set1_epi16((16 - fx) * (16 - fy)), b = _mm_set1_epi16(fx * (16 - fy));
+    __m128i c = _mm_set1_epi16((16 - fx) * fy), d = _mm_set1_epi16(fx * fy);
+    __m128i round = _mm_set1_epi16(rounder), zero = _mm_setzero_si128();
+    int y;
+
+    for (y = 0; y < height; y++) {
+        __m128i s0 = load16(src), s1 = load16(src + step);
+        __m128i s2 = load16(src + src_stride), s3 = load16(src + src_stride + step);
+        /* The weights add up to 256, so the sums fit unsigned 16 bits */
+        __m128i lo = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(s0, zero), a),
+                                                 _mm_mullo_epi16(_mm_unpacklo_epi8(s1, zero), b)),
+                                   _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(s2, zero), c),
+                                                 _mm_mullo_epi16(_mm_unpacklo_epi8(s3, zero), d)));
+        __m128i hi = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(s0, zero), a),
+                                                 _mm_mullo_epi16(_mm_unpackhi_epi8(s1, zero), b)),
+                                   _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(s2, zero), c),
+                                                 _mm_mullo_epi16(_mm_unpackhi_epi8(s3, zero), d)));
+
+        lo = _mm_srli_epi16(_mm_add_epi16(lo, round), 8);
+        hi = _mm_srli_epi16(_mm_add_epi16(hi, round), 8);
+        _mm_storeu_si128((__m128i *) dst, _mm_packus_epi16(lo, hi));
+        dst += dst_stride;
+        src += src_stride;
+    }
+}
+
+static SSE2 void
+gmc1_luma_sse2(uint8_t *dst, ptrdiff_t dst_stride, const uint8_t *src, ptrdiff_t src_stride,
+               int fx, int fy, int rounder)
+{
+    gmc1_sse2(dst, dst_stride, src, src_stride, 16, 1, fx, fy, rounder);
+}
+
+static SSE2 void
+gmc1_uv_sse2(uint8_t *dst, ptrdiff_t dst_stride, const uint8_t *src, ptrdiff_t src_stride,
+             int fx, int fy, int rounder)
+{
+    gmc1_sse2(dst, dst_stride, src, src_stride, 8, 2, fx, fy, rounder);
+}
+
+/*
+ * General warping. The sample positions are affine in the block, so
+ * if its corners and their right and lower neighbours are inside the
+ * plane all of it is, and the edge clamping can go. The samples are
+ * gathered and the bilinear weights applied in 16-bit lanes, where as
+ * in gmc1 the sums fit. Blocks reaching the edges use the C version.
+ */
+static inline SSE2 int
+gmc_sse2(uint8_t *dst, ptrdiff_t dst_stride, const uint8_t *src, ptrdiff_t src_stride, int step,
+         int h, int ox, int oy, int dxx, int dxy, int dyx, int dyy,
+         int shift, int r, int width, int height)
+{
+    __m128i sh = _mm_cvtsi32_si128(2 * shift), round = _mm_set1_epi16(r);
+    __m128i s = _mm_set1_epi16(1 << shift);
+    uint16_t p[4][16], fx[16], fy[16];
+    int i, n = 8 * step, x, y;
+
+    for (i = 0; i < 4; i++) {
+        int cx = i & 1 ? 7 : 0, cy = i & 2 ? h - 1 : 0;
+        int sx = ((ox + cx * dxx + cy * dxy) >> 16) >> shift;
+        int sy = ((oy + cx * dyx + cy * dyy) >> 16) >> shift;
+
+        if (sx < 0 || sx >= width - 1 || sy < 0 || sy >= height - 1)
+            return 0;
+    }
+    for (y = 0; y < h; y++) {
+        int vx = ox, vy = oy;
+
+        for (x = 0; x < 8; x++) {
+            int sx = vx >> 16, sy = vy >> 16;
+            const uint8_t *q = src + (sy >> shift) * src_stride + (sx >> shift) * step;
+
+            for (i = 0; i < step; i++) {
+                fx[x * step + i] = sx & ((1 << shift) - 1);
+                fy[x * step + i] = sy & ((1 << shift) - 1);
+                p[0][x * step + i] = q[i];
+                p[1][x * step + i] = q[i + step];
+                p[2][x * step + i] = q[i + src_stride];
+                p[3][x * step + i] = q[i + src_stride + step];
+            }
+            vx += dxx;
+            vy += dyx;
+        }
+        for (i = 0; i < n; i += 8) {
+            __m128i wx = _mm_loadu_si128((const __m128i *) (fx + i));
+            __m128i wy = _mm_loadu_si128((const __m128i *) (fy + i));
+            __m128i ix = _mm_sub_epi16(s, wx), iy = _mm_sub_epi16(s, wy);
+            __m128i t0 = _mm_add_epi16(_mm_mullo_epi16(_mm_loadu_si128((const __m128i *) (p[0] + i)), ix),
+                                       _mm_mullo_epi16(_mm_loadu_si128((const __m128i *) (p[1] + i)), wx));
+            __m128i t1 = _mm_add_epi16(_mm_mullo_epi16(_mm_loadu_si128((const __m128i *) (p[2] + i)), ix),
+                                       _mm_mullo_epi16(_mm_loadu_si128((const __m128i *) (p[3] + i)), wx));
+
+            t0 = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(t0, iy), _mm_mullo_epi16(t1, wy)), round);
+            t0 = _mm_srl_epi16(t0, sh);
+            _mm_storel_epi64((__m128i *) (dst + i), _mm_packus_epi16(t0, t0));
+        }
+        ox += dxy;
+        oy += dyy;
+        dst += dst_stride;
+    }
+    return 1;
+}
+
+static SSE2 void
+gmc_luma_sse2(uint8_t *dst, ptrdiff_t dst_stride, const uint8_t *src, ptrdiff_t src_stride,
+              int h, int ox, int oy, int dxx, int dxy, int dyx, int dyy,
+              int shift, int r, int width, int height)
+{
+    if (!gmc_sse2(dst, dst_stride, src, src_stride, 1, h, ox, oy, dxx, dxy, dyx, dyy,
+                  shift, r, width, height))
+        mpeg4_dsp_c.gmc(dst, dst_stride, src, src_stride, h, ox, oy, dxx, dxy, dyx, dyy,
+                        shift, r, width, height);
+}
+
+static SSE2 void
+gmc_uv_sse2(uint8_t *dst, ptrdiff_t dst_stride, const uint8_t *src, ptrdiff_t src_stride,
+            int h, int ox, int oy, int dxx, int dxy, int dyx, int dyy,
+            int shift, int r, int width, int height)
+{
+    if (!gmc_sse2(dst, dst_stride, src, src_stride, 2, h, ox, oy, dxx, dxy, dyx, dyy,
+                  shift, r, width, height))
+        mpeg4_dsp_c.gmc_uv(dst, dst_stride, src, src_stride, h, ox, oy, dxx, dxy, dyx, dyy,
+                           shift, r, width, height);
+}
+
+static SSE2 void
+avg_sse2(uint8_t *dst, ptrdiff_t dst_stride, const uint8_t *src, ptrdiff_t src_stride,
+         int width, int height)
+{
+    int y;
+
+    for (y = 0; y < height; y++) {
+        store(dst, _mm_avg_epu8(load(dst, width), load(src, width)), width);
+        dst += dst_stride;
+        src += src_stride;
+    }
+}
+
+#define QPEL_SET(ops, index, size)                                              \
+do {                                                                            \
+    ops->put_qpel[index][0] = put_qpel##size##_00_sse2;                         \
+    ops->put_qpel[index][1] = put_qpel##size##_10_sse2;                         \
+    ops->put_qpel[index][2] = put_qpel##size##_20_sse2;                         \
+    ops->put_qpel[index][3] = put_qpel##size##_30_sse2;                         \
+    ops->put_qpel[index][4] = put_qpel##size##_01_sse2;                         \
+    ops->put_qpel[index][5] = put_qpel##size##_11_sse2;                         \
+    ops->put_qpel[index][6] = put_qpel##size##_21_sse2;                         \
+    ops->put_qpel[index][7] = put_qpel##size##_31_sse2;                         \
+    ops->put_qpel[index][8] = put_qpel##size##_02_sse2;                         \
+    ops->put_qpel[index][9] = put_qpel##size##_12_sse2;                         \
+    ops->put_qpel[index][10] = put_qpel##size##_22_sse2;                        \
+    ops->put_qpel[index][11] = put_qpel##size##_32_sse2;                        \
+    ops->put_qpel[index][12] = put_qpel##size##_03_sse2;                        \
+    ops->put_qpel[index][13] = put_qpel##size##_13_sse2;                        \
+    ops->put_qpel[index][14] = put_qpel##size##_23_sse2;                        \
+    ops->put_qpel[index][15] = put_qpel##size##_33_sse2;                        \
+} while (0)
+
+void
+mpeg4_dsp_init_sse2(struct mpeg4_dsp_ops *ops)
+{
+    QPEL_SET(ops, MPEG4_MC_16, 16);
+    QPEL_SET(ops, MPEG4_MC_8, 8);
+    ops->put_hpel[MPEG4_MC_16][0] = put_hpel16_00_sse2;
+    ops->put_hpel[MPEG4_MC_16][1] = put_hpel16_10_sse2;
+    ops->put_hpel[MPEG4_MC_16][2] = put_hpel16_01_sse2;
+    ops->put_hpel[MPEG4_MC_16][3] = put_hpel16_11_sse2;
+    ops->put_hpel[MPEG4_MC_8][0] = put_hpel8_00_sse2;
+    ops->put_hpel[MPEG4_MC_8][1] = put_hpel8_10_sse2;
+    ops->put_hpel[MPEG4_MC_8][2] = put_hpel8_01_sse2;
+    ops->put_hpel[MPEG4_MC_8][3] = put_hpel8_11_sse2;
+    ops->put_hpel_uv[0] = put_hpel_uv_00_sse2;
+    ops->put_hpel_uv[1] = put_hpel_uv_10_sse2;
+    ops->put_hpel_uv[2] = put_hpel_uv_01_sse2;
+    ops->put_hpel_uv[3] = put_hpel_uv_11_sse2;
+    ops->gmc1 = gmc1_luma_sse2;
+    ops->gmc1_uv = gmc1_uv_sse2;
+    ops->gmc = gmc_luma_sse2;
+    ops->gmc_uv = gmc_uv_sse2;
+    ops->avg = avg_sse2;
+}
+
+#endif /* __x86_64__ || __i386__ */
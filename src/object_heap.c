@@ -23,7 +23,9 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
+#include <sched.h>
 #include "object_heap.h"
 
 #define ASSERT  assert
@@ -31,6 +33,71 @@
 #define LAST_FREE   -1
 #define ALLOCATED   -2
 
+/*
+ * Lookups run without the heap mutex, so every field they read is published
+ * with release semantics by the (locked) writers and read back with acquire.
+ */
+#define ATOMIC_LOAD(ptr)        __atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+#define ATOMIC_STORE(ptr, val)  __atomic_store_n((ptr), (val), __ATOMIC_RELEASE)
+
+/*
+ * A lookup announces itself on its reader shard before it reads the heap
+ * size and the bucket, and object_heap_trim() unpublishes buckets before it
+ * reads the shards. Both sides need sequential consistency for that to work.
+ */
+#define ATOMIC_LOAD_SC(ptr)         __atomic_load_n((ptr), __ATOMIC_SEQ_CST)
+#define ATOMIC_STORE_SC(ptr, val)   __atomic_store_n((ptr), (val), __ATOMIC_SEQ_CST)
+
+/* Reader shard of the calling thread, assigned on its first lookup */
+static __thread int object_heap_shard = -1;
+static int object_heap_next_shard;
+
+/*
+ * Slot index to object, buckets hold a power of two objects so this is a
+ * shift and a mask rather than a divide and a modulo
+ */
+#define OBJECT_HEAP_SLOT(heap, bucket, i) \
+    ((object_base_p)((bucket)[(i) >> (heap)->bucket_shift] + ((i) & (heap)->bucket_mask) * (heap)->object_size))
+
+/* Occupancy bitmap helpers, one bit per slot */
+#define OCCUPIED_WORD(i)        ((i) >> 6)
+#define OCCUPIED_BIT(i)         (1ULL << ((i) & 63))
+#define OCCUPIED_WORDS(size)    (((size) + 63) >> 6)
+
+/*
+ * Grows the bucket index. The old index is never freed or modified while the
+ * heap is alive, so lock-free readers that still hold it keep seeing valid
+ * bucket pointers; it is retired and released in object_heap_destroy().
+ * Return 0 on success, -1 on error
+ */
+static int
+object_heap_grow_index(object_heap_p heap)
+{
+    int new_num_buckets = heap->num_buckets ? heap->num_buckets * 2 : 8;
+    void **new_bucket;
+    void ***new_retired;
+
+    new_bucket = calloc(new_num_buckets, sizeof(void *));
+    if (NULL == new_bucket) {
+        return -1;
+    }
+
+    if (heap->bucket) {
+        new_retired = realloc(heap->retired, (heap->num_retired + 1) * sizeof(void **));
+        if (NULL == new_retired) {
+            free(new_bucket);
+            return -1;
+        }
+        heap->retired = new_retired;
+        heap->retired[heap->num_retired++] = heap->bucket;
+        memcpy(new_bucket, heap->bucket, heap->num_buckets * sizeof(void *));
+    }
+
+    heap->num_buckets = new_num_buckets;
+    ATOMIC_STORE(&heap->bucket, new_bucket);
+    return 0;
+}
+
 /*
  * Expands the heap
  * Return 0 on success, -1 on error
@@ -42,36 +109,66 @@ object_heap_expand(object_heap_p heap)
     void *new_heap_index;
     int next_free;
     int new_heap_size = heap->heap_size + heap->heap_increment;
-    int bucket_index = new_heap_size / heap->heap_increment - 1;
+    int bucket_index = heap->heap_size >> heap->bucket_shift;
+
+    if (new_heap_size > OBJECT_HEAP_INDEX_MASK + 1) {
+        return -1; /* Out of IDs */
+    }
 
     if (bucket_index >= heap->num_buckets) {
-        int new_num_buckets = heap->num_buckets + 8;
-        void **new_bucket;
+        if (-1 == object_heap_grow_index(heap)) {
+            return -1;
+        }
+    }
+
+    if (OCCUPIED_WORDS(new_heap_size) > OCCUPIED_WORDS(heap->heap_size)) {
+        uint64_t *new_occupied;
+        int old_words = OCCUPIED_WORDS(heap->heap_size);
+        int new_words = OCCUPIED_WORDS(new_heap_size);
 
-        new_bucket = realloc(heap->bucket, new_num_buckets * sizeof(void *));
-        if (NULL == new_bucket) {
+        new_occupied = realloc(heap->occupied, new_words * sizeof(uint64_t));
+        if (NULL == new_occupied) {
             return -1;
         }
+        memset(new_occupied + old_words, 0, (new_words - old_words) * sizeof(uint64_t));
+        heap->occupied = new_occupied;
+    }
+
+    if (new_heap_size > heap->num_generations) {
+        uint16_t *new_generation;
 
-        heap->num_buckets = new_num_buckets;
-        heap->bucket = new_bucket;
+        new_generation = realloc(heap->generation, new_heap_size * sizeof(uint16_t));
+        if (NULL == new_generation) {
+            return -1;
+        }
+        memset(new_generation + heap->num_generations, 0,
+               (new_heap_size - heap->num_generations) * sizeof(uint16_t));
+        heap->generation = new_generation;
+        heap->num_generations = new_heap_size;
     }
 
-    new_heap_index = (void *) malloc(heap->heap_increment * heap->object_size);
-    if (NULL == new_heap_index) {
+    if (posix_memalign(&new_heap_index, OBJECT_HEAP_ALIGNMENT, heap->heap_increment * heap->object_size)) {
         return -1; /* Out of memory */
     }
 
-    heap->bucket[bucket_index] = new_heap_index;
-    next_free = heap->next_free;
+    /* Slots given up by object_heap_trim() resume at the generation they had */
+    next_free = LAST_FREE;
     for (i = new_heap_size; i-- > heap->heap_size;) {
         object_base_p obj = (object_base_p)(new_heap_index + (i - heap->heap_size) * heap->object_size);
-        obj->id = i + heap->id_offset;
+        obj->id = i + heap->id_offset + (heap->generation[i] << OBJECT_HEAP_GENERATION_SHIFT);
         obj->next_free = next_free;
         next_free = i;
     }
-    heap->next_free = next_free;
-    heap->heap_size = new_heap_size;
+    if (LAST_FREE == heap->last_free) {
+        heap->next_free = next_free;
+    } else {
+        ATOMIC_STORE(&OBJECT_HEAP_SLOT(heap, heap->bucket, heap->last_free)->next_free, next_free);
+    }
+    heap->last_free = new_heap_size - 1;
+
+    /* Publish the bucket before the size that makes it reachable */
+    ATOMIC_STORE(&heap->bucket[bucket_index], new_heap_index);
+    ATOMIC_STORE(&heap->heap_size, new_heap_size);
     return 0; /* Success */
 }
 
@@ -81,14 +178,47 @@ object_heap_expand(object_heap_p heap)
 int
 object_heap_init(object_heap_p heap, int object_size, int id_offset)
 {
+    return object_heap_init_bucket_size(heap, object_size, id_offset, OBJECT_HEAP_DEFAULT_BUCKET_SIZE);
+}
+
+/*
+ * Return 0 on success, -1 on error
+ */
+int
+object_heap_init_bucket_size(object_heap_p heap, int object_size, int id_offset, int bucket_size)
+{
+    /* Bucket sizes must be a power of two */
+    if ((bucket_size <= 0) || (bucket_size & (bucket_size - 1)) ||
+        (bucket_size > OBJECT_HEAP_INDEX_MASK + 1)) {
+        return -1;
+    }
+
+    if (posix_memalign((void **) &heap->readers, OBJECT_HEAP_ALIGNMENT,
+                       OBJECT_HEAP_READER_SHARDS * sizeof(struct object_heap_readers))) {
+        return -1;
+    }
+    memset(heap->readers, 0, OBJECT_HEAP_READER_SHARDS * sizeof(struct object_heap_readers));
+    heap->reader_phase = 0;
+
     pthread_mutex_init(&heap->mutex, NULL);
-    heap->object_size = object_size;
+    /* Pad objects so that no two of them share a cache line */
+    heap->object_size = (object_size + OBJECT_HEAP_ALIGNMENT - 1) & ~(OBJECT_HEAP_ALIGNMENT - 1);
     heap->id_offset = id_offset & OBJECT_HEAP_OFFSET_MASK;
     heap->heap_size = 0;
-    heap->heap_increment = 16;
+    heap->heap_increment = bucket_size;
+    heap->bucket_shift = __builtin_ctz(bucket_size);
+    heap->bucket_mask = bucket_size - 1;
     heap->next_free = LAST_FREE;
+    heap->last_free = LAST_FREE;
     heap->num_buckets = 0;
     heap->bucket = NULL;
+    heap->num_retired = 0;
+    heap->retired = NULL;
+    heap->occupied = NULL;
+    heap->generation = NULL;
+    heap->num_generations = 0;
+    heap->num_allocated = 0;
+    heap->peak_allocated = 0;
     return object_heap_expand(heap);
 }
 
@@ -100,7 +230,6 @@ static int
 object_heap_allocate_unlocked(object_heap_p heap)
 {
     object_base_p obj;
-    int bucket_index, obj_index;
 
     if (LAST_FREE == heap->next_free) {
         if (-1 == object_heap_expand(heap)) {
@@ -109,12 +238,16 @@ object_heap_allocate_unlocked(object_heap_p heap)
     }
     ASSERT(heap->next_free >= 0);
 
-    bucket_index = heap->next_free / heap->heap_increment;
-    obj_index = heap->next_free % heap->heap_increment;
-
-    obj = (object_base_p)(heap->bucket[bucket_index] + obj_index * heap->object_size);
+    obj = OBJECT_HEAP_SLOT(heap, heap->bucket, heap->next_free);
+    heap->occupied[OCCUPIED_WORD(heap->next_free)] |= OCCUPIED_BIT(heap->next_free);
     heap->next_free = obj->next_free;
-    obj->next_free = ALLOCATED;
+    if (LAST_FREE == heap->next_free) {
+        heap->last_free = LAST_FREE;
+    }
+    if (++heap->num_allocated > heap->peak_allocated) {
+        heap->peak_allocated = heap->num_allocated;
+    }
+    ATOMIC_STORE(&obj->next_free, ALLOCATED);
     return obj->id;
 }
 
@@ -130,38 +263,71 @@ object_heap_allocate(object_heap_p heap)
 }
 
 /*
- * Lookup an object by object ID
+ * Resolves an object ID, either inside a counted lookup or with the heap
+ * mutex held, both of which keep object_heap_trim() from freeing the bucket.
  * Returns a pointer to the object on success, returns NULL on error
  */
 static object_base_p
-object_heap_lookup_unlocked(object_heap_p heap, int id)
+object_heap_resolve(object_heap_p heap, int id)
 {
     object_base_p obj;
-    int bucket_index, obj_index;
+    void **bucket;
+    void *slots;
+    int index;
 
-    if ((id < heap->id_offset) || (id > (heap->heap_size + heap->id_offset))) {
+    if ((id & ~OBJECT_HEAP_ID_MASK) != heap->id_offset) {
+        return NULL;
+    }
+    index = id & OBJECT_HEAP_INDEX_MASK;
+    if (index >= ATOMIC_LOAD_SC(&heap->heap_size)) {
+        return NULL;
+    }
+    bucket = ATOMIC_LOAD(&heap->bucket);
+    /* The size may have been read just before a trim unpublished the bucket */
+    slots = ATOMIC_LOAD_SC(&bucket[index >> heap->bucket_shift]);
+    if (NULL == slots) {
         return NULL;
     }
-    id &= OBJECT_HEAP_ID_MASK;
-    bucket_index = id / heap->heap_increment;
-    obj_index = id % heap->heap_increment;
-    obj = (object_base_p)(heap->bucket[bucket_index] + obj_index * heap->object_size);
+    obj = (object_base_p)(slots + (index & heap->bucket_mask) * heap->object_size);
 
     /* Check if the object has in fact been allocated */
-    if (obj->next_free != ALLOCATED) {
+    if (ATOMIC_LOAD(&obj->next_free) != ALLOCATED) {
+        return NULL;
+    }
+    /* Check that the ID is not a stale handle to a previous tenant */
+    if (ATOMIC_LOAD(&obj->id) != id) {
         return NULL;
     }
     return obj;
 }
 
+/*
+ * Lookup an object by object ID
+ * Returns a pointer to the object on success, returns NULL on error
+ *
+ * This takes no lock: buckets never move once published and retired bucket
+ * indexes stay valid until the heap is destroyed. The only writer that frees
+ * memory a lookup may read is object_heap_trim(), which waits for the lookups
+ * counted on the reader shards. Each thread counts on its own shard, so
+ * concurrent lookups do not contend for a cache line.
+ */
 object_base_p
 object_heap_lookup(object_heap_p heap, int id)
 {
+    struct object_heap_readers *readers;
     object_base_p obj;
+    int phase;
 
-    pthread_mutex_lock(&heap->mutex);
-    obj = object_heap_lookup_unlocked(heap, id);
-    pthread_mutex_unlock(&heap->mutex);
+    if (object_heap_shard < 0) {
+        object_heap_shard = __atomic_fetch_add(&object_heap_next_shard, 1, __ATOMIC_RELAXED) %
+                            OBJECT_HEAP_READER_SHARDS;
+    }
+    readers = &heap->readers[object_heap_shard];
+
+    phase = ATOMIC_LOAD_SC(&heap->reader_phase) & 1;
+    __atomic_fetch_add(&readers->active[phase], 1, __ATOMIC_SEQ_CST);
+    obj = object_heap_resolve(heap, id);
+    __atomic_fetch_sub(&readers->active[phase], 1, __ATOMIC_RELEASE);
     return obj;
 }
 
@@ -179,27 +345,33 @@ object_heap_first(object_heap_p heap, object_heap_iterator *iter)
 /*
  * Iterate over all objects in the heap.
  * Returns a pointer to the next object on the heap, returns NULL if heap is empty.
+ * Free slots are skipped a bitmap word at a time, so a walk costs O(live objects).
  */
 static object_base_p
 object_heap_next_unlocked(object_heap_p heap, object_heap_iterator *iter)
 {
-    object_base_p obj;
-    int bucket_index, obj_index;
     int i = *iter + 1;
+    int word, num_words = OCCUPIED_WORDS(heap->heap_size);
+    uint64_t bits;
 
-    while (i < heap->heap_size) {
-        bucket_index = i / heap->heap_increment;
-        obj_index = i % heap->heap_increment;
+    if (i >= heap->heap_size) {
+        *iter = heap->heap_size;
+        return NULL;
+    }
 
-        obj = (object_base_p)(heap->bucket[bucket_index] + obj_index * heap->object_size);
-        if (obj->next_free == ALLOCATED) {
-            *iter = i;
-            return obj;
+    word = OCCUPIED_WORD(i);
+    bits = heap->occupied[word] & ~(OCCUPIED_BIT(i) - 1);
+    while (!bits) {
+        if (++word >= num_words) {
+            *iter = heap->heap_size;
+            return NULL;
         }
-        i++;
+        bits = heap->occupied[word];
     }
+
+    i = (word << 6) + __builtin_ctzll(bits);
     *iter = i;
-    return NULL;
+    return OBJECT_HEAP_SLOT(heap, heap->bucket, i);
 }
 
 object_base_p
@@ -219,11 +391,30 @@ object_heap_next(object_heap_p heap, object_heap_iterator *iter)
 static void
 object_heap_free_unlocked(object_heap_p heap, object_base_p obj)
 {
+    int generation, index;
+
     /* Check if the object has in fact been allocated */
     ASSERT(obj->next_free == ALLOCATED);
 
-    obj->next_free = heap->next_free;
-    heap->next_free = obj->id & OBJECT_HEAP_ID_MASK;
+    /* Retire the current ID before the slot becomes allocatable again */
+    generation = (obj->id + (1 << OBJECT_HEAP_GENERATION_SHIFT)) & OBJECT_HEAP_GENERATION_MASK;
+    ATOMIC_STORE(&obj->id, (obj->id & ~OBJECT_HEAP_GENERATION_MASK) | generation);
+
+    /*
+     * Queue the slot at the tail, so that its generations only advance as
+     * fast as those of all the free slots and stale IDs take that much
+     * longer to come around again
+     */
+    index = obj->id & OBJECT_HEAP_INDEX_MASK;
+    ATOMIC_STORE(&obj->next_free, LAST_FREE);
+    if (LAST_FREE == heap->last_free) {
+        heap->next_free = index;
+    } else {
+        ATOMIC_STORE(&OBJECT_HEAP_SLOT(heap, heap->bucket, heap->last_free)->next_free, index);
+    }
+    heap->last_free = index;
+    heap->occupied[OCCUPIED_WORD(index)] &= ~OCCUPIED_BIT(index);
+    heap->num_allocated--;
 }
 
 void
@@ -236,6 +427,235 @@ object_heap_free(object_heap_p heap, object_base_p obj)
     pthread_mutex_unlock(&heap->mutex);
 }
 
+/*
+ * Allocates num_objects objects under a single lock round-trip
+ * Fresh slots come off the free list in ascending order, so the IDs form a
+ * contiguous run unless previously freed slots are being reused.
+ * Returns 0 on success, returns -1 on error (nothing is allocated then)
+ */
+int
+object_heap_allocate_n(object_heap_p heap, int num_objects, int *ids)
+{
+    int i;
+
+    pthread_mutex_lock(&heap->mutex);
+    for (i = 0; i < num_objects; i++) {
+        ids[i] = object_heap_allocate_unlocked(heap);
+        if (-1 == ids[i]) {
+            break;
+        }
+    }
+
+    /* Error recovery */
+    if (i < num_objects) {
+        /* ids[i-1] was the last successful allocation */
+        for (; i--; ) {
+            object_heap_free_unlocked(heap, object_heap_resolve(heap, ids[i]));
+            ids[i] = -1;
+        }
+        pthread_mutex_unlock(&heap->mutex);
+        return -1;
+    }
+    pthread_mutex_unlock(&heap->mutex);
+    return 0;
+}
+
+/*
+ * Frees num_objects objects by ID under a single lock round-trip
+ * IDs that do not resolve to an allocated object are skipped.
+ */
+void
+object_heap_free_n(object_heap_p heap, const int *ids, int num_objects)
+{
+    object_base_p obj;
+    int i;
+
+    pthread_mutex_lock(&heap->mutex);
+    for (i = num_objects; i--; ) {
+        obj = object_heap_resolve(heap, ids[i]);
+        if (obj) {
+            object_heap_free_unlocked(heap, obj);
+        }
+    }
+    pthread_mutex_unlock(&heap->mutex);
+}
+
+/*
+ * Calls visit for every allocated object while holding the heap lock once
+ * for the whole walk.
+ * Returns the number of objects visited.
+ */
+int
+object_heap_foreach(object_heap_p heap, object_heap_visitor visit, void *data)
+{
+    object_base_p obj;
+    int word, num_words, i, ret;
+    int count = 0;
+    uint64_t bits;
+
+    pthread_mutex_lock(&heap->mutex);
+    num_words = OCCUPIED_WORDS(heap->heap_size);
+    for (word = 0; word < num_words; word++) {
+        bits = heap->occupied[word];
+        while (bits) {
+            i = (word << 6) + __builtin_ctzll(bits);
+            bits &= bits - 1;
+
+            obj = OBJECT_HEAP_SLOT(heap, heap->bucket, i);
+            count++;
+            ret = visit(obj, data);
+            if (ret & OBJECT_HEAP_VISIT_FREE) {
+                object_heap_free_unlocked(heap, obj);
+            }
+            if (ret & OBJECT_HEAP_VISIT_STOP) {
+                goto out;
+            }
+        }
+    }
+out:
+    pthread_mutex_unlock(&heap->mutex);
+    return count;
+}
+
+/*
+ * Returns 1 if no slot of the given bucket is allocated
+ */
+static int
+object_heap_bucket_is_free(object_heap_p heap, int bucket_index)
+{
+    int first = bucket_index << heap->bucket_shift;
+    int word;
+
+    if (heap->heap_increment < 64) {
+        /* The whole bucket lives in a single bitmap word */
+        uint64_t mask = ((1ULL << heap->heap_increment) - 1) << (first & 63);
+        return !(heap->occupied[OCCUPIED_WORD(first)] & mask);
+    }
+
+    for (word = OCCUPIED_WORD(first); word < OCCUPIED_WORD(first + heap->heap_increment); word++) {
+        if (heap->occupied[word]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Waits until no lookup that started before the call is still running.
+ * New lookups count on the other phase, so a steady stream of them cannot
+ * hold this up. A lookup may read the phase just before it is flipped and
+ * count on the old one after the wait, which is why both phases are drained.
+ */
+static void
+object_heap_wait_readers(object_heap_p heap)
+{
+    int pass, phase, i;
+
+    for (pass = 0; pass < 2; pass++) {
+        phase = heap->reader_phase & 1;
+        ATOMIC_STORE_SC(&heap->reader_phase, heap->reader_phase + 1);
+        for (i = 0; i < OBJECT_HEAP_READER_SHARDS; i++) {
+            while (ATOMIC_LOAD_SC(&heap->readers[i].active[phase])) {
+                sched_yield();
+            }
+        }
+    }
+}
+
+/*
+ * Releases fully free buckets at the end of the heap, the first bucket is
+ * always kept. The buckets are unpublished first, then freed once the
+ * lookups that may have read them are done, see object_heap_lookup().
+ * Returns the number of slots given up.
+ */
+int
+object_heap_trim(object_heap_p heap)
+{
+    object_base_p obj, tail;
+    void **trimmed;
+    int num_buckets, new_heap_size, next_free, following, i, j;
+    int released;
+
+    pthread_mutex_lock(&heap->mutex);
+
+    num_buckets = heap->heap_size >> heap->bucket_shift;
+    i = num_buckets;
+    while ((i > 1) && object_heap_bucket_is_free(heap, i - 1)) {
+        i--;
+    }
+    if (i == num_buckets) {
+        pthread_mutex_unlock(&heap->mutex);
+        return 0;
+    }
+
+    trimmed = malloc((num_buckets - i) * sizeof(void *));
+    if (NULL == trimmed) {
+        pthread_mutex_unlock(&heap->mutex);
+        return 0;
+    }
+    new_heap_size = i << heap->bucket_shift;
+
+    /* Unlink the slots that go away from the free list, keeping its order */
+    next_free = heap->next_free;
+    heap->next_free = LAST_FREE;
+    tail = NULL;
+    while (LAST_FREE != next_free) {
+        obj = OBJECT_HEAP_SLOT(heap, heap->bucket, next_free);
+        following = obj->next_free;
+        if (next_free < new_heap_size) {
+            if (tail) {
+                ATOMIC_STORE(&tail->next_free, next_free);
+            } else {
+                heap->next_free = next_free;
+            }
+            tail = obj;
+        }
+        next_free = following;
+    }
+    if (tail) {
+        ATOMIC_STORE(&tail->next_free, LAST_FREE);
+        heap->last_free = tail->id & OBJECT_HEAP_INDEX_MASK;
+    } else {
+        heap->last_free = LAST_FREE;
+    }
+
+    /* Remember where the generations were, for when the heap grows back */
+    for (j = new_heap_size; j < heap->heap_size; j++) {
+        obj = OBJECT_HEAP_SLOT(heap, heap->bucket, j);
+        heap->generation[j] = (obj->id & OBJECT_HEAP_GENERATION_MASK) >> OBJECT_HEAP_GENERATION_SHIFT;
+    }
+
+    /* Unpublish the size first so that new lookups stop at the new end */
+    released = heap->heap_size - new_heap_size;
+    ATOMIC_STORE_SC(&heap->heap_size, new_heap_size);
+    for (j = 0; i < num_buckets; i++, j++) {
+        trimmed[j] = heap->bucket[i];
+        ATOMIC_STORE_SC(&heap->bucket[i], NULL);
+    }
+
+    object_heap_wait_readers(heap);
+    while (j--) {
+        free(trimmed[j]);
+    }
+    free(trimmed);
+
+    pthread_mutex_unlock(&heap->mutex);
+    return released;
+}
+
+/*
+ * Returns the current, peak and reserved object counts
+ */
+void
+object_heap_get_stats(object_heap_p heap, struct object_heap_stats *stats)
+{
+    pthread_mutex_lock(&heap->mutex);
+    stats->allocated = heap->num_allocated;
+    stats->peak_allocated = heap->peak_allocated;
+    stats->reserved = heap->heap_size;
+    pthread_mutex_unlock(&heap->mutex);
+}
+
 /*
  * Destroys a heap, the heap must be empty.
  */
@@ -243,25 +663,41 @@ void
 object_heap_destroy(object_heap_p heap)
 {
     object_base_p obj;
-    int bucket_index, obj_index, i;
+    int i;
 
     /* Check if heap is empty */
     for (i = 0; i < heap->heap_size; i++) {
         /* Check if object is not still allocated */
-        bucket_index = i / heap->heap_increment;
-        obj_index = i % heap->heap_increment;
-        obj = (object_base_p)(heap->bucket[bucket_index] + obj_index * heap->object_size);
+        obj = OBJECT_HEAP_SLOT(heap, heap->bucket, i);
         ASSERT(obj->next_free != ALLOCATED);
     }
 
-    for (i = 0; i < heap->heap_size / heap->heap_increment; i++) {
+    for (i = 0; i < heap->heap_size >> heap->bucket_shift; i++) {
         free(heap->bucket[i]);
     }
 
     pthread_mutex_destroy(&heap->mutex);
 
+    for (i = 0; i < heap->num_retired; i++) {
+        free(heap->retired[i]);
+    }
+    free(heap->retired);
+    heap->retired = NULL;
+    heap->num_retired = 0;
+
+    free(heap->occupied);
+    heap->occupied = NULL;
+
+    free(heap->generation);
+    heap->generation = NULL;
+    heap->num_generations = 0;
+
+    free(heap->readers);
+    heap->readers = NULL;
+
     free(heap->bucket);
     heap->bucket = NULL;
     heap->heap_size = 0;
     heap->next_free = LAST_FREE;
+    heap->last_free = LAST_FREE;
 }
@@ -26,9 +26,34 @@
 #define OBJECT_HEAP_H
 
 #include <pthread.h>
+#include <stdint.h>
 
-#define OBJECT_HEAP_OFFSET_MASK 0x7F000000
-#define OBJECT_HEAP_ID_MASK     0x00FFFFFF
+/*
+ * The top bits of an ID tell the heaps of a driver apart, an id_offset is a
+ * multiple of OBJECT_HEAP_ID_MASK + 1 below OBJECT_HEAP_OFFSET_MASK, so up to
+ * seven heaps.
+ */
+#define OBJECT_HEAP_OFFSET_MASK 0x70000000
+#define OBJECT_HEAP_ID_MASK     0x0FFFFFFF
+
+/*
+ * The per-heap part of an ID is split into a slot index and a generation
+ * counter that is bumped every time the slot is freed, so a stale ID held
+ * after the object was destroyed no longer resolves to the slot's next tenant.
+ * A heap holds up to 262144 objects. Freed slots are reused oldest first, so
+ * a stale ID can only resolve again once its slot has been reallocated 1024
+ * times, and no sooner than 1024 times the number of free slots allocations.
+ */
+#define OBJECT_HEAP_INDEX_MASK          0x0003FFFF
+#define OBJECT_HEAP_GENERATION_MASK     0x0FFC0000
+#define OBJECT_HEAP_GENERATION_SHIFT    18
+
+/* Objects are padded and aligned to a cache line */
+#define OBJECT_HEAP_ALIGNMENT           64
+#define OBJECT_HEAP_DEFAULT_BUCKET_SIZE 16
+
+/* Lookups in flight are counted on this many cache lines, see object_heap_trim() */
+#define OBJECT_HEAP_READER_SHARDS       16
 
 typedef struct object_base *object_base_p;
 typedef struct object_heap *object_heap_p;
@@ -38,25 +63,64 @@ struct object_base {
     int next_free;
 };
 
+/* Lookups in flight on one shard, per phase of object_heap_trim() */
+struct object_heap_readers {
+    int active[2];
+    char pad[OBJECT_HEAP_ALIGNMENT - 2 * sizeof(int)];
+};
+
 struct object_heap {
     pthread_mutex_t mutex;
     int object_size;
     int id_offset;
     int next_free;
+    int last_free;      /* Tail of the free list, freed slots are queued there */
     int heap_size;
-    int heap_increment;
+    int heap_increment;     /* Objects per bucket, a power of two */
+    int bucket_shift;
+    int bucket_mask;
     void **bucket;
     int num_buckets;
+    void ***retired;    /* Superseded bucket indexes, see object_heap_lookup() */
+    int num_retired;
+    uint64_t *occupied; /* One bit per allocated slot */
+    uint16_t *generation;   /* Next generation of every slot ever reserved */
+    int num_generations;
+    struct object_heap_readers *readers;
+    int reader_phase;
+    int num_allocated;
+    int peak_allocated;
+};
+
+struct object_heap_stats {
+    int allocated;      /* Objects currently allocated */
+    int peak_allocated; /* High-water mark of allocated objects */
+    int reserved;       /* Slots backed by memory */
 };
 
 typedef int object_heap_iterator;
 
+/* Return value flags of an object_heap_visitor */
+#define OBJECT_HEAP_VISIT_CONTINUE      0
+#define OBJECT_HEAP_VISIT_STOP          1   /* End the walk after this object */
+#define OBJECT_HEAP_VISIT_FREE          2   /* Free this object */
+
+typedef int (*object_heap_visitor)(object_base_p obj, void *data);
+
 /*
  * Return 0 on success, -1 on error
  */
 int
 object_heap_init(object_heap_p heap, int object_size, int id_offset);
 
+/*
+ * Same as object_heap_init() with bucket_size objects per bucket instead of
+ * OBJECT_HEAP_DEFAULT_BUCKET_SIZE, bucket_size must be a power of two.
+ * Return 0 on success, -1 on error
+ */
+int
+object_heap_init_bucket_size(object_heap_p heap, int object_size, int id_offset, int bucket_size);
+
 /*
  * Allocates an object
  * Returns the object ID on success, returns -1 on error
@@ -64,9 +128,20 @@ object_heap_init(object_heap_p heap, int object_size, int id_offset);
 int
 object_heap_allocate(object_heap_p heap);
 
+/*
+ * Allocates num_objects objects, taking the heap lock once
+ * The IDs are returned in ids and are contiguous whenever the free list allows.
+ * Returns 0 on success, returns -1 on error (nothing is allocated then)
+ */
+int
+object_heap_allocate_n(object_heap_p heap, int num_objects, int *ids);
+
 /*
  * Lookup an allocated object by object ID
  * Returns a pointer to the object on success, returns NULL on error
+ * (including IDs whose generation no longer matches the slot).
+ * Does not take the heap mutex and is safe to call concurrently with
+ * allocate and free.
  */
 object_base_p
 object_heap_lookup(object_heap_p heap, int id);
@@ -85,12 +160,44 @@ object_heap_first(object_heap_p heap, object_heap_iterator *iter);
 object_base_p
 object_heap_next(object_heap_p heap, object_heap_iterator *iter);
 
+/*
+ * Calls visit for every allocated object, holding the heap lock once for the
+ * whole walk. The visitor must not allocate or free objects of this heap
+ * itself, it returns OBJECT_HEAP_VISIT_FREE to have the heap free the object.
+ * Returns the number of objects visited.
+ */
+int
+object_heap_foreach(object_heap_p heap, object_heap_visitor visit, void *data);
+
 /*
  * Frees an object
  */
 void
 object_heap_free(object_heap_p heap, object_base_p obj);
 
+/*
+ * Frees the objects with the given IDs, taking the heap lock once
+ * IDs that are not allocated are ignored.
+ */
+void
+object_heap_free_n(object_heap_p heap, const int *ids, int num_objects);
+
+/*
+ * Releases the memory of fully free buckets at the end of the heap.
+ * Meant to be called at idle points, it waits for the lookups in flight to
+ * finish before the memory is returned to the system. IDs of released slots
+ * stay invalid when the heap grows back over them.
+ * Returns the number of slots released.
+ */
+int
+object_heap_trim(object_heap_p heap);
+
+/*
+ * Returns the current, peak and reserved object counts of the heap
+ */
+void
+object_heap_get_stats(object_heap_p heap, struct object_heap_stats *stats);
+
 /*
  * Destroys a heap, the heap must be empty.
  */
@@ -0,0 +1,308 @@
+/*
+ * Copyright (c) 2012 Scott Tincman <sctincman@gmail.com>. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <assert.h>
+#include <sys/mman.h>
+#include "surface_pool.h"
+
+#define ASSERT  assert
+
+#define ALIGN(value, alignment)     (((value) + (alignment) - 1) & ~((alignment) - 1))
+
+static struct surface_storage *
+surface_pool_create_storage(surface_pool_p pool, int width, int height)
+{
+    struct surface_storage *storage;
+    size_t alignment = SURFACE_POOL_ALIGNMENT;
+    void *ptr;
+
+    storage = malloc(sizeof(*storage));
+    if (!storage) {
+        return NULL;
+    }
+
+    storage->width = width;
+    storage->height = height;
+    storage->pitch = ALIGN(width, SURFACE_POOL_ALIGNMENT);
+    /* Pitches that are a multiple of 4 KB make every line alias in the cache */
+    if ((storage->pitch & 4095) == 0) {
+        storage->pitch += SURFACE_POOL_ALIGNMENT;
+    }
+    storage->luma_height = ALIGN(height, SURFACE_POOL_HEIGHT_ALIGNMENT);
+    storage->chroma_offset = storage->pitch * storage->luma_height;
+    storage->size = (size_t)storage->chroma_offset + storage->pitch * (storage->luma_height / 2);
+    storage->hugepage = pool->use_hugepages && (storage->size >= SURFACE_POOL_HUGEPAGE_SIZE);
+    if (storage->hugepage) {
+        alignment = SURFACE_POOL_HUGEPAGE_SIZE;
+        storage->size = ALIGN(storage->size, SURFACE_POOL_HUGEPAGE_SIZE);
+    }
+
+    if (posix_memalign(&ptr, alignment, storage->size)) {
+        free(storage);
+        return NULL; /* Out of memory */
+    }
+#ifdef MADV_HUGEPAGE
+    if (storage->hugepage) {
+        /* Only advice, a kernel without transparent huge pages ignores it */
+        madvise(ptr, storage->size, MADV_HUGEPAGE);
+    }
+#endif
+    storage->data = ptr;
+    storage->next = storage->prev = NULL;
+    storage->lru_next = storage->lru_prev = NULL;
+    storage->bucket = NULL;
+    return storage;
+}
+
+static void
+surface_pool_free_list(struct surface_storage *storage)
+{
+    struct surface_storage *next;
+
+    for (; storage; storage = next) {
+        next = storage->next;
+        free(storage->data);
+        free(storage);
+    }
+}
+
+static struct surface_pool_bucket *
+surface_pool_find_bucket(surface_pool_p pool, int width, int height)
+{
+    struct surface_pool_bucket *bucket;
+
+    for (bucket = pool->buckets; bucket; bucket = bucket->next) {
+        if ((bucket->width == width) && (bucket->height == height)) {
+            break;
+        }
+    }
+    return bucket;
+}
+
+/*
+ * Takes cached storage off its bucket and the LRU list, and frees the bucket
+ * once it is empty so resolutions that are gone don't pile up.
+ * Called with the pool mutex held.
+ */
+static void
+surface_pool_unlink(surface_pool_p pool, struct surface_storage *storage)
+{
+    struct surface_pool_bucket *bucket = storage->bucket;
+    struct surface_pool_bucket **link;
+
+    if (storage->prev) {
+        storage->prev->next = storage->next;
+    } else {
+        bucket->free_list = storage->next;
+    }
+    if (storage->next) {
+        storage->next->prev = storage->prev;
+    }
+
+    if (storage->lru_prev) {
+        storage->lru_prev->lru_next = storage->lru_next;
+    } else {
+        pool->lru_head = storage->lru_next;
+    }
+    if (storage->lru_next) {
+        storage->lru_next->lru_prev = storage->lru_prev;
+    } else {
+        pool->lru_tail = storage->lru_prev;
+    }
+
+    pool->bytes_cached -= storage->size;
+    storage->next = storage->prev = NULL;
+    storage->lru_next = storage->lru_prev = NULL;
+    storage->bucket = NULL;
+
+    if (!bucket->free_list) {
+        for (link = &pool->buckets; *link != bucket; link = &(*link)->next)
+            ;
+        *link = bucket->next;
+        free(bucket);
+    }
+}
+
+/*
+ * Return 0 on success, -1 on error
+ */
+int
+surface_pool_init(surface_pool_p pool, size_t max_cached, int use_hugepages)
+{
+    pthread_mutex_init(&pool->mutex, NULL);
+    pool->buckets = NULL;
+    pool->lru_head = NULL;
+    pool->lru_tail = NULL;
+    pool->max_cached = max_cached;
+    pool->bytes_cached = 0;
+    pool->bytes_in_use = 0;
+    pool->use_hugepages = use_hugepages;
+    pool->hits = 0;
+    pool->misses = 0;
+    return 0;
+}
+
+/*
+ * Returns NV12 storage for a width x height surface, NULL on error
+ */
+struct surface_storage *
+surface_pool_alloc(surface_pool_p pool, int width, int height)
+{
+    struct surface_pool_bucket *bucket;
+    struct surface_storage *storage = NULL;
+
+    pthread_mutex_lock(&pool->mutex);
+    bucket = surface_pool_find_bucket(pool, width, height);
+    if (bucket) {
+        storage = bucket->free_list;
+        surface_pool_unlink(pool, storage);
+        pool->hits++;
+    } else {
+        pool->misses++;
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    if (!storage) {
+        storage = surface_pool_create_storage(pool, width, height);
+        if (!storage) {
+            return NULL;
+        }
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->bytes_in_use += storage->size;
+    pthread_mutex_unlock(&pool->mutex);
+
+    return storage;
+}
+
+/*
+ * Returns storage obtained from surface_pool_alloc() to the pool
+ */
+void
+surface_pool_release(surface_pool_p pool, struct surface_storage *storage)
+{
+    struct surface_pool_bucket *bucket = NULL;
+    struct surface_storage *stale = NULL, *victim;
+
+    if (!storage)
+        return;
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->bytes_in_use -= storage->size;
+    if (storage->size <= pool->max_cached) {
+        /* Make room by evicting whatever was released longest ago */
+        while (pool->bytes_cached + storage->size > pool->max_cached) {
+            victim = pool->lru_tail;
+            surface_pool_unlink(pool, victim);
+            victim->next = stale;
+            stale = victim;
+        }
+
+        bucket = surface_pool_find_bucket(pool, storage->width, storage->height);
+        if (!bucket) {
+            bucket = malloc(sizeof(*bucket));
+            if (bucket) {
+                bucket->width = storage->width;
+                bucket->height = storage->height;
+                bucket->free_list = NULL;
+                bucket->next = pool->buckets;
+                pool->buckets = bucket;
+            }
+        }
+    }
+    if (bucket) {
+        storage->bucket = bucket;
+        storage->prev = NULL;
+        storage->next = bucket->free_list;
+        if (storage->next) {
+            storage->next->prev = storage;
+        }
+        bucket->free_list = storage;
+
+        storage->lru_prev = NULL;
+        storage->lru_next = pool->lru_head;
+        if (storage->lru_next) {
+            storage->lru_next->lru_prev = storage;
+        } else {
+            pool->lru_tail = storage;
+        }
+        pool->lru_head = storage;
+
+        pool->bytes_cached += storage->size;
+    } else {
+        /* Larger than the whole cache, or out of memory for a bucket */
+        storage->next = stale;
+        stale = storage;
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    surface_pool_free_list(stale);
+}
+
+/*
+ * Frees all cached storage
+ */
+void
+surface_pool_trim(surface_pool_p pool)
+{
+    struct surface_storage *stale = NULL, *storage;
+
+    pthread_mutex_lock(&pool->mutex);
+    while ((storage = pool->lru_tail)) {
+        surface_pool_unlink(pool, storage);
+        storage->next = stale;
+        stale = storage;
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    surface_pool_free_list(stale);
+}
+
+/*
+ * Returns the hit/miss counters and the memory held by the pool
+ */
+void
+surface_pool_get_stats(surface_pool_p pool, struct surface_pool_stats *stats)
+{
+    pthread_mutex_lock(&pool->mutex);
+    stats->hits = pool->hits;
+    stats->misses = pool->misses;
+    stats->bytes_cached = pool->bytes_cached;
+    stats->bytes_in_use = pool->bytes_in_use;
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+/*
+ * Destroys a pool, all storage must have been released.
+ */
+void
+surface_pool_destroy(surface_pool_p pool)
+{
+    ASSERT(pool->bytes_in_use == 0);
+
+    surface_pool_trim(pool);
+    pthread_mutex_destroy(&pool->mutex);
+}
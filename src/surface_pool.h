@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2012 Scott Tincman <sctincman@gmail.com>. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef SURFACE_POOL_H
+#define SURFACE_POOL_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+/*
+ * Backing storage for NV12 surfaces. Released storage is kept on a free list
+ * per resolution for reuse by surfaces of the same size, so tearing down and
+ * re-creating the surfaces of a stream costs no page faults, even when
+ * several streams of different sizes share the pool. Once max_cached is
+ * reached, the least recently released storage is freed first.
+ */
+
+#define SURFACE_POOL_ALIGNMENT          64      /* Base address and pitch */
+#define SURFACE_POOL_HEIGHT_ALIGNMENT   32      /* Whole macroblock pairs */
+#define SURFACE_POOL_HUGEPAGE_SIZE      (2 << 20)
+
+typedef struct surface_pool *surface_pool_p;
+
+struct surface_pool_bucket;
+
+struct surface_storage {
+    struct surface_storage *next;       /* Bucket free list, most recently released first */
+    struct surface_storage *prev;
+    struct surface_storage *lru_next;   /* Pool-wide release order, newest first */
+    struct surface_storage *lru_prev;
+    struct surface_pool_bucket *bucket; /* Free list holding this storage while cached */
+    unsigned char *data;                /* Y plane, followed by the interleaved UV plane */
+    size_t size;                        /* Bytes allocated at data */
+    int width;
+    int height;
+    unsigned int pitch;                 /* Bytes per line, for both planes */
+    unsigned int luma_height;           /* Lines allocated for the Y plane */
+    unsigned int chroma_offset;         /* Offset of the UV plane from data */
+    int hugepage;                       /* Allocation was aligned and advised for huge pages */
+};
+
+/*
+ * Free list of the cached storage for one resolution
+ */
+struct surface_pool_bucket {
+    struct surface_pool_bucket *next;
+    struct surface_storage *free_list;
+    int width;
+    int height;
+};
+
+struct surface_pool {
+    pthread_mutex_t mutex;
+    struct surface_pool_bucket *buckets;
+    struct surface_storage *lru_head;   /* Most recently released */
+    struct surface_storage *lru_tail;   /* Evicted first */
+    size_t max_cached;      /* Storage beyond this many cached bytes is freed */
+    size_t bytes_cached;
+    size_t bytes_in_use;
+    int use_hugepages;
+    unsigned long hits;
+    unsigned long misses;
+};
+
+struct surface_pool_stats {
+    unsigned long hits;
+    unsigned long misses;
+    size_t bytes_cached;    /* Held on the free lists */
+    size_t bytes_in_use;    /* Backing live surfaces */
+};
+
+/*
+ * Return 0 on success, -1 on error
+ */
+int
+surface_pool_init(surface_pool_p pool, size_t max_cached, int use_hugepages);
+
+/*
+ * Returns NV12 storage for a width x height surface, NULL on error
+ */
+struct surface_storage *
+surface_pool_alloc(surface_pool_p pool, int width, int height);
+
+/*
+ * Returns storage obtained from surface_pool_alloc() to the pool
+ */
+void
+surface_pool_release(surface_pool_p pool, struct surface_storage *storage);
+
+/*
+ * Frees all cached storage
+ */
+void
+surface_pool_trim(surface_pool_p pool);
+
+/*
+ * Returns the hit/miss counters and the memory held by the pool
+ */
+void
+surface_pool_get_stats(surface_pool_p pool, struct surface_pool_stats *stats);
+
+/*
+ * Destroys a pool, all storage must have been released.
+ */
+void
+surface_pool_destroy(surface_pool_p pool);
+
+#endif /* SURFACE_POOL_H */
@@ -0,0 +1,438 @@
+/*
+ * Copyright (c) 2012 Scott Tincman <sctincman@gmail.com>. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <assert.h>
+#include <sched.h>
+#include "thread_pool.h"
+
+#define ASSERT  assert
+
+#define THREAD_POOL_MIN_DEQUE   64
+
+/* The worker the calling thread is, NULL outside of every pool */
+static __thread struct thread_pool_worker *thread_pool_self;
+
+/* The group the calling thread works for, NULL for none */
+static __thread thread_pool_group_p thread_pool_self_group;
+
+/*
+ * Counts the calling thread in the group of a task it is about to run,
+ * unless it works for the group already
+ * Return 1 if it was counted, 0 if it needn't be, -1 if the group is full
+ */
+static int
+thread_pool_claim(thread_pool_group_p group)
+{
+    unsigned int threads;
+
+    if ((NULL == group) || (group == thread_pool_self_group)) {
+        return 0;
+    }
+    threads = __atomic_load_n(&group->threads, __ATOMIC_SEQ_CST);
+    do {
+        if (threads >= group->max_threads) {
+            return -1;
+        }
+    } while (!__atomic_compare_exchange_n(&group->threads, &threads, threads + 1, 0,
+                                          __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+    return 1;
+}
+
+/*
+ * Appends a task at the newest end of a deque
+ * Return 0 on success, -1 on error
+ */
+static int
+thread_pool_push(thread_pool_p pool, struct thread_pool_deque *deque, struct thread_pool_task *task)
+{
+    unsigned int i;
+
+    pthread_mutex_lock(&deque->mutex);
+    if (deque->count == deque->size) {
+        unsigned int size = deque->size ? 2 * deque->size : THREAD_POOL_MIN_DEQUE;
+        struct thread_pool_task **tasks = malloc(size * sizeof(*tasks));
+
+        if (NULL == tasks) {
+            pthread_mutex_unlock(&deque->mutex);
+            return -1;
+        }
+        for (i = 0; i < deque->count; i++) {
+            tasks[i] = deque->tasks[(deque->head + i) % deque->size];
+        }
+        free(deque->tasks);
+        deque->tasks = tasks;
+        deque->head = 0;
+        deque->size = size;
+    }
+    deque->tasks[(deque->head + deque->count) % deque->size] = task;
+    deque->count++;
+    __atomic_add_fetch(&pool->queued, 1, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&pool->events, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&deque->mutex);
+    return 0;
+}
+
+/*
+ * Removes the newest task of a deque the calling thread may run, or the
+ * oldest one when stealing, counting the thread in its group
+ * Returns NULL if there is none, *claimed tells whether it was counted
+ */
+static struct thread_pool_task *
+thread_pool_pop(thread_pool_p pool, struct thread_pool_deque *deque, int steal, int *claimed)
+{
+    struct thread_pool_task *task = NULL;
+    unsigned int i, j;
+    int claim;
+
+    pthread_mutex_lock(&deque->mutex);
+    for (i = 0; i < deque->count; i++) {
+        j = steal ? i : deque->count - 1 - i;
+        claim = thread_pool_claim(deque->tasks[(deque->head + j) % deque->size]->group);
+        if (claim < 0) {
+            continue;
+        }
+        task = deque->tasks[(deque->head + j) % deque->size];
+        *claimed = claim;
+        /* Close the gap, tasks are mostly taken from either end */
+        if (0 == j) {
+            deque->head = (deque->head + 1) % deque->size;
+        } else {
+            for (; j + 1 < deque->count; j++) {
+                deque->tasks[(deque->head + j) % deque->size] = deque->tasks[(deque->head + j + 1) % deque->size];
+            }
+        }
+        deque->count--;
+        __atomic_sub_fetch(&pool->queued, 1, __ATOMIC_SEQ_CST);
+        break;
+    }
+    pthread_mutex_unlock(&deque->mutex);
+    return task;
+}
+
+/*
+ * Takes a task off the deque at index, or steals one from the others
+ * Returns NULL if no deque has a task the calling thread may run
+ */
+static struct thread_pool_task *
+thread_pool_take(thread_pool_p pool, int index, int *claimed)
+{
+    struct thread_pool_task *task;
+    int num_deques = pool->num_workers + 1;
+    int i;
+
+    if (0 == __atomic_load_n(&pool->queued, __ATOMIC_SEQ_CST)) {
+        return NULL;
+    }
+    task = thread_pool_pop(pool, &pool->deques[index], 0, claimed);
+    for (i = 1; (NULL == task) && (i < num_deques); i++) {
+        task = thread_pool_pop(pool, &pool->deques[(index + i) % num_deques], 1, claimed);
+        if (task) {
+            __atomic_add_fetch(&pool->tasks_stolen, 1, __ATOMIC_RELAXED);
+        }
+    }
+    return task;
+}
+
+static void thread_pool_wake(thread_pool_p pool, int all);
+
+/*
+ * Lets a thread counted in the group go, waking up a thread skipping its
+ * tasks. The group may go once the count drops, so that is the last thing
+ * touching it.
+ */
+static void
+thread_pool_release(thread_pool_p pool, thread_pool_group_p group)
+{
+    __atomic_sub_fetch(&group->threads, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&pool->queued, __ATOMIC_SEQ_CST)) {
+        __atomic_add_fetch(&pool->events, 1, __ATOMIC_SEQ_CST);
+        thread_pool_wake(pool, 0);
+    }
+}
+
+/* Runs a task taken off a deque, working for its group meanwhile */
+static void
+thread_pool_run(thread_pool_p pool, struct thread_pool_task *task, int claimed)
+{
+    thread_pool_group_p self_group = thread_pool_self_group;
+    thread_pool_group_p group = task->group;
+
+    __atomic_add_fetch(&pool->tasks_run, 1, __ATOMIC_RELAXED);
+    if (group) {
+        thread_pool_self_group = group;
+    }
+    task->run(task);
+    thread_pool_self_group = self_group;
+    if (claimed) {
+        thread_pool_release(pool, group);
+    }
+}
+
+/* Index of the deque the calling thread takes its tasks from */
+static int
+thread_pool_index(thread_pool_p pool)
+{
+    if (thread_pool_self && (thread_pool_self->pool == pool)) {
+        return thread_pool_self->index;
+    }
+    return pool->num_workers;
+}
+
+/*
+ * Wakes up a thread blocked on the pool
+ * Called after making the change it has to see
+ */
+static void
+thread_pool_wake(thread_pool_p pool, int all)
+{
+    /* Sleepers count themselves before checking, so one side sees the other */
+    if (0 == __atomic_load_n(&pool->sleeping, __ATOMIC_SEQ_CST)) {
+        return;
+    }
+    pthread_mutex_lock(&pool->mutex);
+    if (all) {
+        pthread_cond_broadcast(&pool->wake);
+    } else {
+        pthread_cond_signal(&pool->wake);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+static void *
+thread_pool_worker(void *arg)
+{
+    struct thread_pool_worker *worker = arg;
+    thread_pool_p pool = worker->pool;
+    struct thread_pool_task *task;
+    unsigned int events;
+    int stop = 0, claimed;
+
+    thread_pool_self = worker;
+    while (!stop) {
+        events = __atomic_load_n(&pool->events, __ATOMIC_SEQ_CST);
+        task = thread_pool_take(pool, worker->index, &claimed);
+        if (task) {
+            thread_pool_run(pool, task, claimed);
+            continue;
+        }
+        /* Sleep until a task is queued or a full group lets a thread go */
+        pthread_mutex_lock(&pool->mutex);
+        __atomic_add_fetch(&pool->sleeping, 1, __ATOMIC_SEQ_CST);
+        while (!pool->stop && (events == __atomic_load_n(&pool->events, __ATOMIC_SEQ_CST))) {
+            pthread_cond_wait(&pool->wake, &pool->mutex);
+        }
+        __atomic_sub_fetch(&pool->sleeping, 1, __ATOMIC_SEQ_CST);
+        stop = pool->stop;
+        pthread_mutex_unlock(&pool->mutex);
+    }
+    return NULL;
+}
+
+/*
+ * Return 0 on success, -1 on error
+ */
+int
+thread_pool_init(thread_pool_p pool, int num_workers)
+{
+    int i;
+
+    ASSERT(num_workers >= 0);
+    pool->num_workers = 0;
+    pool->num_threads = 0;
+    pool->stop = 0;
+    pool->queued = 0;
+    pool->events = 0;
+    pool->sleeping = 0;
+    pool->tasks_run = 0;
+    pool->tasks_stolen = 0;
+    pool->workers = calloc(num_workers + 1, sizeof(*pool->workers));
+    pool->deques = calloc(num_workers + 1, sizeof(*pool->deques));
+    if ((NULL == pool->workers) || (NULL == pool->deques)) {
+        free(pool->workers);
+        free(pool->deques);
+        return -1;
+    }
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    for (i = 0; i <= num_workers; i++) {
+        pthread_mutex_init(&pool->deques[i].mutex, NULL);
+    }
+
+    pool->num_workers = num_workers;
+    for (i = 0; i < num_workers; i++) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].index = i;
+    }
+    /* The deques of workers that didn't start only ever get stolen from */
+    for (pool->num_threads = 0; pool->num_threads < num_workers; pool->num_threads++) {
+        if (pthread_create(&pool->workers[pool->num_threads].thread, NULL, thread_pool_worker,
+                           &pool->workers[pool->num_threads])) {
+            break;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Queues a task, on the deque of the calling worker if it is one of the
+ * pool's. The task runs in the calling thread if it can't be queued.
+ */
+void
+thread_pool_submit(thread_pool_p pool, struct thread_pool_task *task)
+{
+    task->group = thread_pool_self_group;
+    if (thread_pool_push(pool, &pool->deques[thread_pool_index(pool)], task) < 0) {
+        /* Works for the group already */
+        thread_pool_run(pool, task, 0);
+        return;
+    }
+    thread_pool_wake(pool, 0);
+}
+
+/*
+ * Runs queued tasks until *pending drops to zero, blocking when there are
+ * none to run
+ */
+void
+thread_pool_wait(thread_pool_p pool, unsigned int *pending)
+{
+    int index = thread_pool_index(pool);
+    struct thread_pool_task *task;
+    unsigned int events;
+    int claimed;
+
+    while (__atomic_load_n(pending, __ATOMIC_SEQ_CST)) {
+        events = __atomic_load_n(&pool->events, __ATOMIC_SEQ_CST);
+        task = thread_pool_take(pool, index, &claimed);
+        if (task) {
+            thread_pool_run(pool, task, claimed);
+            continue;
+        }
+        pthread_mutex_lock(&pool->mutex);
+        __atomic_add_fetch(&pool->sleeping, 1, __ATOMIC_SEQ_CST);
+        while (__atomic_load_n(pending, __ATOMIC_SEQ_CST) &&
+               (events == __atomic_load_n(&pool->events, __ATOMIC_SEQ_CST))) {
+            pthread_cond_wait(&pool->wake, &pool->mutex);
+        }
+        __atomic_sub_fetch(&pool->sleeping, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&pool->mutex);
+    }
+}
+
+/*
+ * Decrements *pending, waking up the threads waiting on it when it drops
+ * to zero
+ */
+void
+thread_pool_done(thread_pool_p pool, unsigned int *pending)
+{
+    ASSERT(__atomic_load_n(pending, __ATOMIC_RELAXED) > 0);
+    if (0 == __atomic_sub_fetch(pending, 1, __ATOMIC_SEQ_CST)) {
+        thread_pool_wake(pool, 1);
+    }
+}
+
+/*
+ * Returns the task counters
+ */
+void
+thread_pool_get_stats(thread_pool_p pool, struct thread_pool_stats *stats)
+{
+    stats->num_threads = pool->num_threads;
+    stats->tasks_run = __atomic_load_n(&pool->tasks_run, __ATOMIC_RELAXED);
+    stats->tasks_stolen = __atomic_load_n(&pool->tasks_stolen, __ATOMIC_RELAXED);
+}
+
+/*
+ * Lets up to max_threads threads work for the group at once
+ */
+void
+thread_pool_group_init(thread_pool_group_p group, int max_threads)
+{
+    ASSERT(max_threads > 0);
+    group->max_threads = max_threads;
+    group->threads = 0;
+}
+
+/*
+ * The calling thread works for the group until thread_pool_leave(),
+ * whatever the other threads do
+ */
+void
+thread_pool_enter(thread_pool_p pool, thread_pool_group_p group)
+{
+    ASSERT(NULL == thread_pool_self_group);
+    (void) pool;
+    __atomic_add_fetch(&group->threads, 1, __ATOMIC_SEQ_CST);
+    thread_pool_self_group = group;
+}
+
+void
+thread_pool_leave(thread_pool_p pool, thread_pool_group_p group)
+{
+    ASSERT(group == thread_pool_self_group);
+    thread_pool_self_group = NULL;
+    thread_pool_release(pool, group);
+}
+
+/*
+ * Waits for the threads still letting go of the group, no task of the
+ * group may be queued
+ */
+void
+thread_pool_group_destroy(thread_pool_group_p group)
+{
+    /* Only the moment between a task returning and the count dropping */
+    while (__atomic_load_n(&group->threads, __ATOMIC_SEQ_CST)) {
+        sched_yield();
+    }
+}
+
+/*
+ * Stops the workers, no task may be queued or running
+ */
+void
+thread_pool_destroy(thread_pool_p pool)
+{
+    int i;
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->mutex);
+    for (i = 0; i < pool->num_threads; i++) {
+        pthread_join(pool->workers[i].thread, NULL);
+    }
+    ASSERT(0 == pool->queued);
+
+    for (i = 0; i <= pool->num_workers; i++) {
+        free(pool->deques[i].tasks);
+        pthread_mutex_destroy(&pool->deques[i].mutex);
+    }
+    free(pool->deques);
+    free(pool->workers);
+    pthread_cond_destroy(&pool->wake);
+    pthread_mutex_destroy(&pool->mutex);
+}
@@ -0,0 +1,164 @@
+/*
+ * Copyright (c) 2012 Scott Tincman <sctincman@gmail.com>. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <pthread.h>
+
+/*
+ * A fixed set of worker threads running small tasks, for spreading the
+ * work of one picture over several cores. Every worker owns a deque: what
+ * a worker submits goes on its own deque and it takes its newest task
+ * first, while the data is still in its cache, and a worker that runs dry
+ * steals the oldest task of another deque. Threads outside the pool share
+ * one more deque.
+ *
+ * Waiting for work is cooperative: thread_pool_wait() runs queued tasks
+ * until the counter it waits on drops to zero, so the decode thread joins
+ * in and n - 1 workers keep n cores busy.
+ *
+ * A group caps the threads working for one user of the pool at once. A
+ * thread works for the group it entered, or the group of the task it is
+ * running, and the tasks it submits belong to that group. Threads skip
+ * the tasks of a group running on as many threads as it allows, except
+ * the threads already working for it.
+ */
+
+typedef struct thread_pool *thread_pool_p;
+typedef struct thread_pool_group *thread_pool_group_p;
+
+/* Embedded at the start of the caller's task structure */
+struct thread_pool_task {
+    void (*run)(struct thread_pool_task *task);
+    thread_pool_group_p group;  /* Set when submitted */
+};
+
+struct thread_pool_group {
+    unsigned int max_threads;
+    /* Updated atomically */
+    unsigned int threads;       /* Threads working for the group */
+};
+
+struct thread_pool_deque {
+    pthread_mutex_t mutex;
+    struct thread_pool_task **tasks;    /* Ring of size entries */
+    unsigned int head;                  /* Oldest task */
+    unsigned int count;
+    unsigned int size;
+};
+
+struct thread_pool_worker {
+    struct thread_pool *pool;
+    pthread_t thread;
+    int index;
+};
+
+struct thread_pool {
+    pthread_mutex_t mutex;
+    pthread_cond_t wake;        /* Tasks were queued, a counter dropped to zero or the workers must stop */
+    int num_workers;
+    int num_threads;            /* Workers running, num_workers unless some failed to start */
+    int stop;
+    struct thread_pool_worker *workers;
+    struct thread_pool_deque *deques;   /* One per worker, then the one of outside threads */
+    /* Updated atomically */
+    unsigned int queued;        /* Tasks in all deques */
+    unsigned int events;        /* Times a task was queued or a group let a thread go */
+    unsigned int sleeping;      /* Threads blocked on wake */
+    unsigned long tasks_run;
+    unsigned long tasks_stolen;
+};
+
+struct thread_pool_stats {
+    int num_threads;
+    unsigned long tasks_run;
+    unsigned long tasks_stolen;
+};
+
+/*
+ * Starts num_workers threads. Fewer are left running if some can't be
+ * created, down to none, in which case waiting threads run every task.
+ * Return 0 on success, -1 on error
+ */
+int
+thread_pool_init(thread_pool_p pool, int num_workers);
+
+/*
+ * Queues a task, on the deque of the calling worker if it is one of the
+ * pool's. The task runs in the calling thread if it can't be queued.
+ */
+void
+thread_pool_submit(thread_pool_p pool, struct thread_pool_task *task);
+
+/*
+ * Runs queued tasks until *pending drops to zero, blocking when there are
+ * none to run
+ */
+void
+thread_pool_wait(thread_pool_p pool, unsigned int *pending);
+
+/*
+ * Decrements *pending, waking up the threads waiting on it when it drops
+ * to zero
+ */
+void
+thread_pool_done(thread_pool_p pool, unsigned int *pending);
+
+/*
+ * Returns the task counters
+ */
+void
+thread_pool_get_stats(thread_pool_p pool, struct thread_pool_stats *stats);
+
+/*
+ * Lets up to max_threads threads work for the group at once
+ */
+void
+thread_pool_group_init(thread_pool_group_p group, int max_threads);
+
+/*
+ * The calling thread works for the group until thread_pool_leave(),
+ * whatever the other threads do
+ */
+void
+thread_pool_enter(thread_pool_p pool, thread_pool_group_p group);
+
+void
+thread_pool_leave(thread_pool_p pool, thread_pool_group_p group);
+
+/*
+ * Waits for the threads still letting go of the group, no task of the
+ * group may be queued
+ */
+void
+thread_pool_group_destroy(thread_pool_group_p group);
+
+/*
+ * Stops the workers, no task may be queued or running
+ */
+void
+thread_pool_destroy(thread_pool_p pool);
+
+#endif /* THREAD_POOL_H */
@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2012 Scott Tincman <sctincman@gmail.com>. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Epiphany driver specific VA-API extensions
+ */
+
+#ifndef _VA_EPIPHANY_H_
+#define _VA_EPIPHANY_H_
+
+#include <va/va.h>
+
+/* Config attribute types private to this driver */
+#define VA_EPIPHANY_CONFIG_ATTRIB_BASE          0x45500000
+
+/*
+ * Zero-copy slice data (decode configs, value 0 or 1, default 0)
+ *
+ * When enabled, a VASliceDataBufferType buffer created with a non-NULL data
+ * pointer wraps the caller's memory (e.g. an mmap()ed memfd) instead of
+ * copying it. The memory must stay valid and unmodified until the buffer is
+ * destroyed, which for buffers passed to vaRenderPicture() is once the
+ * picture has been decoded: vaSyncSurface() on its render target returns.
+ * vaMapBuffer() returns the caller's pointer.
+ */
+#define VAConfigAttribEpiphanyZeroCopySliceData \
+    ((VAConfigAttribType)(VA_EPIPHANY_CONFIG_ATTRIB_BASE + 1))
+
+/*
+ * Decode threads (decode configs, value 1 to
+ * VA_EPIPHANY_MAX_DECODE_THREADS, default the "decode_threads" driver
+ * setting or 1)
+ *
+ * Most threads decoding pictures of the context at once: the decode queue
+ * thread running the picture and up to the value minus one workers of the
+ * pool all contexts share. The pool has "pool_threads" workers, by default
+ * one per core left by the decode queue threads, and is started by the
+ * first context asking for more than one thread. vaGetConfigAttributes()
+ * returns the pool's workers plus one, the most a context can use; a
+ * larger value is accepted and means as many. With more than one, the work
+ * is split as the decode strategy says. Pictures come out the same
+ * whatever the count.
+ */
+#define VAConfigAttribEpiphanyDecodeThreads \
+    ((VAConfigAttribType)(VA_EPIPHANY_CONFIG_ATTRIB_BASE + 2))
+#define VA_EPIPHANY_MAX_DECODE_THREADS          64
+
+/*
+ * Decode strategy (decode configs, one of VA_EPIPHANY_DECODE_*, default the
+ * "decode_strategy" driver setting, "serial", "rows" or "slices", or rows)
+ *
+ * What the decode threads do side by side within a picture:
+ *
+ * SERIAL:  nothing, each picture is decoded on one thread and no workers
+ *          are started.
+ * ROWS:    H.264 reconstructs and deblocks macroblock rows in wavefront
+ *          order behind parsing, MPEG-2 decodes its slice rows.
+ * SLICES:  H.264 decodes its slices, then deblocks the picture including
+ *          the slice boundaries in wavefront order. MPEG-2 slices do not
+ *          leave their row, so this is the same as ROWS there.
+ *
+ * Pictures whose slices are out of order or predict from the picture
+ * itself for want of a reference are decoded serially.
+ */
+#define VAConfigAttribEpiphanyDecodeStrategy \
+    ((VAConfigAttribType)(VA_EPIPHANY_CONFIG_ATTRIB_BASE + 3))
+#define VA_EPIPHANY_DECODE_SERIAL               0
+#define VA_EPIPHANY_DECODE_ROWS                 1
+#define VA_EPIPHANY_DECODE_SLICES               2
+
+/*
+ * Decode depth (decode configs, value 1 to VA_EPIPHANY_MAX_DECODE_DEPTH,
+ * default the "decode_depth" driver setting or 1)
+ *
+ * Pictures of the context the decode threads work on at once. With more
+ * than one, the next picture is parsed while the workers still
+ * reconstruct and deblock the ones before it, each as soon as the
+ * pictures it references are done, and vaSyncSurface() waits for all of
+ * that. Only H.264 with the ROWS strategy splits its pictures into those
+ * stages; other pictures, and contexts decoding on one thread, go one at
+ * a time.
+ */
+#define VAConfigAttribEpiphanyDecodeDepth \
+    ((VAConfigAttribType)(VA_EPIPHANY_CONFIG_ATTRIB_BASE + 4))
+#define VA_EPIPHANY_MAX_DECODE_DEPTH            8
+
+/*
+ * Decode weight (all configs, value 1 to VA_EPIPHANY_MAX_DECODE_WEIGHT,
+ * default 1)
+ *
+ * Share of the decode queue threads the context gets while pictures of
+ * other contexts wait too: contexts of the same priority are given decode
+ * time in proportion to their weights, whatever the size of their
+ * pictures. Contexts rendering into the same surfaces are scheduled
+ * together, with the sum of their weights.
+ */
+#define VAConfigAttribEpiphanyDecodeWeight \
+    ((VAConfigAttribType)(VA_EPIPHANY_CONFIG_ATTRIB_BASE + 5))
+#define VA_EPIPHANY_MAX_DECODE_WEIGHT           1000
+
+/*
+ * Decode priority (all configs, value 0 to VA_EPIPHANY_MAX_DECODE_PRIORITY,
+ * default 0)
+ *
+ * Pictures of a context are only decoded when no context of a higher
+ * priority has one waiting.
+ */
+#define VAConfigAttribEpiphanyDecodePriority \
+    ((VAConfigAttribType)(VA_EPIPHANY_CONFIG_ATTRIB_BASE + 6))
+#define VA_EPIPHANY_MAX_DECODE_PRIORITY         15
+
+/*
+ * Decode deadline (all configs, microseconds up to
+ * VA_EPIPHANY_MAX_DECODE_DEADLINE, default 0 for none)
+ *
+ * Time after vaEndPicture by which pictures of the context should be
+ * decoded. A picture whose deadline is nearer than the time the context's
+ * pictures take to decode goes ahead of the fair share of its priority,
+ * the earliest deadline first. Deadlines missed are counted in the driver
+ * stats.
+ */
+#define VAConfigAttribEpiphanyDecodeDeadline \
+    ((VAConfigAttribType)(VA_EPIPHANY_CONFIG_ATTRIB_BASE + 7))
+#define VA_EPIPHANY_MAX_DECODE_DEADLINE         10000000
+
+/*
+ * MPEG-2 MoComp (VAEntrypointMoComp)
+ *
+ * VAMacroblockParameterBufferMPEG2 elements carry the final motion vectors
+ * in PMV[r][s][t], not predictions. Bit (2 * r + s) of
+ * motion_vertical_field_select selects the reference field of vector r in
+ * direction s. Dual prime macroblocks put the vector in PMV[0][0] and the
+ * derived opposite parity vectors in PMV[0][1] (first field, or the field
+ * picture) and PMV[1][1] (second field). num_skipped_macroblocks
+ * macroblocks after macroblock_address are predicted like skipped ones.
+ *
+ * VAResidualDataBufferType buffers hold one short[64] spatial block, in
+ * raster order, per coded block of coded_block_pattern, in the order of
+ * the macroblock parameters. Buffers are consumed in the order rendered.
+ * Intra blocks are the samples themselves, the other blocks are added to
+ * the prediction; both saturate to 0..255.
+ */
+
+#endif /* _VA_EPIPHANY_H_ */
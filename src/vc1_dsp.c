@@ -0,0 +1,566 @@
+/*
+ * Copyright (c) 2012 Scott Tincman <sctincman@gmail.com>. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "config.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vc1_dsp.h"
+
+static inline uint8_t
+clip_u8(int value)
+{
+    return value < 0 ? 0 : (value > 255 ? 255 : value);
+}
+
+/*
+ * 8.3.6.3, one 8 point pass over values step apart: bias is added
+ * before the shift, and once more to the second half of the outputs in
+ * the column pass
+ */
+static inline void
+idct8_1d(int *x, int step, int bias, int bias2, int shift)
+{
+    int t1 = 12 * (x[0] + x[4 * step]) + bias;
+    int t2 = 12 * (x[0] - x[4 * step]) + bias;
+    int t3 = 16 * x[2 * step] + 6 * x[6 * step];
+    int t4 = 6 * x[2 * step] - 16 * x[6 * step];
+    int t5 = t1 + t3, t6 = t2 + t4, t7 = t2 - t4, t8 = t1 - t3;
+
+    t1 = 16 * x[step] + 15 * x[3 * step] + 9 * x[5 * step] + 4 * x[7 * step];
+    t2 = 15 * x[step] - 4 * x[3 * step] - 16 * x[5 * step] - 9 * x[7 * step];
+    t3 = 9 * x[step] - 16 * x[3 * step] + 4 * x[5 * step] + 15 * x[7 * step];
+    t4 = 4 * x[step] - 9 * x[3 * step] + 15 * x[5 * step] - 16 * x[7 * step];
+    x[0] = (t5 + t1) >> shift;
+    x[step] = (t6 + t2) >> shift;
+    x[2 * step] = (t7 + t3) >> shift;
+    x[3 * step] = (t8 + t4) >> shift;
+    x[4 * step] = (t8 - t4 + bias2) >> shift;
+    x[5 * step] = (t7 - t3 + bias2) >> shift;
+    x[6 * step] = (t6 - t2 + bias2) >> shift;
+    x[7 * step] = (t5 - t1 + bias2) >> shift;
+}
+
+/* The 4 point pass */
+static inline void
+idct4_1d(int *x, int step, int bias, int shift)
+{
+    int t1 = 17 * (x[0] + x[2 * step]) + bias;
+    int t2 = 17 * (x[0] - x[2 * step]) + bias;
+    int t3 = 22 * x[step] + 10 * x[3 * step];
+    int t4 = 22 * x[3 * step] - 10 * x[step];
+
+    x[0] = (t1 + t3) >> shift;
+    x[step] = (t2 - t4) >> shift;
+    x[2 * step] = (t2 + t4) >> shift;
+    x[3 * step] = (t1 - t3) >> shift;
+}
+
+/*
+ * Inverse transform of the width x height block at x, y of an 8x8 block
+ * into tmp with a stride of 8, rows first
+ */
+static void
+idct_block(int *tmp, const int16_t *block, int x, int y, int width, int height)
+{
+    int i, j;
+
+    for (j = 0; j < height; j++) {
+        int *row = tmp + (y + j) * 8 + x;
+
+        for (i = 0; i < width; i++)
+            row[i] = block[(y + j) * 8 + x + i];
+        if (width == 8)
+            idct8_1d(row, 1, 4, 0, 3);
+        else
+            idct4_1d(row, 1, 4, 3);
+    }
+    for (i = 0; i < width; i++) {
+        if (height == 8)
+            idct8_1d(tmp + y * 8 + x + i, 8, 64, 1, 7);
+        else
+            idct4_1d(tmp + y * 8 + x + i, 8, 64, 7);
+    }
+}
+
+static void
+idct8x8_c(int16_t *block)
+{
+    int tmp[64], i;
+
+    idct_block(tmp, block, 0, 0, 8, 8);
+    for (i = 0; i < 64; i++)
+        block[i] = tmp[i];
+}
+
+/*
+ * Transforms the parts of block in mask, given by the 8x8, 8x4 or 4x8
+ * shape and the 4x4 quarters they cover, and adds them to every
+ * step-th byte of dst
+ */
+static void
+idct_add_step(uint8_t *dst, ptrdiff_t stride, int step, int16_t *block, int width, int height,
+              int mask)
+{
+    int tmp[64], part, i, j;
+
+    for (part = 0; part < 4; part++) {
+        int x = (part & 1) * 4, y = (part >> 1) * 4;
+
+        if (!(mask & (8 >> part)) || (width == 8 && x) || (height == 8 && y))
+            continue;
+        idct_block(tmp, block, x, y, width, height);
+        for (j = 0; j < height; j++) {
+            for (i = 0; i < width; i++) {
+                uint8_t *pix = dst + (y + j) * stride + (x + i) * step;
+
+                *pix = clip_u8(*pix + tmp[(y + j) * 8 + x + i]);
+            }
+        }
+    }
+    memset(block, 0, 64 * sizeof(*block));
+}
+
+/* Which halves of 8x4 and 4x8 blocks as quarters */
+static const uint8_t half_mask[2][4] = {
+    { 0x0, 0xc, 0x3, 0xf },     /* Top, bottom */
+    { 0x0, 0xa, 0x5, 0xf },     /* Left, right */
+};
+
+static void
+idct8x8_add_c(uint8_t *dst, ptrdiff_t stride, int16_t *block)
+{
+    idct_add_step(dst, stride, 1, block, 8, 8, 0xf);
+}
+
+static void
+idct8x4_add_c(uint8_t *dst, ptrdiff_t stride, int16_t *block, int which)
+{
+    idct_add_step(dst, stride, 1, block, 8, 4, half_mask[0][which & 3]);
+}
+
+static void
+idct4x8_add_c(uint8_t *dst, ptrdiff_t stride, int16_t *block, int which)
+{
+    idct_add_step(dst, stride, 1, block, 4, 8, half_mask[1][which & 3]);
+}
+
+static void
+idct4x4_add_c(uint8_t *dst, ptrdiff_t stride, int16_t *block, int which)
+{
+    idct_add_step(dst, stride, 1, block, 4, 4, which);
+}
+
+static void
+idct8x8_add_uv_c(uint8_t *dst, ptrdiff_t stride, int16_t *block)
+{
+    idct_add_step(dst, stride, 2, block, 8, 8, 0xf);
+}
+
+static void
+idct8x4_add_uv_c(uint8_t *dst, ptrdiff_t stride, int16_t *block, int which)
+{
+    idct_add_step(dst, stride, 2, block, 8, 4, half_mask[0][which & 3]);
+}
+
+static void
+idct4x8_add_uv_c(uint8_t *dst, ptrdiff_t stride, int16_t *block, int which)
+{
+    idct_add_step(dst, stride, 2, block, 4, 8, half_mask[1][which & 3]);
+}
+
+static void
+idct4x4_add_uv_c(uint8_t *dst, ptrdiff_t stride, int16_t *block, int which)
+{
+    idct_add_step(dst, stride, 2, block, 4, 4, which);
+}
+
+/*
+ * 8.5.1, smooths the four samples at src[-2 * step] to src[step] of 8
+ * lines next apart, alternating the rounding between lines
+ */
+static inline void
+overlap_c(int16_t *src, ptrdiff_t step, ptrdiff_t next)
+{
+    int i, rnd = 1;
+
+    for (i = 0; i < 8; i++) {
+        int a = src[-2 * step], b = src[-step], c = src[0], d = src[step];
+        int d1 = a - d, d2 = a - d + b - c;
+        int r0 = rnd ? 4 : 3, r1 = 7 - r0;
+
+        src[-2 * step] = (8 * a - d1 + r0) >> 3;
+        src[-step] = (8 * b - d2 + r1) >> 3;
+        src[0] = (8 * c + d2 + r0) >> 3;
+        src[step] = (8 * d + d1 + r1) >> 3;
+        src += next;
+        rnd = !rnd;
+    }
+}
+
+static void
+overlap_h_c(int16_t *src, ptrdiff_t stride)
+{
+    overlap_c(src, 1, stride);
+}
+
+static void
+overlap_v_c(int16_t *src, ptrdiff_t stride)
+{
+    overlap_c(src, stride, 1);
+}
+
+/*
+ * 8.6.4, filters one line of samples across the edge before src[0],
+ * returns whether the line decides to filter its segment of 4
+ */
+static inline int
+filter_line_c(uint8_t *src, ptrdiff_t stride, int pq)
+{
+    int a0 = (2 * (src[-2 * stride] - src[stride]) - 5 * (src[-stride] - src[0]) + 4) >> 3;
+    int a0_sign = a0 < 0 ? -1 : 0;
+    int a1, a2, clip, clip_sign, d, d_sign;
+
+    a0 = abs(a0);
+    if (a0 >= pq)
+        return 0;
+    a1 = abs((2 * (src[-4 * stride] - src[-stride]) - 5 * (src[-3 * stride] - src[-2 * stride]) + 4) >> 3);
+    a2 = abs((2 * (src[0] - src[3 * stride]) - 5 * (src[stride] - src[2 * stride]) + 4) >> 3);
+    if (a1 >= a0 && a2 >= a0)
+        return 0;
+    clip = src[-stride] - src[0];
+    clip_sign = clip < 0 ? -1 : 0;
+    clip = abs(clip) >> 1;
+    if (!clip)
+        return 0;
+    d = 5 * ((a1 < a2 ? a1 : a2) - a0);
+    d_sign = (d < 0 ? -1 : 0) ^ a0_sign;
+    d = abs(d) >> 3;
+    if (d_sign == clip_sign) {
+        d = d < clip ? d : clip;
+        d = (d ^ d_sign) - d_sign;
+        src[-stride] = clip_u8(src[-stride] - d);
+        src[0] = clip_u8(src[0] + d);
+    }
+    return 1;
+}
+
+/* The third line of each 4 decides for all of them */
+static inline void
+loop_filter_c(uint8_t *src, ptrdiff_t step, ptrdiff_t stride, int len, int pq)
+{
+    int i;
+
+    for (i = 0; i < len; i += 4) {
+        if (filter_line_c(src + 2 * step, stride, pq)) {
+            filter_line_c(src, stride, pq);
+            filter_line_c(src + step, stride, pq);
+            filter_line_c(src + 3 * step, stride, pq);
+        }
+        src += 4 * step;
+    }
+}
+
+static void
+loop_filter_v_c(uint8_t *pix, ptrdiff_t stride, int len, int pq)
+{
+    loop_filter_c(pix, stride, 1, len, pq);
+}
+
+static void
+loop_filter_h_c(uint8_t *pix, ptrdiff_t stride, int len, int pq)
+{
+    loop_filter_c(pix, 1, stride, len, pq);
+}
+
+static void
+loop_filter_uv_v_c(uint8_t *pix, ptrdiff_t stride, int len, int pq, int components)
+{
+    if (components & 1)
+        loop_filter_c(pix, stride, 2, len, pq);
+    if (components & 2)
+        loop_filter_c(pix + 1, stride, 2, len, pq);
+}
+
+static void
+loop_filter_uv_h_c(uint8_t *pix, ptrdiff_t stride, int len, int pq, int components)
+{
+    if (components & 1)
+        loop_filter_c(pix, 2, stride, len, pq);
+    if (components & 2)
+        loop_filter_c(pix + 1, 2, stride, len, pq);
+}
+
+/* 8.3.6.5.1, the bicubic filter at quarter offset mode of four samples step apart */
+static inline int
+mspel_filter(const uint8_t *src, ptrdiff_t step, int mode)
+{
+    switch (mode) {
+    case 1:
+        return -4 * src[-step] + 53 * src[0] + 18 * src[step] - 3 * src[2 * step];
+    case 2:
+        return -src[-step] + 9 * src[0] + 9 * src[step] - src[2 * step];
+    default:
+        return -3 * src[-step] + 18 * src[0] + 53 * src[step] - 4 * src[2 * step];
+    }
+}
+
+static inline int
+mspel_filter16(const int16_t *src, int mode)
+{
+    switch (mode) {
+    case 1:
+        return -4 * src[-1] + 53 * src[0] + 18 * src[1] - 3 * src[2];
+    case 2:
+        return -src[-1] + 9 * src[0] + 9 * src[1] - src[2];
+    default:
+        return -3 * src[-1] + 18 * src[0] + 53 * src[1] - 4 * src[2];
+    }
+}
+
+/*
+ * Bicubic prediction of a size x size block. With both offsets the
+ * vertical pass goes first into 16 bits, with a shift that depends on
+ * the two filters.
+ */
+static inline void
+put_mspel_c(uint8_t *dst, ptrdiff_t dst_stride, const uint8_t *src, ptrdiff_t src_stride,
+            int size, int mx, int my, int rnd)
+{
+    static const int shift_value[4] = { 0, 5, 1, 5 };
+    int16_t tmp[16 * 19];
+    int x, y;
+
+    for (y = 0; y < size; y++) {
+        for (x = 0; x < size; x++) {
+            int value;
+
+            if (mx && my)
+                break;
+            else if (my)
+                value = (mspel_filter(src + x, src_stride, my) + (my == 2 ? 8 : 32) - (1 - rnd)) >>
+                        (my == 2 ? 4 : 6);
+            else if (mx)
+                value = (mspel_filter(src + x, 1, mx) + (mx == 2 ? 8 : 32) - rnd) >> (mx == 2 ? 4 : 6);
+            else
+                value = src[x];
+            dst[x] = clip_u8(value);
+        }
+        if (mx && my)
+            break;
+        dst += dst_stride;
+        src += src_stride;
+    }
+    if (!mx || !my)
+        return;
+
+    {
+        int shift = (shift_value[mx] + shift_value[my]) >> 1;
+        int r = (1 << (shift - 1)) + rnd - 1;
+
+        for (y = 0; y < size; y++) {
+            for (x = 0; x < size + 3; x++)
+                tmp[y * 19 + x] = (mspel_filter(src + x - 1, src_stride, my) + r) >> shift;
+            src += src_stride;
+        }
+        for (y = 0; y < size; y++) {
+            for (x = 0; x < size; x++)
+                dst[x] = clip_u8((mspel_filter16(tmp + y * 19 + x + 1, mx) + 64 - rnd) >> 7);
+            dst += dst_stride;
+        }
+    }
+}
+
+#define MSPEL_C(size, mx, my)                                                   \
+static void                                                                     \
+put_mspel##size##_##mx##my##_c(uint8_t *dst, ptrdiff_t dst_stride,              \
+                               const uint8_t *src, ptrdiff_t src_stride, int rnd) \
+{                                                                               \
+    put_mspel_c(dst, dst_stride, src, src_stride, size, mx, my, rnd);           \
+}
+
+#define MSPEL_C_ALL(size)                                                       \
+    MSPEL_C(size, 0, 0) MSPEL_C(size, 1, 0) MSPEL_C(size, 2, 0) MSPEL_C(size, 3, 0) \
+    MSPEL_C(size, 0, 1) MSPEL_C(size, 1, 1) MSPEL_C(size, 2, 1) MSPEL_C(size, 3, 1) \
+    MSPEL_C(size, 0, 2) MSPEL_C(size, 1, 2) MSPEL_C(size, 2, 2) MSPEL_C(size, 3, 2) \
+    MSPEL_C(size, 0, 3) MSPEL_C(size, 1, 3) MSPEL_C(size, 2, 3) MSPEL_C(size, 3, 3)
+
+MSPEL_C_ALL(16)
+MSPEL_C_ALL(8)
+
+#define MSPEL_TABLE(size, suffix) {                                             \
+    put_mspel##size##_00_##suffix, put_mspel##size##_10_##suffix,               \
+    put_mspel##size##_20_##suffix, put_mspel##size##_30_##suffix,               \
+    put_mspel##size##_01_##suffix, put_mspel##size##_11_##suffix,               \
+    put_mspel##size##_21_##suffix, put_mspel##size##_31_##suffix,               \
+    put_mspel##size##_02_##suffix, put_mspel##size##_12_##suffix,               \
+    put_mspel##size##_22_##suffix, put_mspel##size##_32_##suffix,               \
+    put_mspel##size##_03_##suffix, put_mspel##size##_13_##suffix,               \
+    put_mspel##size##_23_##suffix, put_mspel##size##_33_##suffix,               \
+}
+
+/* 8.3.6.5.2, bilinear half samples, rounding down when rnd is set */
+static inline void
+put_hpel_c(uint8_t *dst, ptrdiff_t dst_stride, const uint8_t *src, ptrdiff_t src_stride,
+           int size, int hx, int hy, int rnd)
+{
+    int x, y;
+
+    for (y = 0; y < size; y++) {
+        for (x = 0; x < size; x++) {
+            if (hx && hy)
+                dst[x] = (src[x] + src[x + 1] + src[x + src_stride] + src[x + src_stride + 1] +
+                          2 - rnd) >> 2;
+            else if (hx || hy)
+                dst[x] = (src[x] + src[x + (hy ? src_stride : 1)] + 1 - rnd) >> 1;
+            else
+                dst[x] = src[x];
+        }
+        dst += dst_stride;
+        src += src_stride;
+    }
+}
+
+#define HPEL_C(size, hx, hy)                                                    \
+static void                                                                     \
+put_hpel##size##_##hx##hy##_c(uint8_t *dst, ptrdiff_t dst_stride,               \
+                              const uint8_t *src, ptrdiff_t src_stride, int rnd) \
+{                                                                               \
+    put_hpel_c(dst, dst_stride, src, src_stride, size, hx, hy, rnd);            \
+}
+
+HPEL_C(16, 0, 0) HPEL_C(16, 1, 0) HPEL_C(16, 0, 1) HPEL_C(16, 1, 1)
+HPEL_C(8, 0, 0) HPEL_C(8, 1, 0) HPEL_C(8, 0, 1) HPEL_C(8, 1, 1)
+
+/* 8.3.6.5.3, bilinear quarter sample chroma over the interleaved plane */
+static void
+put_chroma_c(uint8_t *dst, ptrdiff_t dst_stride, const uint8_t *src, ptrdiff_t src_stride,
+             int mx, int my, int rnd)
+{
+    int a = (4 - mx) * (4 - my), b = mx * (4 - my), c = (4 - mx) * my, d = mx * my;
+    int x, y;
+
+    for (y = 0; y < 8; y++) {
+        for (x = 0; x < 16; x++)
+            dst[x] = (a * src[x] + b * src[x + 2] + c * src[x + src_stride] +
+                      d * src[x + src_stride + 2] + 8 - rnd) >> 4;
+        dst += dst_stride;
+        src += src_stride;
+    }
+}
+
+static void
+avg_c(uint8_t *dst, ptrdiff_t dst_stride, const uint8_t *src, ptrdiff_t src_stride,
+      int width, int height)
+{
+    int x, y;
+
+    for (y = 0; y < height; y++) {
+        for (x = 0; x < width; x++)
+            dst[x] = (dst[x] + src[x] + 1) >> 1;
+        dst += dst_stride;
+        src += src_stride;
+    }
+}
+
+const struct vc1_dsp_ops vc1_dsp_c = {
+    "c",
+    idct8x8_c,
+    idct8x8_add_c,
+    idct8x4_add_c,
+    idct4x8_add_c,
+    idct4x4_add_c,
+    idct8x8_add_uv_c,
+    idct8x4_add_uv_c,
+    idct4x8_add_uv_c,
+    idct4x4_add_uv_c,
+    overlap_h_c,
+    overlap_v_c,
+    { loop_filter_v_c, loop_filter_h_c },
+    { loop_filter_uv_v_c, loop_filter_uv_h_c },
+    {
+        MSPEL_TABLE(16, c),
+        MSPEL_TABLE(8, c),
+    },
+    {
+        { put_hpel16_00_c, put_hpel16_10_c, put_hpel16_01_c, put_hpel16_11_c },
+        { put_hpel8_00_c, put_hpel8_10_c, put_hpel8_01_c, put_hpel8_11_c },
+    },
+    put_chroma_c,
+    avg_c,
+};
+#if defined(__x86_64__) || defined(__i386__)
+static struct vc1_dsp_ops vc1_dsp_sse2;
+#endif
+static pthread_once_t vc1_dsp_once = PTHREAD_ONCE_INIT;
+
+static void
+vc1_dsp_init(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    vc1_dsp_sse2 = vc1_dsp_c;
+    vc1_dsp_sse2.name = "sse2";
+    vc1_dsp_init_sse2(&vc1_dsp_sse2);
+#endif
+}
+
+/* Best first */
+static const struct vc1_dsp_ops *const vc1_dsp_all[] = {
+#if defined(__x86_64__) || defined(__i386__)
+    &vc1_dsp_sse2,
+#endif
+    &vc1_dsp_c,
+};
+
+static int
+vc1_dsp_cpu_supports(const struct vc1_dsp_ops *ops)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (ops == &vc1_dsp_sse2)
+        return __builtin_cpu_supports("sse2");
+#endif
+    return 1;
+}
+
+const struct vc1_dsp_ops *
+vc1_dsp_get_ops(const char *name)
+{
+    unsigned int i;
+    const struct vc1_dsp_ops *best = NULL;
+
+    pthread_once(&vc1_dsp_once, vc1_dsp_init);
+    for (i = 0; i < sizeof(vc1_dsp_all) / sizeof(vc1_dsp_all[0]); i++) {
+        const struct vc1_dsp_ops *ops = vc1_dsp_all[i];
+
+        if (!vc1_dsp_cpu_supports(ops))
+            continue;
+        if (!best)
+            best = ops;
+        if (name && !strcmp(name, ops->name))
+            return ops;
+    }
+    return best;
+}
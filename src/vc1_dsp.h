@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2012 Scott Tincman <sctincman@gmail.com>. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef VC1_DSP_H
+#define VC1_DSP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Pixel kernels of the VC-1 decoder: the inverse transforms, overlap
+ * smoothing, the in-loop deblocking filter and motion compensation.
+ * Chroma kernels work on the interleaved NV12 plane directly. As with
+ * the dsp ones there is a C version and SIMD versions picked at runtime
+ * that match it exactly.
+ */
+
+/* Block widths for the motion compensation tables */
+#define VC1_MC_16       0
+#define VC1_MC_8        1
+
+typedef void (*vc1_mspel_func)(uint8_t *dst, ptrdiff_t dst_stride,
+                               const uint8_t *src, ptrdiff_t src_stride, int rnd);
+
+struct vc1_dsp_ops {
+    const char *name;
+    /*
+     * Inverse transform of a raster order 8x8 block of dequantized
+     * coefficients, left in place as signed samples. Intra blocks are
+     * smoothed and offset by 128 from there.
+     */
+    void (*idct8x8)(int16_t *block);
+    /*
+     * The inverse transforms of the 8x8, 8x4, 4x8 and 4x4 inter blocks,
+     * added to dst and clamped. The 8x4 and 4x8 ones do the two halves
+     * of an 8x8 block given by which (1 top or left, 2 the other one, 3
+     * both), the 4x4 one its quarters by which as a raster order mask
+     * from bit 3. The block is cleared for the next one.
+     */
+    void (*idct8x8_add)(uint8_t *dst, ptrdiff_t stride, int16_t *block);
+    void (*idct8x4_add)(uint8_t *dst, ptrdiff_t stride, int16_t *block, int which);
+    void (*idct4x8_add)(uint8_t *dst, ptrdiff_t stride, int16_t *block, int which);
+    void (*idct4x4_add)(uint8_t *dst, ptrdiff_t stride, int16_t *block, int which);
+    /* The same for one component of NV12 chroma, dst steps two bytes */
+    void (*idct8x8_add_uv)(uint8_t *dst, ptrdiff_t stride, int16_t *block);
+    void (*idct8x4_add_uv)(uint8_t *dst, ptrdiff_t stride, int16_t *block, int which);
+    void (*idct4x8_add_uv)(uint8_t *dst, ptrdiff_t stride, int16_t *block, int which);
+    void (*idct4x4_add_uv)(uint8_t *dst, ptrdiff_t stride, int16_t *block, int which);
+
+    /*
+     * Overlap smoothing of the signed intra samples of 8.5.1 across 8
+     * rows of a vertical edge left of src[0], and across 8 columns of a
+     * horizontal edge above src[0]. stride counts samples.
+     */
+    void (*overlap_h)(int16_t *src, ptrdiff_t stride);
+    void (*overlap_v)(int16_t *src, ptrdiff_t stride);
+
+    /*
+     * Deblocking of an edge of len samples (a multiple of 4) starting at
+     * the first q0 sample, indexed by direction: 0 filters a vertical
+     * edge, 1 a horizontal one. The chroma versions filter the NV12
+     * components set in components (1 Cb, 2 Cr) of len samples each.
+     */
+    void (*loop_filter[2])(uint8_t *pix, ptrdiff_t stride, int len, int pq);
+    void (*loop_filter_uv[2])(uint8_t *pix, ptrdiff_t stride, int len, int pq, int components);
+
+    /*
+     * Luma prediction at quarter sample offsets, indexed by [VC1_MC_*]
+     * [(frac_y << 2) | frac_x]. The bicubic filters need 1 sample of
+     * margin before the block and 2 after it in both directions, rnd is
+     * the picture's rounding control.
+     */
+    vc1_mspel_func put_mspel[2][16];
+    /*
+     * The bilinear half sample filters of the half sample bilinear mode,
+     * indexed by [VC1_MC_*][(half_y << 1) | half_x]. They need one
+     * sample of margin after the block.
+     */
+    vc1_mspel_func put_hpel[2][4];
+    /*
+     * Chroma prediction at quarter sample offsets mx, my for 8 samples
+     * of both NV12 components. src needs one sample of margin after the
+     * block.
+     */
+    void (*put_chroma)(uint8_t *dst, ptrdiff_t dst_stride, const uint8_t *src, ptrdiff_t src_stride,
+                       int mx, int my, int rnd);
+    /* Averages width x height bytes of src into dst rounding up */
+    void (*avg)(uint8_t *dst, ptrdiff_t dst_stride, const uint8_t *src, ptrdiff_t src_stride,
+                int width, int height);
+};
+
+extern const struct vc1_dsp_ops vc1_dsp_c;
+#if defined(__x86_64__) || defined(__i386__)
+/*
+ * Only the hot kernels have SIMD versions, so those tables start as a
+ * copy of the C one and this replaces what it has
+ */
+void
+vc1_dsp_init_sse2(struct vc1_dsp_ops *ops);
+#endif
+
+/*
+ * Returns the kernels called name ("c" or "sse2"), or the best ones this
+ * CPU supports if name is NULL or not supported
+ */
+const struct vc1_dsp_ops *
+vc1_dsp_get_ops(const char *name);
+
+#endif /* VC1_DSP_H */
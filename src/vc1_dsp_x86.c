@@ -0,0 +1,395 @@
+/*
+ * Copyright (c) 2012 Scott Tincman <sctincman@gmail.com>. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+/*
+ * SSE2 versions of the hot VC-1 kernels: overlap smoothing and the
+ * in-loop deblocking filters. The rest stay C.
+ */
+
+#include "config.h"
+#include <string.h>
+#include "vc1_dsp.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+#define SSE2    __attribute__((target("sse2")))
+
+static inline SSE2 __m128i
+load4(const uint8_t *p)
+{
+    int32_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return _mm_cvtsi32_si128(v);
+}
+
+static inline SSE2 void
+store4(uint8_t *p, __m128i v)
+{
+    int32_t x = _mm_cvtsi128_si32(v);
+
+    memcpy(p, &x, sizeof(x));
+}
+
+static inline SSE2 __m128i
+load8(const uint8_t *p)
+{
+    return _mm_loadl_epi64((const __m128i *) p);
+}
+
+static inline SSE2 __m128i
+load16(const uint8_t *p)
+{
+    return _mm_loadu_si128((const __m128i *) p);
+}
+
+/* Sign extends the low four 16-bit lanes */
+static inline SSE2 __m128i
+widen_lo(__m128i v)
+{
+    return _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+}
+
+static inline SSE2 __m128i
+widen_hi(__m128i v)
+{
+    return _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+}
+
+/* Packs 32-bit lanes to 16 bits dropping the high halves, as a store to int16_t does */
+static inline SSE2 __m128i
+narrow(__m128i lo, __m128i hi)
+{
+    lo = _mm_srai_epi32(_mm_slli_epi32(lo, 16), 16);
+    hi = _mm_srai_epi32(_mm_slli_epi32(hi, 16), 16);
+    return _mm_packs_epi32(lo, hi);
+}
+
+static inline SSE2 __m128i
+abs16(__m128i v)
+{
+    return _mm_max_epi16(v, _mm_sub_epi16(_mm_setzero_si128(), v));
+}
+
+/*
+ * Overlap smoothing of four vectors of 4 samples across the edge in
+ * 32 bits, r0 holds the rounding of the lines, r1 is 7 - r0
+ */
+static inline SSE2 void
+overlap4_sse2(__m128i *a, __m128i *b, __m128i *c, __m128i *d, __m128i r0, __m128i r1)
+{
+    __m128i d1 = _mm_sub_epi32(*a, *d);
+    __m128i d2 = _mm_add_epi32(d1, _mm_sub_epi32(*b, *c));
+
+    *a = _mm_srai_epi32(_mm_add_epi32(_mm_sub_epi32(_mm_slli_epi32(*a, 3), d1), r0), 3);
+    *b = _mm_srai_epi32(_mm_add_epi32(_mm_sub_epi32(_mm_slli_epi32(*b, 3), d2), r1), 3);
+    *c = _mm_srai_epi32(_mm_add_epi32(_mm_add_epi32(_mm_slli_epi32(*c, 3), d2), r0), 3);
+    *d = _mm_srai_epi32(_mm_add_epi32(_mm_add_epi32(_mm_slli_epi32(*d, 3), d1), r1), 3);
+}
+
+/* The 8 lines of an edge, one vector per position across it */
+static inline SSE2 void
+overlap8_sse2(__m128i *v)
+{
+    const __m128i r0 = _mm_setr_epi32(4, 3, 4, 3), r1 = _mm_setr_epi32(3, 4, 3, 4);
+    __m128i lo[4], hi[4];
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        lo[i] = widen_lo(v[i]);
+        hi[i] = widen_hi(v[i]);
+    }
+    overlap4_sse2(&lo[0], &lo[1], &lo[2], &lo[3], r0, r1);
+    overlap4_sse2(&hi[0], &hi[1], &hi[2], &hi[3], r0, r1);
+    for (i = 0; i < 4; i++)
+        v[i] = narrow(lo[i], hi[i]);
+}
+
+static SSE2 void
+overlap_v_sse2(int16_t *src, ptrdiff_t stride)
+{
+    __m128i v[4];
+    int i;
+
+    for (i = 0; i < 4; i++)
+        v[i] = _mm_loadu_si128((const __m128i *) (src + (i - 2) * stride));
+    overlap8_sse2(v);
+    for (i = 0; i < 4; i++)
+        _mm_storeu_si128((__m128i *) (src + (i - 2) * stride), v[i]);
+}
+
+static SSE2 void
+overlap_h_sse2(int16_t *src, ptrdiff_t stride)
+{
+    __m128i r[8], t[8], v[4];
+    int i;
+
+    /* Transposes the 8 rows of 4 samples to 4 vectors of 8 and back */
+    for (i = 0; i < 8; i++)
+        r[i] = _mm_loadl_epi64((const __m128i *) (src - 2 + i * stride));
+    for (i = 0; i < 4; i++)
+        t[i] = _mm_unpacklo_epi16(r[2 * i], r[2 * i + 1]);
+    t[4] = _mm_unpacklo_epi32(t[0], t[1]);
+    t[5] = _mm_unpackhi_epi32(t[0], t[1]);
+    t[6] = _mm_unpacklo_epi32(t[2], t[3]);
+    t[7] = _mm_unpackhi_epi32(t[2], t[3]);
+    v[0] = _mm_unpacklo_epi64(t[4], t[6]);
+    v[1] = _mm_unpackhi_epi64(t[4], t[6]);
+    v[2] = _mm_unpacklo_epi64(t[5], t[7]);
+    v[3] = _mm_unpackhi_epi64(t[5], t[7]);
+
+    overlap8_sse2(v);
+
+    t[0] = _mm_unpacklo_epi16(v[0], v[1]);
+    t[1] = _mm_unpacklo_epi16(v[2], v[3]);
+    t[2] = _mm_unpackhi_epi16(v[0], v[1]);
+    t[3] = _mm_unpackhi_epi16(v[2], v[3]);
+    r[0] = _mm_unpacklo_epi32(t[0], t[1]);
+    r[1] = _mm_unpackhi_epi32(t[0], t[1]);
+    r[2] = _mm_unpacklo_epi32(t[2], t[3]);
+    r[3] = _mm_unpackhi_epi32(t[2], t[3]);
+    for (i = 0; i < 4; i++) {
+        _mm_storel_epi64((__m128i *) (src - 2 + 2 * i * stride), r[i]);
+        _mm_storel_epi64((__m128i *) (src - 2 + (2 * i + 1) * stride), _mm_unpackhi_epi64(r[i], r[i]));
+    }
+}
+
+/*
+ * The deblocking filter of 8 lines at once, p[0..3] are p3 to p0 and
+ * q[0..3] q0 to q3 as 16-bit lanes. Only p0 and q0 change. The third
+ * line of each 4 decides for its group, as in the C version.
+ */
+static inline SSE2 void
+filter8_sse2(__m128i *p, __m128i *q, int pq)
+{
+    const __m128i four = _mm_set1_epi16(4), zero = _mm_setzero_si128();
+    __m128i a0, a0_sign, a1, a2, clip, clip_sign, d, d_sign, own, filter;
+
+    a0 = _mm_sub_epi16(_mm_slli_epi16(_mm_sub_epi16(p[2], q[1]), 1),
+                       _mm_mullo_epi16(_mm_sub_epi16(p[3], q[0]), _mm_set1_epi16(5)));
+    a0 = _mm_srai_epi16(_mm_add_epi16(a0, four), 3);
+    a0_sign = _mm_cmplt_epi16(a0, zero);
+    a0 = abs16(a0);
+    a1 = _mm_sub_epi16(_mm_slli_epi16(_mm_sub_epi16(p[0], p[3]), 1),
+                       _mm_mullo_epi16(_mm_sub_epi16(p[1], p[2]), _mm_set1_epi16(5)));
+    a1 = abs16(_mm_srai_epi16(_mm_add_epi16(a1, four), 3));
+    a2 = _mm_sub_epi16(_mm_slli_epi16(_mm_sub_epi16(q[0], q[3]), 1),
+                       _mm_mullo_epi16(_mm_sub_epi16(q[1], q[2]), _mm_set1_epi16(5)));
+    a2 = abs16(_mm_srai_epi16(_mm_add_epi16(a2, four), 3));
+    clip = _mm_sub_epi16(p[3], q[0]);
+    clip_sign = _mm_cmplt_epi16(clip, zero);
+    clip = _mm_srai_epi16(abs16(clip), 1);
+
+    own = _mm_cmplt_epi16(a0, _mm_set1_epi16(pq));
+    own = _mm_and_si128(own, _mm_or_si128(_mm_cmplt_epi16(a1, a0), _mm_cmplt_epi16(a2, a0)));
+    own = _mm_andnot_si128(_mm_cmpeq_epi16(clip, zero), own);
+    filter = _mm_shufflelo_epi16(own, _MM_SHUFFLE(2, 2, 2, 2));
+    filter = _mm_shufflehi_epi16(filter, _MM_SHUFFLE(2, 2, 2, 2));
+
+    d = _mm_mullo_epi16(_mm_sub_epi16(_mm_min_epi16(a1, a2), a0), _mm_set1_epi16(5));
+    d_sign = _mm_xor_si128(_mm_cmplt_epi16(d, zero), a0_sign);
+    d = _mm_min_epi16(_mm_srai_epi16(abs16(d), 3), clip);
+    d = _mm_sub_epi16(_mm_xor_si128(d, d_sign), d_sign);
+    /* Lines of a filtered group still check themselves, and only move p0 and q0 towards each other */
+    filter = _mm_and_si128(filter, own);
+    filter = _mm_andnot_si128(_mm_xor_si128(d_sign, clip_sign), filter);
+    d = _mm_and_si128(d, filter);
+    p[3] = _mm_sub_epi16(p[3], d);
+    q[0] = _mm_add_epi16(q[0], d);
+}
+
+/* Transposes 8 rows of 8 bytes into 8 vectors of 16-bit lanes */
+static inline SSE2 void
+transpose8x8_u8(const __m128i *r, __m128i *v)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i t[4], u[4];
+    int i;
+
+    for (i = 0; i < 4; i++)
+        t[i] = _mm_unpacklo_epi8(r[2 * i], r[2 * i + 1]);
+    u[0] = _mm_unpacklo_epi16(t[0], t[1]);
+    u[1] = _mm_unpackhi_epi16(t[0], t[1]);
+    u[2] = _mm_unpacklo_epi16(t[2], t[3]);
+    u[3] = _mm_unpackhi_epi16(t[2], t[3]);
+    for (i = 0; i < 2; i++) {
+        __m128i lo = _mm_unpacklo_epi32(u[i], u[i + 2]);
+        __m128i hi = _mm_unpackhi_epi32(u[i], u[i + 2]);
+
+        v[4 * i] = _mm_unpacklo_epi8(lo, zero);
+        v[4 * i + 1] = _mm_unpackhi_epi8(lo, zero);
+        v[4 * i + 2] = _mm_unpacklo_epi8(hi, zero);
+        v[4 * i + 3] = _mm_unpackhi_epi8(hi, zero);
+    }
+}
+
+/* Transposes 8 vectors of 8 16-bit lanes */
+static inline SSE2 void
+transpose8x8_16(__m128i *v)
+{
+    __m128i t[8], u[8];
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        t[2 * i] = _mm_unpacklo_epi16(v[2 * i], v[2 * i + 1]);
+        t[2 * i + 1] = _mm_unpackhi_epi16(v[2 * i], v[2 * i + 1]);
+    }
+    for (i = 0; i < 2; i++) {
+        u[4 * i] = _mm_unpacklo_epi32(t[4 * i], t[4 * i + 2]);
+        u[4 * i + 1] = _mm_unpackhi_epi32(t[4 * i], t[4 * i + 2]);
+        u[4 * i + 2] = _mm_unpacklo_epi32(t[4 * i + 1], t[4 * i + 3]);
+        u[4 * i + 3] = _mm_unpackhi_epi32(t[4 * i + 1], t[4 * i + 3]);
+    }
+    for (i = 0; i < 4; i++) {
+        v[2 * i] = _mm_unpacklo_epi64(u[i], u[i + 4]);
+        v[2 * i + 1] = _mm_unpackhi_epi64(u[i], u[i + 4]);
+    }
+}
+
+/* Filters across a horizontal edge, the lines are columns */
+static SSE2 void
+loop_filter_h_sse2(uint8_t *pix, ptrdiff_t stride, int len, int pq)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i v[8];
+    int i, x;
+
+    for (x = 0; x < len; x += 8) {
+        for (i = 0; i < 8; i++)
+            v[i] = _mm_unpacklo_epi8(len - x >= 8 ? load8(pix + x + (i - 4) * stride) :
+                                     load4(pix + x + (i - 4) * stride), zero);
+        filter8_sse2(v, v + 4, pq);
+        v[3] = _mm_packus_epi16(v[3], v[4]);
+        if (len - x >= 8) {
+            _mm_storel_epi64((__m128i *) (pix + x - stride), v[3]);
+            _mm_storel_epi64((__m128i *) (pix + x), _mm_unpackhi_epi64(v[3], v[3]));
+        } else {
+            store4(pix + x - stride, v[3]);
+            store4(pix + x, _mm_unpackhi_epi64(v[3], v[3]));
+        }
+    }
+}
+
+/* Filters across a vertical edge, the lines are rows */
+static SSE2 void
+loop_filter_v_sse2(uint8_t *pix, ptrdiff_t stride, int len, int pq)
+{
+    uint16_t pairs[8];
+    __m128i r[8], v[8];
+    int i, y;
+
+    for (y = 0; y < len; y += 8) {
+        int rows = len - y >= 8 ? 8 : 4;
+
+        for (i = 0; i < 8; i++)
+            r[i] = i < rows ? load8(pix + (y + i) * stride - 4) : _mm_setzero_si128();
+        transpose8x8_u8(r, v);
+        filter8_sse2(v, v + 4, pq);
+        v[3] = _mm_unpacklo_epi8(_mm_packus_epi16(v[3], v[3]), _mm_packus_epi16(v[4], v[4]));
+        _mm_storeu_si128((__m128i *) pairs, v[3]);
+        for (i = 0; i < rows; i++)
+            memcpy(pix + (y + i) * stride - 1, &pairs[i], sizeof(pairs[i]));
+    }
+}
+
+/* The same for both components of an NV12 chroma edge */
+static SSE2 void
+loop_filter_uv_h_sse2(uint8_t *pix, ptrdiff_t stride, int len, int pq, int components)
+{
+    const __m128i mask = _mm_set1_epi16(0xff);
+    __m128i u[8], v[8];
+    int i, x;
+
+    for (x = 0; x < len; x += 8) {
+        for (i = 0; i < 8; i++) {
+            __m128i row = len - x >= 8 ? load16(pix + 2 * x + (i - 4) * stride) :
+                                         load8(pix + 2 * x + (i - 4) * stride);
+
+            u[i] = _mm_and_si128(row, mask);
+            v[i] = _mm_srli_epi16(row, 8);
+        }
+        if (components & 1)
+            filter8_sse2(u, u + 4, pq);
+        if (components & 2)
+            filter8_sse2(v, v + 4, pq);
+        u[3] = _mm_or_si128(u[3], _mm_slli_epi16(v[3], 8));
+        u[4] = _mm_or_si128(u[4], _mm_slli_epi16(v[4], 8));
+        if (len - x >= 8) {
+            _mm_storeu_si128((__m128i *) (pix + 2 * x - stride), u[3]);
+            _mm_storeu_si128((__m128i *) (pix + 2 * x), u[4]);
+        } else {
+            _mm_storel_epi64((__m128i *) (pix + 2 * x - stride), u[3]);
+            _mm_storel_epi64((__m128i *) (pix + 2 * x), u[4]);
+        }
+    }
+}
+
+static SSE2 void
+loop_filter_uv_v_sse2(uint8_t *pix, ptrdiff_t stride, int len, int pq, int components)
+{
+    const __m128i mask = _mm_set1_epi16(0xff);
+    uint32_t quads[8];
+    __m128i u[8], v[8];
+    int i, y;
+
+    for (y = 0; y < len; y += 8) {
+        int rows = len - y >= 8 ? 8 : 4;
+
+        for (i = 0; i < 8; i++) {
+            __m128i row = i < rows ? load16(pix + (y + i) * stride - 8) : _mm_setzero_si128();
+
+            u[i] = _mm_and_si128(row, mask);
+            v[i] = _mm_srli_epi16(row, 8);
+        }
+        transpose8x8_16(u);
+        transpose8x8_16(v);
+        if (components & 1)
+            filter8_sse2(u, u + 4, pq);
+        if (components & 2)
+            filter8_sse2(v, v + 4, pq);
+        /* p0 and q0 of both components, interleaved back for each row */
+        u[3] = _mm_packus_epi16(_mm_unpacklo_epi16(u[3], v[3]), _mm_unpackhi_epi16(u[3], v[3]));
+        u[4] = _mm_packus_epi16(_mm_unpacklo_epi16(u[4], v[4]), _mm_unpackhi_epi16(u[4], v[4]));
+        _mm_storeu_si128((__m128i *) quads, _mm_unpacklo_epi16(u[3], u[4]));
+        _mm_storeu_si128((__m128i *) (quads + 4), _mm_unpackhi_epi16(u[3], u[4]));
+        for (i = 0; i < rows; i++)
+            memcpy(pix + (y + i) * stride - 2, &quads[i], sizeof(quads[i]));
+    }
+}
+
+void
+vc1_dsp_init_sse2(struct vc1_dsp_ops *ops)
+{
+    ops->overlap_h = overlap_h_sse2;
+    ops->overlap_v = overlap_v_sse2;
+    ops->loop_filter[0] = loop_filter_v_sse2;
+    ops->loop_filter[1] = loop_filter_h_sse2;
+    ops->loop_filter_uv[0] = loop_filter_uv_v_sse2;
+    ops->loop_filter_uv[1] = loop_filter_uv_h_sse2;
+}
+
+#endif /* __x86_64__ || __i386__ */
@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2012 Scott Tincman <sctincman@gmail.com>. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "config.h"
+#include <string.h>
+#include "vlc.h"
+
+/* Sets count entries starting at index, failing on overlap with another code */
+static int
+vlc_fill(struct vlc_entry *table, int index, int count, int symbol, int length)
+{
+    int i;
+
+    for (i = index; i < index + count; i++) {
+        if (table[i].length != 0)
+            return -1;
+        table[i].symbol = symbol;
+        table[i].length = length;
+    }
+    return 0;
+}
+
+int
+vlc_init(struct vlc *vlc, int bits, const struct vlc_code *codes, int num_codes,
+         struct vlc_entry *table, int max_entries)
+{
+    int size = 1 << bits;
+    int prefix, i;
+
+    if (size > max_entries)
+        return -1;
+    memset(table, 0, max_entries * sizeof(*table));
+
+    /* Codes that fit the first level */
+    for (i = 0; i < num_codes; i++) {
+        int length = codes[i].length;
+
+        if (length > bits)
+            continue;
+        if (vlc_fill(table, codes[i].code << (bits - length), 1 << (bits - length),
+                     codes[i].symbol, length))
+            return -1;
+    }
+
+    /* One second level table for each prefix of the longer codes */
+    for (prefix = 0; prefix < (1 << bits); prefix++) {
+        int sub_bits = 0;
+
+        for (i = 0; i < num_codes; i++) {
+            int length = codes[i].length;
+
+            if (length > bits && (int)(codes[i].code >> (length - bits)) == prefix &&
+                length - bits > sub_bits)
+                sub_bits = length - bits;
+        }
+        if (sub_bits == 0)
+            continue;
+        if (table[prefix].length != 0 || size + (1 << sub_bits) > max_entries || size > INT16_MAX)
+            return -1;
+        table[prefix].symbol = size;
+        table[prefix].length = -sub_bits;
+
+        for (i = 0; i < num_codes; i++) {
+            int length = codes[i].length;
+            int rest = length - bits;
+
+            if (rest <= 0 || (int)(codes[i].code >> rest) != prefix)
+                continue;
+            if (vlc_fill(table, size + ((codes[i].code & ((1 << rest) - 1)) << (sub_bits - rest)),
+                         1 << (sub_bits - rest), codes[i].symbol, rest))
+                return -1;
+        }
+        size += 1 << sub_bits;
+    }
+
+    vlc->table = table;
+    vlc->bits = bits;
+    return 0;
+}
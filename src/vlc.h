@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2012 Scott Tincman <sctincman@gmail.com>. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef VLC_H
+#define VLC_H
+
+#include <stdint.h>
+#include "bitstream.h"
+
+/*
+ * Two level lookup tables for prefix codes. The first level is indexed by
+ * the next `bits` bits of the stream. Codes longer than that share an entry
+ * pointing at a second level table indexed by the bits that follow.
+ */
+
+#define VLC_INVALID     (-32768)
+
+struct vlc_code {
+    uint32_t code;          /* Right aligned */
+    uint8_t length;
+    int16_t symbol;
+};
+
+struct vlc_entry {
+    int16_t symbol;         /* Decoded value, or second level table offset */
+    int8_t length;          /* Code length, 0 if invalid, -bits for a second level */
+};
+
+struct vlc {
+    const struct vlc_entry *table;
+    int bits;
+};
+
+/*
+ * Builds the lookup table for codes into table, which has room for
+ * max_entries entries. The codes must be prefix free.
+ * Return 0 on success, -1 if the codes do not fit or clash
+ */
+int
+vlc_init(struct vlc *vlc, int bits, const struct vlc_code *codes, int num_codes,
+         struct vlc_entry *table, int max_entries);
+
+/*
+ * Reads one code, returns its symbol or VLC_INVALID
+ */
+static inline int
+vlc_get(struct bitstream *bs, const struct vlc *vlc)
+{
+    const struct vlc_entry *entry = &vlc->table[bitstream_show_bits(bs, vlc->bits)];
+
+    if (entry->length < 0) {
+        int sub_bits = -entry->length;
+
+        bitstream_skip_bits(bs, vlc->bits);
+        entry = &vlc->table[entry->symbol + bitstream_show_bits(bs, sub_bits)];
+    }
+    if (entry->length == 0)
+        return VLC_INVALID;
+    bitstream_skip_bits(bs, entry->length);
+    return entry->symbol;
+}
+
+#endif /* VLC_H */
@@ -0,0 +1,223 @@
+/*
+ * Copyright (c) 2012 Scott Tincman <sctincman@gmail.com>. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <assert.h>
+#include "wavefront.h"
+
+#define ASSERT  assert
+
+/*
+ * Macroblocks a waiting row must be able to process before it is queued
+ * again. Queueing it for every one would cost a wakeup per macroblock,
+ * more than processing one takes.
+ */
+#define WAVEFRONT_MIN_RUN   8
+
+/*
+ * Whether macroblock (x, y) can be processed. The loads pair with the
+ * stores of wavefront_row_task() and wavefront_queue_row(): a row going
+ * idle either sees what it waits for or gets queued again.
+ */
+static int
+wavefront_ready(wavefront_p wavefront, int x, int y)
+{
+    int above;
+
+    if (x >= wavefront->width) {
+        return 0;
+    }
+    if (y * wavefront->width + x >= __atomic_load_n(&wavefront->available, __ATOMIC_SEQ_CST)) {
+        return 0;
+    }
+    if (y > 0) {
+        above = x + wavefront->lag < wavefront->width ? x + wavefront->lag : wavefront->width;
+        if (__atomic_load_n(&wavefront->rows[y - 1].done, __ATOMIC_SEQ_CST) < above) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Claims an idle row for queueing or running, returns 0 if it was not idle */
+static int
+wavefront_claim(struct wavefront_row *row)
+{
+    int idle = 0;
+
+    return __atomic_compare_exchange_n(&row->queued, &idle, 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+/*
+ * Queues the task of row y if it is idle and can go on for a while. A row
+ * going idle rechecks whether it can go on at all, so what it waits for
+ * is never missed.
+ */
+static void
+wavefront_queue_row(wavefront_p wavefront, int y)
+{
+    struct wavefront_row *row = &wavefront->rows[y];
+    int x;
+
+    if (__atomic_load_n(&row->queued, __ATOMIC_SEQ_CST)) {
+        return;
+    }
+    /* done only changes while the row is queued */
+    x = __atomic_load_n(&row->done, __ATOMIC_SEQ_CST) + WAVEFRONT_MIN_RUN - 1;
+    if (x >= wavefront->width) {
+        x = wavefront->width - 1;
+    }
+    if (wavefront_ready(wavefront, x, y) && wavefront_claim(row)) {
+        __atomic_add_fetch(&wavefront->pending, 1, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&wavefront->dispatches, 1, __ATOMIC_RELAXED);
+        thread_pool_submit(wavefront->pool, &row->task);
+    }
+}
+
+/*
+ * Processes a row until it is finished or has to wait. The wavefront may
+ * be started again once the task is done with it, so that is the last
+ * thing the task does.
+ */
+static void
+wavefront_row_task(struct thread_pool_task *task)
+{
+    struct wavefront_row *row = (struct wavefront_row *) task;
+    wavefront_p wavefront = row->wavefront;
+    int x = __atomic_load_n(&row->done, __ATOMIC_RELAXED);
+
+    for (;;) {
+        if (x == wavefront->width) {
+            /* Finished rows stay claimed */
+            break;
+        }
+        if (!wavefront_ready(wavefront, x, row->y)) {
+            __atomic_store_n(&row->queued, 0, __ATOMIC_SEQ_CST);
+            if (!wavefront_ready(wavefront, x, row->y) || !wavefront_claim(row)) {
+                break;
+            }
+            continue;
+        }
+        wavefront->run(wavefront->data, x, row->y);
+        __atomic_store_n(&row->done, ++x, __ATOMIC_SEQ_CST);
+        if (row->y + 1 < wavefront->height) {
+            wavefront_queue_row(wavefront, row->y + 1);
+        }
+    }
+    thread_pool_done(wavefront->pool, &wavefront->pending);
+}
+
+/*
+ * Empties a wavefront for wavefront_start()
+ */
+void
+wavefront_init(wavefront_p wavefront)
+{
+    wavefront->rows = NULL;
+    wavefront->max_rows = 0;
+    wavefront->width = 0;
+    wavefront->height = 0;
+    wavefront->pending = 0;
+    wavefront->dispatches = 0;
+}
+
+/*
+ * Return 0 on success, -1 on error
+ */
+int
+wavefront_start(wavefront_p wavefront, thread_pool_p pool, int width, int height, int lag,
+                int available, wavefront_func run, void *data)
+{
+    int y;
+
+    ASSERT(0 == wavefront->pending);
+    ASSERT(width > 0);
+    if (height > wavefront->max_rows) {
+        struct wavefront_row *rows = realloc(wavefront->rows, height * sizeof(*rows));
+
+        if (NULL == rows) {
+            return -1;
+        }
+        wavefront->rows = rows;
+        wavefront->max_rows = height;
+    }
+    wavefront->pool = pool;
+    wavefront->run = run;
+    wavefront->data = data;
+    wavefront->width = width;
+    wavefront->height = height;
+    wavefront->lag = lag;
+    wavefront->available = 0;
+    for (y = 0; y < height; y++) {
+        wavefront->rows[y].task.run = wavefront_row_task;
+        wavefront->rows[y].wavefront = wavefront;
+        wavefront->rows[y].y = y;
+        wavefront->rows[y].done = 0;
+        wavefront->rows[y].queued = 0;
+    }
+    wavefront_set_available(wavefront, available);
+    return 0;
+}
+
+/*
+ * Producer side: makes the first available macroblocks in raster order
+ * available, queueing the rows that were waiting for them
+ */
+void
+wavefront_set_available(wavefront_p wavefront, int available)
+{
+    int first = wavefront->available, y;
+
+    if (available > wavefront->width * wavefront->height) {
+        available = wavefront->width * wavefront->height;
+    }
+    if (available <= first) {
+        return;
+    }
+    __atomic_store_n(&wavefront->available, available, __ATOMIC_SEQ_CST);
+    for (y = first / wavefront->width; y <= (available - 1) / wavefront->width; y++) {
+        wavefront_queue_row(wavefront, y);
+    }
+}
+
+/*
+ * Runs tasks of the pool until every macroblock has been processed
+ */
+void
+wavefront_wait(wavefront_p wavefront)
+{
+    thread_pool_wait(wavefront->pool, &wavefront->pending);
+}
+
+/*
+ * Frees the rows, the wavefront must not be running
+ */
+void
+wavefront_destroy(wavefront_p wavefront)
+{
+    ASSERT(0 == wavefront->pending);
+    free(wavefront->rows);
+    wavefront->rows = NULL;
+    wavefront->max_rows = 0;
+}
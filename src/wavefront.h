@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2012 Scott Tincman <sctincman@gmail.com>. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+#include "thread_pool.h"
+
+/*
+ * Processes a grid of macroblocks on a thread pool in wavefront order:
+ * macroblock (x, y) waits for macroblock (x + lag - 1, y - 1) above it,
+ * the one above and to the right for a lag of 2, and for its input, the
+ * macroblocks up to it in raster order having been made available. Each
+ * row is a task that works its way along the row and gives up its thread
+ * when it catches up with what it waits for; finishing a macroblock
+ * queues the row below again if it was waiting for it.
+ *
+ * Macroblocks are made available by one producer thread, typically the one
+ * parsing them, which makes all of them available before wavefront_wait().
+ * With nothing left to wait for, no row task left means no row left.
+ */
+
+typedef struct wavefront *wavefront_p;
+
+/* Processes macroblock (x, y) */
+typedef void (*wavefront_func)(void *data, int x, int y);
+
+struct wavefront_row {
+    struct thread_pool_task task;
+    struct wavefront *wavefront;
+    int y;
+    /* Updated atomically */
+    int done;                   /* Macroblocks of the row processed */
+    int queued;                 /* The row's task is queued or running */
+};
+
+struct wavefront {
+    thread_pool_p pool;
+    wavefront_func run;
+    void *data;
+    int width;
+    int height;
+    int lag;
+    struct wavefront_row *rows;
+    int max_rows;
+    /* Updated atomically */
+    int available;              /* Macroblocks in raster order that may be processed */
+    unsigned int pending;       /* Row tasks queued or running */
+    unsigned long dispatches;   /* Times a row task was queued */
+};
+
+/*
+ * Empties a wavefront for wavefront_start()
+ */
+void
+wavefront_init(wavefront_p wavefront);
+
+/*
+ * Starts processing a width x height grid with run, the first available
+ * macroblocks in raster order being available already
+ * Return 0 on success, -1 on error
+ */
+int
+wavefront_start(wavefront_p wavefront, thread_pool_p pool, int width, int height, int lag,
+                int available, wavefront_func run, void *data);
+
+/*
+ * Producer side: makes the first available macroblocks in raster order
+ * available, queueing the rows that were waiting for them
+ */
+void
+wavefront_set_available(wavefront_p wavefront, int available);
+
+/*
+ * Runs tasks of the pool until every macroblock has been processed
+ */
+void
+wavefront_wait(wavefront_p wavefront);
+
+/*
+ * Frees the rows, the wavefront must not be running
+ */
+void
+wavefront_destroy(wavefront_p wavefront);
+
+#endif /* WAVEFRONT_H */
@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2012 Scott Tincman <sctincman@gmail.com>. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * MSB-first bit reader for the stream parsers. Reads past the end return
+ * zeros, callers check bit_reader_overrun() where it matters.
+ */
+
+#ifndef BIT_READER_H
+#define BIT_READER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct bit_reader {
+    const uint8_t *data;
+    size_t size;
+    size_t pos;     /* In bits */
+};
+
+static inline void
+bit_reader_init(struct bit_reader *br, const uint8_t *data, size_t size, size_t pos)
+{
+    br->data = data;
+    br->size = size;
+    br->pos = pos;
+}
+
+static inline unsigned int
+bit_reader_bit(struct bit_reader *br)
+{
+    unsigned int bit = 0;
+
+    if (br->pos < br->size * 8) {
+        bit = (br->data[br->pos >> 3] >> (7 - (br->pos & 7))) & 1;
+    }
+    br->pos++;
+    return bit;
+}
+
+static inline unsigned int
+bit_reader_bits(struct bit_reader *br, int n)
+{
+    unsigned int value = 0;
+
+    while (n--) {
+        value = (value << 1) | bit_reader_bit(br);
+    }
+    return value;
+}
+
+static inline void
+bit_reader_skip(struct bit_reader *br, int n)
+{
+    br->pos += n;
+}
+
+/* Exp-Golomb codes */
+static inline unsigned int
+bit_reader_ue(struct bit_reader *br)
+{
+    int zeros = 0;
+
+    while (!bit_reader_bit(br)) {
+        if (++zeros > 31) {
+            return 0;
+        }
+    }
+    return ((1u << zeros) - 1) + bit_reader_bits(br, zeros);
+}
+
+static inline int
+bit_reader_se(struct bit_reader *br)
+{
+    unsigned int value = bit_reader_ue(br);
+
+    return (value & 1) ? (int)((value + 1) / 2) : -(int)(value / 2);
+}
+
+static inline int
+bit_reader_overrun(struct bit_reader *br)
+{
+    return br->pos > br->size * 8;
+}
+
+#endif /* BIT_READER_H */
@@ -0,0 +1,249 @@
+/*
+ * Copyright (c) 2012 Scott Tincman <sctincman@gmail.com>. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * H.264 conformance and throughput test.
+ *
+ * Decodes each stream through the driver and compares every output frame,
+ * in display order and cropped, with the lines of the stream's .md5 file,
+ * or with the frames of its reference .yuv file when there is no .md5.
+ * Without arguments it runs every *.264 stream under $srcdir/streams and
+ * $srcdir/streams/jvt, the latter filled in by streams/fetch-jvt.sh.
+ *
+ * usage: h264_conformance [stream.264 ...]
+ */
+
+#include <glob.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "va_client.h"
+#include "h264_stream.h"
+#include "md5.h"
+
+#define CONFORMANCE_MAX_FRAMES  4096
+#define CONFORMANCE_SKIP        77      /* Exit status automake reports as SKIP */
+
+struct conformance {
+    char (*expected)[33];
+    int num_expected;
+    const uint8_t *reference;   /* I420 frames, instead of expected */
+    size_t reference_size;
+    size_t reference_pos;
+    int num_frames;
+    int num_mismatches;
+    int first_mismatch;
+    uint8_t *i420;
+};
+
+static const char *
+conformance_basename(const char *path)
+{
+    const char *slash = strrchr(path, '/');
+
+    return slash ? slash + 1 : path;
+}
+
+/*
+ * Reads one MD5 per line from path
+ * Returns the number of lines, -1 on error
+ */
+static int
+conformance_load_md5(const char *path, char (*md5s)[33], int max_md5s)
+{
+    char line[128];
+    FILE *f;
+    int n = 0;
+
+    f = fopen(path, "r");
+    if (NULL == f) {
+        return -1;
+    }
+    while ((n < max_md5s) && fgets(line, sizeof(line), f)) {
+        if (strlen(line) >= 32) {
+            memcpy(md5s[n], line, 32);
+            md5s[n][32] = '\0';
+            n++;
+        }
+    }
+    fclose(f);
+    return n;
+}
+
+static void
+conformance_output(struct va_decoder *decoder, VASurfaceID surface, void *data)
+{
+    struct conformance *conformance = data;
+    size_t size = (size_t) decoder->crop_width * decoder->crop_height +
+                  2 * (size_t) ((decoder->crop_width + 1) / 2) * ((decoder->crop_height + 1) / 2);
+    struct md5 md5;
+    char hex[33];
+    uint8_t *i420;
+    int matched, n = conformance->num_frames++;
+
+    i420 = realloc(conformance->i420, size);
+    if (NULL == i420) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    conformance->i420 = i420;
+    va_decoder_read_i420(decoder, surface, i420);
+
+    if (conformance->reference) {
+        matched = 0;
+        if (conformance->reference_pos + size <= conformance->reference_size) {
+            matched = !memcmp(i420, conformance->reference + conformance->reference_pos, size);
+            conformance->num_expected++;
+        }
+        conformance->reference_pos += size;
+        if (matched) {
+            return;
+        }
+    } else {
+        md5_init(&md5);
+        md5_update(&md5, i420, size);
+        md5_final(&md5, hex);
+        if ((n < conformance->num_expected) && !strcmp(hex, conformance->expected[n])) {
+            return;
+        }
+    }
+    if (!conformance->num_mismatches++) {
+        conformance->first_mismatch = n;
+    }
+}
+
+/*
+ * Return 0 if the stream decodes to its checksums, 1 otherwise
+ */
+static int
+conformance_run(const char *path, char (*expected)[33])
+{
+    struct conformance conformance;
+    struct va_client client;
+    struct va_decoder decoder;
+    char md5_path[4096];
+    uint8_t *data, *reference = NULL;
+    size_t size;
+    double start, seconds;
+    int ret;
+
+    memset(&conformance, 0, sizeof(conformance));
+    conformance.expected = expected;
+    snprintf(md5_path, sizeof(md5_path), "%s.md5", path);
+    conformance.num_expected = conformance_load_md5(md5_path, expected, CONFORMANCE_MAX_FRAMES);
+    if (conformance.num_expected < 0) {
+        /* Frames are counted as they are matched */
+        snprintf(md5_path, sizeof(md5_path), "%.*s.yuv", (int) (strlen(path) - 4), path);
+        reference = va_client_load(md5_path, &conformance.reference_size);
+        if (NULL == reference) {
+            printf("FAIL %s: no .md5 or .yuv reference\n", conformance_basename(path));
+            return 1;
+        }
+        conformance.reference = reference;
+        conformance.num_expected = 0;
+    }
+    data = va_client_load(path, &size);
+    if (NULL == data) {
+        printf("FAIL %s: cannot read the stream\n", conformance_basename(path));
+        return 1;
+    }
+    if (va_client_open(&client)) {
+        fprintf(stderr, "cannot initialize the driver\n");
+        exit(1);
+    }
+    va_decoder_init(&decoder, &client);
+    decoder.output = conformance_output;
+    decoder.output_data = &conformance;
+
+    start = va_client_now();
+    ret = h264_stream_decode(&decoder, data, size);
+    seconds = va_client_now() - start;
+
+    va_decoder_stop(&decoder);
+    va_client_close(&client);
+    free(conformance.i420);
+    free(reference);
+    free(data);
+
+    if (ret) {
+        printf("FAIL %s: decoding failed after %d frames\n", conformance_basename(path), conformance.num_frames);
+        return 1;
+    }
+    if (conformance.reference && (conformance.reference_pos < conformance.reference_size)) {
+        printf("FAIL %s: the reference has frames past the %d decoded\n", conformance_basename(path),
+               conformance.num_frames);
+        return 1;
+    }
+    if (conformance.num_mismatches || (conformance.num_frames != conformance.num_expected)) {
+        printf("FAIL %s: %d of %d frames differ, first at frame %d, %d frames expected\n",
+               conformance_basename(path), conformance.num_mismatches, conformance.num_frames,
+               conformance.first_mismatch, conformance.num_expected);
+        return 1;
+    }
+    printf("PASS %s: %d frames, %.1f fps\n", conformance_basename(path), conformance.num_frames,
+           conformance.num_frames / seconds);
+    return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+    static const char *patterns[] = { "streams/*.264", "streams/jvt/*.264" };
+    char (*expected)[33];
+    const char *srcdir = getenv("srcdir");
+    char pattern[4096];
+    glob_t streams;
+    size_t i, p;
+    int failures = 0;
+
+    expected = malloc(CONFORMANCE_MAX_FRAMES * sizeof(*expected));
+    if (NULL == expected) {
+        return 1;
+    }
+    if (argc > 1) {
+        for (i = 1; i < (size_t) argc; i++) {
+            failures += conformance_run(argv[i], expected);
+        }
+        free(expected);
+        return failures != 0;
+    }
+
+    memset(&streams, 0, sizeof(streams));
+    for (p = 0; p < sizeof(patterns) / sizeof(patterns[0]); p++) {
+        snprintf(pattern, sizeof(pattern), "%s/%s", srcdir ? srcdir : ".", patterns[p]);
+        glob(pattern, p ? GLOB_APPEND : 0, NULL, &streams);
+    }
+    if (0 == streams.gl_pathc) {
+        printf("no H.264 streams found\n");
+        free(expected);
+        return CONFORMANCE_SKIP;
+    }
+    for (i = 0; i < streams.gl_pathc; i++) {
+        failures += conformance_run(streams.gl_pathv[i], expected);
+    }
+    printf("%d of %d streams failed\n", failures, (int) streams.gl_pathc);
+    globfree(&streams);
+    free(expected);
+    return failures != 0;
+}
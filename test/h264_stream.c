@@ -0,0 +1,1450 @@
+/*
+ * Copyright (c) 2012 Scott Tincman <sctincman@gmail.com>. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bit_reader.h"
+#include "h264_stream.h"
+
+#define H264_NAL_SLICE          1
+#define H264_NAL_IDR_SLICE      5
+#define H264_NAL_SEI            6
+#define H264_NAL_SPS            7
+#define H264_NAL_PPS            8
+#define H264_NAL_END_OF_STREAM  11
+
+#define H264_SLICE_P            0
+#define H264_SLICE_B            1
+#define H264_SLICE_I            2
+
+#define H264_MAX_SPS            32
+#define H264_MAX_PPS            256
+#define H264_MAX_DPB            16
+#define H264_MAX_REF_IDX        32
+#define H264_MAX_MMCO           66
+
+/* Reference marking of a frame */
+#define H264_UNUSED             0
+#define H264_SHORT_TERM         1
+#define H264_LONG_TERM          2
+
+/* Scaling list state in a parameter set */
+#define H264_LIST_ABSENT        0
+#define H264_LIST_CODED         1
+#define H264_LIST_DEFAULT       2
+
+/* Default scaling lists, in zigzag order like the bitstream */
+static const uint8_t h264_default_4x4[2][16] = {
+    { 6, 13, 13, 20, 20, 20, 28, 28, 28, 28, 32, 32, 32, 37, 37, 42 },
+    { 10, 14, 14, 20, 20, 20, 24, 24, 24, 24, 27, 27, 27, 30, 30, 34 }
+};
+
+static const uint8_t h264_default_8x8[2][64] = {
+    {  6, 10, 10, 13, 11, 13, 16, 16, 16, 16, 18, 18, 18, 18, 18, 23,
+      23, 23, 23, 23, 23, 25, 25, 25, 25, 25, 25, 25, 27, 27, 27, 27,
+      27, 27, 27, 27, 29, 29, 29, 29, 29, 29, 29, 31, 31, 31, 31, 31,
+      31, 33, 33, 33, 33, 33, 36, 36, 36, 36, 38, 38, 38, 40, 40, 42 },
+    {  9, 13, 13, 15, 13, 15, 17, 17, 17, 17, 19, 19, 19, 19, 19, 21,
+      21, 21, 21, 21, 21, 22, 22, 22, 22, 22, 22, 22, 24, 24, 24, 24,
+      24, 24, 24, 24, 25, 25, 25, 25, 25, 25, 25, 27, 27, 27, 27, 27,
+      27, 28, 28, 28, 28, 28, 30, 30, 30, 30, 32, 32, 32, 33, 33, 35 }
+};
+
+/* MaxDpbMbs of Table A-1, by level_idc */
+static const struct {
+    int level_idc;
+    int max_dpb_mbs;
+} h264_levels[] = {
+    {  9,    396 }, { 10,    396 }, { 11,    900 }, { 12,   2376 }, { 13,   2376 },
+    { 20,   2376 }, { 21,   4752 }, { 22,   8100 }, { 30,   8100 }, { 31,  18000 },
+    { 32,  20480 }, { 40,  32768 }, { 41,  32768 }, { 42,  34816 }, { 50, 110400 },
+    { 51, 184320 }, { 52, 184320 },
+};
+
+struct h264_scaling {
+    int state[12];                  /* H264_LIST_*, 4x4 lists then 8x8 lists */
+    uint8_t lists_4x4[6][16];
+    uint8_t lists_8x8[6][64];       /* Only the first two are used for 4:2:0 */
+};
+
+struct h264_sps {
+    int valid;
+    int profile_idc;
+    int level_idc;
+    int chroma_format_idc;
+    int bit_depth_luma;
+    int bit_depth_chroma;
+    int scaling_matrix_present;
+    struct h264_scaling scaling;
+    int log2_max_frame_num;
+    int poc_type;
+    int log2_max_poc_lsb;
+    int delta_pic_order_always_zero;
+    int offset_for_non_ref_pic;
+    int offset_for_top_to_bottom_field;
+    int num_ref_frames_in_poc_cycle;
+    int offset_for_ref_frame[256];
+    int max_num_ref_frames;
+    int gaps_in_frame_num_allowed;
+    int width_mbs;
+    int height_mbs;
+    int frame_mbs_only;
+    int mbaff;
+    int direct_8x8_inference;
+    int crop_left;                  /* In luma samples */
+    int crop_right;
+    int crop_top;
+    int crop_bottom;
+};
+
+struct h264_pps {
+    int valid;
+    int sps_id;
+    int entropy_coding_mode;
+    int bottom_field_pic_order_in_frame_present;
+    int num_slice_groups;
+    int num_ref_idx_default[2];
+    int weighted_pred;
+    int weighted_bipred_idc;
+    int pic_init_qp;
+    int pic_init_qs;
+    int chroma_qp_index_offset;
+    int deblocking_filter_control_present;
+    int constrained_intra_pred;
+    int redundant_pic_cnt_present;
+    int transform_8x8_mode;
+    int scaling_matrix_present;
+    struct h264_scaling scaling;
+    int second_chroma_qp_index_offset;
+};
+
+struct h264_slice_header {
+    int nal_unit_type;
+    int nal_ref_idc;
+    int first_mb;
+    int slice_type;
+    int pps_id;
+    int frame_num;
+    int idr_pic_id;
+    int poc_lsb;
+    int delta_poc_bottom;
+    int delta_poc[2];
+    int redundant_pic_cnt;
+    int num_ref_idx[2];
+    int num_modifications[2];
+    int modifications[2][H264_MAX_REF_IDX + 1][2];     /* modification_of_pic_nums_idc and its value */
+    int no_output_of_prior_pics;
+    int long_term_reference;
+    int adaptive_marking;
+    int num_mmco;
+    int mmco[H264_MAX_MMCO][3];     /* Operation and its two arguments */
+    int has_mmco5;
+};
+
+/* A frame of the DPB, decoded into the surface of the same index */
+struct h264_frame {
+    int reference;                  /* H264_UNUSED, H264_SHORT_TERM or H264_LONG_TERM */
+    int needed_for_output;
+    int frame_num;
+    int frame_num_wrap;
+    int long_term_frame_idx;
+    int top_poc;
+    int bottom_poc;
+    int poc;
+};
+
+struct h264_stream {
+    struct va_decoder *decoder;
+    struct h264_sps sps[H264_MAX_SPS];
+    struct h264_pps pps[H264_MAX_PPS];
+    struct h264_sps active_sps;     /* Copy of the SPS the decoder was started for */
+    const struct h264_pps *active_pps;
+    uint8_t *rbsp;
+    struct h264_frame frames[H264_MAX_DPB + 1];
+    int num_frames;                 /* DPB size, plus one for the current picture */
+    int dpb_size;
+    int max_frame_num;
+    int in_picture;
+    struct h264_slice_header first_slice;   /* Of the picture being collected */
+    int current;                    /* Frame being decoded */
+    VAPictureParameterBufferH264 picture;
+    VAIQMatrixBufferH264 iq_matrix;
+    VASliceParameterBufferH264 slice;
+    /* Picture order count state, 8.2.1 */
+    int prev_poc_msb;
+    int prev_poc_lsb;
+    int prev_frame_num_offset;
+    int prev_frame_num;
+    int prev_ref_frame_num;
+};
+
+/*
+ * Returns the offset of the next start code prefix at or after pos, or size
+ */
+static size_t
+h264_next_start_code(const uint8_t *data, size_t size, size_t pos)
+{
+    while ((pos + 3 < size) && !((0 == data[pos]) && (0 == data[pos + 1]) && (1 == data[pos + 2]))) {
+        pos++;
+    }
+    return (pos + 3 < size) ? pos : size;
+}
+
+/*
+ * Copies a NAL unit without its emulation prevention bytes, returns the
+ * RBSP size
+ */
+static size_t
+h264_unescape(const uint8_t *nal, size_t size, uint8_t *rbsp)
+{
+    size_t i, n = 0;
+    int zeros = 0;
+
+    for (i = 0; i < size; i++) {
+        if ((zeros >= 2) && (3 == nal[i])) {
+            zeros = 0;
+            continue;
+        }
+        rbsp[n++] = nal[i];
+        zeros = nal[i] ? 0 : zeros + 1;
+    }
+    return n;
+}
+
+static int
+h264_more_rbsp_data(struct bit_reader *br)
+{
+    size_t size = br->size;
+
+    while (size && !br->data[size - 1]) {
+        size--;
+    }
+    return size && (br->pos < size * 8 - 1 - __builtin_ctz(br->data[size - 1]));
+}
+
+/*
+ * Reads scaling_list(), returns H264_LIST_DEFAULT for useDefaultScalingMatrixFlag
+ */
+static int
+h264_read_scaling_list(struct bit_reader *br, uint8_t *list, int size)
+{
+    int last = 8, next = 8, j;
+
+    for (j = 0; j < size; j++) {
+        if (next) {
+            next = (last + bit_reader_se(br) + 256) % 256;
+            if ((0 == j) && (0 == next)) {
+                return H264_LIST_DEFAULT;
+            }
+        }
+        list[j] = next ? next : last;
+        last = list[j];
+    }
+    return H264_LIST_CODED;
+}
+
+static void
+h264_read_scaling_matrix(struct bit_reader *br, struct h264_scaling *scaling, int num_lists)
+{
+    int i;
+
+    memset(scaling, 0, sizeof(*scaling));
+    for (i = 0; i < num_lists; i++) {
+        if (!bit_reader_bit(br)) {
+            continue;
+        }
+        if (i < 6) {
+            scaling->state[i] = h264_read_scaling_list(br, scaling->lists_4x4[i], 16);
+        } else {
+            scaling->state[i] = h264_read_scaling_list(br, scaling->lists_8x8[i - 6], 64);
+        }
+    }
+}
+
+/*
+ * Resolves coded scaling lists with the fall-back rules of Table 7-2.
+ * fallback_4x4/8x8 are the lists for the first intra and inter list of each
+ * size: the defaults for rule A, the SPS lists for rule B
+ */
+static void
+h264_resolve_scaling(const struct h264_scaling *scaling, const uint8_t fallback_4x4[2][16],
+                     const uint8_t fallback_8x8[2][64], VAIQMatrixBufferH264 *iq)
+{
+    int i;
+
+    for (i = 0; i < 6; i++) {
+        if (H264_LIST_CODED == scaling->state[i]) {
+            memcpy(iq->ScalingList4x4[i], scaling->lists_4x4[i], 16);
+        } else if (H264_LIST_DEFAULT == scaling->state[i]) {
+            memcpy(iq->ScalingList4x4[i], h264_default_4x4[i / 3], 16);
+        } else if ((0 == i) || (3 == i)) {
+            memcpy(iq->ScalingList4x4[i], fallback_4x4[i / 3], 16);
+        } else {
+            memcpy(iq->ScalingList4x4[i], iq->ScalingList4x4[i - 1], 16);
+        }
+    }
+    for (i = 0; i < 2; i++) {
+        if (H264_LIST_CODED == scaling->state[6 + i]) {
+            memcpy(iq->ScalingList8x8[i], scaling->lists_8x8[i], 64);
+        } else if (H264_LIST_DEFAULT == scaling->state[6 + i]) {
+            memcpy(iq->ScalingList8x8[i], h264_default_8x8[i], 64);
+        } else {
+            memcpy(iq->ScalingList8x8[i], fallback_8x8[i], 64);
+        }
+    }
+}
+
+static void
+h264_init_iq_matrix(const struct h264_sps *sps, const struct h264_pps *pps, VAIQMatrixBufferH264 *iq)
+{
+    uint8_t sps_4x4[2][16], sps_8x8[2][64];
+
+    if (sps->scaling_matrix_present) {
+        h264_resolve_scaling(&sps->scaling, h264_default_4x4, h264_default_8x8, iq);
+    } else {
+        memset(iq, 16, sizeof(*iq));
+    }
+    if (!pps->scaling_matrix_present) {
+        return;
+    }
+    if (sps->scaling_matrix_present) {
+        /* Fall-back rule B */
+        memcpy(sps_4x4[0], iq->ScalingList4x4[0], 16);
+        memcpy(sps_4x4[1], iq->ScalingList4x4[3], 16);
+        memcpy(sps_8x8, iq->ScalingList8x8, sizeof(sps_8x8));
+        h264_resolve_scaling(&pps->scaling, (const uint8_t (*)[16]) sps_4x4, (const uint8_t (*)[64]) sps_8x8, iq);
+    } else {
+        h264_resolve_scaling(&pps->scaling, h264_default_4x4, h264_default_8x8, iq);
+    }
+}
+
+static int
+h264_parse_sps(struct h264_stream *stream, struct bit_reader *br)
+{
+    struct h264_sps sps;
+    int id, i, crop_unit_x, crop_unit_y;
+
+    memset(&sps, 0, sizeof(sps));
+    sps.profile_idc = bit_reader_bits(br, 8);
+    bit_reader_skip(br, 8); /* constraint_set flags */
+    sps.level_idc = bit_reader_bits(br, 8);
+    id = bit_reader_ue(br);
+    if (id >= H264_MAX_SPS) {
+        fprintf(stderr, "h264: bad seq_parameter_set_id %d\n", id);
+        return -1;
+    }
+
+    sps.chroma_format_idc = 1;
+    sps.bit_depth_luma = 8;
+    sps.bit_depth_chroma = 8;
+    if ((100 == sps.profile_idc) || (110 == sps.profile_idc) || (122 == sps.profile_idc) ||
+        (244 == sps.profile_idc) || (44 == sps.profile_idc) || (83 == sps.profile_idc) ||
+        (86 == sps.profile_idc) || (118 == sps.profile_idc) || (128 == sps.profile_idc)) {
+        sps.chroma_format_idc = bit_reader_ue(br);
+        if (3 == sps.chroma_format_idc) {
+            bit_reader_skip(br, 1); /* separate_colour_plane_flag */
+        }
+        sps.bit_depth_luma = 8 + bit_reader_ue(br);
+        sps.bit_depth_chroma = 8 + bit_reader_ue(br);
+        bit_reader_skip(br, 1); /* qpprime_y_zero_transform_bypass_flag */
+        sps.scaling_matrix_present = bit_reader_bit(br);
+        if (sps.scaling_matrix_present) {
+            h264_read_scaling_matrix(br, &sps.scaling, (3 == sps.chroma_format_idc) ? 12 : 8);
+        }
+    }
+
+    sps.log2_max_frame_num = 4 + bit_reader_ue(br);
+    sps.poc_type = bit_reader_ue(br);
+    if (0 == sps.poc_type) {
+        sps.log2_max_poc_lsb = 4 + bit_reader_ue(br);
+    } else if (1 == sps.poc_type) {
+        sps.delta_pic_order_always_zero = bit_reader_bit(br);
+        sps.offset_for_non_ref_pic = bit_reader_se(br);
+        sps.offset_for_top_to_bottom_field = bit_reader_se(br);
+        sps.num_ref_frames_in_poc_cycle = bit_reader_ue(br);
+        if (sps.num_ref_frames_in_poc_cycle > 255) {
+            fprintf(stderr, "h264: bad num_ref_frames_in_pic_order_cnt_cycle\n");
+            return -1;
+        }
+        for (i = 0; i < sps.num_ref_frames_in_poc_cycle; i++) {
+            sps.offset_for_ref_frame[i] = bit_reader_se(br);
+        }
+    }
+    sps.max_num_ref_frames = bit_reader_ue(br);
+    sps.gaps_in_frame_num_allowed = bit_reader_bit(br);
+    sps.width_mbs = 1 + bit_reader_ue(br);
+    sps.height_mbs = 1 + bit_reader_ue(br);
+    sps.frame_mbs_only = bit_reader_bit(br);
+    if (!sps.frame_mbs_only) {
+        sps.mbaff = bit_reader_bit(br);
+        sps.height_mbs *= 2;
+    }
+    sps.direct_8x8_inference = bit_reader_bit(br);
+    if (bit_reader_bit(br)) {
+        /* Crop units of Table 6-1 for 4:2:0 */
+        crop_unit_x = 2;
+        crop_unit_y = 2 * (2 - sps.frame_mbs_only);
+        sps.crop_left = crop_unit_x * bit_reader_ue(br);
+        sps.crop_right = crop_unit_x * bit_reader_ue(br);
+        sps.crop_top = crop_unit_y * bit_reader_ue(br);
+        sps.crop_bottom = crop_unit_y * bit_reader_ue(br);
+    }
+
+    if ((sps.max_num_ref_frames > H264_MAX_DPB) || bit_reader_overrun(br) ||
+        (sps.crop_left + sps.crop_right >= sps.width_mbs * 16) ||
+        (sps.crop_top + sps.crop_bottom >= sps.height_mbs * 16)) {
+        fprintf(stderr, "h264: bad sequence parameter set\n");
+        return -1;
+    }
+    sps.valid = 1;
+    stream->sps[id] = sps;
+    return 0;
+}
+
+static int
+h264_parse_pps(struct h264_stream *stream, struct bit_reader *br)
+{
+    struct h264_pps pps;
+    int id;
+
+    memset(&pps, 0, sizeof(pps));
+    id = bit_reader_ue(br);
+    pps.sps_id = bit_reader_ue(br);
+    if ((id >= H264_MAX_PPS) || (pps.sps_id >= H264_MAX_SPS) || !stream->sps[pps.sps_id].valid) {
+        fprintf(stderr, "h264: bad picture parameter set %d\n", id);
+        return -1;
+    }
+    pps.entropy_coding_mode = bit_reader_bit(br);
+    pps.bottom_field_pic_order_in_frame_present = bit_reader_bit(br);
+    pps.num_slice_groups = 1 + bit_reader_ue(br);
+    if (pps.num_slice_groups > 1) {
+        /* Slice groups are not passed on, keep the set so the error names the picture using it */
+        stream->pps[id] = pps;
+        stream->pps[id].valid = 1;
+        return 0;
+    }
+    pps.num_ref_idx_default[0] = 1 + bit_reader_ue(br);
+    pps.num_ref_idx_default[1] = 1 + bit_reader_ue(br);
+    pps.weighted_pred = bit_reader_bit(br);
+    pps.weighted_bipred_idc = bit_reader_bits(br, 2);
+    pps.pic_init_qp = 26 + bit_reader_se(br);
+    pps.pic_init_qs = 26 + bit_reader_se(br);
+    pps.chroma_qp_index_offset = bit_reader_se(br);
+    pps.deblocking_filter_control_present = bit_reader_bit(br);
+    pps.constrained_intra_pred = bit_reader_bit(br);
+    pps.redundant_pic_cnt_present = bit_reader_bit(br);
+    pps.second_chroma_qp_index_offset = pps.chroma_qp_index_offset;
+    if (h264_more_rbsp_data(br)) {
+        pps.transform_8x8_mode = bit_reader_bit(br);
+        pps.scaling_matrix_present = bit_reader_bit(br);
+        if (pps.scaling_matrix_present) {
+            h264_read_scaling_matrix(br, &pps.scaling, 6 + ((3 == stream->sps[pps.sps_id].chroma_format_idc) ? 6 : 2) *
+                                     pps.transform_8x8_mode);
+        }
+        pps.second_chroma_qp_index_offset = bit_reader_se(br);
+    }
+
+    if ((pps.num_ref_idx_default[0] > H264_MAX_REF_IDX) || (pps.num_ref_idx_default[1] > H264_MAX_REF_IDX) ||
+        bit_reader_overrun(br)) {
+        fprintf(stderr, "h264: bad picture parameter set %d\n", id);
+        return -1;
+    }
+    pps.valid = 1;
+    stream->pps[id] = pps;
+    return 0;
+}
+
+static void
+h264_read_pred_weight_table(struct bit_reader *br, const struct h264_sps *sps,
+                            const struct h264_slice_header *header, VASliceParameterBufferH264 *slice)
+{
+    int list, i, c;
+
+    slice->luma_log2_weight_denom = bit_reader_ue(br);
+    if (sps->chroma_format_idc) {
+        slice->chroma_log2_weight_denom = bit_reader_ue(br);
+    }
+    for (list = 0; list < ((H264_SLICE_B == header->slice_type) ? 2 : 1); list++) {
+        short *luma_weight = list ? slice->luma_weight_l1 : slice->luma_weight_l0;
+        short *luma_offset = list ? slice->luma_offset_l1 : slice->luma_offset_l0;
+        short (*chroma_weight)[2] = list ? slice->chroma_weight_l1 : slice->chroma_weight_l0;
+        short (*chroma_offset)[2] = list ? slice->chroma_offset_l1 : slice->chroma_offset_l0;
+
+        for (i = 0; i < header->num_ref_idx[list]; i++) {
+            luma_weight[i] = 1 << slice->luma_log2_weight_denom;
+            luma_offset[i] = 0;
+            if (bit_reader_bit(br)) {
+                luma_weight[i] = bit_reader_se(br);
+                luma_offset[i] = bit_reader_se(br);
+                if (list) {
+                    slice->luma_weight_l1_flag = 1;
+                } else {
+                    slice->luma_weight_l0_flag = 1;
+                }
+            }
+            for (c = 0; c < 2; c++) {
+                chroma_weight[i][c] = 1 << slice->chroma_log2_weight_denom;
+                chroma_offset[i][c] = 0;
+            }
+            if (sps->chroma_format_idc && bit_reader_bit(br)) {
+                for (c = 0; c < 2; c++) {
+                    chroma_weight[i][c] = bit_reader_se(br);
+                    chroma_offset[i][c] = bit_reader_se(br);
+                }
+                if (list) {
+                    slice->chroma_weight_l1_flag = 1;
+                } else {
+                    slice->chroma_weight_l0_flag = 1;
+                }
+            }
+        }
+    }
+}
+
+/*
+ * Parses a slice header into header and the prediction weights and
+ * deblocking fields of slice
+ * Return 0 on success, -1 on error
+ */
+static int
+h264_parse_slice_header(struct h264_stream *stream, struct bit_reader *br, struct h264_slice_header *header,
+                        VASliceParameterBufferH264 *slice)
+{
+    const struct h264_sps *sps;
+    const struct h264_pps *pps;
+    int list, n, op;
+
+    header->first_mb = bit_reader_ue(br);
+    header->slice_type = bit_reader_ue(br) % 5;
+    header->pps_id = bit_reader_ue(br);
+    if ((header->pps_id >= H264_MAX_PPS) || !stream->pps[header->pps_id].valid) {
+        fprintf(stderr, "h264: slice refers to missing picture parameter set %d\n", header->pps_id);
+        return -1;
+    }
+    pps = &stream->pps[header->pps_id];
+    sps = &stream->sps[pps->sps_id];
+    if (pps->num_slice_groups > 1) {
+        fprintf(stderr, "h264: slice groups are not supported\n");
+        return -1;
+    }
+    if (header->slice_type > H264_SLICE_I) {
+        fprintf(stderr, "h264: SP and SI slices are not supported\n");
+        return -1;
+    }
+
+    header->frame_num = bit_reader_bits(br, sps->log2_max_frame_num);
+    if (!sps->frame_mbs_only && bit_reader_bit(br)) {
+        fprintf(stderr, "h264: field pictures are not supported\n");
+        return -1;
+    }
+    if (H264_NAL_IDR_SLICE == header->nal_unit_type) {
+        header->idr_pic_id = bit_reader_ue(br);
+    }
+    if (0 == sps->poc_type) {
+        header->poc_lsb = bit_reader_bits(br, sps->log2_max_poc_lsb);
+        if (pps->bottom_field_pic_order_in_frame_present) {
+            header->delta_poc_bottom = bit_reader_se(br);
+        }
+    } else if ((1 == sps->poc_type) && !sps->delta_pic_order_always_zero) {
+        header->delta_poc[0] = bit_reader_se(br);
+        if (pps->bottom_field_pic_order_in_frame_present) {
+            header->delta_poc[1] = bit_reader_se(br);
+        }
+    }
+    if (pps->redundant_pic_cnt_present) {
+        header->redundant_pic_cnt = bit_reader_ue(br);
+    }
+    if (H264_SLICE_B == header->slice_type) {
+        slice->direct_spatial_mv_pred_flag = bit_reader_bit(br);
+    }
+
+    header->num_ref_idx[0] = (H264_SLICE_I != header->slice_type) ? pps->num_ref_idx_default[0] : 0;
+    header->num_ref_idx[1] = (H264_SLICE_B == header->slice_type) ? pps->num_ref_idx_default[1] : 0;
+    if ((H264_SLICE_I != header->slice_type) && bit_reader_bit(br)) {
+        header->num_ref_idx[0] = 1 + bit_reader_ue(br);
+        if (H264_SLICE_B == header->slice_type) {
+            header->num_ref_idx[1] = 1 + bit_reader_ue(br);
+        }
+    }
+    if ((header->num_ref_idx[0] > H264_MAX_REF_IDX) || (header->num_ref_idx[1] > H264_MAX_REF_IDX)) {
+        fprintf(stderr, "h264: too many reference indexes\n");
+        return -1;
+    }
+
+    for (list = 0; list < 2; list++) {
+        if (!header->num_ref_idx[list] || !bit_reader_bit(br)) {
+            continue;
+        }
+        for (n = 0; (op = bit_reader_ue(br)) != 3; n++) {
+            if ((n > H264_MAX_REF_IDX) || (op > 3) || bit_reader_overrun(br)) {
+                fprintf(stderr, "h264: bad reference picture list modification\n");
+                return -1;
+            }
+            header->modifications[list][n][0] = op;
+            header->modifications[list][n][1] = bit_reader_ue(br);
+        }
+        header->num_modifications[list] = n;
+    }
+
+    if ((pps->weighted_pred && (H264_SLICE_P == header->slice_type)) ||
+        ((1 == pps->weighted_bipred_idc) && (H264_SLICE_B == header->slice_type))) {
+        h264_read_pred_weight_table(br, sps, header, slice);
+    }
+
+    if (header->nal_ref_idc) {
+        if (H264_NAL_IDR_SLICE == header->nal_unit_type) {
+            header->no_output_of_prior_pics = bit_reader_bit(br);
+            header->long_term_reference = bit_reader_bit(br);
+        } else if ((header->adaptive_marking = bit_reader_bit(br))) {
+            for (n = 0; (op = bit_reader_ue(br)) != 0; n++) {
+                if ((n == H264_MAX_MMCO) || (op > 6) || bit_reader_overrun(br)) {
+                    fprintf(stderr, "h264: bad memory management control operations\n");
+                    return -1;
+                }
+                header->mmco[n][0] = op;
+                header->mmco[n][1] = 0;
+                header->mmco[n][2] = 0;
+                if ((1 == op) || (3 == op)) {
+                    header->mmco[n][1] = bit_reader_ue(br);     /* difference_of_pic_nums_minus1 */
+                }
+                if ((2 == op) || (3 == op) || (6 == op)) {
+                    header->mmco[n][2] = bit_reader_ue(br);     /* long_term_pic_num or long_term_frame_idx */
+                }
+                if (4 == op) {
+                    header->mmco[n][2] = bit_reader_ue(br);     /* max_long_term_frame_idx_plus1 */
+                }
+                if (5 == op) {
+                    header->has_mmco5 = 1;
+                }
+            }
+            header->num_mmco = n;
+        }
+    }
+
+    if (pps->entropy_coding_mode && (H264_SLICE_I != header->slice_type)) {
+        slice->cabac_init_idc = bit_reader_ue(br);
+    }
+    slice->slice_qp_delta = bit_reader_se(br);
+    if (pps->deblocking_filter_control_present) {
+        slice->disable_deblocking_filter_idc = bit_reader_ue(br);
+        if (1 != slice->disable_deblocking_filter_idc) {
+            slice->slice_alpha_c0_offset_div2 = bit_reader_se(br);
+            slice->slice_beta_offset_div2 = bit_reader_se(br);
+        }
+    }
+    if (bit_reader_overrun(br)) {
+        fprintf(stderr, "h264: truncated slice header\n");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Returns non-zero if a slice starts a new primary coded picture, 7.4.1.2.4
+ */
+static int
+h264_first_slice_of_picture(const struct h264_slice_header *prev, const struct h264_slice_header *header)
+{
+    return (prev->frame_num != header->frame_num) ||
+           (prev->pps_id != header->pps_id) ||
+           (!prev->nal_ref_idc != !header->nal_ref_idc) ||
+           (prev->poc_lsb != header->poc_lsb) ||
+           (prev->delta_poc_bottom != header->delta_poc_bottom) ||
+           (prev->delta_poc[0] != header->delta_poc[0]) ||
+           (prev->delta_poc[1] != header->delta_poc[1]) ||
+           ((H264_NAL_IDR_SLICE == prev->nal_unit_type) != (H264_NAL_IDR_SLICE == header->nal_unit_type)) ||
+           ((H264_NAL_IDR_SLICE == header->nal_unit_type) && (prev->idr_pic_id != header->idr_pic_id));
+}
+
+static void
+h264_output_frame(struct h264_stream *stream, int index)
+{
+    stream->frames[index].needed_for_output = 0;
+    va_decoder_output_picture(stream->decoder, stream->decoder->surfaces[index]);
+}
+
+/*
+ * Returns the frame other than the current one waiting for output with the
+ * lowest POC, or -1
+ */
+static int
+h264_next_output(struct h264_stream *stream)
+{
+    int i, best = -1;
+
+    for (i = 0; i < stream->num_frames; i++) {
+        if ((i != stream->current) && stream->frames[i].needed_for_output &&
+            ((best < 0) || (stream->frames[i].poc < stream->frames[best].poc))) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+/*
+ * Outputs the next frame, C.4.5.3
+ * Return 0 on success, -1 if no frame waits for output
+ */
+static int
+h264_bump(struct h264_stream *stream)
+{
+    int next = h264_next_output(stream);
+
+    if (next < 0) {
+        return -1;
+    }
+    h264_output_frame(stream, next);
+    return 0;
+}
+
+static void
+h264_flush(struct h264_stream *stream)
+{
+    while (0 == h264_bump(stream)) {
+    }
+}
+
+/*
+ * Returns the frames other than the current one that are still referenced
+ * or waiting for output
+ */
+static int
+h264_dpb_fullness(struct h264_stream *stream)
+{
+    int i, fullness = 0;
+
+    for (i = 0; i < stream->num_frames; i++) {
+        if ((i != stream->current) && (stream->frames[i].reference || stream->frames[i].needed_for_output)) {
+            fullness++;
+        }
+    }
+    return fullness;
+}
+
+/*
+ * Applies the first slice's dec_ref_pic_marking() to the DPB, 8.2.5
+ */
+static void
+h264_mark_references(struct h264_stream *stream)
+{
+    const struct h264_slice_header *header = &stream->first_slice;
+    struct h264_frame *cur = &stream->frames[stream->current];
+    struct h264_frame *frame, *oldest;
+    int i, k, pic_num, num_refs;
+
+    if (H264_NAL_IDR_SLICE == header->nal_unit_type) {
+        cur->reference = header->long_term_reference ? H264_LONG_TERM : H264_SHORT_TERM;
+        cur->long_term_frame_idx = 0;
+        return;
+    }
+
+    if (!header->adaptive_marking) {
+        /* Sliding window */
+        num_refs = 0;
+        oldest = NULL;
+        for (i = 0; i < stream->num_frames; i++) {
+            frame = &stream->frames[i];
+            if ((frame == cur) || !frame->reference) {
+                continue;
+            }
+            num_refs++;
+            if ((H264_SHORT_TERM == frame->reference) &&
+                (!oldest || (frame->frame_num_wrap < oldest->frame_num_wrap))) {
+                oldest = frame;
+            }
+        }
+        if (oldest && (num_refs >= (stream->active_sps.max_num_ref_frames ? stream->active_sps.max_num_ref_frames : 1))) {
+            oldest->reference = H264_UNUSED;
+        }
+        cur->reference = H264_SHORT_TERM;
+        return;
+    }
+
+    cur->reference = H264_SHORT_TERM;
+    for (k = 0; k < header->num_mmco; k++) {
+        const int *mmco = header->mmco[k];
+
+        pic_num = header->frame_num - (mmco[1] + 1);
+        for (i = 0; i < stream->num_frames; i++) {
+            frame = &stream->frames[i];
+            if (frame == cur) {
+                continue;
+            }
+            switch (mmco[0]) {
+            case 1:
+                if ((H264_SHORT_TERM == frame->reference) && (frame->frame_num_wrap == pic_num)) {
+                    frame->reference = H264_UNUSED;
+                }
+                break;
+            case 2:
+                if ((H264_LONG_TERM == frame->reference) && (frame->long_term_frame_idx == mmco[2])) {
+                    frame->reference = H264_UNUSED;
+                }
+                break;
+            case 3:
+            case 6:
+                /* The index moves to a new frame */
+                if ((H264_LONG_TERM == frame->reference) && (frame->long_term_frame_idx == mmco[2])) {
+                    frame->reference = H264_UNUSED;
+                }
+                break;
+            case 4:
+                if ((H264_LONG_TERM == frame->reference) && (frame->long_term_frame_idx >= mmco[2])) {
+                    frame->reference = H264_UNUSED;
+                }
+                break;
+            case 5:
+                frame->reference = H264_UNUSED;
+                break;
+            }
+        }
+        if (3 == mmco[0]) {
+            for (i = 0; i < stream->num_frames; i++) {
+                frame = &stream->frames[i];
+                if ((frame != cur) && (H264_SHORT_TERM == frame->reference) && (frame->frame_num_wrap == pic_num)) {
+                    frame->reference = H264_LONG_TERM;
+                    frame->long_term_frame_idx = mmco[2];
+                }
+            }
+        } else if (6 == mmco[0]) {
+            cur->reference = H264_LONG_TERM;
+            cur->long_term_frame_idx = mmco[2];
+        }
+    }
+}
+
+/*
+ * Renders the picture collected so far, updates the DPB and outputs what
+ * the bumping process of C.4.5 makes displayable
+ */
+static void
+h264_finish_picture(struct h264_stream *stream)
+{
+    struct va_decoder *decoder = stream->decoder;
+    const struct h264_slice_header *header = &stream->first_slice;
+    struct h264_frame *cur;
+    int temp, next;
+
+    if (!stream->in_picture) {
+        return;
+    }
+    stream->in_picture = 0;
+    cur = &stream->frames[stream->current];
+    va_decoder_render(decoder, decoder->surfaces[stream->current]);
+
+    if (header->nal_ref_idc) {
+        h264_mark_references(stream);
+        stream->prev_ref_frame_num = header->frame_num;
+    }
+    if (header->has_mmco5) {
+        /* Numbering restarts after this picture, everything before it goes out first */
+        h264_flush(stream);
+        temp = (cur->top_poc < cur->bottom_poc) ? cur->top_poc : cur->bottom_poc;
+        cur->top_poc -= temp;
+        cur->bottom_poc -= temp;
+        cur->poc = 0;
+        cur->frame_num = 0;
+        stream->prev_poc_msb = 0;
+        stream->prev_poc_lsb = cur->top_poc;
+        stream->prev_frame_num_offset = 0;
+        stream->prev_frame_num = 0;
+        stream->prev_ref_frame_num = 0;
+    }
+
+    /* Storage, C.4.5.1 and C.4.5.2 */
+    cur->needed_for_output = 1;
+    while (h264_dpb_fullness(stream) >= stream->dpb_size) {
+        next = h264_next_output(stream);
+        if (!cur->reference && ((next < 0) || (cur->poc < stream->frames[next].poc))) {
+            /* Comes before everything stored, it goes straight out */
+            h264_output_frame(stream, stream->current);
+            break;
+        }
+        if (next < 0) {
+            break;
+        }
+        h264_output_frame(stream, next);
+    }
+    stream->current = -1;
+}
+
+/*
+ * Computes the POC of the picture starting with header, 8.2.1
+ */
+static void
+h264_compute_poc(struct h264_stream *stream, const struct h264_slice_header *header, struct h264_frame *cur)
+{
+    const struct h264_sps *sps = &stream->active_sps;
+    int max_poc_lsb, poc_msb, frame_num_offset, abs_frame_num, expected, cycle, in_cycle, i;
+
+    if (0 == sps->poc_type) {
+        max_poc_lsb = 1 << sps->log2_max_poc_lsb;
+        if ((header->poc_lsb < stream->prev_poc_lsb) && (stream->prev_poc_lsb - header->poc_lsb >= max_poc_lsb / 2)) {
+            poc_msb = stream->prev_poc_msb + max_poc_lsb;
+        } else if ((header->poc_lsb > stream->prev_poc_lsb) &&
+                   (header->poc_lsb - stream->prev_poc_lsb > max_poc_lsb / 2)) {
+            poc_msb = stream->prev_poc_msb - max_poc_lsb;
+        } else {
+            poc_msb = stream->prev_poc_msb;
+        }
+        cur->top_poc = poc_msb + header->poc_lsb;
+        cur->bottom_poc = cur->top_poc + header->delta_poc_bottom;
+        if (header->nal_ref_idc) {
+            stream->prev_poc_msb = poc_msb;
+            stream->prev_poc_lsb = header->poc_lsb;
+        }
+    } else {
+        if (H264_NAL_IDR_SLICE == header->nal_unit_type) {
+            frame_num_offset = 0;
+        } else if (stream->prev_frame_num > header->frame_num) {
+            frame_num_offset = stream->prev_frame_num_offset + stream->max_frame_num;
+        } else {
+            frame_num_offset = stream->prev_frame_num_offset;
+        }
+
+        if (1 == sps->poc_type) {
+            abs_frame_num = sps->num_ref_frames_in_poc_cycle ? frame_num_offset + header->frame_num : 0;
+            if (!header->nal_ref_idc && (abs_frame_num > 0)) {
+                abs_frame_num--;
+            }
+            expected = 0;
+            if (abs_frame_num > 0) {
+                cycle = (abs_frame_num - 1) / sps->num_ref_frames_in_poc_cycle;
+                in_cycle = (abs_frame_num - 1) % sps->num_ref_frames_in_poc_cycle;
+                for (i = 0; i < sps->num_ref_frames_in_poc_cycle; i++) {
+                    expected += cycle * sps->offset_for_ref_frame[i];
+                }
+                for (i = 0; i <= in_cycle; i++) {
+                    expected += sps->offset_for_ref_frame[i];
+                }
+            }
+            if (!header->nal_ref_idc) {
+                expected += sps->offset_for_non_ref_pic;
+            }
+            cur->top_poc = expected + header->delta_poc[0];
+            cur->bottom_poc = cur->top_poc + sps->offset_for_top_to_bottom_field + header->delta_poc[1];
+        } else if (H264_NAL_IDR_SLICE == header->nal_unit_type) {
+            cur->top_poc = cur->bottom_poc = 0;
+        } else {
+            cur->top_poc = 2 * (frame_num_offset + header->frame_num) - !header->nal_ref_idc;
+            cur->bottom_poc = cur->top_poc;
+        }
+        stream->prev_frame_num_offset = frame_num_offset;
+    }
+    stream->prev_frame_num = header->frame_num;
+    cur->poc = (cur->top_poc < cur->bottom_poc) ? cur->top_poc : cur->bottom_poc;
+}
+
+static void
+h264_fill_va_picture(struct h264_stream *stream, VAPictureH264 *va_pic, int index)
+{
+    const struct h264_frame *frame;
+
+    memset(va_pic, 0, sizeof(*va_pic));
+    if (index < 0) {
+        va_pic->picture_id = VA_INVALID_SURFACE;
+        va_pic->flags = VA_PICTURE_H264_INVALID;
+        return;
+    }
+    frame = &stream->frames[index];
+    va_pic->picture_id = stream->decoder->surfaces[index];
+    va_pic->TopFieldOrderCnt = frame->top_poc;
+    va_pic->BottomFieldOrderCnt = frame->bottom_poc;
+    if (H264_LONG_TERM == frame->reference) {
+        va_pic->frame_idx = frame->long_term_frame_idx;
+        va_pic->flags = VA_PICTURE_H264_LONG_TERM_REFERENCE;
+    } else {
+        va_pic->frame_idx = frame->frame_num;
+        if (H264_SHORT_TERM == frame->reference) {
+            va_pic->flags = VA_PICTURE_H264_SHORT_TERM_REFERENCE;
+        }
+    }
+}
+
+/*
+ * Starts the decoder for the SPS a new IDR picture activates, if it changed
+ * Return 0 on success, -1 on error
+ */
+static int
+h264_activate_sps(struct h264_stream *stream, const struct h264_sps *sps)
+{
+    struct va_decoder *decoder = stream->decoder;
+    VAProfile profile;
+    int i, mbs, max_dpb_mbs = 0;
+
+    if (stream->num_frames && !memcmp(sps, &stream->active_sps, sizeof(*sps))) {
+        return 0;
+    }
+    if (!sps->frame_mbs_only) {
+        fprintf(stderr, "h264: field and MBAFF coding are not supported\n");
+        return -1;
+    }
+    if ((1 != sps->chroma_format_idc) || (8 != sps->bit_depth_luma) || (8 != sps->bit_depth_chroma)) {
+        fprintf(stderr, "h264: only 8-bit 4:2:0 is supported\n");
+        return -1;
+    }
+    switch (sps->profile_idc) {
+    case 66:
+        profile = VAProfileH264Baseline;
+        break;
+    case 77:
+        profile = VAProfileH264Main;
+        break;
+    case 100:
+        profile = VAProfileH264High;
+        break;
+    default:
+        fprintf(stderr, "h264: profile_idc %d is not supported\n", sps->profile_idc);
+        return -1;
+    }
+
+    /* Pictures of the old sequence go out before its surfaces go away */
+    if (stream->num_frames) {
+        stream->current = -1;
+        h264_flush(stream);
+    }
+
+    mbs = sps->width_mbs * sps->height_mbs;
+    for (i = 0; i < (int) (sizeof(h264_levels) / sizeof(h264_levels[0])); i++) {
+        if (h264_levels[i].level_idc == sps->level_idc) {
+            max_dpb_mbs = h264_levels[i].max_dpb_mbs;
+        }
+    }
+    stream->dpb_size = max_dpb_mbs ? max_dpb_mbs / mbs : H264_MAX_DPB;
+    if (stream->dpb_size > H264_MAX_DPB) {
+        stream->dpb_size = H264_MAX_DPB;
+    }
+    if (stream->dpb_size < sps->max_num_ref_frames) {
+        stream->dpb_size = sps->max_num_ref_frames;
+    }
+    if (stream->dpb_size < 1) {
+        stream->dpb_size = 1;
+    }
+
+    va_decoder_stop(decoder);
+    if (va_decoder_start(decoder, profile, sps->width_mbs * 16, sps->height_mbs * 16, stream->dpb_size + 1)) {
+        fprintf(stderr, "h264: cannot start the decoder for profile_idc %d\n", sps->profile_idc);
+        return -1;
+    }
+    decoder->crop_x = sps->crop_left;
+    decoder->crop_y = sps->crop_top;
+    decoder->crop_width = sps->width_mbs * 16 - sps->crop_left - sps->crop_right;
+    decoder->crop_height = sps->height_mbs * 16 - sps->crop_top - sps->crop_bottom;
+
+    memset(stream->frames, 0, sizeof(stream->frames));
+    stream->num_frames = stream->dpb_size + 1;
+    stream->active_sps = *sps;
+    stream->max_frame_num = 1 << sps->log2_max_frame_num;
+    return 0;
+}
+
+/*
+ * Sets up the DPB, the picture parameters and the scaling lists for the
+ * picture starting with header
+ * Return 0 on success, -1 on error
+ */
+static int
+h264_start_picture(struct h264_stream *stream, const struct h264_slice_header *header)
+{
+    const struct h264_pps *pps = &stream->pps[header->pps_id];
+    const struct h264_sps *sps;
+    VAPictureParameterBufferH264 *pic = &stream->picture;
+    struct h264_frame *cur, *frame;
+    int i, n, idr = (H264_NAL_IDR_SLICE == header->nal_unit_type);
+
+    if (idr) {
+        if (h264_activate_sps(stream, &stream->sps[pps->sps_id])) {
+            return -1;
+        }
+        /* C.4.4, prior pictures go out unless the stream says to drop them */
+        for (i = 0; i < stream->num_frames; i++) {
+            stream->frames[i].reference = H264_UNUSED;
+            if (header->no_output_of_prior_pics) {
+                stream->frames[i].needed_for_output = 0;
+            }
+        }
+        h264_flush(stream);
+        stream->prev_poc_msb = 0;
+        stream->prev_poc_lsb = 0;
+        stream->prev_frame_num_offset = 0;
+        stream->prev_frame_num = 0;
+        stream->prev_ref_frame_num = 0;
+    } else if (!stream->num_frames) {
+        return 0; /* Not decodable before the first IDR picture */
+    } else if (memcmp(&stream->sps[pps->sps_id], &stream->active_sps, sizeof(stream->active_sps))) {
+        fprintf(stderr, "h264: sequence parameter set changed outside an IDR picture\n");
+        return -1;
+    } else if ((header->frame_num != stream->prev_ref_frame_num) &&
+               (header->frame_num != (stream->prev_ref_frame_num + 1) % stream->max_frame_num)) {
+        fprintf(stderr, "h264: gaps in frame_num are not supported\n");
+        return -1;
+    }
+    sps = &stream->active_sps;
+
+    for (stream->current = 0; stream->current < stream->num_frames; stream->current++) {
+        frame = &stream->frames[stream->current];
+        if (!frame->reference && !frame->needed_for_output) {
+            break;
+        }
+    }
+    if (stream->current == stream->num_frames) {
+        fprintf(stderr, "h264: no free frame in the DPB\n");
+        return -1;
+    }
+    cur = &stream->frames[stream->current];
+    memset(cur, 0, sizeof(*cur));
+    cur->frame_num = header->frame_num;
+    cur->frame_num_wrap = header->frame_num;
+    h264_compute_poc(stream, header, cur);
+
+    /* FrameNumWrap, 8.2.4.1 */
+    for (i = 0; i < stream->num_frames; i++) {
+        frame = &stream->frames[i];
+        if ((frame != cur) && (H264_SHORT_TERM == frame->reference)) {
+            frame->frame_num_wrap = frame->frame_num - ((frame->frame_num > header->frame_num) ? stream->max_frame_num : 0);
+        }
+    }
+
+    memset(pic, 0, sizeof(*pic));
+    h264_fill_va_picture(stream, &pic->CurrPic, stream->current);
+    n = 0;
+    for (i = 0; i < stream->num_frames; i++) {
+        if ((i != stream->current) && stream->frames[i].reference) {
+            h264_fill_va_picture(stream, &pic->ReferenceFrames[n++], i);
+        }
+    }
+    for (; n < 16; n++) {
+        h264_fill_va_picture(stream, &pic->ReferenceFrames[n], -1);
+    }
+    pic->picture_width_in_mbs_minus1 = sps->width_mbs - 1;
+    pic->picture_height_in_mbs_minus1 = sps->height_mbs - 1;
+    pic->bit_depth_luma_minus8 = sps->bit_depth_luma - 8;
+    pic->bit_depth_chroma_minus8 = sps->bit_depth_chroma - 8;
+    pic->num_ref_frames = sps->max_num_ref_frames;
+    pic->seq_fields.bits.chroma_format_idc = sps->chroma_format_idc;
+    pic->seq_fields.bits.gaps_in_frame_num_value_allowed_flag = sps->gaps_in_frame_num_allowed;
+    pic->seq_fields.bits.frame_mbs_only_flag = sps->frame_mbs_only;
+    pic->seq_fields.bits.mb_adaptive_frame_field_flag = sps->mbaff;
+    pic->seq_fields.bits.direct_8x8_inference_flag = sps->direct_8x8_inference;
+    pic->seq_fields.bits.MinLumaBiPredSize8x8 = sps->level_idc >= 31;
+    pic->seq_fields.bits.log2_max_frame_num_minus4 = sps->log2_max_frame_num - 4;
+    pic->seq_fields.bits.pic_order_cnt_type = sps->poc_type;
+    pic->seq_fields.bits.log2_max_pic_order_cnt_lsb_minus4 = sps->poc_type ? 0 : sps->log2_max_poc_lsb - 4;
+    pic->seq_fields.bits.delta_pic_order_always_zero_flag = sps->delta_pic_order_always_zero;
+    pic->pic_init_qp_minus26 = pps->pic_init_qp - 26;
+    pic->pic_init_qs_minus26 = pps->pic_init_qs - 26;
+    pic->chroma_qp_index_offset = pps->chroma_qp_index_offset;
+    pic->second_chroma_qp_index_offset = pps->second_chroma_qp_index_offset;
+    pic->pic_fields.bits.entropy_coding_mode_flag = pps->entropy_coding_mode;
+    pic->pic_fields.bits.weighted_pred_flag = pps->weighted_pred;
+    pic->pic_fields.bits.weighted_bipred_idc = pps->weighted_bipred_idc;
+    pic->pic_fields.bits.transform_8x8_mode_flag = pps->transform_8x8_mode;
+    pic->pic_fields.bits.constrained_intra_pred_flag = pps->constrained_intra_pred;
+    pic->pic_fields.bits.pic_order_present_flag = pps->bottom_field_pic_order_in_frame_present;
+    pic->pic_fields.bits.deblocking_filter_control_present_flag = pps->deblocking_filter_control_present;
+    pic->pic_fields.bits.redundant_pic_cnt_present_flag = pps->redundant_pic_cnt_present;
+    pic->pic_fields.bits.reference_pic_flag = header->nal_ref_idc != 0;
+    pic->frame_num = header->frame_num;
+    h264_init_iq_matrix(sps, pps, &stream->iq_matrix);
+
+    va_decoder_add_buffer(stream->decoder, VAPictureParameterBufferType, sizeof(*pic), 1, pic);
+    va_decoder_add_buffer(stream->decoder, VAIQMatrixBufferType, sizeof(stream->iq_matrix), 1, &stream->iq_matrix);
+    stream->active_pps = pps;
+    stream->first_slice = *header;
+    stream->in_picture = 1;
+    return 0;
+}
+
+/*
+ * Sorts frame indexes by ascending keys[index]
+ */
+static void
+h264_sort_refs(int *refs, int num_refs, const int *keys)
+{
+    int i, j, index;
+
+    for (i = 1; i < num_refs; i++) {
+        index = refs[i];
+        for (j = i; (j > 0) && (keys[refs[j - 1]] > keys[index]); j--) {
+            refs[j] = refs[j - 1];
+        }
+        refs[j] = index;
+    }
+}
+
+/*
+ * Builds the initial reference picture lists of 8.2.4.2 for the frames
+ * of the DPB, returns the lengths in sizes
+ */
+static void
+h264_init_ref_lists(struct h264_stream *stream, int slice_type, int lists[2][H264_MAX_REF_IDX + 1], int sizes[2])
+{
+    struct h264_frame *frames = stream->frames;
+    int short_term[H264_MAX_DPB], before[H264_MAX_DPB], after[H264_MAX_DPB], long_term[H264_MAX_DPB];
+    int pic_num_desc[H264_MAX_DPB + 1], poc_desc[H264_MAX_DPB + 1], poc_asc[H264_MAX_DPB + 1];
+    int long_term_asc[H264_MAX_DPB + 1];
+    int num_short = 0, num_before = 0, num_after = 0, num_long = 0;
+    int i, list, tmp;
+
+    for (i = 0; i < stream->num_frames; i++) {
+        if ((i == stream->current) || !frames[i].reference) {
+            continue;
+        }
+        pic_num_desc[i] = -frames[i].frame_num_wrap;
+        poc_desc[i] = -frames[i].poc;
+        poc_asc[i] = frames[i].poc;
+        long_term_asc[i] = frames[i].long_term_frame_idx;
+        if (H264_LONG_TERM == frames[i].reference) {
+            long_term[num_long++] = i;
+        } else {
+            short_term[num_short++] = i;
+            if (frames[i].poc < frames[stream->current].poc) {
+                before[num_before++] = i;
+            } else {
+                after[num_after++] = i;
+            }
+        }
+    }
+    h264_sort_refs(long_term, num_long, long_term_asc);
+
+    sizes[0] = sizes[1] = 0;
+    if (H264_SLICE_P == slice_type) {
+        h264_sort_refs(short_term, num_short, pic_num_desc);
+        for (i = 0; i < num_short; i++) {
+            lists[0][sizes[0]++] = short_term[i];
+        }
+    } else if (H264_SLICE_B == slice_type) {
+        h264_sort_refs(before, num_before, poc_desc);
+        h264_sort_refs(after, num_after, poc_asc);
+        for (i = 0; i < num_before; i++) {
+            lists[0][sizes[0]++] = before[i];
+        }
+        for (i = 0; i < num_after; i++) {
+            lists[0][sizes[0]++] = after[i];
+            lists[1][sizes[1]++] = after[i];
+        }
+        for (i = 0; i < num_before; i++) {
+            lists[1][sizes[1]++] = before[i];
+        }
+    } else {
+        return;
+    }
+    for (list = 0; list < 1 + (H264_SLICE_B == slice_type); list++) {
+        for (i = 0; i < num_long; i++) {
+            lists[list][sizes[list]++] = long_term[i];
+        }
+    }
+    if ((H264_SLICE_B == slice_type) && (sizes[1] > 1) && (sizes[0] == sizes[1]) &&
+        !memcmp(lists[0], lists[1], sizes[0] * sizeof(int))) {
+        tmp = lists[1][0];
+        lists[1][0] = lists[1][1];
+        lists[1][1] = tmp;
+    }
+}
+
+/*
+ * Applies ref_pic_list_modification(), 8.2.4.3, to a list of num_ref_idx
+ * entries
+ * Return 0 on success, -1 on error
+ */
+static int
+h264_modify_ref_list(struct h264_stream *stream, const struct h264_slice_header *header, int list,
+                     int *refs, int num_ref_idx)
+{
+    struct h264_frame *frames = stream->frames;
+    int pic_num_pred = header->frame_num;
+    int k, i, n, ref_idx = 0, pic_num, target, op, value;
+
+    for (k = 0; k < header->num_modifications[list]; k++) {
+        op = header->modifications[list][k][0];
+        value = header->modifications[list][k][1];
+        target = -1;
+        if (op < 2) {
+            if (0 == op) {
+                pic_num_pred -= value + 1;
+                if (pic_num_pred < 0) {
+                    pic_num_pred += stream->max_frame_num;
+                }
+            } else {
+                pic_num_pred += value + 1;
+                if (pic_num_pred >= stream->max_frame_num) {
+                    pic_num_pred -= stream->max_frame_num;
+                }
+            }
+            pic_num = (pic_num_pred > header->frame_num) ? pic_num_pred - stream->max_frame_num : pic_num_pred;
+            for (i = 0; i < stream->num_frames; i++) {
+                if ((i != stream->current) && (H264_SHORT_TERM == frames[i].reference) &&
+                    (frames[i].frame_num_wrap == pic_num)) {
+                    target = i;
+                }
+            }
+        } else {
+            for (i = 0; i < stream->num_frames; i++) {
+                if ((i != stream->current) && (H264_LONG_TERM == frames[i].reference) &&
+                    (frames[i].long_term_frame_idx == value)) {
+                    target = i;
+                }
+            }
+        }
+        if ((target < 0) || (ref_idx >= num_ref_idx)) {
+            fprintf(stderr, "h264: reference picture list modification to a missing picture\n");
+            return -1;
+        }
+        for (i = num_ref_idx; i > ref_idx; i--) {
+            refs[i] = refs[i - 1];
+        }
+        refs[ref_idx++] = target;
+        for (i = n = ref_idx; i <= num_ref_idx; i++) {
+            if (refs[i] != target) {
+                refs[n++] = refs[i];
+            }
+        }
+    }
+    return 0;
+}
+
+/*
+ * Parses a slice NAL unit and adds it to the picture it belongs to
+ * Return 0 on success, -1 on error
+ */
+static int
+h264_parse_slice(struct h264_stream *stream, const uint8_t *nal, size_t nal_size, size_t rbsp_size)
+{
+    VASliceParameterBufferH264 *slice = &stream->slice;
+    struct h264_slice_header header;
+    struct bit_reader br;
+    int lists[2][H264_MAX_REF_IDX + 1], sizes[2];
+    int list, i;
+
+    memset(&header, 0, sizeof(header));
+    memset(slice, 0, sizeof(*slice));
+    header.nal_unit_type = nal[0] & 0x1f;
+    header.nal_ref_idc = (nal[0] >> 5) & 3;
+    bit_reader_init(&br, stream->rbsp, rbsp_size, 8);
+    if (h264_parse_slice_header(stream, &br, &header, slice)) {
+        return -1;
+    }
+    if (header.redundant_pic_cnt) {
+        return 0; /* The primary picture is always there */
+    }
+
+    if (!stream->in_picture || h264_first_slice_of_picture(&stream->first_slice, &header)) {
+        h264_finish_picture(stream);
+        if (h264_start_picture(stream, &header)) {
+            return -1;
+        }
+        if (!stream->in_picture) {
+            return 0;
+        }
+    } else if (stream->active_pps != &stream->pps[header.pps_id]) {
+        fprintf(stderr, "h264: picture parameter set changed within a picture\n");
+        return -1;
+    }
+
+    h264_init_ref_lists(stream, header.slice_type, lists, sizes);
+    for (list = 0; list < 2; list++) {
+        /* Entries past the initial list are only valid once modified */
+        for (i = sizes[list]; i <= header.num_ref_idx[list]; i++) {
+            lists[list][i] = -1;
+        }
+        if (h264_modify_ref_list(stream, &header, list, lists[list], header.num_ref_idx[list])) {
+            return -1;
+        }
+    }
+    for (i = 0; i < 32; i++) {
+        h264_fill_va_picture(stream, &slice->RefPicList0[i], (i < header.num_ref_idx[0]) ? lists[0][i] : -1);
+        h264_fill_va_picture(stream, &slice->RefPicList1[i], (i < header.num_ref_idx[1]) ? lists[1][i] : -1);
+    }
+
+    slice->slice_data_size = nal_size;
+    slice->slice_data_offset = 0;
+    slice->slice_data_flag = VA_SLICE_DATA_FLAG_ALL;
+    slice->slice_data_bit_offset = br.pos;
+    slice->first_mb_in_slice = header.first_mb;
+    slice->slice_type = header.slice_type;
+    slice->num_ref_idx_l0_active_minus1 = header.num_ref_idx[0] ? header.num_ref_idx[0] - 1 : 0;
+    slice->num_ref_idx_l1_active_minus1 = header.num_ref_idx[1] ? header.num_ref_idx[1] - 1 : 0;
+    va_decoder_add_buffer(stream->decoder, VASliceParameterBufferType, sizeof(*slice), 1, slice);
+    va_decoder_add_buffer(stream->decoder, VASliceDataBufferType, nal_size, 1, (void *) nal);
+    return 0;
+}
+
+int
+h264_stream_decode(struct va_decoder *decoder, const uint8_t *data, size_t size)
+{
+    struct h264_stream *stream;
+    struct bit_reader br;
+    size_t pos, start, end, next, rbsp_size;
+    int type, ret = 0;
+
+    stream = calloc(1, sizeof(*stream));
+    if (NULL == stream) {
+        return -1;
+    }
+    stream->rbsp = malloc(size + 8);
+    if (NULL == stream->rbsp) {
+        free(stream);
+        return -1;
+    }
+    stream->decoder = decoder;
+    stream->current = -1;
+
+    for (pos = h264_next_start_code(data, size, 0); (pos < size) && !ret; pos = next) {
+        start = pos + 3;
+        next = h264_next_start_code(data, size, start);
+        /* NAL units end in a non-zero byte, zeros belong to the next start code */
+        end = next;
+        while ((end > start) && !data[end - 1]) {
+            end--;
+        }
+        if (end == start) {
+            continue;
+        }
+        type = data[start] & 0x1f;
+
+        /* Non-VCL units after the slices start the next access unit, 7.4.1.2.3 */
+        if (((type >= H264_NAL_SEI) && (type <= H264_NAL_END_OF_STREAM)) || ((type >= 14) && (type <= 18))) {
+            h264_finish_picture(stream);
+        }
+
+        rbsp_size = h264_unescape(data + start, end - start, stream->rbsp);
+        bit_reader_init(&br, stream->rbsp, rbsp_size, 8);
+        if (H264_NAL_SPS == type) {
+            ret = h264_parse_sps(stream, &br);
+        } else if (H264_NAL_PPS == type) {
+            ret = h264_parse_pps(stream, &br);
+        } else if ((H264_NAL_SLICE == type) || (H264_NAL_IDR_SLICE == type)) {
+            ret = h264_parse_slice(stream, data + start, end - start, rbsp_size);
+        }
+    }
+    if (!ret) {
+        h264_finish_picture(stream);
+        h264_flush(stream);
+    }
+
+    free(stream->rbsp);
+    free(stream);
+    return ret;
+}
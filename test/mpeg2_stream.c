@@ -0,0 +1,368 @@
+/*
+ * Copyright (c) 2012 Scott Tincman <sctincman@gmail.com>. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bit_reader.h"
+#include "mpeg2_stream.h"
+
+#define MPEG2_PICTURE_START     0x00
+#define MPEG2_SLICE_FIRST       0x01
+#define MPEG2_SLICE_LAST        0xaf
+#define MPEG2_SEQUENCE_HEADER   0xb3
+#define MPEG2_EXTENSION_START   0xb5
+#define MPEG2_SEQUENCE_END      0xb7
+
+#define MPEG2_EXT_SEQUENCE      1
+#define MPEG2_EXT_QUANT_MATRIX  3
+#define MPEG2_EXT_PICTURE       8
+
+#define MPEG2_I_PICTURE         1
+#define MPEG2_B_PICTURE         3
+
+#define MPEG2_FRAME_PICTURE     3
+
+/* Two anchors and the picture being decoded */
+#define MPEG2_NUM_SURFACES      3
+#define MPEG2_MAX_SLICES        1024
+
+/* Default intra matrix, in zigzag order like the bitstream */
+static const uint8_t mpeg2_default_intra_matrix[64] = {
+     8, 16, 16, 19, 16, 19, 22, 22, 22, 22, 22, 22, 26, 24, 26, 27,
+    27, 27, 26, 26, 26, 26, 27, 27, 27, 29, 29, 29, 34, 34, 34, 29,
+    29, 29, 27, 27, 29, 29, 32, 32, 34, 34, 37, 38, 37, 35, 35, 34,
+    35, 38, 38, 40, 40, 40, 48, 48, 46, 46, 56, 56, 58, 69, 69, 83
+};
+
+struct mpeg2_stream {
+    struct va_decoder *decoder;
+    const uint8_t *data;
+    size_t size;
+    VAProfile profile;
+    int width;
+    int height;
+    VAPictureParameterBufferMPEG2 picture;
+    VAIQMatrixBufferMPEG2 iq_matrix;
+    VASliceParameterBufferMPEG2 slices[MPEG2_MAX_SLICES];
+    int num_slices;
+    size_t picture_start;
+    int in_picture;
+    int target;
+    int anchors[2];     /* Surface indexes of the past and future anchor, -1 for none */
+};
+
+/*
+ * Returns the offset of the next start code prefix at or after pos, or size
+ */
+static size_t
+mpeg2_next_start_code(const uint8_t *data, size_t size, size_t pos)
+{
+    while ((pos + 3 < size) && !((0 == data[pos]) && (0 == data[pos + 1]) && (1 == data[pos + 2]))) {
+        pos++;
+    }
+    return (pos + 3 < size) ? pos : size;
+}
+
+static void
+mpeg2_read_matrix(struct bit_reader *br, unsigned char *matrix)
+{
+    int i;
+
+    for (i = 0; i < 64; i++) {
+        matrix[i] = bit_reader_bits(br, 8);
+    }
+}
+
+static int
+mpeg2_parse_sequence_header(struct mpeg2_stream *stream, struct bit_reader *br)
+{
+    VAIQMatrixBufferMPEG2 *iq = &stream->iq_matrix;
+
+    stream->width = bit_reader_bits(br, 12);
+    stream->height = bit_reader_bits(br, 12);
+    /* aspect_ratio_information to constrained_parameters_flag */
+    bit_reader_skip(br, 4 + 4 + 18 + 1 + 10 + 1);
+
+    iq->load_intra_quantiser_matrix = 1;
+    if (bit_reader_bit(br)) {
+        mpeg2_read_matrix(br, iq->intra_quantiser_matrix);
+    } else {
+        memcpy(iq->intra_quantiser_matrix, mpeg2_default_intra_matrix, 64);
+    }
+    iq->load_non_intra_quantiser_matrix = 1;
+    if (bit_reader_bit(br)) {
+        mpeg2_read_matrix(br, iq->non_intra_quantiser_matrix);
+    } else {
+        memset(iq->non_intra_quantiser_matrix, 16, 64);
+    }
+    iq->load_chroma_intra_quantiser_matrix = 0;
+    iq->load_chroma_non_intra_quantiser_matrix = 0;
+    return 0;
+}
+
+static int
+mpeg2_parse_extension(struct mpeg2_stream *stream, struct bit_reader *br)
+{
+    VAPictureParameterBufferMPEG2 *pic = &stream->picture;
+    VAIQMatrixBufferMPEG2 *iq = &stream->iq_matrix;
+
+    switch (bit_reader_bits(br, 4)) {
+    case MPEG2_EXT_SEQUENCE:
+        bit_reader_skip(br, 1);
+        /* Simple profile is 5, everything else decodes as Main */
+        stream->profile = (5 == bit_reader_bits(br, 3)) ? VAProfileMPEG2Simple : VAProfileMPEG2Main;
+        bit_reader_skip(br, 4 + 1);
+        if (1 != bit_reader_bits(br, 2)) {
+            fprintf(stderr, "mpeg2: only 4:2:0 streams are supported\n");
+            return -1;
+        }
+        stream->width |= bit_reader_bits(br, 2) << 12;
+        stream->height |= bit_reader_bits(br, 2) << 12;
+        break;
+
+    case MPEG2_EXT_QUANT_MATRIX:
+        if ((iq->load_intra_quantiser_matrix = bit_reader_bit(br))) {
+            mpeg2_read_matrix(br, iq->intra_quantiser_matrix);
+        }
+        if ((iq->load_non_intra_quantiser_matrix = bit_reader_bit(br))) {
+            mpeg2_read_matrix(br, iq->non_intra_quantiser_matrix);
+        }
+        if ((iq->load_chroma_intra_quantiser_matrix = bit_reader_bit(br))) {
+            mpeg2_read_matrix(br, iq->chroma_intra_quantiser_matrix);
+        }
+        if ((iq->load_chroma_non_intra_quantiser_matrix = bit_reader_bit(br))) {
+            mpeg2_read_matrix(br, iq->chroma_non_intra_quantiser_matrix);
+        }
+        break;
+
+    case MPEG2_EXT_PICTURE:
+        if (!stream->in_picture) {
+            break;
+        }
+        pic->f_code = bit_reader_bits(br, 16);
+        pic->picture_coding_extension.bits.intra_dc_precision = bit_reader_bits(br, 2);
+        pic->picture_coding_extension.bits.picture_structure = bit_reader_bits(br, 2);
+        pic->picture_coding_extension.bits.top_field_first = bit_reader_bit(br);
+        pic->picture_coding_extension.bits.frame_pred_frame_dct = bit_reader_bit(br);
+        pic->picture_coding_extension.bits.concealment_motion_vectors = bit_reader_bit(br);
+        pic->picture_coding_extension.bits.q_scale_type = bit_reader_bit(br);
+        pic->picture_coding_extension.bits.intra_vlc_format = bit_reader_bit(br);
+        pic->picture_coding_extension.bits.alternate_scan = bit_reader_bit(br);
+        pic->picture_coding_extension.bits.repeat_first_field = bit_reader_bit(br);
+        bit_reader_skip(br, 1); /* chroma_420_type */
+        pic->picture_coding_extension.bits.progressive_frame = bit_reader_bit(br);
+        pic->picture_coding_extension.bits.is_first_field = 1;
+        if (MPEG2_FRAME_PICTURE != pic->picture_coding_extension.bits.picture_structure) {
+            fprintf(stderr, "mpeg2: field pictures are not supported by this client\n");
+            return -1;
+        }
+        break;
+
+    default:
+        break;
+    }
+    return 0;
+}
+
+static int
+mpeg2_parse_picture_header(struct mpeg2_stream *stream, struct bit_reader *br, size_t pos)
+{
+    VAPictureParameterBufferMPEG2 *pic = &stream->picture;
+    struct va_decoder *decoder = stream->decoder;
+    int type;
+
+    if (!stream->width) {
+        fprintf(stderr, "mpeg2: picture before the sequence header\n");
+        return -1;
+    }
+    if (va_decoder_start(decoder, stream->profile, stream->width, stream->height, MPEG2_NUM_SURFACES)) {
+        return -1;
+    }
+
+    bit_reader_skip(br, 10); /* temporal_reference */
+    type = bit_reader_bits(br, 3);
+
+    memset(pic, 0, sizeof(*pic));
+    pic->horizontal_size = stream->width;
+    pic->vertical_size = stream->height;
+    pic->picture_coding_type = type;
+    /* MPEG-1 style pictures without a coding extension */
+    pic->f_code = 0xffff;
+    pic->picture_coding_extension.bits.picture_structure = MPEG2_FRAME_PICTURE;
+    pic->picture_coding_extension.bits.frame_pred_frame_dct = 1;
+    pic->picture_coding_extension.bits.progressive_frame = 1;
+    pic->picture_coding_extension.bits.is_first_field = 1;
+
+    /* Decode into the surface neither anchor uses */
+    for (stream->target = 0; (stream->target == stream->anchors[0]) || (stream->target == stream->anchors[1]);
+         stream->target++) {
+    }
+    pic->forward_reference_picture = VA_INVALID_SURFACE;
+    pic->backward_reference_picture = VA_INVALID_SURFACE;
+    if (MPEG2_B_PICTURE == type) {
+        if ((stream->anchors[0] < 0) || (stream->anchors[1] < 0)) {
+            return 0; /* Leading B pictures of an open GOP, skipped */
+        }
+        pic->forward_reference_picture = decoder->surfaces[stream->anchors[0]];
+        pic->backward_reference_picture = decoder->surfaces[stream->anchors[1]];
+    } else if (MPEG2_I_PICTURE != type) {
+        if (stream->anchors[1] < 0) {
+            fprintf(stderr, "mpeg2: P picture without an anchor\n");
+            return -1;
+        }
+        pic->forward_reference_picture = decoder->surfaces[stream->anchors[1]];
+    }
+
+    stream->num_slices = 0;
+    stream->picture_start = pos;
+    stream->in_picture = 1;
+    return 0;
+}
+
+static int
+mpeg2_parse_slice(struct mpeg2_stream *stream, struct bit_reader *br, size_t pos, int code)
+{
+    VASliceParameterBufferMPEG2 *slice;
+    size_t end;
+
+    if (stream->num_slices == MPEG2_MAX_SLICES) {
+        fprintf(stderr, "mpeg2: too many slices\n");
+        return -1;
+    }
+    slice = &stream->slices[stream->num_slices++];
+    memset(slice, 0, sizeof(*slice));
+
+    slice->slice_vertical_position = code - 1;
+    if (stream->height > 2800) {
+        slice->slice_vertical_position += bit_reader_bits(br, 3) << 7;
+    }
+    slice->quantiser_scale_code = bit_reader_bits(br, 5);
+    if (bit_reader_bit(br)) {
+        /* intra_slice and reserved bits, then extra_information_slice */
+        bit_reader_skip(br, 8);
+        while (bit_reader_bit(br)) {
+            bit_reader_skip(br, 8);
+        }
+    }
+
+    end = mpeg2_next_start_code(stream->data, stream->size, pos + 4);
+    slice->slice_data_offset = pos - stream->picture_start;
+    slice->slice_data_size = end - pos;
+    slice->macroblock_offset = br->pos - pos * 8;
+    slice->slice_data_flag = VA_SLICE_DATA_FLAG_ALL;
+    return 0;
+}
+
+/*
+ * Submits the picture collected so far and outputs whatever it makes
+ * displayable
+ */
+static void
+mpeg2_finish_picture(struct mpeg2_stream *stream, size_t end)
+{
+    struct va_decoder *decoder = stream->decoder;
+    VAIQMatrixBufferMPEG2 *iq = &stream->iq_matrix;
+
+    stream->in_picture = 0;
+    if (0 == stream->num_slices) {
+        return;
+    }
+
+    va_decoder_add_buffer(decoder, VAPictureParameterBufferType, sizeof(stream->picture), 1, &stream->picture);
+    va_decoder_add_buffer(decoder, VAIQMatrixBufferType, sizeof(*iq), 1, iq);
+    va_decoder_add_buffer(decoder, VASliceParameterBufferType, sizeof(stream->slices[0]), stream->num_slices,
+                          stream->slices);
+    va_decoder_add_buffer(decoder, VASliceDataBufferType, end - stream->picture_start, 1,
+                          (void *) (stream->data + stream->picture_start));
+    va_decoder_render(decoder, decoder->surfaces[stream->target]);
+
+    /* Matrices stay loaded until the next sequence header or matrix extension */
+    iq->load_intra_quantiser_matrix = 0;
+    iq->load_non_intra_quantiser_matrix = 0;
+    iq->load_chroma_intra_quantiser_matrix = 0;
+    iq->load_chroma_non_intra_quantiser_matrix = 0;
+
+    if (MPEG2_B_PICTURE == stream->picture.picture_coding_type) {
+        va_decoder_output_picture(decoder, decoder->surfaces[stream->target]);
+    } else {
+        /* A new anchor makes the previous one displayable */
+        if (stream->anchors[1] >= 0) {
+            va_decoder_output_picture(decoder, decoder->surfaces[stream->anchors[1]]);
+        }
+        stream->anchors[0] = stream->anchors[1];
+        stream->anchors[1] = stream->target;
+    }
+}
+
+int
+mpeg2_stream_decode(struct va_decoder *decoder, const uint8_t *data, size_t size)
+{
+    struct mpeg2_stream *stream;
+    struct bit_reader br;
+    size_t pos;
+    int code, ret = 0;
+
+    stream = calloc(1, sizeof(*stream));
+    if (NULL == stream) {
+        return -1;
+    }
+    stream->decoder = decoder;
+    stream->data = data;
+    stream->size = size;
+    stream->profile = VAProfileMPEG2Main;
+    stream->anchors[0] = -1;
+    stream->anchors[1] = -1;
+
+    for (pos = mpeg2_next_start_code(data, size, 0); (pos < size) && !ret;
+         pos = mpeg2_next_start_code(data, size, pos + 3)) {
+        code = data[pos + 3];
+        if (stream->in_picture && stream->num_slices &&
+            !((code >= MPEG2_SLICE_FIRST) && (code <= MPEG2_SLICE_LAST))) {
+            mpeg2_finish_picture(stream, pos);
+        }
+
+        bit_reader_init(&br, data, size, (pos + 4) * 8);
+        if (MPEG2_SEQUENCE_HEADER == code) {
+            ret = mpeg2_parse_sequence_header(stream, &br);
+        } else if (MPEG2_EXTENSION_START == code) {
+            ret = mpeg2_parse_extension(stream, &br);
+        } else if (MPEG2_PICTURE_START == code) {
+            ret = mpeg2_parse_picture_header(stream, &br, pos);
+        } else if ((code >= MPEG2_SLICE_FIRST) && (code <= MPEG2_SLICE_LAST) && stream->in_picture) {
+            ret = mpeg2_parse_slice(stream, &br, pos, code);
+        }
+    }
+    if (!ret) {
+        if (stream->in_picture) {
+            mpeg2_finish_picture(stream, size);
+        }
+        if (stream->anchors[1] >= 0) {
+            va_decoder_output_picture(decoder, decoder->surfaces[stream->anchors[1]]);
+        }
+    }
+
+    free(stream);
+    return ret;
+}
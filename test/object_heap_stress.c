@@ -0,0 +1,425 @@
+/*
+ * Copyright (c) 2012 Scott Tincman <sctincman@gmail.com>. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Multi-threaded stress test of object_heap_lookup().
+ *
+ * The first part measures lookup throughput over a fixed set of objects
+ * with 1 to STRESS_MAX_THREADS threads, next to the same lookups behind
+ * the heap mutex. The second part has readers look up live and stale IDs
+ * while a writer frees and allocates objects, and fails on any lookup
+ * that returns the wrong object or resolves a stale ID. The third part does
+ * the same while the writer keeps growing the heap and trimming it back, so
+ * lookups run into buckets that are being released. The last part reuses
+ * single slots and checks that none of their earlier IDs resolve again.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include "object_heap.h"
+
+#define STRESS_ID_OFFSET        0x30000000
+#define STRESS_OBJECTS          4096
+#define STRESS_LOOKUPS          (1 << 20)   /* Per thread and run */
+#define STRESS_MAX_THREADS      8
+#define STRESS_ROUNDS           1200        /* Past the 1024 generations of a slot */
+#define STRESS_BATCH            64
+#define STRESS_STALE            1024
+#define STRESS_EXTRA            256         /* Objects past the fixed set, trimmed every round */
+#define STRESS_REUSES           3           /* Reallocations of an extra slot before the trim */
+#define STRESS_TRIM_ROUNDS      300
+
+struct stress_object {
+    struct object_base base;
+    int index;
+};
+
+struct stress_thread {
+    pthread_t thread;
+    int seed;
+    int locked;
+    int *live;
+    int num_live;
+    unsigned long lookups;
+    unsigned long errors;
+};
+
+static struct object_heap heap;
+static int ids[STRESS_OBJECTS];
+static int extra[STRESS_EXTRA];
+static int stale[STRESS_STALE];
+static int num_stale;
+static int stop;
+
+static double
+stress_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * Returns the next value of a xorshift generator
+ */
+static unsigned int
+stress_random(unsigned int *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+/*
+ * Looks up STRESS_LOOKUPS IDs of the fixed set, checking each object
+ */
+static void *
+stress_lookup_thread(void *arg)
+{
+    struct stress_thread *self = arg;
+    unsigned int state = self->seed;
+    struct stress_object *obj;
+    int i, index;
+
+    for (i = 0; i < STRESS_LOOKUPS; i++) {
+        index = stress_random(&state) % STRESS_OBJECTS;
+        if (self->locked) {
+            pthread_mutex_lock(&heap.mutex);
+            obj = (struct stress_object *) object_heap_lookup(&heap, ids[index]);
+            pthread_mutex_unlock(&heap.mutex);
+        } else {
+            obj = (struct stress_object *) object_heap_lookup(&heap, ids[index]);
+        }
+        if (NULL == obj || obj->index != index) {
+            self->errors++;
+        }
+    }
+    self->lookups = STRESS_LOOKUPS;
+    return NULL;
+}
+
+/*
+ * Runs num_threads lookup threads
+ * Returns the lookups per second, or -1 if a lookup went wrong
+ */
+static double
+stress_run_lookups(int num_threads, int locked)
+{
+    struct stress_thread threads[STRESS_MAX_THREADS];
+    unsigned long lookups = 0, errors = 0;
+    double start;
+    int i;
+
+    start = stress_now();
+    for (i = 0; i < num_threads; i++) {
+        threads[i].seed = 2463534242u + i * 7919;
+        threads[i].locked = locked;
+        threads[i].lookups = 0;
+        threads[i].errors = 0;
+        pthread_create(&threads[i].thread, NULL, stress_lookup_thread, &threads[i]);
+    }
+    for (i = 0; i < num_threads; i++) {
+        pthread_join(threads[i].thread, NULL);
+        lookups += threads[i].lookups;
+        errors += threads[i].errors;
+    }
+    if (errors) {
+        printf("FAIL: %lu of %lu lookups returned the wrong object\n", errors, lookups);
+        return -1;
+    }
+    return lookups / (stress_now() - start);
+}
+
+/*
+ * Looks up current and stale IDs until the writer is done. A current ID may
+ * be freed under the reader at any time, so only its lookup is exercised,
+ * but an ID retired before the lookup started must never resolve.
+ */
+static void *
+stress_reader_thread(void *arg)
+{
+    struct stress_thread *self = arg;
+    unsigned int state = self->seed;
+    int index, id;
+
+    while (!__atomic_load_n(&stop, __ATOMIC_ACQUIRE)) {
+        index = stress_random(&state) % self->num_live;
+        id = __atomic_load_n(&self->live[index], __ATOMIC_ACQUIRE);
+        object_heap_lookup(&heap, id);
+
+        index = __atomic_load_n(&num_stale, __ATOMIC_ACQUIRE);
+        if (index) {
+            id = __atomic_load_n(&stale[stress_random(&state) % (index < STRESS_STALE ? index : STRESS_STALE)],
+                                 __ATOMIC_ACQUIRE);
+            if (object_heap_lookup(&heap, id)) {
+                self->errors++;
+            }
+        }
+        self->lookups += 2;
+    }
+    return NULL;
+}
+
+/*
+ * Frees an object and records its ID as stale
+ */
+static void
+stress_retire(int id)
+{
+    object_heap_free(&heap, object_heap_lookup(&heap, id));
+    __atomic_store_n(&stale[num_stale % STRESS_STALE], id, __ATOMIC_RELEASE);
+    __atomic_store_n(&num_stale, num_stale + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Frees and reallocates every object STRESS_ROUNDS times, STRESS_BATCH at a
+ * time, recording the IDs it retires
+ * Return 0 on success, -1 on error
+ */
+static int
+stress_churn(void)
+{
+    struct stress_object *obj;
+    int round, first, i, id;
+
+    for (round = 0; round < STRESS_ROUNDS; round++) {
+        for (first = 0; first < STRESS_OBJECTS; first += STRESS_BATCH) {
+            for (i = first; i < first + STRESS_BATCH; i++) {
+                stress_retire(ids[i]);
+            }
+            for (i = first; i < first + STRESS_BATCH; i++) {
+                id = object_heap_allocate(&heap);
+                if (-1 == id) {
+                    printf("FAIL: allocation failed\n");
+                    return -1;
+                }
+                obj = (struct stress_object *) object_heap_lookup(&heap, id);
+                obj->index = i;
+                __atomic_store_n(&ids[i], id, __ATOMIC_RELEASE);
+            }
+        }
+    }
+    return 0;
+}
+
+/*
+ * Grows the heap by STRESS_EXTRA objects, reallocates them a few times, then
+ * frees them all and trims the heap back, STRESS_TRIM_ROUNDS times. The IDs
+ * retired in one round must not resolve after the heap grows back over
+ * their slots in the next.
+ * Return 0 on success, -1 on error
+ */
+static int
+stress_trim_churn(void)
+{
+    int round, reuse, released, i, id;
+
+    for (round = 0; round < STRESS_TRIM_ROUNDS; round++) {
+        for (i = 0; i < STRESS_EXTRA; i++) {
+            id = object_heap_allocate(&heap);
+            if (-1 == id) {
+                printf("FAIL: allocation failed\n");
+                return -1;
+            }
+            __atomic_store_n(&extra[i], id, __ATOMIC_RELEASE);
+        }
+        for (i = 0; i < (num_stale < STRESS_STALE ? num_stale : STRESS_STALE); i++) {
+            if (object_heap_lookup(&heap, stale[i])) {
+                printf("FAIL: stale ID 0x%08x resolves after the heap grew back\n", stale[i]);
+                return -1;
+            }
+        }
+
+        for (reuse = 0; reuse < STRESS_REUSES; reuse++) {
+            for (i = 0; i < STRESS_EXTRA; i++) {
+                stress_retire(extra[i]);
+                __atomic_store_n(&extra[i], object_heap_allocate(&heap), __ATOMIC_RELEASE);
+            }
+        }
+        for (i = 0; i < STRESS_EXTRA; i++) {
+            stress_retire(extra[i]);
+        }
+
+        released = object_heap_trim(&heap);
+        if (released != STRESS_EXTRA) {
+            printf("FAIL: trim released %d slots instead of %d\n", released, STRESS_EXTRA);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Frees and reallocates the only slot of a heap for all but the last of its
+ * generations, no ID it had before may resolve. Then checks that a freed slot
+ * is only handed out again after the other free slots.
+ * Return 0 on success, -1 on error
+ */
+static int
+stress_stale_slot(void)
+{
+    int generations = (OBJECT_HEAP_GENERATION_MASK >> OBJECT_HEAP_GENERATION_SHIFT) + 1;
+    struct object_heap single;
+    int *history, i, j, id, first, ret = 0;
+
+    history = malloc(generations * sizeof(int));
+    if (NULL == history || object_heap_init_bucket_size(&single, sizeof(struct stress_object), STRESS_ID_OFFSET, 1)) {
+        printf("FAIL: cannot set up the heap\n");
+        free(history);
+        return -1;
+    }
+
+    history[0] = object_heap_allocate(&single);
+    for (i = 1; i < generations && !ret; i++) {
+        object_heap_free(&single, object_heap_lookup(&single, history[i - 1]));
+        history[i] = object_heap_allocate(&single);
+        if ((history[i] & OBJECT_HEAP_INDEX_MASK) != (history[0] & OBJECT_HEAP_INDEX_MASK)) {
+            printf("FAIL: a one-slot heap allocated ID 0x%08x\n", history[i]);
+            ret = -1;
+        }
+        for (j = 0; j < i; j++) {
+            if (object_heap_lookup(&single, history[j])) {
+                printf("FAIL: ID 0x%08x resolves after %d reuses of its slot\n", history[j], i - j);
+                ret = -1;
+                break;
+            }
+        }
+    }
+    printf("stale slot: %d reuses of one slot\n", i - 1);
+    object_heap_free(&single, object_heap_lookup(&single, history[i - 1]));
+    object_heap_destroy(&single);
+
+    /* Half of the first bucket stays free */
+    if (object_heap_init_bucket_size(&single, sizeof(struct stress_object), STRESS_ID_OFFSET, STRESS_BATCH) ||
+        object_heap_allocate_n(&single, STRESS_BATCH / 2, history)) {
+        printf("FAIL: cannot set up the heap\n");
+        free(history);
+        return -1;
+    }
+    first = history[0];
+    object_heap_free(&single, object_heap_lookup(&single, first));
+    for (i = 0; i < STRESS_BATCH / 2 && !ret; i++) {
+        id = object_heap_allocate(&single);
+        if ((id & OBJECT_HEAP_INDEX_MASK) == (first & OBJECT_HEAP_INDEX_MASK)) {
+            printf("FAIL: freed slot reused after %d of %d free slots\n", i, STRESS_BATCH / 2 + 1);
+            ret = -1;
+        }
+        object_heap_free(&single, object_heap_lookup(&single, id));
+    }
+    for (i = 1; i < STRESS_BATCH / 2; i++) {
+        object_heap_free(&single, object_heap_lookup(&single, history[i]));
+    }
+    object_heap_destroy(&single);
+    free(history);
+    return ret;
+}
+
+/*
+ * Runs the writer with STRESS_MAX_THREADS - 1 readers looking up live and
+ * stale IDs next to it
+ * Return 0 on success, -1 on error
+ */
+static int
+stress_run_churn(const char *name, int (*writer)(void), int *live, int num_live, int writes)
+{
+    struct stress_thread readers[STRESS_MAX_THREADS];
+    unsigned long lookups = 0, errors = 0;
+    int i, ret = 0;
+
+    __atomic_store_n(&stop, 0, __ATOMIC_RELEASE);
+    for (i = 0; i < STRESS_MAX_THREADS - 1; i++) {
+        readers[i].seed = 88172645u + i * 104729;
+        readers[i].live = live;
+        readers[i].num_live = num_live;
+        readers[i].lookups = 0;
+        readers[i].errors = 0;
+        pthread_create(&readers[i].thread, NULL, stress_reader_thread, &readers[i]);
+    }
+    if (writer()) {
+        ret = -1;
+    }
+    __atomic_store_n(&stop, 1, __ATOMIC_RELEASE);
+    for (i = 0; i < STRESS_MAX_THREADS - 1; i++) {
+        pthread_join(readers[i].thread, NULL);
+        lookups += readers[i].lookups;
+        errors += readers[i].errors;
+    }
+    printf("%s: %d frees and allocations, %lu concurrent lookups\n", name, writes, lookups);
+    if (errors) {
+        printf("FAIL: %lu lookups resolved a stale ID\n", errors);
+        ret = -1;
+    }
+    return ret;
+}
+
+int
+main(int argc, char **argv)
+{
+    struct stress_object *obj;
+    double wait_free, locked;
+    int num_threads, i, ret = 0;
+
+    if (object_heap_init(&heap, sizeof(struct stress_object), STRESS_ID_OFFSET) ||
+        object_heap_allocate_n(&heap, STRESS_OBJECTS, ids)) {
+        printf("FAIL: cannot set up the heap\n");
+        return 1;
+    }
+    for (i = 0; i < STRESS_OBJECTS; i++) {
+        obj = (struct stress_object *) object_heap_lookup(&heap, ids[i]);
+        obj->index = i;
+    }
+
+    printf("lookups of %d objects, millions per second:\n", STRESS_OBJECTS);
+    printf("  threads  wait-free  locked\n");
+    for (num_threads = 1; num_threads <= STRESS_MAX_THREADS; num_threads *= 2) {
+        wait_free = stress_run_lookups(num_threads, 0);
+        locked = stress_run_lookups(num_threads, 1);
+        if (wait_free < 0 || locked < 0) {
+            return 1;
+        }
+        printf("  %7d  %9.1f  %6.1f\n", num_threads, wait_free * 1e-6, locked * 1e-6);
+    }
+
+    if (stress_run_churn("churn", stress_churn, ids, STRESS_OBJECTS, STRESS_ROUNDS * STRESS_OBJECTS)) {
+        ret = 1;
+    }
+    if (stress_run_churn("trim churn", stress_trim_churn, extra, STRESS_EXTRA,
+                         STRESS_TRIM_ROUNDS * STRESS_EXTRA * (STRESS_REUSES + 1))) {
+        return 1; /* Objects may be left allocated, skip the teardown */
+    }
+
+    for (i = 0; i < STRESS_OBJECTS; i++) {
+        object_heap_free(&heap, object_heap_lookup(&heap, ids[i]));
+    }
+    object_heap_destroy(&heap);
+
+    if (stress_stale_slot()) {
+        ret = 1;
+    }
+    return ret;
+}
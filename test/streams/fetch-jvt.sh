@@ -0,0 +1,74 @@
+#!/bin/sh
+#
+# Downloads H.264 conformance bitstreams (ITU-T H.264.1) into jvt/, for
+# "make check" to run next to the streams kept in this directory. Each
+# stream is stored as jvt/<name>.264 with its decoded reference as
+# jvt/<name>.yuv.
+#
+# The default list holds the progressive CAVLC and CABAC streams of the
+# suite without slice groups or arbitrary slice order, which is what the
+# driver decodes. Other names can be given on the command line.
+#
+# usage: fetch-jvt.sh [name ...]
+# JVT_URL overrides where the zip files are downloaded from.
+
+JVT_URL=${JVT_URL:-https://www.itu.int/wftp3/av-arch/jvt-site/draft_conformance}
+
+STREAMS="
+BA1_Sony_D BA2_Sony_F BA_MW_D BANM_MW_D BA1_FT_C BAMQ1_JVC_C BAMQ2_JVC_E
+SVA_BA1_B SVA_BA2_D SVA_Base_B SVA_CL1_E SVA_NL1_B SVA_NL2_E
+NL1_Sony_D NL2_Sony_H LS_SVA_D MIDR_MW_D NRF_MW_E MPS_MW_A CI_MW_D
+CVPCMNL1_SVA_C CVPCMNL2_SVA_C NLMQ1_JVC_C NLMQ2_JVC_C CVBS3_Sony_C
+CVSE2_Sony_B CVSE3_Sony_H CVWP2_TOSHIBA_E CVFC1_Sony_C MR1_BT_A
+FRext/FRExt1_Panasonic_D FRext/FRExt2_Panasonic_C FRext/HPCV_BRCM_A
+FRext/HPCVNL_BRCM_A FRext/HPCVMOLQ_BRCM_B
+CABA1_SVA_B CABA1_Sony_D CABA2_SVA_B CABA2_Sony_E CABA3_SVA_B CABA3_Sony_C
+CABA3_TOSHIBA_E CABACI3_Sony_B CABAST3_Sony_E CABASTBR3_Sony_B
+CANL1_TOSHIBA_G CANL1_Sony_E CANL1_SVA_B CANL2_Sony_E CANL2_SVA_B
+CANL3_Sony_C CANL3_SVA_B CANL4_SVA_B CACQP3_Sony_D CAQP1_Sony_B
+CAPCMNL1_Sand_E CAPCM1_Sand_E CAWP1_TOSHIBA_E CAWP5_TOSHIBA_E
+camp_mot_frm0_full
+FRext/FRExt3_Panasonic_E FRext/FRExt4_Panasonic_B FRext/FRExt_MMCO4_Sony_B
+FRext/HCAFR1_HHI_C FRext/HCAFR2_HHI_A FRext/HCAFR3_HHI_A FRext/HCAFR4_HHI_A
+FRext/HPCA_BRCM_B FRext/HPCADQ_BRCM_B FRext/HPCALQ_BRCM_B FRext/HPCAQ2LQ_BRCM_B
+"
+
+cd "$(dirname "$0")" || exit 1
+mkdir -p jvt
+tmp=$(mktemp -d) || exit 1
+trap 'rm -rf "$tmp"' EXIT
+
+fetch() {
+    if command -v curl >/dev/null; then
+        curl -fsSL -o "$2" "$1"
+    else
+        wget -q -O "$2" "$1"
+    fi
+}
+
+failed=0
+for path in ${*:-$STREAMS}; do
+    name=$(basename "$path")
+    if [ -f "jvt/$name.264" ] && [ -f "jvt/$name.yuv" ]; then
+        continue
+    fi
+    rm -rf "$tmp/unpack" && mkdir "$tmp/unpack"
+    if ! fetch "$JVT_URL/$path.zip" "$tmp/$name.zip" || ! unzip -qo "$tmp/$name.zip" -d "$tmp/unpack"; then
+        echo "$name: download failed" >&2
+        failed=1
+        continue
+    fi
+    # Archives name their files inconsistently, take the largest of each kind
+    stream=$(find "$tmp/unpack" -type f \( -iname '*.264' -o -iname '*.h264' -o -iname '*.jsv' \
+             -o -iname '*.26l' -o -iname '*.avc' -o -iname '*.jvt' -o -iname '*.bit' \) \
+             -exec ls -S {} + | head -n 1)
+    yuv=$(find "$tmp/unpack" -type f -iname '*.yuv' -exec ls -S {} + | head -n 1)
+    if [ -z "$stream" ] || [ -z "$yuv" ]; then
+        echo "$name: no bitstream or reference YUV in the archive" >&2
+        failed=1
+        continue
+    fi
+    cp "$stream" "jvt/$name.264" && cp "$yuv" "jvt/$name.yuv"
+    echo "$name"
+done
+exit $failed
@@ -0,0 +1,45 @@
+#!/bin/sh
+#
+# Downloads VC-1 streams of the SMPTE conformance suite from the FFmpeg FATE
+# sample collection into vc1/, for bench/decode_bench to time a stream of
+# each profile the driver decodes. Simple and Main profile streams come in
+# the RCV container, Advanced profile ones as elementary streams; both are
+# stored as vc1/<name>.vc1.
+#
+# The default list holds progressive streams: SA00040 (Simple), SA10091
+# (Main) and SA20021 (Advanced). Other names can be given on the command
+# line.
+#
+# usage: fetch-vc1.sh [name ...]
+# FATE_URL overrides where the streams are downloaded from.
+
+FATE_URL=${FATE_URL:-https://fate-suite.ffmpeg.org/vc1}
+
+STREAMS="SA00040 SA10091 SA20021"
+
+cd "$(dirname "$0")" || exit 1
+mkdir -p vc1
+
+fetch() {
+    if command -v curl >/dev/null; then
+        curl -fsSL -o "$2" "$1"
+    else
+        wget -q -O "$2" "$1"
+    fi
+}
+
+failed=0
+for name in ${*:-$STREAMS}; do
+    if [ -f "vc1/$name.vc1" ]; then
+        continue
+    fi
+    if ! fetch "$FATE_URL/$name.vc1" "vc1/$name.vc1.part"; then
+        rm -f "vc1/$name.vc1.part"
+        echo "$name: download failed" >&2
+        failed=1
+        continue
+    fi
+    mv "vc1/$name.vc1.part" "vc1/$name.vc1"
+    echo "$name"
+done
+exit $failed
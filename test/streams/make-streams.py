@@ -0,0 +1,120 @@
+#!/usr/bin/env python3
+#
+# Regenerates the streams in this directory with PyAV (FFmpeg's encoders
+# and decoders), plus an .md5 file for each stream the driver must decode
+# bit-exactly. The content is a synthetic
+# moving scene, so the streams carry motion, texture and flat areas
+# without any third-party footage.
+#
+# usage: make-streams.py [name ...]
+
+import hashlib
+import os
+import sys
+
+import av
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+
+
+def scene(width, height, frames):
+    """Yields I420 frames of a textured background panning under a bouncing box"""
+    state = 1
+    texture = bytearray(width * height * 4)
+    for i in range(len(texture)):
+        state = (state * 1103515245 + 12345) & 0x7fffffff
+        texture[i] = (state >> 16) % 48
+    for n in range(frames):
+        bx = (n * 7) % (width - 64)
+        by = abs((n * 5) % (2 * (height - 64)) - (height - 64))
+        frame = av.VideoFrame(width, height, 'yuv420p')
+        for i, plane in enumerate(frame.planes):
+            pw = width if i == 0 else width // 2
+            ph = height if i == 0 else height // 2
+            data = bytearray(plane.line_size * ph)
+            for y in range(ph):
+                row = y * plane.line_size
+                for x in range(pw):
+                    if i == 0:
+                        if bx <= x < bx + 64 and by <= y < by + 64:
+                            v = 235 - (x % 16) * 4
+                        else:
+                            v = (x * 2 + y + n * 3) % 200 + texture[(y + n) * width * 2 + x + 2 * n]
+                    elif i == 1:
+                        v = 128 + (x + n) % 64 - 32
+                    else:
+                        v = 128 + (y - n) % 64 - 32
+                    data[row + x] = min(max(v, 16), 240)
+            plane.update(bytes(data))
+        yield frame
+
+
+def encode(name, codec, width, height, frames, options, **settings):
+    path = os.path.join(HERE, name)
+    with av.open(path, 'w', format=settings.pop('format')) as out:
+        stream = out.add_stream(codec, rate=25)
+        stream.width, stream.height = width, height
+        stream.pix_fmt = 'yuv420p'
+        stream.options = options
+        for key, value in settings.items():
+            setattr(stream.codec_context, key, value)
+        for frame in scene(width, height, frames):
+            out.mux(stream.encode(frame))
+        out.mux(stream.encode())
+
+
+def write_md5(name):
+    """One MD5 per decoded I420 frame, in display order"""
+    lines = []
+    with av.open(os.path.join(HERE, name)) as f:
+        for frame in f.decode(video=0):
+            md5 = hashlib.md5()
+            for i, plane in enumerate(frame.planes):
+                width = frame.width if i == 0 else (frame.width + 1) // 2
+                height = frame.height if i == 0 else (frame.height + 1) // 2
+                data = bytes(plane)
+                for y in range(height):
+                    md5.update(data[y * plane.line_size:y * plane.line_size + width])
+            lines.append(md5.hexdigest())
+    with open(os.path.join(HERE, name + '.md5'), 'w') as f:
+        f.write('\n'.join(lines) + '\n')
+
+
+# name: (generator, bit-exact). MPEG-2 leaves the IDCT rounding to the
+# decoder, the driver's output is within 1 of FFmpeg's, so those streams
+# get no .md5 and are only used for benchmarking.
+#
+# The H.264 streams cover CAVLC and CABAC, multiple slices and references,
+# B pyramids with memory management operations, temporal and spatial
+# direct, weighted prediction, 8x8 transforms, scaling matrices and frame
+# cropping.
+STREAMS = {
+    'mpeg2-main-cif.m2v': (lambda n: encode(n, 'mpeg2video', 352, 288, 30, {}, format='mpeg2video',
+                                            bit_rate=1500000, gop_size=12, max_b_frames=2), False),
+    'h264-baseline-cif.264': (lambda n: encode(n, 'libx264', 352, 288, 20, {
+        'profile': 'baseline', 'crf': '26',
+        'x264-params': 'slices=4:ref=3:keyint=10:min-keyint=10:scenecut=0'}, format='h264'), True),
+    'h264-main-crop.264': (lambda n: encode(n, 'libx264', 320, 180, 25, {
+        'profile': 'main', 'crf': '26',
+        'x264-params': 'cabac=0:bframes=3:b-pyramid=normal:ref=4:weightp=2:weightb=1:direct=temporal'},
+        format='h264'), True),
+    'h264-high-cif.264': (lambda n: encode(n, 'libx264', 352, 288, 25, {
+        'profile': 'high', 'crf': '24',
+        'x264-params': 'cabac=0:8x8dct=1:cqm=jvt:bframes=2:b-pyramid=none:ref=3:weightb=1:direct=spatial'},
+        format='h264'), True),
+    'h264-main-cabac.264': (lambda n: encode(n, 'libx264', 320, 240, 25, {
+        'profile': 'main', 'crf': '26',
+        'x264-params': 'bframes=3:b-pyramid=normal:ref=4:weightp=2:weightb=1:direct=temporal'},
+        format='h264'), True),
+    'h264-high-cabac-cif.264': (lambda n: encode(n, 'libx264', 352, 288, 25, {
+        'profile': 'high', 'crf': '22',
+        'x264-params': 'cabac-idc=2:slices=4:8x8dct=1:cqm=jvt:bframes=2:b-pyramid=none:ref=3:weightb=1:direct=spatial'},
+        format='h264'), True),
+}
+
+if __name__ == '__main__':
+    for name in sys.argv[1:] or STREAMS:
+        generate, exact = STREAMS[name]
+        generate(name)
+        if exact:
+            write_md5(name)
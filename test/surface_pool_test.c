@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2012 Scott Tincman <sctincman@gmail.com>. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Checks that surface_pool keeps storage of several resolutions cached at
+ * once, and that it evicts the least recently released storage once
+ * max_cached is reached.
+ */
+
+#include <stdio.h>
+#include "surface_pool.h"
+
+#define CHECK(expr)                                                     \
+    do {                                                                \
+        if (!(expr)) {                                                  \
+            fprintf(stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #expr); \
+            return 1;                                                   \
+        }                                                               \
+    } while (0)
+
+int
+main(int argc, char **argv)
+{
+    struct surface_pool pool;
+    struct surface_pool_stats stats;
+    struct surface_storage *sd, *hd, *cif, *storage;
+    size_t budget;
+
+    /* Probe the storage sizes, then size the cache for SD + HD only */
+    CHECK(surface_pool_init(&pool, 0, 0) == 0);
+    sd = surface_pool_alloc(&pool, 720, 576);
+    hd = surface_pool_alloc(&pool, 1920, 1080);
+    cif = surface_pool_alloc(&pool, 352, 288);
+    CHECK(sd && hd && cif);
+    budget = sd->size + hd->size;
+    surface_pool_release(&pool, sd);
+    surface_pool_release(&pool, hd);
+    surface_pool_release(&pool, cif);
+    surface_pool_get_stats(&pool, &stats);
+    CHECK(stats.bytes_cached == 0 && stats.bytes_in_use == 0);
+    surface_pool_destroy(&pool);
+
+    CHECK(surface_pool_init(&pool, budget, 0) == 0);
+
+    /* Two streams of different sizes alternating keep hitting */
+    sd = surface_pool_alloc(&pool, 720, 576);
+    hd = surface_pool_alloc(&pool, 1920, 1080);
+    surface_pool_release(&pool, sd);
+    surface_pool_release(&pool, hd);
+    storage = surface_pool_alloc(&pool, 720, 576);
+    CHECK(storage == sd);
+    surface_pool_release(&pool, storage);
+    storage = surface_pool_alloc(&pool, 1920, 1080);
+    CHECK(storage == hd);
+    surface_pool_release(&pool, storage);
+
+    /* A miss on a third size leaves both cached */
+    cif = surface_pool_alloc(&pool, 352, 288);
+    surface_pool_get_stats(&pool, &stats);
+    CHECK(stats.hits == 2 && stats.misses == 3);
+    CHECK(stats.bytes_cached == budget);
+
+    /* Releasing it evicts SD, released longest ago, and keeps HD */
+    surface_pool_release(&pool, cif);
+    surface_pool_get_stats(&pool, &stats);
+    CHECK(stats.bytes_cached == hd->size + cif->size);
+    storage = surface_pool_alloc(&pool, 1920, 1080);
+    CHECK(storage == hd);
+    surface_pool_release(&pool, storage);
+    storage = surface_pool_alloc(&pool, 352, 288);
+    CHECK(storage == cif);
+    surface_pool_release(&pool, storage);
+    surface_pool_get_stats(&pool, &stats);
+    CHECK(stats.hits == 4 && stats.misses == 3);
+
+    surface_pool_trim(&pool);
+    surface_pool_get_stats(&pool, &stats);
+    CHECK(stats.bytes_cached == 0);
+    surface_pool_destroy(&pool);
+
+    printf("surface_pool: OK\n");
+    return 0;
+}
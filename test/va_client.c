@@ -0,0 +1,242 @@
+/*
+ * Copyright (c) 2012 Scott Tincman <sctincman@gmail.com>. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "va_client.h"
+
+/* Not all VA-API versions define it */
+#ifndef VA_FOURCC_I420
+#define VA_FOURCC_I420  0x30323449
+#endif
+
+VAStatus VA_DRIVER_INIT_FUNC(VADriverContextP ctx);
+
+int
+va_client_open(struct va_client *client)
+{
+    memset(client, 0, sizeof(*client));
+    client->ctx = &client->context;
+    client->context.vtable = &client->vtable;
+    if (VA_STATUS_SUCCESS != VA_DRIVER_INIT_FUNC(client->ctx)) {
+        return -1;
+    }
+    return 0;
+}
+
+void
+va_client_close(struct va_client *client)
+{
+    client->vtable.vaTerminate(client->ctx);
+}
+
+void
+va_client_check(VAStatus status, const char *expr, const char *file, int line)
+{
+    if (VA_STATUS_SUCCESS != status) {
+        fprintf(stderr, "%s:%d: %s failed with status %d\n", file, line, expr, status);
+        exit(1);
+    }
+}
+
+uint8_t *
+va_client_load(const char *path, size_t *size)
+{
+    uint8_t *data;
+    FILE *f;
+    long n;
+
+    f = fopen(path, "rb");
+    if (NULL == f) {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    n = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    data = malloc(n + 8);
+    if (data && (fread(data, 1, n, f) != (size_t) n)) {
+        free(data);
+        data = NULL;
+    }
+    fclose(f);
+    if (data) {
+        memset(data + n, 0, 8);
+        *size = n;
+    }
+    return data;
+}
+
+double
+va_client_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void
+va_decoder_init(struct va_decoder *decoder, struct va_client *client)
+{
+    memset(decoder, 0, sizeof(*decoder));
+    decoder->client = client;
+    decoder->config = VA_INVALID_ID;
+    decoder->context = VA_INVALID_ID;
+}
+
+void
+va_decoder_set_attrib(struct va_decoder *decoder, VAConfigAttribType type, unsigned int value)
+{
+    if (decoder->num_attribs < VA_DECODER_MAX_ATTRIBS) {
+        decoder->attribs[decoder->num_attribs].type = type;
+        decoder->attribs[decoder->num_attribs].value = value;
+        decoder->num_attribs++;
+    }
+}
+
+int
+va_decoder_start(struct va_decoder *decoder, VAProfile profile, int width, int height, int num_surfaces)
+{
+    struct VADriverVTable *vtable = &decoder->client->vtable;
+    VADriverContextP ctx = decoder->client->ctx;
+
+    if ((VA_INVALID_ID != decoder->context) && (decoder->profile == profile) &&
+        (decoder->width == width) && (decoder->height == height)) {
+        return 0;
+    }
+    va_decoder_stop(decoder);
+    if (num_surfaces > VA_DECODER_MAX_SURFACES) {
+        return -1;
+    }
+
+    if (VA_STATUS_SUCCESS != vtable->vaCreateConfig(ctx, profile, VAEntrypointVLD, decoder->attribs,
+                                                     decoder->num_attribs, &decoder->config)) {
+        return -1;
+    }
+    VA_CHECK(vtable->vaCreateSurfaces(ctx, width, height, VA_RT_FORMAT_YUV420, num_surfaces, decoder->surfaces));
+    VA_CHECK(vtable->vaCreateContext(ctx, decoder->config, width, height, VA_PROGRESSIVE,
+                                     decoder->surfaces, num_surfaces, &decoder->context));
+    decoder->profile = profile;
+    decoder->width = width;
+    decoder->height = height;
+    decoder->crop_x = 0;
+    decoder->crop_y = 0;
+    decoder->crop_width = width;
+    decoder->crop_height = height;
+    decoder->num_surfaces = num_surfaces;
+    return 0;
+}
+
+void
+va_decoder_add_buffer(struct va_decoder *decoder, VABufferType type, unsigned int size,
+                      unsigned int num_elements, void *data)
+{
+    if (decoder->num_buffers == VA_DECODER_MAX_BUFFERS) {
+        fprintf(stderr, "too many buffers in one picture\n");
+        exit(1);
+    }
+    VA_CHECK(decoder->client->vtable.vaCreateBuffer(decoder->client->ctx, decoder->context, type, size,
+                                                    num_elements, data, &decoder->buffers[decoder->num_buffers]));
+    decoder->num_buffers++;
+}
+
+void
+va_decoder_render(struct va_decoder *decoder, VASurfaceID target)
+{
+    struct VADriverVTable *vtable = &decoder->client->vtable;
+    VADriverContextP ctx = decoder->client->ctx;
+    int i;
+
+    VA_CHECK(vtable->vaBeginPicture(ctx, decoder->context, target));
+    VA_CHECK(vtable->vaRenderPicture(ctx, decoder->context, decoder->buffers, decoder->num_buffers));
+    VA_CHECK(vtable->vaEndPicture(ctx, decoder->context));
+    for (i = 0; i < decoder->num_buffers; i++) {
+        vtable->vaDestroyBuffer(ctx, decoder->buffers[i]);
+    }
+    decoder->num_buffers = 0;
+    decoder->num_pictures++;
+}
+
+void
+va_decoder_output_picture(struct va_decoder *decoder, VASurfaceID surface)
+{
+    VA_CHECK(decoder->client->vtable.vaSyncSurface(decoder->client->ctx, surface));
+    if (decoder->output) {
+        decoder->output(decoder, surface, decoder->output_data);
+    }
+}
+
+void
+va_decoder_read_i420(struct va_decoder *decoder, VASurfaceID surface, uint8_t *i420)
+{
+    struct VADriverVTable *vtable = &decoder->client->vtable;
+    VADriverContextP ctx = decoder->client->ctx;
+    VAImageFormat format;
+    VAImage image;
+    uint8_t *data, *dst;
+    int plane, width, height, y;
+
+    memset(&format, 0, sizeof(format));
+    format.fourcc = VA_FOURCC_I420;
+    format.byte_order = VA_LSB_FIRST;
+    format.bits_per_pixel = 12;
+    VA_CHECK(vtable->vaCreateImage(ctx, &format, decoder->crop_width, decoder->crop_height, &image));
+    VA_CHECK(vtable->vaGetImage(ctx, surface, decoder->crop_x, decoder->crop_y, decoder->crop_width,
+                                decoder->crop_height, image.image_id));
+    VA_CHECK(vtable->vaMapBuffer(ctx, image.buf, (void **) &data));
+
+    dst = i420;
+    for (plane = 0; plane < 3; plane++) {
+        width = plane ? (decoder->crop_width + 1) / 2 : decoder->crop_width;
+        height = plane ? (decoder->crop_height + 1) / 2 : decoder->crop_height;
+        for (y = 0; y < height; y++) {
+            memcpy(dst, data + image.offsets[plane] + y * image.pitches[plane], width);
+            dst += width;
+        }
+    }
+
+    vtable->vaUnmapBuffer(ctx, image.buf);
+    vtable->vaDestroyImage(ctx, image.image_id);
+}
+
+void
+va_decoder_stop(struct va_decoder *decoder)
+{
+    struct VADriverVTable *vtable = &decoder->client->vtable;
+    VADriverContextP ctx = decoder->client->ctx;
+
+    if (VA_INVALID_ID != decoder->context) {
+        vtable->vaDestroyContext(ctx, decoder->context);
+        vtable->vaDestroySurfaces(ctx, decoder->surfaces, decoder->num_surfaces);
+        decoder->context = VA_INVALID_ID;
+        decoder->num_surfaces = 0;
+    }
+    if (VA_INVALID_ID != decoder->config) {
+        vtable->vaDestroyConfig(ctx, decoder->config);
+        decoder->config = VA_INVALID_ID;
+    }
+}
@@ -0,0 +1,153 @@
+/*
+ * Copyright (c) 2012 Scott Tincman <sctincman@gmail.com>. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * A minimal VA client for the programs in test/ and bench/. It calls the
+ * driver's init function directly instead of going through libva, and
+ * drives a decode context one picture at a time for the stream parsers.
+ */
+
+#ifndef VA_CLIENT_H
+#define VA_CLIENT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <va/va_backend.h>
+
+#define VA_DECODER_MAX_ATTRIBS      8
+#define VA_DECODER_MAX_SURFACES     32
+#define VA_DECODER_MAX_BUFFERS      1024
+
+/* Exits with a message when a VA call fails */
+#define VA_CHECK(expr)  va_client_check((expr), #expr, __FILE__, __LINE__)
+
+struct va_client {
+    struct VADriverContext context;
+    struct VADriverVTable vtable;
+    VADriverContextP ctx;
+};
+
+struct va_decoder;
+
+/* Called for every decoded picture, in display order */
+typedef void (*va_decoder_output)(struct va_decoder *decoder, VASurfaceID surface, void *data);
+
+struct va_decoder {
+    struct va_client *client;
+    VAConfigAttrib attribs[VA_DECODER_MAX_ATTRIBS];
+    int num_attribs;
+    VAProfile profile;
+    VAConfigID config;
+    VAContextID context;
+    VASurfaceID surfaces[VA_DECODER_MAX_SURFACES];
+    int num_surfaces;
+    int width;
+    int height;
+    int crop_x;                 /* Area read back, the whole surface unless the stream crops it */
+    int crop_y;
+    int crop_width;
+    int crop_height;
+    VABufferID buffers[VA_DECODER_MAX_BUFFERS];
+    int num_buffers;
+    va_decoder_output output;
+    void *output_data;
+    int num_pictures;
+};
+
+/*
+ * Initializes the driver
+ * Return 0 on success, -1 on error
+ */
+int
+va_client_open(struct va_client *client);
+
+void
+va_client_close(struct va_client *client);
+
+void
+va_client_check(VAStatus status, const char *expr, const char *file, int line);
+
+/*
+ * Reads a whole file, the buffer is padded with 8 zero bytes
+ * Returns the contents on success, returns NULL on error
+ */
+uint8_t *
+va_client_load(const char *path, size_t *size);
+
+/*
+ * Returns a monotonic time in seconds
+ */
+double
+va_client_now(void);
+
+void
+va_decoder_init(struct va_decoder *decoder, struct va_client *client);
+
+/*
+ * Adds a config attribute, before va_decoder_start()
+ */
+void
+va_decoder_set_attrib(struct va_decoder *decoder, VAConfigAttribType type, unsigned int value);
+
+/*
+ * Creates the config, num_surfaces surfaces and the context. Does nothing if
+ * the decoder was already started with the same profile and size.
+ * Return 0 on success, -1 on error
+ */
+int
+va_decoder_start(struct va_decoder *decoder, VAProfile profile, int width, int height, int num_surfaces);
+
+/*
+ * Creates a buffer for the picture being collected
+ */
+void
+va_decoder_add_buffer(struct va_decoder *decoder, VABufferType type, unsigned int size,
+                      unsigned int num_elements, void *data);
+
+/*
+ * Decodes the collected buffers into target, without waiting for the result
+ */
+void
+va_decoder_render(struct va_decoder *decoder, VASurfaceID target);
+
+/*
+ * Hands a decoded picture to the output callback
+ */
+void
+va_decoder_output_picture(struct va_decoder *decoder, VASurfaceID surface);
+
+/*
+ * Reads back the crop area of a surface as I420, crop_width * crop_height
+ * luma bytes followed by the two chroma planes
+ */
+void
+va_decoder_read_i420(struct va_decoder *decoder, VASurfaceID surface, uint8_t *i420);
+
+/*
+ * Destroys the context, the surfaces and the config
+ */
+void
+va_decoder_stop(struct va_decoder *decoder);
+
+#endif /* VA_CLIENT_H */
@@ -0,0 +1,1257 @@
+/*
+ * Copyright (c) 2012 Scott Tincman <sctincman@gmail.com>. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * VC-1 parser for the test and benchmark programs. It reads the sequence,
+ * entry point and picture headers, decodes the bitplanes into the VA
+ * bitplane buffer and submits one picture at a time, which is what a VA
+ * client has to do before the driver's macroblock layer takes over.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bit_reader.h"
+#include "vc1_stream.h"
+
+#define VC1_PROFILE_SIMPLE      0
+#define VC1_PROFILE_MAIN        1
+#define VC1_PROFILE_ADVANCED    3
+
+/* Advanced profile start codes */
+#define VC1_END_OF_SEQUENCE     0x0a
+#define VC1_SLICE               0x0b
+#define VC1_FIELD               0x0c
+#define VC1_FRAME               0x0d
+#define VC1_ENTRY_POINT         0x0e
+#define VC1_SEQUENCE_HEADER     0x0f
+
+/* picture_fields.bits.picture_type */
+#define VC1_PICTURE_I           0
+#define VC1_PICTURE_P           1
+#define VC1_PICTURE_B           2
+#define VC1_PICTURE_BI          3
+#define VC1_PICTURE_SKIPPED     4
+
+/* Bitplane coding modes, 8.7.3.2 */
+#define VC1_IMODE_RAW           0
+#define VC1_IMODE_NORM2         1
+#define VC1_IMODE_DIFF2         2
+#define VC1_IMODE_NORM6         3
+#define VC1_IMODE_DIFF6         4
+#define VC1_IMODE_ROWSKIP       5
+#define VC1_IMODE_COLSKIP       6
+
+/* The bitplanes, by their bit in the nibble a macroblock of the VA buffer */
+#define VC1_BP_DIRECTMB         0       /* B */
+#define VC1_BP_ACPRED           1       /* I and BI */
+#define VC1_BP_SKIPMB           1       /* P and B */
+#define VC1_BP_OVERFLAGS        2       /* I and BI */
+#define VC1_BP_MVTYPEMB         2       /* P */
+#define VC1_NUM_BITPLANES       3
+
+/* dq_profile */
+#define VC1_DQPROFILE_DOUBLE_EDGES  1
+#define VC1_DQPROFILE_SINGLE_EDGE   2
+#define VC1_DQPROFILE_ALL_MBS       3
+
+/* conditional_overlap_flag */
+#define VC1_CONDOVER_SELECT     2
+
+/* BFRACTION codes past the fractions */
+#define VC1_BFRACTION_RESERVED  21
+#define VC1_BFRACTION_BI        22
+
+/* The RCV container, Annex L */
+#define VC1_RCV_HEADER_SIZE     36
+#define VC1_RCV_FRAME_HEADER    8
+#define VC1_RCV_MARKER          0xc5
+
+#define VC1_NORM6_BITS          13
+
+/* Two anchors and the picture being decoded */
+#define VC1_NUM_SURFACES        3
+#define VC1_MAX_SLICES          512
+
+/* PQUANT from PQINDEX with the implicit quantizer, Table 36 */
+static const uint8_t vc1_pquant_implicit[32] = {
+     0,  1,  2,  3,  4,  5,  6,  7,  8,  6,  7,  8,  9, 10, 11, 12,
+    13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 27, 29, 31
+};
+
+/* MVMODE and MVMODE2 of P pictures, by PQUANT > 12 then the code index */
+static const uint8_t vc1_mv_mode[2][5] = {
+    { VAMvMode1MvHalfPelBilinear, VAMvMode1Mv, VAMvMode1MvHalfPel, VAMvModeIntensityCompensation, VAMvModeMixedMv },
+    { VAMvMode1Mv, VAMvModeMixedMv, VAMvMode1MvHalfPel, VAMvModeIntensityCompensation, VAMvMode1MvHalfPelBilinear }
+};
+
+static const uint8_t vc1_mv_mode2[2][4] = {
+    { VAMvMode1MvHalfPelBilinear, VAMvMode1Mv, VAMvMode1MvHalfPel, VAMvModeMixedMv },
+    { VAMvMode1Mv, VAMvModeMixedMv, VAMvMode1MvHalfPel, VAMvMode1MvHalfPelBilinear }
+};
+
+/* Norm-6 and Diff-6 codes of a tile, bit i is macroblock i in raster order, Table 81 */
+static const uint16_t vc1_norm6_codes[64] = {
+    0x001, 0x002, 0x003, 0x000, 0x004, 0x001, 0x002, 0x047, 0x005, 0x003, 0x004, 0x04b, 0x005, 0x04d, 0x04e, 0x30e,
+    0x006, 0x006, 0x007, 0x053, 0x008, 0x055, 0x056, 0x30d, 0x009, 0x059, 0x05a, 0x30c, 0x05c, 0x30b, 0x30a, 0x037,
+    0x007, 0x00a, 0x00b, 0x043, 0x00c, 0x045, 0x046, 0x309, 0x00d, 0x049, 0x04a, 0x308, 0x04c, 0x307, 0x306, 0x036,
+    0x00e, 0x051, 0x052, 0x305, 0x054, 0x304, 0x303, 0x035, 0x058, 0x302, 0x301, 0x034, 0x300, 0x033, 0x032, 0x007
+};
+
+static const uint8_t vc1_norm6_lengths[64] = {
+     1,  4,  4,  8,  4,  8,  8, 10,  4,  8,  8, 10,  8, 10, 10, 13,
+     4,  8,  8, 10,  8, 10, 10, 13,  8, 10, 10, 13, 10, 13, 13,  9,
+     4,  8,  8, 10,  8, 10, 10, 13,  8, 10, 10, 13, 10, 13, 13,  9,
+     8, 10, 10, 13, 10, 13, 13,  9, 10, 13, 13,  9, 13,  9,  9,  6
+};
+
+struct vc1_stream {
+    struct va_decoder *decoder;
+    const uint8_t *data;
+    size_t size;
+    VAProfile va_profile;
+    int profile;
+    int width;              /* Coded size */
+    int height;
+    int mb_width;
+    int mb_height;
+
+    /* Sequence layer */
+    int pulldown;
+    int interlace;
+    int tfcntrflag;
+    int finterpflag;
+    int psf;
+    int postprocflag;
+    int hrd_param_flag;
+    int num_leaky_buckets;
+    int multires;
+    int syncmarker;
+    int rangered;
+    int max_b_frames;
+    int overlap;
+
+    /* Entry point layer, or the sequence layer of the Simple and Main profiles */
+    int have_entry_point;
+    int broken_link;
+    int closed_entry;
+    int panscan_flag;
+    int refdist_flag;
+    int loopfilter;
+    int fastuvmc;
+    int extended_mv;
+    int extended_dmv;
+    int dquant;
+    int vstransform;
+    int quantizer;
+    int range_mapy;         /* -1 when absent */
+    int range_mapuv;
+
+    int rnd;                /* Rounding control of the Simple and Main profiles */
+    int16_t norm6_table[1 << VC1_NORM6_BITS];  /* Tile and code length, by the next 13 bits */
+    uint8_t *planes[VC1_NUM_BITPLANES];         /* One byte a macroblock */
+    int planes_present;     /* Bitplanes of the picture that go in the VA buffer */
+    uint8_t *bitplane;      /* The VA buffer, two macroblocks a byte */
+    uint8_t *rbsp;          /* Picture and slice headers without emulation prevention bytes */
+    size_t rbsp_size;
+
+    VAPictureParameterBufferVC1 picture;
+    VASliceParameterBufferVC1 slices[VC1_MAX_SLICES];
+    int num_slices;
+    size_t picture_start;
+    size_t picture_end;
+    int in_picture;
+    int skip_picture;       /* B pictures without both anchors */
+    int target;
+    int anchors[2];         /* Surface indexes of the past and future anchor, -1 for none */
+};
+
+/*
+ * Returns the offset of the next start code prefix at or after pos, or size
+ */
+static size_t
+vc1_next_start_code(const uint8_t *data, size_t size, size_t pos)
+{
+    while ((pos + 3 < size) && !((0 == data[pos]) && (0 == data[pos + 1]) && (1 == data[pos + 2]))) {
+        pos++;
+    }
+    return (pos + 3 < size) ? pos : size;
+}
+
+/*
+ * Copies up to max bytes of an Advanced profile BDU without its emulation
+ * prevention bytes to stream->rbsp, the copy is padded with 8 zero bytes
+ * Returns the size copied, returns -1 on allocation failure
+ */
+static long
+vc1_unescape(struct vc1_stream *stream, const uint8_t *data, size_t size, size_t max)
+{
+    size_t i, n = 0;
+    int zeros = 0;
+
+    if (stream->rbsp_size < max + 8) {
+        uint8_t *rbsp = realloc(stream->rbsp, max + 8);
+
+        if (NULL == rbsp) {
+            return -1;
+        }
+        stream->rbsp = rbsp;
+        stream->rbsp_size = max + 8;
+    }
+    for (i = 0; (i < size) && (n < max); i++) {
+        if ((zeros >= 2) && (3 == data[i]) && (i + 1 < size) && (data[i + 1] < 4)) {
+            zeros = 0;
+            continue;
+        }
+        stream->rbsp[n++] = data[i];
+        zeros = data[i] ? 0 : zeros + 1;
+    }
+    memset(stream->rbsp + n, 0, 8);
+    return n;
+}
+
+/* Codes '0', '10' and '11' */
+static int
+vc1_read_012(struct bit_reader *br)
+{
+    if (!bit_reader_bit(br)) {
+        return 0;
+    }
+    return 1 + bit_reader_bit(br);
+}
+
+/* Counts the bits up to one equal to stop, at most max */
+static int
+vc1_read_unary(struct bit_reader *br, int stop, int max)
+{
+    int n = 0;
+
+    while ((n < max) && (bit_reader_bit(br) != stop)) {
+        n++;
+    }
+    return n;
+}
+
+static void
+vc1_init_norm6_table(struct vc1_stream *stream)
+{
+    int i, j, shift;
+
+    for (i = 0; i < 64; i++) {
+        shift = VC1_NORM6_BITS - vc1_norm6_lengths[i];
+        for (j = 0; j < (1 << shift); j++) {
+            stream->norm6_table[(vc1_norm6_codes[i] << shift) | j] = (i << 4) | vc1_norm6_lengths[i];
+        }
+    }
+}
+
+/* One Norm-6 tile, -1 for an invalid code */
+static int
+vc1_read_norm6(struct vc1_stream *stream, struct bit_reader *br)
+{
+    struct bit_reader peek = *br;
+    int entry = stream->norm6_table[bit_reader_bits(&peek, VC1_NORM6_BITS)];
+
+    if (0 == entry) {
+        return -1;
+    }
+    bit_reader_skip(br, entry & 15);
+    return entry >> 4;
+}
+
+/* Rows of a plane area, each is all zeros or coded raw */
+static void
+vc1_read_rowskip(struct bit_reader *br, uint8_t *plane, int stride, int width, int height)
+{
+    int x, y;
+
+    for (y = 0; y < height; y++, plane += stride) {
+        if (bit_reader_bit(br)) {
+            for (x = 0; x < width; x++) {
+                plane[x] = bit_reader_bit(br);
+            }
+        } else {
+            memset(plane, 0, width);
+        }
+    }
+}
+
+static void
+vc1_read_colskip(struct bit_reader *br, uint8_t *plane, int stride, int width, int height)
+{
+    int x, y;
+
+    for (x = 0; x < width; x++) {
+        if (bit_reader_bit(br)) {
+            for (y = 0; y < height; y++) {
+                plane[y * stride + x] = bit_reader_bit(br);
+            }
+        } else {
+            for (y = 0; y < height; y++) {
+                plane[y * stride + x] = 0;
+            }
+        }
+    }
+}
+
+/*
+ * 8.7, reads a bitplane into plane, one byte a macroblock
+ * Returns 1 when the bitplane is coded raw in the macroblock layer, 0 when
+ * it was read, -1 on error
+ */
+static int
+vc1_read_bitplane(struct vc1_stream *stream, struct bit_reader *br, uint8_t *plane)
+{
+    int width = stream->mb_width;
+    int height = stream->mb_height;
+    int invert, imode, code, x, y, i;
+
+    invert = bit_reader_bit(br);
+    if (bit_reader_bit(br)) {
+        imode = bit_reader_bit(br) ? VC1_IMODE_NORM6 : VC1_IMODE_NORM2;
+    } else if (bit_reader_bit(br)) {
+        imode = bit_reader_bit(br) ? VC1_IMODE_COLSKIP : VC1_IMODE_ROWSKIP;
+    } else if (bit_reader_bit(br)) {
+        imode = VC1_IMODE_DIFF2;
+    } else {
+        imode = bit_reader_bit(br) ? VC1_IMODE_DIFF6 : VC1_IMODE_RAW;
+    }
+
+    switch (imode) {
+    case VC1_IMODE_RAW:
+        return 1;
+
+    case VC1_IMODE_NORM2:
+    case VC1_IMODE_DIFF2:
+        /* Pairs in raster order, after a lone first one if the count is odd */
+        i = 0;
+        if ((width * height) & 1) {
+            plane[i++] = bit_reader_bit(br);
+        }
+        for (; i < width * height; i += 2) {
+            if (!bit_reader_bit(br)) {
+                plane[i] = 0;
+                plane[i + 1] = 0;
+            } else if (bit_reader_bit(br)) {
+                plane[i] = 1;
+                plane[i + 1] = 1;
+            } else {
+                code = bit_reader_bit(br);
+                plane[i] = !code;
+                plane[i + 1] = code;
+            }
+        }
+        break;
+
+    case VC1_IMODE_NORM6:
+    case VC1_IMODE_DIFF6:
+        if ((0 == height % 3) && (0 != width % 3)) {
+            /* Tiles 2 wide and 3 high, a column left of them if the width is odd */
+            for (y = 0; y < height; y += 3) {
+                for (x = width & 1; x < width; x += 2) {
+                    code = vc1_read_norm6(stream, br);
+                    if (code < 0) {
+                        return -1;
+                    }
+                    for (i = 0; i < 6; i++) {
+                        plane[(y + i / 2) * width + x + i % 2] = (code >> i) & 1;
+                    }
+                }
+            }
+            vc1_read_colskip(br, plane, width, width & 1, height);
+        } else {
+            /* Tiles 3 wide and 2 high, columns left of them and a row above */
+            for (y = height & 1; y < height; y += 2) {
+                for (x = width % 3; x < width; x += 3) {
+                    code = vc1_read_norm6(stream, br);
+                    if (code < 0) {
+                        return -1;
+                    }
+                    for (i = 0; i < 6; i++) {
+                        plane[(y + i / 3) * width + x + i % 3] = (code >> i) & 1;
+                    }
+                }
+            }
+            vc1_read_colskip(br, plane, width, width % 3, height);
+            vc1_read_rowskip(br, plane + width % 3, width, width - width % 3, height & 1);
+        }
+        break;
+
+    case VC1_IMODE_ROWSKIP:
+        vc1_read_rowskip(br, plane, width, width, height);
+        break;
+
+    case VC1_IMODE_COLSKIP:
+        vc1_read_colskip(br, plane, width, width, height);
+        break;
+    }
+
+    if ((VC1_IMODE_DIFF2 == imode) || (VC1_IMODE_DIFF6 == imode)) {
+        /* 8.7.3.7, the inverse differential operation */
+        for (y = 0; y < height; y++) {
+            for (x = 0; x < width; x++) {
+                i = y * width + x;
+                if (0 == x && 0 == y) {
+                    plane[i] ^= invert;
+                } else if (0 == y) {
+                    plane[i] ^= plane[i - 1];
+                } else if (0 == x) {
+                    plane[i] ^= plane[i - width];
+                } else if (plane[i - 1] != plane[i - width]) {
+                    plane[i] ^= invert;
+                } else {
+                    plane[i] ^= plane[i - 1];
+                }
+            }
+        }
+    } else if (invert) {
+        for (i = 0; i < width * height; i++) {
+            plane[i] ^= 1;
+        }
+    }
+    return bit_reader_overrun(br) ? -1 : 0;
+}
+
+/*
+ * Reads one of the picture's bitplanes
+ * Returns 1 when it is coded raw in the macroblock layer, 0 when it goes in
+ * the VA bitplane buffer, -1 on error
+ */
+static int
+vc1_parse_bitplane(struct vc1_stream *stream, struct bit_reader *br, int index)
+{
+    int raw = vc1_read_bitplane(stream, br, stream->planes[index]);
+
+    if (raw < 0) {
+        fprintf(stderr, "vc1: invalid bitplane\n");
+        return -1;
+    }
+    if (!raw) {
+        stream->planes_present |= 1 << index;
+    }
+    return raw;
+}
+
+/* Reallocates the bitplanes for a new coded size */
+static int
+vc1_set_size(struct vc1_stream *stream, int width, int height)
+{
+    size_t count;
+    int i;
+
+    if ((width == stream->width) && (height == stream->height)) {
+        return 0;
+    }
+    stream->width = width;
+    stream->height = height;
+    stream->mb_width = (width + 15) / 16;
+    stream->mb_height = (height + 15) / 16;
+    count = (size_t) stream->mb_width * stream->mb_height;
+    for (i = 0; i < VC1_NUM_BITPLANES; i++) {
+        free(stream->planes[i]);
+        stream->planes[i] = calloc(1, count);
+    }
+    free(stream->bitplane);
+    stream->bitplane = calloc(1, (count + 1) / 2);
+    for (i = 0; i < VC1_NUM_BITPLANES; i++) {
+        if (NULL == stream->planes[i]) {
+            return -1;
+        }
+    }
+    return (NULL == stream->bitplane) ? -1 : 0;
+}
+
+/* BFRACTION, Table 40 */
+static int
+vc1_read_bfraction(struct bit_reader *br)
+{
+    int code = bit_reader_bits(br, 3);
+
+    if (code < 7) {
+        return code;
+    }
+    return 7 + (((code << 4) | bit_reader_bits(br, 4)) - 0x70);
+}
+
+/* VOPDQUANT, 7.1.1.31 */
+static void
+vc1_parse_vopdquant(struct vc1_stream *stream, struct bit_reader *br)
+{
+    VAPictureParameterBufferVC1 *pic = &stream->picture;
+    int pqdiff;
+
+    if (2 != stream->dquant) {
+        pic->pic_quantizer_fields.bits.dq_frame = bit_reader_bit(br);
+        if (!pic->pic_quantizer_fields.bits.dq_frame) {
+            return;
+        }
+        pic->pic_quantizer_fields.bits.dq_profile = bit_reader_bits(br, 2);
+        switch (pic->pic_quantizer_fields.bits.dq_profile) {
+        case VC1_DQPROFILE_DOUBLE_EDGES:
+            pic->pic_quantizer_fields.bits.dq_db_edge = bit_reader_bits(br, 2);
+            break;
+        case VC1_DQPROFILE_SINGLE_EDGE:
+            pic->pic_quantizer_fields.bits.dq_sb_edge = bit_reader_bits(br, 2);
+            break;
+        case VC1_DQPROFILE_ALL_MBS:
+            pic->pic_quantizer_fields.bits.dq_binary_level = bit_reader_bit(br);
+            if (!pic->pic_quantizer_fields.bits.dq_binary_level) {
+                /* Every macroblock codes its own quantizer, like the reference decoder drop HALFQP */
+                pic->pic_quantizer_fields.bits.half_qp = 0;
+                return;
+            }
+            break;
+        }
+    }
+    pqdiff = bit_reader_bits(br, 3);
+    if (7 == pqdiff) {
+        pic->pic_quantizer_fields.bits.alt_pic_quantizer = bit_reader_bits(br, 5);
+    } else {
+        pic->pic_quantizer_fields.bits.alt_pic_quantizer = pic->pic_quantizer_fields.bits.pic_quantizer_scale +
+                                                            pqdiff + 1;
+    }
+}
+
+/*
+ * The progressive picture layer from PQINDEX on, the same for all profiles
+ * but for where MVRANGE goes and the bitplanes of I pictures
+ */
+static int
+vc1_parse_picture_body(struct vc1_stream *stream, struct bit_reader *br)
+{
+    VAPictureParameterBufferVC1 *pic = &stream->picture;
+    int type = pic->picture_fields.bits.picture_type;
+    int intra = (VC1_PICTURE_I == type) || (VC1_PICTURE_BI == type);
+    int advanced = (VC1_PROFILE_ADVANCED == stream->profile);
+    int pqindex, pq, raw, lowquant, mode, mode2 = 0;
+
+    pqindex = bit_reader_bits(br, 5);
+    if (0 == pqindex) {
+        fprintf(stderr, "vc1: invalid PQINDEX\n");
+        return -1;
+    }
+    pq = (0 == stream->quantizer) ? vc1_pquant_implicit[pqindex] : pqindex;
+    pic->pic_quantizer_fields.bits.pic_quantizer_scale = pq;
+    if (pqindex <= 8) {
+        pic->pic_quantizer_fields.bits.half_qp = bit_reader_bit(br);
+    }
+    switch (stream->quantizer) {
+    case 0:
+        pic->pic_quantizer_fields.bits.pic_quantizer_type = (pqindex <= 8);
+        break;
+    case 1:
+        pic->pic_quantizer_fields.bits.pic_quantizer_type = bit_reader_bit(br);
+        break;
+    case 2:
+        pic->pic_quantizer_fields.bits.pic_quantizer_type = 0;
+        break;
+    default:
+        pic->pic_quantizer_fields.bits.pic_quantizer_type = 1;
+        break;
+    }
+    if (advanced) {
+        if (stream->postprocflag) {
+            pic->post_processing = bit_reader_bits(br, 2);
+        }
+    } else if (stream->extended_mv) {
+        pic->mv_fields.bits.extended_mv_range = vc1_read_unary(br, 0, 3);
+    }
+
+    if (intra) {
+        /* The Simple and Main profiles code ACPRED in the macroblock layer, without overlap control */
+        if (advanced) {
+            raw = vc1_parse_bitplane(stream, br, VC1_BP_ACPRED);
+            if (raw < 0) {
+                return -1;
+            }
+            pic->raw_coding.flags.ac_pred = raw;
+            pic->bitplane_present.flags.bp_ac_pred = !raw;
+            if (stream->overlap && (pq <= 8)) {
+                pic->conditional_overlap_flag = vc1_read_012(br);
+                if (VC1_CONDOVER_SELECT == pic->conditional_overlap_flag) {
+                    raw = vc1_parse_bitplane(stream, br, VC1_BP_OVERFLAGS);
+                    if (raw < 0) {
+                        return -1;
+                    }
+                    pic->raw_coding.flags.overflags = raw;
+                    pic->bitplane_present.flags.bp_overflags = !raw;
+                }
+            }
+        } else {
+            pic->raw_coding.flags.ac_pred = 1;
+        }
+    } else {
+        if (advanced && stream->extended_mv) {
+            pic->mv_fields.bits.extended_mv_range = vc1_read_unary(br, 0, 3);
+        }
+        if (VC1_PICTURE_P == type) {
+            lowquant = (pq <= 12);
+            mode = vc1_mv_mode[lowquant][vc1_read_unary(br, 1, 4)];
+            if (VAMvModeIntensityCompensation == mode) {
+                mode2 = vc1_mv_mode2[lowquant][vc1_read_unary(br, 1, 3)];
+                pic->luma_scale = bit_reader_bits(br, 6);
+                pic->luma_shift = bit_reader_bits(br, 6);
+                pic->picture_fields.bits.intensity_compensation = 1;
+            }
+            pic->mv_fields.bits.mv_mode = mode;
+            pic->mv_fields.bits.mv_mode2 = mode2;
+            if ((VAMvModeMixedMv == mode) ||
+                ((VAMvModeIntensityCompensation == mode) && (VAMvModeMixedMv == mode2))) {
+                raw = vc1_parse_bitplane(stream, br, VC1_BP_MVTYPEMB);
+                if (raw < 0) {
+                    return -1;
+                }
+                pic->raw_coding.flags.mv_type_mb = raw;
+                pic->bitplane_present.flags.bp_mv_type_mb = !raw;
+            }
+        } else {
+            pic->mv_fields.bits.mv_mode = bit_reader_bit(br) ? VAMvMode1Mv : VAMvMode1MvHalfPelBilinear;
+            raw = vc1_parse_bitplane(stream, br, VC1_BP_DIRECTMB);
+            if (raw < 0) {
+                return -1;
+            }
+            pic->raw_coding.flags.direct_mb = raw;
+            pic->bitplane_present.flags.bp_direct_mb = !raw;
+        }
+        raw = vc1_parse_bitplane(stream, br, VC1_BP_SKIPMB);
+        if (raw < 0) {
+            return -1;
+        }
+        pic->raw_coding.flags.skip_mb = raw;
+        pic->bitplane_present.flags.bp_skip_mb = !raw;
+        pic->mv_fields.bits.mv_table = bit_reader_bits(br, 2);
+        pic->cbp_table = bit_reader_bits(br, 2);
+        if (stream->dquant) {
+            vc1_parse_vopdquant(stream, br);
+        }
+        if (stream->vstransform) {
+            pic->transform_fields.bits.mb_level_transform_type_flag = bit_reader_bit(br);
+            if (pic->transform_fields.bits.mb_level_transform_type_flag) {
+                pic->transform_fields.bits.frame_level_transform_type = bit_reader_bits(br, 2);
+            }
+        }
+    }
+
+    pic->transform_fields.bits.transform_ac_codingset_idx1 = vc1_read_012(br);
+    if (intra) {
+        pic->transform_fields.bits.transform_ac_codingset_idx2 = vc1_read_012(br);
+    }
+    pic->transform_fields.bits.intra_transform_dc_table = bit_reader_bit(br);
+    if (intra && advanced && stream->dquant) {
+        vc1_parse_vopdquant(stream, br);
+    }
+    if (bit_reader_overrun(br)) {
+        fprintf(stderr, "vc1: truncated picture header\n");
+        return -1;
+    }
+    return 0;
+}
+
+/* Sets the fields of the VA picture parameters the sequence and entry point layers give */
+static void
+vc1_init_picture(struct vc1_stream *stream)
+{
+    VAPictureParameterBufferVC1 *pic = &stream->picture;
+
+    memset(pic, 0, sizeof(*pic));
+    pic->forward_reference_picture = VA_INVALID_SURFACE;
+    pic->backward_reference_picture = VA_INVALID_SURFACE;
+    pic->inloop_decoded_picture = VA_INVALID_SURFACE;
+    pic->sequence_fields.bits.pulldown = stream->pulldown;
+    pic->sequence_fields.bits.interlace = stream->interlace;
+    pic->sequence_fields.bits.tfcntrflag = stream->tfcntrflag;
+    pic->sequence_fields.bits.finterpflag = stream->finterpflag;
+    pic->sequence_fields.bits.psf = stream->psf;
+    pic->sequence_fields.bits.multires = stream->multires;
+    pic->sequence_fields.bits.overlap = stream->overlap;
+    pic->sequence_fields.bits.syncmarker = stream->syncmarker;
+    pic->sequence_fields.bits.rangered = stream->rangered;
+    pic->sequence_fields.bits.max_b_frames = stream->max_b_frames;
+    pic->sequence_fields.bits.profile = stream->profile;
+    pic->coded_width = stream->width;
+    pic->coded_height = stream->height;
+    pic->entrypoint_fields.bits.broken_link = stream->broken_link;
+    pic->entrypoint_fields.bits.closed_entry = stream->closed_entry;
+    pic->entrypoint_fields.bits.panscan_flag = stream->panscan_flag;
+    pic->entrypoint_fields.bits.loopfilter = stream->loopfilter;
+    pic->fast_uvmc_flag = stream->fastuvmc;
+    if (stream->range_mapy >= 0) {
+        pic->range_mapping_fields.bits.luma_flag = 1;
+        pic->range_mapping_fields.bits.luma = stream->range_mapy;
+    }
+    if (stream->range_mapuv >= 0) {
+        pic->range_mapping_fields.bits.chroma_flag = 1;
+        pic->range_mapping_fields.bits.chroma = stream->range_mapuv;
+    }
+    pic->reference_fields.bits.reference_distance_flag = stream->refdist_flag;
+    pic->mv_fields.bits.extended_mv_flag = stream->extended_mv;
+    pic->mv_fields.bits.extended_dmv_flag = stream->extended_dmv;
+    pic->pic_quantizer_fields.bits.dquant = stream->dquant;
+    pic->pic_quantizer_fields.bits.quantizer = stream->quantizer;
+    pic->transform_fields.bits.variable_sized_transform_flag = stream->vstransform;
+    stream->planes_present = 0;
+}
+
+/*
+ * Picks the target surface and the references of the parsed picture and
+ * starts collecting its slices
+ * Return 0 on success, -1 on error
+ */
+static int
+vc1_start_picture(struct vc1_stream *stream, size_t pos)
+{
+    VAPictureParameterBufferVC1 *pic = &stream->picture;
+    struct va_decoder *decoder = stream->decoder;
+    int type = pic->picture_fields.bits.picture_type;
+
+    /* Decode into the surface neither anchor uses */
+    for (stream->target = 0; (stream->target == stream->anchors[0]) || (stream->target == stream->anchors[1]);
+         stream->target++) {
+    }
+    stream->skip_picture = 0;
+    if ((VC1_PICTURE_B == type) || (VC1_PICTURE_BI == type)) {
+        if ((stream->anchors[0] < 0) || (stream->anchors[1] < 0)) {
+            stream->skip_picture = 1; /* Leading B pictures of an open entry point */
+        } else {
+            pic->forward_reference_picture = decoder->surfaces[stream->anchors[0]];
+            pic->backward_reference_picture = decoder->surfaces[stream->anchors[1]];
+        }
+    } else if (VC1_PICTURE_I != type) {
+        if (stream->anchors[1] < 0) {
+            fprintf(stderr, "vc1: P picture without an anchor\n");
+            return -1;
+        }
+        pic->forward_reference_picture = decoder->surfaces[stream->anchors[1]];
+    }
+
+    stream->num_slices = 0;
+    stream->picture_start = pos;
+    stream->in_picture = 1;
+    return 0;
+}
+
+static int
+vc1_add_slice(struct vc1_stream *stream, size_t pos, size_t end, int macroblock_offset, int row)
+{
+    VASliceParameterBufferVC1 *slice;
+
+    if (stream->num_slices == VC1_MAX_SLICES) {
+        fprintf(stderr, "vc1: too many slices\n");
+        return -1;
+    }
+    slice = &stream->slices[stream->num_slices++];
+    slice->slice_data_offset = pos - stream->picture_start;
+    slice->slice_data_size = end - pos;
+    slice->slice_data_flag = VA_SLICE_DATA_FLAG_ALL;
+    slice->macroblock_offset = macroblock_offset;
+    slice->slice_vertical_position = row;
+    stream->picture_end = end;
+    return 0;
+}
+
+/*
+ * Submits the picture collected so far and outputs whatever it makes
+ * displayable
+ */
+static void
+vc1_finish_picture(struct vc1_stream *stream)
+{
+    struct va_decoder *decoder = stream->decoder;
+    int type = stream->picture.picture_fields.bits.picture_type;
+    int count = stream->mb_width * stream->mb_height;
+    int i, n, bits;
+
+    stream->in_picture = 0;
+    if (stream->skip_picture || (0 == stream->num_slices)) {
+        return;
+    }
+
+    va_decoder_add_buffer(decoder, VAPictureParameterBufferType, sizeof(stream->picture), 1, &stream->picture);
+    if (stream->planes_present) {
+        /* The first macroblock of a pair in the high nibble */
+        for (n = 0; n < count; n++) {
+            bits = 0;
+            for (i = 0; i < VC1_NUM_BITPLANES; i++) {
+                if (stream->planes_present & (1 << i)) {
+                    bits |= stream->planes[i][n] << i;
+                }
+            }
+            if (n & 1) {
+                stream->bitplane[n >> 1] |= bits;
+            } else {
+                stream->bitplane[n >> 1] = bits << 4;
+            }
+        }
+        va_decoder_add_buffer(decoder, VABitPlaneBufferType, (count + 1) / 2, 1, stream->bitplane);
+    }
+    va_decoder_add_buffer(decoder, VASliceParameterBufferType, sizeof(stream->slices[0]), stream->num_slices,
+                          stream->slices);
+    va_decoder_add_buffer(decoder, VASliceDataBufferType, stream->picture_end - stream->picture_start, 1,
+                          (void *) (stream->data + stream->picture_start));
+    va_decoder_render(decoder, decoder->surfaces[stream->target]);
+
+    if ((VC1_PICTURE_B == type) || (VC1_PICTURE_BI == type)) {
+        va_decoder_output_picture(decoder, decoder->surfaces[stream->target]);
+    } else {
+        /* A new anchor makes the previous one displayable */
+        if (stream->anchors[1] >= 0) {
+            va_decoder_output_picture(decoder, decoder->surfaces[stream->anchors[1]]);
+        }
+        stream->anchors[0] = stream->anchors[1];
+        stream->anchors[1] = stream->target;
+    }
+}
+
+/* Creates the surfaces for the current coded size */
+static int
+vc1_start_decoder(struct vc1_stream *stream)
+{
+    struct va_decoder *decoder = stream->decoder;
+
+    if (va_decoder_start(decoder, stream->va_profile, stream->mb_width * 16, stream->mb_height * 16,
+                         VC1_NUM_SURFACES)) {
+        return -1;
+    }
+    decoder->crop_width = stream->width;
+    decoder->crop_height = stream->height;
+    return 0;
+}
+
+/* STRUCT_C of an RCV file, the sequence layer of the Simple and Main profiles, Annex J */
+static int
+vc1_parse_struct_c(struct vc1_stream *stream, struct bit_reader *br)
+{
+    stream->profile = bit_reader_bits(br, 2);
+    if (VC1_PROFILE_SIMPLE == stream->profile) {
+        stream->va_profile = VAProfileVC1Simple;
+    } else if (VC1_PROFILE_MAIN == stream->profile) {
+        stream->va_profile = VAProfileVC1Main;
+    } else {
+        fprintf(stderr, "vc1: profile %d in an RCV file\n", stream->profile);
+        return -1;
+    }
+    bit_reader_skip(br, 2 + 3 + 5);     /* Reserved, FRMRTQ_POSTPROC, BITRTQ_POSTPROC */
+    stream->loopfilter = bit_reader_bit(br);
+    bit_reader_skip(br, 1);
+    stream->multires = bit_reader_bit(br);
+    bit_reader_skip(br, 1);
+    stream->fastuvmc = bit_reader_bit(br);
+    stream->extended_mv = bit_reader_bit(br);
+    stream->dquant = bit_reader_bits(br, 2);
+    stream->vstransform = bit_reader_bit(br);
+    bit_reader_skip(br, 1);
+    stream->overlap = bit_reader_bit(br);
+    stream->syncmarker = bit_reader_bit(br);
+    stream->rangered = bit_reader_bit(br);
+    stream->max_b_frames = bit_reader_bits(br, 3);
+    stream->quantizer = bit_reader_bits(br, 2);
+    stream->finterpflag = bit_reader_bit(br);
+    stream->range_mapy = -1;
+    stream->range_mapuv = -1;
+    if (stream->multires) {
+        fprintf(stderr, "vc1: multiresolution coding is not supported\n");
+        return -1;
+    }
+    return 0;
+}
+
+/* The progressive picture layer of the Simple and Main profiles, 7.1.1 */
+static int
+vc1_parse_rcv_picture(struct vc1_stream *stream, struct bit_reader *br)
+{
+    VAPictureParameterBufferVC1 *pic = &stream->picture;
+    int type, bfraction = 0;
+
+    vc1_init_picture(stream);
+    if (stream->finterpflag) {
+        bit_reader_skip(br, 1);         /* INTERPFRM */
+    }
+    bit_reader_skip(br, 2);             /* FRMCNT */
+    if (stream->rangered && bit_reader_bit(br)) {
+        fprintf(stderr, "vc1: range reduced pictures are not supported\n");
+        return -1;
+    }
+    if (bit_reader_bit(br)) {
+        type = VC1_PICTURE_P;
+    } else if (stream->max_b_frames && !bit_reader_bit(br)) {
+        type = VC1_PICTURE_B;
+        bfraction = vc1_read_bfraction(br);
+        if (VC1_BFRACTION_BI == bfraction) {
+            type = VC1_PICTURE_BI;
+            bfraction = 0;
+        } else if (VC1_BFRACTION_RESERVED == bfraction) {
+            fprintf(stderr, "vc1: invalid BFRACTION\n");
+            return -1;
+        }
+    } else {
+        type = VC1_PICTURE_I;
+    }
+    if ((VC1_PICTURE_I == type) || (VC1_PICTURE_BI == type)) {
+        bit_reader_skip(br, 7);         /* BF */
+    }
+    pic->picture_fields.bits.picture_type = type;
+    pic->b_picture_fraction = bfraction;
+
+    /* Rounding control is implicit, reset by I pictures and toggled by P pictures, 8.3.7 */
+    if ((VC1_PICTURE_I == type) || (VC1_PICTURE_BI == type)) {
+        stream->rnd = 1;
+    } else if (VC1_PICTURE_P == type) {
+        stream->rnd ^= 1;
+    }
+    pic->rounding_control = stream->rnd;
+    return vc1_parse_picture_body(stream, br);
+}
+
+static int
+vc1_decode_rcv(struct vc1_stream *stream)
+{
+    const uint8_t *data = stream->data;
+    struct bit_reader br;
+    size_t pos, frame_size;
+
+    bit_reader_init(&br, data + 8, 4, 0);
+    if (vc1_parse_struct_c(stream, &br) ||
+        vc1_set_size(stream, data[16] | (data[17] << 8) | (data[18] << 16) | ((uint32_t) data[19] << 24),
+                     data[12] | (data[13] << 8) | (data[14] << 16) | ((uint32_t) data[15] << 24))) {
+        return -1;
+    }
+    if ((0 == stream->width) || (0 == stream->height) || (stream->width > 8192) || (stream->height > 8192)) {
+        fprintf(stderr, "vc1: invalid picture size %dx%d\n", stream->width, stream->height);
+        return -1;
+    }
+    if (vc1_start_decoder(stream)) {
+        return -1;
+    }
+
+    for (pos = VC1_RCV_HEADER_SIZE; pos + VC1_RCV_FRAME_HEADER <= stream->size; pos += frame_size) {
+        frame_size = data[pos] | (data[pos + 1] << 8) | (data[pos + 2] << 16);
+        pos += VC1_RCV_FRAME_HEADER;
+        if (frame_size > stream->size - pos) {
+            fprintf(stderr, "vc1: truncated frame\n");
+            return -1;
+        }
+
+        /* A frame with no more than a byte repeats the previous one */
+        if (frame_size <= 1) {
+            vc1_init_picture(stream);
+            stream->picture.picture_fields.bits.picture_type = VC1_PICTURE_SKIPPED;
+            bit_reader_init(&br, data + pos, frame_size, 0);
+        } else {
+            bit_reader_init(&br, data + pos, frame_size, 0);
+            if (vc1_parse_rcv_picture(stream, &br)) {
+                return -1;
+            }
+        }
+        if (vc1_start_picture(stream, pos) ||
+            vc1_add_slice(stream, pos, pos + frame_size, br.pos, 0)) {
+            return -1;
+        }
+        vc1_finish_picture(stream);
+    }
+    return 0;
+}
+
+/* The sequence layer of the Advanced profile, 6.1 */
+static int
+vc1_parse_sequence_header(struct vc1_stream *stream, struct bit_reader *br)
+{
+    int width, height, i;
+
+    stream->profile = bit_reader_bits(br, 2);
+    if (VC1_PROFILE_ADVANCED != stream->profile) {
+        fprintf(stderr, "vc1: profile %d in an elementary stream\n", stream->profile);
+        return -1;
+    }
+    stream->va_profile = VAProfileVC1Advanced;
+    bit_reader_skip(br, 3);             /* LEVEL */
+    if (1 != bit_reader_bits(br, 2)) {
+        fprintf(stderr, "vc1: only 4:2:0 is supported\n");
+        return -1;
+    }
+    bit_reader_skip(br, 3 + 5);         /* FRMRTQ_POSTPROC, BITRTQ_POSTPROC */
+    stream->postprocflag = bit_reader_bit(br);
+    width = (bit_reader_bits(br, 12) + 1) * 2;
+    height = (bit_reader_bits(br, 12) + 1) * 2;
+    stream->pulldown = bit_reader_bit(br);
+    stream->interlace = bit_reader_bit(br);
+    stream->tfcntrflag = bit_reader_bit(br);
+    stream->finterpflag = bit_reader_bit(br);
+    bit_reader_skip(br, 1);
+    stream->psf = bit_reader_bit(br);
+    if (bit_reader_bit(br)) {
+        /* DISPLAY_EXT */
+        bit_reader_skip(br, 14 + 14);
+        if (bit_reader_bit(br) && (15 == bit_reader_bits(br, 4))) {
+            bit_reader_skip(br, 8 + 8);
+        }
+        if (bit_reader_bit(br)) {
+            bit_reader_skip(br, bit_reader_bit(br) ? 16 : 8 + 4);
+        }
+        if (bit_reader_bit(br)) {
+            bit_reader_skip(br, 8 + 8 + 8);
+        }
+    }
+    stream->hrd_param_flag = bit_reader_bit(br);
+    stream->num_leaky_buckets = 0;
+    if (stream->hrd_param_flag) {
+        stream->num_leaky_buckets = bit_reader_bits(br, 5);
+        bit_reader_skip(br, 4 + 4);
+        for (i = 0; i < stream->num_leaky_buckets; i++) {
+            bit_reader_skip(br, 16 + 16);
+        }
+    }
+    if (stream->interlace) {
+        fprintf(stderr, "vc1: interlaced sequences are not supported\n");
+        return -1;
+    }
+    stream->have_entry_point = 0;
+    return vc1_set_size(stream, width, height);
+}
+
+/* The entry point layer, 6.2 */
+static int
+vc1_parse_entry_point(struct vc1_stream *stream, struct bit_reader *br)
+{
+    int width = stream->width, height = stream->height;
+
+    if (VC1_PROFILE_ADVANCED != stream->profile) {
+        fprintf(stderr, "vc1: entry point before the sequence header\n");
+        return -1;
+    }
+    stream->broken_link = bit_reader_bit(br);
+    stream->closed_entry = bit_reader_bit(br);
+    stream->panscan_flag = bit_reader_bit(br);
+    stream->refdist_flag = bit_reader_bit(br);
+    stream->loopfilter = bit_reader_bit(br);
+    stream->fastuvmc = bit_reader_bit(br);
+    stream->extended_mv = bit_reader_bit(br);
+    stream->dquant = bit_reader_bits(br, 2);
+    stream->vstransform = bit_reader_bit(br);
+    stream->overlap = bit_reader_bit(br);
+    stream->quantizer = bit_reader_bits(br, 2);
+    if (stream->hrd_param_flag) {
+        bit_reader_skip(br, 8 * stream->num_leaky_buckets);
+    }
+    if (bit_reader_bit(br)) {
+        width = (bit_reader_bits(br, 12) + 1) * 2;
+        height = (bit_reader_bits(br, 12) + 1) * 2;
+    }
+    stream->extended_dmv = stream->extended_mv ? bit_reader_bit(br) : 0;
+    stream->range_mapy = bit_reader_bit(br) ? (int) bit_reader_bits(br, 3) : -1;
+    stream->range_mapuv = bit_reader_bit(br) ? (int) bit_reader_bits(br, 3) : -1;
+    stream->have_entry_point = 1;
+    return vc1_set_size(stream, width, height);
+}
+
+/* The progressive picture layer of the Advanced profile up to PQINDEX, 7.1.1 */
+static int
+vc1_parse_frame_header(struct vc1_stream *stream, struct bit_reader *br)
+{
+    static const int types[5] = {
+        VC1_PICTURE_P, VC1_PICTURE_B, VC1_PICTURE_I, VC1_PICTURE_BI, VC1_PICTURE_SKIPPED
+    };
+    VAPictureParameterBufferVC1 *pic = &stream->picture;
+    int type, rptfrm = 0;
+
+    vc1_init_picture(stream);
+    type = types[vc1_read_unary(br, 0, 4)];
+    pic->picture_fields.bits.picture_type = type;
+    if (stream->tfcntrflag) {
+        bit_reader_skip(br, 8);         /* TFCNTR */
+    }
+    if (stream->pulldown) {
+        rptfrm = bit_reader_bits(br, 2);
+    }
+    if (stream->panscan_flag && bit_reader_bit(br)) {
+        bit_reader_skip(br, (rptfrm + 1) * (18 + 18 + 14 + 14));
+    }
+    if (VC1_PICTURE_SKIPPED == type) {
+        return 0;
+    }
+    pic->rounding_control = bit_reader_bit(br);
+    if (stream->finterpflag) {
+        bit_reader_skip(br, 1);         /* INTERPFRM */
+    }
+    if (VC1_PICTURE_B == type) {
+        pic->b_picture_fraction = vc1_read_bfraction(br);
+        if (pic->b_picture_fraction >= VC1_BFRACTION_RESERVED) {
+            fprintf(stderr, "vc1: invalid BFRACTION\n");
+            return -1;
+        }
+    }
+    return vc1_parse_picture_body(stream, br);
+}
+
+/* Upper bound on the bytes of a picture header, the bitplanes take under 3 bits a macroblock each */
+static size_t
+vc1_max_header_size(struct vc1_stream *stream)
+{
+    return (9 * (size_t) stream->mb_width * stream->mb_height + 2048) / 8;
+}
+
+static int
+vc1_parse_frame(struct vc1_stream *stream, size_t pos, size_t end)
+{
+    struct bit_reader br;
+    long size;
+
+    if (!stream->have_entry_point) {
+        fprintf(stderr, "vc1: frame before the entry point\n");
+        return -1;
+    }
+    if (vc1_start_decoder(stream)) {
+        return -1;
+    }
+    size = vc1_unescape(stream, stream->data + pos + 4, end - pos - 4, vc1_max_header_size(stream));
+    if (size < 0) {
+        return -1;
+    }
+    bit_reader_init(&br, stream->rbsp, size, 0);
+    if (vc1_parse_frame_header(stream, &br) || vc1_start_picture(stream, pos)) {
+        return -1;
+    }
+    return vc1_add_slice(stream, pos, end, br.pos, 0);
+}
+
+static int
+vc1_parse_slice(struct vc1_stream *stream, size_t pos, size_t end)
+{
+    VAPictureParameterBufferVC1 picture;
+    struct bit_reader br;
+    long size;
+    int row;
+
+    size = vc1_unescape(stream, stream->data + pos + 4, end - pos - 4, vc1_max_header_size(stream));
+    if (size < 0) {
+        return -1;
+    }
+    bit_reader_init(&br, stream->rbsp, size, 0);
+    row = bit_reader_bits(&br, 9);
+    if (bit_reader_bit(&br)) {
+        /* A copy of the picture header */
+        picture = stream->picture;
+        if (vc1_parse_frame_header(stream, &br)) {
+            return -1;
+        }
+        stream->picture = picture;
+    }
+    return vc1_add_slice(stream, pos, end, br.pos, row);
+}
+
+static int
+vc1_decode_elementary_stream(struct vc1_stream *stream)
+{
+    const uint8_t *data = stream->data;
+    size_t size = stream->size;
+    struct bit_reader br;
+    size_t pos, end;
+    long n;
+    int code, ret = 0;
+
+    for (pos = vc1_next_start_code(data, size, 0); (pos < size) && !ret; pos = end) {
+        code = data[pos + 3];
+        end = vc1_next_start_code(data, size, pos + 3);
+        if (stream->in_picture && (code >= VC1_END_OF_SEQUENCE) && (code <= VC1_SEQUENCE_HEADER) &&
+            (VC1_SLICE != code)) {
+            vc1_finish_picture(stream);
+        }
+
+        switch (code) {
+        case VC1_SEQUENCE_HEADER:
+        case VC1_ENTRY_POINT:
+            n = vc1_unescape(stream, data + pos + 4, end - pos - 4, 64);
+            if (n < 0) {
+                return -1;
+            }
+            bit_reader_init(&br, stream->rbsp, n, 0);
+            if (VC1_SEQUENCE_HEADER == code) {
+                ret = vc1_parse_sequence_header(stream, &br);
+            } else {
+                ret = vc1_parse_entry_point(stream, &br);
+            }
+            break;
+
+        case VC1_FRAME:
+            ret = vc1_parse_frame(stream, pos, end);
+            break;
+
+        case VC1_SLICE:
+            if (stream->in_picture) {
+                ret = vc1_parse_slice(stream, pos, end);
+            }
+            break;
+
+        case VC1_FIELD:
+            fprintf(stderr, "vc1: field pictures are not supported\n");
+            ret = -1;
+            break;
+
+        default:
+            break;
+        }
+    }
+    if (!ret && stream->in_picture) {
+        vc1_finish_picture(stream);
+    }
+    return ret;
+}
+
+int
+vc1_stream_decode(struct va_decoder *decoder, const uint8_t *data, size_t size)
+{
+    struct vc1_stream *stream;
+    int i, ret;
+
+    stream = calloc(1, sizeof(*stream));
+    if (NULL == stream) {
+        return -1;
+    }
+    stream->decoder = decoder;
+    stream->data = data;
+    stream->size = size;
+    stream->anchors[0] = -1;
+    stream->anchors[1] = -1;
+    vc1_init_norm6_table(stream);
+
+    if ((size >= VC1_RCV_HEADER_SIZE) && (VC1_RCV_MARKER == data[3]) && (4 == data[4]) && !data[5] &&
+        !data[6] && !data[7]) {
+        ret = vc1_decode_rcv(stream);
+    } else if ((size >= 4) && (vc1_next_start_code(data, size, 0) < size)) {
+        ret = vc1_decode_elementary_stream(stream);
+    } else {
+        fprintf(stderr, "vc1: neither an RCV file nor an elementary stream\n");
+        ret = -1;
+    }
+    if (!ret && (stream->anchors[1] >= 0)) {
+        va_decoder_output_picture(decoder, decoder->surfaces[stream->anchors[1]]);
+    }
+
+    for (i = 0; i < VC1_NUM_BITPLANES; i++) {
+        free(stream->planes[i]);
+    }
+    free(stream->bitplane);
+    free(stream->rbsp);
+    free(stream);
+    return ret;
+}
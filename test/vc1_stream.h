@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) 2012 Scott Tincman <sctincman@gmail.com>. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VC1_STREAM_H
+#define VC1_STREAM_H
+
+#include "va_client.h"
+
+/*
+ * Decodes VC-1 progressive frames, handing the pictures to the decoder's
+ * output callback in display order. Simple and Main profile streams come
+ * in the RCV container of SMPTE 421M Annex L, Advanced profile ones as an
+ * Annex E elementary stream; the format is told from the first bytes.
+ * The decoder's crop area is set to the coded size.
+ * Return 0 on success, -1 on error or for streams the parser cannot drive
+ */
+int
+vc1_stream_decode(struct va_decoder *decoder, const uint8_t *data, size_t size);
+
+#endif /* VC1_STREAM_H */